@@ -0,0 +1,167 @@
+//! Compares the per-call `write_command`/`read_command` path with the
+//! connection-scoped `CommandWriter`/`CommandReader`.
+//!
+//!     cargo bench -p common --bench codec
+//!
+//! Writes go to a sink that counts write calls, a stand-in for syscalls;
+//! reads come from an in-memory stream of pre-encoded frames.
+
+use std::hint::black_box;
+use std::io;
+use std::pin::Pin;
+use std::task::{Context, Poll};
+use std::time::{Duration, Instant};
+
+use bytes::BytesMut;
+use common::{codec::encode_frame, OutputPhase};
+use common::{read_command, write_command, Command, CommandReader, CommandV1, CommandWriter};
+use tokio::io::AsyncWrite;
+
+#[derive(Default)]
+struct CountingSink {
+    writes: u64,
+}
+
+impl AsyncWrite for CountingSink {
+    fn poll_write(
+        mut self: Pin<&mut Self>,
+        _cx: &mut Context<'_>,
+        buf: &[u8],
+    ) -> Poll<io::Result<usize>> {
+        self.writes += 1;
+        Poll::Ready(Ok(buf.len()))
+    }
+
+    fn poll_flush(self: Pin<&mut Self>, _cx: &mut Context<'_>) -> Poll<io::Result<()>> {
+        Poll::Ready(Ok(()))
+    }
+
+    fn poll_shutdown(self: Pin<&mut Self>, _cx: &mut Context<'_>) -> Poll<io::Result<()>> {
+        Poll::Ready(Ok(()))
+    }
+}
+
+fn chunk(seq: u32) -> Command {
+    Command::V1(CommandV1::InferenceResultChunk {
+        task_id: "3f2a9c1e-bench".to_string(),
+        seq,
+        delta: " token".to_string(),
+        phase: OutputPhase::Final,
+        done: false,
+        error: None,
+        prompt_tokens: 32,
+        completion_tokens: seq,
+        analysis_tokens: 0,
+        final_tokens: seq,
+    })
+}
+
+fn result(bytes: usize) -> Command {
+    Command::V1(CommandV1::InferenceResult {
+        task_id: "3f2a9c1e-bench".to_string(),
+        success: true,
+        result: Some("x".repeat(bytes)),
+        error: None,
+        execution_time_ms: 0,
+        prompt_tokens: 32,
+        completion_tokens: 512,
+    })
+}
+
+fn report(name: &str, ops: u64, elapsed: Duration, writes: Option<u64>) {
+    let ns = elapsed.as_nanos() as f64 / ops as f64;
+    match writes {
+        Some(writes) => println!(
+            "{name:<40} {ns:>10.1} ns/op {:>6.2} writes/op",
+            writes as f64 / ops as f64
+        ),
+        None => println!("{name:<40} {ns:>10.1} ns/op"),
+    }
+}
+
+async fn bench_writes(commands: &[Command], batch: usize) {
+    let ops = commands.len() as u64;
+
+    let mut sink = CountingSink::default();
+    let start = Instant::now();
+    for command in commands {
+        write_command(&mut sink, command).await.unwrap();
+    }
+    report("write_command", ops, start.elapsed(), Some(sink.writes));
+
+    let mut writer = CommandWriter::new(CountingSink::default());
+    let start = Instant::now();
+    for command in commands {
+        writer.send(command).await.unwrap();
+    }
+    let elapsed = start.elapsed();
+    report(
+        "CommandWriter::send",
+        ops,
+        elapsed,
+        Some(writer.get_mut().writes),
+    );
+
+    let mut writer = CommandWriter::new(CountingSink::default());
+    let start = Instant::now();
+    for group in commands.chunks(batch) {
+        writer.send_all(group).await.unwrap();
+    }
+    let elapsed = start.elapsed();
+    report(
+        &format!("CommandWriter::send_all (x{batch})"),
+        ops,
+        elapsed,
+        Some(writer.get_mut().writes),
+    );
+}
+
+async fn bench_reads(commands: &[Command], label: &str) {
+    let mut wire = BytesMut::new();
+    for command in commands {
+        encode_frame(command, &mut wire).unwrap();
+    }
+    let ops = commands.len() as u64;
+
+    let mut input = &wire[..];
+    let mut buf = BytesMut::with_capacity(common::MAX_MESSAGE_SIZE);
+    let start = Instant::now();
+    for _ in 0..ops {
+        black_box(read_command(&mut input, &mut buf).await.unwrap());
+    }
+    report(
+        &format!("read_command ({label})"),
+        ops,
+        start.elapsed(),
+        None,
+    );
+
+    let mut reader = CommandReader::new(&wire[..]);
+    let start = Instant::now();
+    for _ in 0..ops {
+        black_box(reader.read_command().await.unwrap());
+    }
+    report(
+        &format!("CommandReader::read_command ({label})"),
+        ops,
+        start.elapsed(),
+        None,
+    );
+}
+
+fn main() {
+    let runtime = tokio::runtime::Builder::new_current_thread()
+        .build()
+        .unwrap();
+    runtime.block_on(async {
+        let chunks: Vec<Command> = (0..200_000).map(chunk).collect();
+        let results: Vec<Command> = (0..200).map(|_| result(256 * 1024)).collect();
+
+        println!("-- streamed chunks --");
+        bench_writes(&chunks, 4).await;
+        bench_reads(&chunks, "chunks").await;
+        println!("-- 256 KiB results --");
+        bench_writes(&results, 4).await;
+        bench_reads(&results, "256 KiB").await;
+    });
+}
@@ -0,0 +1,320 @@
+//! Framing for `Command` on the wire: a 4-byte big-endian length followed by
+//! the bincode body.
+//!
+//! `CommandWriter` encodes into a buffer it keeps for the life of the
+//! connection, length prefix and body side by side, so a frame leaves in one
+//! write; commands fed before a flush leave in that same write.
+//! `CommandReader` reads ahead into its own buffer and hands frames out as
+//! `Bytes` slices of it: back-to-back frames cost one read, and a large frame
+//! is neither zero-filled nor copied before it is decoded.
+
+use anyhow::{anyhow, Result};
+use bincode::config::{self as bincode_config, Config};
+use bytes::{Buf, BufMut, Bytes, BytesMut};
+use tokio::io::{AsyncRead, AsyncReadExt, AsyncWrite, AsyncWriteExt};
+use tracing::warn;
+
+use crate::{Command, MAX_MESSAGE_SIZE};
+
+const LEN_PREFIX: usize = 4;
+const INITIAL_CAPACITY: usize = 8 * 1024;
+/// Read-ahead requested when the buffer holds no partial frame.
+const READ_CHUNK: usize = 64 * 1024;
+/// A buffer that grew past this for a large frame is released once drained.
+const RETAINED_CAPACITY: usize = 1024 * 1024;
+
+pub(crate) fn wire_config() -> impl Config {
+    bincode_config::standard()
+        .with_fixed_int_encoding()
+        .with_little_endian()
+}
+
+/// Append `command` to `dst` as one frame. `dst` is left as it was on error.
+pub fn encode_frame(command: &Command, dst: &mut BytesMut) -> Result<()> {
+    let start = dst.len();
+    dst.put_u32(0);
+    if let Err(e) =
+        bincode::encode_into_std_write(command, &mut (&mut *dst).writer(), wire_config())
+    {
+        dst.truncate(start);
+        return Err(e.into());
+    }
+    let len = dst.len() - start - LEN_PREFIX;
+    if len > MAX_MESSAGE_SIZE {
+        dst.truncate(start);
+        warn!(
+            "encode_frame: Message too large: {} bytes (max: {} bytes)",
+            len, MAX_MESSAGE_SIZE
+        );
+        return Err(anyhow!("Message too large"));
+    }
+    dst[start..start + LEN_PREFIX].copy_from_slice(&(len as u32).to_be_bytes());
+    Ok(())
+}
+
+/// Decode a frame body, without its length prefix.
+pub fn decode_frame(body: &[u8]) -> Result<Command> {
+    let (command, _) = bincode::decode_from_slice(body, wire_config())
+        .map_err(|e| anyhow!("Failed to deserialize command: {}", e))?;
+    Ok(command)
+}
+
+/// Body length announced by a frame's prefix.
+pub(crate) fn frame_len(prefix: [u8; LEN_PREFIX]) -> Result<usize> {
+    let len = u32::from_be_bytes(prefix) as usize;
+    if len > MAX_MESSAGE_SIZE {
+        warn!(
+            "read_command: Message too large: {} bytes (max: {} bytes)",
+            len, MAX_MESSAGE_SIZE
+        );
+        return Err(anyhow!("Message too large"));
+    }
+    Ok(len)
+}
+
+/// Drop the allocation of an empty buffer a large frame left oversized.
+pub(crate) fn trim(buf: &mut BytesMut) {
+    if buf.is_empty() && buf.capacity() > RETAINED_CAPACITY {
+        *buf = BytesMut::with_capacity(INITIAL_CAPACITY);
+    }
+}
+
+fn eof() -> anyhow::Error {
+    std::io::Error::from(std::io::ErrorKind::UnexpectedEof).into()
+}
+
+/// Writes commands through a reused encode buffer.
+pub struct CommandWriter<W> {
+    inner: W,
+    buf: BytesMut,
+}
+
+impl<W> CommandWriter<W> {
+    pub fn new(inner: W) -> Self {
+        Self {
+            inner,
+            buf: BytesMut::with_capacity(INITIAL_CAPACITY),
+        }
+    }
+
+    pub fn get_mut(&mut self) -> &mut W {
+        &mut self.inner
+    }
+
+    pub fn into_inner(self) -> W {
+        self.inner
+    }
+
+    /// Encoded bytes waiting for `flush`.
+    pub fn pending(&self) -> usize {
+        self.buf.len()
+    }
+
+    /// Encode `command` for the next flush; nothing is written yet.
+    pub fn feed(&mut self, command: &Command) -> Result<()> {
+        encode_frame(command, &mut self.buf)
+    }
+}
+
+impl<W: AsyncWrite + Unpin> CommandWriter<W> {
+    /// Write everything fed so far in one write.
+    pub async fn flush(&mut self) -> Result<()> {
+        if !self.buf.is_empty() {
+            let written = self.inner.write_all(&self.buf).await;
+            self.buf.clear();
+            trim(&mut self.buf);
+            written?;
+        }
+        self.inner.flush().await?;
+        Ok(())
+    }
+
+    pub async fn send(&mut self, command: &Command) -> Result<()> {
+        self.feed(command)?;
+        self.flush().await
+    }
+
+    /// Send `commands` coalesced into one write.
+    pub async fn send_all<'a, I>(&mut self, commands: I) -> Result<()>
+    where
+        I: IntoIterator<Item = &'a Command>,
+    {
+        for command in commands {
+            if let Err(e) = self.feed(command) {
+                self.buf.clear();
+                return Err(e);
+            }
+        }
+        self.flush().await
+    }
+}
+
+/// Reads commands through a read-ahead buffer.
+pub struct CommandReader<R> {
+    inner: R,
+    buf: BytesMut,
+}
+
+impl<R> CommandReader<R> {
+    pub fn new(inner: R) -> Self {
+        Self {
+            inner,
+            buf: BytesMut::with_capacity(INITIAL_CAPACITY),
+        }
+    }
+
+    pub fn get_mut(&mut self) -> &mut R {
+        &mut self.inner
+    }
+}
+
+impl<R: AsyncRead + Unpin> CommandReader<R> {
+    /// Body of the next frame. It shares the read buffer, so keeping it alive
+    /// only costs the reader a fresh allocation on its next read.
+    pub async fn read_frame(&mut self) -> Result<Bytes> {
+        trim(&mut self.buf);
+        loop {
+            if self.buf.len() >= LEN_PREFIX {
+                let mut prefix = [0u8; LEN_PREFIX];
+                prefix.copy_from_slice(&self.buf[..LEN_PREFIX]);
+                let len = frame_len(prefix)?;
+                if self.buf.len() >= LEN_PREFIX + len {
+                    self.buf.advance(LEN_PREFIX);
+                    return Ok(self.buf.split_to(len).freeze());
+                }
+                self.buf.reserve(LEN_PREFIX + len - self.buf.len());
+            } else {
+                self.buf.reserve(READ_CHUNK);
+            }
+            if self.inner.read_buf(&mut self.buf).await? == 0 {
+                return Err(eof());
+            }
+        }
+    }
+
+    pub async fn read_command(&mut self) -> Result<Command> {
+        let frame = self.read_frame().await?;
+        decode_frame(&frame)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{CommandV1, OutputPhase};
+
+    fn chunk(seq: u32, delta: &str) -> Command {
+        Command::V1(CommandV1::InferenceResultChunk {
+            task_id: "t".to_string(),
+            seq,
+            delta: delta.to_string(),
+            phase: OutputPhase::Final,
+            done: false,
+            error: None,
+            prompt_tokens: 1,
+            completion_tokens: seq,
+            analysis_tokens: 0,
+            final_tokens: seq,
+        })
+    }
+
+    fn seq_and_delta(command: &Command) -> (u32, String) {
+        match command {
+            Command::V1(CommandV1::InferenceResultChunk { seq, delta, .. }) => {
+                (*seq, delta.clone())
+            }
+            other => panic!("unexpected command {other:?}"),
+        }
+    }
+
+    #[tokio::test]
+    async fn coalesced_frames_round_trip_through_partial_reads() {
+        // A tiny pipe splits frames across reads and writes.
+        let (client, server) = tokio::io::duplex(7);
+        let large = "x".repeat(3 * READ_CHUNK);
+        let commands = vec![chunk(0, "hello"), chunk(1, &large), chunk(2, "")];
+
+        let send = {
+            let commands = commands.clone();
+            tokio::spawn(async move {
+                let mut writer = CommandWriter::new(client);
+                writer.send_all(&commands).await.unwrap();
+                assert_eq!(writer.pending(), 0);
+            })
+        };
+        let mut reader = CommandReader::new(server);
+        for expected in &commands {
+            let got = reader.read_command().await.unwrap();
+            assert_eq!(seq_and_delta(&got), seq_and_delta(expected));
+        }
+        send.await.unwrap();
+        assert!(
+            reader.read_command().await.is_err(),
+            "EOF after the writer closed"
+        );
+    }
+
+    #[tokio::test]
+    async fn frames_match_the_legacy_wire_format() {
+        let mut wire = Vec::new();
+        crate::write_command(&mut wire, &chunk(7, "abc"))
+            .await
+            .unwrap();
+
+        let mut buf = BytesMut::new();
+        encode_frame(&chunk(7, "abc"), &mut buf).unwrap();
+        assert_eq!(&buf[..], &wire[..]);
+
+        let mut reader = CommandReader::new(&wire[..]);
+        let frame = reader.read_frame().await.unwrap();
+        assert_eq!(&frame[..], &wire[LEN_PREFIX..]);
+    }
+
+    #[test]
+    fn heartbeat_v1_layout_is_unchanged() {
+        // Older peers decode V1 heartbeats field by field with fixed-int
+        // encoding; additions belong in CommandV2::WorkerStatus instead.
+        let heartbeat = Command::V1(crate::CommandV1::Heartbeat {
+            client_id: [7; 16],
+            system_info: crate::SystemInfo::default(),
+            device_count: 1,
+            device_memtotal_gb: 2,
+            device_total_tflops: 3,
+            devices_info: Vec::new(),
+        });
+        let mut buf = BytesMut::new();
+        encode_frame(&heartbeat, &mut buf).unwrap();
+        // variant tags 4 + 4, client_id 16, system_info 3 + 8 + 8,
+        // device_count 2, memtotal 4, tflops 4, empty Vec length 8
+        assert_eq!(buf.len() - LEN_PREFIX, 61);
+
+        let status = Command::V2(crate::CommandV2::WorkerStatus {
+            client_id: [7; 16],
+            resident_models: vec!["qwen".to_string()],
+            inference_stats: None,
+            perf_capacity: None,
+            task_slots: 4,
+            gpu_placement: None,
+        });
+        buf.clear();
+        encode_frame(&status, &mut buf).unwrap();
+        match decode_frame(&buf[LEN_PREFIX..]).unwrap() {
+            Command::V2(crate::CommandV2::WorkerStatus {
+                resident_models,
+                task_slots,
+                ..
+            }) => {
+                assert_eq!(resident_models, vec!["qwen".to_string()]);
+                assert_eq!(task_slots, 4);
+            }
+            other => panic!("unexpected {:?}", other),
+        }
+    }
+
+    #[tokio::test]
+    async fn rejects_oversized_prefix() {
+        let prefix = ((MAX_MESSAGE_SIZE + 1) as u32).to_be_bytes();
+        let mut reader = CommandReader::new(&prefix[..]);
+        assert!(reader.read_frame().await.is_err());
+    }
+}
@@ -1,10 +1,11 @@
-use anyhow::{anyhow, Result};
-use bincode::{self as bincode, config as bincode_config, Decode, Encode};
+use anyhow::Result;
+use bincode::{Decode, Encode};
 use serde::{Deserialize, Serialize};
 use tokio::io::{AsyncRead, AsyncReadExt, AsyncWrite, AsyncWriteExt};
-use tracing::warn;
+pub mod codec;
 pub mod config;
 use bytes::BytesMut;
+pub use codec::{CommandReader, CommandWriter};
 use config::GpuModelConfig;
 use std::fmt;
 use zeroize::Zeroize;
@@ -152,6 +153,64 @@ pub struct SystemInfo {
     pub network_tx: u64,
 }
 
+/// Inference performance of a worker since its previous heartbeat
+#[derive(Serialize, Deserialize, Encode, Decode, Debug, Clone, Default, PartialEq)]
+pub struct InferenceStats {
+    pub requests: u32,
+    pub prompt_tokens: u64,
+    /// Prompt tokens served from the KV cache instead of being prefilled.
+    pub prompt_tokens_reused: u64,
+    pub generated_tokens: u64,
+    pub avg_tokenize_ms: f32,
+    pub avg_prefill_ms: f32,
+    pub avg_decode_ms: f32,
+    /// Mean time to first token.
+    pub avg_ttft_ms: f32,
+    pub decode_tokens_per_sec: f32,
+    /// Duration of the most recent model load.
+    pub model_load_ms: u32,
+    /// KV cells held by the most recent request.
+    pub kv_cells_used: u32,
+    /// Process resident set high-water mark.
+    pub peak_rss_mb: u32,
+}
+
+/// Throughput a mobile worker expects to sustain under its performance
+/// profile and current thermal and battery limits
+#[derive(Serialize, Deserialize, Encode, Decode, Debug, Clone, Default, PartialEq)]
+pub struct PerfCapacity {
+    /// 0 max-throughput, 1 sustained, 2 battery.
+    pub profile: u8,
+    /// True while thermal or battery limits hold the engine below its profile.
+    pub throttled: bool,
+    /// Thermal level: 0 nominal, 1 light, 2 moderate, 3 severe.
+    pub thermal_level: u8,
+    pub sustainable_tokens_per_sec: f32,
+}
+
+/// How a desktop worker's llama.cpp engine spread its loaded model over
+/// its GPUs
+#[derive(Serialize, Deserialize, Encode, Decode, Debug, Clone, Default, PartialEq)]
+pub struct GpuPlacement {
+    /// Repeating layers in the model.
+    pub n_layers: u32,
+    /// Layers offloaded to the GPUs; `n_layers + 1` includes the output
+    /// layer, fewer means the rest runs on the CPU.
+    pub n_gpu_layers: u32,
+    pub devices: Vec<GpuShare>,
+}
+
+/// One GPU's part of a `GpuPlacement`
+#[derive(Serialize, Deserialize, Encode, Decode, Debug, Clone, Default, PartialEq)]
+pub struct GpuShare {
+    pub index: u16,
+    pub layers: u32,
+    /// Weights and KV cache of those layers.
+    pub used_mb: u32,
+    /// Free memory before the model was loaded.
+    pub free_mb: u32,
+}
+
 /// Commands exchanged between client and server.
 #[derive(Encode, Decode, Debug, Clone)]
 pub enum Command {
@@ -276,6 +335,25 @@ pub enum CommandV1 {
         status: DownloadStatus,
         error: Option<String>,
     },
+
+    // Embedding task from server to client; `inputs` may merge several
+    // API requests, which the server splits again on the result
+    EmbeddingTask {
+        task_id: String,
+        model: String,
+        inputs: Vec<String>,
+        normalize: bool,
+    },
+
+    // Embedding result from client to server: `inputs.len()` vectors of
+    // `dim` floats, back to back
+    EmbeddingResult {
+        task_id: String,
+        dim: u32,
+        embeddings: Vec<f32>,
+        prompt_tokens: u32,
+        error: Option<String>,
+    },
 }
 
 #[derive(Encode, Decode, Debug, Clone)]
@@ -376,6 +454,33 @@ pub enum CommandV2 {
         connection_id: [u8; 16],
         error: String,
     },
+
+    /// Worker state beyond the V1 heartbeat, sent from gpuf-c to gpuf-s right
+    /// before each `CommandV1::Heartbeat` on the logged-in connection, once
+    /// the server advertised `FEATURE_WORKER_STATUS`. Kept out of the V1
+    /// variant so its fixed-int encoding stays readable by older peers.
+    WorkerStatus {
+        client_id: [u8; 16],
+        /// Ids of the models kept loaded, most recently used first.
+        resident_models: Vec<String>,
+        /// None when the worker does not run the built-in llama.cpp engine.
+        inference_stats: Option<InferenceStats>,
+        /// None for workers without adaptive performance profiles.
+        perf_capacity: Option<PerfCapacity>,
+        /// Inference tasks the worker runs at once; 0 when it does not say.
+        task_slots: u16,
+        /// None unless the worker placed its model with `--gpu-placement auto`.
+        gpu_placement: Option<GpuPlacement>,
+    },
+
+    /// What the server decodes beyond the baseline protocol, sent from gpuf-s
+    /// right before a successful `CommandV1::LoginResult` to workers that log
+    /// in with `PROTOCOL_VERSION` or later. Workers keep to the baseline
+    /// commands until they receive it.
+    ServerFeatures {
+        /// `FEATURE_*` bits; unknown bits are ignored.
+        features: u32,
+    },
 }
 
 #[derive(Encode, Decode, Clone, PartialEq, Eq)]
@@ -519,53 +624,55 @@ pub fn process_id(id: &[u8; 32]) -> &str {
 // Max message size 10MB
 pub const MAX_MESSAGE_SIZE: usize = 10 * 1024 * 1024;
 
+/// `CommandV1::Login::version` of workers that decode
+/// `CommandV2::ServerFeatures` and `CommandV1::EmbeddingTask`; older workers
+/// drop the connection on either.
+pub const PROTOCOL_VERSION: u32 = 2;
+
+/// `ServerFeatures` bit: the server decodes `CommandV2::WorkerStatus`.
+pub const FEATURE_WORKER_STATUS: u32 = 1 << 0;
+
 /// Reads a command from an async reader.
 /// The format is a 4-byte length prefix (u32) followed by the bin-encoded command.
+/// Connections that read many commands should use `CommandReader`.
 pub async fn read_command<R: AsyncRead + Unpin>(
     reader: &mut R,
     buf: &mut BytesMut,
 ) -> Result<Command> {
     let mut len_buf = [0u8; 4];
     reader.read_exact(&mut len_buf).await?;
-    let len = u32::from_be_bytes(len_buf) as usize;
-    if len > MAX_MESSAGE_SIZE {
-        warn!(
-            "read_command: Message too large: {} bytes (max: {} bytes)",
-            len, MAX_MESSAGE_SIZE
-        );
-        return Err(anyhow!("Message too large"));
-    }
-
-    let config = bincode_config::standard()
-        .with_fixed_int_encoding()
-        .with_little_endian();
+    let len = codec::frame_len(len_buf)?;
 
+    // Read into spare capacity rather than zero-filling `len` bytes first.
     buf.clear();
-    buf.resize(len, 0);
-    reader.read_exact(buf).await?;
+    buf.reserve(len);
+    let mut body = (&mut *reader).take(len as u64);
+    while buf.len() < len {
+        if body.read_buf(buf).await? == 0 {
+            return Err(std::io::Error::from(std::io::ErrorKind::UnexpectedEof).into());
+        }
+    }
 
-    let (command, _) = bincode::decode_from_slice(buf.as_ref(), config)
-        .map_err(|e| anyhow!("Failed to deserialize command: {}", e))?;
-    Ok(command)
+    codec::decode_frame(buf)
 }
 
 /// Writes a command to an async writer.
-/// The format is a 4-byte length prefix (u32) followed by the JSON-encoded command.
+/// The format is a 4-byte length prefix (u32) followed by the bincode-encoded command.
+/// Encodes into a fresh buffer; connections that send many commands should
+/// hold a `CommandWriter`.
 pub async fn write_command<W: AsyncWrite + Unpin>(writer: &mut W, command: &Command) -> Result<()> {
-    let config = bincode_config::standard()
-        .with_fixed_int_encoding()
-        .with_little_endian();
-    let buf = bincode::encode_to_vec(command, config)?;
-    let len = buf.len() as u32;
-    if len as usize > MAX_MESSAGE_SIZE {
-        warn!(
-            "write_command: Message too large: {} bytes (max: {} bytes)",
-            len, MAX_MESSAGE_SIZE
-        );
-        return Err(anyhow!("Message too large"));
-    }
+    write_commands(writer, std::slice::from_ref(command)).await
+}
 
-    writer.write_all(&len.to_be_bytes()).await?;
+/// Writes `commands` back to back in a single write.
+pub async fn write_commands<W: AsyncWrite + Unpin>(
+    writer: &mut W,
+    commands: &[Command],
+) -> Result<()> {
+    let mut buf = BytesMut::new();
+    for command in commands {
+        codec::encode_frame(command, &mut buf)?;
+    }
     writer.write_all(&buf).await?;
     writer.flush().await?;
     Ok(())
@@ -576,49 +683,32 @@ pub async fn write_command<W: AsyncWrite + Unpin>(writer: &mut W, command: &Comm
 pub fn read_command_sync<R: std::io::Read>(reader: &mut R) -> Result<Command> {
     let mut len_buf = [0u8; 4];
     reader.read_exact(&mut len_buf)?;
-    let len = u32::from_be_bytes(len_buf) as usize;
-
-    if len > MAX_MESSAGE_SIZE {
-        warn!(
-            "read_command_sync: Message too large: {} bytes (max: {} bytes)",
-            len, MAX_MESSAGE_SIZE
-        );
-        return Err(anyhow!("Message too large"));
-    }
-
-    let config = bincode_config::standard()
-        .with_fixed_int_encoding()
-        .with_little_endian();
+    let len = codec::frame_len(len_buf)?;
 
     let mut buf = vec![0u8; len];
     reader.read_exact(&mut buf)?;
 
-    let (command, _) = bincode::decode_from_slice(&buf, config)
-        .map_err(|e| anyhow!("Failed to deserialize command: {}", e))?;
-    Ok(command)
+    codec::decode_frame(&buf)
+}
+
+thread_local! {
+    // Blocking writers run on dedicated threads; each keeps its encode buffer.
+    static SYNC_FRAME_BUF: std::cell::RefCell<BytesMut> = std::cell::RefCell::new(BytesMut::new());
 }
 
 /// Synchronous version: Writes a command to a blocking writer.
 /// The format is a 4-byte length prefix (u32) followed by the bincode-encoded command.
 pub fn write_command_sync<W: std::io::Write>(writer: &mut W, command: &Command) -> Result<()> {
-    let config = bincode_config::standard()
-        .with_fixed_int_encoding()
-        .with_little_endian();
-    let buf = bincode::encode_to_vec(command, config)?;
-    let len = buf.len() as u32;
-
-    if len as usize > MAX_MESSAGE_SIZE {
-        warn!(
-            "write_command_sync: Message too large: {} bytes (max: {} bytes)",
-            len, MAX_MESSAGE_SIZE
-        );
-        return Err(anyhow!("Message too large"));
-    }
-
-    writer.write_all(&len.to_be_bytes())?;
-    writer.write_all(&buf)?;
-    writer.flush()?;
-    Ok(())
+    SYNC_FRAME_BUF.with(|buf| {
+        let mut buf = buf.borrow_mut();
+        buf.clear();
+        codec::encode_frame(command, &mut buf)?;
+        let written = writer.write_all(&buf).and_then(|_| writer.flush());
+        buf.clear();
+        codec::trim(&mut buf);
+        written?;
+        Ok(())
+    })
 }
 
 /// Joins two streams, copying data in both directions.
@@ -0,0 +1,189 @@
+#!/bin/bash
+#
+# Build (and optionally run) the GPUFabric benchmark suite
+#
+# Usage: ./build_bench.sh check|android|ios-sim [--run] [-- bench args...]
+#
+#   check     compiles the source with the host compiler (CI); desktop
+#             builds only stub the on-device API, so there is nothing to run
+#   android   links libgpuf_c_sdk_v9.so with the NDK, pushes to
+#             /data/local/tmp and runs over adb (ABI=x86_64 for emulators)
+#   ios-sim   links the iOS simulator slice from generate_ios_sdk.sh,
+#             runs in the booted simulator via simctl
+#
+# Results land in bench_results_<target>.json next to this script. Pass
+# BASELINE=<file> to compare against an earlier run.
+#
+
+set -e
+
+SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
+PROJECT_ROOT="$(cd "$SCRIPT_DIR/../.." && pwd)"
+NDK_ROOT="${NDK_ROOT:-${ANDROID_NDK_ROOT:-${ANDROID_NDK_HOME:-$HOME/android-ndk-r27d}}}"
+SOURCE="$SCRIPT_DIR/gpuf_bench.c"
+BUILD_DIR="$SCRIPT_DIR/build"
+DEVICE_DIR="/data/local/tmp"
+ABI="${ABI:-arm64-v8a}"
+
+# Models: host paths; on Android they are pushed and referenced by basename
+MODEL="${MODEL:-$HOME/models/qwen2.5-0.5b-instruct-q4_k_m.gguf}"
+ALT_MODEL="${ALT_MODEL:-}"
+MM_MODEL="${MM_MODEL:-}"
+MMPROJ="${MMPROJ:-}"
+BASELINE="${BASELINE:-}"
+
+# Colors
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+BLUE='\033[0;34m'
+NC='\033[0m'
+
+print_step() {
+    echo -e "${BLUE}🔧 $1${NC}"
+}
+
+print_success() {
+    echo -e "${GREEN}✅ $1${NC}"
+}
+
+print_error() {
+    echo -e "${RED}❌ $1${NC}"
+}
+
+print_warning() {
+    echo -e "${YELLOW}⚠️  $1${NC}"
+}
+
+TARGET="$1"
+shift || true
+RUN=0
+if [ "$1" = "--run" ]; then
+    RUN=1
+    shift
+fi
+if [ "$1" = "--" ]; then
+    shift
+fi
+EXTRA_ARGS=("$@")
+
+# bench_args <model prefix> [<baseline path>]
+bench_args() {
+    local prefix="$1"
+    local args=(--model "$prefix$(basename "$MODEL")" --out "$OUT_NAME")
+    [ -n "$ALT_MODEL" ] && args+=(--alt-model "$prefix$(basename "$ALT_MODEL")")
+    [ -n "$MM_MODEL" ] && args+=(--mm-model "$prefix$(basename "$MM_MODEL")")
+    [ -n "$MMPROJ" ] && args+=(--mmproj "$prefix$(basename "$MMPROJ")")
+    [ -n "$2" ] && args+=(--baseline "$2")
+    echo "${args[@]}" "${EXTRA_ARGS[@]}"
+}
+
+check_host() {
+    # Desktop builds stub the on-device C API, so the host only compiles
+    print_step "Checking benchmark source with the host compiler..."
+    ${CC:-cc} -std=c11 -D_POSIX_C_SOURCE=200809L -Wall -Wextra -Werror -fsyntax-only "$SOURCE"
+    print_success "Benchmark source OK"
+}
+
+build_android() {
+    local sdk_lib="$PROJECT_ROOT/libgpuf_c_sdk_v9.so"
+    if [ ! -d "$NDK_ROOT" ]; then
+        print_error "Android NDK not found at: $NDK_ROOT"
+        echo "Please set NDK_ROOT environment variable"
+        exit 1
+    fi
+    if [ ! -f "$sdk_lib" ]; then
+        print_error "SDK library not found: $sdk_lib"
+        echo "Please run ./generate_sdk.sh first"
+        exit 1
+    fi
+
+    local triple="aarch64-linux-android"
+    [ "$ABI" = "x86_64" ] && triple="x86_64-linux-android"
+
+    print_step "Compiling for Android ($ABI)..."
+    local clang="$NDK_ROOT/toolchains/llvm/prebuilt/linux-x86_64/bin/${triple}21-clang"
+    mkdir -p "$BUILD_DIR"
+    $clang -O2 -std=c11 \
+        "$SOURCE" \
+        -o "$BUILD_DIR/gpuf_bench_android" \
+        -L"$PROJECT_ROOT" \
+        -lgpuf_c_sdk_v9 \
+        -llog -ldl -lm \
+        -pie \
+        -Wl,-rpath,'$ORIGIN'
+    print_success "Built $BUILD_DIR/gpuf_bench_android"
+
+    if [ $RUN -eq 1 ]; then
+        print_step "Pushing to device..."
+        adb push "$sdk_lib" "$DEVICE_DIR/"
+        adb push "$BUILD_DIR/gpuf_bench_android" "$DEVICE_DIR/gpuf_bench"
+        adb shell chmod +x "$DEVICE_DIR/gpuf_bench"
+        for model in "$MODEL" "$ALT_MODEL" "$MM_MODEL" "$MMPROJ"; do
+            if [ -n "$model" ] && ! adb shell "[ -f $DEVICE_DIR/$(basename "$model") ]"; then
+                adb push "$model" "$DEVICE_DIR/"
+            fi
+        done
+        local device_baseline=""
+        if [ -n "$BASELINE" ]; then
+            adb push "$BASELINE" "$DEVICE_DIR/bench_baseline.json"
+            device_baseline="$DEVICE_DIR/bench_baseline.json"
+        fi
+
+        OUT_NAME="$DEVICE_DIR/bench_results.json"
+        local status=0
+        adb shell "cd $DEVICE_DIR && LD_LIBRARY_PATH=. ./gpuf_bench $(bench_args "$DEVICE_DIR/" "$device_baseline")" \
+            || status=$?
+        adb pull "$OUT_NAME" "$SCRIPT_DIR/bench_results_android.json"
+        return $status
+    fi
+}
+
+build_ios_sim() {
+    local sim_dir="$PROJECT_ROOT/build_ios/dist/ios-arm64-simulator"
+    if [ ! -f "$sim_dir/libgpuf_c_sdk.a" ]; then
+        print_error "iOS simulator library not found: $sim_dir/libgpuf_c_sdk.a"
+        echo "Please run ./generate_ios_sdk.sh first"
+        exit 1
+    fi
+
+    print_step "Compiling for the iOS simulator (arm64)..."
+    mkdir -p "$BUILD_DIR"
+    xcrun --sdk iphonesimulator clang -O2 -std=c11 \
+        -arch arm64 -mios-simulator-version-min=14.0 \
+        "$SOURCE" "$sim_dir/libgpuf_c_sdk.a" \
+        -o "$BUILD_DIR/gpuf_bench_ios_sim" \
+        -lc++ \
+        -framework Foundation -framework Metal -framework MetalKit \
+        -framework Accelerate -framework Security -framework SystemConfiguration
+    print_success "Built $BUILD_DIR/gpuf_bench_ios_sim"
+
+    if [ $RUN -eq 1 ]; then
+        if ! xcrun simctl list devices booted | grep -q Booted; then
+            print_error "No booted simulator; boot one or run ../ios_sim_test/run_ios_sim_test.sh"
+            exit 1
+        fi
+        # Simulator processes share the host filesystem
+        OUT_NAME="$SCRIPT_DIR/bench_results_ios_sim.json"
+        xcrun simctl spawn booted "$BUILD_DIR/gpuf_bench_ios_sim" --model "$MODEL" --out "$OUT_NAME" \
+            ${ALT_MODEL:+--alt-model "$ALT_MODEL"} \
+            ${BASELINE:+--baseline "$BASELINE"} \
+            "${EXTRA_ARGS[@]}"
+    fi
+}
+
+case "$TARGET" in
+    check)
+        check_host
+        ;;
+    android)
+        build_android
+        ;;
+    ios-sim)
+        build_ios_sim
+        ;;
+    *)
+        echo "Usage: $0 check|android|ios-sim [--run] [-- bench args...]"
+        exit 1
+        ;;
+esac
@@ -0,0 +1,736 @@
+/**
+ * GPUFabric benchmark suite
+ *
+ * Brings the ad-hoc timing of test_async_real.c,
+ * android_inference_test_optimized.c, test_multimodal_streaming.c and
+ * model_switch_test.c into one reproducible run over the public gpuf_c.h
+ * API. Every scenario uses fixed prompts and sampling parameters and
+ * reports medians over --runs repetitions:
+ *
+ *   load            cold model load and warm (resident) re-acquire
+ *   text            TTFT, prefill and decode tokens/s per prompt length,
+ *                   plus TTFT with the whole prompt already in the KV cache
+ *   sessions        aggregate decode throughput of N concurrent sessions
+ *   multimodal      image request latency with a cold and a warm vision
+ *                   embedding cache (--mm-model/--mmproj)
+ *   switch          remote-worker hot swap to --alt-model and back
+ *
+ * Results are written as JSON (--out). With --baseline, every metric is
+ * compared against an earlier result file and the run fails with exit
+ * code 3 when one regresses by more than --tolerance.
+ *
+ * Build with build_bench.sh for android or ios-sim.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __APPLE__
+#include <TargetConditionals.h>
+#endif
+
+// ============================================================================
+// SDK API (declarations as in gpuf_c.h)
+// ============================================================================
+
+#define SESSION_MAX_SEQUENCES 8
+
+typedef enum PixelFormat { Rgb888 = 0, Rgba8888 = 1, Bgra8888 = 2, Nv12 = 3 } PixelFormat;
+
+struct llama_context;
+struct gpuf_multimodal_model;
+
+struct gpuf_image_planes {
+    int format;
+    uint32_t width;
+    uint32_t height;
+    const uint8_t *data;
+    uint32_t stride;
+    const uint8_t *uv_data;
+    uint32_t uv_stride;
+};
+
+struct gpuf_perf_stats {
+    uint64_t requests;
+    float model_load_ms;
+    float tokenize_ms;
+    float prefill_ms;
+    float decode_ms;
+    float ttft_ms;
+    float decode_tokens_per_second;
+    uint64_t prompt_tokens;
+    uint64_t prompt_tokens_reused;
+    uint64_t generated_tokens;
+    uint64_t kv_cells_used;
+    uint64_t peak_rss_bytes;
+};
+
+typedef void (*TokenCallback)(void *, const char *, int);
+typedef void (*CompletionCallback)(void *, const char *, int);
+
+extern const char *gpuf_version(void);
+extern int gpuf_init(void);
+extern int gpuf_cleanup(void);
+extern void llama_free(struct llama_context *ctx);
+
+extern struct llama_context *gpuf_model_registry_acquire(const char *path);
+extern int gpuf_model_registry_release(struct llama_context *ctx);
+
+extern int gpuf_start_generation_async(struct llama_context *ctx, const char *prompt,
+                                       int max_tokens, float temperature, int top_k, float top_p,
+                                       float repeat_penalty,
+                                       void (*on_token_callback)(const char *, void *),
+                                       void *user_data);
+
+extern int gpuf_session_create(struct llama_context *ctx);
+extern int gpuf_session_submit(int session, const char *prompt, int max_tokens, float temperature,
+                               int top_k, float top_p, float repeat_penalty, TokenCallback on_token,
+                               CompletionCallback on_complete, void *user_data);
+extern int gpuf_session_destroy(int session);
+
+extern struct gpuf_multimodal_model *gpuf_load_multimodal_model(const char *text_model_path,
+                                                                const char *mmproj_path);
+extern struct llama_context *gpuf_create_multimodal_context(struct gpuf_multimodal_model *model);
+extern int gpuf_generate_multimodal_pixels(struct gpuf_multimodal_model *multimodal_model,
+                                           struct llama_context *ctx, const char *text_prompt,
+                                           const struct gpuf_image_planes *planes,
+                                           uint32_t max_side, int max_tokens, float temperature,
+                                           int top_k, float top_p, float repeat_penalty,
+                                           char *output, int output_len);
+extern void gpuf_free_multimodal_model(struct gpuf_multimodal_model *multimodal_model);
+extern void gpuf_vision_cache_clear(void);
+
+extern int gpuf_perf_get_last(struct gpuf_perf_stats *stats);
+
+extern int set_remote_worker_model(const char *model_path);
+
+#define BENCH_SCHEMA_VERSION 1
+#define MAX_METRICS 128
+#define MAX_PROMPT_LENGTHS 8
+#define MAX_RUNS 32
+
+#if defined(__ANDROID__)
+#define BENCH_PLATFORM "android"
+#elif defined(__APPLE__) && TARGET_OS_SIMULATOR
+#define BENCH_PLATFORM "ios-simulator"
+#elif defined(__APPLE__) && TARGET_OS_IPHONE
+#define BENCH_PLATFORM "ios"
+#elif defined(__APPLE__)
+#define BENCH_PLATFORM "macos"
+#else
+#define BENCH_PLATFORM "linux"
+#endif
+
+// Fixed sampling parameters; llama.cpp's dist sampler is seeded by the SDK
+#define BENCH_TEMPERATURE 0.7f
+#define BENCH_TOP_K 40
+#define BENCH_TOP_P 0.9f
+#define BENCH_REPEAT_PENALTY 1.1f
+
+typedef struct {
+    const char *model;
+    const char *alt_model;
+    const char *mm_model;
+    const char *mmproj;
+    const char *out;
+    const char *baseline;
+    int prompt_lengths[MAX_PROMPT_LENGTHS];
+    int prompt_length_count;
+    int gen_tokens;
+    int runs;
+    int sessions;
+    double tolerance;
+} bench_config;
+
+typedef struct {
+    char name[64];
+    double value;
+    int higher_is_better;
+} bench_metric;
+
+static bench_metric g_metrics[MAX_METRICS];
+static int g_metric_count = 0;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+static void add_metric(const char *name, double value, int higher_is_better) {
+    if (g_metric_count >= MAX_METRICS) {
+        return;
+    }
+    bench_metric *m = &g_metrics[g_metric_count++];
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    m->value = value;
+    m->higher_is_better = higher_is_better;
+    printf("  %-32s %12.2f\n", name, value);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double median(double *values, int count) {
+    if (count <= 0) {
+        return 0.0;
+    }
+    qsort(values, (size_t)count, sizeof(double), compare_double);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2.0;
+}
+
+// ============================================================================
+// Fixed prompt set
+// ============================================================================
+
+static const char *CORPUS[] = {
+    "The river bends twice before it reaches the old mill at the edge of town.",
+    "Engineers measured the bridge every spring and logged each crack they found.",
+    "A small lantern hung by the door so late travellers could find the inn.",
+    "The library kept its maps in long drawers sorted by decade and region.",
+    "Farmers along the valley rotate wheat, barley and clover every three years.",
+    "Each evening the keeper wound the lighthouse clock and trimmed the wick.",
+    "The market opened at dawn with bread, cheese, apples and fresh fish.",
+    "Students copied the star charts by hand and compared them with the sky.",
+};
+#define CORPUS_LEN (sizeof(CORPUS) / sizeof(CORPUS[0]))
+
+/**
+ * Deterministic prompt of roughly `approx_tokens` tokens (one corpus
+ * sentence is about 16). `salt` goes first so that different runs do not
+ * share a KV prefix; the same salt reproduces the same prompt.
+ */
+static char *build_prompt(int salt, int approx_tokens) {
+    size_t cap = 256 + (size_t)approx_tokens * 8;
+    char *prompt = malloc(cap);
+    if (!prompt) {
+        return NULL;
+    }
+    size_t len = (size_t)snprintf(prompt, cap, "Note %d. Summarize the following text.\n", salt);
+    int sentences = approx_tokens / 16;
+    if (sentences < 1) {
+        sentences = 1;
+    }
+    for (int i = 0; i < sentences && len + 128 < cap; i++) {
+        len += (size_t)snprintf(prompt + len, cap - len, "%s ", CORPUS[(salt + i) % CORPUS_LEN]);
+    }
+    snprintf(prompt + len, cap - len, "\nSummary:");
+    return prompt;
+}
+
+// ============================================================================
+// Scenarios
+// ============================================================================
+
+static void ignore_token(const char *token, void *user_data) {
+    (void)token;
+    (void)user_data;
+}
+
+/** Run one completion and return its engine-side counters. */
+static int run_completion(struct llama_context *ctx, const char *prompt, int max_tokens,
+                          struct gpuf_perf_stats *stats) {
+    int generated = gpuf_start_generation_async(ctx, prompt, max_tokens, BENCH_TEMPERATURE,
+                                                BENCH_TOP_K, BENCH_TOP_P, BENCH_REPEAT_PENALTY,
+                                                ignore_token, NULL);
+    if (generated < 0) {
+        return generated;
+    }
+    return gpuf_perf_get_last(stats);
+}
+
+static struct llama_context *bench_load(const bench_config *cfg) {
+    printf("\n📦 Model load\n");
+    double start = now_ms();
+    struct llama_context *ctx = gpuf_model_registry_acquire(cfg->model);
+    double cold = now_ms() - start;
+    if (!ctx) {
+        fprintf(stderr, "❌ Failed to load %s\n", cfg->model);
+        return NULL;
+    }
+    add_metric("load_cold_ms", cold, 0);
+
+    // A resident model hands back its pooled context
+    double warm[MAX_RUNS];
+    for (int run = 0; run < cfg->runs; run++) {
+        gpuf_model_registry_release(ctx);
+        start = now_ms();
+        ctx = gpuf_model_registry_acquire(cfg->model);
+        warm[run] = now_ms() - start;
+        if (!ctx) {
+            fprintf(stderr, "❌ Failed to re-acquire %s\n", cfg->model);
+            return NULL;
+        }
+    }
+    add_metric("load_warm_ms", median(warm, cfg->runs), 0);
+    return ctx;
+}
+
+static void bench_text(const bench_config *cfg, struct llama_context *ctx) {
+    printf("\n📝 Text generation (%d tokens)\n", cfg->gen_tokens);
+    for (int l = 0; l < cfg->prompt_length_count; l++) {
+        int length = cfg->prompt_lengths[l];
+        double ttft[MAX_RUNS], prefill[MAX_RUNS], tps[MAX_RUNS], ttft_cached[MAX_RUNS];
+        int ok = 0;
+        for (int run = 0; run < cfg->runs; run++) {
+            char *prompt = build_prompt(run, length);
+            struct gpuf_perf_stats stats;
+            if (!prompt || run_completion(ctx, prompt, cfg->gen_tokens, &stats) != 0) {
+                free(prompt);
+                continue;
+            }
+            ttft[ok] = stats.ttft_ms;
+            prefill[ok] = stats.prefill_ms;
+            tps[ok] = stats.decode_tokens_per_second;
+
+            // Same prompt again: only the generated tail is re-decoded
+            run_completion(ctx, prompt, 1, &stats);
+            ttft_cached[ok] = stats.ttft_ms;
+            ok++;
+            free(prompt);
+        }
+        if (ok == 0) {
+            fprintf(stderr, "⚠️ No successful runs at prompt length %d\n", length);
+            continue;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "ttft_ms_p%d", length);
+        add_metric(name, median(ttft, ok), 0);
+        snprintf(name, sizeof(name), "prefill_ms_p%d", length);
+        add_metric(name, median(prefill, ok), 0);
+        snprintf(name, sizeof(name), "decode_tps_p%d", length);
+        add_metric(name, median(tps, ok), 1);
+        snprintf(name, sizeof(name), "ttft_cached_ms_p%d", length);
+        add_metric(name, median(ttft_cached, ok), 0);
+    }
+}
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int pending;
+    long long tokens;
+} session_wait;
+
+static void session_token(void *user_data, const char *text, int token_id) {
+    (void)user_data;
+    (void)text;
+    (void)token_id;
+}
+
+static void session_complete(void *user_data, const char *text, int token_count) {
+    (void)text;
+    session_wait *wait = user_data;
+    pthread_mutex_lock(&wait->lock);
+    wait->tokens += token_count > 0 ? token_count : 0;
+    wait->pending--;
+    pthread_cond_signal(&wait->done);
+    pthread_mutex_unlock(&wait->lock);
+}
+
+/** Aggregate tokens/s of `count` sessions decoding at once, 0 on failure. */
+static double run_sessions(const bench_config *cfg, struct llama_context *ctx, int count,
+                           int salt) {
+    int ids[SESSION_MAX_SEQUENCES];
+    int created = 0;
+    for (; created < count; created++) {
+        ids[created] = gpuf_session_create(ctx);
+        if (ids[created] <= 0) {
+            break;
+        }
+    }
+
+    session_wait wait = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0};
+    char *prompts[SESSION_MAX_SEQUENCES] = {0};
+    double start = now_ms();
+    for (int i = 0; i < created; i++) {
+        prompts[i] = build_prompt(salt * SESSION_MAX_SEQUENCES + i, cfg->prompt_lengths[0]);
+        pthread_mutex_lock(&wait.lock);
+        wait.pending++;
+        pthread_mutex_unlock(&wait.lock);
+        if (!prompts[i] ||
+            gpuf_session_submit(ids[i], prompts[i], cfg->gen_tokens, BENCH_TEMPERATURE,
+                                BENCH_TOP_K, BENCH_TOP_P, BENCH_REPEAT_PENALTY, session_token,
+                                session_complete, &wait) != 0) {
+            pthread_mutex_lock(&wait.lock);
+            wait.pending--;
+            pthread_mutex_unlock(&wait.lock);
+        }
+    }
+
+    pthread_mutex_lock(&wait.lock);
+    while (wait.pending > 0) {
+        pthread_cond_wait(&wait.done, &wait.lock);
+    }
+    pthread_mutex_unlock(&wait.lock);
+    double elapsed = now_ms() - start;
+
+    for (int i = 0; i < created; i++) {
+        gpuf_session_destroy(ids[i]);
+        free(prompts[i]);
+    }
+    if (created < count) {
+        fprintf(stderr, "⚠️ Only %d of %d sessions could be created\n", created, count);
+    }
+    return elapsed > 0.0 && created == count ? wait.tokens * 1000.0 / elapsed : 0.0;
+}
+
+static void bench_sessions(const bench_config *cfg, struct llama_context *ctx) {
+    if (cfg->sessions <= 0) {
+        return;
+    }
+    printf("\n👥 Concurrent sessions (%d)\n", cfg->sessions);
+    double single[MAX_RUNS], concurrent[MAX_RUNS];
+    for (int run = 0; run < cfg->runs; run++) {
+        single[run] = run_sessions(cfg, ctx, 1, 2 * run);
+        concurrent[run] = run_sessions(cfg, ctx, cfg->sessions, 2 * run + 1);
+    }
+    add_metric("session_tps_x1", median(single, cfg->runs), 1);
+    char name[64];
+    snprintf(name, sizeof(name), "session_tps_x%d", cfg->sessions);
+    add_metric(name, median(concurrent, cfg->runs), 1);
+}
+
+static void bench_multimodal(const bench_config *cfg) {
+    if (!cfg->mm_model || !cfg->mmproj) {
+        return;
+    }
+    printf("\n🖼️ Multimodal\n");
+    double start = now_ms();
+    struct gpuf_multimodal_model *mm = gpuf_load_multimodal_model(cfg->mm_model, cfg->mmproj);
+    if (!mm) {
+        fprintf(stderr, "⚠️ Multimodal model unavailable on this platform, skipped\n");
+        return;
+    }
+    add_metric("mm_load_ms", now_ms() - start, 0);
+    struct llama_context *ctx = gpuf_create_multimodal_context(mm);
+
+    // Synthetic 448x448 RGB gradient; new contents per run defeat the cache
+    const uint32_t side = 448;
+    uint8_t *pixels = malloc((size_t)side * side * 3);
+    char output[1024];
+    double cold[MAX_RUNS], warm[MAX_RUNS];
+    int ok = 0;
+    for (int run = 0; pixels && run < cfg->runs; run++) {
+        for (uint32_t y = 0; y < side; y++) {
+            for (uint32_t x = 0; x < side; x++) {
+                uint8_t *p = pixels + ((size_t)y * side + x) * 3;
+                p[0] = (uint8_t)(x + run * 17);
+                p[1] = (uint8_t)(y + run * 29);
+                p[2] = (uint8_t)((x ^ y) + run);
+            }
+        }
+        struct gpuf_image_planes planes = {Rgb888, side, side, pixels, side * 3, NULL, 0};
+        const char *prompt = "<__media__>\nDescribe the image in one word.";
+
+        gpuf_vision_cache_clear();
+        start = now_ms();
+        int miss = gpuf_generate_multimodal_pixels(mm, ctx, prompt, &planes, 0, 1,
+                                                   BENCH_TEMPERATURE, BENCH_TOP_K, BENCH_TOP_P,
+                                                   BENCH_REPEAT_PENALTY, output, sizeof(output));
+        double miss_ms = now_ms() - start;
+        start = now_ms();
+        int hit = gpuf_generate_multimodal_pixels(mm, ctx, prompt, &planes, 0, 1,
+                                                  BENCH_TEMPERATURE, BENCH_TOP_K, BENCH_TOP_P,
+                                                  BENCH_REPEAT_PENALTY, output, sizeof(output));
+        double hit_ms = now_ms() - start;
+        if (miss >= 0 && hit >= 0) {
+            cold[ok] = miss_ms;
+            warm[ok] = hit_ms;
+            ok++;
+        }
+    }
+    if (ok > 0) {
+        add_metric("mm_encode_ms", median(cold, ok), 0);
+        add_metric("mm_encode_cached_ms", median(warm, ok), 0);
+    } else {
+        fprintf(stderr, "⚠️ Multimodal generation failed, skipped\n");
+    }
+
+    free(pixels);
+    if (ctx) {
+        llama_free(ctx);
+    }
+    gpuf_free_multimodal_model(mm);
+}
+
+static void bench_switch(const bench_config *cfg) {
+    if (!cfg->alt_model) {
+        return;
+    }
+    printf("\n🔄 Model switch\n");
+    if (set_remote_worker_model(cfg->model) != 0) {
+        fprintf(stderr, "⚠️ Remote worker model switching unavailable, skipped\n");
+        return;
+    }
+    double to_alt[MAX_RUNS], back[MAX_RUNS];
+    int ok = 0;
+    for (int run = 0; run < cfg->runs; run++) {
+        double start = now_ms();
+        int a = set_remote_worker_model(cfg->alt_model);
+        double mid = now_ms();
+        int b = set_remote_worker_model(cfg->model);
+        double end = now_ms();
+        if (a == 0 && b == 0) {
+            to_alt[ok] = mid - start;
+            back[ok] = end - mid;
+            ok++;
+        }
+    }
+    if (ok > 0) {
+        // The first swap loads the alternate model; later ones find it resident
+        add_metric("switch_ms", median(to_alt, ok), 0);
+        add_metric("switch_back_ms", median(back, ok), 0);
+    }
+}
+
+// ============================================================================
+// Results
+// ============================================================================
+
+static char *read_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (data) {
+        size_t read = fread(data, 1, (size_t)size, f);
+        data[read] = '\0';
+    }
+    fclose(f);
+    return data;
+}
+
+/** Find `"name": <number>` inside the "metrics" object of a result file. */
+static int baseline_value(const char *json, const char *name, double *value) {
+    const char *metrics = strstr(json, "\"metrics\"");
+    if (!metrics) {
+        return 0;
+    }
+    const char *end = strchr(metrics, '}');
+    char key[80];
+    snprintf(key, sizeof(key), "\"%s\":", name);
+    const char *p = strstr(metrics, key);
+    if (!p || (end && p > end)) {
+        return 0;
+    }
+    p += strlen(key);
+    char *parsed;
+    *value = strtod(p, &parsed);
+    return parsed != p;
+}
+
+/** Relative change, signed so that positive is always worse. */
+static double regression_of(const bench_metric *m, double base) {
+    double change = (m->value - base) / base;
+    return m->higher_is_better ? -change : change;
+}
+
+static void write_json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', out);
+        }
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static int write_results(const bench_config *cfg, FILE *out, const char *baseline) {
+    int regressions = 0;
+    fprintf(out, "{\n");
+    fprintf(out, "  \"schema\": %d,\n", BENCH_SCHEMA_VERSION);
+    fprintf(out, "  \"sdk_version\": \"%s\",\n", gpuf_version() ? gpuf_version() : "unknown");
+    fprintf(out, "  \"platform\": \"%s\",\n", BENCH_PLATFORM);
+    fprintf(out, "  \"timestamp\": %lld,\n", (long long)time(NULL));
+    fprintf(out, "  \"config\": {\n");
+    fprintf(out, "    \"model\": ");
+    write_json_string(out, cfg->model);
+    fprintf(out, ",\n");
+    fprintf(out, "    \"gen_tokens\": %d,\n", cfg->gen_tokens);
+    fprintf(out, "    \"runs\": %d,\n", cfg->runs);
+    fprintf(out, "    \"sessions\": %d,\n", cfg->sessions);
+    fprintf(out, "    \"prompt_lengths\": [");
+    for (int i = 0; i < cfg->prompt_length_count; i++) {
+        fprintf(out, "%s%d", i ? ", " : "", cfg->prompt_lengths[i]);
+    }
+    fprintf(out, "]\n  },\n");
+
+    fprintf(out, "  \"metrics\": {\n");
+    for (int i = 0; i < g_metric_count; i++) {
+        fprintf(out, "    \"%s\": %.3f%s\n", g_metrics[i].name, g_metrics[i].value,
+                i + 1 < g_metric_count ? "," : "");
+    }
+    fprintf(out, "  }");
+
+    if (baseline) {
+        printf("\n📊 Baseline comparison (tolerance %.0f%%)\n", cfg->tolerance * 100.0);
+        fprintf(out, ",\n  \"comparison\": [\n");
+        int first = 1;
+        for (int i = 0; i < g_metric_count; i++) {
+            const bench_metric *m = &g_metrics[i];
+            double base;
+            if (!baseline_value(baseline, m->name, &base) || base <= 0.0) {
+                continue;
+            }
+            double worse = regression_of(m, base);
+            int regressed = worse > cfg->tolerance;
+            regressions += regressed;
+            printf("  %-32s %12.2f -> %12.2f  %+7.1f%%%s\n", m->name, base, m->value,
+                   (m->value - base) / base * 100.0, regressed ? "  ❌ REGRESSION" : "");
+            fprintf(out,
+                    "%s    {\"metric\": \"%s\", \"baseline\": %.3f, \"value\": %.3f, "
+                    "\"change_pct\": %.2f, \"regression\": %s}",
+                    first ? "" : ",\n", m->name, base, m->value,
+                    (m->value - base) / base * 100.0, regressed ? "true" : "false");
+            first = 0;
+        }
+        fprintf(out, "\n  ],\n  \"regressions\": %d", regressions);
+    }
+    fprintf(out, "\n}\n");
+    return regressions;
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s --model PATH [options]\n"
+            "  --alt-model PATH       second model for the switch scenario\n"
+            "  --mm-model PATH        multimodal text model\n"
+            "  --mmproj PATH          multimodal projector\n"
+            "  --prompt-tokens LIST   comma-separated prompt lengths (default 32,128,512)\n"
+            "  --gen-tokens N         tokens generated per request (default 64)\n"
+            "  --runs N               repetitions per scenario (default 3, max %d)\n"
+            "  --sessions N           concurrent sessions (default 4, 0 disables)\n"
+            "  --out PATH             result JSON (default bench_results.json)\n"
+            "  --baseline PATH        earlier result JSON to compare against\n"
+            "  --tolerance F          allowed relative regression (default 0.10)\n",
+            argv0, MAX_RUNS);
+}
+
+static int parse_lengths(bench_config *cfg, const char *list) {
+    cfg->prompt_length_count = 0;
+    const char *p = list;
+    while (*p && cfg->prompt_length_count < MAX_PROMPT_LENGTHS) {
+        char *end;
+        long value = strtol(p, &end, 10);
+        if (end == p || value <= 0) {
+            return -1;
+        }
+        cfg->prompt_lengths[cfg->prompt_length_count++] = (int)value;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return cfg->prompt_length_count > 0 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    bench_config cfg = {
+        .out = "bench_results.json",
+        .prompt_lengths = {32, 128, 512},
+        .prompt_length_count = 3,
+        .gen_tokens = 64,
+        .runs = 3,
+        .sessions = 4,
+        .tolerance = 0.10,
+    };
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value) {
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+        if (!strcmp(arg, "--model")) {
+            cfg.model = value;
+        } else if (!strcmp(arg, "--alt-model")) {
+            cfg.alt_model = value;
+        } else if (!strcmp(arg, "--mm-model")) {
+            cfg.mm_model = value;
+        } else if (!strcmp(arg, "--mmproj")) {
+            cfg.mmproj = value;
+        } else if (!strcmp(arg, "--prompt-tokens")) {
+            if (parse_lengths(&cfg, value) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (!strcmp(arg, "--gen-tokens")) {
+            cfg.gen_tokens = atoi(value);
+        } else if (!strcmp(arg, "--runs")) {
+            cfg.runs = atoi(value);
+        } else if (!strcmp(arg, "--sessions")) {
+            cfg.sessions = atoi(value);
+        } else if (!strcmp(arg, "--out")) {
+            cfg.out = value;
+        } else if (!strcmp(arg, "--baseline")) {
+            cfg.baseline = value;
+        } else if (!strcmp(arg, "--tolerance")) {
+            cfg.tolerance = atof(value);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!cfg.model || cfg.runs < 1 || cfg.runs > MAX_RUNS || cfg.gen_tokens < 1 ||
+        cfg.sessions < 0 || cfg.sessions > SESSION_MAX_SEQUENCES) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char *baseline = NULL;
+    if (cfg.baseline && !(baseline = read_file(cfg.baseline))) {
+        fprintf(stderr, "❌ Cannot read baseline %s: %s\n", cfg.baseline, strerror(errno));
+        return 1;
+    }
+
+    printf("🚀 GPUFabric benchmark (%s, %d runs)\n", BENCH_PLATFORM, cfg.runs);
+    if (gpuf_init() < 0) {
+        fprintf(stderr, "❌ gpuf_init failed\n");
+        return 1;
+    }
+
+    struct llama_context *ctx = bench_load(&cfg);
+    if (!ctx) {
+        return 1;
+    }
+    bench_text(&cfg, ctx);
+    bench_sessions(&cfg, ctx);
+    gpuf_model_registry_release(ctx);
+    bench_multimodal(&cfg);
+    bench_switch(&cfg);
+
+    FILE *out = fopen(cfg.out, "w");
+    if (!out) {
+        fprintf(stderr, "❌ Cannot write %s: %s\n", cfg.out, strerror(errno));
+        return 1;
+    }
+    int regressions = write_results(&cfg, out, baseline);
+    fclose(out);
+    free(baseline);
+    printf("\n✅ Results written to %s\n", cfg.out);
+
+    gpuf_cleanup();
+    if (regressions > 0) {
+        fprintf(stderr, "❌ %d metric(s) regressed beyond %.0f%%\n", regressions,
+                cfg.tolerance * 100.0);
+        return 3;
+    }
+    return 0;
+}
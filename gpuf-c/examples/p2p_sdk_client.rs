@@ -1022,15 +1022,88 @@ struct Args {
     prompt: String,
     #[arg(long, default_value_t = 50)]
     max_tokens: u32,
+    /// gpuf-s inference API (e.g. http://127.0.0.1:8081). When set, the
+    /// request is streamed through the relay if the P2P data plane fails.
+    #[arg(long)]
+    relay_api_url: Option<String>,
+    /// Bearer token for `--relay-api-url`.
+    #[arg(long)]
+    api_key: Option<String>,
 }
 
 #[tokio::main]
 async fn main() -> Result<()> {
     let args = Args::parse();
 
+    let out = match p2p_completion(&args).await {
+        Ok(out) => out,
+        Err(e) => {
+            let Some(api_url) = args.relay_api_url.as_deref() else {
+                return Err(e);
+            };
+            println!("P2P data plane unavailable ({e}), falling back to relay");
+            relay_completion(&args, api_url).await?
+        }
+    };
+
+    println!("Output:\n{}", out);
+    Ok(())
+}
+
+/// Stream the completion through the gpuf-s relay (`/v1/completions` with
+/// SSE), pinned to the same worker via `x-target-client-id`.
+async fn relay_completion(args: &Args, api_url: &str) -> Result<String> {
+    use futures_util::StreamExt;
+
+    let url = format!("{}/v1/completions", api_url.trim_end_matches('/'));
+    let body = serde_json::json!({
+        "prompt": args.prompt,
+        "max_tokens": args.max_tokens,
+        "stream": true,
+    });
+    let mut req = reqwest::Client::new()
+        .post(&url)
+        .header("x-target-client-id", &args.target_client_id)
+        .json(&body);
+    if let Some(key) = &args.api_key {
+        req = req.bearer_auth(key);
+    }
+    let resp = req.send().await?;
+    if !resp.status().is_success() {
+        let status = resp.status();
+        let text = resp.text().await.unwrap_or_default();
+        return Err(anyhow!("relay completion failed: {status} {text}"));
+    }
+
+    let mut out = String::new();
+    let mut pending = String::new();
+    let mut body = resp.bytes_stream();
+    while let Some(bytes) = body.next().await {
+        pending.push_str(&String::from_utf8_lossy(&bytes?));
+        while let Some(end) = pending.find('\n') {
+            let line: String = pending.drain(..=end).collect();
+            let Some(data) = line.trim_end().strip_prefix("data:") else {
+                continue;
+            };
+            let data = data.trim_start();
+            if data == "[DONE]" {
+                return Ok(out);
+            }
+            let event: serde_json::Value = serde_json::from_str(data)?;
+            if let Some(text) = event["choices"][0]["text"].as_str() {
+                out.push_str(text);
+                println!("relay_result: {}", text);
+            }
+        }
+    }
+    Ok(out)
+}
+
+/// Run the request over the direct UDP data plane, falling back to TURN/UDP.
+async fn p2p_completion(args: &Args) -> Result<String> {
     let target_client_id = parse_client_id_hex(&args.target_client_id)?;
-    let source_client_id = match args.source_client_id {
-        Some(v) => parse_client_id_hex(&v)?,
+    let source_client_id = match &args.source_client_id {
+        Some(v) => parse_client_id_hex(v)?,
         None => *uuid::Uuid::new_v4().as_bytes(),
     };
     let connection_id = *uuid::Uuid::new_v4().as_bytes();
@@ -1063,32 +1136,44 @@ async fn main() -> Result<()> {
     let mut buf = BytesMut::with_capacity(MAX_MESSAGE_SIZE);
     let mut turn_cfg: Option<(Vec<String>, String, String)> = None;
     let mut data_plane_secret: Option<[u8; 32]> = None;
-    let peer_candidates = loop {
-        let cmd = read_command(&mut stream, &mut buf).await?;
-        match cmd {
-            Command::V2(CommandV2::P2PConnectionConfig {
-                connection_id: cid,
-                turn_urls,
-                turn_username,
-                turn_password,
-                data_plane_secret: secret,
-                ..
-            }) if cid == connection_id => {
-                data_plane_secret = Some(secret.into_inner());
-                turn_cfg = Some((turn_urls, turn_username, turn_password.into_inner()));
-            }
-            Command::V2(CommandV2::P2PCandidates {
-                connection_id: cid,
-                candidates,
-                ..
-            }) if cid == connection_id => {
-                break candidates;
-            }
-            _ => {
-                // ignore
+    let peer_candidates = timeout(Duration::from_secs(15), async {
+        loop {
+            let cmd = read_command(&mut stream, &mut buf).await?;
+            match cmd {
+                Command::V2(CommandV2::P2PConnectionConfig {
+                    connection_id: cid,
+                    turn_urls,
+                    turn_username,
+                    turn_password,
+                    data_plane_secret: secret,
+                    ..
+                }) if cid == connection_id => {
+                    data_plane_secret = Some(secret.into_inner());
+                    turn_cfg = Some((turn_urls, turn_username, turn_password.into_inner()));
+                }
+                Command::V2(CommandV2::P2PCandidates {
+                    connection_id: cid,
+                    candidates,
+                    ..
+                }) if cid == connection_id => {
+                    break Ok::<_, anyhow::Error>(candidates);
+                }
+                // The worker gave up on this connection; don't wait for candidates.
+                Command::V2(CommandV2::P2PConnectionFailed {
+                    connection_id: cid,
+                    error,
+                    ..
+                }) if cid == connection_id => {
+                    break Err(anyhow!("P2P connection failed: {error}"));
+                }
+                _ => {
+                    // ignore
+                }
             }
         }
-    };
+    })
+    .await
+    .map_err(|_| anyhow!("timed out waiting for P2P candidates"))??;
 
     let direct_udp = peer_candidates
         .iter()
@@ -1123,7 +1208,7 @@ async fn main() -> Result<()> {
         connection_id,
         task_id: task_id.clone(),
         model: None,
-        prompt: args.prompt,
+        prompt: args.prompt.clone(),
         max_tokens: args.max_tokens,
         temperature: 0.7,
         top_k: 40,
@@ -1163,6 +1248,8 @@ async fn main() -> Result<()> {
         let mut buf = vec![0u8; 64 * 1024];
         let mut inflight: std::collections::HashMap<u32, std::collections::HashMap<u16, Vec<u8>>> =
             std::collections::HashMap::new();
+        // A lost ACK makes the worker resend a message we already have.
+        let mut completed: std::collections::HashSet<u32> = std::collections::HashSet::new();
         loop {
             let (n, from) = timeout(Duration::from_secs(15), socket.recv_from(&mut buf)).await??;
             if from != direct_udp {
@@ -1202,6 +1289,9 @@ async fn main() -> Result<()> {
                 continue;
             };
             inflight.remove(&msg_id);
+            if !completed.insert(msg_id) {
+                continue;
+            }
 
             let cmd = udp_decode_command(&full)?;
             match cmd {
@@ -1279,6 +1369,7 @@ async fn main() -> Result<()> {
                 u32,
                 std::collections::HashMap<u16, Vec<u8>>,
             > = std::collections::HashMap::new();
+            let mut completed: std::collections::HashSet<u32> = std::collections::HashSet::new();
             let mut buf = vec![0u8; 4096];
             loop {
                 let (peer, data) = if let Some((p, d)) = inbox.pop_front() {
@@ -1329,6 +1420,9 @@ async fn main() -> Result<()> {
                     continue;
                 };
                 inflight.remove(&msg_id);
+                if !completed.insert(msg_id) {
+                    continue;
+                }
                 let cmd = udp_decode_command(&full)?;
                 match cmd {
                     Command::V2(CommandV2::P2PInferenceChunk {
@@ -1359,6 +1453,5 @@ async fn main() -> Result<()> {
         }
     };
 
-    println!("P2P output:\n{}", out);
-    Ok(())
+    Ok(out)
 }
@@ -10,6 +10,74 @@
 
 #define DEFAULT_OUTPUT_LIMIT (256 * 1024)
 
+/**
+ * Number of named prefix snapshots kept in memory; the oldest is evicted.
+ */
+#define MAX_PREFIX_SNAPSHOTS 4
+
+/**
+ * Released contexts kept per resident model for reuse.
+ */
+#define MAX_POOLED_CONTEXTS 2
+
+/**
+ * Upper bound on concurrent sessions per context (excluding sequence 0).
+ */
+#define SESSION_MAX_SEQUENCES 8
+
+/**
+ * Upper bound on tokens proposed per round.
+ */
+#define MAX_DRAFT_TOKENS 16
+
+/**
+ * Default byte budget of the embedding cache, in megabytes.
+ */
+#define VISION_CACHE_DEFAULT_BUDGET_MB 64
+
+/**
+ * Requests the rolling aggregate covers.
+ */
+#define PERF_WINDOW 32
+
+/**
+ * Number of recent tokens the repeat penalty looks back over.
+ */
+#define REPEAT_PENALTY_WINDOW 64
+
+/**
+ * f16 K/V cache elements (`GGML_TYPE_F16`).
+ */
+#define KV_CACHE_F16 1
+
+/**
+ * 4-bit K/V cache elements (`GGML_TYPE_Q4_0`).
+ */
+#define KV_CACHE_Q4_0 2
+
+/**
+ * 8-bit K/V cache elements (`GGML_TYPE_Q8_0`).
+ */
+#define KV_CACHE_Q8_0 8
+
+/**
+ * Let llama.cpp decide whether to use flash attention.
+ */
+#define FLASH_ATTN_AUTO -1
+
+#define FLASH_ATTN_DISABLED 0
+
+#define FLASH_ATTN_ENABLED 1
+
+#define PERF_PROFILE_MAX_THROUGHPUT 0
+
+/**
+ * The default: the thread count workers always used, backed off when hot.
+ */
+#define PERF_PROFILE_SUSTAINED 1
+
+#define PERF_PROFILE_BATTERY 2
+
 typedef enum ProjectorType {
   Unknown = 0,
   LLaVA = 1,
@@ -19,6 +87,34 @@ typedef enum ProjectorType {
   Pixtral = 5,
 } ProjectorType;
 
+/**
+ * Pixel layouts accepted by `gpuf_generate_multimodal_pixels`.
+ */
+typedef enum PixelFormat {
+  /**
+   * Packed 8-bit R, G, B.
+   */
+  Rgb888 = 0,
+  /**
+   * Packed 8-bit R, G, B, A (alpha ignored).
+   */
+  Rgba8888 = 1,
+  /**
+   * Packed 8-bit B, G, R, A (alpha ignored), e.g. `kCVPixelFormatType_32BGRA`.
+   */
+  Bgra8888 = 2,
+  /**
+   * Full-range BT.601 Y plane plus interleaved CbCr plane at half
+   * resolution, e.g. `kCVPixelFormatType_420YpCbCr8BiPlanarFullRange`.
+   */
+  Nv12 = 3,
+} PixelFormat;
+
+/**
+ * Opaque stream handle shared by the generating thread and the host.
+ */
+typedef struct gpuf_stream gpuf_stream;
+
 typedef struct llama_model {
   uint8_t _private[0];
 } llama_model;
@@ -168,6 +264,206 @@ typedef struct gpuf_multimodal_model {
   CString _media_marker;
 } gpuf_multimodal_model;
 
+/**
+ * Speculative decoding counters of one target context, accumulated since
+ * the draft was attached.
+ */
+typedef struct gpuf_speculative_stats {
+  /**
+   * Tokens proposed by the draft model.
+   */
+  uint64_t drafted_tokens;
+  /**
+   * Proposed tokens the target model accepted.
+   */
+  uint64_t accepted_tokens;
+  /**
+   * Batched `llama_decode` calls on the target model.
+   */
+  uint64_t target_decodes;
+  /**
+   * Tokens emitted to callers.
+   */
+  uint64_t generated_tokens;
+  /**
+   * `accepted_tokens / drafted_tokens`, 0 before the first proposal.
+   */
+  float acceptance_rate;
+  /**
+   * Generated tokens per second of speculative generation time.
+   */
+  float tokens_per_second;
+} gpuf_speculative_stats;
+
+/**
+ * Counters of the vision embedding cache since process start or the last
+ * `gpuf_vision_cache_clear`.
+ */
+typedef struct gpuf_vision_cache_stats {
+  /**
+   * Image chunks served from the cache.
+   */
+  uint64_t hits;
+  /**
+   * Image chunks that had to be encoded.
+   */
+  uint64_t misses;
+  /**
+   * Cached images.
+   */
+  uint64_t entries;
+  /**
+   * Bytes of cached embeddings.
+   */
+  uint64_t bytes;
+  /**
+   * Current byte budget.
+   */
+  uint64_t budget_bytes;
+} gpuf_vision_cache_stats;
+
+/**
+ * A caller-owned image in one of the `PixelFormat` layouts.
+ */
+typedef struct gpuf_image_planes {
+  /**
+   * A `PixelFormat` value.
+   */
+  int format;
+  uint32_t width;
+  uint32_t height;
+  /**
+   * Packed pixels, or the Y plane for `Nv12`.
+   */
+  const uint8_t *data;
+  /**
+   * Bytes between the starts of two rows of `data`.
+   */
+  uint32_t stride;
+  /**
+   * Interleaved CbCr plane for `Nv12`, unused otherwise.
+   */
+  const uint8_t *uv_data;
+  /**
+   * Bytes between the starts of two rows of `uv_data`.
+   */
+  uint32_t uv_stride;
+} gpuf_image_planes;
+
+/**
+ * Performance of one request, or an aggregate over several.
+ */
+typedef struct gpuf_perf_stats {
+  /**
+   * Requests covered: 1 for the last request, up to `PERF_WINDOW` for
+   * the rolling aggregate.
+   */
+  uint64_t requests;
+  /**
+   * Duration of the most recent model load.
+   */
+  float model_load_ms;
+  float tokenize_ms;
+  float prefill_ms;
+  float decode_ms;
+  /**
+   * Time from the start of the request to the first sampled token.
+   */
+  float ttft_ms;
+  /**
+   * Generated tokens per second of decode time.
+   */
+  float decode_tokens_per_second;
+  uint64_t prompt_tokens;
+  /**
+   * Prompt tokens served from the KV cache instead of being prefilled.
+   */
+  uint64_t prompt_tokens_reused;
+  uint64_t generated_tokens;
+  /**
+   * KV cells held by the request's sequence when it finished.
+   */
+  uint64_t kv_cells_used;
+  /**
+   * Process resident set high-water mark.
+   */
+  uint64_t peak_rss_bytes;
+} gpuf_perf_stats;
+
+/**
+ * Options of `gpuf_create_context_ex`. Zero sizes keep the defaults of
+ * `gpuf_context_options_default`.
+ */
+typedef struct gpuf_context_options {
+  /**
+   * Context size in tokens, shared by all sequences.
+   */
+  uint32_t n_ctx;
+  /**
+   * Tokens submitted per `llama_decode` call.
+   */
+  uint32_t n_batch;
+  /**
+   * Tokens computed per graph evaluation; at most `n_batch`.
+   */
+  uint32_t n_ubatch;
+  /**
+   * One of the `KV_CACHE_*` types.
+   */
+  int type_k;
+  /**
+   * One of the `KV_CACHE_*` types; quantized V requires flash attention.
+   */
+  int type_v;
+  /**
+   * One of the `FLASH_ATTN_*` modes.
+   */
+  int flash_attn;
+  /**
+   * Non-zero to shift the context instead of failing when it is full.
+   */
+  int context_shift;
+  /**
+   * Leading tokens the shift keeps; negative keeps the system turn.
+   */
+  int n_keep;
+} gpuf_context_options;
+
+/**
+ * Current profile, limits and sustainable throughput.
+ */
+typedef struct gpuf_perf_profile_status {
+  /**
+   * One of the `PERF_PROFILE_*` values.
+   */
+  int profile;
+  /**
+   * 0 nominal, 1 light, 2 moderate, 3 severe.
+   */
+  int thermal_level;
+  /**
+   * -1 when unknown.
+   */
+  int battery_percent;
+  int charging;
+  int n_threads;
+  int n_threads_batch;
+  /**
+   * Tokens per prefill `llama_decode`, 0 for the context's `n_batch`.
+   */
+  int prefill_batch;
+  /**
+   * Non-zero while thermal or battery limits hold the engine below its
+   * profile.
+   */
+  int throttled;
+  /**
+   * Decode tokens/s expected at the current limits, 0 before the first
+   * request.
+   */
+  float sustainable_tokens_per_second;
+} gpuf_perf_profile_status;
+
 /**
  * Token callback: called for each generated token
  * Parameters: user_data, token_text, token_id
@@ -376,6 +672,12 @@ bool gpuf_load_model_has_error(void);
  */
 struct llama_model *gpuf_load_model_get_result(void);
 
+/**
+ * Get the context created and warmed by `gpuf_load_model_async_start`
+ * (only valid after completion with warm start enabled; null otherwise)
+ */
+struct llama_context *gpuf_load_model_get_context(void);
+
 /**
  * Wait for loading to complete (blocking)
  */
@@ -592,6 +894,21 @@ int gpuf_start_generation_async(struct llama_context *ctx,
                                 void (*on_token_callback)(const char*, void*),
                                 void *user_data);
 
+/**
+ * Like `gpuf_start_generation_async`, but sample with `sampler` from
+ * `gpuf_sampler_create` instead of per-call parameters. The sampler keeps
+ * its penalty window and random state across calls.
+ *
+ * # Safety
+ * `sampler` must be live and not used by another request at the same time.
+ */
+int gpuf_start_generation_with_sampler(struct llama_context *ctx,
+                                       const char *prompt,
+                                       int max_tokens,
+                                       struct llama_sampler *sampler,
+                                       void (*on_token_callback)(const char*, void*),
+                                       void *user_data);
+
 /**
  * Simple single token generation for testing
  */
@@ -601,6 +918,522 @@ int gpuf_generate_single_token(const struct llama_model *model,
                                char *output,
                                int output_len);
 
+/**
+ * Create a generation session on `ctx`.
+ *
+ * Each session owns one sequence of the context's KV cache, so up to
+ * `n_seq_max - 1` sessions can generate concurrently; their decode steps are
+ * merged into one `llama_decode` batch per iteration.
+ *
+ * Returns a positive session id, -1 for an invalid context or -2 when every
+ * sequence of the context is already taken.
+ */
+int gpuf_session_create(struct llama_context *ctx);
+
+/**
+ * Queue a prompt on `session` and return immediately.
+ *
+ * `on_token` receives `(user_data, text, token_id)` for every emitted UTF-8
+ * chunk and `on_complete` receives `(user_data, full_text, token_count)` once
+ * the request ends. Both run on the context's session worker thread.
+ *
+ * Returns 0 on success, -1 for invalid arguments, -2 for an unknown session,
+ * -3 if the session already has a request in flight and -4 if the prompt
+ * cannot be tokenized or does not fit the context.
+ *
+ * # Safety
+ * `prompt` must be a valid NUL-terminated string for the duration of this
+ * call. `user_data` must stay valid until `on_complete` has been called.
+ */
+int gpuf_session_submit(int session,
+                        const char *prompt,
+                        int max_tokens,
+                        float temperature,
+                        int top_k,
+                        float top_p,
+                        float repeat_penalty,
+                        TokenCallback on_token,
+                        CompletionCallback on_complete,
+                        void *user_data);
+
+/**
+ * Cancel the request running on `session`. Other sessions on the same
+ * context keep generating; `on_complete` still fires with the partial text.
+ *
+ * Returns 0 on success or -2 for an unknown session.
+ */
+int gpuf_session_cancel(int session);
+
+/**
+ * Release `session` and its sequence. A request still in flight is
+ * cancelled and the sequence is freed after its `on_complete` callback.
+ *
+ * Returns 0 on success or -2 for an unknown session.
+ */
+int gpuf_session_destroy(int session);
+
+/**
+ * Embedding width of the model behind `ctx`, i.e. the floats
+ * `gpuf_embed_batch` writes per text. Returns -1 for a null context.
+ */
+int gpuf_embedding_size(struct llama_context *ctx);
+
+/**
+ * Embed `n_texts` texts and write their vectors back to back into `out`
+ * (`gpuf_embedding_size(ctx)` floats each, in input order).
+ *
+ * Texts are packed as separate sequences into `llama_decode` batches of up
+ * to `n_batch` tokens. The context's pooling type decides the vector;
+ * without pooling the token embeddings are averaged. Non-zero `normalize`
+ * scales every vector to unit length.
+ *
+ * Returns the number of vectors written, -1 for invalid arguments, -2 if
+ * `out_len` is too small, -3 if decoding failed, -4 if a text is empty or
+ * longer than one micro-batch (`n_ubatch`) and -5 for a reranking context.
+ *
+ * # Safety
+ * `ctx` must be a live context not used by sessions during the call,
+ * `texts` must point to `n_texts` valid NUL-terminated strings and `out` to
+ * `out_len` writable floats.
+ */
+int gpuf_embed_batch(struct llama_context *ctx,
+                     const char *const *texts,
+                     int n_texts,
+                     float *out,
+                     uintptr_t out_len,
+                     int normalize);
+
+/**
+ * Number of prompt tokens the last request on `ctx` reused from the KV
+ * cache instead of prefilling them again.
+ */
+int gpuf_prefix_reused_tokens(struct llama_context *ctx);
+
+/**
+ * Save the tokens resident in sequence 0 of `ctx` as snapshot `name`,
+ * replacing an older snapshot of the same name. At most
+ * `MAX_PREFIX_SNAPSHOTS` are kept; the oldest is evicted first.
+ *
+ * Returns the number of tokens saved, -1 for invalid arguments, -2 if
+ * nothing is resident and -3 if llama.cpp could not serialize the state.
+ *
+ * # Safety
+ * `ctx` must be a live context not used for generation during the call and
+ * `name` a valid NUL-terminated string.
+ */
+int gpuf_prefix_snapshot_save(struct llama_context *ctx, const char *name);
+
+/**
+ * Replace sequence 0 of `ctx` with snapshot `name`, so the next request
+ * only prefills what follows the snapshot's tokens.
+ *
+ * Returns the number of restored tokens, -1 for invalid arguments, -2 for
+ * an unknown snapshot, -3 if llama.cpp rejected the state and -4 if the
+ * snapshot was taken with a different model.
+ *
+ * # Safety
+ * `ctx` must be a live context not used for generation during the call and
+ * `name` a valid NUL-terminated string.
+ */
+int gpuf_prefix_snapshot_restore(struct llama_context *ctx, const char *name);
+
+/**
+ * Drop snapshot `name`. Returns 0 on success, -1 for an invalid name or -2
+ * if no such snapshot exists.
+ */
+int gpuf_prefix_snapshot_drop(const char *name);
+
+/**
+ * Create a token stream for `gpuf_start_generation_stream`.
+ *
+ * The ring holds up to `token_capacity` tokens and `text_capacity` bytes of
+ * UTF-8 text (0 selects a default). `on_ready(user_data)` is called from the
+ * generating thread after `flush_tokens` tokens or once the oldest unread
+ * token is `flush_ms` old, and once more when generation ends; it must not
+ * block. Free the stream with `gpuf_stream_free`.
+ */
+gpuf_stream *gpuf_stream_create(int token_capacity,
+                                int text_capacity,
+                                int flush_tokens,
+                                int flush_ms,
+                                void (*on_ready)(void*),
+                                void *user_data);
+
+/**
+ * Drain `stream` without blocking.
+ *
+ * Copies up to `max_tokens` token ids into `tokens_out` and up to
+ * `text_cap` bytes of text into `text_out` (not NUL-terminated, never split
+ * inside a UTF-8 sequence; the length goes to `text_len_out`). Either
+ * buffer may be null with a zero size. `finished_out` is set to 1 once the
+ * generation has ended and everything was read.
+ *
+ * Returns the number of tokens copied or -1 for invalid arguments.
+ *
+ * # Safety
+ * `stream` must come from `gpuf_stream_create`, the output buffers must be
+ * valid for the given sizes and the out pointers null or writable.
+ */
+int gpuf_stream_poll(gpuf_stream *stream,
+                     LlamaToken *tokens_out,
+                     int max_tokens,
+                     uint8_t *text_out,
+                     int text_cap,
+                     int *text_len_out,
+                     int *finished_out);
+
+/**
+ * Free a stream created by `gpuf_stream_create`.
+ *
+ * # Safety
+ * No generation may be writing to `stream`; stop it with
+ * `gpuf_stop_generation` and wait for `gpuf_start_generation_stream` to
+ * return first.
+ */
+void gpuf_stream_free(gpuf_stream *stream);
+
+/**
+ * Generate like `gpuf_start_generation_async`, but write tokens and text
+ * into `stream` instead of calling back once per token. Blocks until
+ * generation ends; run it on a worker thread and drain `stream` from
+ * another with `gpuf_stream_poll`. If the host stops draining, generation
+ * waits for room in the ring (or for `gpuf_stop_generation`).
+ *
+ * Returns the number of generated tokens or -1 on error.
+ */
+int gpuf_start_generation_stream(struct llama_context *ctx,
+                                 const char *prompt,
+                                 int max_tokens,
+                                 float temperature,
+                                 int top_k,
+                                 float top_p,
+                                 float repeat_penalty,
+                                 gpuf_stream *stream);
+
+/**
+ * Limit the memory used by resident models and their contexts to
+ * `budget_mb` megabytes (0 = unlimited, the default). Idle models are
+ * evicted least recently used first, immediately and before later loads.
+ */
+void gpuf_model_registry_set_budget_mb(uint64_t budget_mb);
+
+/**
+ * Lease a context on the model at `path`, loading the model if it is not
+ * resident yet. A context released earlier is reused when available.
+ *
+ * Returns null if the model cannot be loaded or no context can be created.
+ * Hand the context back with `gpuf_model_registry_release`; never free it
+ * or its model directly.
+ *
+ * # Safety
+ * `path` must be a valid NUL-terminated string.
+ */
+struct llama_context *gpuf_model_registry_acquire(const char *path);
+
+/**
+ * Return a context leased with `gpuf_model_registry_acquire`. Destroy its
+ * sessions first. Returns 0 on success, -1 for a null context or -2 if
+ * `ctx` is not leased.
+ */
+int gpuf_model_registry_release(struct llama_context *ctx);
+
+/**
+ * Unload the model at `path` and its pooled contexts.
+ *
+ * Returns 0 on success, -1 for an invalid path, -2 if the model is not
+ * resident and -3 while one of its contexts is leased.
+ *
+ * # Safety
+ * `path` must be a valid NUL-terminated string.
+ */
+int gpuf_model_registry_evict(const char *path);
+
+/**
+ * Number of models currently resident in the registry.
+ */
+int gpuf_model_registry_resident_count(void);
+
+/**
+ * Pair `ctx` with `draft_ctx`, a context on a smaller model with the same
+ * vocabulary (e.g. loaded with `gpuf_load_model` and `gpuf_create_context`).
+ * From then on `gpuf_start_generation_async`, `gpuf_start_generation_stream`
+ * and `gpuf_generate_with_sampling` on `ctx` let the draft propose up to
+ * `n_draft` tokens (at most `MAX_DRAFT_TOKENS`) that the target verifies in
+ * a single batched decode. Attaching again replaces the draft and resets the
+ * statistics.
+ *
+ * Returns 0 on success, -1 for invalid arguments and -2 if the vocabularies
+ * differ.
+ *
+ * # Safety
+ * Both contexts must stay alive until `gpuf_speculative_detach`, and the
+ * draft context must not be used for anything else meanwhile.
+ */
+int gpuf_speculative_attach(struct llama_context *ctx,
+                            struct llama_context *draft_ctx,
+                            int n_draft);
+
+/**
+ * Stop speculative decoding on `ctx`. The draft context is not freed.
+ * Returns 0 on success or -2 if no draft was attached.
+ */
+int gpuf_speculative_detach(struct llama_context *ctx);
+
+/**
+ * Copy the speculative decoding statistics of `ctx` into `stats`.
+ * Returns 0 on success, -1 for a null `stats` and -2 if no draft is
+ * attached.
+ *
+ * # Safety
+ * `stats` must point to writable memory for one `gpuf_speculative_stats`.
+ */
+int gpuf_speculative_get_stats(struct llama_context *ctx, struct gpuf_speculative_stats *stats);
+
+/**
+ * Limit the vision embedding cache to `budget_mb` megabytes (default
+ * `VISION_CACHE_DEFAULT_BUDGET_MB`, 0 disables caching). Least recently
+ * used images are evicted first.
+ */
+void gpuf_vision_cache_set_budget_mb(uint64_t budget_mb);
+
+/**
+ * Drop all cached image embeddings and reset the hit/miss counters.
+ */
+void gpuf_vision_cache_clear(void);
+
+/**
+ * Copy the vision embedding cache counters into `stats`.
+ * Returns 0 on success or -1 for a null `stats`.
+ *
+ * # Safety
+ * `stats` must point to writable memory for one `gpuf_vision_cache_stats`.
+ */
+int gpuf_vision_cache_get_stats(struct gpuf_vision_cache_stats *stats);
+
+/**
+ * Generate from a raw frame instead of encoded image bytes. The frame is
+ * converted to RGB and resampled so its longest side is at most `max_side`
+ * pixels (0 keeps the source size) on a worker thread, while the prompt
+ * text before the media marker is prefilled. Repeated frames hit the
+ * vision embedding cache like `gpuf_generate_multimodal`.
+ *
+ * Returns the number of bytes written to `output` (NUL-terminated), -1 on
+ * failure and -2 for an invalid `planes` description.
+ *
+ * # Safety
+ * - `multimodal_model` must come from `gpuf_load_multimodal_model`; `ctx`
+ *   may be null to use a temporary context.
+ * - `text_prompt` must be a valid NUL-terminated string.
+ * - The planes in `planes` must be readable for the sizes implied by their
+ *   dimensions and strides until the call returns.
+ * - `output` must be writable for `output_len` bytes.
+ */
+int gpuf_generate_multimodal_pixels(struct gpuf_multimodal_model *multimodal_model,
+                                    struct llama_context *ctx,
+                                    const char *text_prompt,
+                                    const struct gpuf_image_planes *planes,
+                                    uint32_t max_side,
+                                    int max_tokens,
+                                    float temperature,
+                                    int top_k,
+                                    float top_p,
+                                    float repeat_penalty,
+                                    char *output,
+                                    int output_len);
+
+int gpuf_generate_multimodal_pixels(struct gpuf_multimodal_model *_multimodal_model,
+                                    struct llama_context *_ctx,
+                                    const char *_text_prompt,
+                                    const struct gpuf_image_planes *_planes,
+                                    uint32_t _max_side,
+                                    int _max_tokens,
+                                    float _temperature,
+                                    int _top_k,
+                                    float _top_p,
+                                    float _repeat_penalty,
+                                    char *_output,
+                                    int _output_len);
+
+/**
+ * Like `gpuf_generate_multimodal_pixels`, reading the frame straight from
+ * an `AHardwareBuffer` (RGBA/RGBX/RGB 8888 or YUV_420_888). The buffer is
+ * locked for CPU reads for the duration of the conversion.
+ *
+ * Returns the number of bytes written to `output`, -1 on failure, -2 for
+ * an unsupported buffer format and -3 if the buffer cannot be locked.
+ *
+ * # Safety
+ * `hardware_buffer` must be a valid `AHardwareBuffer*` with CPU read usage;
+ * see `gpuf_generate_multimodal_pixels` for the other arguments.
+ */
+int gpuf_generate_multimodal_hardware_buffer(struct gpuf_multimodal_model *multimodal_model,
+                                             struct llama_context *ctx,
+                                             const char *text_prompt,
+                                             void *hardware_buffer,
+                                             uint32_t max_side,
+                                             int max_tokens,
+                                             float temperature,
+                                             int top_k,
+                                             float top_p,
+                                             float repeat_penalty,
+                                             char *output,
+                                             int output_len);
+
+/**
+ * Copy the counters of the most recent request into `stats`. Every field
+ * is 0 before the first request finishes.
+ * Returns 0 on success or -1 for a null `stats`.
+ *
+ * # Safety
+ * `stats` must point to writable memory for one `gpuf_perf_stats`.
+ */
+int gpuf_perf_get_last(struct gpuf_perf_stats *stats);
+
+/**
+ * Copy means over the last `PERF_WINDOW` requests into `stats`: phase
+ * times and TTFT are per-request means, token counts are sums and
+ * `kv_cells_used` is that of the latest request.
+ * Returns 0 on success or -1 for a null `stats`.
+ *
+ * # Safety
+ * `stats` must point to writable memory for one `gpuf_perf_stats`.
+ */
+int gpuf_perf_get_aggregate(struct gpuf_perf_stats *stats);
+
+/**
+ * Forget recorded requests. The last model load time is kept.
+ */
+void gpuf_perf_reset(void);
+
+/**
+ * Create a reusable sampler: repeat penalty over the last
+ * `REPEAT_PENALTY_WINDOW` tokens, then top-k (`top_k <= 0` disables),
+ * top-p (`>= 1` disables), min-p (`<= 0` disables) and temperature
+ * (`<= 0` samples greedily), drawing with `seed`.
+ *
+ * The handle is a regular llama.cpp sampler: pass it to
+ * `gpuf_start_generation_with_sampler` or `gpuf_sampler_sample`, one
+ * request at a time. Its penalty window and random state carry over
+ * between requests until `gpuf_sampler_reset`. Free it with
+ * `gpuf_sampler_free`. Returns null on failure.
+ */
+struct llama_sampler *gpuf_sampler_create(float temperature,
+                                          int top_k,
+                                          float top_p,
+                                          float min_p,
+                                          float repeat_penalty,
+                                          uint32_t seed);
+
+/**
+ * Clear the penalty window and restart the random state of `sampler`.
+ *
+ * # Safety
+ * `sampler` must come from `gpuf_sampler_create` and not be in use.
+ */
+void gpuf_sampler_reset(struct llama_sampler *sampler);
+
+/**
+ * Sample and accept a token from the logits of batch position `idx` of
+ * `ctx` (-1 for the last). Returns the token or -1 on invalid arguments.
+ *
+ * # Safety
+ * `sampler` must be live and unused by other threads; `ctx` must hold
+ * logits for `idx`.
+ */
+LlamaToken gpuf_sampler_sample(struct llama_sampler *sampler, struct llama_context *ctx, int idx);
+
+/**
+ * Free a sampler from `gpuf_sampler_create`.
+ *
+ * # Safety
+ * `sampler` must not be used afterwards.
+ */
+void gpuf_sampler_free(struct llama_sampler *sampler);
+
+/**
+ * Write the default options of `gpuf_create_context` to `options`.
+ * Returns 0 on success or -1 for a null `options`.
+ *
+ * # Safety
+ * `options` must point to writable memory for one `gpuf_context_options`.
+ */
+int gpuf_context_options_default(struct gpuf_context_options *options);
+
+/**
+ * Create a context on `model` with `options` (null for the defaults).
+ * Returns null for invalid options or when llama.cpp cannot allocate the
+ * context, e.g. a quantized V cache on a backend without flash attention.
+ *
+ * # Safety
+ * `model` must be a live model from `gpuf_load_model`; `options` must be
+ * null or point to a `gpuf_context_options`.
+ */
+struct llama_context *gpuf_create_context_ex(struct llama_model *model,
+                                             const struct gpuf_context_options *options);
+
+/**
+ * Use `options` for contexts the model registry creates from now on,
+ * including those of the remote worker. Pooled contexts keep the options
+ * they were created with. Returns 0 on success or -1 for invalid options.
+ *
+ * # Safety
+ * `options` must be null or point to a `gpuf_context_options`.
+ */
+int gpuf_model_registry_set_context_options(const struct gpuf_context_options *options);
+
+/**
+ * Select a `PERF_PROFILE_*` profile for the following requests.
+ * Returns 0 on success or -1 for an unknown profile.
+ */
+int gpuf_set_perf_profile(int profile);
+
+/**
+ * Report device signals the SDK cannot read itself: `thermal_level` 0-3
+ * (map Android's `PowerManager` thermal status or iOS's
+ * `ProcessInfo.thermalState`), `battery_percent` 0-100 or -1 when unknown,
+ * and whether the device is charging. A report overrides the sensors for
+ * two minutes. Returns 0 on success or -1 for out-of-range values.
+ */
+int gpuf_report_device_state(int thermal_level, int battery_percent, int charging);
+
+/**
+ * Copy the current profile, the limits it yields under the latest device
+ * signals and the sustainable throughput into `status`.
+ * Returns 0 on success or -1 for a null `status`.
+ *
+ * # Safety
+ * `status` must point to writable memory for one
+ * `gpuf_perf_profile_status`.
+ */
+int gpuf_get_perf_profile_status(struct gpuf_perf_profile_status *status);
+
+/**
+ * Turn warm start on. Cache files go to `cache_dir`, or to a `.gpuf-warm`
+ * directory next to each model file when it is null. Takes effect for
+ * contexts created afterwards. Returns 0, or -1 for an invalid `cache_dir`.
+ *
+ * # Safety
+ * `cache_dir` must be null or a valid NUL-terminated C string.
+ */
+int gpuf_warm_start_enable(const char *cache_dir);
+
+/**
+ * Turn warm start off and forget the registered prompts. Cache files stay
+ * on disk.
+ */
+void gpuf_warm_start_disable(void);
+
+/**
+ * Register `prompt`, already rendered with the model's chat template
+ * (e.g. the full system turn), to be warmed under the snapshot `name`.
+ * Re-registering a name replaces its text. Returns the number of prompts,
+ * -1 for invalid arguments or -2 when `MAX_PREFIX_SNAPSHOTS` are registered.
+ *
+ * # Safety
+ * `name` and `prompt` must be valid NUL-terminated C strings.
+ */
+int gpuf_warm_start_add_prompt(const char *name, const char *prompt);
+
 /**
  * Validate mobile TLS policy inputs before a wrapper enables remote worker TLS.
  *
@@ -659,7 +1492,8 @@ int start_remote_worker(const char *_server_addr,
  * Set remote worker model (C API) - Safe Hot Swapping Version
  *
  * This function supports safe hot swapping without stopping the worker.
- * Uses coordination mutex to ensure no inference requests access freed memory.
+ * Tasks lease the serving model, so the old model is only released after
+ * its in-flight tasks have finished.
  *
  * # Parameters
  * - `model_path`: Path to the model file (.gguf)
@@ -676,13 +1510,64 @@ int start_remote_worker(const char *_server_addr,
  *
  * # Hot Swapping
  * This function can be called multiple times without stopping the worker.
- * Inference requests will be briefly paused during the swap but the worker
- * remains connected and continues processing afterward.
+ * The new model is loaded and warmed up while the old one keeps serving
+ * and stays advertised; only the final pointer flip is atomic. Models are
+ * kept in the model registry, so switching back to one that is still
+ * resident skips the GGUF load. Use `set_remote_worker_model_async` to
+ * load in the background.
  */
 int set_remote_worker_model(const char *model_path);
 
 int set_remote_worker_model(const char *_model_path);
 
+/**
+ * Start a background hot swap to `model_path` and return immediately.
+ *
+ * Progress is reported through `gpuf_load_model_get_status`,
+ * `gpuf_load_model_get_progress` and `gpuf_load_model_wait`, like
+ * `gpuf_load_model_async_start`. The current model keeps serving until the
+ * swap completes. The pointer from `gpuf_load_model_get_result` belongs to
+ * the model registry and must not be freed.
+ *
+ * # Returns
+ * - `0`: Swap started
+ * - `-1`: Backend initialization failed
+ * - `-2`: Path conversion failed
+ * - `-5`: Another background load is still running
+ *
+ * # Safety
+ * Caller must ensure `model_path` is a valid null-terminated C string
+ */
+int set_remote_worker_model_async(const char *model_path);
+
+int set_remote_worker_model_async(const char *_model_path);
+
+/**
+ * Configure a draft model for speculative decoding on the remote worker.
+ *
+ * The draft is kept in the model registry and paired with the serving
+ * context, now and after every later `set_remote_worker_model` swap whose
+ * model shares the draft's vocabulary. Passing a null `draft_path` turns
+ * speculative decoding off again.
+ *
+ * # Parameters
+ * - `draft_path`: Path to a small model with the target's vocabulary (.gguf)
+ * - `n_draft`: Tokens proposed per round, at most `MAX_DRAFT_TOKENS`
+ *
+ * # Returns
+ * - `0`: Success
+ * - `-1`: Backend initialization failed or `n_draft` is not positive
+ * - `-2`: Path conversion failed, or the serving model's vocabulary differs
+ * - `-3`: Model loading failed
+ * - `-4`: Context creation failed
+ *
+ * # Safety
+ * Caller must ensure `draft_path` is null or a valid null-terminated C string
+ */
+int set_remote_worker_draft_model(const char *draft_path, int n_draft);
+
+int set_remote_worker_draft_model(const char *_draft_path, int _n_draft);
+
 /**
  * Start remote worker background tasks (C API)
  */
@@ -1036,6 +1921,116 @@ void Java_com_gpuf_c_GPUEngine_freeMultimodalModel(JNIEnv _env,
                                                    JClass _class,
                                                    jlong multimodal_model_ptr);
 
+/**
+ * Generate text with sampling parameters using direct buffers
+ *
+ * Java signature:
+ * public static native int generateTextDirect(ByteBuffer prompt, int promptLen, ByteBuffer output, int maxTokens, float temperature, int topK, float topP, float repeatPenalty);
+ *
+ * `prompt` and `output` must be direct buffers. The result is written to
+ * `output` as NUL-terminated UTF-8.
+ *
+ * Returns: bytes written (excluding the NUL), -1 if no model is loaded, -2
+ * for a heap, empty or too short buffer, or another negative value when
+ * generation failed
+ */
+jint Java_com_gpuf_c_GPUEngine_generateTextDirect(JNIEnv env,
+                                                  JClass _class,
+                                                  JByteBuffer prompt,
+                                                  jint prompt_len,
+                                                  JByteBuffer output,
+                                                  jint max_tokens,
+                                                  jfloat temperature,
+                                                  jint top_k,
+                                                  jfloat top_p,
+                                                  jfloat repeat_penalty);
+
+/**
+ * Generate with multimodal input using direct buffers
+ *
+ * Java signature:
+ * public static native int generateMultimodalDirect(long multimodalModelPtr, long ctxPtr, ByteBuffer prompt, int promptLen, ByteBuffer image, int imageLen, ByteBuffer output, int maxTokens, float temperature, int topK, float topP, float repeatPenalty);
+ *
+ * The image bytes are read in place; pass a null `image` for a text-only
+ * prompt.
+ *
+ * Returns: bytes written to `output`, -1 for an invalid model or context,
+ * -2 for a heap or too short buffer, or another negative value when
+ * generation failed
+ */
+jint Java_com_gpuf_c_GPUEngine_generateMultimodalDirect(JNIEnv env,
+                                                        JClass _class,
+                                                        jlong multimodal_model_ptr,
+                                                        jlong ctx_ptr,
+                                                        JByteBuffer prompt,
+                                                        jint prompt_len,
+                                                        JByteBuffer image,
+                                                        jint image_len,
+                                                        JByteBuffer output,
+                                                        jint max_tokens,
+                                                        jfloat temperature,
+                                                        jint top_k,
+                                                        jfloat top_p,
+                                                        jfloat repeat_penalty);
+
+/**
+ * Register the token sink used by `startGenerationDirect`
+ *
+ * Java signature:
+ * public static native int registerTokenSink(Object sink, int textCapacity, int flushTokens, int flushMs);
+ *
+ * `sink` must implement `void onTokens(ByteBuffer utf8, int length, int
+ * tokenCount, boolean finished)`. It is called on one native thread with
+ * the next `length` bytes of UTF-8 text (never split inside a character) at
+ * the start of a direct buffer that is reused for every call, so read them
+ * before returning. Batches are cut every `flushTokens` tokens or
+ * `flushMs` milliseconds (0 selects the defaults). Registering again
+ * replaces the previous sink.
+ *
+ * Returns: 0 on success, -1 on JNI failure, -2 while a generation is running
+ */
+jint Java_com_gpuf_c_GPUEngine_registerTokenSink(JNIEnv env,
+                                                 JClass _class,
+                                                 JObject sink,
+                                                 jint text_capacity,
+                                                 jint flush_tokens,
+                                                 jint flush_ms);
+
+/**
+ * Stop the token sink thread and release the Java sink
+ *
+ * Java signature:
+ * public static native int unregisterTokenSink();
+ *
+ * Returns: 0 on success, -2 while a generation is running
+ */
+jint Java_com_gpuf_c_GPUEngine_unregisterTokenSink(JNIEnv _env, JClass _class);
+
+/**
+ * Generate into the registered token sink
+ *
+ * Java signature:
+ * public static native int startGenerationDirect(long ctxPtr, ByteBuffer prompt, int promptLen, int maxTokens, float temperature, int topK, float topP, float repeatPenalty);
+ *
+ * Blocks like `startGenerationAsync` while the sink thread delivers text in
+ * batches; the last `onTokens` call has `finished` set. Stop early with
+ * `stopGeneration`.
+ *
+ * Returns: generated token count, -1 for an invalid context, no registered
+ * sink or a failed generation, -2 for an unusable prompt buffer, -3 while
+ * another generation uses the sink
+ */
+jint Java_com_gpuf_c_GPUEngine_startGenerationDirect(JNIEnv env,
+                                                     JClass _class,
+                                                     jlong ctx_ptr,
+                                                     JByteBuffer prompt,
+                                                     jint prompt_len,
+                                                     jint max_tokens,
+                                                     jfloat temperature,
+                                                     jint top_k,
+                                                     jfloat top_p,
+                                                     jfloat repeat_penalty);
+
 /**
  * Java signature:
  * public static native int validateMobileTlsPolicy(
@@ -15,8 +15,26 @@ typedef void (*gpuf_status_callback)(const char *message, void *user_data);
 
 struct llama_model;
 struct llama_context;
+struct llama_sampler;
 struct gpuf_multimodal_model;
 
+/* Pixel layouts for gpuf_image_planes.format */
+#define GPUF_PIXEL_FORMAT_RGB888 0
+#define GPUF_PIXEL_FORMAT_RGBA8888 1
+#define GPUF_PIXEL_FORMAT_BGRA8888 2 /* kCVPixelFormatType_32BGRA */
+#define GPUF_PIXEL_FORMAT_NV12 3     /* kCVPixelFormatType_420YpCbCr8BiPlanarFullRange */
+
+/* A locked CVPixelBuffer's planes: base address and bytes-per-row of each */
+struct gpuf_image_planes {
+    int format;
+    uint32_t width;
+    uint32_t height;
+    const uint8_t *data;
+    uint32_t stride;
+    const uint8_t *uv_data;
+    uint32_t uv_stride;
+};
+
 int gpuf_init(void);
 int gpuf_cleanup(void);
 const char *gpuf_version(void);
@@ -85,6 +103,117 @@ int gpuf_register_remote_worker_callback(gpuf_status_callback callback, void *us
 int get_remote_worker_status(char *buffer, size_t buffer_size);
 int stop_remote_worker(void);
 
+/* Per-request performance counters (see gpuf_c.h for field docs) */
+#define PERF_WINDOW 32
+
+struct gpuf_perf_stats {
+    uint64_t requests;
+    float model_load_ms;
+    float tokenize_ms;
+    float prefill_ms;
+    float decode_ms;
+    float ttft_ms;
+    float decode_tokens_per_second;
+    uint64_t prompt_tokens;
+    uint64_t prompt_tokens_reused;
+    uint64_t generated_tokens;
+    uint64_t kv_cells_used;
+    uint64_t peak_rss_bytes;
+};
+
+int gpuf_perf_get_last(struct gpuf_perf_stats *stats);
+int gpuf_perf_get_aggregate(struct gpuf_perf_stats *stats);
+void gpuf_perf_reset(void);
+
+/* Reusable samplers (see gpuf_c.h); one request at a time per handle */
+#define REPEAT_PENALTY_WINDOW 64
+
+struct llama_sampler *gpuf_sampler_create(
+    float temperature,
+    int top_k,
+    float top_p,
+    float min_p,
+    float repeat_penalty,
+    uint32_t seed
+);
+void gpuf_sampler_reset(struct llama_sampler *sampler);
+int32_t gpuf_sampler_sample(struct llama_sampler *sampler, struct llama_context *ctx, int idx);
+void gpuf_sampler_free(struct llama_sampler *sampler);
+int gpuf_start_generation_with_sampler(
+    struct llama_context *ctx,
+    const char *prompt,
+    int max_tokens,
+    struct llama_sampler *sampler,
+    void (*on_token_callback)(const char *, void *),
+    void *user_data
+);
+
+/* Context options (see gpuf_c.h); KV_CACHE_* are ggml type ids */
+#define KV_CACHE_F16 1
+#define KV_CACHE_Q4_0 2
+#define KV_CACHE_Q8_0 8
+#define FLASH_ATTN_AUTO -1
+#define FLASH_ATTN_DISABLED 0
+#define FLASH_ATTN_ENABLED 1
+
+struct gpuf_context_options {
+    uint32_t n_ctx;
+    uint32_t n_batch;
+    uint32_t n_ubatch;
+    int type_k;
+    int type_v;
+    int flash_attn;
+    int context_shift;
+    int n_keep;
+};
+
+int gpuf_context_options_default(struct gpuf_context_options *options);
+struct llama_context *gpuf_create_context_ex(
+    struct llama_model *model,
+    const struct gpuf_context_options *options
+);
+int gpuf_model_registry_set_context_options(const struct gpuf_context_options *options);
+
+/* Performance profiles (see gpuf_c.h); report ProcessInfo.thermalState
+   (0-3) and UIDevice battery state, iOS has no sensors the SDK can read */
+#define PERF_PROFILE_MAX_THROUGHPUT 0
+#define PERF_PROFILE_SUSTAINED 1
+#define PERF_PROFILE_BATTERY 2
+
+struct gpuf_perf_profile_status {
+    int profile;
+    int thermal_level;
+    int battery_percent;
+    int charging;
+    int n_threads;
+    int n_threads_batch;
+    int prefill_batch;
+    int throttled;
+    float sustainable_tokens_per_second;
+};
+
+int gpuf_set_perf_profile(int profile);
+int gpuf_report_device_state(int thermal_level, int battery_percent, int charging);
+int gpuf_get_perf_profile_status(struct gpuf_perf_profile_status *status);
+
+/* Warm start: system prompts registered here are restored from state files
+   next to the model (or in cache_dir) whenever a context is created, and
+   prefilled and saved on a miss */
+int gpuf_warm_start_enable(const char *cache_dir);
+void gpuf_warm_start_disable(void);
+int gpuf_warm_start_add_prompt(const char *name, const char *prompt);
+
+/* Batched embeddings (see gpuf_c.h); out holds n_texts * gpuf_embedding_size(ctx) floats */
+int gpuf_embedding_size(struct llama_context *ctx);
+int gpuf_embed_batch(
+    struct llama_context *ctx,
+    const char *const *texts,
+    int n_texts,
+    float *out,
+    size_t out_len,
+    int normalize
+);
+
 struct gpuf_multimodal_model *gpuf_load_multimodal_model(
     const char *text_model_path,
     const char *mmproj_path
@@ -109,6 +238,21 @@ int gpuf_generate_multimodal(
     int output_buffer_size
 );
 
+int gpuf_generate_multimodal_pixels(
+    struct gpuf_multimodal_model *multimodal_model,
+    struct llama_context *context,
+    const char *text_prompt,
+    const struct gpuf_image_planes *planes,
+    uint32_t max_side,
+    int max_tokens,
+    float temperature,
+    int top_k,
+    float top_p,
+    float repeat_penalty,
+    char *output_buffer,
+    int output_buffer_size
+);
+
 void gpuf_free_multimodal_model(struct gpuf_multimodal_model *multimodal_model);
 bool gpuf_multimodal_supports_vision(struct gpuf_multimodal_model *multimodal_model);
 int gpuf_get_multimodal_info(struct gpuf_multimodal_model *multimodal_model, bool *has_vision);
@@ -0,0 +1,418 @@
+// ============================================================================
+// Chat templates and incremental prompt tokenization
+// ============================================================================
+//
+// Chat requests carry the whole conversation. Rendering it used to read the
+// GGUF chat template through `llama_model_meta_val_str` on every turn, and
+// the rendered prompt was tokenized from scratch (twice: once to count it,
+// once to decode it). The template is now resolved once per model. The
+// token sequences of recent prompts are kept per vocabulary, so when a new
+// prompt extends one of them (the next turn of the same conversation) only
+// the appended text is tokenized. The resulting tokens share their prefix
+// with what `prefix_cache` keeps resident, so prefill starts after it too.
+// SentencePiece vocabularies prefix the first text of a tokenization with
+// "▁", so for them a suffix is only reused when it starts with a special
+// token; otherwise the whole prompt is tokenized again.
+// ============================================================================
+
+use std::collections::VecDeque;
+
+use crate::LlamaToken;
+
+/// Recent prompts kept per vocabulary, about one per live conversation.
+pub const MAX_CACHED_PROMPTS: usize = 8;
+
+/// Byte offset from which `prompt` must be tokenized when the tokens of
+/// `cached` are known, or None when `prompt` does not extend `cached` at a
+/// boundary that tokenizes independently. Pre-tokenizers split after a
+/// newline unless more whitespace follows, and chat templates end every
+/// turn header with one.
+fn extension_point(cached: &str, prompt: &str) -> Option<usize> {
+    if cached.is_empty() || !prompt.starts_with(cached) {
+        return None;
+    }
+    let suffix = &prompt[cached.len()..];
+    if suffix.is_empty() {
+        return Some(cached.len());
+    }
+    if !cached.ends_with('\n') || suffix.starts_with(char::is_whitespace) {
+        return None;
+    }
+    Some(cached.len())
+}
+
+struct CachedPrompt {
+    text: String,
+    tokens: Vec<LlamaToken>,
+}
+
+/// Token sequences of recent prompts, most recently used last.
+#[derive(Default)]
+struct PromptCache {
+    entries: VecDeque<CachedPrompt>,
+}
+
+impl PromptCache {
+    /// Entry with the longest text that `prompt` extends, and the offset to
+    /// tokenize from.
+    fn best_match(&self, prompt: &str) -> Option<(usize, usize)> {
+        self.entries
+            .iter()
+            .enumerate()
+            .filter_map(|(i, entry)| extension_point(&entry.text, prompt).map(|at| (i, at)))
+            .max_by_key(|&(_, at)| at)
+    }
+
+    /// Tokens of `prompt`. `tokenize(text, at_start)` is asked for the text
+    /// no cached prompt covers; `at_start` is false for an appended suffix,
+    /// which must not get a BOS token. `appendable(suffix_tokens)` tells
+    /// whether those tokens match what full tokenization would produce
+    /// there; if not, the whole prompt is tokenized instead.
+    fn tokens_for(
+        &mut self,
+        prompt: &str,
+        mut tokenize: impl FnMut(&str, bool) -> Option<Vec<LlamaToken>>,
+        appendable: impl Fn(&[LlamaToken]) -> bool,
+    ) -> Option<Vec<LlamaToken>> {
+        let extended = match self.best_match(prompt) {
+            Some((i, at)) => {
+                let suffix = &prompt[at..];
+                let suffix_tokens = if suffix.is_empty() {
+                    Vec::new()
+                } else {
+                    tokenize(suffix, false)?
+                };
+                if suffix.is_empty() || appendable(&suffix_tokens) {
+                    let mut entry = self.entries.remove(i)?;
+                    entry.tokens.extend(suffix_tokens);
+                    entry.text.push_str(suffix);
+                    Some(entry)
+                } else {
+                    None
+                }
+            }
+            None => None,
+        };
+        let entry = match extended {
+            Some(entry) => entry,
+            None => CachedPrompt {
+                tokens: tokenize(prompt, true)?,
+                text: prompt.to_string(),
+            },
+        };
+        let tokens = entry.tokens.clone();
+        self.entries.push_back(entry);
+        while self.entries.len() > MAX_CACHED_PROMPTS {
+            self.entries.pop_front();
+        }
+        Some(tokens)
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+mod engine {
+    use super::*;
+    use crate::{
+        llama_chat_apply_template, llama_chat_message, llama_model, llama_model_get_vocab,
+        llama_model_meta_val_str, llama_tokenize, llama_vocab, llama_vocab_is_control,
+        llama_vocab_type,
+    };
+    use once_cell::sync::Lazy;
+    use std::collections::HashMap;
+    use std::ffi::{c_char, c_int, CStr, CString};
+    use std::sync::{Arc, Mutex};
+
+    /// model pointer -> GGUF chat template (None: the model has none)
+    static TEMPLATES: Lazy<Mutex<HashMap<usize, Option<Arc<CString>>>>> =
+        Lazy::new(|| Mutex::new(HashMap::new()));
+    /// vocab pointer -> recent prompt token sequences
+    static PROMPTS: Lazy<Mutex<HashMap<usize, PromptCache>>> =
+        Lazy::new(|| Mutex::new(HashMap::new()));
+
+    /// `LLAMA_VOCAB_TYPE_BPE`: byte-level, no space prefix on a new text.
+    const VOCAB_TYPE_BPE: c_int = 2;
+
+    unsafe fn tokenize(
+        vocab: *const llama_vocab,
+        text: &str,
+        add_special: bool,
+    ) -> Option<Vec<LlamaToken>> {
+        let mut tokens: Vec<LlamaToken> = vec![0; text.len() / 2 + 8];
+        for _ in 0..2 {
+            let n = llama_tokenize(
+                vocab,
+                text.as_ptr() as *const c_char,
+                text.len() as c_int,
+                tokens.as_mut_ptr(),
+                tokens.len() as c_int,
+                add_special,
+                true,
+            );
+            if n >= 0 {
+                tokens.truncate(n as usize);
+                return Some(tokens);
+            }
+            tokens = vec![0; (-n) as usize];
+        }
+        None
+    }
+
+    /// Tokens of `prompt` (BOS added, special tokens parsed), reusing the
+    /// tokens of a cached prompt it extends. Empty when tokenization fails.
+    pub(crate) unsafe fn tokenize_prompt(
+        vocab: *const llama_vocab,
+        prompt: &str,
+    ) -> Vec<LlamaToken> {
+        if vocab.is_null() || prompt.is_empty() {
+            return Vec::new();
+        }
+        let bpe = llama_vocab_type(vocab) == VOCAB_TYPE_BPE;
+        let mut prompts = PROMPTS.lock().unwrap_or_else(|p| p.into_inner());
+        prompts
+            .entry(vocab as usize)
+            .or_default()
+            .tokens_for(
+                prompt,
+                |text, at_start| tokenize(vocab, text, at_start),
+                |suffix| {
+                    bpe || suffix
+                        .first()
+                        .is_some_and(|&token| llama_vocab_is_control(vocab, token))
+                },
+            )
+            .unwrap_or_default()
+    }
+
+    unsafe fn read_template(model: *const llama_model) -> Option<Arc<CString>> {
+        let key = CString::new("tokenizer.chat_template").ok()?;
+        let mut buf = vec![0u8; 8192];
+        let mut len = llama_model_meta_val_str(
+            model,
+            key.as_ptr(),
+            buf.as_mut_ptr() as *mut c_char,
+            buf.len(),
+        );
+        if len > 0 && len as usize >= buf.len() {
+            // snprintf semantics: `len` is the full length, retry with room
+            buf = vec![0u8; len as usize + 1];
+            len = llama_model_meta_val_str(
+                model,
+                key.as_ptr(),
+                buf.as_mut_ptr() as *mut c_char,
+                buf.len(),
+            );
+        }
+        if len <= 0 {
+            return None;
+        }
+        let template = CStr::from_bytes_until_nul(&buf).ok()?;
+        Some(Arc::new(template.to_owned()))
+    }
+
+    /// The chat template of `model`, read from the GGUF metadata once.
+    pub(crate) unsafe fn model_template(model: *const llama_model) -> Option<Arc<CString>> {
+        if model.is_null() {
+            return None;
+        }
+        let mut templates = TEMPLATES.lock().unwrap_or_else(|p| p.into_inner());
+        templates
+            .entry(model as usize)
+            .or_insert_with(|| read_template(model))
+            .clone()
+    }
+
+    /// Render `(role, content)` messages with the chat template of `model`
+    /// and open an assistant turn. None when the model has no template or
+    /// llama.cpp does not recognize it.
+    pub(crate) unsafe fn render<'a>(
+        model: *const llama_model,
+        messages: impl IntoIterator<Item = (&'a str, &'a str)>,
+    ) -> Option<String> {
+        let template = model_template(model)?;
+
+        let mut strings = Vec::new();
+        for (role, content) in messages {
+            strings.push((CString::new(role).ok()?, CString::new(content).ok()?));
+        }
+        let chat: Vec<llama_chat_message> = strings
+            .iter()
+            .map(|(role, content)| llama_chat_message {
+                role: role.as_ptr(),
+                content: content.as_ptr(),
+            })
+            .collect();
+
+        let text_len: usize = strings.iter().map(|(_, c)| c.as_bytes().len()).sum();
+        let mut out = vec![0u8; text_len + 64 * chat.len() + 256];
+        for _ in 0..2 {
+            let written = llama_chat_apply_template(
+                template.as_ptr(),
+                chat.as_ptr(),
+                chat.len(),
+                true,
+                out.as_mut_ptr() as *mut c_char,
+                out.len() as c_int,
+            );
+            if written <= 0 {
+                return None;
+            }
+            if (written as usize) < out.len() {
+                out.truncate(written as usize);
+                return String::from_utf8(out).ok();
+            }
+            out = vec![0u8; written as usize + 1];
+        }
+        None
+    }
+
+    /// `model` is being freed; its pointers may be reused.
+    pub(crate) fn forget_model(model: *mut llama_model) {
+        if model.is_null() {
+            return;
+        }
+        TEMPLATES
+            .lock()
+            .unwrap_or_else(|p| p.into_inner())
+            .remove(&(model as usize));
+        // SAFETY: `model` is still live; it is freed after this call.
+        let vocab = unsafe { llama_model_get_vocab(model) };
+        PROMPTS
+            .lock()
+            .unwrap_or_else(|p| p.into_inner())
+            .remove(&(vocab as usize));
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub(crate) use engine::{forget_model, render, tokenize_prompt};
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    /// One token per byte, with a BOS of 0 at the start.
+    fn byte_tokens(text: &str, at_start: bool) -> Option<Vec<LlamaToken>> {
+        let bos = at_start.then_some(0);
+        Some(
+            bos.into_iter()
+                .chain(text.bytes().map(LlamaToken::from))
+                .collect(),
+        )
+    }
+
+    #[test]
+    fn extends_only_after_a_newline() {
+        assert_eq!(
+            extension_point("<|user|>\nhi\n", "<|user|>\nhi\nyo"),
+            Some(12)
+        );
+        assert_eq!(extension_point("a\n", "a\n"), Some(2));
+        assert_eq!(extension_point("abc", "abc"), Some(3));
+        assert_eq!(extension_point("abc", "abcd"), None);
+        assert_eq!(extension_point("a\n", "a\n\nb"), None);
+        assert_eq!(extension_point("a\n", "b\nc"), None);
+        assert_eq!(extension_point("", "abc"), None);
+    }
+
+    #[test]
+    fn next_turn_tokenizes_only_the_appended_text() {
+        let mut cache = PromptCache::default();
+        let mut asked = Vec::new();
+        let mut tokenize = |text: &str, at_start: bool| {
+            asked.push(text.to_string());
+            byte_tokens(text, at_start)
+        };
+
+        let first = cache
+            .tokens_for("sys\nq1\n", &mut tokenize, |_| true)
+            .unwrap();
+        let second = cache
+            .tokens_for("sys\nq1\na1 q2\n", &mut tokenize, |_| true)
+            .unwrap();
+        let again = cache
+            .tokens_for("sys\nq1\na1 q2\n", &mut tokenize, |_| true)
+            .unwrap();
+
+        assert_eq!(asked, vec!["sys\nq1\n".to_string(), "a1 q2\n".to_string()]);
+        assert_eq!(second[..first.len()], first[..]);
+        assert_eq!(second, byte_tokens("sys\nq1\na1 q2\n", true).unwrap());
+        assert_eq!(again, second);
+        assert_eq!(cache.entries.len(), 1);
+    }
+
+    #[test]
+    fn keeps_separate_conversations_and_evicts_the_oldest() {
+        let mut cache = PromptCache::default();
+        for i in 0..=MAX_CACHED_PROMPTS {
+            cache.tokens_for(&format!("conversation {i}\n"), byte_tokens, |_| true);
+        }
+        assert_eq!(cache.entries.len(), MAX_CACHED_PROMPTS);
+        assert!(cache.best_match("conversation 0\nmore").is_none());
+        let (_, at) = cache.best_match("conversation 3\nmore").unwrap();
+        assert_eq!(at, "conversation 3\n".len());
+    }
+
+    const SPECIAL: &str = "<|turn|>";
+    const SPECIAL_TOKEN: LlamaToken = 1000;
+
+    /// SentencePiece-like: one token per byte, `SPECIAL` parsed as one
+    /// control token, and every text fragment at the start or after a
+    /// special token prefixed with a space (`add_space_prefix`).
+    fn spm_tokens(text: &str, at_start: bool) -> Option<Vec<LlamaToken>> {
+        let mut tokens: Vec<LlamaToken> = at_start.then_some(0).into_iter().collect();
+        for (i, fragment) in text.split(SPECIAL).enumerate() {
+            if i > 0 {
+                tokens.push(SPECIAL_TOKEN);
+            }
+            if !fragment.is_empty() {
+                tokens.push(LlamaToken::from(b' '));
+                tokens.extend(fragment.bytes().map(LlamaToken::from));
+            }
+        }
+        Some(tokens)
+    }
+
+    #[test]
+    fn space_prefixed_vocab_matches_full_tokenization() {
+        let appendable = |suffix: &[LlamaToken]| suffix.first() == Some(&SPECIAL_TOKEN);
+        let turns = [
+            "<|turn|>sys\n",
+            "<|turn|>sys\n<|turn|>q1\n",
+            // plain text after the cached turn: the suffix alone would get
+            // a space prefix that full tokenization does not produce
+            "<|turn|>sys\n<|turn|>q1\na1\n",
+            "<|turn|>sys\n<|turn|>q1\na1\n<|turn|>q2\n",
+        ];
+        let mut cache = PromptCache::default();
+        let mut asked = Vec::new();
+        for prompt in turns {
+            let tokens = cache
+                .tokens_for(
+                    prompt,
+                    |text, at_start| {
+                        asked.push(text.to_string());
+                        spm_tokens(text, at_start)
+                    },
+                    appendable,
+                )
+                .unwrap();
+            assert_eq!(tokens, spm_tokens(prompt, true).unwrap(), "{prompt:?}");
+        }
+        assert_eq!(
+            asked,
+            vec![
+                "<|turn|>sys\n",
+                "<|turn|>q1\n",
+                "a1\n",
+                "<|turn|>sys\n<|turn|>q1\na1\n",
+                "<|turn|>q2\n",
+            ]
+        );
+
+        // appending unconditionally would have diverged
+        let mut naive = PromptCache::default();
+        naive.tokens_for(turns[1], spm_tokens, |_| true);
+        let tokens = naive.tokens_for(turns[2], spm_tokens, |_| true).unwrap();
+        assert_ne!(tokens, spm_tokens(turns[2], true).unwrap());
+    }
+}
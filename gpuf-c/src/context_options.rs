@@ -0,0 +1,479 @@
+// ============================================================================
+// Context creation options and automatic context shift
+// ============================================================================
+//
+// `gpuf_create_context` used fixed sizes, an f16 KV cache and llama.cpp's
+// default attention kernel. `gpuf_create_context_ex` takes the context and
+// batch sizes, the K and V cache types (q8_0 roughly halves and q4_0
+// quarters the cache, which is what fits 8k contexts on 8 GB phones), the
+// flash attention mode and whether the context shifts instead of failing
+// when it fills up. Contexts the model registry creates, including those of
+// the remote worker, use the options set with
+// `gpuf_model_registry_set_context_options`.
+//
+// With context shift a prompt longer than the context keeps its first
+// `n_keep` tokens and its tail, and generation that reaches `n_ctx` drops
+// the older half of the tokens after `n_keep` from the KV cache and slides
+// the rest down, like llama.cpp's server. A negative `n_keep` keeps the
+// prompt's leading system turn.
+// ============================================================================
+
+use std::ffi::c_int;
+
+use crate::{llama_context_params, LlamaToken};
+
+/// f16 K/V cache elements (`GGML_TYPE_F16`).
+pub const KV_CACHE_F16: c_int = 1;
+/// 4-bit K/V cache elements (`GGML_TYPE_Q4_0`).
+pub const KV_CACHE_Q4_0: c_int = 2;
+/// 8-bit K/V cache elements (`GGML_TYPE_Q8_0`).
+pub const KV_CACHE_Q8_0: c_int = 8;
+
+/// Let llama.cpp decide whether to use flash attention.
+pub const FLASH_ATTN_AUTO: c_int = -1;
+pub const FLASH_ATTN_DISABLED: c_int = 0;
+pub const FLASH_ATTN_ENABLED: c_int = 1;
+
+/// Options of `gpuf_create_context_ex`. Zero sizes keep the defaults of
+/// `gpuf_context_options_default`.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct gpuf_context_options {
+    /// Context size in tokens, shared by all sequences.
+    pub n_ctx: u32,
+    /// Tokens submitted per `llama_decode` call.
+    pub n_batch: u32,
+    /// Tokens computed per graph evaluation; at most `n_batch`.
+    pub n_ubatch: u32,
+    /// One of the `KV_CACHE_*` types.
+    pub type_k: c_int,
+    /// One of the `KV_CACHE_*` types; quantized V requires flash attention.
+    pub type_v: c_int,
+    /// One of the `FLASH_ATTN_*` modes.
+    pub flash_attn: c_int,
+    /// Non-zero to shift the context instead of failing when it is full.
+    pub context_shift: c_int,
+    /// Leading tokens the shift keeps; negative keeps the system turn.
+    pub n_keep: c_int,
+}
+
+impl Default for gpuf_context_options {
+    fn default() -> Self {
+        Self {
+            n_ctx: 4096,
+            n_batch: 128,
+            n_ubatch: 128,
+            type_k: KV_CACHE_F16,
+            type_v: KV_CACHE_F16,
+            flash_attn: FLASH_ATTN_AUTO,
+            context_shift: 0,
+            n_keep: -1,
+        }
+    }
+}
+
+/// Reasons `gpuf_create_context_ex` rejects options.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub(crate) enum OptionsError {
+    KvType,
+    FlashAttn,
+    /// A quantized V cache needs flash attention.
+    QuantizedV,
+}
+
+fn is_kv_type(ty: c_int) -> bool {
+    matches!(ty, KV_CACHE_F16 | KV_CACHE_Q8_0 | KV_CACHE_Q4_0)
+}
+
+impl gpuf_context_options {
+    /// Fill zero sizes with defaults, cap `n_ubatch` at `n_batch` and check
+    /// the cache types and flash attention mode.
+    pub(crate) fn resolve(mut self) -> Result<Self, OptionsError> {
+        let defaults = Self::default();
+        if self.n_ctx == 0 {
+            self.n_ctx = defaults.n_ctx;
+        }
+        if self.n_batch == 0 {
+            self.n_batch = defaults.n_batch;
+        }
+        self.n_batch = self.n_batch.min(self.n_ctx);
+        if self.n_ubatch == 0 || self.n_ubatch > self.n_batch {
+            self.n_ubatch = self.n_batch;
+        }
+        if !is_kv_type(self.type_k) || !is_kv_type(self.type_v) {
+            return Err(OptionsError::KvType);
+        }
+        if !(FLASH_ATTN_AUTO..=FLASH_ATTN_ENABLED).contains(&self.flash_attn) {
+            return Err(OptionsError::FlashAttn);
+        }
+        if self.type_v != KV_CACHE_F16 && self.flash_attn == FLASH_ATTN_DISABLED {
+            return Err(OptionsError::QuantizedV);
+        }
+        Ok(self)
+    }
+
+    /// Write the resolved options into llama.cpp context parameters.
+    pub(crate) fn apply(&self, params: &mut llama_context_params) {
+        params.n_ctx = self.n_ctx;
+        params.n_batch = self.n_batch;
+        params.n_ubatch = self.n_ubatch;
+        params.type_k = self.type_k;
+        params.type_v = self.type_v;
+        params.flash_attn_type = self.flash_attn;
+    }
+}
+
+/// Bytes per cached K or V element of `ty`, as a fraction.
+pub(crate) fn kv_element_bytes(ty: c_int) -> (u64, u64) {
+    match ty {
+        // 32 elements per block: an f16 scale plus the quants
+        KV_CACHE_Q8_0 => (34, 32),
+        KV_CACHE_Q4_0 => (18, 32),
+        _ => (2, 1),
+    }
+}
+
+/// Byte length of the system turn `prompt` starts with, end marker
+/// included, for the chat formats the SDK templates produce.
+pub(crate) fn system_turn_len(prompt: &str) -> Option<usize> {
+    const TURNS: [(&str, &str); 3] = [
+        ("<|im_start|>system", "<|im_end|>"),
+        ("<|start_header_id|>system<|end_header_id|>", "<|eot_id|>"),
+        ("<|system|>", "<|end|>"),
+    ];
+    // Llama 3 prompts begin with <|begin_of_text|>
+    let body = prompt.trim_start_matches("<|begin_of_text|>").trim_start();
+    let offset = prompt.len() - body.len();
+    TURNS.iter().find_map(|(start, end)| {
+        if !body.starts_with(start) {
+            return None;
+        }
+        body.find(end).map(|at| offset + at + end.len())
+    })
+}
+
+/// Drop tokens after the first `n_keep` so that `tokens` fits `room`,
+/// keeping the most recent ones. `n_keep` is capped at half the room so the
+/// tail is never squeezed out. Returns how many tokens were dropped.
+pub(crate) fn fit_prompt(tokens: &mut Vec<LlamaToken>, n_keep: usize, room: usize) -> usize {
+    if tokens.len() <= room {
+        return 0;
+    }
+    let keep = n_keep.min(room / 2);
+    let dropped = tokens.len() - room;
+    tokens.drain(keep..keep + dropped);
+    dropped
+}
+
+/// Tokens to discard from a full sequence of `n_past` tokens: half of those
+/// after the kept prefix, and at least one.
+pub(crate) fn shift_amount(n_past: usize, n_keep: usize) -> usize {
+    (n_past.saturating_sub(n_keep) / 2).max(1)
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+mod engine {
+    use super::*;
+    use crate::{
+        llama_context, llama_context_default_params, llama_get_memory, llama_init_from_model,
+        llama_memory_can_shift, llama_memory_seq_add, llama_memory_seq_rm, llama_model,
+        llama_tokenize, llama_vocab, session, warm_start, DEFAULT_LLAMA_THREADS,
+    };
+    use once_cell::sync::Lazy;
+    use std::collections::HashMap;
+    use std::ffi::c_char;
+    use std::sync::Mutex;
+
+    /// context pointer -> `n_keep` of contexts created with context shift
+    static SHIFTING: Lazy<Mutex<HashMap<usize, c_int>>> = Lazy::new(|| Mutex::new(HashMap::new()));
+    static REGISTRY_OPTIONS: Lazy<Mutex<gpuf_context_options>> =
+        Lazy::new(|| Mutex::new(gpuf_context_options::default()));
+
+    pub(crate) unsafe fn create(
+        model: *mut llama_model,
+        options: &gpuf_context_options,
+    ) -> *mut llama_context {
+        let options = match options.resolve() {
+            Ok(options) => options,
+            Err(e) => {
+                println!("❌ Invalid context options: {:?}", e);
+                return std::ptr::null_mut();
+            }
+        };
+        let mut params = llama_context_default_params();
+        options.apply(&mut params);
+        params.n_threads = DEFAULT_LLAMA_THREADS;
+        params.n_threads_batch = DEFAULT_LLAMA_THREADS;
+        // Sequence 0 serves the single-request API, the rest back gpuf_session_*.
+        // A unified KV cache lets every sequence use the full n_ctx.
+        params.n_seq_max = 1 + session::SESSION_MAX_SEQUENCES;
+        params.kv_unified = true;
+        params.embeddings = false;
+        params.offload_kqv = false;
+
+        println!(
+            "🔧 Creating context: n_ctx={}, n_batch={}, n_ubatch={}, type_k={}, type_v={}, flash_attn={}",
+            options.n_ctx,
+            options.n_batch,
+            options.n_ubatch,
+            options.type_k,
+            options.type_v,
+            options.flash_attn
+        );
+        let ctx = llama_init_from_model(model, params);
+        if !ctx.is_null() && options.context_shift != 0 {
+            if llama_memory_can_shift(llama_get_memory(ctx)) {
+                SHIFTING
+                    .lock()
+                    .unwrap_or_else(|p| p.into_inner())
+                    .insert(ctx as usize, options.n_keep);
+            } else {
+                println!("⚠️ This model's KV cache cannot shift; context shift disabled");
+            }
+        }
+        if !ctx.is_null() {
+            warm_start::warm(ctx, model, &options);
+        }
+        ctx
+    }
+
+    pub(crate) fn registry_options() -> gpuf_context_options {
+        *REGISTRY_OPTIONS.lock().unwrap_or_else(|p| p.into_inner())
+    }
+
+    pub(super) fn set_registry_options(options: gpuf_context_options) -> bool {
+        if options.resolve().is_err() {
+            return false;
+        }
+        *REGISTRY_OPTIONS.lock().unwrap_or_else(|p| p.into_inner()) = options;
+        true
+    }
+
+    /// The context is being freed; drop its shift setting.
+    pub(crate) fn forget(ctx: *mut llama_context) {
+        SHIFTING
+            .lock()
+            .unwrap_or_else(|p| p.into_inner())
+            .remove(&(ctx as usize));
+    }
+
+    /// Leading tokens of `tokens` (the tokenized `prompt`) that a shift on
+    /// `ctx` keeps, or `None` when `ctx` does not shift.
+    pub(crate) unsafe fn keep_for(
+        ctx: *mut llama_context,
+        vocab: *const llama_vocab,
+        prompt: &str,
+        tokens: &[LlamaToken],
+    ) -> Option<usize> {
+        let n_keep = *SHIFTING
+            .lock()
+            .unwrap_or_else(|p| p.into_inner())
+            .get(&(ctx as usize))?;
+        if n_keep >= 0 {
+            return Some((n_keep as usize).min(tokens.len()));
+        }
+        // Keep the system turn, or just the first (BOS) token without one
+        let Some(len) = system_turn_len(prompt) else {
+            return Some(tokens.len().min(1));
+        };
+        let mut system = vec![0 as LlamaToken; len + 2];
+        let n = llama_tokenize(
+            vocab,
+            prompt.as_ptr() as *const c_char,
+            len as c_int,
+            system.as_mut_ptr(),
+            system.len() as c_int,
+            true,
+            true,
+        );
+        Some((n.max(1) as usize).min(tokens.len()))
+    }
+
+    /// Make room on full sequence 0 of `ctx`: discard tokens after the
+    /// first `n_keep` and slide the rest down. `tokens` mirrors the KV cache
+    /// and shrinks accordingly. Returns false when nothing can be discarded.
+    pub(crate) unsafe fn shift(
+        ctx: *mut llama_context,
+        n_keep: usize,
+        tokens: &mut Vec<LlamaToken>,
+    ) -> bool {
+        let n_past = tokens.len();
+        if n_keep + 1 >= n_past {
+            return false;
+        }
+        let n_discard = shift_amount(n_past, n_keep);
+        let mem = llama_get_memory(ctx);
+        let (keep, end) = (n_keep as c_int, (n_keep + n_discard) as c_int);
+        if !llama_memory_seq_rm(mem, 0, keep, end) {
+            return false;
+        }
+        llama_memory_seq_add(mem, 0, end, n_past as c_int, -(n_discard as c_int));
+        tokens.drain(n_keep..n_keep + n_discard);
+        println!(
+            "🔄 Context shift: discarded {} tokens after the first {}",
+            n_discard, n_keep
+        );
+        true
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub(crate) use engine::{create, forget, keep_for, registry_options, shift};
+
+/// Write the default options of `gpuf_create_context` to `options`.
+/// Returns 0 on success or -1 for a null `options`.
+///
+/// # Safety
+/// `options` must point to writable memory for one `gpuf_context_options`.
+#[no_mangle]
+pub unsafe extern "C" fn gpuf_context_options_default(options: *mut gpuf_context_options) -> c_int {
+    if options.is_null() {
+        return -1;
+    }
+    *options = gpuf_context_options::default();
+    0
+}
+
+/// Create a context on `model` with `options` (null for the defaults).
+/// Returns null for invalid options or when llama.cpp cannot allocate the
+/// context, e.g. a quantized V cache on a backend without flash attention.
+///
+/// # Safety
+/// `model` must be a live model from `gpuf_load_model`; `options` must be
+/// null or point to a `gpuf_context_options`.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub unsafe extern "C" fn gpuf_create_context_ex(
+    model: *mut crate::llama_model,
+    options: *const gpuf_context_options,
+) -> *mut crate::llama_context {
+    if model.is_null() {
+        return std::ptr::null_mut();
+    }
+    let options = options.as_ref().copied().unwrap_or_default();
+    engine::create(model, &options)
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub unsafe extern "C" fn gpuf_create_context_ex(
+    _model: *mut crate::llama_model,
+    _options: *const gpuf_context_options,
+) -> *mut crate::llama_context {
+    std::ptr::null_mut()
+}
+
+/// Use `options` for contexts the model registry creates from now on,
+/// including those of the remote worker. Pooled contexts keep the options
+/// they were created with. Returns 0 on success or -1 for invalid options.
+///
+/// # Safety
+/// `options` must be null or point to a `gpuf_context_options`.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub unsafe extern "C" fn gpuf_model_registry_set_context_options(
+    options: *const gpuf_context_options,
+) -> c_int {
+    let Some(options) = options.as_ref() else {
+        return -1;
+    };
+    if engine::set_registry_options(*options) {
+        0
+    } else {
+        -1
+    }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub unsafe extern "C" fn gpuf_model_registry_set_context_options(
+    _options: *const gpuf_context_options,
+) -> c_int {
+    -1
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn options_resolve_to_consistent_sizes() {
+        let zero = gpuf_context_options {
+            n_ctx: 0,
+            n_batch: 0,
+            n_ubatch: 0,
+            ..Default::default()
+        };
+        assert_eq!(zero.resolve(), Ok(gpuf_context_options::default()));
+
+        let big = gpuf_context_options {
+            n_ctx: 8192,
+            n_batch: 16384,
+            n_ubatch: 0,
+            type_k: KV_CACHE_Q8_0,
+            type_v: KV_CACHE_Q8_0,
+            flash_attn: FLASH_ATTN_ENABLED,
+            ..Default::default()
+        }
+        .resolve()
+        .unwrap();
+        assert_eq!((big.n_batch, big.n_ubatch), (8192, 8192));
+
+        let bad_type = gpuf_context_options {
+            type_k: 3,
+            ..Default::default()
+        };
+        assert_eq!(bad_type.resolve(), Err(OptionsError::KvType));
+        let no_fa = gpuf_context_options {
+            type_v: KV_CACHE_Q4_0,
+            flash_attn: FLASH_ATTN_DISABLED,
+            ..Default::default()
+        };
+        assert_eq!(no_fa.resolve(), Err(OptionsError::QuantizedV));
+        // A quantized K cache works without flash attention
+        let k_only = gpuf_context_options {
+            type_k: KV_CACHE_Q4_0,
+            flash_attn: FLASH_ATTN_DISABLED,
+            ..Default::default()
+        };
+        assert!(k_only.resolve().is_ok());
+    }
+
+    #[test]
+    fn system_turns_are_found() {
+        let chatml = "<|im_start|>system\nBe brief.<|im_end|>\n<|im_start|>user\nHi<|im_end|>";
+        assert_eq!(
+            system_turn_len(chatml).map(|n| &chatml[..n]),
+            Some("<|im_start|>system\nBe brief.<|im_end|>")
+        );
+        let llama3 = "<|begin_of_text|><|start_header_id|>system<|end_header_id|>\n\nX<|eot_id|>\
+                      <|start_header_id|>user<|end_header_id|>\n\nY<|eot_id|>";
+        assert_eq!(
+            system_turn_len(llama3).map(|n| &llama3[..n]),
+            Some("<|begin_of_text|><|start_header_id|>system<|end_header_id|>\n\nX<|eot_id|>")
+        );
+        assert_eq!(system_turn_len("<|im_start|>user\nHi<|im_end|>"), None);
+        assert_eq!(system_turn_len("<|im_start|>system\nunterminated"), None);
+    }
+
+    #[test]
+    fn prompts_keep_the_prefix_and_the_tail() {
+        let mut tokens: Vec<LlamaToken> = (0..10).collect();
+        assert_eq!(fit_prompt(&mut tokens, 2, 10), 0);
+        assert_eq!(fit_prompt(&mut tokens, 2, 6), 4);
+        assert_eq!(tokens, vec![0, 1, 6, 7, 8, 9]);
+
+        // An oversized prefix is capped at half the room
+        let mut tokens: Vec<LlamaToken> = (0..10).collect();
+        fit_prompt(&mut tokens, 8, 4);
+        assert_eq!(tokens, vec![0, 1, 8, 9]);
+    }
+
+    #[test]
+    fn shifts_discard_half_after_the_prefix() {
+        assert_eq!(shift_amount(4096, 96), 2000);
+        assert_eq!(shift_amount(3, 2), 1);
+        assert_eq!(kv_element_bytes(KV_CACHE_F16), (2, 1));
+        assert_eq!(kv_element_bytes(KV_CACHE_Q4_0), (18, 32));
+    }
+}
@@ -0,0 +1,361 @@
+// ============================================================================
+// Batched embeddings
+// ============================================================================
+//
+// `gpuf_embed_batch` embeds N texts in as few `llama_decode` calls as
+// possible: every text becomes its own sequence, and sequences are packed
+// into a batch until it holds `n_batch` tokens or `n_seq_max` sequences.
+// The pooled vector of each sequence (or the mean of its token embeddings
+// for models without a pooling layer) is written straight into the
+// caller's float buffer, so nothing is allocated per text. The token
+// buffer and the batch are allocated once per call.
+//
+// Texts are decoded into sequence ids no session is generating in, and
+// their cells are removed again after every batch, so embeddings can share
+// the serving context with running sessions. Only when every session
+// sequence is busy does it fall back to sequence 0, dropping the resident
+// prompt prefix of the single-request entry points.
+// ============================================================================
+
+use std::ffi::{c_char, c_int};
+use std::ops::Range;
+
+/// `LLAMA_POOLING_TYPE_NONE`: one embedding per token.
+const POOLING_NONE: c_int = 0;
+/// `LLAMA_POOLING_TYPE_RANK`: reranker score, not an embedding.
+const POOLING_RANK: c_int = 4;
+
+/// Split texts of `lens` tokens into consecutive runs, each decoded by one
+/// `llama_decode` call of at most `n_batch` tokens and `n_seq_max`
+/// sequences. Every length must be in `1..=n_batch`. The desktop engine
+/// packs its llama-cpp-2 batches with the same plan.
+pub(crate) fn plan_batches(lens: &[usize], n_batch: usize, n_seq_max: usize) -> Vec<Range<usize>> {
+    let mut batches = Vec::new();
+    let mut start = 0;
+    let mut tokens = 0;
+    for (i, &len) in lens.iter().enumerate() {
+        if i > start && (tokens + len > n_batch || i - start == n_seq_max) {
+            batches.push(start..i);
+            start = i;
+            tokens = 0;
+        }
+        tokens += len;
+    }
+    if start < lens.len() {
+        batches.push(start..lens.len());
+    }
+    batches
+}
+
+/// Scale `v` to unit length; a zero vector stays zero.
+pub(crate) fn l2_normalize(v: &mut [f32]) {
+    let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+    if norm > 0.0 {
+        v.iter_mut().for_each(|x| *x /= norm);
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+mod engine {
+    use super::*;
+    use crate::session::{batch_push, idle_sequences};
+    use crate::{
+        llama_batch_free, llama_batch_init, llama_context, llama_decode, llama_get_embeddings_ith,
+        llama_get_embeddings_seq, llama_get_memory, llama_get_model, llama_memory_seq_rm,
+        llama_model_get_vocab, llama_model_n_embd, llama_n_batch, llama_n_ubatch,
+        llama_pooling_type, llama_set_embeddings, llama_tokenize, llama_vocab, prefix_cache,
+        LlamaSeqId, LlamaToken, GLOBAL_INFERENCE_MUTEX,
+    };
+    use std::ffi::{c_void, CStr, CString};
+
+    pub(super) fn embedding_size(ctx: *mut llama_context) -> c_int {
+        if ctx.is_null() {
+            return -1;
+        }
+        // SAFETY: `ctx` is a live context per the C API contract.
+        unsafe { llama_model_n_embd(llama_get_model(ctx)) }
+    }
+
+    /// Append the tokens of `text` to `tokens`.
+    unsafe fn tokenize_into(
+        vocab: *const llama_vocab,
+        text: &CStr,
+        tokens: &mut Vec<LlamaToken>,
+    ) -> Option<usize> {
+        let bytes = text.to_bytes().len();
+        let start = tokens.len();
+        // A token covers at least one byte, plus room for BOS/EOS.
+        tokens.resize(start + bytes + 4, 0);
+        let mut n = llama_tokenize(
+            vocab,
+            text.as_ptr(),
+            bytes as c_int,
+            tokens.as_mut_ptr().add(start),
+            (tokens.len() - start) as c_int,
+            true,
+            false,
+        );
+        if n < 0 {
+            tokens.resize(start + (-n) as usize, 0);
+            n = llama_tokenize(
+                vocab,
+                text.as_ptr(),
+                bytes as c_int,
+                tokens.as_mut_ptr().add(start),
+                (tokens.len() - start) as c_int,
+                true,
+                false,
+            );
+        }
+        tokens.truncate(start + n.max(0) as usize);
+        (n > 0).then_some(n as usize)
+    }
+
+    /// Drop the cells a batch left in `seqs`.
+    unsafe fn release_sequences(mem: *mut c_void, seqs: &[LlamaSeqId]) {
+        for &seq_id in seqs {
+            llama_memory_seq_rm(mem, seq_id, -1, -1);
+        }
+    }
+
+    /// Embed `texts` into `out` and return the number of tokens decoded, or
+    /// the error code of `gpuf_embed_batch`.
+    pub(super) unsafe fn embed_batch(
+        ctx: *mut llama_context,
+        texts: &[*const c_char],
+        out: &mut [f32],
+        normalize: bool,
+    ) -> Result<usize, c_int> {
+        let model = llama_get_model(ctx);
+        let n_embd = llama_model_n_embd(model).max(0) as usize;
+        if n_embd == 0 || out.len() < texts.len() * n_embd {
+            return Err(-2);
+        }
+        let pooling = llama_pooling_type(ctx);
+        if pooling == POOLING_RANK {
+            return Err(-5);
+        }
+
+        let n_batch = llama_n_batch(ctx).max(1) as usize;
+        // Non-causal encoders need a whole sequence in one micro-batch.
+        let max_len = n_batch.min(llama_n_ubatch(ctx).max(1) as usize);
+        let vocab = llama_model_get_vocab(model);
+        let mut tokens: Vec<LlamaToken> = Vec::new();
+        let mut lens = Vec::with_capacity(texts.len());
+        for &text in texts {
+            match tokenize_into(vocab, CStr::from_ptr(text), &mut tokens) {
+                Some(len) if len <= max_len => lens.push(len),
+                _ => return Err(-4),
+            }
+        }
+
+        let _lock = GLOBAL_INFERENCE_MUTEX
+            .lock()
+            .unwrap_or_else(|p| p.into_inner());
+        let mem = llama_get_memory(ctx);
+        let mut seqs = idle_sequences(ctx);
+        if seqs.is_empty() {
+            // Every session sequence is generating: borrow sequence 0 from
+            // the single-request entry points and their prompt prefix.
+            prefix_cache::forget(ctx);
+            llama_memory_seq_rm(mem, 0, -1, -1);
+            seqs.push(0);
+        }
+        llama_set_embeddings(ctx, true);
+        let mut batch = llama_batch_init(n_batch as c_int, 0, 1);
+
+        let mut result = Ok(tokens.len());
+        let mut offset = 0;
+        let mut used: &[LlamaSeqId] = &[];
+        'batches: for range in plan_batches(&lens, n_batch, seqs.len()) {
+            release_sequences(mem, used);
+            used = &seqs[..range.len()];
+            batch.n_tokens = 0;
+            for (&seq_id, i) in used.iter().zip(range.clone()) {
+                for (pos, &token) in tokens[offset..offset + lens[i]].iter().enumerate() {
+                    batch_push(&mut batch, token, pos as c_int, seq_id, true);
+                }
+                offset += lens[i];
+            }
+            if llama_decode(ctx, batch.clone()) != 0 {
+                result = Err(-3);
+                break;
+            }
+
+            let mut row = 0;
+            for (&seq_id, i) in used.iter().zip(range) {
+                let dst = &mut out[i * n_embd..(i + 1) * n_embd];
+                if pooling == POOLING_NONE {
+                    // Mean over the sequence's token embeddings.
+                    dst.fill(0.0);
+                    for _ in 0..lens[i] {
+                        let e = llama_get_embeddings_ith(ctx, row as c_int);
+                        if e.is_null() {
+                            result = Err(-3);
+                            break 'batches;
+                        }
+                        let e = std::slice::from_raw_parts(e, n_embd);
+                        dst.iter_mut().zip(e).for_each(|(d, x)| *d += x);
+                        row += 1;
+                    }
+                    let n = lens[i] as f32;
+                    dst.iter_mut().for_each(|d| *d /= n);
+                } else {
+                    let e = llama_get_embeddings_seq(ctx, seq_id);
+                    if e.is_null() {
+                        result = Err(-3);
+                        break 'batches;
+                    }
+                    dst.copy_from_slice(std::slice::from_raw_parts(e, n_embd));
+                }
+                if normalize {
+                    l2_normalize(dst);
+                }
+            }
+        }
+
+        release_sequences(mem, used);
+        llama_set_embeddings(ctx, false);
+        llama_batch_free(batch);
+        result
+    }
+
+    /// Embed `inputs` with the worker's serving model for an
+    /// `EmbeddingTask`: the vectors back to back, their width and the
+    /// number of prompt tokens.
+    pub(crate) fn embed_serving(
+        inputs: &[String],
+        normalize: bool,
+    ) -> Result<(Vec<f32>, u32, u32), String> {
+        // Lease the serving model so a hot swap cannot free it mid-task.
+        let serving = crate::serving_model();
+        let ctx = serving.as_ref().map_or(std::ptr::null_mut(), |s| s.context);
+        if ctx.is_null() {
+            return Err("Model not loaded - please load a model first".to_string());
+        }
+        let texts = inputs
+            .iter()
+            .map(|s| CString::new(s.as_str()))
+            .collect::<Result<Vec<_>, _>>()
+            .map_err(|e| format!("Invalid input: {}", e))?;
+        let ptrs: Vec<*const c_char> = texts.iter().map(|s| s.as_ptr()).collect();
+        let dim = embedding_size(ctx).max(0) as usize;
+        let mut out = vec![0f32; dim * inputs.len()];
+        // SAFETY: `serving` keeps `ctx` alive for the call, `ptrs` point into
+        // `texts` and `out` holds `dim` floats per input.
+        match unsafe { embed_batch(ctx, &ptrs, &mut out, normalize) } {
+            Ok(tokens) => Ok((out, dim as u32, tokens as u32)),
+            Err(code) => Err(format!("Embedding failed with code: {}", code)),
+        }
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub(crate) use engine::embed_serving;
+
+/// Embedding width of the model behind `ctx`, i.e. the floats
+/// `gpuf_embed_batch` writes per text. Returns -1 for a null context.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_embedding_size(ctx: *mut crate::llama_context) -> c_int {
+    engine::embedding_size(ctx)
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_embedding_size(_ctx: *mut crate::llama_context) -> c_int {
+    -1
+}
+
+/// Embed `n_texts` texts and write their vectors back to back into `out`
+/// (`gpuf_embedding_size(ctx)` floats each, in input order).
+///
+/// Texts are packed as separate sequences into `llama_decode` batches of up
+/// to `n_batch` tokens. The context's pooling type decides the vector;
+/// without pooling the token embeddings are averaged. Non-zero `normalize`
+/// scales every vector to unit length.
+///
+/// Returns the number of vectors written, -1 for invalid arguments, -2 if
+/// `out_len` is too small, -3 if decoding failed, -4 if a text is empty or
+/// longer than one micro-batch (`n_ubatch`) and -5 for a reranking context.
+///
+/// # Safety
+/// `ctx` must be a live context. Sessions on it may keep running; their
+/// sequences are left untouched.
+///
+/// `texts` must point to `n_texts` valid NUL-terminated strings and `out` to
+/// `out_len` writable floats.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub unsafe extern "C" fn gpuf_embed_batch(
+    ctx: *mut crate::llama_context,
+    texts: *const *const c_char,
+    n_texts: c_int,
+    out: *mut f32,
+    out_len: usize,
+    normalize: c_int,
+) -> c_int {
+    if ctx.is_null() || n_texts < 0 || (n_texts > 0 && (texts.is_null() || out.is_null())) {
+        return -1;
+    }
+    if n_texts == 0 {
+        return 0;
+    }
+    let texts = std::slice::from_raw_parts(texts, n_texts as usize);
+    if texts.iter().any(|t| t.is_null()) {
+        return -1;
+    }
+    let out = std::slice::from_raw_parts_mut(out, out_len);
+    match engine::embed_batch(ctx, texts, out, normalize != 0) {
+        Ok(_) => n_texts,
+        Err(code) => code,
+    }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub unsafe extern "C" fn gpuf_embed_batch(
+    _ctx: *mut crate::llama_context,
+    _texts: *const *const c_char,
+    _n_texts: c_int,
+    _out: *mut f32,
+    _out_len: usize,
+    _normalize: c_int,
+) -> c_int {
+    -1
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn batches_respect_token_and_sequence_limits() {
+        assert_eq!(plan_batches(&[3, 3, 3], 8, 4), vec![0..2, 2..3]);
+        assert_eq!(plan_batches(&[1, 1, 1, 1, 1], 8, 2), vec![0..2, 2..4, 4..5]);
+        assert_eq!(plan_batches(&[8, 1, 8], 8, 4), vec![0..1, 1..2, 2..3]);
+        assert_eq!(plan_batches(&[], 8, 4), Vec::<Range<usize>>::new());
+    }
+
+    #[test]
+    fn every_text_is_planned_once_in_order() {
+        let lens = [5, 2, 7, 1, 1, 4, 6, 3];
+        let plan = plan_batches(&lens, 9, 3);
+        let flat: Vec<usize> = plan.iter().flat_map(|r| r.clone()).collect();
+        assert_eq!(flat, (0..lens.len()).collect::<Vec<_>>());
+        for r in plan {
+            assert!(lens[r.clone()].iter().sum::<usize>() <= 9);
+            assert!(r.len() <= 3);
+        }
+    }
+
+    #[test]
+    fn normalize_scales_to_unit_length() {
+        let mut v = [3.0, 4.0];
+        l2_normalize(&mut v);
+        assert_eq!(v, [0.6, 0.8]);
+        let mut zero = [0.0, 0.0];
+        l2_normalize(&mut zero);
+        assert_eq!(zero, [0.0, 0.0]);
+    }
+}
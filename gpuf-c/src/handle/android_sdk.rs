@@ -8,13 +8,15 @@
 use crate::util::mobile_control_stream::connect_mobile_control_stream;
 use crate::util::mobile_control_stream::{MobileControlStream, MobileControlTlsConfig};
 #[cfg(target_os = "android")]
+use crate::util::stream_coalescer::StreamCoalescer;
+#[cfg(target_os = "android")]
 use anyhow::{anyhow, Result};
 
 #[cfg(target_os = "android")]
-use common::{ChatMessage, Command, CommandV1, Model, OsType, OutputPhase, SystemInfo};
+use common::{ChatMessage, Command, CommandV1, CommandV2, Model, OsType, OutputPhase, SystemInfo};
 
 #[cfg(target_os = "android")]
-use std::ffi::{CStr, CString};
+use std::ffi::CString;
 
 #[cfg(target_os = "android")]
 use std::sync::atomic::{AtomicBool, Ordering};
@@ -82,6 +84,8 @@ fn command_label(command: &Command) -> &'static str {
             CommandV1::InferenceResult { .. } => "v1.inference_result",
             CommandV1::InferenceResultChunk { .. } => "v1.inference_result_chunk",
             CommandV1::ModelDownloadProgress { .. } => "v1.model_download_progress",
+            CommandV1::EmbeddingTask { .. } => "v1.embedding_task",
+            CommandV1::EmbeddingResult { .. } => "v1.embedding_result",
         },
         Command::V2(_) => "v2.command",
     }
@@ -104,29 +108,6 @@ fn call_status_callback(callback: Option<StatusCallback>, message: &CString) {
 extern "C" {
     fn llama_get_model(ctx: *const crate::llama_context) -> *const crate::llama_model;
     fn llama_model_get_vocab(model: *const crate::llama_model) -> *const crate::llama_vocab;
-    fn llama_tokenize(
-        vocab: *const crate::llama_vocab,
-        text: *const std::os::raw::c_char,
-        text_len: i32,
-        tokens: *mut i32,
-        n_tokens_max: i32,
-        add_special: bool,
-        parse_special: bool,
-    ) -> i32;
-    fn llama_model_meta_val_str(
-        model: *const crate::llama_model,
-        key: *const std::os::raw::c_char,
-        buf: *mut std::os::raw::c_char,
-        buf_size: usize,
-    ) -> i32;
-    fn llama_chat_apply_template(
-        tmpl: *const std::os::raw::c_char,
-        chat: *const crate::llama_chat_message,
-        n_msg: usize,
-        add_ass: bool,
-        buf: *mut std::os::raw::c_char,
-        length: i32,
-    ) -> i32;
 }
 
 #[cfg(target_os = "android")]
@@ -147,44 +128,11 @@ fn count_prompt_tokens(ctx: *mut crate::llama_context, prompt: *const std::os::r
     }
 
     // SAFETY: `prompt` was checked for null and the C API requires a NUL-terminated prompt.
-    let prompt_len = unsafe { std::ffi::CStr::from_ptr(prompt) }.to_bytes().len();
-
-    let mut tokens: Vec<i32> = vec![0; 512];
-    // SAFETY: `vocab` and `prompt` are valid for this call, and `tokens` is a
-    // writable buffer sized by `tokens.len()`.
-    let mut n = unsafe {
-        llama_tokenize(
-            vocab,
-            prompt,
-            prompt_len as i32,
-            tokens.as_mut_ptr(),
-            tokens.len() as i32,
-            true,
-            true,
-        )
-    };
-    if n < 0 {
-        let needed = (-n) as usize;
-        tokens = vec![0; needed.max(1)];
-        // SAFETY: `tokens` was resized to the capacity requested by llama.cpp.
-        n = unsafe {
-            llama_tokenize(
-                vocab,
-                prompt,
-                prompt_len as i32,
-                tokens.as_mut_ptr(),
-                tokens.len() as i32,
-                true,
-                true,
-            )
-        };
-    }
-
-    if n > 0 {
-        n as u32
-    } else {
-        0
-    }
+    let prompt = unsafe { std::ffi::CStr::from_ptr(prompt) }.to_string_lossy();
+    // The tokens are cached, so the generation that follows does not
+    // tokenize the prompt again.
+    // SAFETY: `vocab` belongs to the live model of `ctx`.
+    unsafe { crate::chat_prompt::tokenize_prompt(vocab, &prompt) }.len() as u32
 }
 
 #[cfg(target_os = "android")]
@@ -198,82 +146,15 @@ fn build_chat_prompt_with_gguf_template(
 
     // SAFETY: `ctx` was checked for null above and is only queried for its model pointer.
     let model = unsafe { llama_get_model(ctx) };
-    if model.is_null() {
-        return None;
-    }
-
-    let key = CString::new("tokenizer.chat_template").ok()?;
-    let mut tmpl_buf = vec![0u8; 8192];
-    // SAFETY: `model`, `key`, and `tmpl_buf` are valid for this metadata copy.
-    let got = unsafe {
-        llama_model_meta_val_str(
+    // SAFETY: `model` belongs to the live context; null is rejected inside.
+    unsafe {
+        crate::chat_prompt::render(
             model,
-            key.as_ptr(),
-            tmpl_buf.as_mut_ptr() as *mut std::os::raw::c_char,
-            tmpl_buf.len(),
+            messages
+                .iter()
+                .map(|m| (m.role.as_str(), m.content.as_str())),
         )
-    };
-    if got <= 0 {
-        return None;
     }
-
-    // SAFETY: llama.cpp returned a positive byte count into `tmpl_buf`; metadata
-    // string values are NUL-terminated C strings.
-    let tmpl_cstr = unsafe { CStr::from_ptr(tmpl_buf.as_ptr() as *const std::os::raw::c_char) };
-
-    let mut role_cstrs = Vec::with_capacity(messages.len());
-    let mut content_cstrs = Vec::with_capacity(messages.len());
-    let mut chat_msgs = Vec::with_capacity(messages.len());
-
-    for m in messages {
-        let role = CString::new(m.role.as_str()).ok()?;
-        let content = CString::new(m.content.as_str()).ok()?;
-        chat_msgs.push(crate::llama_chat_message {
-            role: role.as_ptr(),
-            content: content.as_ptr(),
-        });
-        role_cstrs.push(role);
-        content_cstrs.push(content);
-    }
-
-    // SAFETY: `tmpl_cstr` and `chat_msgs` point to live C strings/vectors for
-    // this sizing call; null output buffer with length 0 requests required size.
-    let needed = unsafe {
-        llama_chat_apply_template(
-            tmpl_cstr.as_ptr(),
-            chat_msgs.as_ptr(),
-            chat_msgs.len(),
-            true,
-            std::ptr::null_mut(),
-            0,
-        )
-    };
-    if needed <= 0 {
-        return None;
-    }
-
-    let mut out = vec![0u8; needed as usize + 1];
-    // SAFETY: `out` is a writable buffer of the advertised length and all chat
-    // message pointers remain owned by `role_cstrs`/`content_cstrs` for the call.
-    let written = unsafe {
-        llama_chat_apply_template(
-            tmpl_cstr.as_ptr(),
-            chat_msgs.as_ptr(),
-            chat_msgs.len(),
-            true,
-            out.as_mut_ptr() as *mut std::os::raw::c_char,
-            out.len() as i32,
-        )
-    };
-    if written <= 0 {
-        return None;
-    }
-
-    // SAFETY: positive `written` indicates `out` now contains a NUL-terminated prompt.
-    let s = unsafe { CStr::from_ptr(out.as_ptr() as *const std::os::raw::c_char) }
-        .to_string_lossy()
-        .to_string();
-    Some(s)
 }
 
 #[cfg(target_os = "android")]
@@ -816,7 +697,7 @@ pub async fn perform_android_login_with_tls(
         network_tx: 0,
     };
     // Create Login command (same structure as TCPWorker::login())
-    const CURRENT_VERSION: u32 = 1;
+    const CURRENT_VERSION: u32 = common::PROTOCOL_VERSION;
 
     // Calculate device metrics from actual device info
     let device_memtotal_gb = devices_info.memsize_gb.try_into().unwrap_or(0);
@@ -849,6 +730,7 @@ pub async fn perform_android_login_with_tls(
 
     // Send login command using common library function
     info!("📤 Android: Sending login command...");
+    crate::SERVER_FEATURES.store(0, Ordering::Release);
     common::write_command_sync(&mut stream, &Command::V1(login_cmd))
         .map_err(|e| anyhow!("Failed to send login command: {}", e))?;
 
@@ -920,6 +802,70 @@ fn write_v1_to_control_stream(stream: &Arc<Mutex<MobileControlStream>>, command:
     }
 }
 
+/// Send one heartbeat round. `WorkerStatus` is only accepted on the
+/// logged-in connection, so a round carrying it goes out there; otherwise the
+/// round keeps a short-lived connection of its own, as older servers expect.
+#[cfg(target_os = "android")]
+fn send_heartbeat_round(
+    control: &Arc<Mutex<MobileControlStream>>,
+    round: &[Command],
+) -> Result<()> {
+    let write_round = |stream: &mut MobileControlStream| {
+        round
+            .iter()
+            .try_for_each(|command| common::write_command_sync(stream, command))
+    };
+    if matches!(
+        round.first(),
+        Some(Command::V2(CommandV2::WorkerStatus { .. }))
+    ) {
+        let mut stream = control
+            .lock()
+            .map_err(|_| anyhow!("control stream mutex poisoned"))?;
+        return write_round(&mut stream);
+    }
+    let server_addr = ANDROID_SERVER_ADDR
+        .get()
+        .and_then(|m| m.lock().ok().and_then(|g| g.clone()))
+        .ok_or_else(|| anyhow!("server address not stored"))?;
+    let control_port = ANDROID_CONTROL_PORT
+        .get()
+        .and_then(|m| m.lock().ok().and_then(|g| *g))
+        .ok_or_else(|| anyhow!("control port not stored"))?;
+    let tls_config = get_android_control_tls_config();
+    let mut stream = connect_mobile_control_stream(&server_addr, control_port, &tls_config)?;
+    write_round(&mut stream)
+}
+
+/// Run an `EmbeddingTask` off the read loop and reply on `stream`.
+#[cfg(target_os = "android")]
+fn spawn_embedding_task(
+    stream: Arc<Mutex<MobileControlStream>>,
+    task_id: String,
+    inputs: Vec<String>,
+    normalize: bool,
+) {
+    std::thread::spawn(move || {
+        let result = match crate::embedding::embed_serving(&inputs, normalize) {
+            Ok((embeddings, dim, prompt_tokens)) => CommandV1::EmbeddingResult {
+                task_id,
+                dim,
+                embeddings,
+                prompt_tokens,
+                error: None,
+            },
+            Err(e) => CommandV1::EmbeddingResult {
+                task_id,
+                dim: 0,
+                embeddings: Vec::new(),
+                prompt_tokens: 0,
+                error: Some(e),
+            },
+        };
+        write_v1_to_control_stream(&stream, result);
+    });
+}
+
 /// Initialize global worker for Android
 #[cfg(target_os = "android")]
 pub async fn init_global_worker(args: Args) -> Result<()> {
@@ -960,7 +906,7 @@ pub async fn start_worker_tasks() -> Result<()> {
         .map_err(|_| anyhow!("Failed to set stop signal"))?;
 
     // Spawn heartbeat task using native thread with full heartbeat logic
-    let _heartbeat_stream = tcp_stream.clone();
+    let heartbeat_control = tcp_stream.clone();
     let heartbeat_stop_signal = stop_signal.clone();
     let _heartbeat_handle = thread::spawn(move || {
         println!("🔧 Android: Heartbeat thread started");
@@ -1007,47 +953,26 @@ pub async fn start_worker_tasks() -> Result<()> {
                 cpu_usage, memory_usage, disk_usage, network_tx, network_rx, device_info.memtotal_gb
             );
 
-            // Send heartbeat using independent TCP connection to avoid lock conflicts
-            let server_addr = match ANDROID_SERVER_ADDR
-                .get()
-                .and_then(|m| m.lock().ok().and_then(|g| g.clone()))
-            {
-                Some(addr) => addr,
-                None => {
-                    eprintln!("❌ Android: Server address not stored, skipping heartbeat");
-                    continue;
-                }
-            };
-
-            let control_port = match ANDROID_CONTROL_PORT
-                .get()
-                .and_then(|m| m.lock().ok().and_then(|g| *g))
-            {
-                Some(port) => port,
-                None => {
-                    eprintln!("❌ Android: Control port not stored, skipping heartbeat");
-                    continue;
-                }
-            };
-            let tls_config = get_android_control_tls_config();
-            let mut heartbeat_stream =
-                match connect_mobile_control_stream(&server_addr, control_port, &tls_config) {
-                    Ok(stream) => {
-                        println!("✅ Android: Connected to server for heartbeat");
-                        stream
-                    }
-                    Err(e) => {
-                        eprintln!("❌ Android: Failed to connect for heartbeat: {}", e);
-                        continue;
-                    }
-                };
-
             // Create heartbeat command
             let client_id = ANDROID_CLIENT_ID
                 .get()
                 .and_then(|m| m.lock().ok().and_then(|g| *g))
                 .unwrap_or([0u8; 16]);
-            let heartbeat_cmd = CommandV1::Heartbeat {
+            let mut round = Vec::with_capacity(2);
+            if crate::server_accepts_worker_status() {
+                round.push(Command::V2(CommandV2::WorkerStatus {
+                    client_id,
+                    resident_models: crate::model_registry::resident_paths()
+                        .iter()
+                        .map(|path| derive_model_id_from_path(path))
+                        .collect(),
+                    inference_stats: crate::perf::take_heartbeat_stats(),
+                    perf_capacity: crate::perf_profile::heartbeat_capacity(),
+                    task_slots: crate::WORKER_TASK_SLOTS,
+                    gpu_placement: None,
+                }));
+            }
+            round.push(Command::V1(CommandV1::Heartbeat {
                 client_id,
                 system_info: SystemInfo {
                     cpu_usage: cpu_usage as u8,
@@ -1060,22 +985,15 @@ pub async fn start_worker_tasks() -> Result<()> {
                 device_total_tflops: device_info.total_tflops.into(),
                 device_count: device_info.num as u16,
                 devices_info: vec![device_info],
-            };
+            }));
 
-            // Send heartbeat using common library function
-            if let Err(e) =
-                common::write_command_sync(&mut heartbeat_stream, &Command::V1(heartbeat_cmd))
-            {
+            if let Err(e) = send_heartbeat_round(&heartbeat_control, &round) {
                 eprintln!("❌ Android: Failed to send heartbeat: {}", e);
                 println!("🔧 Android: Continuing heartbeat loop despite send failure...");
             } else {
                 println!("✅ Android: Heartbeat sent successfully");
             }
 
-            // Close the connection after sending heartbeat
-            drop(heartbeat_stream);
-            println!("🔧 Android: Heartbeat connection closed, starting next iteration...");
-
             // Sleep with periodic stop signal checks
             for _ in 0..120 {
                 // 120 seconds / 1 second intervals
@@ -1206,13 +1124,13 @@ pub async fn start_worker_tasks() -> Result<()> {
                                                              max_tokens, temperature, top_k, top_p);
 
                                 use crate::llama_context;
-                                use crate::{
-                                    gpuf_start_generation_async, GLOBAL_CONTEXT_PTR,
-                                    GLOBAL_INFERENCE_MUTEX,
-                                };
+                                use crate::{gpuf_start_generation_async, GLOBAL_INFERENCE_MUTEX};
                                 use std::ffi::CString;
                                 use std::os::raw::c_void;
-                                let context_ptr = GLOBAL_CONTEXT_PTR.load(Ordering::SeqCst);
+                                // Lease the serving model so a hot swap cannot free it mid-task.
+                                let serving = crate::serving_model();
+                                let context_ptr =
+                                    serving.as_ref().map_or(std::ptr::null_mut(), |s| s.context);
                                 if context_ptr.is_null() {
                                     let result_command = CommandV1::InferenceResultChunk {
                                         task_id: task_id.clone(),
@@ -1250,6 +1168,7 @@ pub async fn start_worker_tasks() -> Result<()> {
                                 let prompt_for_thread = prompt.clone();
                                 let context_ptr_usize = context_ptr as usize;
                                 std::thread::spawn(move || {
+                                    let _serving = serving;
                                     let context_ptr = context_ptr_usize as *mut llama_context;
                                     #[repr(C)]
                                     struct TokenCallbackState {
@@ -1257,7 +1176,7 @@ pub async fn start_worker_tasks() -> Result<()> {
                                         task_id: String,
                                         seq: u32,
                                         buf: String,
-                                        max_bytes: usize,
+                                        coalescer: StreamCoalescer,
                                         prompt_tokens: u32,
                                         completion_tokens: u32,
                                         analysis_tokens: u32,
@@ -1331,6 +1250,7 @@ pub async fn start_worker_tasks() -> Result<()> {
                                                 state.buf_phase = phase;
                                             } else if state.buf_phase != phase {
                                                 let delta = std::mem::take(&mut state.buf);
+                                                state.coalescer.reset();
                                                 let chunk = CommandV1::InferenceResultChunk {
                                                     task_id: state.task_id.clone(),
                                                     seq: state.seq,
@@ -1351,11 +1271,13 @@ pub async fn start_worker_tasks() -> Result<()> {
                                             state.buf.push_str(&seg);
                                         }
 
-                                        if state.buf.len() < state.max_bytes {
+                                        if !state.coalescer.push(state.buf.len()) {
                                             return;
                                         }
 
                                         let delta = std::mem::take(&mut state.buf);
+
+                                        state.coalescer.reset();
                                         let chunk = CommandV1::InferenceResultChunk {
                                             task_id: state.task_id.clone(),
                                             seq: state.seq,
@@ -1407,7 +1329,7 @@ pub async fn start_worker_tasks() -> Result<()> {
                                         task_id: task_id_for_thread.clone(),
                                         seq: 0,
                                         buf: String::new(),
-                                        max_bytes: 8,
+                                        coalescer: StreamCoalescer::default(),
                                         prompt_tokens,
                                         completion_tokens: 0,
                                         analysis_tokens: 0,
@@ -1498,13 +1420,13 @@ pub async fn start_worker_tasks() -> Result<()> {
                                 println!("🔧 Android: Received chat inference task: {}", task_id);
 
                                 use crate::llama_context;
-                                use crate::{
-                                    gpuf_start_generation_async, GLOBAL_CONTEXT_PTR,
-                                    GLOBAL_INFERENCE_MUTEX,
-                                };
+                                use crate::{gpuf_start_generation_async, GLOBAL_INFERENCE_MUTEX};
                                 use std::ffi::CString;
                                 use std::os::raw::c_void;
-                                let context_ptr = GLOBAL_CONTEXT_PTR.load(Ordering::SeqCst);
+                                // Lease the serving model so a hot swap cannot free it mid-task.
+                                let serving = crate::serving_model();
+                                let context_ptr =
+                                    serving.as_ref().map_or(std::ptr::null_mut(), |s| s.context);
                                 if context_ptr.is_null() {
                                     let result_command = CommandV1::InferenceResultChunk {
                                         task_id: task_id.clone(),
@@ -1547,6 +1469,7 @@ pub async fn start_worker_tasks() -> Result<()> {
                                 let prompt_for_thread = prompt.clone();
                                 let context_ptr_usize = context_ptr as usize;
                                 std::thread::spawn(move || {
+                                    let _serving = serving;
                                     let context_ptr = context_ptr_usize as *mut llama_context;
                                     #[repr(C)]
                                     struct TokenCallbackState {
@@ -1554,7 +1477,7 @@ pub async fn start_worker_tasks() -> Result<()> {
                                         task_id: String,
                                         seq: u32,
                                         buf: String,
-                                        max_bytes: usize,
+                                        coalescer: StreamCoalescer,
                                         prompt_tokens: u32,
                                         completion_tokens: u32,
                                         suppress: bool,
@@ -1601,11 +1524,13 @@ pub async fn start_worker_tasks() -> Result<()> {
                                         state.buf.push_str(token_str);
                                         state.completion_tokens =
                                             state.completion_tokens.saturating_add(1);
-                                        if state.buf.len() < state.max_bytes {
+                                        if !state.coalescer.push(state.buf.len()) {
                                             return;
                                         }
 
                                         let delta = std::mem::take(&mut state.buf);
+
+                                        state.coalescer.reset();
                                         let chunk = CommandV1::InferenceResultChunk {
                                             task_id: state.task_id.clone(),
                                             seq: state.seq,
@@ -1656,7 +1581,7 @@ pub async fn start_worker_tasks() -> Result<()> {
                                         task_id: task_id_for_thread.clone(),
                                         seq: 0,
                                         buf: String::new(),
-                                        max_bytes: 8,
+                                        coalescer: StreamCoalescer::default(),
                                         prompt_tokens,
                                         completion_tokens: 0,
                                         suppress: false,
@@ -1722,6 +1647,24 @@ pub async fn start_worker_tasks() -> Result<()> {
                                     }
                                 });
                             }
+                            CommandV1::EmbeddingTask {
+                                task_id,
+                                model: _,
+                                inputs,
+                                normalize,
+                            } => {
+                                println!(
+                                    "🔧 Android: Received embedding task: {} ({} inputs)",
+                                    task_id,
+                                    inputs.len()
+                                );
+                                spawn_embedding_task(
+                                    handler_stream.clone(),
+                                    task_id,
+                                    inputs,
+                                    normalize,
+                                );
+                            }
                             CommandV1::CancelInference { task_id } => {
                                 let should_cancel = {
                                     let active_lock = ANDROID_ACTIVE_TASK_ID
@@ -1733,12 +1676,8 @@ pub async fn start_worker_tasks() -> Result<()> {
                                 };
 
                                 if should_cancel {
-                                    use crate::{gpuf_stop_generation, GLOBAL_CONTEXT_PTR};
-                                    let context_ptr = GLOBAL_CONTEXT_PTR.load(Ordering::SeqCst);
-                                    if !context_ptr.is_null() {
-                                        // `context_ptr` was loaded from the global context slot
-                                        // and checked for null before cancellation.
-                                        gpuf_stop_generation(context_ptr);
+                                    if let Some(serving) = crate::serving_model() {
+                                        crate::gpuf_stop_generation(serving.context);
                                     }
                                 }
                             }
@@ -1746,6 +1685,9 @@ pub async fn start_worker_tasks() -> Result<()> {
                                 println!("⚠️ Android: Received unhandled command type");
                             }
                         },
+                        Command::V2(CommandV2::ServerFeatures { features }) => {
+                            crate::SERVER_FEATURES.store(features, Ordering::Release);
+                        }
                         _ => {
                             println!("⚠️ Android: Received non-V1 command");
                         }
@@ -1845,7 +1787,7 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
     let _device_info_for_handler = devices_info.clone();
 
     // Spawn heartbeat task using native thread with full heartbeat logic
-    let _heartbeat_stream = tcp_stream.clone();
+    let heartbeat_control = tcp_stream.clone();
     let heartbeat_callback = callback;
     let heartbeat_stop_signal = stop_signal.clone();
     let heartbeat_handle = thread::spawn(move || {
@@ -1885,56 +1827,26 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                 cpu_usage, memory_usage, disk_usage, network_tx, network_rx, device_info.memtotal_gb
             );
 
-            // Send heartbeat using independent TCP connection to avoid lock conflicts
-            let server_addr = match ANDROID_SERVER_ADDR
-                .get()
-                .and_then(|m| m.lock().ok().and_then(|g| g.clone()))
-            {
-                Some(addr) => addr,
-                None => {
-                    eprintln!("❌ Android: Server address not set");
-                    continue;
-                }
-            };
-
-            let control_port = match ANDROID_CONTROL_PORT
-                .get()
-                .and_then(|m| m.lock().ok().and_then(|g| *g))
-            {
-                Some(port) => port,
-                None => {
-                    eprintln!("❌ Android: Control port not set");
-                    continue;
-                }
-            };
-
-            let tls_config = get_android_control_tls_config();
-            let mut stream =
-                match connect_mobile_control_stream(&server_addr, control_port, &tls_config) {
-                    Ok(s) => {
-                        println!("✅ Android: Connected to server for heartbeat");
-                        s
-                    }
-                    Err(e) => {
-                        eprintln!("❌ Android: Failed to connect for heartbeat: {}", e);
-                        if let Some(callback_fn) = heartbeat_callback {
-                            let error_msg =
-                                match CString::new("ERROR - Failed to connect for heartbeat") {
-                                    Ok(s) => s,
-                                    Err(_) => continue,
-                                };
-                            call_status_callback(Some(callback_fn), &error_msg);
-                        }
-                        continue;
-                    }
-                };
-
             // Create heartbeat command
             let client_id = ANDROID_CLIENT_ID
                 .get()
                 .and_then(|m| m.lock().ok().and_then(|g| *g))
                 .unwrap_or([0u8; 16]);
-            let heartbeat_cmd = CommandV1::Heartbeat {
+            let mut round = Vec::with_capacity(3);
+            if crate::server_accepts_worker_status() {
+                round.push(Command::V2(CommandV2::WorkerStatus {
+                    client_id,
+                    resident_models: crate::model_registry::resident_paths()
+                        .iter()
+                        .map(|path| derive_model_id_from_path(path))
+                        .collect(),
+                    inference_stats: crate::perf::take_heartbeat_stats(),
+                    perf_capacity: crate::perf_profile::heartbeat_capacity(),
+                    task_slots: crate::WORKER_TASK_SLOTS,
+                    gpu_placement: None,
+                }));
+            }
+            round.push(Command::V1(CommandV1::Heartbeat {
                 client_id,
                 system_info: SystemInfo {
                     cpu_usage: cpu_usage as u8,
@@ -1947,10 +1859,25 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                 device_total_tflops: device_info.total_tflops.into(),
                 device_count: device_info.num as u16,
                 devices_info: vec![device_info],
-            };
-
-            // Send heartbeat using common library function
-            if let Err(e) = common::write_command_sync(&mut stream, &Command::V1(heartbeat_cmd)) {
+            }));
+            let current_model_path = crate::MODEL_STATUS
+                .lock()
+                .ok()
+                .and_then(|s| s.current_model.clone())
+                .unwrap_or_else(|| "android".to_string());
+            let model_id = derive_model_id_from_path(&current_model_path);
+            round.push(Command::V1(CommandV1::ModelStatus {
+                client_id,
+                models: vec![Model {
+                    id: model_id,
+                    object: "model".to_string(),
+                    created: 0,
+                    owned_by: "android".to_string(),
+                }],
+                auto_models_device: Vec::new(),
+            }));
+
+            if let Err(e) = send_heartbeat_round(&heartbeat_control, &round) {
                 eprintln!("❌ Android: Failed to send heartbeat: {}", e);
                 println!("🔧 Android: Continuing heartbeat loop despite send failure...");
                 if let Some(callback_fn) = heartbeat_callback {
@@ -1962,34 +1889,8 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                     call_status_callback(Some(callback_fn), &error_msg);
                 }
             } else {
-                println!("✅ Android: Heartbeat sent successfully");
-                {
-                    let current_model_path = crate::MODEL_STATUS
-                        .lock()
-                        .ok()
-                        .and_then(|s| s.current_model.clone())
-                        .unwrap_or_else(|| "android".to_string());
-                    let model_id = derive_model_id_from_path(&current_model_path);
-                    let models = vec![Model {
-                        id: model_id,
-                        object: "model".to_string(),
-                        created: 0,
-                        owned_by: "android".to_string(),
-                    }];
-                    let model_status = CommandV1::ModelStatus {
-                        client_id,
-                        models,
-                        auto_models_device: Vec::new(),
-                    };
-                    if let Err(e) =
-                        common::write_command_sync(&mut stream, &Command::V1(model_status))
-                    {
-                        eprintln!("❌ Android: Failed to send model status: {}", e);
-                    } else {
-                        println!("✅ Android: Model status sent successfully");
-                    }
-                    std::io::stdout().flush().ok();
-                }
+                println!("✅ Android: Heartbeat and model status sent successfully");
+                std::io::stdout().flush().ok();
                 if let Some(callback_fn) = heartbeat_callback {
                     let success_msg = match CString::new("SUCCESS - Heartbeat sent successfully") {
                         Ok(s) => s,
@@ -1999,10 +1900,6 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                 }
             }
 
-            // Close the connection after sending heartbeat
-            drop(stream);
-            println!("🔧 Android: Heartbeat connection closed, starting next iteration...");
-
             // Sleep with periodic stop signal checks
             for _ in 0..120 {
                 // 120 seconds / 1 second intervals
@@ -2224,12 +2121,15 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
 
                                     use crate::llama_context;
                                     use crate::{
-                                        gpuf_start_generation_async, GLOBAL_CONTEXT_PTR,
-                                        GLOBAL_INFERENCE_MUTEX,
+                                        gpuf_start_generation_async, GLOBAL_INFERENCE_MUTEX,
                                     };
                                     use std::ffi::CString;
                                     use std::os::raw::c_void;
-                                    let context_ptr = GLOBAL_CONTEXT_PTR.load(Ordering::SeqCst);
+                                    // Lease the serving model so a hot swap cannot free it mid-task.
+                                    let serving = crate::serving_model();
+                                    let context_ptr = serving
+                                        .as_ref()
+                                        .map_or(std::ptr::null_mut(), |s| s.context);
                                     if context_ptr.is_null() {
                                         let err = "Model not loaded - please load a model first"
                                             .to_string();
@@ -2270,6 +2170,7 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                                     let prompt_for_thread = prompt.clone();
                                     let context_ptr_usize = context_ptr as usize;
                                     std::thread::spawn(move || {
+                                        let _serving = serving;
                                         let context_ptr = context_ptr_usize as *mut llama_context;
                                         #[repr(C)]
                                         struct TokenCallbackState {
@@ -2277,7 +2178,7 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                                             task_id: String,
                                             seq: u32,
                                             buf: String,
-                                            max_bytes: usize,
+                                            coalescer: StreamCoalescer,
                                             prompt_tokens: u32,
                                             completion_tokens: u32,
                                             analysis_tokens: u32,
@@ -2352,6 +2253,7 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                                                     state.buf_phase = phase;
                                                 } else if state.buf_phase != phase {
                                                     let delta = std::mem::take(&mut state.buf);
+                                                    state.coalescer.reset();
                                                     let chunk = CommandV1::InferenceResultChunk {
                                                         task_id: state.task_id.clone(),
                                                         seq: state.seq,
@@ -2375,11 +2277,13 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                                                 state.buf.push_str(&seg);
                                             }
 
-                                            if state.buf.len() < state.max_bytes {
+                                            if !state.coalescer.push(state.buf.len()) {
                                                 return;
                                             }
 
                                             let delta = std::mem::take(&mut state.buf);
+
+                                            state.coalescer.reset();
                                             let chunk = CommandV1::InferenceResultChunk {
                                                 task_id: state.task_id.clone(),
                                                 seq: state.seq,
@@ -2438,7 +2342,7 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                                             task_id: task_id_for_thread.clone(),
                                             seq: 0,
                                             buf: String::new(),
-                                            max_bytes: 8,
+                                            coalescer: StreamCoalescer::default(),
                                             prompt_tokens,
                                             completion_tokens: 0,
                                             analysis_tokens: 0,
@@ -2513,11 +2417,15 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
 
                                         let execution_time =
                                             start_time.elapsed().as_millis() as u64;
+                                        let perf = crate::perf::last();
                                         invoke_callback(
                                             "INFERENCE_SUCCESS",
                                             &format!(
-                                                "Task: {} in {}ms",
-                                                task_id_for_thread, execution_time
+                                                "Task: {} in {}ms (ttft {:.0}ms, {:.1} tok/s)",
+                                                task_id_for_thread,
+                                                execution_time,
+                                                perf.ttft_ms,
+                                                perf.decode_tokens_per_second
                                             ),
                                         );
                                         invoke_callback(
@@ -2551,13 +2459,16 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
 
                                     use crate::llama_context;
                                     use crate::{
-                                        gpuf_start_generation_async, GLOBAL_CONTEXT_PTR,
-                                        GLOBAL_INFERENCE_MUTEX,
+                                        gpuf_start_generation_async, GLOBAL_INFERENCE_MUTEX,
                                     };
                                     use std::ffi::CString;
                                     use std::os::raw::c_void;
 
-                                    let context_ptr = GLOBAL_CONTEXT_PTR.load(Ordering::SeqCst);
+                                    // Lease the serving model so a hot swap cannot free it mid-task.
+                                    let serving = crate::serving_model();
+                                    let context_ptr = serving
+                                        .as_ref()
+                                        .map_or(std::ptr::null_mut(), |s| s.context);
                                     if context_ptr.is_null() {
                                         let err = "Model not loaded - please load a model first"
                                             .to_string();
@@ -2604,6 +2515,7 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                                     let prompt_for_thread = prompt.clone();
                                     let context_ptr_usize = context_ptr as usize;
                                     std::thread::spawn(move || {
+                                        let _serving = serving;
                                         let context_ptr = context_ptr_usize as *mut llama_context;
 
                                         #[repr(C)]
@@ -2612,7 +2524,7 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                                             task_id: String,
                                             seq: u32,
                                             buf: String,
-                                            max_bytes: usize,
+                                            coalescer: StreamCoalescer,
                                             prompt_tokens: u32,
                                             completion_tokens: u32,
                                             analysis_tokens: u32,
@@ -2688,6 +2600,7 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                                                     state.buf_phase = phase;
                                                 } else if state.buf_phase != phase {
                                                     let delta = std::mem::take(&mut state.buf);
+                                                    state.coalescer.reset();
                                                     let chunk = CommandV1::InferenceResultChunk {
                                                         task_id: state.task_id.clone(),
                                                         seq: state.seq,
@@ -2710,11 +2623,13 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
 
                                                 state.buf.push_str(&seg);
                                             }
-                                            if state.buf.len() < state.max_bytes {
+                                            if !state.coalescer.push(state.buf.len()) {
                                                 return;
                                             }
 
                                             let delta = std::mem::take(&mut state.buf);
+
+                                            state.coalescer.reset();
                                             let chunk = CommandV1::InferenceResultChunk {
                                                 task_id: state.task_id.clone(),
                                                 seq: state.seq,
@@ -2774,7 +2689,7 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                                             task_id: task_id_for_thread.clone(),
                                             seq: 0,
                                             buf: String::new(),
-                                            max_bytes: 8,
+                                            coalescer: StreamCoalescer::default(),
                                             prompt_tokens,
                                             completion_tokens: 0,
                                             analysis_tokens: 0,
@@ -2846,16 +2761,39 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
 
                                         let execution_time =
                                             start_time.elapsed().as_millis() as u64;
+                                        let perf = crate::perf::last();
                                         invoke_callback(
                                             "INFERENCE_SUCCESS",
                                             &format!(
-                                                "Task: {} in {}ms",
-                                                task_id_for_thread, execution_time
+                                                "Task: {} in {}ms (ttft {:.0}ms, {:.1} tok/s)",
+                                                task_id_for_thread,
+                                                execution_time,
+                                                perf.ttft_ms,
+                                                perf.decode_tokens_per_second
                                             ),
                                         );
                                     });
                                 }
 
+                                CommandV1::EmbeddingTask {
+                                    task_id,
+                                    model: _,
+                                    inputs,
+                                    normalize,
+                                } => {
+                                    println!(
+                                        "🔧 Android: Received embedding task: {} ({} inputs)",
+                                        task_id,
+                                        inputs.len()
+                                    );
+                                    spawn_embedding_task(
+                                        handler_stream.clone(),
+                                        task_id,
+                                        inputs,
+                                        normalize,
+                                    );
+                                }
+
                                 CommandV1::CancelInference { task_id } => {
                                     let should_cancel = {
                                         let active_lock = ANDROID_ACTIVE_TASK_ID
@@ -2867,10 +2805,8 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                                     };
 
                                     if should_cancel {
-                                        use crate::{gpuf_stop_generation, GLOBAL_CONTEXT_PTR};
-                                        let context_ptr = GLOBAL_CONTEXT_PTR.load(Ordering::SeqCst);
-                                        if !context_ptr.is_null() {
-                                            gpuf_stop_generation(context_ptr);
+                                        if let Some(serving) = crate::serving_model() {
+                                            crate::gpuf_stop_generation(serving.context);
                                         }
                                     }
                                 }
@@ -2880,6 +2816,9 @@ pub async fn start_worker_tasks_with_callback_ptr(callback: Option<StatusCallbac
                                 }
                             }
                         }
+                        Command::V2(CommandV2::ServerFeatures { features }) => {
+                            crate::SERVER_FEATURES.store(features, Ordering::Release);
+                        }
                         _ => {
                             println!("⚠️ Android: Received non-V1 command");
                             invoke_callback("WARNING", "Received non-V1 command");
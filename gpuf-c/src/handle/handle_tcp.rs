@@ -4,23 +4,22 @@ use crate::handle::handle_udp::{P2PReplayWindow, P2PUdpReassemblyState};
 // LLM engine is not available in lightweight Android version
 #[cfg(not(target_os = "android"))]
 use crate::llm_engine::{self, llama_engine::LlamaEngine};
+use crate::util::stream_coalescer::StreamCoalescer;
 use crate::util::system_info::{
     collect_device_info, collect_system_info, get_engine_models, pull_ollama_model,
 };
 use crate::util::{log_icon, security_metrics};
 use anyhow::{anyhow, Result};
 use common::{
-    format_bytes, format_duration, join_streams, read_command, write_command, Command, CommandV1,
-    CommandV2, DownloadStatus, EngineType as ClientEngineType, Model, OsType, OutputPhase,
-    P2PCandidate, P2PCandidateType, P2PConnectionType, P2PTransport, PodModel, SystemInfo,
-    MAX_MESSAGE_SIZE,
+    format_bytes, format_duration, join_streams, write_command, Command, CommandV1, CommandV2,
+    DownloadStatus, EngineType as ClientEngineType, Model, OsType, OutputPhase, P2PCandidate,
+    P2PCandidateType, P2PConnectionType, P2PTransport, PodModel, SystemInfo,
 };
 use tokio::io::AsyncWriteExt;
 
 #[cfg(not(target_os = "android"))]
 use futures_util::StreamExt;
 
-use bytes::BytesMut;
 use std::collections::HashMap;
 use std::collections::HashSet;
 #[cfg(not(target_os = "android"))]
@@ -41,6 +40,10 @@ use tokio::time::timeout;
 #[cfg(not(target_os = "android"))]
 static HTTP_SERVER_STARTED: AtomicBool = AtomicBool::new(false);
 
+// Same for the LAN model peer server (`--model-peer-listen`)
+#[cfg(not(target_os = "android"))]
+static MODEL_PEER_SERVER_STARTED: AtomicBool = AtomicBool::new(false);
+
 // Global engine cache - initialized once on startup, reused on reconnection
 #[cfg(not(target_os = "android"))]
 use std::sync::OnceLock;
@@ -357,6 +360,157 @@ impl PhaseSplitter {
     }
 }
 
+/// Turns a P2P token stream into data-plane chunks. Pieces go through the
+/// same control-token filter and phase split as the relay path and are
+/// coalesced like `InferenceResultChunk`s, except that the first chunk is
+/// sent as soon as it has text so time-to-first-token does not wait on the
+/// flush window. A chunk stays under `MAX_CHUNK_BYTES` so it fits one UDP
+/// fragment, which matters because the UDP sender waits for an ACK per
+/// message.
+#[cfg(not(target_os = "android"))]
+struct P2PStreamBatcher {
+    connection_id: [u8; 16],
+    task_id: String,
+    splitter: PhaseSplitter,
+    coalescer: StreamCoalescer,
+    buf: String,
+    buf_phase: OutputPhase,
+    seq: u32,
+    completion_tokens: u32,
+    analysis_tokens: u32,
+    final_tokens: u32,
+}
+
+#[cfg(not(target_os = "android"))]
+impl P2PStreamBatcher {
+    const MAX_CHUNK_BYTES: usize = 1024;
+
+    fn new(connection_id: [u8; 16], task_id: String) -> Self {
+        Self {
+            connection_id,
+            task_id,
+            splitter: PhaseSplitter::default(),
+            coalescer: StreamCoalescer::new(
+                crate::util::stream_coalescer::DEFAULT_FLUSH_TOKENS,
+                Duration::from_millis(crate::util::stream_coalescer::DEFAULT_FLUSH_MS),
+                Self::MAX_CHUNK_BYTES,
+            ),
+            buf: String::new(),
+            buf_phase: OutputPhase::Unknown,
+            seq: 0,
+            completion_tokens: 0,
+            analysis_tokens: 0,
+            final_tokens: 0,
+        }
+    }
+
+    /// Feed one generated piece; returns the chunks that are due.
+    fn push(&mut self, piece: &str) -> Vec<Command> {
+        let mut out = Vec::new();
+        // One piece is one generated token.
+        self.completion_tokens = self.completion_tokens.saturating_add(1);
+
+        let filtered = filter_control_tokens(piece);
+        for (phase, seg) in self.splitter.push(&filtered) {
+            if seg.is_empty() {
+                continue;
+            }
+            match phase {
+                OutputPhase::Analysis => {
+                    self.analysis_tokens = self.analysis_tokens.saturating_add(1)
+                }
+                OutputPhase::Final => self.final_tokens = self.final_tokens.saturating_add(1),
+                OutputPhase::Unknown => {}
+            }
+
+            if self.buf.is_empty() {
+                self.buf_phase = phase;
+            } else if self.buf_phase != phase || self.buf.len() + seg.len() > Self::MAX_CHUNK_BYTES
+            {
+                out.push(self.take_chunk());
+                self.buf_phase = phase;
+            }
+
+            self.buf.push_str(&seg);
+            let due = self.coalescer.push(self.buf.len());
+            if self.seq == 0 || due {
+                out.push(self.take_chunk());
+            }
+        }
+        out
+    }
+
+    /// The buffered tail (including text the splitter held back as a
+    /// possible marker prefix), then a terminal error chunk if generation
+    /// failed, then the done marker with the token counts.
+    fn finish(mut self, error: Option<String>) -> Vec<Command> {
+        let mut out = Vec::with_capacity(3);
+        let carry = std::mem::take(&mut self.splitter.carry);
+        if !carry.is_empty() {
+            let phase = self.splitter.phase();
+            if !self.buf.is_empty() && self.buf_phase != phase {
+                out.push(self.take_chunk());
+            }
+            if self.buf.is_empty() {
+                self.buf_phase = phase;
+            }
+            self.buf.push_str(&carry);
+        }
+        if !self.buf.is_empty() {
+            out.push(self.take_chunk());
+        }
+        if let Some(error) = error {
+            out.push(Command::V2(CommandV2::P2PInferenceChunk {
+                connection_id: self.connection_id,
+                task_id: self.task_id.clone(),
+                seq: self.seq,
+                delta: String::new(),
+                phase: OutputPhase::Unknown,
+                done: true,
+                error: Some(error),
+                analysis_tokens: self.analysis_tokens,
+                final_tokens: self.final_tokens,
+            }));
+        }
+        out.push(Command::V2(CommandV2::P2PInferenceDone {
+            connection_id: self.connection_id,
+            task_id: self.task_id,
+            prompt_tokens: 0,
+            completion_tokens: self.completion_tokens,
+            total_tokens: self.completion_tokens,
+            analysis_tokens: self.analysis_tokens,
+            final_tokens: self.final_tokens,
+        }));
+        out
+    }
+
+    fn take_chunk(&mut self) -> Command {
+        self.coalescer.reset();
+        let chunk = Command::V2(CommandV2::P2PInferenceChunk {
+            connection_id: self.connection_id,
+            task_id: self.task_id.clone(),
+            seq: self.seq,
+            delta: std::mem::take(&mut self.buf),
+            phase: self.buf_phase,
+            done: false,
+            error: None,
+            analysis_tokens: self.analysis_tokens,
+            final_tokens: self.final_tokens,
+        });
+        self.seq = self.seq.wrapping_add(1);
+        chunk
+    }
+}
+
+/// Downloaded models live next to the executable.
+fn models_dir() -> std::path::PathBuf {
+    std::env::current_exe()
+        .ok()
+        .and_then(|p| p.parent().map(|p| p.to_path_buf()))
+        .unwrap_or_else(|| std::path::PathBuf::from("."))
+        .join("models")
+}
+
 fn derive_model_id_from_path(model_path: &str) -> String {
     let lower = model_path.to_ascii_lowercase();
     if lower.contains("llama-3") || lower.contains("llama3") {
@@ -388,7 +542,7 @@ fn derive_model_id_from_path(model_path: &str) -> String {
     base.to_string()
 }
 
-const CURRENT_VERSION: u32 = 1;
+const CURRENT_VERSION: u32 = common::PROTOCOL_VERSION;
 
 impl ClientWorker {
     /// Execute inference task using local LLM engine (Android specific)
@@ -447,19 +601,21 @@ impl ClientWorker {
 
         #[cfg(target_os = "android")]
         {
-            use crate::{
-                gpuf_generate_final_solution_text, GLOBAL_CONTEXT_PTR, GLOBAL_INFERENCE_MUTEX,
-                GLOBAL_MODEL_PTR,
-            };
+            use crate::{gpuf_generate_final_solution_text, GLOBAL_INFERENCE_MUTEX};
             use std::ffi::CString;
-            use std::sync::atomic::Ordering;
+
+            // Lease the serving model first; the lease must outlive the lock
+            let serving = crate::serving_model();
 
             // Acquire global inference lock to prevent concurrent execution
             let _lock = GLOBAL_INFERENCE_MUTEX.lock().unwrap();
 
-            // Get global model and context pointers
-            let model_ptr = GLOBAL_MODEL_PTR.load(Ordering::SeqCst);
-            let context_ptr = GLOBAL_CONTEXT_PTR.load(Ordering::SeqCst);
+            // Get the serving model and context pointers
+            let (model_ptr, context_ptr) = serving
+                .as_ref()
+                .map_or((std::ptr::null_mut(), std::ptr::null_mut()), |s| {
+                    (s.model, s.context)
+                });
 
             if model_ptr.is_null() || context_ptr.is_null() {
                 return Err(anyhow!("Model not loaded - please load a model first"));
@@ -498,6 +654,35 @@ impl ClientWorker {
         }
     }
 
+    /// Embed the inputs of an `EmbeddingTask`: the vectors back to back,
+    /// their width and the number of prompt tokens.
+    async fn execute_embedding_task(
+        &self,
+        inputs: Vec<String>,
+        normalize: bool,
+    ) -> Result<(Vec<f32>, u32, u32)> {
+        #[cfg(not(target_os = "android"))]
+        {
+            let engine_guard = self.engine.lock().await;
+            let engine = engine_guard
+                .as_ref()
+                .ok_or_else(|| anyhow!("Engine not initialized"))?;
+
+            let AnyEngine::Llama(llama) = engine else {
+                return Err(anyhow!("EmbeddingTask is only supported for LLAMA engine"));
+            };
+            llama.embed_with_cached_model(inputs, normalize).await
+        }
+
+        #[cfg(target_os = "android")]
+        {
+            tokio::task::spawn_blocking(move || {
+                crate::embedding::embed_serving(&inputs, normalize).map_err(|e| anyhow!(e))
+            })
+            .await?
+        }
+    }
+
     async fn stream_inference_task_to_server(
         &self,
         task_id: String,
@@ -564,6 +749,11 @@ impl ClientWorker {
             let mut stream = Box::pin(stream);
 
             let max_bytes: usize = self.args.stream_chunk_bytes.max(1);
+            let mut coalescer = StreamCoalescer::new(
+                self.args.stream_flush_tokens,
+                Duration::from_millis(self.args.stream_flush_ms),
+                max_bytes,
+            );
             let mut seq: u32 = 0;
             let mut buf = String::new();
             let mut buf_phase: OutputPhase = OutputPhase::Unknown;
@@ -621,6 +811,7 @@ impl ClientWorker {
                                 buf_phase = phase;
                             } else if buf_phase != phase {
                                 let delta = std::mem::take(&mut buf);
+                                coalescer.reset();
                                 let chunk = CommandV1::InferenceResultChunk {
                                     task_id: task_id.clone(),
                                     seq,
@@ -639,8 +830,9 @@ impl ClientWorker {
                             }
 
                             buf.push_str(&seg);
-                            if buf.len() >= max_bytes {
+                            if coalescer.push(buf.len()) {
                                 let delta = std::mem::take(&mut buf);
+                                coalescer.reset();
                                 let chunk = CommandV1::InferenceResultChunk {
                                     task_id: task_id.clone(),
                                     seq,
@@ -661,8 +853,10 @@ impl ClientWorker {
                 }
             }
 
+            // The tail and the done marker go out together in one write.
+            let mut last = Vec::with_capacity(2);
             if !buf.is_empty() {
-                let chunk = CommandV1::InferenceResultChunk {
+                last.push(CommandV1::InferenceResultChunk {
                     task_id: task_id.clone(),
                     seq,
                     delta: buf,
@@ -673,12 +867,11 @@ impl ClientWorker {
                     completion_tokens,
                     analysis_tokens,
                     final_tokens,
-                };
-                self.send_command(chunk).await?;
+                });
                 seq = seq.wrapping_add(1);
             }
 
-            let done_chunk = CommandV1::InferenceResultChunk {
+            last.push(CommandV1::InferenceResultChunk {
                 task_id: task_id.clone(),
                 seq,
                 delta: String::new(),
@@ -689,8 +882,8 @@ impl ClientWorker {
                 completion_tokens,
                 analysis_tokens,
                 final_tokens,
-            };
-            self.send_command(done_chunk).await?;
+            });
+            self.send_commands(last).await?;
 
             if cancelled_early {
                 debug!(task_id = %task_id, "Sent done chunk after cancellation");
@@ -760,26 +953,27 @@ impl ClientWorker {
 
     /// Send command to server
     async fn send_command(&self, command: CommandV1) -> Result<()> {
-        use common::{write_command, Command};
+        use common::Command;
 
-        let command = Command::V1(command);
-        let mut writer = self.writer.lock().await;
-        write_command(&mut *writer, &command).await?;
-        writer.flush().await?;
-        Ok(())
+        self.writer.lock().await.send(&Command::V1(command)).await
+    }
+
+    /// Send several commands to the server in one write.
+    #[cfg(not(target_os = "android"))]
+    async fn send_commands(&self, commands: Vec<CommandV1>) -> Result<()> {
+        use common::Command;
+
+        let commands: Vec<Command> = commands.into_iter().map(Command::V1).collect();
+        self.writer.lock().await.send_all(&commands).await
     }
 
     async fn send_command_v2_on_writer(
         writer: Arc<Mutex<ControlWriter>>,
         command: CommandV2,
     ) -> Result<()> {
-        use common::{write_command, Command};
+        use common::Command;
 
-        let command = Command::V2(command);
-        let mut w = writer.lock().await;
-        write_command(&mut *w, &command).await?;
-        w.flush().await?;
-        Ok(())
+        writer.lock().await.send(&Command::V2(command)).await
     }
 
     fn parse_turns_url(url: &str) -> Result<(String, u16)> {
@@ -987,13 +1181,9 @@ impl ClientWorker {
     }
 
     async fn send_command_v2(&self, command: CommandV2) -> Result<()> {
-        use common::{write_command, Command};
+        use common::Command;
 
-        let command = Command::V2(command);
-        let mut writer = self.writer.lock().await;
-        write_command(&mut *writer, &command).await?;
-        writer.flush().await?;
-        Ok(())
+        self.writer.lock().await.send(&Command::V2(command)).await
     }
 
     async fn get_advertise_ip(&self) -> Result<String> {
@@ -1047,15 +1237,17 @@ impl ClientWorker {
     #[cfg(not(target_os = "android"))]
     async fn serve_p2p_io_with_engine<S: tokio::io::AsyncRead + tokio::io::AsyncWrite + Unpin>(
         engine: Arc<Mutex<Option<AnyEngine>>>,
-        mut stream: S,
+        stream: S,
         connection_id: [u8; 16],
         data_plane_secret: [u8; 32],
     ) -> Result<()> {
-        let mut buf = BytesMut::with_capacity(MAX_MESSAGE_SIZE);
+        let (reader, writer) = tokio::io::split(stream);
+        let mut reader = CommandReader::new(reader);
+        let mut writer = CommandWriter::new(writer);
         let mut inbound_replay = P2PReplayWindow::new();
         let mut outbound_seq: u64 = 1;
-        async fn write_signed_p2p_command<S: tokio::io::AsyncWrite + Unpin>(
-            stream: &mut S,
+        async fn write_signed_p2p_command<W: tokio::io::AsyncWrite + Unpin>(
+            writer: &mut CommandWriter<W>,
             command: &Command,
             connection_id: [u8; 16],
             data_plane_secret: [u8; 32],
@@ -1069,12 +1261,10 @@ impl ClientWorker {
                 ClientWorker::p2p_now_secs(),
             )?;
             *outbound_seq = outbound_seq.wrapping_add(1);
-            write_command(stream, &signed).await?;
-            stream.flush().await?;
-            Ok(())
+            writer.send(&signed).await
         }
         loop {
-            let signed_cmd = read_command(&mut stream, &mut buf).await?;
+            let signed_cmd = reader.read_command().await?;
             let cmd = match Self::p2p_decode_data_plane_envelope(
                 signed_cmd,
                 connection_id,
@@ -1132,7 +1322,7 @@ impl ClientWorker {
                             final_tokens: 0,
                         });
                         write_signed_p2p_command(
-                            &mut stream,
+                            &mut writer,
                             &chunk,
                             connection_id,
                             data_plane_secret,
@@ -1158,123 +1348,31 @@ impl ClientWorker {
                         .await?;
                     let mut token_stream = Box::pin(token_stream);
 
-                    let mut seq: u32 = 0;
-                    let mut buf = String::new();
-                    let mut buf_phase: OutputPhase = OutputPhase::Unknown;
-                    let mut splitter = PhaseSplitter::default();
-                    let mut analysis_tokens: u32 = 0;
-                    let mut final_tokens: u32 = 0;
-                    let max_bytes: usize = 64;
-
+                    let mut batcher = P2PStreamBatcher::new(connection_id, task_id);
                     while let Some(piece_res) = token_stream.next().await {
                         let piece = piece_res?;
-                        let filtered = filter_control_tokens(&piece);
-                        let segs = splitter.push(&filtered);
-                        for (phase, seg) in segs {
-                            if seg.is_empty() {
-                                continue;
-                            }
-                            match phase {
-                                OutputPhase::Analysis => {
-                                    analysis_tokens = analysis_tokens.saturating_add(1)
-                                }
-                                OutputPhase::Final => final_tokens = final_tokens.saturating_add(1),
-                                OutputPhase::Unknown => {}
-                            }
-
-                            if buf.is_empty() {
-                                buf_phase = phase;
-                            } else if buf_phase != phase {
-                                let delta = std::mem::take(&mut buf);
-                                let chunk = Command::V2(CommandV2::P2PInferenceChunk {
-                                    connection_id,
-                                    task_id: task_id.clone(),
-                                    seq,
-                                    delta,
-                                    phase: buf_phase,
-                                    done: false,
-                                    error: None,
-                                    analysis_tokens,
-                                    final_tokens,
-                                });
-                                write_signed_p2p_command(
-                                    &mut stream,
-                                    &chunk,
-                                    connection_id,
-                                    data_plane_secret,
-                                    &mut outbound_seq,
-                                )
-                                .await?;
-                                seq = seq.wrapping_add(1);
-                                buf_phase = phase;
-                            }
-
-                            buf.push_str(&seg);
-                            if buf.len() >= max_bytes {
-                                let delta = std::mem::take(&mut buf);
-                                let chunk = Command::V2(CommandV2::P2PInferenceChunk {
-                                    connection_id,
-                                    task_id: task_id.clone(),
-                                    seq,
-                                    delta,
-                                    phase: buf_phase,
-                                    done: false,
-                                    error: None,
-                                    analysis_tokens,
-                                    final_tokens,
-                                });
-                                write_signed_p2p_command(
-                                    &mut stream,
-                                    &chunk,
-                                    connection_id,
-                                    data_plane_secret,
-                                    &mut outbound_seq,
-                                )
-                                .await?;
-                            }
+                        for chunk in batcher.push(&piece) {
+                            write_signed_p2p_command(
+                                &mut writer,
+                                &chunk,
+                                connection_id,
+                                data_plane_secret,
+                                &mut outbound_seq,
+                            )
+                            .await?;
                         }
                     }
 
-                    if !buf.is_empty() {
-                        let delta = std::mem::take(&mut buf);
-                        let chunk = Command::V2(CommandV2::P2PInferenceChunk {
-                            connection_id,
-                            task_id: task_id.clone(),
-                            seq,
-                            delta,
-                            phase: buf_phase,
-                            done: false,
-                            error: None,
-                            analysis_tokens,
-                            final_tokens,
-                        });
+                    for command in batcher.finish(None) {
                         write_signed_p2p_command(
-                            &mut stream,
-                            &chunk,
+                            &mut writer,
+                            &command,
                             connection_id,
                             data_plane_secret,
                             &mut outbound_seq,
                         )
                         .await?;
                     }
-
-                    let done = Command::V2(CommandV2::P2PInferenceDone {
-                        connection_id,
-                        task_id,
-                        prompt_tokens: 0,
-                        completion_tokens: 0,
-                        total_tokens: 0,
-                        analysis_tokens,
-                        final_tokens,
-                    });
-                    write_signed_p2p_command(
-                        &mut stream,
-                        &done,
-                        connection_id,
-                        data_plane_secret,
-                        &mut outbound_seq,
-                    )
-                    .await?;
                 }
 
                 Command::V2(CommandV2::P2PCancelInference {
@@ -1399,6 +1497,21 @@ impl ClientWorker {
 
         info!("Debug: Engine type from args: {:?}", args.engine_type);
 
+        #[cfg(not(target_os = "android"))]
+        if let Some(listen) = args.model_peer_listen.clone() {
+            if !MODEL_PEER_SERVER_STARTED.swap(true, Ordering::SeqCst) {
+                let token = args.model_peer_token.clone();
+                tokio::spawn(async move {
+                    if let Err(e) =
+                        crate::util::model_peer::serve(models_dir(), &listen, token).await
+                    {
+                        error!("Model peer server error: {}", e);
+                        MODEL_PEER_SERVER_STARTED.store(false, Ordering::SeqCst);
+                    }
+                });
+            }
+        }
+
         let os_type = if cfg!(target_os = "macos") {
             OsType::MACOS
         } else if cfg!(target_os = "windows") {
@@ -1467,26 +1580,32 @@ impl ClientWorker {
                             "Creating LLAMA engine with configured model path ({} bytes)",
                             model_path.len()
                         );
-                        llm_engine::AnyEngine::Llama(LlamaEngine::with_config(
-                            model_path.clone(),
-                            args.n_ctx,
-                            args.n_batch,
-                            args.n_gpu_layers,
-                            args.llama_split_mode.clone(),
-                            args.llama_main_gpu,
-                            args.llama_devices.clone(),
-                        ))
+                        llm_engine::AnyEngine::Llama(
+                            LlamaEngine::with_config(
+                                model_path.clone(),
+                                args.n_ctx,
+                                args.n_batch,
+                                args.n_gpu_layers,
+                                args.llama_split_mode.clone(),
+                                args.llama_main_gpu,
+                                args.llama_devices.clone(),
+                            )
+                            .with_gpu_placement(args.gpu_placement),
+                        )
                     } else {
                         // Create engine without model (will be set later)
                         info!("Creating LLAMA engine without model (will be set later)");
-                        llm_engine::AnyEngine::Llama(LlamaEngine::with_runtime_config(
-                            args.n_ctx,
-                            args.n_batch,
-                            args.n_gpu_layers,
-                            args.llama_split_mode.clone(),
-                            args.llama_main_gpu,
-                            args.llama_devices.clone(),
-                        ))
+                        llm_engine::AnyEngine::Llama(
+                            LlamaEngine::with_runtime_config(
+                                args.n_ctx,
+                                args.n_batch,
+                                args.n_gpu_layers,
+                                args.llama_split_mode.clone(),
+                                args.llama_main_gpu,
+                                args.llama_devices.clone(),
+                            )
+                            .with_gpu_placement(args.gpu_placement),
+                        )
                     };
 
                     // Initialize the engine (only on first startup)
@@ -1612,26 +1731,32 @@ impl ClientWorker {
                             "Creating LLAMA engine with configured model path ({} bytes)",
                             model_path.len()
                         );
-                        llm_engine::AnyEngine::Llama(LlamaEngine::with_config(
-                            model_path.clone(),
-                            args.n_ctx,
-                            args.n_batch,
-                            args.n_gpu_layers,
-                            args.llama_split_mode.clone(),
-                            args.llama_main_gpu,
-                            args.llama_devices.clone(),
-                        ))
+                        llm_engine::AnyEngine::Llama(
+                            LlamaEngine::with_config(
+                                model_path.clone(),
+                                args.n_ctx,
+                                args.n_batch,
+                                args.n_gpu_layers,
+                                args.llama_split_mode.clone(),
+                                args.llama_main_gpu,
+                                args.llama_devices.clone(),
+                            )
+                            .with_gpu_placement(args.gpu_placement),
+                        )
                     } else {
                         // Create engine without model (will be set later)
                         info!("Creating LLAMA engine without model (will be set later)");
-                        llm_engine::AnyEngine::Llama(LlamaEngine::with_runtime_config(
-                            args.n_ctx,
-                            args.n_batch,
-                            args.n_gpu_layers,
-                            args.llama_split_mode.clone(),
-                            args.llama_main_gpu,
-                            args.llama_devices.clone(),
-                        ))
+                        llm_engine::AnyEngine::Llama(
+                            LlamaEngine::with_runtime_config(
+                                args.n_ctx,
+                                args.n_batch,
+                                args.n_gpu_layers,
+                                args.llama_split_mode.clone(),
+                                args.llama_main_gpu,
+                                args.llama_devices.clone(),
+                            )
+                            .with_gpu_placement(args.gpu_placement),
+                        )
                     };
 
                     // Initialize the engine (only on first startup)
@@ -1778,11 +1903,7 @@ impl ClientWorker {
             .ok_or_else(|| anyhow!("Model {} is missing required SHA256 checksum", model_name))?;
 
         // Get models directory (same level as executable)
-        let models_dir = std::env::current_exe()
-            .ok()
-            .and_then(|p| p.parent().map(|p| p.to_path_buf()))
-            .unwrap_or_else(|| std::path::PathBuf::from("."))
-            .join("models");
+        let models_dir = models_dir();
 
         // Create models directory if it doesn't exist
         tokio::fs::create_dir_all(&models_dir).await?;
@@ -1906,6 +2027,12 @@ impl ClientWorker {
             .await?;
         }
 
+        #[cfg(not(target_os = "android"))]
+        let peer_urls =
+            crate::util::model_peer::peer_file_urls(&self.args.model_peer_urls(), &model_name);
+        #[cfg(target_os = "android")]
+        let peer_urls: Vec<String> = Vec::new();
+
         // Create download config
         let config = crate::util::model_downloader::DownloadConfig {
             url: download_url.clone(),
@@ -1915,6 +2042,8 @@ impl ClientWorker {
             expected_size: pod_model.expected_size,
             checksum: checksum.clone(),
             resume: true,
+            peer_urls: peer_urls.clone(),
+            peer_token: self.args.model_peer_token.clone(),
         };
 
         // Setup progress reporting with 10 second interval
@@ -1955,7 +2084,7 @@ impl ClientWorker {
                     let writer_clone = writer.clone();
                     tokio::task::spawn(async move {
                         let mut writer_guard = writer_clone.lock().await;
-                        let _ = write_command(&mut *writer_guard, &cmd).await;
+                        let _ = writer_guard.send(&cmd).await;
                     });
                 }
             }
@@ -2047,6 +2176,8 @@ impl ClientWorker {
                             expected_size: pod_model.expected_size,
                             checksum: checksum.clone(),
                             resume: true,
+                            peer_urls: peer_urls.clone(),
+                            peer_token: self.args.model_peer_token.clone(),
                         };
                         downloader = crate::util::model_downloader::ModelDownloader::new(config);
                         downloader.set_progress_callback({
@@ -2078,7 +2209,7 @@ impl ClientWorker {
                                     let writer_clone = writer.clone();
                                     tokio::task::spawn(async move {
                                         let mut writer_guard = writer_clone.lock().await;
-                                        let _ = write_command(&mut *writer_guard, &cmd).await;
+                                        let _ = writer_guard.send(&cmd).await;
                                     });
                                 }
                             }
@@ -2228,7 +2359,8 @@ impl WorkerHandle for ClientWorker {
                 "{} About to write login command to server...",
                 log_icon("📤", "[SEND]")
             );
-            match write_command(&mut *self.writer.lock().await, &Command::V1(login_cmd)).await {
+            crate::SERVER_FEATURES.store(0, Ordering::Release);
+            match self.writer.lock().await.send(&Command::V1(login_cmd)).await {
                 Ok(_) => {
                     info!(
                         "{} Login command written successfully",
@@ -2315,9 +2447,11 @@ impl WorkerHandle for ClientWorker {
                         models,
                         auto_models_device,
                     };
-                    if let Err(e) =
-                        write_command(&mut *writer_clone.lock().await, &Command::V1(model_cmd))
-                            .await
+                    if let Err(e) = writer_clone
+                        .lock()
+                        .await
+                        .send(&Command::V1(model_cmd))
+                        .await
                     {
                         error!(
                             "Failed to send model status (connection may be closed): {}",
@@ -2381,27 +2515,39 @@ impl WorkerHandle for ClientWorker {
                         format_duration!(session_stats.2.as_secs())
                     );
 
-                    let mut writer = writer_clone.lock().await;
-                    if let Err(e) = write_command(
-                        &mut *writer,
-                        &Command::V1(CommandV1::Heartbeat {
+                    // worker status goes first so gpuf-s publishes its stats
+                    // with the heartbeat; servers that did not advertise it
+                    // would drop the connection
+                    let mut commands = Vec::with_capacity(2);
+                    if crate::server_accepts_worker_status() {
+                        commands.push(Command::V2(CommandV2::WorkerStatus {
                             client_id: *client_id,
-                            system_info: SystemInfo {
-                                cpu_usage: cpu_usage,
-                                memory_usage: memory_usage,
-                                disk_usage: disk_usage,
-                                network_rx: stats.0,
-                                network_tx: stats.1,
-                            },
-                            // TODO: devices_info device_count device_total_tflops and device_memtotal_gb is single device
-                            device_memtotal_gb: device_info.memtotal_gb as u32,
-                            device_total_tflops: device_info.total_tflops as u32,
-                            device_count: device_info.num as u16,
-                            devices_info: vec![device_info],
-                        }),
-                    )
-                    .await
-                    {
+                            resident_models: crate::model_registry::resident_paths()
+                                .iter()
+                                .map(|path| derive_model_id_from_path(path))
+                                .collect(),
+                            inference_stats: crate::perf::take_heartbeat_stats(),
+                            perf_capacity: crate::perf_profile::heartbeat_capacity(),
+                            task_slots: crate::WORKER_TASK_SLOTS,
+                            gpu_placement: crate::llm_engine::gpu_placement::heartbeat_placement(),
+                        }));
+                    }
+                    commands.push(Command::V1(CommandV1::Heartbeat {
+                        client_id: *client_id,
+                        system_info: SystemInfo {
+                            cpu_usage: cpu_usage,
+                            memory_usage: memory_usage,
+                            disk_usage: disk_usage,
+                            network_rx: stats.0,
+                            network_tx: stats.1,
+                        },
+                        // TODO: devices_info device_count device_total_tflops and device_memtotal_gb is single device
+                        device_memtotal_gb: device_info.memtotal_gb as u32,
+                        device_total_tflops: device_info.total_tflops as u32,
+                        device_count: device_info.num as u16,
+                        devices_info: vec![device_info],
+                    }));
+                    if let Err(e) = writer_clone.lock().await.send_all(&commands).await {
                         error!("Failed to send heartbeat: {}", e);
                         break;
                     }
@@ -2413,10 +2559,9 @@ impl WorkerHandle for ClientWorker {
 
     fn handler(&self) -> impl Future<Output = Result<()>> + Send {
         async move {
-            let mut buf = BytesMut::with_capacity(MAX_MESSAGE_SIZE);
             let mut p2p_turn_config: HashMap<[u8; 16], P2PConnectionRuntimeConfig> = HashMap::new();
             loop {
-                let cmd_result = read_command(&mut *self.reader.lock().await, &mut buf).await;
+                let cmd_result = self.reader.lock().await.read_command().await;
 
                 // Handle connection errors gracefully
                 let cmd = match cmd_result {
@@ -2448,6 +2593,38 @@ impl WorkerHandle for ClientWorker {
                                 }
                                 self.cancel_state.notify.notify_waiters();
                             }
+                            CommandV1::EmbeddingTask {
+                                task_id,
+                                model: _model,
+                                inputs,
+                                normalize,
+                            } => {
+                                info!(
+                                    "Received embedding task: {} inputs: {}",
+                                    task_id,
+                                    inputs.len()
+                                );
+                                let result = self.execute_embedding_task(inputs, normalize).await;
+                                let command = match result {
+                                    Ok((embeddings, dim, prompt_tokens)) => {
+                                        CommandV1::EmbeddingResult {
+                                            task_id,
+                                            dim,
+                                            embeddings,
+                                            prompt_tokens,
+                                            error: None,
+                                        }
+                                    }
+                                    Err(e) => CommandV1::EmbeddingResult {
+                                        task_id,
+                                        dim: 0,
+                                        embeddings: Vec::new(),
+                                        prompt_tokens: 0,
+                                        error: Some(e.to_string()),
+                                    },
+                                };
+                                self.send_command(command).await?;
+                            }
                             CommandV1::LoginResult {
                                 success,
                                 pods_model,
@@ -2834,6 +3011,10 @@ impl WorkerHandle for ClientWorker {
                     }
                     Command::V2(cmd_v2) => {
                         match cmd_v2 {
+                            CommandV2::ServerFeatures { features } => {
+                                debug!("Server features: {:#x}", features);
+                                crate::SERVER_FEATURES.store(features, Ordering::Release);
+                            }
                             CommandV2::P2PConnectionConfig {
                                 peer_id,
                                 connection_id,
@@ -2882,110 +3063,169 @@ impl WorkerHandle for ClientWorker {
                                     let engine = Arc::clone(&self.engine);
                                     let socket = Arc::clone(&socket);
                                     let data_plane_secret_copy = data_plane_secret;
+                                    // Optional in-kernel pre-filter; without it the socket path
+                                    // below does all validation.
+                                    let xdp_port = self.args.p2p_xdp_pin_dir.as_deref().and_then(
+                                        |dir| {
+                                            match crate::util::p2p_xdp::P2PXdpMaps::open(dir)
+                                                .and_then(|maps| maps.register_port(local_port))
+                                            {
+                                                Ok(port) => {
+                                                    info!(
+                                                        "P2P UDP port {} registered with XDP pre-filter",
+                                                        local_port
+                                                    );
+                                                    Some(port)
+                                                }
+                                                Err(e) => {
+                                                    warn!("P2P XDP pre-filter disabled: {}", e);
+                                                    None
+                                                }
+                                            }
+                                        },
+                                    );
                                     tokio::spawn(async move {
+                                        let reject_source =
+                                            |reassembly: &mut P2PUdpReassemblyState,
+                                             from: std::net::SocketAddr| {
+                                                if reassembly.record_invalid_source(from) {
+                                                    if let Some(port) = &xdp_port {
+                                                        port.ban_source(
+                                                            from.ip(),
+                                                            Self::P2P_SOURCE_BAN_TTL,
+                                                        );
+                                                    }
+                                                }
+                                            };
                                         let mut next_msg_id: u32 = 1;
                                         let mut reassembly = P2PUdpReassemblyState::new();
-                                        let mut buf = vec![0u8; 64 * 1024];
+                                        let mut batch = crate::util::udp_batch::RecvBatch::new();
+                                        let mut acks = crate::util::udp_batch::SendBatch::new();
                                         loop {
-                                            let (n, from) = match socket.recv_from(&mut buf).await {
-                                                Ok(v) => v,
-                                                Err(e) => {
-                                                    error!("P2P UDP recv error: {}", e);
-                                                    return;
-                                                }
-                                            };
-
-                                            if reassembly.is_source_banned(from) {
-                                                continue;
+                                            // ACKs for the previous batch leave in one send.
+                                            if let Err(e) = crate::util::udp_batch::send_batch(
+                                                &socket, &mut acks,
+                                            )
+                                            .await
+                                            {
+                                                warn!("P2P UDP ack send error: {}", e);
                                             }
-
-                                            let Some((flags, msg_id, frag_idx, frag_cnt, ts, tag)) =
-                                                Self::p2p_udp_parse_header(&buf[..n])
-                                            else {
-                                                security_metrics::record_p2p_auth_rejection();
-                                                reassembly.record_invalid_source(from);
-                                                continue;
-                                            };
-
-                                            if (flags & Self::P2P_UDP_FLAG_ACK) != 0 {
-                                                continue;
+                                            if let Err(e) = crate::util::udp_batch::recv_batch(
+                                                &socket, &mut batch,
+                                            )
+                                            .await
+                                            {
+                                                error!("P2P UDP recv error: {}", e);
+                                                return;
                                             }
+                                            for (buf, from) in batch.iter() {
+                                                let n = buf.len();
 
-                                            let payload = &buf[Self::P2P_UDP_HEADER_LEN..n];
-                                            if let Err(e) = Self::p2p_udp_validate_fragment(
-                                                &data_plane_secret_copy,
-                                                &connection_id,
-                                                flags,
-                                                msg_id,
-                                                frag_idx,
-                                                frag_cnt,
-                                                ts,
-                                                payload,
-                                                &tag,
-                                                Self::p2p_now_secs(),
-                                            ) {
-                                                security_metrics::record_p2p_auth_rejection();
-                                                warn!("P2P UDP authentication rejected packet from {}: {}", from, e);
-                                                reassembly.record_invalid_source(from);
-                                                continue;
-                                            }
+                                                if reassembly.is_source_banned(from) {
+                                                    continue;
+                                                }
 
-                                            let full = match reassembly.accept_fragment(
-                                                from, msg_id, frag_idx, frag_cnt, payload,
-                                            ) {
-                                                Ok(v) => {
-                                                    Self::p2p_udp_send_ack(
-                                                        &socket,
-                                                        from,
-                                                        connection_id,
-                                                        data_plane_secret_copy,
-                                                        msg_id,
-                                                    )
-                                                    .await;
-                                                    v
+                                                let Some((
+                                                    flags,
+                                                    msg_id,
+                                                    frag_idx,
+                                                    frag_cnt,
+                                                    ts,
+                                                    tag,
+                                                )) = Self::p2p_udp_parse_header(&buf[..n])
+                                                else {
+                                                    security_metrics::record_p2p_auth_rejection();
+                                                    reject_source(&mut reassembly, from);
+                                                    continue;
+                                                };
+
+                                                if (flags & Self::P2P_UDP_FLAG_ACK) != 0 {
+                                                    continue;
                                                 }
-                                                Err(e) => {
-                                                    security_metrics::record_p2p_reassembly_rejection();
-                                                    warn!("P2P UDP reassembly rejected packet from {}: {}", from, e);
-                                                    reassembly.record_invalid_source(from);
+
+                                                let payload = &buf[Self::P2P_UDP_HEADER_LEN..n];
+                                                if let Err(e) = Self::p2p_udp_validate_fragment(
+                                                    &data_plane_secret_copy,
+                                                    &connection_id,
+                                                    flags,
+                                                    msg_id,
+                                                    frag_idx,
+                                                    frag_cnt,
+                                                    ts,
+                                                    payload,
+                                                    &tag,
+                                                    Self::p2p_now_secs(),
+                                                ) {
+                                                    security_metrics::record_p2p_auth_rejection();
+                                                    warn!("P2P UDP authentication rejected packet from {}: {}", from, e);
+                                                    reject_source(&mut reassembly, from);
                                                     continue;
                                                 }
-                                            };
-                                            let Some(full) = full else {
-                                                continue;
-                                            };
 
-                                            let cmd = match Self::udp_decode_command(&full) {
-                                                Ok(c) => c,
-                                                Err(e) => {
-                                                    warn!("P2P UDP decode failed: {}", e);
+                                                let full = match reassembly.accept_fragment(
+                                                    from, msg_id, frag_idx, frag_cnt, payload,
+                                                ) {
+                                                    Ok(v) => {
+                                                        acks.push(
+                                                            &Self::p2p_udp_ack_packet(
+                                                                connection_id,
+                                                                data_plane_secret_copy,
+                                                                msg_id,
+                                                            ),
+                                                            from,
+                                                        );
+                                                        v
+                                                    }
+                                                    Err(e) => {
+                                                        security_metrics::record_p2p_reassembly_rejection();
+                                                        warn!("P2P UDP reassembly rejected packet from {}: {}", from, e);
+                                                        reject_source(&mut reassembly, from);
+                                                        continue;
+                                                    }
+                                                };
+                                                let Some(full) = full else {
                                                     continue;
+                                                };
+                                                // Answering may take a whole generation; ACK first.
+                                                if let Err(e) = crate::util::udp_batch::send_batch(
+                                                    &socket, &mut acks,
+                                                )
+                                                .await
+                                                {
+                                                    warn!("P2P UDP ack send error: {}", e);
                                                 }
-                                            };
 
-                                            let Command::V2(CommandV2::P2PInferenceRequest {
-                                                connection_id: req_conn_id,
-                                                task_id,
-                                                model: _model,
-                                                prompt,
-                                                max_tokens,
-                                                temperature,
-                                                top_k,
-                                                top_p,
-                                                repeat_penalty,
-                                                repeat_last_n,
-                                                min_keep,
-                                            }) = cmd
-                                            else {
-                                                continue;
-                                            };
+                                                let cmd = match Self::udp_decode_command(&full) {
+                                                    Ok(c) => c,
+                                                    Err(e) => {
+                                                        warn!("P2P UDP decode failed: {}", e);
+                                                        continue;
+                                                    }
+                                                };
 
-                                            if req_conn_id != connection_id {
-                                                continue;
-                                            }
+                                                let Command::V2(CommandV2::P2PInferenceRequest {
+                                                    connection_id: req_conn_id,
+                                                    task_id,
+                                                    model: _model,
+                                                    prompt,
+                                                    max_tokens,
+                                                    temperature,
+                                                    top_k,
+                                                    top_p,
+                                                    repeat_penalty,
+                                                    repeat_last_n,
+                                                    min_keep,
+                                                }) = cmd
+                                                else {
+                                                    continue;
+                                                };
+
+                                                if req_conn_id != connection_id {
+                                                    continue;
+                                                }
 
-                                            // Stream inference over UDP data-plane.
-                                            let sampling =
+                                                // Stream inference over UDP data-plane.
+                                                let sampling =
                                                 crate::llm_engine::llama_engine::SamplingParams {
                                                     temperature,
                                                     top_k: top_k as i32,
@@ -2997,27 +3237,62 @@ impl WorkerHandle for ClientWorker {
                                                     thinking_budget_tokens: None,
                                                 };
 
-                                            let token_stream_res = {
-                                                let engine_guard = engine.lock().await;
-                                                let engine_ref = match engine_guard.as_ref() {
-                                                    Some(v) => v,
-                                                    None => {
-                                                        let chunk = Command::V2(
-                                                            CommandV2::P2PInferenceChunk {
-                                                                connection_id,
-                                                                task_id: task_id.clone(),
-                                                                seq: 0,
-                                                                delta: String::new(),
-                                                                phase: OutputPhase::Unknown,
-                                                                done: true,
-                                                                error: Some(
-                                                                    "Engine not initialized"
-                                                                        .to_string(),
-                                                                ),
-                                                                analysis_tokens: 0,
-                                                                final_tokens: 0,
-                                                            },
-                                                        );
+                                                let token_stream_res = {
+                                                    let engine_guard = engine.lock().await;
+                                                    let engine_ref = match engine_guard.as_ref() {
+                                                        Some(v) => v,
+                                                        None => {
+                                                            let chunk = Command::V2(
+                                                                CommandV2::P2PInferenceChunk {
+                                                                    connection_id,
+                                                                    task_id: task_id.clone(),
+                                                                    seq: 0,
+                                                                    delta: String::new(),
+                                                                    phase: OutputPhase::Unknown,
+                                                                    done: true,
+                                                                    error: Some(
+                                                                        "Engine not initialized"
+                                                                            .to_string(),
+                                                                    ),
+                                                                    analysis_tokens: 0,
+                                                                    final_tokens: 0,
+                                                                },
+                                                            );
+                                                            if let Ok(pkt) =
+                                                                Self::p2p_udp_encode_command_payload(
+                                                                    &chunk,
+                                                                )
+                                                            {
+                                                                let msg_id = next_msg_id;
+                                                                next_msg_id =
+                                                                    next_msg_id.wrapping_add(1);
+                                                                let _ =
+                                                                    Self::p2p_udp_send_reliable(
+                                                                        &socket,
+                                                                        from,
+                                                                        connection_id,
+                                                                        data_plane_secret_copy,
+                                                                        msg_id,
+                                                                        &pkt,
+                                                                    )
+                                                                    .await;
+                                                            }
+                                                            continue;
+                                                        }
+                                                    };
+
+                                                    let AnyEngine::Llama(llama) = engine_ref else {
+                                                        let chunk = Command::V2(CommandV2::P2PInferenceChunk {
+                                                        connection_id,
+                                                        task_id: task_id.clone(),
+                                                        seq: 0,
+                                                        delta: String::new(),
+                                                        phase: OutputPhase::Unknown,
+                                                        done: true,
+                                                        error: Some("P2P UDP streaming is only supported for LLAMA engine".to_string()),
+                                                        analysis_tokens: 0,
+                                                        final_tokens: 0,
+                                                    });
                                                         if let Ok(pkt) =
                                                             Self::p2p_udp_encode_command_payload(
                                                                 &chunk,
@@ -3037,94 +3312,25 @@ impl WorkerHandle for ClientWorker {
                                                             .await;
                                                         }
                                                         continue;
-                                                    }
-                                                };
+                                                    };
 
-                                                let AnyEngine::Llama(llama) = engine_ref else {
-                                                    let chunk = Command::V2(CommandV2::P2PInferenceChunk {
-                                                        connection_id,
-                                                        task_id: task_id.clone(),
-                                                        seq: 0,
-                                                        delta: String::new(),
-                                                        phase: OutputPhase::Unknown,
-                                                        done: true,
-                                                        error: Some("P2P UDP streaming is only supported for LLAMA engine".to_string()),
-                                                        analysis_tokens: 0,
-                                                        final_tokens: 0,
-                                                    });
-                                                    if let Ok(pkt) =
-                                                        Self::p2p_udp_encode_command_payload(&chunk)
-                                                    {
-                                                        let msg_id = next_msg_id;
-                                                        next_msg_id = next_msg_id.wrapping_add(1);
-                                                        let _ = Self::p2p_udp_send_reliable(
-                                                            &socket,
-                                                            from,
-                                                            connection_id,
-                                                            data_plane_secret_copy,
-                                                            msg_id,
-                                                            &pkt,
+                                                    llama
+                                                        .stream_with_cached_model_sampling(
+                                                            &prompt,
+                                                            max_tokens as usize,
+                                                            &sampling,
                                                         )
-                                                        .await;
-                                                    }
-                                                    continue;
+                                                        .await
                                                 };
 
-                                                llama
-                                                    .stream_with_cached_model_sampling(
-                                                        &prompt,
-                                                        max_tokens as usize,
-                                                        &sampling,
-                                                    )
-                                                    .await
-                                            };
-
-                                            let token_stream = match token_stream_res {
-                                                Ok(s) => s,
-                                                Err(e) => {
-                                                    let chunk =
-                                                        Command::V2(CommandV2::P2PInferenceChunk {
-                                                            connection_id,
-                                                            task_id: task_id.clone(),
-                                                            seq: 0,
-                                                            delta: String::new(),
-                                                            phase: OutputPhase::Unknown,
-                                                            done: true,
-                                                            error: Some(e.to_string()),
-                                                            analysis_tokens: 0,
-                                                            final_tokens: 0,
-                                                        });
-                                                    if let Ok(pkt) =
-                                                        Self::p2p_udp_encode_command_payload(&chunk)
-                                                    {
-                                                        let msg_id = next_msg_id;
-                                                        next_msg_id = next_msg_id.wrapping_add(1);
-                                                        let _ = Self::p2p_udp_send_reliable(
-                                                            &socket,
-                                                            from,
-                                                            connection_id,
-                                                            data_plane_secret_copy,
-                                                            msg_id,
-                                                            &pkt,
-                                                        )
-                                                        .await;
-                                                    }
-                                                    continue;
-                                                }
-                                            };
-
-                                            let mut token_stream = Box::pin(token_stream);
-                                            let mut seq: u32 = 0;
-
-                                            while let Some(piece_res) = token_stream.next().await {
-                                                let piece = match piece_res {
-                                                    Ok(p) => p,
+                                                let token_stream = match token_stream_res {
+                                                    Ok(s) => s,
                                                     Err(e) => {
                                                         let chunk = Command::V2(
                                                             CommandV2::P2PInferenceChunk {
                                                                 connection_id,
                                                                 task_id: task_id.clone(),
-                                                                seq,
+                                                                seq: 0,
                                                                 delta: String::new(),
                                                                 phase: OutputPhase::Unknown,
                                                                 done: true,
@@ -3151,49 +3357,33 @@ impl WorkerHandle for ClientWorker {
                                                             )
                                                             .await;
                                                         }
-                                                        break;
+                                                        continue;
                                                     }
                                                 };
-                                                let filtered = filter_control_tokens(&piece);
-                                                if filtered.is_empty() {
-                                                    continue;
-                                                }
 
-                                                let mut start: usize = 0;
-                                                let max_bytes: usize = 64;
-                                                while start < filtered.len() {
-                                                    let mut end =
-                                                        (start + max_bytes).min(filtered.len());
-                                                    while end < filtered.len()
-                                                        && !filtered.is_char_boundary(end)
-                                                    {
-                                                        end -= 1;
-                                                    }
-                                                    if end == start {
-                                                        end = filtered
-                                                            .char_indices()
-                                                            .nth(1)
-                                                            .map(|(i, _)| i)
-                                                            .unwrap_or(filtered.len());
-                                                    }
-                                                    let delta = filtered[start..end].to_string();
-                                                    start = end;
+                                                let mut token_stream = Box::pin(token_stream);
+                                                let mut batcher =
+                                                    P2PStreamBatcher::new(connection_id, task_id);
+                                                let mut failed = None;
 
-                                                    let chunk =
-                                                        Command::V2(CommandV2::P2PInferenceChunk {
-                                                            connection_id,
-                                                            task_id: task_id.clone(),
-                                                            seq,
-                                                            delta,
-                                                            phase: OutputPhase::Unknown,
-                                                            done: false,
-                                                            error: None,
-                                                            analysis_tokens: 0,
-                                                            final_tokens: 0,
-                                                        });
-                                                    if let Ok(pkt) =
-                                                        Self::p2p_udp_encode_command_payload(&chunk)
-                                                    {
+                                                while let Some(piece_res) =
+                                                    token_stream.next().await
+                                                {
+                                                    let piece = match piece_res {
+                                                        Ok(p) => p,
+                                                        Err(e) => {
+                                                            failed = Some(e.to_string());
+                                                            break;
+                                                        }
+                                                    };
+                                                    for chunk in batcher.push(&piece) {
+                                                        let Ok(pkt) =
+                                                            Self::p2p_udp_encode_command_payload(
+                                                                &chunk,
+                                                            )
+                                                        else {
+                                                            continue;
+                                                        };
                                                         let msg_id = next_msg_id;
                                                         next_msg_id = next_msg_id.wrapping_add(1);
                                                         let _ = Self::p2p_udp_send_reliable(
@@ -3206,33 +3396,28 @@ impl WorkerHandle for ClientWorker {
                                                         )
                                                         .await;
                                                     }
-                                                    seq = seq.wrapping_add(1);
                                                 }
-                                            }
 
-                                            let done = Command::V2(CommandV2::P2PInferenceDone {
-                                                connection_id,
-                                                task_id,
-                                                prompt_tokens: 0,
-                                                completion_tokens: 0,
-                                                total_tokens: 0,
-                                                analysis_tokens: 0,
-                                                final_tokens: 0,
-                                            });
-                                            if let Ok(pkt) =
-                                                Self::p2p_udp_encode_command_payload(&done)
-                                            {
-                                                let msg_id = next_msg_id;
-                                                next_msg_id = next_msg_id.wrapping_add(1);
-                                                let _ = Self::p2p_udp_send_reliable(
-                                                    &socket,
-                                                    from,
-                                                    connection_id,
-                                                    data_plane_secret_copy,
-                                                    msg_id,
-                                                    &pkt,
-                                                )
-                                                .await;
+                                                for command in batcher.finish(failed) {
+                                                    let Ok(pkt) =
+                                                        Self::p2p_udp_encode_command_payload(
+                                                            &command,
+                                                        )
+                                                    else {
+                                                        continue;
+                                                    };
+                                                    let msg_id = next_msg_id;
+                                                    next_msg_id = next_msg_id.wrapping_add(1);
+                                                    let _ = Self::p2p_udp_send_reliable(
+                                                        &socket,
+                                                        from,
+                                                        connection_id,
+                                                        data_plane_secret_copy,
+                                                        msg_id,
+                                                        &pkt,
+                                                    )
+                                                    .await;
+                                                }
                                             }
                                         }
                                     });
@@ -3591,7 +3776,11 @@ impl WorkerHandle for ClientWorker {
 
                                                         let mut token_stream =
                                                             Box::pin(token_stream);
-                                                        let mut seq: u32 = 0;
+                                                        let mut batcher = P2PStreamBatcher::new(
+                                                            connection_id_copy,
+                                                            task_id,
+                                                        );
+                                                        let mut failed = None;
 
                                                         while let Some(piece_res) =
                                                             token_stream.next().await
@@ -3599,114 +3788,40 @@ impl WorkerHandle for ClientWorker {
                                                             let piece = match piece_res {
                                                                 Ok(p) => p,
                                                                 Err(e) => {
-                                                                    let chunk = Command::V2(CommandV2::P2PInferenceChunk {
-                                                                        connection_id: connection_id_copy,
-                                                                        task_id: task_id.clone(),
-                                                                        seq,
-                                                                        delta: String::new(),
-                                                                        phase: OutputPhase::Unknown,
-                                                                        done: true,
-                                                                        error: Some(e.to_string()),
-                                                                        analysis_tokens: 0,
-                                                                        final_tokens: 0,
-                                                                    });
-                                                                    if let Ok(pkt) =
-                                                                        Self::p2p_udp_encode_command_payload(&chunk)
-                                                                    {
-                                                                        let msg_id = next_msg_id;
-                                                                        next_msg_id = next_msg_id.wrapping_add(1);
-                                                                        let _ = Self::turn_send_reliable_over_indication(
-                                                                            &turn_sock,
-                                                                            peer,
-                                                                            connection_id_copy,
-                                                                            data_plane_secret_copy,
-                                                                            msg_id,
-                                                                            &pkt,
-                                                                            &mut inbox,
-                                                                        )
-                                                                        .await;
-                                                                    }
+                                                                    failed = Some(e.to_string());
                                                                     break;
                                                                 }
                                                             };
-                                                            let filtered =
-                                                                filter_control_tokens(&piece);
-                                                            if filtered.is_empty() {
-                                                                continue;
-                                                            }
-
-                                                            let mut start: usize = 0;
-                                                            let max_bytes: usize = 64;
-                                                            while start < filtered.len() {
-                                                                let mut end = (start + max_bytes)
-                                                                    .min(filtered.len());
-                                                                while end < filtered.len()
-                                                                    && !filtered
-                                                                        .is_char_boundary(end)
-                                                                {
-                                                                    end -= 1;
-                                                                }
-                                                                if end == start {
-                                                                    end = filtered
-                                                                        .char_indices()
-                                                                        .nth(1)
-                                                                        .map(|(i, _)| i)
-                                                                        .unwrap_or(filtered.len());
-                                                                }
-                                                                let delta = filtered[start..end]
-                                                                    .to_string();
-                                                                start = end;
-
-                                                                let chunk = Command::V2(
-                                                                    CommandV2::P2PInferenceChunk {
-                                                                        connection_id:
-                                                                            connection_id_copy,
-                                                                        task_id: task_id.clone(),
-                                                                        seq,
-                                                                        delta,
-                                                                        phase: OutputPhase::Unknown,
-                                                                        done: false,
-                                                                        error: None,
-                                                                        analysis_tokens: 0,
-                                                                        final_tokens: 0,
-                                                                    },
-                                                                );
-                                                                if let Ok(pkt) =
+                                                            for chunk in batcher.push(&piece) {
+                                                                let Ok(pkt) =
                                                                     Self::p2p_udp_encode_command_payload(&chunk)
-                                                                {
-                                                                    let msg_id = next_msg_id;
-                                                                    next_msg_id = next_msg_id.wrapping_add(1);
-                                                                    let _ = Self::turn_send_reliable_over_indication(
-                                                                        &turn_sock,
-                                                                        peer,
-                                                                        connection_id_copy,
-                                                                        data_plane_secret_copy,
-                                                                        msg_id,
-                                                                        &pkt,
-                                                                        &mut inbox,
-                                                                    )
-                                                                    .await;
-                                                                }
-                                                                seq = seq.wrapping_add(1);
+                                                                else {
+                                                                    continue;
+                                                                };
+                                                                let msg_id = next_msg_id;
+                                                                next_msg_id =
+                                                                    next_msg_id.wrapping_add(1);
+                                                                let _ = Self::turn_send_reliable_over_indication(
+                                                                    &turn_sock,
+                                                                    peer,
+                                                                    connection_id_copy,
+                                                                    data_plane_secret_copy,
+                                                                    msg_id,
+                                                                    &pkt,
+                                                                    &mut inbox,
+                                                                )
+                                                                .await;
                                                             }
                                                         }
 
-                                                        let done = Command::V2(
-                                                            CommandV2::P2PInferenceDone {
-                                                                connection_id: connection_id_copy,
-                                                                task_id,
-                                                                prompt_tokens: 0,
-                                                                completion_tokens: 0,
-                                                                total_tokens: 0,
-                                                                analysis_tokens: 0,
-                                                                final_tokens: 0,
-                                                            },
-                                                        );
-                                                        if let Ok(pkt) =
-                                                            Self::p2p_udp_encode_command_payload(
-                                                                &done,
-                                                            )
-                                                        {
+                                                        for command in batcher.finish(failed) {
+                                                            let Ok(pkt) =
+                                                                Self::p2p_udp_encode_command_payload(
+                                                                    &command,
+                                                                )
+                                                            else {
+                                                                continue;
+                                                            };
                                                             let msg_id = next_msg_id;
                                                             next_msg_id =
                                                                 next_msg_id.wrapping_add(1);
@@ -3934,7 +4049,10 @@ async fn connect_control_stream(
             );
         }
         let (reader, writer) = tcp_stream.into_split();
-        return Ok((Box::new(reader), Box::new(writer)));
+        return Ok((
+            CommandReader::new(Box::new(reader)),
+            CommandWriter::new(Box::new(writer)),
+        ));
     }
 
     #[cfg(target_os = "android")]
@@ -3967,7 +4085,10 @@ async fn connect_control_stream(
             .map_err(|_| anyhow!("Invalid control TLS server name: {}", server_name_raw))?;
         let tls_stream = connector.connect(server_name, tcp_stream).await?;
         let (reader, writer) = tokio::io::split(tls_stream);
-        Ok((Box::new(reader), Box::new(writer)))
+        Ok((
+            CommandReader::new(Box::new(reader)),
+            CommandWriter::new(Box::new(writer)),
+        ))
     }
 }
 
@@ -4292,7 +4413,7 @@ mod control_stream_tests {
 
         let (mut reader, _writer) = connect_control_stream(&args, addr).await?;
         let mut buf = [0u8; 2];
-        reader.read_exact(&mut buf).await?;
+        reader.get_mut().read_exact(&mut buf).await?;
         assert_eq!(&buf, b"ok");
         server.await??;
         Ok(())
@@ -4355,7 +4476,7 @@ mod control_stream_tests {
 
         let (mut reader, _writer) = connect_control_stream(&args, addr).await?;
         let mut buf = [0u8; 2];
-        reader.read_exact(&mut buf).await?;
+        reader.get_mut().read_exact(&mut buf).await?;
         assert_eq!(&buf, b"ok");
         Ok(())
     }
@@ -4404,9 +4525,77 @@ mod control_stream_tests {
 
         let (mut reader, _writer) = connect_control_stream(&args, addr).await?;
         let mut buf = [0u8; 2];
-        reader.read_exact(&mut buf).await?;
+        reader.get_mut().read_exact(&mut buf).await?;
         assert_eq!(&buf, b"ok");
         server.await??;
         Ok(())
     }
 }
+
+#[cfg(all(test, not(target_os = "android")))]
+mod p2p_stream_tests {
+    use super::*;
+
+    fn deltas(commands: &[Command]) -> Vec<(u32, String)> {
+        commands
+            .iter()
+            .filter_map(|c| match c {
+                Command::V2(CommandV2::P2PInferenceChunk {
+                    seq, delta, done, ..
+                }) if !done => Some((*seq, delta.clone())),
+                _ => None,
+            })
+            .collect()
+    }
+
+    #[test]
+    fn p2p_stream_sends_first_token_then_coalesces() {
+        let mut batcher = P2PStreamBatcher::new([7u8; 16], "task".to_string());
+        let first = batcher.push("Hello");
+        assert_eq!(deltas(&first), vec![(0, "Hello".to_string())]);
+
+        let mut later = Vec::new();
+        for piece in [" a", " b", " c"] {
+            later.extend(batcher.push(piece));
+        }
+        assert!(
+            later.is_empty(),
+            "tokens after the first should be coalesced"
+        );
+
+        let last = batcher.finish(None);
+        assert_eq!(deltas(&last), vec![(1, " a b c".to_string())]);
+        match last.last() {
+            Some(Command::V2(CommandV2::P2PInferenceDone {
+                completion_tokens,
+                total_tokens,
+                ..
+            })) => {
+                assert_eq!(*completion_tokens, 4);
+                assert_eq!(*total_tokens, 4);
+            }
+            other => panic!("expected P2PInferenceDone, got {:?}", other),
+        }
+    }
+
+    #[test]
+    fn p2p_stream_caps_chunk_size() {
+        let mut batcher = P2PStreamBatcher::new([7u8; 16], "task".to_string());
+        let piece = "x".repeat(300);
+        let mut out = Vec::new();
+        for _ in 0..8 {
+            out.extend(batcher.push(&piece));
+        }
+        out.extend(batcher.finish(Some("boom".to_string())));
+
+        for (_, delta) in deltas(&out) {
+            assert!(delta.len() <= P2PStreamBatcher::MAX_CHUNK_BYTES);
+        }
+        let total: usize = deltas(&out).iter().map(|(_, d)| d.len()).sum();
+        assert_eq!(total, 300 * 8);
+        assert!(out.iter().any(|c| matches!(
+            c,
+            Command::V2(CommandV2::P2PInferenceChunk { done: true, error: Some(e), .. }) if e == "boom"
+        )));
+    }
+}
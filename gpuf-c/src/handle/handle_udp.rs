@@ -60,13 +60,57 @@ impl P2PReplayWindow {
     }
 }
 
+const P2P_FRAGMENT_SLOTS: usize = ClientWorker::P2P_MAX_FRAGMENTS_PER_MESSAGE as usize;
+const P2P_FRAGMENT_BITMAP_WORDS: usize = (P2P_FRAGMENT_SLOTS + 63) / 64;
+/// A slot buffer grown past this for a large message is released when freed.
+const P2P_SLOT_RETAINED_BYTES: usize = 64 * 1024;
+
+/// One message being reassembled. Fragment `i` is written in place at
+/// `i * P2P_UDP_FRAGMENT_PAYLOAD` of `buf`; `received` marks which have
+/// arrived.
 #[derive(Debug)]
-struct P2PUdpPartialMessage {
-    created_at: Instant,
-    last_seen: Instant,
+struct P2PUdpReassemblySlot {
+    key: Option<(SocketAddr, u32)>,
+    generation: u32,
     frag_cnt: u16,
-    bytes: usize,
-    parts: HashMap<u16, Vec<u8>>,
+    fragments: u16,
+    received: [u64; P2P_FRAGMENT_BITMAP_WORDS],
+    lens: [u16; P2P_FRAGMENT_SLOTS],
+    buf: Vec<u8>,
+}
+
+impl P2PUdpReassemblySlot {
+    fn new() -> Self {
+        Self {
+            key: None,
+            generation: 0,
+            frag_cnt: 0,
+            fragments: 0,
+            received: [0; P2P_FRAGMENT_BITMAP_WORDS],
+            lens: [0; P2P_FRAGMENT_SLOTS],
+            buf: Vec::new(),
+        }
+    }
+
+    fn reserved(&self) -> usize {
+        self.frag_cnt as usize * ClientWorker::P2P_UDP_FRAGMENT_PAYLOAD
+    }
+
+    /// Close the gaps left by fragments shorter than the stride. Conforming
+    /// senders only shorten the last one, so nothing moves.
+    fn compact(&mut self) {
+        let stride = ClientWorker::P2P_UDP_FRAGMENT_PAYLOAD;
+        let mut end = 0usize;
+        for idx in 0..self.frag_cnt as usize {
+            let start = idx * stride;
+            let len = self.lens[idx] as usize;
+            if start != end {
+                self.buf.copy_within(start..start + len, end);
+            }
+            end += len;
+        }
+        self.buf.truncate(end);
+    }
 }
 
 #[derive(Debug)]
@@ -76,60 +120,97 @@ struct P2PUdpSourceState {
     banned_until: Option<Instant>,
 }
 
+/// Reassembly of P2P UDP messages into a fixed slab of slots.
+///
+/// Every slot lives for the same TTL, so deadlines come due in the order slots
+/// were opened and a FIFO serves as the expiry wheel; completed message ids
+/// are expired the same way. Entries for slots reused in the meantime are
+/// recognised by their generation and skipped.
 #[derive(Debug)]
 pub(super) struct P2PUdpReassemblyState {
-    inflight: HashMap<(SocketAddr, u32), P2PUdpPartialMessage>,
+    slots: Vec<P2PUdpReassemblySlot>,
+    free: Vec<usize>,
+    inflight: HashMap<(SocketAddr, u32), usize>,
+    per_source: HashMap<IpAddr, usize>,
+    expiry: VecDeque<(Instant, usize, u32)>,
     completed: HashMap<(SocketAddr, u32), Instant>,
+    completed_order: VecDeque<(Instant, (SocketAddr, u32))>,
     source_state: HashMap<IpAddr, P2PUdpSourceState>,
+    next_source_sweep: Instant,
     total_bytes: usize,
 }
 
 impl P2PUdpReassemblyState {
     pub(super) fn new() -> Self {
         Self {
+            slots: Vec::with_capacity(ClientWorker::P2P_MAX_INFLIGHT_MESSAGES),
+            free: Vec::with_capacity(ClientWorker::P2P_MAX_INFLIGHT_MESSAGES),
             inflight: HashMap::new(),
+            per_source: HashMap::new(),
+            expiry: VecDeque::new(),
             completed: HashMap::new(),
+            completed_order: VecDeque::new(),
             source_state: HashMap::new(),
+            next_source_sweep: Instant::now(),
             total_bytes: 0,
         }
     }
 
-    fn prune(&mut self) {
-        let now = Instant::now();
-        let mut removed_bytes = 0usize;
-        self.inflight.retain(|_, entry| {
-            let keep = now.duration_since(entry.created_at) <= ClientWorker::P2P_REASSEMBLY_TTL;
-            if !keep {
-                removed_bytes = removed_bytes.saturating_add(entry.bytes);
+    fn prune(&mut self, now: Instant) {
+        while let Some(&(deadline, slot, generation)) = self.expiry.front() {
+            let live = self.slots[slot].generation == generation;
+            if live && deadline > now {
+                break;
             }
-            keep
-        });
-        self.total_bytes = self.total_bytes.saturating_sub(removed_bytes);
-        self.completed.retain(|_, seen_at| {
-            now.duration_since(*seen_at)
-                <= Duration::from_secs(ClientWorker::P2P_REPLAY_WINDOW_SECS)
-        });
-        self.source_state.retain(|_, state| {
-            if let Some(until) = state.banned_until {
-                until > now
-            } else {
-                now.duration_since(state.window_started) <= ClientWorker::P2P_SOURCE_BAN_TTL
-                    || state.bad_count > 0
+            self.expiry.pop_front();
+            if live {
+                self.release(slot);
             }
-        });
+        }
+        // Completed messages leave dead entries behind their live neighbours;
+        // drop them once they outnumber the slab.
+        if self.expiry.len() > 2 * ClientWorker::P2P_MAX_INFLIGHT_MESSAGES {
+            let slots = &self.slots;
+            self.expiry
+                .retain(|&(_, slot, generation)| slots[slot].generation == generation);
+        }
+
+        let replay_window = Duration::from_secs(ClientWorker::P2P_REPLAY_WINDOW_SECS);
+        while let Some(&(seen_at, key)) = self.completed_order.front() {
+            if now.duration_since(seen_at) <= replay_window {
+                break;
+            }
+            self.completed_order.pop_front();
+            if self.completed.get(&key) == Some(&seen_at) {
+                self.completed.remove(&key);
+            }
+        }
+
+        if now >= self.next_source_sweep {
+            self.next_source_sweep = now + Duration::from_secs(1);
+            self.source_state.retain(|_, state| {
+                if let Some(until) = state.banned_until {
+                    until > now
+                } else {
+                    now.duration_since(state.window_started) <= ClientWorker::P2P_SOURCE_BAN_TTL
+                        || state.bad_count > 0
+                }
+            });
+        }
     }
 
     pub(super) fn is_source_banned(&mut self, from: SocketAddr) -> bool {
-        self.prune();
+        self.prune(Instant::now());
         self.source_state
             .get(&from.ip())
             .and_then(|state| state.banned_until)
             .is_some_and(|until| until > Instant::now())
     }
 
-    pub(super) fn record_invalid_source(&mut self, from: SocketAddr) {
-        self.prune();
+    /// Count an invalid datagram; returns true when this starts a ban.
+    pub(super) fn record_invalid_source(&mut self, from: SocketAddr) -> bool {
         let now = Instant::now();
+        self.prune(now);
         let state = self
             .source_state
             .entry(from.ip())
@@ -139,7 +220,7 @@ impl P2PUdpReassemblyState {
                 banned_until: None,
             });
         if state.banned_until.is_some_and(|until| until > now) {
-            return;
+            return false;
         }
         if now.duration_since(state.window_started) > Duration::from_secs(10) {
             state.window_started = now;
@@ -153,7 +234,73 @@ impl P2PUdpReassemblyState {
                 "P2P UDP source {} temporarily banned after invalid traffic",
                 from.ip()
             );
+            return true;
+        }
+        false
+    }
+
+    fn open_slot(&mut self, key: (SocketAddr, u32), frag_cnt: u16, now: Instant) -> Result<usize> {
+        if self.inflight.len() >= ClientWorker::P2P_MAX_INFLIGHT_MESSAGES {
+            return Err(anyhow!("p2p udp inflight message limit exceeded"));
+        }
+        let source_messages = self.per_source.get(&key.0.ip()).copied().unwrap_or(0);
+        if source_messages >= ClientWorker::P2P_MAX_MESSAGES_PER_SOURCE {
+            return Err(anyhow!("p2p udp per-source message limit exceeded"));
+        }
+        let reserved = frag_cnt as usize * Self::stride();
+        if reserved > MAX_MESSAGE_SIZE {
+            return Err(anyhow!("p2p udp reassembled message exceeds max size"));
+        }
+        if self.total_bytes.saturating_add(reserved) > ClientWorker::P2P_MAX_INFLIGHT_BYTES {
+            return Err(anyhow!("p2p udp inflight byte limit exceeded"));
+        }
+
+        let slot = match self.free.pop() {
+            Some(slot) => slot,
+            None => {
+                self.slots.push(P2PUdpReassemblySlot::new());
+                self.slots.len() - 1
+            }
+        };
+        let entry = &mut self.slots[slot];
+        entry.key = Some(key);
+        entry.frag_cnt = frag_cnt;
+        entry.fragments = 0;
+        entry.received = [0; P2P_FRAGMENT_BITMAP_WORDS];
+        entry.buf.clear();
+        entry.buf.resize(reserved, 0);
+        let generation = entry.generation;
+
+        self.inflight.insert(key, slot);
+        *self.per_source.entry(key.0.ip()).or_insert(0) += 1;
+        self.total_bytes += reserved;
+        self.expiry
+            .push_back((now + ClientWorker::P2P_REASSEMBLY_TTL, slot, generation));
+        Ok(slot)
+    }
+
+    fn release(&mut self, slot: usize) {
+        let entry = &mut self.slots[slot];
+        let Some(key) = entry.key.take() else {
+            return;
+        };
+        entry.generation = entry.generation.wrapping_add(1);
+        self.total_bytes = self.total_bytes.saturating_sub(entry.reserved());
+        if entry.buf.capacity() > P2P_SLOT_RETAINED_BYTES {
+            entry.buf = Vec::new();
+        }
+        self.inflight.remove(&key);
+        if let Some(count) = self.per_source.get_mut(&key.0.ip()) {
+            *count -= 1;
+            if *count == 0 {
+                self.per_source.remove(&key.0.ip());
+            }
         }
+        self.free.push(slot);
+    }
+
+    fn stride() -> usize {
+        ClientWorker::P2P_UDP_FRAGMENT_PAYLOAD
     }
 
     pub(super) fn accept_fragment(
@@ -164,14 +311,15 @@ impl P2PUdpReassemblyState {
         frag_cnt: u16,
         payload: &[u8],
     ) -> Result<Option<Vec<u8>>> {
-        self.prune();
+        let now = Instant::now();
+        self.prune(now);
         if frag_cnt == 0 || frag_idx >= frag_cnt {
             return Err(anyhow!("invalid p2p udp fragment metadata"));
         }
         if frag_cnt > ClientWorker::P2P_MAX_FRAGMENTS_PER_MESSAGE {
             return Err(anyhow!("p2p udp fragment count exceeds limit"));
         }
-        if payload.len() > ClientWorker::P2P_UDP_MTU_PAYLOAD {
+        if payload.len() > Self::stride() {
             return Err(anyhow!("p2p udp fragment payload too large"));
         }
 
@@ -181,73 +329,34 @@ impl P2PUdpReassemblyState {
             return Ok(None);
         }
 
-        let is_new_message = !self.inflight.contains_key(&key);
-        if is_new_message {
-            if self.inflight.len() >= ClientWorker::P2P_MAX_INFLIGHT_MESSAGES {
-                return Err(anyhow!("p2p udp inflight message limit exceeded"));
-            }
-            let source_messages = self
-                .inflight
-                .keys()
-                .filter(|(addr, _)| addr.ip() == from.ip())
-                .count();
-            if source_messages >= ClientWorker::P2P_MAX_MESSAGES_PER_SOURCE {
-                return Err(anyhow!("p2p udp per-source message limit exceeded"));
-            }
-        }
-
-        let duplicate = self
-            .inflight
-            .get(&key)
-            .is_some_and(|entry| entry.parts.contains_key(&frag_idx));
-        if duplicate {
-            return Ok(None);
-        }
-
-        if self.total_bytes.saturating_add(payload.len()) > ClientWorker::P2P_MAX_INFLIGHT_BYTES {
-            return Err(anyhow!("p2p udp inflight byte limit exceeded"));
-        }
-
-        let now = Instant::now();
-        let entry = self
-            .inflight
-            .entry(key)
-            .or_insert_with(|| P2PUdpPartialMessage {
-                created_at: now,
-                last_seen: now,
-                frag_cnt,
-                bytes: 0,
-                parts: HashMap::new(),
-            });
+        let slot = match self.inflight.get(&key) {
+            Some(&slot) => slot,
+            None => self.open_slot(key, frag_cnt, now)?,
+        };
+        let entry = &mut self.slots[slot];
         if entry.frag_cnt != frag_cnt {
             return Err(anyhow!("p2p udp fragment count changed within message"));
         }
-        if entry.bytes.saturating_add(payload.len()) > MAX_MESSAGE_SIZE {
-            return Err(anyhow!("p2p udp reassembled message exceeds max size"));
+        let idx = frag_idx as usize;
+        let bit = 1u64 << (idx % 64);
+        if entry.received[idx / 64] & bit != 0 {
+            return Ok(None);
         }
-        entry.parts.insert(frag_idx, payload.to_vec());
-        entry.bytes = entry.bytes.saturating_add(payload.len());
-        entry.last_seen = now;
-        self.total_bytes = self.total_bytes.saturating_add(payload.len());
 
-        if entry.parts.len() != frag_cnt as usize {
+        let offset = idx * Self::stride();
+        entry.buf[offset..offset + payload.len()].copy_from_slice(payload);
+        entry.lens[idx] = payload.len() as u16;
+        entry.received[idx / 64] |= bit;
+        entry.fragments += 1;
+        if entry.fragments != frag_cnt {
             return Ok(None);
         }
 
-        let mut entry = self
-            .inflight
-            .remove(&key)
-            .ok_or_else(|| anyhow!("p2p udp reassembly state disappeared"))?;
-        self.total_bytes = self.total_bytes.saturating_sub(entry.bytes);
-        let mut out = Vec::with_capacity(entry.bytes);
-        for idx in 0..entry.frag_cnt {
-            let part = entry
-                .parts
-                .remove(&idx)
-                .ok_or_else(|| anyhow!("p2p udp missing fragment during reassembly"))?;
-            out.extend_from_slice(&part);
-        }
+        entry.compact();
+        let out = std::mem::take(&mut entry.buf);
+        self.release(slot);
         self.completed.insert(key, now);
+        self.completed_order.push_back((now, key));
         Ok(Some(out))
     }
 }
@@ -258,6 +367,9 @@ impl ClientWorker {
     pub(super) const P2P_UDP_FLAG_ACK: u8 = 0x01;
     pub(super) const P2P_UDP_HEADER_LEN: usize = 4 + 1 + 1 + 4 + 2 + 2 + 8 + 32;
     pub(super) const P2P_UDP_MTU_PAYLOAD: usize = 1200;
+    /// Payload bytes per fragment; every fragment but the last is full.
+    pub(super) const P2P_UDP_FRAGMENT_PAYLOAD: usize =
+        Self::P2P_UDP_MTU_PAYLOAD - Self::P2P_UDP_HEADER_LEN;
     pub(super) const P2P_REPLAY_WINDOW_SECS: u64 = 300;
     pub(super) const P2P_REPLAY_CACHE_LIMIT: usize = 4096;
     pub(super) const P2P_MAX_FRAGMENTS_PER_MESSAGE: u16 = 128;
@@ -414,28 +526,6 @@ impl ClientWorker {
         Ok(())
     }
 
-    pub(super) async fn p2p_udp_send_ack(
-        socket: &UdpSocket,
-        to: SocketAddr,
-        connection_id: [u8; 16],
-        secret: [u8; 32],
-        msg_id: u32,
-    ) {
-        let timestamp = Self::p2p_now_secs();
-        let tag = Self::p2p_udp_tag(
-            &secret,
-            &connection_id,
-            Self::P2P_UDP_FLAG_ACK,
-            msg_id,
-            0,
-            0,
-            timestamp,
-            &[],
-        );
-        let hdr = Self::p2p_udp_make_header(Self::P2P_UDP_FLAG_ACK, msg_id, 0, 0, timestamp, &tag);
-        let _ = socket.send_to(&hdr, to).await;
-    }
-
     pub(super) fn p2p_udp_ack_packet(
         connection_id: [u8; 16],
         secret: [u8; 32],
@@ -463,10 +553,7 @@ impl ClientWorker {
         msg_id: u32,
         payload: &[u8],
     ) -> Result<()> {
-        let max_payload = Self::P2P_UDP_MTU_PAYLOAD.saturating_sub(Self::P2P_UDP_HEADER_LEN);
-        if max_payload == 0 {
-            return Err(anyhow!("p2p udp mtu too small"));
-        }
+        let max_payload = Self::P2P_UDP_FRAGMENT_PAYLOAD;
         let frag_cnt = ((payload.len() + max_payload - 1) / max_payload).max(1);
         if frag_cnt > Self::P2P_MAX_FRAGMENTS_PER_MESSAGE as usize {
             return Err(anyhow!("p2p udp too many fragments"));
@@ -1006,10 +1093,7 @@ impl ClientWorker {
         payload: &[u8],
         inbox: &mut VecDeque<(SocketAddr, Vec<u8>)>,
     ) -> Result<()> {
-        let max_payload = Self::P2P_UDP_MTU_PAYLOAD.saturating_sub(Self::P2P_UDP_HEADER_LEN);
-        if max_payload == 0 {
-            return Err(anyhow!("p2p udp mtu too small"));
-        }
+        let max_payload = Self::P2P_UDP_FRAGMENT_PAYLOAD;
         let frag_cnt = ((payload.len() + max_payload - 1) / max_payload).max(1);
         if frag_cnt > Self::P2P_MAX_FRAGMENTS_PER_MESSAGE as usize {
             return Err(anyhow!("p2p udp too many fragments"));
@@ -1427,6 +1511,41 @@ mod p2p_security_tests {
             .is_none());
     }
 
+    #[test]
+    fn udp_reassembly_writes_fragments_in_place_and_expires_slots() {
+        let mut state = P2PUdpReassemblyState::new();
+        let from: SocketAddr = "127.0.0.1:9999".parse().unwrap();
+        let stride = ClientWorker::P2P_UDP_FRAGMENT_PAYLOAD;
+        let message: Vec<u8> = (0..2 * stride + 10).map(|i| i as u8).collect();
+        let fragments: Vec<&[u8]> = message.chunks(stride).collect();
+
+        for idx in [2u16, 0] {
+            assert!(state
+                .accept_fragment(from, 7, idx, 3, fragments[idx as usize])
+                .unwrap()
+                .is_none());
+        }
+        let full = state
+            .accept_fragment(from, 7, 1, 3, fragments[1])
+            .unwrap()
+            .unwrap();
+        assert_eq!(full, message);
+        assert_eq!(state.total_bytes, 0);
+
+        for msg_id in 0..ClientWorker::P2P_MAX_MESSAGES_PER_SOURCE as u32 {
+            state
+                .accept_fragment(from, 100 + msg_id, 0, 2, b"a")
+                .unwrap();
+        }
+        assert!(state.accept_fragment(from, 99, 0, 2, b"a").is_err());
+
+        state.prune(Instant::now() + ClientWorker::P2P_REASSEMBLY_TTL + Duration::from_secs(1));
+        assert!(state.inflight.is_empty());
+        assert_eq!(state.total_bytes, 0);
+        assert!(state.accept_fragment(from, 99, 0, 2, b"a").is_ok());
+        assert_eq!(state.slots.len(), ClientWorker::P2P_MAX_MESSAGES_PER_SOURCE);
+    }
+
     #[test]
     fn signed_payload_round_trip_preserves_command_shape() {
         let secret = [1u8; 32];
@@ -9,7 +9,9 @@ use crate::util::network_info::SessionNetworkMonitor;
 // LLM engine is not available in lightweight Android version
 #[cfg(not(target_os = "android"))]
 use crate::llm_engine::Engine;
-use common::{DevicesInfo, EngineType as ClientEngineType, OsType, SystemInfo};
+use common::{
+    CommandReader, CommandWriter, DevicesInfo, EngineType as ClientEngineType, OsType, SystemInfo,
+};
 use tracing::{error, info};
 
 use anyhow::Result;
@@ -36,8 +38,10 @@ pub trait WorkerHandle: Send + Sync {
     fn heartbeat_task(&self) -> impl Future<Output = Result<()>> + Send;
 }
 
-pub type ControlReader = Box<dyn AsyncRead + Send + Unpin>;
-pub type ControlWriter = Box<dyn AsyncWrite + Send + Unpin>;
+/// Control connection halves; each keeps its frame buffer for the life of
+/// the connection, so reads and sends do not allocate.
+pub type ControlReader = CommandReader<Box<dyn AsyncRead + Send + Unpin>>;
+pub type ControlWriter = CommandWriter<Box<dyn AsyncWrite + Send + Unpin>>;
 
 #[cfg(not(target_os = "android"))]
 pub fn install_rustls_crypto_provider_once() {
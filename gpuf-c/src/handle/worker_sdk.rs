@@ -1,16 +1,18 @@
 use crate::util::mobile_control_stream::{
     connect_mobile_control_stream, MobileControlStream, MobileControlTlsConfig,
 };
+use crate::util::stream_coalescer::StreamCoalescer;
 use anyhow::{anyhow, Result};
 use common::{
-    Command, CommandV1, DevicesInfo, EngineType as CommonEngineType, Model, OsType, SystemInfo,
+    Command, CommandV1, CommandV2, DevicesInfo, EngineType as CommonEngineType, Model, OsType,
+    SystemInfo,
 };
 use std::ffi::{c_char, c_void};
 use std::io::Write;
 use std::sync::atomic::{AtomicBool, Ordering};
 use std::sync::{Arc, Mutex, OnceLock};
 
-const CURRENT_VERSION: u32 = 1;
+const CURRENT_VERSION: u32 = common::PROTOCOL_VERSION;
 
 fn derive_model_id_from_path(model_path: &str) -> String {
     let lower = model_path.to_ascii_lowercase();
@@ -184,6 +186,7 @@ pub async fn perform_login_with_tls(
         devices_info: vec![fixed_devices_info],
     };
 
+    crate::SERVER_FEATURES.store(0, Ordering::Release);
     common::write_command_sync(&mut stream, &Command::V1(login_cmd))
         .map_err(|e| anyhow!("Failed to send login command: {}", e))?;
 
@@ -265,12 +268,29 @@ pub async fn start_worker_tasks_with_callback_ptr(
                 device_total_tflops: 0,
                 devices_info: vec![fixed_devices_info],
             };
+            // Servers that did not advertise WorkerStatus drop the
+            // connection on it
+            let status = crate::server_accepts_worker_status().then(|| CommandV2::WorkerStatus {
+                client_id,
+                resident_models: crate::model_registry::resident_paths()
+                    .iter()
+                    .map(|path| derive_model_id_from_path(path))
+                    .collect(),
+                inference_stats: crate::perf::take_heartbeat_stats(),
+                perf_capacity: crate::perf_profile::heartbeat_capacity(),
+                task_slots: crate::WORKER_TASK_SLOTS,
+                gpu_placement: None,
+            });
 
             let send_result = (|| {
                 let mut stream = heartbeat_stream
                     .lock()
                     .map_err(|_| anyhow!("Heartbeat: stream mutex poisoned"))?;
-                common::write_command_sync(&mut *stream, &Command::V1(hb))
+                status
+                    .map_or(Ok(()), |status| {
+                        common::write_command_sync(&mut *stream, &Command::V2(status))
+                    })
+                    .and_then(|_| common::write_command_sync(&mut *stream, &Command::V1(hb)))
                     .map_err(|e| anyhow!("Heartbeat: write_command_sync failed: {e}"))?;
                 stream
                     .flush()
@@ -457,8 +477,13 @@ pub async fn start_worker_tasks_with_callback_ptr(
                     }
                 };
 
-                let Command::V1(v1) = cmd else {
-                    continue;
+                let v1 = match cmd {
+                    Command::V1(v1) => v1,
+                    Command::V2(CommandV2::ServerFeatures { features }) => {
+                        crate::SERVER_FEATURES.store(features, Ordering::Release);
+                        continue;
+                    }
+                    Command::V2(_) => continue,
                 };
 
                 match v1 {
@@ -658,6 +683,53 @@ pub async fn start_worker_tasks_with_callback_ptr(
                             emit_callback(handler_callback, &format!("INFERENCE_DONE - {task_id}"));
                         }
                     }
+                    CommandV1::EmbeddingTask {
+                        task_id,
+                        model: _,
+                        inputs,
+                        normalize,
+                    } => {
+                        emit_callback(handler_callback, &format!("EMBEDDING_TASK - {task_id}"));
+                        let command = match embed_for_task(&inputs, normalize) {
+                            Ok((embeddings, dim, prompt_tokens)) => CommandV1::EmbeddingResult {
+                                task_id: task_id.clone(),
+                                dim,
+                                embeddings,
+                                prompt_tokens,
+                                error: None,
+                            },
+                            Err(error) => CommandV1::EmbeddingResult {
+                                task_id: task_id.clone(),
+                                dim: 0,
+                                embeddings: Vec::new(),
+                                prompt_tokens: 0,
+                                error: Some(error),
+                            },
+                        };
+
+                        let write_result = {
+                            let mut stream = match stream_arc.lock() {
+                                Ok(stream) => stream,
+                                Err(_) => {
+                                    emit_callback(
+                                        handler_callback,
+                                        "STREAM_ERROR - Control stream mutex poisoned",
+                                    );
+                                    clear_tcp_stream();
+                                    break;
+                                }
+                            };
+                            common::write_command_sync(&mut *stream, &Command::V1(command))
+                        };
+                        if let Err(e) = write_result {
+                            emit_callback(
+                                handler_callback,
+                                &format!("EMBEDDING_FAILED - {task_id} - {e}"),
+                            );
+                        } else {
+                            emit_callback(handler_callback, &format!("EMBEDDING_DONE - {task_id}"));
+                        }
+                    }
                     _ => {}
                 }
 
@@ -678,48 +750,20 @@ pub async fn start_worker_tasks_with_callback_ptr(
 fn build_chat_prompt_with_template(messages: &[common::ChatMessage]) -> String {
     #[cfg(any(target_os = "android", target_os = "ios"))]
     {
-        use crate::llama_chat_message;
-
         // Try to use model's built-in chat template first
-        let model_ptr = crate::GLOBAL_MODEL_PTR.load(std::sync::atomic::Ordering::SeqCst);
-        if !model_ptr.is_null() {
-            // Convert messages to C-style array
-            let mut c_messages: Vec<llama_chat_message> = Vec::with_capacity(messages.len());
-            let mut c_roles: Vec<std::ffi::CString> = Vec::with_capacity(messages.len());
-            let mut c_contents: Vec<std::ffi::CString> = Vec::with_capacity(messages.len());
-
-            for msg in messages {
-                c_roles.push(std::ffi::CString::new(msg.role.clone()).unwrap_or_default());
-                c_contents.push(std::ffi::CString::new(msg.content.clone()).unwrap_or_default());
-                c_messages.push(llama_chat_message {
-                    role: c_roles.last().unwrap().as_ptr(),
-                    content: c_contents.last().unwrap().as_ptr(),
-                });
-            }
-
-            // Try to apply model's built-in template (tmpl=nullptr).
-            // SAFETY: `c_messages` points to role/content CStrings owned by
-            // `c_roles`/`c_contents`, all of which live until the call returns.
-            // `buffer` is a valid writable allocation of `buffer.len()` bytes.
-            let mut buffer = vec![0u8; 8192]; // 8KB buffer for template
-            let result = unsafe {
-                crate::llama_chat_apply_template(
-                    std::ptr::null(), // Use model's built-in template
-                    c_messages.as_ptr(),
-                    messages.len(),
-                    true, // add_ass=true
-                    buffer.as_mut_ptr() as *mut std::os::raw::c_char,
-                    buffer.len() as i32,
+        let serving = crate::serving_model();
+        if let Some(serving) = serving.as_ref() {
+            // SAFETY: the lease keeps the serving model alive for the call.
+            let rendered = unsafe {
+                crate::chat_prompt::render(
+                    serving.model,
+                    messages
+                        .iter()
+                        .map(|m| (m.role.as_str(), m.content.as_str())),
                 )
             };
-
-            if result > 0 {
-                if let Ok(prompt) = std::ffi::CStr::from_bytes_until_nul(&buffer[..result as usize])
-                {
-                    if let Ok(prompt_str) = prompt.to_str() {
-                        return prompt_str.to_string();
-                    }
-                }
+            if let Some(prompt) = rendered {
+                return prompt;
             }
         }
 
@@ -747,6 +791,21 @@ fn build_chat_prompt_with_template(messages: &[common::ChatMessage]) -> String {
     }
 }
 
+/// Embed the inputs of an `EmbeddingTask` with the serving model: the
+/// vectors back to back, their width and the number of prompt tokens.
+fn embed_for_task(inputs: &[String], normalize: bool) -> Result<(Vec<f32>, u32, u32), String> {
+    #[cfg(any(target_os = "android", target_os = "ios"))]
+    {
+        crate::embedding::embed_serving(inputs, normalize)
+    }
+
+    #[cfg(not(any(target_os = "android", target_os = "ios")))]
+    {
+        let _ = (inputs, normalize);
+        Err("Embeddings are not supported on this platform".to_string())
+    }
+}
+
 #[cfg_attr(
     not(any(target_os = "android", target_os = "ios")),
     allow(unused_variables)
@@ -763,10 +822,7 @@ fn handle_inference_task(
 ) -> Result<()> {
     #[cfg(any(target_os = "android", target_os = "ios"))]
     {
-        use crate::{
-            gpuf_start_generation_async, GLOBAL_CONTEXT_PTR, GLOBAL_INFERENCE_MUTEX,
-            GLOBAL_MODEL_PTR,
-        };
+        use crate::{gpuf_start_generation_async, GLOBAL_INFERENCE_MUTEX};
 
         fn filter_control_tokens(text: &str) -> String {
             text.replace("<|end|>", "")
@@ -995,10 +1051,16 @@ fn handle_inference_task(
             }
         }
 
+        // Lease the serving model so a hot swap cannot free it mid-task; the
+        // lease must outlive the inference lock.
+        let serving = crate::serving_model();
         let _lock = GLOBAL_INFERENCE_MUTEX.lock().unwrap();
 
-        let model_ptr = GLOBAL_MODEL_PTR.load(Ordering::SeqCst);
-        let ctx_ptr = GLOBAL_CONTEXT_PTR.load(Ordering::SeqCst);
+        let (model_ptr, ctx_ptr) = serving
+            .as_ref()
+            .map_or((std::ptr::null_mut(), std::ptr::null_mut()), |s| {
+                (s.model, s.context)
+            });
 
         if model_ptr.is_null() || ctx_ptr.is_null() {
             let result_command = CommandV1::InferenceResultChunk {
@@ -1027,7 +1089,7 @@ fn handle_inference_task(
             task_id: String,
             seq: u32,
             buf: String,
-            max_bytes: usize,
+            coalescer: StreamCoalescer,
             buf_phase: common::OutputPhase,
             splitter: PhaseSplitter,
             prompt_tokens: u32,
@@ -1098,6 +1160,7 @@ fn handle_inference_task(
                     state.buf_phase = phase;
                 } else if state.buf_phase != phase {
                     let delta = std::mem::take(&mut state.buf);
+                    state.coalescer.reset();
                     let chunk = CommandV1::InferenceResultChunk {
                         task_id: state.task_id.clone(),
                         seq: state.seq,
@@ -1120,11 +1183,13 @@ fn handle_inference_task(
                 }
 
                 state.buf.push_str(&seg);
-                if state.buf.len() < state.max_bytes {
+                if !state.coalescer.push(state.buf.len()) {
                     continue;
                 }
 
                 let delta = std::mem::take(&mut state.buf);
+
+                state.coalescer.reset();
                 let chunk = CommandV1::InferenceResultChunk {
                     task_id: state.task_id.clone(),
                     seq: state.seq,
@@ -1151,7 +1216,7 @@ fn handle_inference_task(
             task_id: task_id.clone(),
             seq: 0,
             buf: String::new(),
-            max_bytes: 8,
+            coalescer: StreamCoalescer::default(),
             buf_phase: common::OutputPhase::Unknown,
             splitter: PhaseSplitter::default(),
             prompt_tokens: 0,
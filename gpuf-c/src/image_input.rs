@@ -0,0 +1,866 @@
+// ============================================================================
+// Raw-pixel and platform buffer image input for multimodal generation
+// ============================================================================
+//
+// Camera frames arrive as packed RGB(A) rows or NV12/YUV 4:2:0 planes with a
+// row stride, on Android usually wrapped in an `AHardwareBuffer`. Instead of
+// having the app encode them to JPEG for us to decode again, the frame is
+// read in place, converted to RGB and area-resampled to the bitmap size in
+// one pass, then handed to `mtmd_bitmap_init`. The conversion runs on a
+// scoped thread while the prompt text ahead of the media marker is prefilled
+// into the text model, so the two overlap.
+// ============================================================================
+
+use std::ffi::c_int;
+
+/// Pixel layouts accepted by `gpuf_generate_multimodal_pixels`.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum PixelFormat {
+    /// Packed 8-bit R, G, B.
+    Rgb888 = 0,
+    /// Packed 8-bit R, G, B, A (alpha ignored).
+    Rgba8888 = 1,
+    /// Packed 8-bit B, G, R, A (alpha ignored), e.g. `kCVPixelFormatType_32BGRA`.
+    Bgra8888 = 2,
+    /// Full-range BT.601 Y plane plus interleaved CbCr plane at half
+    /// resolution, e.g. `kCVPixelFormatType_420YpCbCr8BiPlanarFullRange`.
+    Nv12 = 3,
+}
+
+impl PixelFormat {
+    fn from_raw(raw: c_int) -> Option<Self> {
+        match raw {
+            0 => Some(Self::Rgb888),
+            1 => Some(Self::Rgba8888),
+            2 => Some(Self::Bgra8888),
+            3 => Some(Self::Nv12),
+            _ => None,
+        }
+    }
+}
+
+/// A caller-owned image in one of the `PixelFormat` layouts.
+#[repr(C)]
+#[derive(Debug, Clone, Copy)]
+pub struct gpuf_image_planes {
+    /// A `PixelFormat` value.
+    pub format: c_int,
+    pub width: u32,
+    pub height: u32,
+    /// Packed pixels, or the Y plane for `Nv12`.
+    pub data: *const u8,
+    /// Bytes between the starts of two rows of `data`.
+    pub stride: u32,
+    /// Interleaved CbCr plane for `Nv12`, unused otherwise.
+    pub uv_data: *const u8,
+    /// Bytes between the starts of two rows of `uv_data`.
+    pub uv_stride: u32,
+}
+
+/// Borrowed view of a frame that can be read as RGB.
+#[derive(Debug, Clone, Copy)]
+enum PixelSource<'a> {
+    Packed {
+        data: &'a [u8],
+        stride: usize,
+        bytes_per_pixel: usize,
+        /// Byte offsets of R, G and B within a pixel.
+        rgb: [usize; 3],
+    },
+    Yuv420 {
+        y: &'a [u8],
+        y_stride: usize,
+        u: &'a [u8],
+        v: &'a [u8],
+        uv_stride: usize,
+        /// Bytes between horizontally adjacent chroma samples.
+        uv_pixel_stride: usize,
+    },
+}
+
+/// Full-range BT.601 (JFIF) YCbCr to RGB in 16.16 fixed point.
+fn yuv_to_rgb(y: u8, u: u8, v: u8) -> [u8; 3] {
+    let y = (y as i32) << 16;
+    let u = u as i32 - 128;
+    let v = v as i32 - 128;
+    let clamp = |value: i32| ((value + (1 << 15)) >> 16).clamp(0, 255) as u8;
+    [
+        clamp(y + 91_881 * v),
+        clamp(y - 22_554 * u - 46_802 * v),
+        clamp(y + 116_130 * u),
+    ]
+}
+
+impl PixelSource<'_> {
+    fn rgb_at(&self, x: usize, y: usize) -> [u8; 3] {
+        match *self {
+            PixelSource::Packed {
+                data,
+                stride,
+                bytes_per_pixel,
+                rgb,
+            } => {
+                let pixel = y * stride + x * bytes_per_pixel;
+                [
+                    data[pixel + rgb[0]],
+                    data[pixel + rgb[1]],
+                    data[pixel + rgb[2]],
+                ]
+            }
+            PixelSource::Yuv420 {
+                y: luma,
+                y_stride,
+                u,
+                v,
+                uv_stride,
+                uv_pixel_stride,
+            } => {
+                let chroma = (y / 2) * uv_stride + (x / 2) * uv_pixel_stride;
+                yuv_to_rgb(luma[y * y_stride + x], u[chroma], v[chroma])
+            }
+        }
+    }
+}
+
+/// Bytes a plane of `rows` rows spanning `row_bytes` each occupies when its
+/// rows start `stride` bytes apart.
+fn plane_len(rows: usize, stride: usize, row_bytes: usize) -> usize {
+    if rows == 0 {
+        0
+    } else {
+        (rows - 1) * stride + row_bytes
+    }
+}
+
+/// Bitmap size for a `width` x `height` frame: the longest side is limited
+/// to `max_side` (0 = no limit) and the aspect ratio kept.
+fn target_size(width: u32, height: u32, max_side: u32) -> (u32, u32) {
+    let longest = width.max(height);
+    if max_side == 0 || longest <= max_side {
+        return (width, height);
+    }
+    let scale = |side: u32| {
+        ((side as u64 * max_side as u64 + longest as u64 / 2) / longest as u64).max(1) as u32
+    };
+    (scale(width), scale(height))
+}
+
+/// Convert `source` to packed RGB of `dst_width` x `dst_height`. Every
+/// destination pixel averages the source pixels it covers, which is a box
+/// filter when shrinking and nearest neighbour when enlarging.
+fn resample_rgb(
+    source: &PixelSource,
+    width: usize,
+    height: usize,
+    dst_width: usize,
+    dst_height: usize,
+) -> Vec<u8> {
+    let span = |dst: usize, dst_len: usize, src_len: usize| {
+        let start = dst * src_len / dst_len;
+        let end = ((dst + 1) * src_len / dst_len).max(start + 1);
+        start..end
+    };
+    let mut out = Vec::with_capacity(dst_width * dst_height * 3);
+    for dy in 0..dst_height {
+        let rows = span(dy, dst_height, height);
+        for dx in 0..dst_width {
+            let cols = span(dx, dst_width, width);
+            let mut sum = [0u32; 3];
+            for y in rows.clone() {
+                for x in cols.clone() {
+                    let rgb = source.rgb_at(x, y);
+                    sum[0] += rgb[0] as u32;
+                    sum[1] += rgb[1] as u32;
+                    sum[2] += rgb[2] as u32;
+                }
+            }
+            let count = (rows.len() * cols.len()) as u32;
+            out.extend(
+                sum.iter()
+                    .map(|&channel| ((channel + count / 2) / count) as u8),
+            );
+        }
+    }
+    out
+}
+
+/// RGB frame ready for `mtmd_bitmap_init`.
+struct RgbImage {
+    width: u32,
+    height: u32,
+    pixels: Vec<u8>,
+}
+
+fn convert(source: &PixelSource, width: u32, height: u32, max_side: u32) -> RgbImage {
+    let (dst_width, dst_height) = target_size(width, height, max_side);
+    RgbImage {
+        width: dst_width,
+        height: dst_height,
+        pixels: resample_rgb(
+            source,
+            width as usize,
+            height as usize,
+            dst_width as usize,
+            dst_height as usize,
+        ),
+    }
+}
+
+/// Borrow the planes described by `planes`, checking that strides cover a
+/// row. Returns -2 for an unknown format or inconsistent layout.
+///
+/// # Safety
+/// The plane pointers must be valid for the sizes implied by the
+/// dimensions and strides for the lifetime `'a`.
+unsafe fn source_from_planes<'a>(planes: &gpuf_image_planes) -> Result<PixelSource<'a>, c_int> {
+    let width = planes.width as usize;
+    let height = planes.height as usize;
+    let stride = planes.stride as usize;
+    if width == 0 || height == 0 || planes.data.is_null() {
+        return Err(-2);
+    }
+    let packed = |bytes_per_pixel: usize, rgb: [usize; 3]| {
+        if stride < width * bytes_per_pixel {
+            return Err(-2);
+        }
+        let len = plane_len(height, stride, width * bytes_per_pixel);
+        Ok(PixelSource::Packed {
+            data: std::slice::from_raw_parts(planes.data, len),
+            stride,
+            bytes_per_pixel,
+            rgb,
+        })
+    };
+    match PixelFormat::from_raw(planes.format).ok_or(-2)? {
+        PixelFormat::Rgb888 => packed(3, [0, 1, 2]),
+        PixelFormat::Rgba8888 => packed(4, [0, 1, 2]),
+        PixelFormat::Bgra8888 => packed(4, [2, 1, 0]),
+        PixelFormat::Nv12 => {
+            let uv_stride = planes.uv_stride as usize;
+            let chroma_width = width.div_ceil(2);
+            if planes.uv_data.is_null() || stride < width || uv_stride < chroma_width * 2 {
+                return Err(-2);
+            }
+            let uv_len = plane_len(height.div_ceil(2), uv_stride, chroma_width * 2);
+            let uv = std::slice::from_raw_parts(planes.uv_data, uv_len);
+            Ok(PixelSource::Yuv420 {
+                y: std::slice::from_raw_parts(planes.data, plane_len(height, stride, width)),
+                y_stride: stride,
+                u: uv,
+                v: &uv[1..],
+                uv_stride,
+                uv_pixel_stride: 2,
+            })
+        }
+    }
+}
+
+#[cfg(target_os = "android")]
+mod engine {
+    use super::*;
+    use crate::{
+        generate_multimodal_response_with_vocab, gpuf_create_multimodal_context,
+        gpuf_multimodal_model, llama_context, llama_decode, llama_free, llama_get_memory,
+        llama_get_model, llama_memory_seq_rm, llama_model_get_vocab, llama_n_batch, llama_tokenize,
+        mtmd_bitmap_free, mtmd_bitmap_init, mtmd_input_chunks_free, mtmd_input_chunks_init,
+        mtmd_tokenize, prefix_cache, vision_cache, LlamaPos, LlamaToken, MtmdInputText,
+        MtmdLlamaPos,
+    };
+    use std::ffi::{c_char, c_void, CStr, CString};
+
+    /// Media marker multimodal models are loaded with.
+    const MEDIA_MARKER: &str = "<__media__>";
+
+    /// Tokenize and decode the prompt text ahead of the media marker into
+    /// sequence 0, the way `mtmd_tokenize` would start the first chunk.
+    unsafe fn prefill_leading_text(ctx: *mut llama_context, prompt: &str) -> Vec<LlamaToken> {
+        let Some(marker) = prompt.find(MEDIA_MARKER) else {
+            return Vec::new();
+        };
+        let text = &prompt[..marker];
+        let vocab = llama_model_get_vocab(llama_get_model(ctx));
+        if text.is_empty() || vocab.is_null() {
+            return Vec::new();
+        }
+        let mut tokens: Vec<LlamaToken> = vec![0; text.len() + 2];
+        let n = llama_tokenize(
+            vocab,
+            text.as_ptr() as *const c_char,
+            text.len() as c_int,
+            tokens.as_mut_ptr(),
+            tokens.len() as c_int,
+            true,
+            true,
+        );
+        if n <= 0 {
+            return Vec::new();
+        }
+        tokens.truncate(n as usize);
+
+        let n_batch = llama_n_batch(ctx).max(1) as usize;
+        let mut start = 0;
+        while start < tokens.len() {
+            let end = (start + n_batch).min(tokens.len());
+            let pos: Vec<LlamaPos> = (start as LlamaPos..end as LlamaPos).collect();
+            let logits = vec![0i8; end - start];
+            let batch = crate::llama_batch {
+                n_tokens: (end - start) as c_int,
+                token: tokens.as_mut_ptr().add(start),
+                embd: std::ptr::null_mut(),
+                pos: pos.as_ptr() as *mut LlamaPos,
+                n_seq_id: std::ptr::null_mut(),
+                seq_id: std::ptr::null_mut(),
+                logits: logits.as_ptr() as *mut i8,
+            };
+            if llama_decode(ctx, batch) != 0 {
+                llama_memory_seq_rm(llama_get_memory(ctx), 0, -1, -1);
+                return Vec::new();
+            }
+            start = end;
+        }
+        tokens
+    }
+
+    /// Write `text` NUL-terminated into `output` and return its length.
+    unsafe fn write_output(text: &str, output: *mut c_char, output_len: c_int) -> c_int {
+        let copy_len = text.len().min(output_len as usize - 1);
+        std::ptr::copy_nonoverlapping(text.as_ptr(), output as *mut u8, copy_len);
+        *output.add(copy_len) = 0;
+        copy_len as c_int
+    }
+
+    /// Shared body of the raw-pixel entry points.
+    ///
+    /// # Safety
+    /// `source` must stay readable until this returns; see
+    /// `gpuf_generate_multimodal_pixels` for the other arguments.
+    #[allow(clippy::too_many_arguments)]
+    pub(super) unsafe fn generate(
+        multimodal_model: *mut gpuf_multimodal_model,
+        ctx: *mut llama_context,
+        text_prompt: *const c_char,
+        source: PixelSource,
+        width: u32,
+        height: u32,
+        max_side: u32,
+        max_tokens: c_int,
+        temperature: f32,
+        top_k: c_int,
+        top_p: f32,
+        repeat_penalty: f32,
+        output: *mut c_char,
+        output_len: c_int,
+    ) -> c_int {
+        let mtmd_ctx = (*multimodal_model).mtmd_context;
+        if mtmd_ctx.is_null() {
+            println!("❌ Multimodal context is null");
+            return -1;
+        }
+        let Ok(prompt) = CStr::from_ptr(text_prompt).to_str() else {
+            return -1;
+        };
+
+        let ctx_was_null = ctx.is_null();
+        let ctx = if ctx_was_null {
+            gpuf_create_multimodal_context(multimodal_model)
+        } else {
+            ctx
+        };
+        if ctx.is_null() {
+            println!("❌ Failed to create/get context");
+            return -1;
+        }
+
+        // This rewrites sequence 0
+        prefix_cache::forget(ctx);
+        llama_memory_seq_rm(llama_get_memory(ctx), 0, -1, -1);
+
+        // Convert the frame while the text before the image is prefilled
+        let (image, prefilled) = std::thread::scope(|scope| {
+            let converter = scope.spawn(|| convert(&source, width, height, max_side));
+            let prefilled = prefill_leading_text(ctx, prompt);
+            (converter.join(), prefilled)
+        });
+        let Ok(image) = image else {
+            println!("❌ Image conversion failed");
+            if ctx_was_null {
+                llama_free(ctx);
+            }
+            return -1;
+        };
+        println!(
+            "✅ Image converted {}x{} -> {}x{} ({} prompt tokens prefilled alongside)",
+            width,
+            height,
+            image.width,
+            image.height,
+            prefilled.len()
+        );
+
+        let chunks = mtmd_input_chunks_init();
+        let bitmap = mtmd_bitmap_init(image.width, image.height, image.pixels.as_ptr());
+        if chunks.is_null() || bitmap.is_null() {
+            if !bitmap.is_null() {
+                mtmd_bitmap_free(bitmap);
+            }
+            if !chunks.is_null() {
+                mtmd_input_chunks_free(chunks);
+            }
+            if ctx_was_null {
+                llama_free(ctx);
+            }
+            return -1;
+        }
+        let prompt_cstr = CString::new(prompt).unwrap_or_default();
+        let input_text = MtmdInputText {
+            text: prompt_cstr.as_ptr(),
+            add_special: true,
+            parse_special: true,
+        };
+        let tokenize_result = mtmd_tokenize(mtmd_ctx, chunks, &input_text, &bitmap, 1);
+        mtmd_bitmap_free(bitmap);
+
+        let mut result = -1;
+        if tokenize_result != 0 {
+            println!("❌ Multimodal tokenization failed: {}", tokenize_result);
+        } else {
+            let mut n_past: MtmdLlamaPos = 0;
+            let encode_result = vision_cache::eval_chunks(
+                multimodal_model,
+                ctx,
+                chunks,
+                &image.pixels,
+                0,
+                0,
+                128,
+                true,
+                &prefilled,
+                &mut n_past,
+            );
+            let vocab = llama_model_get_vocab(llama_get_model(ctx));
+            if encode_result != 0 || vocab.is_null() {
+                println!("❌ Multimodal encoding failed: {}", encode_result);
+            } else {
+                let text = generate_multimodal_response_with_vocab(
+                    ctx,
+                    vocab,
+                    max_tokens,
+                    temperature,
+                    top_k,
+                    top_p,
+                    repeat_penalty,
+                    n_past,
+                );
+                result = write_output(&text, output, output_len);
+            }
+        }
+
+        mtmd_input_chunks_free(chunks);
+        if ctx_was_null {
+            llama_free(ctx);
+        }
+        result
+    }
+
+    // Android NDK hardware buffers (libnativewindow, API 26+; planes API 29+)
+    #[repr(C)]
+    #[derive(Default)]
+    struct AHardwareBufferDesc {
+        width: u32,
+        height: u32,
+        layers: u32,
+        format: u32,
+        usage: u64,
+        /// In pixels
+        stride: u32,
+        rfu0: u32,
+        rfu1: u64,
+    }
+
+    #[repr(C)]
+    #[derive(Clone, Copy)]
+    struct AHardwareBufferPlane {
+        data: *mut c_void,
+        pixel_stride: u32,
+        row_stride: u32,
+    }
+
+    #[repr(C)]
+    struct AHardwareBufferPlanes {
+        plane_count: u32,
+        planes: [AHardwareBufferPlane; 4],
+    }
+
+    const AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM: u32 = 1;
+    const AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM: u32 = 2;
+    const AHARDWAREBUFFER_FORMAT_R8G8B8_UNORM: u32 = 3;
+    const AHARDWAREBUFFER_FORMAT_Y8CB8CR8_420: u32 = 0x23;
+    const AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN: u64 = 3;
+
+    #[link(name = "nativewindow")]
+    extern "C" {
+        fn AHardwareBuffer_describe(buffer: *const c_void, desc: *mut AHardwareBufferDesc);
+        fn AHardwareBuffer_lock(
+            buffer: *mut c_void,
+            usage: u64,
+            fence: i32,
+            rect: *const c_void,
+            address: *mut *mut c_void,
+        ) -> c_int;
+        fn AHardwareBuffer_lockPlanes(
+            buffer: *mut c_void,
+            usage: u64,
+            fence: i32,
+            rect: *const c_void,
+            planes: *mut AHardwareBufferPlanes,
+        ) -> c_int;
+        fn AHardwareBuffer_unlock(buffer: *mut c_void, fence: *mut i32) -> c_int;
+    }
+
+    /// Lock `buffer` for CPU reads, run `body` on its pixels, then unlock.
+    /// Returns -2 for an unsupported format and -3 if locking fails.
+    pub(super) unsafe fn with_hardware_buffer(
+        buffer: *mut c_void,
+        body: impl FnOnce(PixelSource, u32, u32) -> c_int,
+    ) -> c_int {
+        let mut desc = AHardwareBufferDesc::default();
+        AHardwareBuffer_describe(buffer, &mut desc);
+        let (width, height) = (desc.width as usize, desc.height as usize);
+        if width == 0 || height == 0 {
+            return -2;
+        }
+
+        let source = match desc.format {
+            AHARDWAREBUFFER_FORMAT_R8G8B8A8_UNORM
+            | AHARDWAREBUFFER_FORMAT_R8G8B8X8_UNORM
+            | AHARDWAREBUFFER_FORMAT_R8G8B8_UNORM => {
+                let bytes_per_pixel = if desc.format == AHARDWAREBUFFER_FORMAT_R8G8B8_UNORM {
+                    3
+                } else {
+                    4
+                };
+                let mut address: *mut c_void = std::ptr::null_mut();
+                if AHardwareBuffer_lock(
+                    buffer,
+                    AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN,
+                    -1,
+                    std::ptr::null(),
+                    &mut address,
+                ) != 0
+                    || address.is_null()
+                {
+                    return -3;
+                }
+                let stride = desc.stride.max(desc.width) as usize * bytes_per_pixel;
+                PixelSource::Packed {
+                    data: std::slice::from_raw_parts(
+                        address as *const u8,
+                        plane_len(height, stride, width * bytes_per_pixel),
+                    ),
+                    stride,
+                    bytes_per_pixel,
+                    rgb: [0, 1, 2],
+                }
+            }
+            AHARDWAREBUFFER_FORMAT_Y8CB8CR8_420 => {
+                let mut planes = AHardwareBufferPlanes {
+                    plane_count: 0,
+                    planes: [AHardwareBufferPlane {
+                        data: std::ptr::null_mut(),
+                        pixel_stride: 0,
+                        row_stride: 0,
+                    }; 4],
+                };
+                if AHardwareBuffer_lockPlanes(
+                    buffer,
+                    AHARDWAREBUFFER_USAGE_CPU_READ_OFTEN,
+                    -1,
+                    std::ptr::null(),
+                    &mut planes,
+                ) != 0
+                {
+                    return -3;
+                }
+                let [y, u, v, _] = planes.planes;
+                if planes.plane_count < 3
+                    || y.data.is_null()
+                    || u.data.is_null()
+                    || v.data.is_null()
+                {
+                    AHardwareBuffer_unlock(buffer, std::ptr::null_mut());
+                    return -2;
+                }
+                let (chroma_width, chroma_height) = (width.div_ceil(2), height.div_ceil(2));
+                let uv_stride = u.row_stride as usize;
+                let uv_pixel_stride = u.pixel_stride.max(1) as usize;
+                let chroma_len = plane_len(
+                    chroma_height,
+                    uv_stride,
+                    (chroma_width - 1) * uv_pixel_stride + 1,
+                );
+                PixelSource::Yuv420 {
+                    y: std::slice::from_raw_parts(
+                        y.data as *const u8,
+                        plane_len(height, y.row_stride as usize, width),
+                    ),
+                    y_stride: y.row_stride as usize,
+                    u: std::slice::from_raw_parts(u.data as *const u8, chroma_len),
+                    v: std::slice::from_raw_parts(v.data as *const u8, chroma_len),
+                    uv_stride,
+                    uv_pixel_stride,
+                }
+            }
+            other => {
+                println!("❌ Unsupported AHardwareBuffer format {:#x}", other);
+                return -2;
+            }
+        };
+
+        let result = body(source, desc.width, desc.height);
+        AHardwareBuffer_unlock(buffer, std::ptr::null_mut());
+        result
+    }
+}
+
+/// Generate from a raw frame instead of encoded image bytes. The frame is
+/// converted to RGB and resampled so its longest side is at most `max_side`
+/// pixels (0 keeps the source size) on a worker thread, while the prompt
+/// text before the media marker is prefilled. Repeated frames hit the
+/// vision embedding cache like `gpuf_generate_multimodal`.
+///
+/// Returns the number of bytes written to `output` (NUL-terminated), -1 on
+/// failure and -2 for an invalid `planes` description.
+///
+/// # Safety
+/// - `multimodal_model` must come from `gpuf_load_multimodal_model`; `ctx`
+///   may be null to use a temporary context.
+/// - `text_prompt` must be a valid NUL-terminated string.
+/// - The planes in `planes` must be readable for the sizes implied by their
+///   dimensions and strides until the call returns.
+/// - `output` must be writable for `output_len` bytes.
+#[no_mangle]
+#[cfg(target_os = "android")]
+pub extern "C" fn gpuf_generate_multimodal_pixels(
+    multimodal_model: *mut crate::gpuf_multimodal_model,
+    ctx: *mut crate::llama_context,
+    text_prompt: *const std::ffi::c_char,
+    planes: *const gpuf_image_planes,
+    max_side: u32,
+    max_tokens: c_int,
+    temperature: f32,
+    top_k: c_int,
+    top_p: f32,
+    repeat_penalty: f32,
+    output: *mut std::ffi::c_char,
+    output_len: c_int,
+) -> c_int {
+    if multimodal_model.is_null()
+        || text_prompt.is_null()
+        || planes.is_null()
+        || output.is_null()
+        || output_len <= 0
+    {
+        return -1;
+    }
+    // SAFETY: Pointers were checked for null; the caller keeps the planes
+    // and output buffer valid for the duration of the call.
+    unsafe {
+        let planes = &*planes;
+        let source = match source_from_planes(planes) {
+            Ok(source) => source,
+            Err(code) => return code,
+        };
+        engine::generate(
+            multimodal_model,
+            ctx,
+            text_prompt,
+            source,
+            planes.width,
+            planes.height,
+            max_side,
+            max_tokens,
+            temperature,
+            top_k,
+            top_p,
+            repeat_penalty,
+            output,
+            output_len,
+        )
+    }
+}
+
+#[no_mangle]
+#[cfg(target_os = "ios")]
+pub extern "C" fn gpuf_generate_multimodal_pixels(
+    _multimodal_model: *mut crate::gpuf_multimodal_model,
+    _ctx: *mut crate::llama_context,
+    _text_prompt: *const std::ffi::c_char,
+    _planes: *const gpuf_image_planes,
+    _max_side: u32,
+    _max_tokens: c_int,
+    _temperature: f32,
+    _top_k: c_int,
+    _top_p: f32,
+    _repeat_penalty: f32,
+    _output: *mut std::ffi::c_char,
+    _output_len: c_int,
+) -> c_int {
+    -1
+}
+
+/// Like `gpuf_generate_multimodal_pixels`, reading the frame straight from
+/// an `AHardwareBuffer` (RGBA/RGBX/RGB 8888 or YUV_420_888). The buffer is
+/// locked for CPU reads for the duration of the conversion.
+///
+/// Returns the number of bytes written to `output`, -1 on failure, -2 for
+/// an unsupported buffer format and -3 if the buffer cannot be locked.
+///
+/// # Safety
+/// `hardware_buffer` must be a valid `AHardwareBuffer*` with CPU read usage;
+/// see `gpuf_generate_multimodal_pixels` for the other arguments.
+#[no_mangle]
+#[cfg(target_os = "android")]
+pub extern "C" fn gpuf_generate_multimodal_hardware_buffer(
+    multimodal_model: *mut crate::gpuf_multimodal_model,
+    ctx: *mut crate::llama_context,
+    text_prompt: *const std::ffi::c_char,
+    hardware_buffer: *mut std::ffi::c_void,
+    max_side: u32,
+    max_tokens: c_int,
+    temperature: f32,
+    top_k: c_int,
+    top_p: f32,
+    repeat_penalty: f32,
+    output: *mut std::ffi::c_char,
+    output_len: c_int,
+) -> c_int {
+    if multimodal_model.is_null()
+        || text_prompt.is_null()
+        || hardware_buffer.is_null()
+        || output.is_null()
+        || output_len <= 0
+    {
+        return -1;
+    }
+    // SAFETY: Pointers were checked for null; the buffer stays locked while
+    // `engine::generate` reads it.
+    unsafe {
+        engine::with_hardware_buffer(hardware_buffer, |source, width, height| {
+            engine::generate(
+                multimodal_model,
+                ctx,
+                text_prompt,
+                source,
+                width,
+                height,
+                max_side,
+                max_tokens,
+                temperature,
+                top_k,
+                top_p,
+                repeat_penalty,
+                output,
+                output_len,
+            )
+        })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn target_size_keeps_aspect_within_max_side() {
+        assert_eq!(target_size(1920, 1080, 0), (1920, 1080));
+        assert_eq!(target_size(640, 480, 1024), (640, 480));
+        assert_eq!(target_size(1920, 1080, 448), (448, 252));
+        assert_eq!(target_size(1080, 1920, 448), (252, 448));
+        assert_eq!(target_size(4000, 2, 100), (100, 1));
+    }
+
+    #[test]
+    fn packed_formats_honour_channel_order_and_stride() {
+        // 2x2 BGRA with 4 bytes of row padding
+        let data: Vec<u8> = vec![
+            1, 2, 3, 255, 4, 5, 6, 255, 0, 0, 0, 0, //
+            7, 8, 9, 255, 10, 11, 12, 255, 0, 0, 0, 0,
+        ];
+        let planes = gpuf_image_planes {
+            format: PixelFormat::Bgra8888 as c_int,
+            width: 2,
+            height: 2,
+            data: data.as_ptr(),
+            stride: 12,
+            uv_data: std::ptr::null(),
+            uv_stride: 0,
+        };
+        // SAFETY: `data` covers the described planes.
+        let source = unsafe { source_from_planes(&planes) }.unwrap();
+        let image = convert(&source, 2, 2, 0);
+        assert_eq!(image.pixels, vec![3, 2, 1, 6, 5, 4, 9, 8, 7, 12, 11, 10]);
+
+        // Stride shorter than a row is rejected
+        let bad = gpuf_image_planes {
+            stride: 4,
+            ..planes
+        };
+        // SAFETY: Rejected before any slice is built.
+        assert_eq!(unsafe { source_from_planes(&bad) }.map(|_| ()), Err(-2));
+        let unknown = gpuf_image_planes {
+            format: 9,
+            ..planes
+        };
+        // SAFETY: Rejected before any slice is built.
+        assert_eq!(unsafe { source_from_planes(&unknown) }.map(|_| ()), Err(-2));
+    }
+
+    #[test]
+    fn nv12_converts_with_full_range_bt601() {
+        assert_eq!(yuv_to_rgb(255, 128, 128), [255, 255, 255]);
+        assert_eq!(yuv_to_rgb(0, 128, 128), [0, 0, 0]);
+        let red = yuv_to_rgb(76, 85, 255);
+        assert!(red[0] >= 250 && red[1] <= 2 && red[2] <= 2, "{:?}", red);
+
+        // 2x2 frame, one chroma sample shared by all four pixels
+        let y = [255u8, 255, 0, 0];
+        let uv = [128u8, 128];
+        let planes = gpuf_image_planes {
+            format: PixelFormat::Nv12 as c_int,
+            width: 2,
+            height: 2,
+            data: y.as_ptr(),
+            stride: 2,
+            uv_data: uv.as_ptr(),
+            uv_stride: 2,
+        };
+        // SAFETY: `y` and `uv` cover the described planes.
+        let source = unsafe { source_from_planes(&planes) }.unwrap();
+        let image = convert(&source, 2, 2, 0);
+        assert_eq!(
+            image.pixels,
+            vec![255, 255, 255, 255, 255, 255, 0, 0, 0, 0, 0, 0]
+        );
+    }
+
+    #[test]
+    fn downscale_averages_covered_pixels() {
+        // 4x2 RGB: left half black, right half white
+        let mut data = Vec::new();
+        for _ in 0..2 {
+            data.extend_from_slice(&[0, 0, 0, 0, 0, 0, 255, 255, 255, 255, 255, 255]);
+        }
+        let source = PixelSource::Packed {
+            data: &data,
+            stride: 12,
+            bytes_per_pixel: 3,
+            rgb: [0, 1, 2],
+        };
+        assert_eq!(
+            resample_rgb(&source, 4, 2, 2, 1),
+            vec![0, 0, 0, 255, 255, 255]
+        );
+        assert_eq!(resample_rgb(&source, 4, 2, 1, 1), vec![128, 128, 128]);
+    }
+}
@@ -9,23 +9,32 @@
 // ============================================================================
 
 #[cfg(target_os = "android")]
-use jni::objects::{JClass, JObject, JString};
+use jni::objects::{GlobalRef, JByteBuffer, JClass, JObject, JString};
 #[cfg(target_os = "android")]
 use jni::sys::{jboolean, jbyteArray, jfloat, jint, jlong, jstring};
 #[cfg(target_os = "android")]
-use jni::JNIEnv;
+use jni::{JNIEnv, JavaVM};
 
 use std::ffi::{c_char, c_int, c_void, CStr, CString};
 use std::sync::atomic::Ordering;
 
+use crate::perf::{gpuf_perf_get_aggregate, gpuf_perf_get_last, gpuf_perf_reset, gpuf_perf_stats};
+use crate::perf_profile::{
+    gpuf_get_perf_profile_status, gpuf_perf_profile_status, gpuf_report_device_state,
+    gpuf_set_perf_profile,
+};
+use crate::token_stream::{
+    gpuf_start_generation_stream, gpuf_stream, gpuf_stream_create, gpuf_stream_free,
+    gpuf_stream_poll,
+};
 use crate::{
     gpuf_cleanup, gpuf_create_context, gpuf_create_multimodal_context, gpuf_free_multimodal_model,
     gpuf_generate_final_solution_text, gpuf_generate_multimodal, gpuf_get_model_status, gpuf_init,
     gpuf_is_context_ready, gpuf_is_model_loaded, gpuf_load_model, gpuf_load_model_async,
     gpuf_load_multimodal_model, gpuf_multimodal_model, gpuf_multimodal_supports_vision,
     gpuf_start_generation_async, gpuf_stop_generation, gpuf_system_info, gpuf_version,
-    llama_context, llama_model, manual_llama_completion, should_stop_generation,
-    GLOBAL_CONTEXT_PTR, GLOBAL_MODEL_PTR, MODEL_STATUS,
+    llama_context, llama_model, manual_llama_completion, serving_model, set_serving_model,
+    should_stop_generation, MODEL_STATUS,
 };
 
 #[cfg(target_os = "android")]
@@ -305,11 +314,8 @@ pub extern "C" fn Java_com_gpuf_c_GPUEngine_startInferenceService(
         return -4;
     }
 
-    // Store global pointers
-    {
-        GLOBAL_MODEL_PTR.store(model_ptr, Ordering::SeqCst);
-        GLOBAL_CONTEXT_PTR.store(context_ptr, Ordering::SeqCst);
-    }
+    // Serve the new pair; readers lease it through `serving_model()`
+    set_serving_model(model_ptr, context_ptr);
 
     // Update status
     {
@@ -413,11 +419,8 @@ pub extern "C" fn Java_com_gpuf_c_GPUEngine_startInferenceServiceAsync(
         return -4;
     }
 
-    // Store global pointers
-    {
-        GLOBAL_MODEL_PTR.store(model_ptr, Ordering::SeqCst);
-        GLOBAL_CONTEXT_PTR.store(context_ptr, Ordering::SeqCst);
-    }
+    // Serve the new pair; readers lease it through `serving_model()`
+    set_serving_model(model_ptr, context_ptr);
 
     // Update status to ready
     {
@@ -441,11 +444,8 @@ pub extern "C" fn Java_com_gpuf_c_GPUEngine_stopInferenceService(
 ) -> jint {
     println!("🔥 GPUFabric JNI: Stopping inference service");
 
-    // Clear global pointers and status
-    {
-        GLOBAL_MODEL_PTR.store(std::ptr::null_mut(), Ordering::SeqCst);
-        GLOBAL_CONTEXT_PTR.store(std::ptr::null_mut(), Ordering::SeqCst);
-    }
+    // Stop serving; tasks still holding a lease finish on the old pair
+    set_serving_model(std::ptr::null_mut(), std::ptr::null_mut());
 
     {
         let mut status = MODEL_STATUS.lock().unwrap();
@@ -512,11 +512,8 @@ pub extern "C" fn Java_com_gpuf_c_GPUEngine_loadModelNew(
         return -4;
     }
 
-    // Store global pointers
-    {
-        GLOBAL_MODEL_PTR.store(model_ptr, Ordering::SeqCst);
-        GLOBAL_CONTEXT_PTR.store(context_ptr, Ordering::SeqCst);
-    }
+    // Serve the new pair; readers lease it through `serving_model()`
+    set_serving_model(model_ptr, context_ptr);
 
     // Update status
     {
@@ -660,17 +657,15 @@ pub extern "C" fn Java_com_gpuf_c_GPUEngine_generateText(
         Err(_) => return std::ptr::null_mut(),
     };
 
-    // Get global model and context pointers
-    let model_ptr = GLOBAL_MODEL_PTR.load(Ordering::SeqCst);
-    let context_ptr = GLOBAL_CONTEXT_PTR.load(Ordering::SeqCst);
-
-    if model_ptr.is_null() || context_ptr.is_null() {
+    // Lease the serving model so a swap cannot free it mid-generation
+    let Some(serving) = serving_model() else {
         eprintln!("🔥 GPUFabric JNI: Model or context not initialized");
         return match env.new_string("Error: Model not loaded") {
             Ok(jstring) => jstring.into_raw(),
             Err(_) => std::ptr::null_mut(),
         };
-    }
+    };
+    let (model_ptr, context_ptr) = (serving.model, serving.context);
 
     let prompt_cstr = match CString::new(prompt_text) {
         Ok(s) => s,
@@ -738,17 +733,15 @@ pub extern "C" fn Java_com_gpuf_c_GPUEngine_generateTextWithSampling(
         Err(_) => return std::ptr::null_mut(),
     };
 
-    // Get global model and context pointers
-    let model_ptr = GLOBAL_MODEL_PTR.load(Ordering::SeqCst);
-    let context_ptr = GLOBAL_CONTEXT_PTR.load(Ordering::SeqCst);
-
-    if model_ptr.is_null() || context_ptr.is_null() {
+    // Lease the serving model so a swap cannot free it mid-generation
+    let Some(serving) = serving_model() else {
         eprintln!("🔥 GPUFabric JNI: Model or context not initialized");
         return match env.new_string("Error: Model not loaded") {
             Ok(jstring) => jstring.into_raw(),
             Err(_) => std::ptr::null_mut(),
         };
-    }
+    };
+    let (model_ptr, context_ptr) = (serving.model, serving.context);
 
     let prompt_cstr = match CString::new(prompt_text) {
         Ok(s) => s,
@@ -968,6 +961,102 @@ pub extern "C" fn Java_com_gpuf_c_GPUEngine_getGenerationStatus(
     }
 }
 
+// ============================================================================
+// Performance Counters
+// ============================================================================
+
+/// Get inference performance counters as a JSON object with the fields of
+/// `gpuf_perf_stats`
+///
+/// Java signature:
+/// public static native String getPerfStats(boolean aggregate);
+///
+/// Returns the most recent request, or the rolling aggregate over the last
+/// `PERF_WINDOW` requests when `aggregate` is true.
+#[no_mangle]
+#[cfg(target_os = "android")]
+pub extern "C" fn Java_com_gpuf_c_GPUEngine_getPerfStats(
+    env: JNIEnv,
+    _class: JClass,
+    aggregate: jboolean,
+) -> jstring {
+    let mut stats = gpuf_perf_stats::default();
+    if aggregate != 0 {
+        gpuf_perf_get_aggregate(&mut stats);
+    } else {
+        gpuf_perf_get_last(&mut stats);
+    }
+
+    let json = serde_json::to_string(&stats).unwrap_or_else(|_| "{}".to_string());
+    match env.new_string(json) {
+        Ok(jstring) => jstring.into_raw(),
+        Err(_) => std::ptr::null_mut(),
+    }
+}
+
+/// Forget recorded performance counters
+///
+/// Java signature:
+/// public static native void resetPerfStats();
+#[no_mangle]
+#[cfg(target_os = "android")]
+pub extern "C" fn Java_com_gpuf_c_GPUEngine_resetPerfStats(_env: JNIEnv, _class: JClass) {
+    gpuf_perf_reset();
+}
+
+/// Select the performance profile: 0 max-throughput, 1 sustained, 2 battery
+///
+/// Java signature:
+/// public static native int setPerfProfile(int profile);
+#[no_mangle]
+#[cfg(target_os = "android")]
+pub extern "C" fn Java_com_gpuf_c_GPUEngine_setPerfProfile(
+    _env: JNIEnv,
+    _class: JClass,
+    profile: jint,
+) -> jint {
+    gpuf_set_perf_profile(profile)
+}
+
+/// Report the thermal level (0-3, from `PowerManager.getCurrentThermalStatus`)
+/// and battery state, which apps can read when sysfs is not accessible
+///
+/// Java signature:
+/// public static native int reportDeviceState(int thermalLevel, int batteryPercent, boolean charging);
+#[no_mangle]
+#[cfg(target_os = "android")]
+pub extern "C" fn Java_com_gpuf_c_GPUEngine_reportDeviceState(
+    _env: JNIEnv,
+    _class: JClass,
+    thermal_level: jint,
+    battery_percent: jint,
+    charging: jboolean,
+) -> jint {
+    gpuf_report_device_state(thermal_level, battery_percent, charging as i32)
+}
+
+/// Get the performance profile, its current limits and the sustainable
+/// tokens/s as a JSON object with the fields of `gpuf_perf_profile_status`
+///
+/// Java signature:
+/// public static native String getPerfProfileStatus();
+#[no_mangle]
+#[cfg(target_os = "android")]
+pub extern "C" fn Java_com_gpuf_c_GPUEngine_getPerfProfileStatus(
+    env: JNIEnv,
+    _class: JClass,
+) -> jstring {
+    let mut status = gpuf_perf_profile_status::default();
+    // SAFETY: `status` is a valid, writable local.
+    unsafe { gpuf_get_perf_profile_status(&mut status) };
+
+    let json = serde_json::to_string(&status).unwrap_or_else(|_| "{}".to_string());
+    match env.new_string(json) {
+        Ok(jstring) => jstring.into_raw(),
+        Err(_) => std::ptr::null_mut(),
+    }
+}
+
 // ============================================================================
 // Multimodal API (Vision + Text)
 // ============================================================================
@@ -1189,3 +1278,515 @@ pub extern "C" fn Java_com_gpuf_c_GPUEngine_freeMultimodalModel(
         println!("✅ Multimodal model freed");
     }
 }
+
+// ============================================================================
+// Direct Buffer Fast Path
+// ============================================================================
+//
+// The String-based calls above copy prompts out of the Java heap, build a new
+// java.lang.String for each result and, when streaming, call into Java once
+// per token. The variants below read prompts and images from direct
+// ByteBuffers and write results straight into a caller-owned direct
+// ByteBuffer. Streaming goes through a token sink: one native thread,
+// attached to the VM for as long as the sink is registered, drains a
+// `gpuf_stream` and passes Java batches of UTF-8 bytes in one reused direct
+// buffer. Nothing is allocated on the Java heap per token.
+
+#[cfg(target_os = "android")]
+thread_local! {
+    /// NUL-terminated copy of the last prompt, reused across calls.
+    static PROMPT_SCRATCH: std::cell::RefCell<Vec<u8>> = std::cell::RefCell::new(Vec::new());
+}
+
+/// Address and capacity of a direct buffer; None for null or heap buffers.
+#[cfg(target_os = "android")]
+fn direct_buffer(env: &JNIEnv, buffer: &JByteBuffer) -> Option<(*mut u8, usize)> {
+    if buffer.is_null() {
+        return None;
+    }
+    let ptr = env.get_direct_buffer_address(buffer).ok()?;
+    let capacity = env.get_direct_buffer_capacity(buffer).ok()?;
+    Some((ptr, capacity))
+}
+
+/// Run `f` with the first `len` bytes of `buffer` as a C string. The bytes
+/// are used in place when the caller put a NUL right after them and copied
+/// into a per-thread scratch buffer otherwise. None for an unusable buffer
+/// or a prompt containing NUL.
+#[cfg(target_os = "android")]
+fn with_direct_prompt<R>(
+    env: &JNIEnv,
+    buffer: &JByteBuffer,
+    len: jint,
+    f: impl FnOnce(*const c_char) -> R,
+) -> Option<R> {
+    let (ptr, capacity) = direct_buffer(env, buffer)?;
+    let len = usize::try_from(len).ok().filter(|&len| len <= capacity)?;
+    // SAFETY: `ptr` is the address of a live direct buffer of `capacity`
+    // bytes, which Java keeps reachable for the duration of this JNI call.
+    let bytes = unsafe { std::slice::from_raw_parts(ptr as *const u8, capacity) };
+    if bytes[..len].contains(&0) {
+        return None;
+    }
+    if capacity > len && bytes[len] == 0 {
+        return Some(f(ptr as *const c_char));
+    }
+    Some(PROMPT_SCRATCH.with(|scratch| {
+        let mut scratch = scratch.borrow_mut();
+        scratch.clear();
+        scratch.extend_from_slice(&bytes[..len]);
+        scratch.push(0);
+        f(scratch.as_ptr() as *const c_char)
+    }))
+}
+
+/// Generate text with sampling parameters using direct buffers
+///
+/// Java signature:
+/// public static native int generateTextDirect(ByteBuffer prompt, int promptLen, ByteBuffer output, int maxTokens, float temperature, int topK, float topP, float repeatPenalty);
+///
+/// `prompt` and `output` must be direct buffers. The result is written to
+/// `output` as NUL-terminated UTF-8.
+///
+/// Returns: bytes written (excluding the NUL), -1 if no model is loaded, -2
+/// for a heap, empty or too short buffer, or another negative value when
+/// generation failed
+#[cfg(target_os = "android")]
+#[no_mangle]
+pub extern "C" fn Java_com_gpuf_c_GPUEngine_generateTextDirect(
+    env: JNIEnv,
+    _class: JClass,
+    prompt: JByteBuffer,
+    prompt_len: jint,
+    output: JByteBuffer,
+    max_tokens: jint,
+    temperature: jfloat,
+    top_k: jint,
+    top_p: jfloat,
+    repeat_penalty: jfloat,
+) -> jint {
+    let Some(serving) = serving_model() else {
+        eprintln!("🔥 GPUFabric JNI: Model or context not initialized");
+        return -1;
+    };
+    let (model_ptr, context_ptr) = (serving.model, serving.context);
+
+    let (output_ptr, output_cap) = match direct_buffer(&env, &output) {
+        Some((ptr, cap)) if cap > 0 => (ptr, cap.min(c_int::MAX as usize) as c_int),
+        _ => return -2,
+    };
+
+    with_direct_prompt(&env, &prompt, prompt_len, |prompt| {
+        manual_llama_completion(
+            model_ptr,
+            context_ptr,
+            prompt,
+            max_tokens,
+            temperature,
+            top_k,
+            top_p,
+            repeat_penalty,
+            output_ptr as *mut c_char,
+            output_cap,
+        )
+    })
+    .unwrap_or(-2)
+}
+
+/// Generate with multimodal input using direct buffers
+///
+/// Java signature:
+/// public static native int generateMultimodalDirect(long multimodalModelPtr, long ctxPtr, ByteBuffer prompt, int promptLen, ByteBuffer image, int imageLen, ByteBuffer output, int maxTokens, float temperature, int topK, float topP, float repeatPenalty);
+///
+/// The image bytes are read in place; pass a null `image` for a text-only
+/// prompt.
+///
+/// Returns: bytes written to `output`, -1 for an invalid model or context,
+/// -2 for a heap or too short buffer, or another negative value when
+/// generation failed
+#[cfg(target_os = "android")]
+#[no_mangle]
+pub extern "C" fn Java_com_gpuf_c_GPUEngine_generateMultimodalDirect(
+    env: JNIEnv,
+    _class: JClass,
+    multimodal_model_ptr: jlong,
+    ctx_ptr: jlong,
+    prompt: JByteBuffer,
+    prompt_len: jint,
+    image: JByteBuffer,
+    image_len: jint,
+    output: JByteBuffer,
+    max_tokens: jint,
+    temperature: jfloat,
+    top_k: jint,
+    top_p: jfloat,
+    repeat_penalty: jfloat,
+) -> jint {
+    if multimodal_model_ptr == 0 || ctx_ptr == 0 {
+        return -1;
+    }
+
+    let (image_ptr, image_size) = if image.is_null() {
+        (std::ptr::null(), 0)
+    } else {
+        match direct_buffer(&env, &image) {
+            Some((ptr, cap)) if image_len >= 0 && image_len as usize <= cap => {
+                (ptr as *const u8, image_len as u64)
+            }
+            _ => return -2,
+        }
+    };
+    let (output_ptr, output_cap) = match direct_buffer(&env, &output) {
+        Some((ptr, cap)) if cap > 0 => (ptr, cap.min(c_int::MAX as usize) as c_int),
+        _ => return -2,
+    };
+
+    with_direct_prompt(&env, &prompt, prompt_len, |prompt| {
+        gpuf_generate_multimodal(
+            multimodal_model_ptr as *mut gpuf_multimodal_model,
+            ctx_ptr as *mut llama_context,
+            prompt,
+            image_ptr,
+            image_size,
+            max_tokens,
+            temperature,
+            top_k,
+            top_p,
+            repeat_penalty,
+            output_ptr as *mut c_char,
+            output_cap,
+        )
+    })
+    .unwrap_or(-2)
+}
+
+/// Wakes the sink thread; lives in a Box so the stream can point at it.
+#[cfg(target_os = "android")]
+struct SinkWake {
+    pending: std::sync::Mutex<bool>,
+    ready: std::sync::Condvar,
+}
+
+#[cfg(target_os = "android")]
+impl SinkWake {
+    fn notify(&self) {
+        *self.pending.lock().unwrap_or_else(|p| p.into_inner()) = true;
+        self.ready.notify_one();
+    }
+
+    fn wait(&self) {
+        let mut pending = self.pending.lock().unwrap_or_else(|p| p.into_inner());
+        while !*pending {
+            pending = self.ready.wait(pending).unwrap_or_else(|p| p.into_inner());
+        }
+        *pending = false;
+    }
+}
+
+#[cfg(target_os = "android")]
+extern "C" fn token_sink_ready(user_data: *mut c_void) {
+    // SAFETY: `user_data` is the `SinkWake` boxed in the `TokenSink` that
+    // owns the stream, which outlives every signal from that stream.
+    unsafe { (*(user_data as *const SinkWake)).notify() }
+}
+
+#[cfg(target_os = "android")]
+struct TokenSink {
+    stream: *mut gpuf_stream,
+    wake: Box<SinkWake>,
+    closing: std::sync::atomic::AtomicBool,
+    generating: std::sync::atomic::AtomicBool,
+    /// Set when a generation starts, cleared once its end was delivered.
+    awaiting_finish: std::sync::atomic::AtomicBool,
+}
+
+// SAFETY: `gpuf_stream` is internally synchronized; the pointer is freed
+// only in `Drop`, after the last `Arc` is gone.
+#[cfg(target_os = "android")]
+unsafe impl Send for TokenSink {}
+#[cfg(target_os = "android")]
+unsafe impl Sync for TokenSink {}
+
+#[cfg(target_os = "android")]
+impl Drop for TokenSink {
+    fn drop(&mut self) {
+        gpuf_stream_free(self.stream);
+    }
+}
+
+#[cfg(target_os = "android")]
+static TOKEN_SINK: std::sync::Mutex<
+    Option<(std::sync::Arc<TokenSink>, std::thread::JoinHandle<()>)>,
+> = std::sync::Mutex::new(None);
+
+/// Body of the sink thread: attach once, then drain the stream into `text`
+/// and call `onTokens` each time the decode loop signals a batch.
+#[cfg(target_os = "android")]
+fn run_token_sink(
+    vm: JavaVM,
+    callback: GlobalRef,
+    sink: std::sync::Arc<TokenSink>,
+    text_capacity: usize,
+) {
+    let mut env = match vm.attach_current_thread_permanently() {
+        Ok(env) => env,
+        Err(e) => {
+            eprintln!("❌ JNI: Token sink failed to attach: {:?}", e);
+            return;
+        }
+    };
+
+    let on_tokens = match env
+        .get_object_class(callback.as_obj())
+        .and_then(|class| env.get_method_id(&class, "onTokens", "(Ljava/nio/ByteBuffer;IIZ)V"))
+    {
+        Ok(method) => method,
+        Err(e) => {
+            eprintln!(
+                "❌ JNI: Token sink has no onTokens(ByteBuffer, int, int, boolean): {:?}",
+                e
+            );
+            return;
+        }
+    };
+
+    let mut text = vec![0u8; text_capacity].into_boxed_slice();
+    let mut tokens = vec![0 as crate::LlamaToken; 256];
+    // SAFETY: `text` is owned by this thread and outlives the buffer object,
+    // which is only handed to Java during `onTokens` calls from this thread.
+    let text_buffer = match unsafe { env.new_direct_byte_buffer(text.as_mut_ptr(), text.len()) }
+        .and_then(|buffer| env.new_global_ref(buffer))
+    {
+        Ok(buffer) => buffer,
+        Err(e) => {
+            eprintln!("❌ JNI: Token sink failed to wrap its text buffer: {:?}", e);
+            return;
+        }
+    };
+
+    while !sink.closing.load(Ordering::Acquire) {
+        sink.wake.wait();
+        loop {
+            let mut text_len: c_int = 0;
+            let mut finished: c_int = 0;
+            let n_tokens = gpuf_stream_poll(
+                sink.stream,
+                tokens.as_mut_ptr(),
+                tokens.len() as c_int,
+                text.as_mut_ptr(),
+                text.len() as c_int,
+                &mut text_len,
+                &mut finished,
+            )
+            .max(0);
+            let last = finished != 0 && sink.awaiting_finish.swap(false, Ordering::AcqRel);
+            if !last && n_tokens == 0 && text_len == 0 {
+                break;
+            }
+
+            let args = [
+                jni::sys::jvalue {
+                    l: text_buffer.as_obj().as_raw(),
+                },
+                jni::sys::jvalue { i: text_len },
+                jni::sys::jvalue { i: n_tokens },
+                jni::sys::jvalue {
+                    z: last as jboolean,
+                },
+            ];
+            // SAFETY: `on_tokens` was resolved on the callback's class with
+            // the signature matching `args`.
+            let called = unsafe {
+                env.call_method_unchecked(
+                    callback.as_obj(),
+                    on_tokens,
+                    jni::signature::ReturnType::Primitive(jni::signature::Primitive::Void),
+                    &args,
+                )
+            };
+            if called.is_err() || env.exception_check().unwrap_or(false) {
+                let _ = env.exception_describe();
+                let _ = env.exception_clear();
+            }
+            if finished != 0 {
+                break;
+            }
+        }
+    }
+}
+
+/// Register the token sink used by `startGenerationDirect`
+///
+/// Java signature:
+/// public static native int registerTokenSink(Object sink, int textCapacity, int flushTokens, int flushMs);
+///
+/// `sink` must implement `void onTokens(ByteBuffer utf8, int length, int
+/// tokenCount, boolean finished)`. It is called on one native thread with
+/// the next `length` bytes of UTF-8 text (never split inside a character) at
+/// the start of a direct buffer that is reused for every call, so read them
+/// before returning. Batches are cut every `flushTokens` tokens or
+/// `flushMs` milliseconds (0 selects the defaults). Registering again
+/// replaces the previous sink.
+///
+/// Returns: 0 on success, -1 on JNI failure, -2 while a generation is running
+#[cfg(target_os = "android")]
+#[no_mangle]
+pub extern "C" fn Java_com_gpuf_c_GPUEngine_registerTokenSink(
+    env: JNIEnv,
+    _class: JClass,
+    sink: JObject,
+    text_capacity: jint,
+    flush_tokens: jint,
+    flush_ms: jint,
+) -> jint {
+    if sink.is_null() {
+        return -1;
+    }
+    let (vm, callback) = match (env.get_java_vm(), env.new_global_ref(&sink)) {
+        (Ok(vm), Ok(callback)) => (vm, callback),
+        _ => {
+            eprintln!("❌ JNI: Failed to retain token sink");
+            return -1;
+        }
+    };
+
+    let mut slot = TOKEN_SINK.lock().unwrap_or_else(|p| p.into_inner());
+    if let Some((current, _)) = slot.as_ref() {
+        if current.generating.load(Ordering::Acquire) {
+            return -2;
+        }
+    }
+    stop_token_sink(slot.take());
+
+    let text_capacity = if text_capacity > 0 {
+        text_capacity as usize
+    } else {
+        4096
+    };
+    let wake = Box::new(SinkWake {
+        pending: std::sync::Mutex::new(false),
+        ready: std::sync::Condvar::new(),
+    });
+    let stream = gpuf_stream_create(
+        0,
+        text_capacity as c_int,
+        flush_tokens,
+        flush_ms,
+        Some(token_sink_ready),
+        &*wake as *const SinkWake as *mut c_void,
+    );
+    let token_sink = std::sync::Arc::new(TokenSink {
+        stream,
+        wake,
+        closing: std::sync::atomic::AtomicBool::new(false),
+        generating: std::sync::atomic::AtomicBool::new(false),
+        awaiting_finish: std::sync::atomic::AtomicBool::new(false),
+    });
+
+    let thread_sink = token_sink.clone();
+    let handle = match std::thread::Builder::new()
+        .name("gpuf-token-sink".to_string())
+        .spawn(move || run_token_sink(vm, callback, thread_sink, text_capacity))
+    {
+        Ok(handle) => handle,
+        Err(e) => {
+            eprintln!("❌ JNI: Failed to start token sink thread: {:?}", e);
+            return -1;
+        }
+    };
+    *slot = Some((token_sink, handle));
+    0
+}
+
+#[cfg(target_os = "android")]
+fn stop_token_sink(sink: Option<(std::sync::Arc<TokenSink>, std::thread::JoinHandle<()>)>) {
+    if let Some((sink, handle)) = sink {
+        sink.closing.store(true, Ordering::Release);
+        sink.wake.notify();
+        let _ = handle.join();
+    }
+}
+
+/// Stop the token sink thread and release the Java sink
+///
+/// Java signature:
+/// public static native int unregisterTokenSink();
+///
+/// Returns: 0 on success, -2 while a generation is running
+#[cfg(target_os = "android")]
+#[no_mangle]
+pub extern "C" fn Java_com_gpuf_c_GPUEngine_unregisterTokenSink(
+    _env: JNIEnv,
+    _class: JClass,
+) -> jint {
+    let mut slot = TOKEN_SINK.lock().unwrap_or_else(|p| p.into_inner());
+    if let Some((current, _)) = slot.as_ref() {
+        if current.generating.load(Ordering::Acquire) {
+            return -2;
+        }
+    }
+    stop_token_sink(slot.take());
+    0
+}
+
+/// Generate into the registered token sink
+///
+/// Java signature:
+/// public static native int startGenerationDirect(long ctxPtr, ByteBuffer prompt, int promptLen, int maxTokens, float temperature, int topK, float topP, float repeatPenalty);
+///
+/// Blocks like `startGenerationAsync` while the sink thread delivers text in
+/// batches; the last `onTokens` call has `finished` set. Stop early with
+/// `stopGeneration`.
+///
+/// Returns: generated token count, -1 for an invalid context, no registered
+/// sink or a failed generation, -2 for an unusable prompt buffer, -3 while
+/// another generation uses the sink
+#[cfg(target_os = "android")]
+#[no_mangle]
+pub extern "C" fn Java_com_gpuf_c_GPUEngine_startGenerationDirect(
+    env: JNIEnv,
+    _class: JClass,
+    ctx_ptr: jlong,
+    prompt: JByteBuffer,
+    prompt_len: jint,
+    max_tokens: jint,
+    temperature: jfloat,
+    top_k: jint,
+    top_p: jfloat,
+    repeat_penalty: jfloat,
+) -> jint {
+    let ctx = ctx_ptr as *mut llama_context;
+    if ctx.is_null() {
+        return -1;
+    }
+    // Claim the sink while holding the slot lock, so register/unregister
+    // cannot swap it out between the lookup and the claim.
+    let sink = {
+        let slot = TOKEN_SINK.lock().unwrap_or_else(|p| p.into_inner());
+        let Some((sink, _)) = slot.as_ref() else {
+            eprintln!("❌ JNI: No token sink registered");
+            return -1;
+        };
+        if sink.generating.swap(true, Ordering::AcqRel) {
+            return -3;
+        }
+        sink.clone()
+    };
+    sink.awaiting_finish.store(true, Ordering::Release);
+
+    let result = with_direct_prompt(&env, &prompt, prompt_len, |prompt| {
+        gpuf_start_generation_stream(
+            ctx,
+            prompt,
+            max_tokens,
+            temperature,
+            top_k,
+            top_p,
+            repeat_penalty,
+            sink.stream,
+        )
+    })
+    .unwrap_or(-2);
+    sink.generating.store(false, Ordering::Release);
+    result
+}
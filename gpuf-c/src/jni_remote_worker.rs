@@ -18,9 +18,9 @@ use std::sync::Mutex;
 use std::sync::OnceLock;
 
 use crate::{
-    get_remote_worker_status, gpuf_validate_mobile_tls_policy, set_remote_worker_model,
-    start_remote_worker, start_remote_worker_tasks_with_callback_ptr, start_remote_worker_with_tls,
-    stop_remote_worker,
+    get_remote_worker_status, gpuf_validate_mobile_tls_policy, set_remote_worker_draft_model,
+    set_remote_worker_model, set_remote_worker_model_async, start_remote_worker,
+    start_remote_worker_tasks_with_callback_ptr, start_remote_worker_with_tls, stop_remote_worker,
 };
 
 #[cfg(target_os = "android")]
@@ -254,6 +254,79 @@ pub extern "C" fn Java_com_gpuf_c_RemoteWorker_setRemoteWorkerModel(
     result
 }
 
+/// Starts a background hot swap; progress is reported by gpuf_load_model_get_progress
+///
+/// Java signature:
+/// public static native int setRemoteWorkerModelAsync(String modelPath);
+///
+/// @param modelPath Path to the GGUF model file
+/// @return 0 if the swap started, negative on failure
+#[cfg(target_os = "android")]
+#[no_mangle]
+pub extern "C" fn Java_com_gpuf_c_RemoteWorker_setRemoteWorkerModelAsync(
+    mut env: JNIEnv,
+    _class: JClass,
+    model_path: JString,
+) -> jint {
+    let model_path_c = match env
+        .get_string(&model_path)
+        .ok()
+        .and_then(|s| s.to_str().ok().map(str::to_owned))
+        .and_then(|s| std::ffi::CString::new(s).ok())
+    {
+        Some(s) => s,
+        None => {
+            eprintln!("❌ JNI: Invalid model path");
+            return -1;
+        }
+    };
+
+    let result = set_remote_worker_model_async(model_path_c.as_ptr());
+    if result != 0 {
+        eprintln!("❌ JNI: Failed to start model swap (error: {})", result);
+    }
+    result
+}
+
+/// Configures the draft model used for speculative decoding
+///
+/// Java signature:
+/// public static native int setRemoteWorkerDraftModel(String draftPath, int nDraft);
+///
+/// @param draftPath Path to a small GGUF model sharing the served model's vocabulary, or null to disable
+/// @param nDraft Tokens proposed per round
+/// @return 0 on success, negative on failure
+#[cfg(target_os = "android")]
+#[no_mangle]
+pub extern "C" fn Java_com_gpuf_c_RemoteWorker_setRemoteWorkerDraftModel(
+    mut env: JNIEnv,
+    _class: JClass,
+    draft_path: JString,
+    n_draft: jint,
+) -> jint {
+    if draft_path.is_null() {
+        return set_remote_worker_draft_model(std::ptr::null(), n_draft);
+    }
+    let draft_path_c = match env
+        .get_string(&draft_path)
+        .ok()
+        .and_then(|s| s.to_str().ok().map(str::to_owned))
+        .and_then(|s| std::ffi::CString::new(s).ok())
+    {
+        Some(s) => s,
+        None => {
+            eprintln!("❌ JNI: Invalid draft model path");
+            return -1;
+        }
+    };
+
+    let result = set_remote_worker_draft_model(draft_path_c.as_ptr(), n_draft);
+    if result != 0 {
+        eprintln!("❌ JNI: Failed to set draft model (error: {})", result);
+    }
+    result
+}
+
 #[cfg(target_os = "android")]
 #[no_mangle]
 pub extern "C" fn Java_com_gpuf_c_RemoteWorker_registerCallbackEmitter(
@@ -17,7 +17,7 @@ use std::ffi::{c_char, c_int, c_void, CStr, CString};
 use std::io::Write;
 #[cfg(any(target_os = "android", target_os = "ios"))]
 use std::os::raw::c_ulonglong;
-use std::sync::atomic::{AtomicBool, AtomicI32, AtomicPtr, Ordering};
+use std::sync::atomic::{AtomicBool, AtomicI32, AtomicPtr, AtomicU32, Ordering};
 use std::sync::{Arc, Mutex};
 
 const DEFAULT_LLAMA_THREADS: i32 = 4;
@@ -85,11 +85,25 @@ static TOKIO_RUNTIME: Lazy<tokio::runtime::Runtime> = Lazy::new(|| {
 });
 
 // Export modules
+pub mod chat_prompt;
+pub mod context_options;
+pub mod embedding;
 #[cfg(not(target_os = "ios"))]
 pub mod handle;
+pub mod image_input;
 #[cfg(not(target_os = "ios"))]
 pub mod llm_engine;
+pub mod model_registry;
+pub mod perf;
+pub mod perf_profile;
+pub mod prefix_cache;
+pub mod sampler;
+pub mod session;
+pub mod speculative;
+pub mod token_stream;
 pub mod util;
+pub mod vision_cache;
+pub mod warm_start;
 
 // iOS builds don't compile the full `handle` module (it depends on llm_engine).
 // Expose worker runtime directly.
@@ -309,6 +323,19 @@ pub struct llama_sampler_chain_params {
     pub no_perf: bool,
 }
 
+/// `struct llama_sampler_i` for samplers implemented on our side. Newer
+/// llama.cpp appends optional callbacks, which `optional` leaves null.
+#[repr(C)]
+pub struct llama_sampler_i {
+    pub name: Option<unsafe extern "C" fn(*const llama_sampler) -> *const c_char>,
+    pub accept: Option<unsafe extern "C" fn(*mut llama_sampler, LlamaToken)>,
+    pub apply: Option<unsafe extern "C" fn(*mut llama_sampler, *mut llama_token_data_array)>,
+    pub reset: Option<unsafe extern "C" fn(*mut llama_sampler)>,
+    pub clone: Option<unsafe extern "C" fn(*const llama_sampler) -> *mut llama_sampler>,
+    pub free: Option<unsafe extern "C" fn(*mut llama_sampler)>,
+    pub optional: [usize; 4],
+}
+
 // ============================================================================
 // Global Engine State Management
 // ============================================================================
@@ -344,6 +371,20 @@ pub static MODEL_STATUS: Lazy<Arc<Mutex<ModelStatusInfo>>> =
 // Global inference mutex for thread safety
 pub static GLOBAL_INFERENCE_MUTEX: Lazy<Mutex<()>> = Lazy::new(|| Mutex::new(()));
 
+/// Inference tasks a worker runs at once, advertised in heartbeats. Tasks
+/// are serialized (see GLOBAL_INFERENCE_MUTEX), so the server queues the rest.
+pub const WORKER_TASK_SLOTS: u16 = 1;
+
+/// `CommandV2::ServerFeatures` bits of the current control connection,
+/// cleared when a login starts.
+pub static SERVER_FEATURES: AtomicU32 = AtomicU32::new(0);
+
+/// Whether the server decodes `CommandV2::WorkerStatus`; older servers drop
+/// the connection on it.
+pub fn server_accepts_worker_status() -> bool {
+    SERVER_FEATURES.load(Ordering::Acquire) & common::FEATURE_WORKER_STATUS != 0
+}
+
 // Global model and context pointers
 static GLOBAL_MODEL_PTR: AtomicPtr<llama_model> = AtomicPtr::new(std::ptr::null_mut());
 static GLOBAL_CONTEXT_PTR: AtomicPtr<llama_context> = AtomicPtr::new(std::ptr::null_mut());
@@ -380,6 +421,26 @@ impl ModelStatusInfo {
         self.error_message = None;
     }
 
+    /// A swap to `model_path` started; the current model stays advertised.
+    pub fn set_switching(&mut self, model_path: &str) {
+        if !self.is_loaded {
+            self.set_loading(model_path);
+            return;
+        }
+        self.loading_status = "Switching...".to_string();
+        self.error_message = None;
+    }
+
+    /// A swap failed; whatever model was serving before keeps serving.
+    pub fn set_switch_error(&mut self, error: &str) {
+        if !self.is_loaded {
+            self.set_error(error);
+            return;
+        }
+        self.loading_status = "Loaded".to_string();
+        self.error_message = Some(error.to_string());
+    }
+
     pub fn set_error(&mut self, error: &str) {
         self.loading_status = "Error".to_string();
         self.is_loaded = false;
@@ -458,6 +519,34 @@ extern "C" {
         new_n_past: *mut MtmdLlamaPos,
     ) -> c_int;
     fn mtmd_get_output_embd(ctx: *mut MtmdContext) -> *mut f32;
+    fn mtmd_input_chunks_size(chunks: *const MtmdInputChunks) -> usize;
+    fn mtmd_input_chunks_get(chunks: *const MtmdInputChunks, idx: usize) -> *const c_void;
+    fn mtmd_input_chunk_get_type(chunk: *const c_void) -> c_int;
+    fn mtmd_input_chunk_get_n_tokens(chunk: *const c_void) -> usize;
+    fn mtmd_input_chunk_get_tokens_text(
+        chunk: *const c_void,
+        n_tokens_output: *mut usize,
+    ) -> *const LlamaToken;
+    fn mtmd_helper_eval_chunk_single(
+        ctx: *mut MtmdContext,
+        lctx: *mut llama_context,
+        chunk: *const c_void,
+        n_past: MtmdLlamaPos,
+        seq_id: MtmdLlamaSeqId,
+        n_batch: c_int,
+        logits_last: bool,
+        new_n_past: *mut MtmdLlamaPos,
+    ) -> c_int;
+    fn mtmd_helper_decode_image_chunk(
+        ctx: *mut MtmdContext,
+        lctx: *mut llama_context,
+        chunk: *const c_void,
+        encoded_embd: *mut f32,
+        n_past: MtmdLlamaPos,
+        seq_id: MtmdLlamaSeqId,
+        n_batch: c_int,
+        new_n_past: *mut MtmdLlamaPos,
+    ) -> c_int;
 
     fn llama_sampler_init_top_k(k: c_int) -> *mut llama_sampler;
     fn llama_sampler_init_top_p(p: f32, min_keep: usize) -> *mut llama_sampler;
@@ -471,7 +560,10 @@ extern "C" {
         penalty_present: f32,
     ) -> *mut llama_sampler;
     fn llama_vocab_n_tokens(vocab: *const llama_vocab) -> c_int;
+    fn llama_vocab_type(vocab: *const llama_vocab) -> c_int;
     fn llama_n_batch(ctx: *mut llama_context) -> c_int;
+    fn llama_n_seq_max(ctx: *const llama_context) -> u32;
+    fn llama_set_n_threads(ctx: *mut llama_context, n_threads: i32, n_threads_batch: i32);
     fn llama_batch_init(n_tokens: c_int, embd: c_int, n_seq_max: c_int) -> llama_batch;
     fn llama_batch_free(batch: llama_batch);
     fn llama_batch_get_one(tokens: *mut LlamaToken, n_tokens: c_int) -> llama_batch;
@@ -479,7 +571,43 @@ extern "C" {
     // Memory/KV cache management (llama.rn style)
     fn llama_get_memory(ctx: *mut llama_context) -> *mut c_void;
     fn llama_memory_seq_rm(mem: *mut c_void, seq_id: c_int, p0: LlamaPos, p1: LlamaPos) -> bool;
+    fn llama_memory_seq_add(
+        mem: *mut c_void,
+        seq_id: c_int,
+        p0: LlamaPos,
+        p1: LlamaPos,
+        delta: LlamaPos,
+    );
+    fn llama_memory_can_shift(mem: *const c_void) -> bool;
     fn llama_memory_clear(mem: *mut c_void, data: bool);
+    fn llama_state_seq_get_size(ctx: *mut llama_context, seq_id: LlamaSeqId) -> usize;
+    fn llama_state_seq_get_data(
+        ctx: *mut llama_context,
+        dst: *mut u8,
+        size: usize,
+        seq_id: LlamaSeqId,
+    ) -> usize;
+    fn llama_state_seq_set_data(
+        ctx: *mut llama_context,
+        src: *const u8,
+        size: usize,
+        dest_seq_id: LlamaSeqId,
+    ) -> usize;
+    fn llama_state_seq_save_file(
+        ctx: *mut llama_context,
+        filepath: *const c_char,
+        seq_id: LlamaSeqId,
+        tokens: *const LlamaToken,
+        n_token_count: usize,
+    ) -> usize;
+    fn llama_state_seq_load_file(
+        ctx: *mut llama_context,
+        filepath: *const c_char,
+        dest_seq_id: LlamaSeqId,
+        tokens_out: *mut LlamaToken,
+        n_token_capacity: usize,
+        n_token_count_out: *mut usize,
+    ) -> usize;
 
     #[allow(non_upper_case_globals)]
     #[allow(improper_ctypes)]
@@ -492,15 +620,23 @@ extern "C" {
     ) -> LlamaToken;
     fn llama_sampler_free(sampler: *mut llama_sampler);
     fn llama_sampler_apply(sampler: *mut llama_sampler, candidates: *mut llama_token_data_array);
+    fn llama_sampler_init(iface: *const llama_sampler_i, ctx: *mut c_void) -> *mut llama_sampler;
+    fn llama_sampler_reset(sampler: *mut llama_sampler);
 
     // Utility functions
     fn llama_n_ctx(ctx: *const llama_context) -> c_int;
     fn llama_n_vocab(ctx: *mut llama_context) -> c_int;
     fn llama_token_bos(model: *const llama_model) -> LlamaToken;
+    fn llama_vocab_bos(vocab: *const llama_vocab) -> LlamaToken;
     fn llama_token_eos(model: *const llama_model) -> LlamaToken;
 
     // 🆕 Added missing functions for proper token decoding
     fn llama_model_get_vocab(model: *const llama_model) -> *const llama_vocab;
+    fn llama_model_size(model: *const llama_model) -> u64;
+    fn llama_model_n_layer(model: *const llama_model) -> i32;
+    fn llama_model_n_embd(model: *const llama_model) -> i32;
+    fn llama_model_n_head(model: *const llama_model) -> i32;
+    fn llama_model_n_head_kv(model: *const llama_model) -> i32;
     fn llama_token_to_piece(
         vocab: *const llama_vocab,
         token: LlamaToken,
@@ -515,6 +651,12 @@ extern "C" {
     fn llama_vocab_is_control(vocab: *const llama_vocab, token: LlamaToken) -> bool;
     fn llama_vocab_is_eog(vocab: *const llama_vocab, token: LlamaToken) -> bool;
     fn llama_get_logits(ctx: *mut llama_context) -> *const f32;
+    fn llama_get_logits_ith(ctx: *mut llama_context, i: c_int) -> *const f32;
+    fn llama_set_embeddings(ctx: *mut llama_context, embeddings: bool);
+    fn llama_get_embeddings_ith(ctx: *mut llama_context, i: c_int) -> *const f32;
+    fn llama_get_embeddings_seq(ctx: *mut llama_context, seq_id: LlamaSeqId) -> *const f32;
+    fn llama_pooling_type(ctx: *const llama_context) -> c_int;
+    fn llama_n_ubatch(ctx: *const llama_context) -> u32;
 
     // Memory management functions
     fn llama_model_free(model: *mut llama_model);
@@ -536,6 +678,12 @@ extern "C" {
         buf: *mut c_char,
         length: c_int,
     ) -> c_int;
+    fn llama_model_meta_val_str(
+        model: *const llama_model,
+        key: *const c_char,
+        buf: *mut c_char,
+        buf_size: usize,
+    ) -> c_int;
 }
 
 // ============================================================================
@@ -564,14 +712,21 @@ fn real_llama_model_load_from_file(
     path: *const c_char,
     params: llama_model_params,
 ) -> *mut llama_model {
+    let started = std::time::Instant::now();
     // SAFETY: `path` is supplied by the C API caller and must be a valid
     // NUL-terminated model path for the duration of this call.
-    unsafe { llama_load_model_from_file(path, params) }
+    let model = unsafe { llama_load_model_from_file(path, params) };
+    if !model.is_null() {
+        perf::record_model_load(started.elapsed());
+    }
+    model
 }
 
 #[cfg(any(target_os = "android", target_os = "ios"))]
 #[allow(dead_code)]
 fn real_llama_model_free(model: *mut llama_model) {
+    warm_start::forget_model(model);
+    chat_prompt::forget_model(model);
     // SAFETY: `model` must be a llama.cpp model pointer returned by this SDK.
     unsafe { llama_model_free(model) }
 }
@@ -588,6 +743,8 @@ fn real_llama_init_from_model(
 #[cfg(any(target_os = "android", target_os = "ios"))]
 #[allow(dead_code)]
 fn real_llama_free(ctx: *mut llama_context) {
+    prefix_cache::forget(ctx);
+    context_options::forget(ctx);
     // SAFETY: `ctx` must be a llama.cpp context pointer returned by this SDK.
     unsafe { llama_free(ctx) }
 }
@@ -847,6 +1004,8 @@ pub fn manual_llama_completion(
     unsafe {
         // DEBUG: Temporarily remove memory pool reset to test llama_tokenize
         // reset_pool();
+        let mut timer = perf::RequestTimer::start();
+        perf_profile::prepare(ctx);
 
         // Step 1: Use safe tokenization inspired by llama-cpp-rs
         let mut tokens = [0i32; 512]; // Static array, no allocation
@@ -894,23 +1053,27 @@ pub fn manual_llama_completion(
         }
 
         println!(" Using {} tokens for inference", token_count);
-
-        // Step 2: Clear KV cache for clean inference
-        let kv = llama_get_memory(ctx);
-        if !kv.is_null() {
-            // Clear all sequences from KV cache
-            let clear_result = llama_memory_seq_rm(kv, -1, -1, -1);
-            if clear_result {
-                println!(" KV cache cleared successfully");
-            } else {
-                println!(" KV cache clear failed, trying full clear...");
-                llama_memory_clear(kv, false);
-            }
-        }
+        timer.tokenized(token_count as usize);
+
+        // Step 2: Keep the prompt prefix already resident in sequence 0
+        // (other sequences belong to gpuf_session_* requests)
+        let Some(reused) = prefix_cache::prepare_sequence(ctx, &tokens[..token_count as usize])
+        else {
+            let msg = "KV sequence 0 could not be cleared";
+            let copy_len = std::cmp::min(msg.len(), output_len as usize - 1);
+            std::ptr::copy_nonoverlapping(msg.as_ptr(), output as *mut u8, copy_len);
+            *output.add(copy_len) = 0;
+            return copy_len as c_int;
+        };
+        let reused = reused as i32;
+        println!(
+            " KV prefix reuse: {} of {} prompt tokens",
+            reused, token_count
+        );
 
         // Step 3: Global position tracking for continuous context
-        // CRITICAL FIX: Reset position for new independent inference
-        let current_pos = 0; // Always start from 0 for clean inference
+        // Sequence positions always start from 0; reused tokens keep theirs
+        let current_pos = 0;
         GLOBAL_CONTEXT_POSITION.store(0, Ordering::SeqCst); // Reset global state
         println!(
             " GLOBAL CONTEXT: Reset to position {} for clean inference",
@@ -920,18 +1083,19 @@ pub fn manual_llama_completion(
         // Step 3: Create batch with global position tracking and logits request
         let mut batch_pos_array = [0i32; 512]; // Position array for batch
         let mut logits_array = [0i8; 512]; // Logits request array
+        let prefill_count = token_count - reused;
 
-        for i in 0..token_count {
-            batch_pos_array[i as usize] = current_pos + i;
+        for i in 0..prefill_count {
+            batch_pos_array[i as usize] = current_pos + reused + i;
             // Request logits for the last token only (for sampling)
-            logits_array[i as usize] = if i == token_count - 1 { 1 } else { 0 };
+            logits_array[i as usize] = if i == prefill_count - 1 { 1 } else { 0 };
         }
 
-        println!("🔍 Creating initial batch with {} tokens", token_count);
+        println!("🔍 Creating initial batch with {} tokens", prefill_count);
 
         let initial_batch = llama_batch {
-            n_tokens: token_count,
-            token: tokens.as_ptr() as *mut LlamaToken,
+            n_tokens: prefill_count,
+            token: tokens.as_ptr().add(reused as usize) as *mut LlamaToken,
             embd: std::ptr::null_mut(),
             pos: batch_pos_array.as_ptr() as *mut LlamaPos,
             n_seq_id: std::ptr::null_mut(),
@@ -943,8 +1107,8 @@ pub fn manual_llama_completion(
 
         println!(
             " Created batch with {} tokens, positions {} to {}",
-            token_count,
-            current_pos,
+            prefill_count,
+            current_pos + reused,
             current_pos + token_count - 1
         );
 
@@ -952,6 +1116,7 @@ pub fn manual_llama_completion(
         let decode_result = llama_decode(ctx, initial_batch);
         if decode_result != 0 {
             println!(" Initial decode failed with code {}", decode_result);
+            prefix_cache::forget(ctx);
             let msg = format!("Initial decode failed: code {}", decode_result);
             let msg_bytes = msg.as_bytes();
             let copy_len = std::cmp::min(msg_bytes.len(), output_len as usize - 1);
@@ -961,11 +1126,13 @@ pub fn manual_llama_completion(
         }
 
         println!(" Initial decode successful");
+        timer.prefilled(reused as usize);
 
         // Step 4: Generate tokens and update global position
         let mut generated_tokens = 0;
         let mut result_text = String::new();
         let mut next_pos = current_pos + token_count;
+        let mut decoded_tokens = tokens[..token_count as usize].to_vec();
 
         // Generate tokens with reasonable safety limits
         // Context window is now 4096, support much longer generation
@@ -984,154 +1151,130 @@ pub fn manual_llama_completion(
             temperature, top_k, top_p, repeat_penalty
         );
 
-        // Create sampler chain
-        let chain_params = llama_sampler_chain_params { no_perf: false };
-        let persistent_sampler = llama_sampler_chain_init(chain_params);
+        // Pooled sampler: penalties, top-k, top-p and temperature in one pass
+        let lease = sampler::acquire(sampler::SamplerParams::new(
+            temperature,
+            top_k,
+            top_p,
+            repeat_penalty,
+        ));
+        let persistent_sampler = lease.as_ptr();
 
         if persistent_sampler.is_null() {
             println!(" Failed to create persistent sampler chain");
             return 0;
         }
 
-        // Add samplers in proper order (like llama.cpp examples)
-
-        // 1. Repeat penalty sampler
-        if repeat_penalty != 1.0 {
-            let repeat_sampler = llama_sampler_init_penalties(-1, repeat_penalty, 0.0, 0.0);
-            if !repeat_sampler.is_null() {
-                llama_sampler_chain_add(persistent_sampler, repeat_sampler);
-                println!(
-                    " Added Repeat penalty sampler (penalty: {})",
-                    repeat_penalty
-                );
-            }
-        }
-
-        // 2. Top-K sampler
-        if top_k > 0 {
-            let top_k_sampler = llama_sampler_init_top_k(top_k);
-            if !top_k_sampler.is_null() {
-                llama_sampler_chain_add(persistent_sampler, top_k_sampler);
-                println!(" Added Top-K sampler (k: {})", top_k);
-            }
-        }
-
-        // 3. Top-P sampler
-        if top_p < 1.0 {
-            let top_p_sampler = llama_sampler_init_top_p(top_p, 1);
-            if !top_p_sampler.is_null() {
-                llama_sampler_chain_add(persistent_sampler, top_p_sampler);
-                println!(" Added Top-P sampler (p: {})", top_p);
-            }
-        }
-
-        // 4. Temperature sampler
-        if temperature > 0.0 {
-            let temp_sampler = llama_sampler_init_temp(temperature);
-            if !temp_sampler.is_null() {
-                llama_sampler_chain_add(persistent_sampler, temp_sampler);
-                println!(" Added Temperature sampler (temp: {})", temperature);
-            }
-        }
-
-        // 5. Distribution sampler (for actual sampling)
-        let dist_sampler = llama_sampler_init_dist(1234);
-        if !dist_sampler.is_null() {
-            llama_sampler_chain_add(persistent_sampler, dist_sampler);
-            println!(" Added Distribution sampler");
-        }
-
         println!(" Sampler chain configured with all parameters");
 
-        // Track current batch size (starts with initial token_count)
-        let mut current_batch_size = token_count;
-
-        for i in 0..safe_generation_limit {
-            // Step 1: Sample from the last decoded position
-            // After decode, logits are available at index (n_tokens - 1) for single token batches
-            // For initial batch, logits are at the last token position
-            let sampling_index = if i == 0 {
-                token_count - 1 // First iteration: sample from initial batch's last token
-            } else {
-                0 // Subsequent iterations: single token batch, logits at index 0
-            };
-
-            println!(
-                " Sampling iteration {}: from logits index {} (batch_size: {})",
-                i, sampling_index, current_batch_size
+        if let Some((draft, n_draft)) = speculative::draft_for(ctx) {
+            generated_tokens = speculative::generate(
+                ctx,
+                draft,
+                n_draft,
+                persistent_sampler,
+                &mut decoded_tokens,
+                safe_generation_limit,
+                &mut |token| {
+                    timer.token();
+                    result_text.push_str(&decode_token_to_text(model, token))
+                },
             );
+            next_pos = decoded_tokens.len() as i32;
+        } else {
+            // Track current batch size (starts with initial token_count)
+            let mut current_batch_size = token_count;
+
+            for i in 0..safe_generation_limit {
+                // Step 1: Sample from the last decoded position
+                // After decode, logits are available at index (n_tokens - 1) for single token batches
+                // For initial batch, logits are at the last token position
+                let sampling_index = if i == 0 {
+                    prefill_count - 1 // First iteration: sample from initial batch's last token
+                } else {
+                    0 // Subsequent iterations: single token batch, logits at index 0
+                };
 
-            // Use persistent sampler
-            let sampled_token = llama_sampler_sample(persistent_sampler, ctx, sampling_index);
+                println!(
+                    " Sampling iteration {}: from logits index {} (batch_size: {})",
+                    i, sampling_index, current_batch_size
+                );
 
-            println!(" Sampled token: {} at position {}", sampled_token, next_pos);
+                // Use persistent sampler
+                let sampled_token = sampler::sample(persistent_sampler, ctx, sampling_index);
+                timer.token();
 
-            // Check for EOS
-            if sampled_token == 2 {
-                // EOS token
-                println!(" Reached EOS token");
-                break;
-            }
+                println!(" Sampled token: {} at position {}", sampled_token, next_pos);
 
-            println!(
-                " Generated token {} at sequence position {} (temp:{}, top_k:{}, top_p:{})",
-                sampled_token, next_pos, temperature, top_k, top_p
-            );
+                // Check for EOS
+                if sampled_token == 2 {
+                    // EOS token
+                    println!(" Reached EOS token");
+                    break;
+                }
 
-            // Decode and add to result
-            let decoded_text = decode_token_to_text(model, sampled_token);
-            result_text.push_str(&decoded_text);
-            println!(" Token text redacted ({} bytes)", decoded_text.len());
+                println!(
+                    " Generated token {} at sequence position {} (temp:{}, top_k:{}, top_p:{})",
+                    sampled_token, next_pos, temperature, top_k, top_p
+                );
 
-            generated_tokens += 1;
-            next_pos += 1;
+                // Decode and add to result
+                let decoded_text = decode_token_to_text(model, sampled_token);
+                result_text.push_str(&decoded_text);
+                println!(" Token text redacted ({} bytes)", decoded_text.len());
 
-            // Step 2: CLEAR batch and add single new token (llama-cpp-rs style)
-            println!(
-                " Clearing batch and adding new token at position {}",
-                next_pos - 1
-            );
+                generated_tokens += 1;
+                next_pos += 1;
 
-            // Create new single token batch (exactly like llama-cpp-rs)
-            let mut single_token_pos = [0i32; 1];
-            let mut single_token_logits = [1i8; 1]; // Always request logits for single token
+                // Step 2: CLEAR batch and add single new token (llama-cpp-rs style)
+                println!(
+                    " Clearing batch and adding new token at position {}",
+                    next_pos - 1
+                );
 
-            single_token_pos[0] = next_pos - 1; // Current sequence position
-            single_token_logits[0] = 1; // Request logits
+                // Create new single token batch (exactly like llama-cpp-rs)
+                let mut single_token_pos = [0i32; 1];
+                let mut single_token_logits = [1i8; 1]; // Always request logits for single token
 
-            let new_batch = llama_batch {
-                n_tokens: 1,                                                     // Single token batch
-                token: (&sampled_token as *const LlamaToken) as *mut LlamaToken, // The new token
-                embd: std::ptr::null_mut(),
-                pos: single_token_pos.as_ptr() as *mut LlamaPos,
-                n_seq_id: std::ptr::null_mut(),
-                seq_id: std::ptr::null_mut(),
-                logits: single_token_logits.as_ptr() as *mut i8,
-            };
+                single_token_pos[0] = next_pos - 1; // Current sequence position
+                single_token_logits[0] = 1; // Request logits
 
-            // Step 3: Decode the new single token batch
-            let decode_result = llama_decode(ctx, new_batch);
-            if decode_result != 0 {
-                println!(" Decode failed at step {} with code {}", i, decode_result);
-                break;
-            }
+                let new_batch = llama_batch {
+                    n_tokens: 1,                                                     // Single token batch
+                    token: (&sampled_token as *const LlamaToken) as *mut LlamaToken, // The new token
+                    embd: std::ptr::null_mut(),
+                    pos: single_token_pos.as_ptr() as *mut LlamaPos,
+                    n_seq_id: std::ptr::null_mut(),
+                    seq_id: std::ptr::null_mut(),
+                    logits: single_token_logits.as_ptr() as *mut i8,
+                };
 
-            // Step 4: Update batch size for next iteration
-            current_batch_size = 1; // Now we have a single token batch
-            println!(
-                " Completed iteration {}, batch_size reset to {}, next_pos: {}",
-                i, current_batch_size, next_pos
-            );
+                // Step 3: Decode the new single token batch
+                let decode_result = llama_decode(ctx, new_batch);
+                if decode_result != 0 {
+                    println!(" Decode failed at step {} with code {}", i, decode_result);
+                    break;
+                }
+                decoded_tokens.push(sampled_token);
 
-            // Safety check
-            if generated_tokens >= max_tokens {
-                break;
+                // Step 4: Update batch size for next iteration
+                current_batch_size = 1; // Now we have a single token batch
+                println!(
+                    " Completed iteration {}, batch_size reset to {}, next_pos: {}",
+                    i, current_batch_size, next_pos
+                );
+
+                // Safety check
+                if generated_tokens >= max_tokens {
+                    break;
+                }
             }
         }
 
-        // Cleanup persistent sampler at the end
-        llama_sampler_free(persistent_sampler);
-        println!(" Cleaned up persistent sampler");
+        // Hand the sampler back to the pool
+        drop(lease);
+        prefix_cache::record_sequence(ctx, &decoded_tokens);
+        timer.finish(generated_tokens, decoded_tokens.len());
 
         GLOBAL_CONTEXT_POSITION.store(next_pos, Ordering::SeqCst);
         println!(
@@ -1449,17 +1592,10 @@ pub extern "C" fn gpuf_create_context(model: *mut llama_model) -> *mut llama_con
 
     println!("🔧 Creating context with correct llama.cpp parameters...");
 
-    // SAFETY: Retrieves llama.cpp default context parameters by value.
-    let mut params = unsafe { llama_context_default_params() };
-    params.n_ctx = 4096;
-    params.n_batch = 128;
-    params.n_threads = DEFAULT_LLAMA_THREADS;
-    params.n_threads_batch = DEFAULT_LLAMA_THREADS;
-    params.embeddings = false;
-    params.offload_kqv = false;
-
-    println!("📍 About to call real_llama_init_from_model...");
-    let result = real_llama_init_from_model(model, params);
+    // SAFETY: `model` was checked for null and is a live llama.cpp model.
+    let result = unsafe {
+        context_options::create(model, &context_options::gpuf_context_options::default())
+    };
     println!("✅ Context created: {:p}", result);
 
     result
@@ -1478,6 +1614,7 @@ pub struct AsyncLoadingState {
     pub status: i32,   // 0 = not started, 1 = loading, 2 = completed, 3 = error
     pub progress: f32, // Only meaningful when status = loading
     pub model_ptr: usize,
+    pub context_ptr: usize, // Warmed context, only when warm start is enabled
 }
 
 /// Start async model loading (realistic implementation)
@@ -1511,6 +1648,7 @@ pub extern "C" fn gpuf_load_model_async_start(path: *const c_char) -> bool {
             status: 1, // loading
             progress: 0.0,
             model_ptr: 0,
+            context_ptr: 0,
         });
     }
 
@@ -1532,6 +1670,22 @@ pub extern "C" fn gpuf_load_model_async_start(path: *const c_char) -> bool {
         let path_cstr = std::ffi::CString::new(path_str).unwrap();
         let model_ptr = gpuf_load_model(path_cstr.as_ptr());
 
+        // With warm start on, "ready" also covers the context and its
+        // restored system prompts.
+        let context_ptr = if !model_ptr.is_null() && warm_start::enabled() {
+            {
+                let mut state_guard = ASYNC_LOADING_STATE
+                    .lock()
+                    .unwrap_or_else(|poisoned| poisoned.into_inner());
+                if let Some(ref mut state) = *state_guard {
+                    state.progress = 0.7; // 70% - weights loaded, warming
+                }
+            }
+            gpuf_create_context(model_ptr)
+        } else {
+            std::ptr::null_mut()
+        };
+
         // Update final state based on real result
         {
             let mut state_guard = ASYNC_LOADING_STATE
@@ -1546,6 +1700,7 @@ pub extern "C" fn gpuf_load_model_async_start(path: *const c_char) -> bool {
                     state.status = 2; // completed
                     state.progress = 1.0;
                     state.model_ptr = model_ptr as usize;
+                    state.context_ptr = context_ptr as usize;
                 }
             }
         }
@@ -1639,6 +1794,20 @@ pub extern "C" fn gpuf_load_model_get_result() -> *mut llama_model {
         .unwrap_or(std::ptr::null_mut())
 }
 
+/// Get the context created and warmed by `gpuf_load_model_async_start`
+/// (only valid after completion with warm start enabled; null otherwise)
+#[no_mangle]
+pub extern "C" fn gpuf_load_model_get_context() -> *mut llama_context {
+    ASYNC_LOADING_STATE
+        .lock()
+        .unwrap_or_else(|poisoned| poisoned.into_inner())
+        .as_ref()
+        .filter(|state| state.status == 2)
+        .map_or(std::ptr::null_mut(), |state| {
+            state.context_ptr as *mut llama_context
+        })
+}
+
 /// Wait for loading to complete (blocking)
 #[no_mangle]
 #[cfg(target_os = "android")]
@@ -1890,6 +2059,12 @@ pub extern "C" fn gpuf_load_model(path: *const c_char) -> *mut llama_model {
     println!("📍 About to call real_llama_model_load_from_file...");
     let result = real_llama_model_load_from_file(path, params);
     println!("✅ real_llama_model_load_from_file returned: {:p}", result);
+    if !result.is_null() {
+        // SAFETY: `path` was checked for null and is a valid C string.
+        if let Ok(path) = unsafe { CStr::from_ptr(path) }.to_str() {
+            warm_start::note_model(result, path);
+        }
+    }
 
     result
 }
@@ -1984,6 +2159,7 @@ pub extern "C" fn gpuf_load_multimodal_model(
         let mtmd_ctx = mtmd_init_from_file(mmproj_cstr.as_ptr(), text_model, ctx_params);
         if mtmd_ctx.is_null() {
             eprintln!("❌ Failed to initialize libmtmd context");
+            chat_prompt::forget_model(text_model);
             llama_model_free(text_model);
             return std::ptr::null_mut();
         }
@@ -2203,8 +2379,9 @@ pub extern "C" fn gpuf_generate_multimodal(
 
                     // For multimodal models, the tokenization should have already prepared the context
                     // Let's check if we can proceed directly to generation
-                    // Always use mtmd_helper_eval_chunks to encode and get correct n_past position
-                    println!("🔍 Encoding multimodal input with mtmd_helper_eval_chunks...");
+                    // Always evaluate all chunks to encode and get correct n_past position
+                    println!("🔍 Encoding multimodal input with vision cache...");
+                    prefix_cache::forget(ctx);
                     println!("🔍 Before encoding - current_pos: {}", current_pos);
 
                     // Check context state before encoding
@@ -2215,18 +2392,21 @@ pub extern "C" fn gpuf_generate_multimodal(
                         pre_encode_n_ctx, pre_encode_vocab
                     );
 
-                    let encode_result = mtmd_helper_eval_chunks(
-                        mtmd_ctx,
+                    // Repeated images reuse their cached vision embeddings
+                    let encode_result = vision_cache::eval_chunks(
+                        multimodal_model,
                         ctx,
-                        chunks as *mut c_void,
+                        chunks,
+                        std::slice::from_raw_parts(image_data, image_size as usize),
                         current_pos,
                         0,    // seq_id
                         128,  // n_batch
                         true, // logits_last
+                        &[],  // nothing prefilled
                         &mut new_n_past,
                     );
 
-                    println!("🔍 mtmd_helper_eval_chunks result: {}", encode_result);
+                    println!("🔍 Multimodal eval result: {}", encode_result);
                     println!("🔍 New n_past: {} (was: {})", new_n_past, current_pos);
 
                     // Check context state after encoding
@@ -2268,10 +2448,7 @@ pub extern "C" fn gpuf_generate_multimodal(
 
                     if encode_result == 0 {
                         println!("✅ Multimodal encoding successful - proceeding with generation");
-                        println!(
-                            "🔍 Using position {} from mtmd_helper_eval_chunks",
-                            new_n_past
-                        );
+                        println!("🔍 Using position {} from multimodal eval", new_n_past);
 
                         // Always use direct vocab pointer approach for consistency
                         // This avoids issues with llama_n_vocab(ctx) returning 0 after multimodal encoding
@@ -2535,16 +2712,25 @@ pub extern "C" fn gpuf_generate_multimodal_stream(
             return -1;
         }
 
-        // Encode with mtmd_helper_eval_chunks
+        // Encode the chunks, reusing cached vision embeddings of a repeated
+        // image; this rewrites sequence 0
+        prefix_cache::forget(ctx);
+        let image_bytes: &[u8] = if !image_data.is_null() && image_size > 0 {
+            std::slice::from_raw_parts(image_data, image_size as usize)
+        } else {
+            &[]
+        };
         let mut new_n_past: MtmdLlamaPos = 0;
-        let encode_result = mtmd_helper_eval_chunks(
-            mtmd_ctx,
+        let encode_result = vision_cache::eval_chunks(
+            multimodal_model,
             ctx,
-            chunks as *mut c_void,
+            chunks,
+            image_bytes,
             0,
             0,
             128,
             true,
+            &[],
             &mut new_n_past,
         );
 
@@ -2582,22 +2768,14 @@ pub extern "C" fn gpuf_generate_multimodal_stream(
         println!("🔍 Starting inline streaming generation...");
 
         let generated_text = {
-            // Initialize samplers
-            let temp_sampler = llama_sampler_init_temp(temperature);
-            let top_k_sampler = llama_sampler_init_top_k(top_k);
-            let top_p_sampler = llama_sampler_init_top_p(top_p, 1);
-            let repeat_sampler = llama_sampler_init_penalties(-1, repeat_penalty, 0.0, 0.0);
-            let dist_sampler = llama_sampler_init_dist(1234);
-
-            // Chain samplers
-            let chain_params = llama_sampler_chain_params { no_perf: false };
-            let sampler = llama_sampler_chain_init(chain_params);
-
-            llama_sampler_chain_add(sampler, temp_sampler);
-            llama_sampler_chain_add(sampler, top_k_sampler);
-            llama_sampler_chain_add(sampler, top_p_sampler);
-            llama_sampler_chain_add(sampler, repeat_sampler);
-            llama_sampler_chain_add(sampler, dist_sampler);
+            // Pooled sampler for these parameters
+            let lease = sampler::acquire(sampler::SamplerParams::new(
+                temperature,
+                top_k,
+                top_p,
+                repeat_penalty,
+            ));
+            let sampler = lease.as_ptr();
 
             let n_ctx = llama_n_ctx(ctx);
             let _vocab_size = llama_vocab_n_tokens(vocab);
@@ -2613,7 +2791,7 @@ pub extern "C" fn gpuf_generate_multimodal_stream(
                     break;
                 }
 
-                let new_token_id = llama_sampler_sample(sampler, ctx, -1);
+                let new_token_id = sampler::sample(sampler, ctx, -1);
 
                 // Check EOS using vocab
                 if llama_vocab_is_eog(vocab, new_token_id) {
@@ -2668,7 +2846,7 @@ pub extern "C" fn gpuf_generate_multimodal_stream(
                 generated_count += 1;
             }
 
-            llama_sampler_free(sampler);
+            drop(lease);
             println!("✅ Generated {} tokens", generated_count);
 
             generated_text
@@ -2715,8 +2893,10 @@ pub extern "C" fn gpuf_free_multimodal_model(multimodal_model: *mut gpuf_multimo
         // SAFETY: Ownership of `multimodal_model` is transferred back from the
         // C caller exactly once; nested llama.cpp/libmtmd pointers are checked.
         unsafe {
+            vision_cache::forget_model(multimodal_model);
             let model = Box::from_raw(multimodal_model);
             if !model.text_model.is_null() {
+                chat_prompt::forget_model(model.text_model);
                 llama_model_free(model.text_model);
             }
             if !model.mtmd_context.is_null() {
@@ -2902,32 +3082,19 @@ fn generate_multimodal_response_with_vocab(
 
     // SAFETY: `ctx` was checked for null above and must be a live llama.cpp
     // context. Sampler pointers are checked before use where ownership matters.
-    let temp_sampler = unsafe { llama_sampler_init_temp(temperature) };
-    let top_k_sampler = unsafe { llama_sampler_init_top_k(top_k) };
-    let top_p_sampler = unsafe { llama_sampler_init_top_p(top_p, 1) };
-    let repeat_sampler = unsafe { llama_sampler_init_penalties(-1, repeat_penalty, 0.0, 0.0) };
-    let dist_sampler = unsafe { llama_sampler_init_dist(1234) }; // Fixed seed for reproducibility
-
-    // Chain samplers together
-    let chain_params = llama_sampler_chain_params { no_perf: false };
-    let sampler = unsafe { llama_sampler_chain_init(chain_params) };
-
-    // SAFETY: `sampler` is a newly created sampler chain; sampler components are
-    // handed to llama.cpp chain ownership exactly once.
-    unsafe {
-        llama_sampler_chain_add(sampler, temp_sampler);
-        llama_sampler_chain_add(sampler, top_k_sampler);
-        llama_sampler_chain_add(sampler, top_p_sampler);
-        llama_sampler_chain_add(sampler, repeat_sampler);
-        llama_sampler_chain_add(sampler, dist_sampler);
-    }
+    // Pooled sampler; the lease returns it to the pool on every exit path
+    let lease = sampler::acquire(sampler::SamplerParams::new(
+        temperature,
+        top_k,
+        top_p,
+        repeat_penalty,
+    ));
+    let sampler = lease.as_ptr();
 
     // Get model and vocab at function start (only once, like llama.rn)
     // SAFETY: `ctx` is a non-null live llama.cpp context for this generation.
     let model = unsafe { llama_get_model(ctx) };
     if model.is_null() {
-        // SAFETY: `sampler` is owned by this function and has not been freed yet.
-        unsafe { llama_sampler_free(sampler) };
         return "❌ Model is null".to_string();
     }
 
@@ -2939,8 +3106,6 @@ fn generate_multimodal_response_with_vocab(
     };
 
     if vocab.is_null() {
-        // SAFETY: `sampler` is owned by this function and has not been freed yet.
-        unsafe { llama_sampler_free(sampler) };
         return "❌ Vocab is null".to_string();
     }
 
@@ -2958,8 +3123,6 @@ fn generate_multimodal_response_with_vocab(
     // Validate vocab
     if vocab_size == 0 {
         println!("❌ CRITICAL: Vocab size is 0 - vocab is not properly initialized!");
-        // SAFETY: `sampler` is owned by this function and has not been freed yet.
-        unsafe { llama_sampler_free(sampler) };
         return "❌ Vocab initialization failed - vocab size is 0".to_string();
     }
 
@@ -3019,7 +3182,7 @@ fn generate_multimodal_response_with_vocab(
 
         // 🆕 Follow llama.cpp official pattern: use llama_sampler_sample with index -1 (last position)
         // SAFETY: `sampler` and `ctx` are live for this generation loop.
-        let token = unsafe { llama_sampler_sample(sampler, ctx, -1) }; // 🆕 Use -1 for last position logits like llama.cpp
+        let token = unsafe { sampler::sample(sampler, ctx, -1) }; // 🆕 Use -1 for last position logits like llama.cpp
         println!("🔍 Sampled token: {} (0x{:x})", token, token);
 
         // Check token validity
@@ -3120,8 +3283,7 @@ fn generate_multimodal_response_with_vocab(
         }
     }
 
-    // SAFETY: `sampler` is owned by this function and has not been freed yet.
-    unsafe { llama_sampler_free(sampler) };
+    drop(lease);
 
     println!("\n✅ Real generation completed: {} tokens", generated_count);
 
@@ -3155,43 +3317,25 @@ fn generate_multimodal_response_with_callbacks(
     unsafe {
         println!("🔍 Initializing samplers...");
 
-        // Initialize samplers (same as original function)
-        let temp_sampler = llama_sampler_init_temp(temperature);
-        println!("🔍 temp_sampler: {:p}", temp_sampler);
-
-        let top_k_sampler = llama_sampler_init_top_k(top_k);
-        println!("🔍 top_k_sampler: {:p}", top_k_sampler);
-
-        let top_p_sampler = llama_sampler_init_top_p(top_p, 1);
-        println!("🔍 top_p_sampler: {:p}", top_p_sampler);
-
-        let repeat_sampler = llama_sampler_init_penalties(-1, repeat_penalty, 0.0, 0.0);
-        println!("🔍 repeat_sampler: {:p}", repeat_sampler);
-
-        let dist_sampler = llama_sampler_init_dist(1234);
-        println!("🔍 dist_sampler: {:p}", dist_sampler);
-
-        // Chain samplers together
-        let chain_params = llama_sampler_chain_params { no_perf: false };
-        let sampler = llama_sampler_chain_init(chain_params);
-        println!("🔍 sampler chain: {:p}", sampler);
+        // Pooled sampler (same parameters as the original function)
+        let lease = sampler::acquire(sampler::SamplerParams::new(
+            temperature,
+            top_k,
+            top_p,
+            repeat_penalty,
+        ));
+        let sampler = lease.as_ptr();
+        println!("🔍 sampler: {:p}", sampler);
 
         if sampler.is_null() {
             return "❌ Failed to create sampler chain".to_string();
         }
 
-        llama_sampler_chain_add(sampler, temp_sampler);
-        llama_sampler_chain_add(sampler, top_k_sampler);
-        llama_sampler_chain_add(sampler, top_p_sampler);
-        llama_sampler_chain_add(sampler, repeat_sampler);
-        llama_sampler_chain_add(sampler, dist_sampler);
-
         let n_ctx = llama_n_ctx(ctx);
         let vocab_size = llama_vocab_n_tokens(direct_vocab);
         println!("🔍 n_ctx: {}, vocab_size: {}", n_ctx, vocab_size);
 
         if vocab_size == 0 {
-            llama_sampler_free(sampler);
             return "❌ Vocab initialization failed".to_string();
         }
 
@@ -3213,7 +3357,7 @@ fn generate_multimodal_response_with_callbacks(
             }
 
             // Sample next token
-            let new_token_id = llama_sampler_sample(sampler, ctx, -1);
+            let new_token_id = sampler::sample(sampler, ctx, -1);
 
             // Check for EOS (use model's vocab to get EOS token)
             let model = llama_get_model(ctx);
@@ -3276,7 +3420,7 @@ fn generate_multimodal_response_with_callbacks(
             generated_count += 1;
         }
 
-        llama_sampler_free(sampler);
+        drop(lease);
         println!(
             "✅ Streaming generation completed: {} tokens",
             generated_count
@@ -3666,7 +3810,117 @@ pub extern "C" fn gpuf_start_generation_async(
         println!("❌ Invalid context or prompt for async generation");
         return -1;
     }
+    let lease = sampler::acquire(sampler::SamplerParams::new(
+        temperature,
+        top_k,
+        top_p,
+        repeat_penalty,
+    ));
+    if lease.as_ptr().is_null() {
+        return -1;
+    }
+    generate_with_callback(
+        ctx,
+        prompt,
+        max_tokens,
+        lease.as_ptr(),
+        on_token_callback,
+        user_data,
+    )
+}
+
+/// Like `gpuf_start_generation_async`, but sample with `sampler` from
+/// `gpuf_sampler_create` instead of per-call parameters. The sampler keeps
+/// its penalty window and random state across calls.
+///
+/// # Safety
+/// `sampler` must be live and not used by another request at the same time.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub unsafe extern "C" fn gpuf_start_generation_with_sampler(
+    ctx: *mut llama_context,
+    prompt: *const c_char,
+    max_tokens: c_int,
+    sampler: *mut llama_sampler,
+    on_token_callback: Option<extern "C" fn(*const c_char, *mut c_void)>,
+    user_data: *mut c_void,
+) -> c_int {
+    if ctx.is_null() || prompt.is_null() || sampler.is_null() {
+        println!("❌ Invalid context, prompt or sampler for async generation");
+        return -1;
+    }
+    generate_with_callback(
+        ctx,
+        prompt,
+        max_tokens,
+        sampler,
+        on_token_callback,
+        user_data,
+    )
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub unsafe extern "C" fn gpuf_start_generation_with_sampler(
+    _ctx: *mut llama_context,
+    _prompt: *const c_char,
+    _max_tokens: c_int,
+    _sampler: *mut llama_sampler,
+    _on_token_callback: Option<extern "C" fn(*const c_char, *mut c_void)>,
+    _user_data: *mut c_void,
+) -> c_int {
+    -1
+}
+
+/// Run `generate_streaming` and hand complete UTF-8 text to the callback.
+#[cfg(any(target_os = "android", target_os = "ios"))]
+fn generate_with_callback(
+    ctx: *mut llama_context,
+    prompt: *const c_char,
+    max_tokens: c_int,
+    sampler: *mut llama_sampler,
+    on_token_callback: Option<extern "C" fn(*const c_char, *mut c_void)>,
+    user_data: *mut c_void,
+) -> c_int {
+    let deliver = |text: &str| {
+        if text.is_empty() {
+            return;
+        }
+        if let Some(callback) = on_token_callback {
+            match std::ffi::CString::new(text) {
+                Ok(token_cstr) => callback(token_cstr.as_ptr(), user_data),
+                Err(_) => println!("⚠️ Token callback skipped - CString conversion failed"),
+            }
+        } else {
+            println!(
+                "🔍 No callback - token text redacted ({} bytes)",
+                text.len()
+            );
+        }
+    };
+
+    let mut utf8_buf = Utf8EmitBuffer::new();
+    let completion_tokens =
+        generate_streaming(ctx, prompt, max_tokens, sampler, &mut |_token, piece| {
+            deliver(&utf8_buf.push_and_take_valid(piece))
+        });
 
+    // Flush any remaining buffered bytes (best-effort)
+    deliver(&utf8_buf.flush_lossy());
+    completion_tokens
+}
+
+/// Shared decode loop of the streaming entry points. `sampler` must be live
+/// and unused by other threads for the whole call. `emit` receives every
+/// sampled token with its raw piece bytes, which may end mid UTF-8 sequence.
+#[cfg(any(target_os = "android", target_os = "ios"))]
+fn generate_streaming(
+    ctx: *mut llama_context,
+    prompt: *const c_char,
+    max_tokens: c_int,
+    sampler: *mut llama_sampler,
+    emit: &mut dyn FnMut(LlamaToken, &[u8]),
+) -> c_int {
     // Initialize generation control
     init_generation_control();
     set_generation_stop(false);
@@ -3675,25 +3929,17 @@ pub extern "C" fn gpuf_start_generation_async(
 
     // For now, use synchronous generation with callbacks
     // This avoids thread safety issues while providing streaming
-    // SAFETY: `ctx` and `prompt` were checked for null above and must remain
+    // SAFETY: Callers check `ctx` and `prompt` for null; both must remain
     // valid for the duration of this synchronous call. Local token, logits,
-    // and position buffers outlive each llama.cpp decode call. Callback C
-    // strings are invoked only while their temporary CString storage is alive.
+    // and position buffers outlive each llama.cpp decode call.
     unsafe {
         // Get prompt string
         let prompt_str = std::ffi::CStr::from_ptr(prompt).to_str().unwrap_or("");
 
         // Reset memory pool
         reset_pool();
-
-        // Clear KV cache for sequence 0 (remove all positions)
-        let kv = llama_get_memory(ctx);
-        let clear_result = llama_memory_seq_rm(kv, 0, -1, -1);
-        if !clear_result {
-            println!("⚠️ llama_memory_seq_rm failed, trying full clear...");
-            llama_memory_clear(kv, false);
-        }
-        println!("✅ KV cache cleared for clean generation");
+        let mut timer = perf::RequestTimer::start();
+        let limits = perf_profile::prepare(ctx);
 
         // Tokenize prompt using real llama.cpp tokenizer
         let model = llama_get_model(ctx);
@@ -3708,29 +3954,9 @@ pub extern "C" fn gpuf_start_generation_async(
             return -1;
         }
 
-        let mut tokens: Vec<i32> = vec![0; 512];
-        let mut token_count = llama_tokenize(
-            vocab,
-            prompt,
-            prompt_str.len() as c_int,
-            tokens.as_mut_ptr(),
-            tokens.len() as c_int,
-            true,
-            true,
-        );
-        if token_count < 0 {
-            let needed = (-token_count) as usize;
-            tokens = vec![0; needed.max(1)];
-            token_count = llama_tokenize(
-                vocab,
-                prompt,
-                prompt_str.len() as c_int,
-                tokens.as_mut_ptr(),
-                tokens.len() as c_int,
-                true,
-                true,
-            );
-        }
+        // Only the text appended since a cached prompt is tokenized
+        let mut tokens = chat_prompt::tokenize_prompt(vocab, prompt_str);
+        let mut token_count = tokens.len() as c_int;
 
         println!("🔍 After tokenization: token_count={}", token_count);
 
@@ -3739,14 +3965,39 @@ pub extern "C" fn gpuf_start_generation_async(
             return -1;
         }
 
+        // With context shift an oversized prompt keeps its head and tail,
+        // leaving room for part of the reply
+        let n_ctx = llama_n_ctx(ctx) as i32;
+        let n_keep = context_options::keep_for(ctx, vocab, prompt_str, &tokens);
+        if let Some(n_keep) = n_keep {
+            let room = n_ctx - max_tokens.clamp(1, (n_ctx / 4).max(1));
+            let dropped = context_options::fit_prompt(&mut tokens, n_keep, room.max(1) as usize);
+            if dropped > 0 {
+                println!(
+                    "🔄 Prompt exceeds the context: dropped {} tokens after the first {}",
+                    dropped, n_keep
+                );
+                token_count = tokens.len() as c_int;
+            }
+        }
+        timer.tokenized(tokens.len());
+
+        // Keep the prefix already resident in sequence 0 and drop the rest
+        let Some(reused) = prefix_cache::prepare_sequence(ctx, &tokens) else {
+            println!("🔍 Early return: KV sequence 0 could not be cleared");
+            return -1;
+        };
+        let reused = reused as i32;
+        println!(
+            "✅ KV prefix reuse: {} of {} prompt tokens",
+            reused, token_count
+        );
+
         // Prefill prompt in chunks to respect ctx n_batch (llama.cpp asserts otherwise)
+        // and the perf profile's chunk size
         let n_batch = {
             let nb = llama_n_batch(ctx);
-            if nb > 0 {
-                nb
-            } else {
-                128
-            }
+            limits.prefill_chunk(if nb > 0 { nb } else { 128 })
         };
 
         println!(
@@ -3754,11 +4005,11 @@ pub extern "C" fn gpuf_start_generation_async(
             token_count, n_batch
         );
 
-        let mut batch_pos_array = [0i32; 512];
-        let mut logits_array = [0i8; 512];
+        let mut batch_pos_array = vec![0i32; n_batch as usize];
+        let mut logits_array = vec![0i8; n_batch as usize];
 
-        let mut n_past: i32 = 0;
-        let mut start: i32 = 0;
+        let mut n_past: i32 = reused;
+        let mut start: i32 = reused;
         while start < token_count {
             let end = std::cmp::min(start + n_batch, token_count);
             let n = end - start;
@@ -3790,63 +4041,30 @@ pub extern "C" fn gpuf_start_generation_async(
             let decode_result = llama_decode(ctx, batch);
             if decode_result != 0 {
                 println!("🔍 Early return due to decode failure: {}", decode_result);
+                prefix_cache::forget(ctx);
                 return -1;
             }
             n_past += n;
             start = end;
         }
+        timer.prefilled(reused as usize);
+        let mut decoded_tokens = tokens;
 
         println!("🔍 Model and vocab ready, starting generation loop...");
 
-        // Initialize sampler
-        let temp_sampler = llama_sampler_init_temp(temperature);
-        let top_k_sampler = llama_sampler_init_top_k(top_k);
-        let top_p_sampler = llama_sampler_init_top_p(top_p, 1);
-        let repeat_sampler = llama_sampler_init_penalties(-1, repeat_penalty, 0.0, 0.0);
-        let dist_sampler = llama_sampler_init_dist(1234);
-
-        let chain_params = llama_sampler_chain_params { no_perf: false };
-        let sampler = llama_sampler_chain_init(chain_params);
-
-        llama_sampler_chain_add(sampler, temp_sampler);
-        llama_sampler_chain_add(sampler, top_k_sampler);
-        llama_sampler_chain_add(sampler, top_p_sampler);
-        llama_sampler_chain_add(sampler, repeat_sampler);
-        llama_sampler_chain_add(sampler, dist_sampler);
-
-        // Generate tokens with streaming callbacks
-        let n_ctx = llama_n_ctx(ctx) as i32;
-        let context_available = n_ctx - n_past;
+        // Generate tokens with streaming callbacks; a shifting context
+        // never runs out of room
+        let context_available = if n_keep.is_some() {
+            max_tokens
+        } else {
+            n_ctx - n_past
+        };
         let safe_generation_limit = std::cmp::min(max_tokens, context_available);
         let mut next_pos = n_past;
-        let mut utf8_buf = Utf8EmitBuffer::new();
-
-        let mut completion_tokens: c_int = 0;
-        for _i in 0..safe_generation_limit {
-            // Check for stop signal
-            if should_stop_generation() {
-                println!("⏹️ Generation stopped by user");
-                break;
-            }
-
-            // Sample next token using llama.cpp sampler
-            let sampled_token = llama_sampler_sample(sampler, ctx, -1);
-
-            println!(
-                "🔍 Sampled token: {} (EOS: {})",
-                sampled_token,
-                llama_vocab_is_eog(vocab, sampled_token)
-            );
-
-            // Check EOS
-            if llama_vocab_is_eog(vocab, sampled_token) {
-                println!("🔍 EOS token detected, stopping generation");
-                break;
-            }
-
-            completion_tokens = completion_tokens.saturating_add(1);
 
-            // Convert token to text
+        // Convert each sampled token to text and hand it to `emit`
+        let mut emit_piece = |sampled_token: LlamaToken| {
+            timer.token();
             let mut token_buf = [0u8; 32];
             let token_len = llama_token_to_piece(
                 vocab,
@@ -3867,39 +4085,14 @@ pub extern "C" fn gpuf_start_generation_async(
                 let piece_len = raw_len.min(token_buf.len());
                 if raw_len > token_buf.len() {
                     println!(
-                        "⚠️ Token piece truncated for UTF-8 buffering (reported {} bytes, buffer {} bytes)",
-                        raw_len,
-                        token_buf.len()
-                    );
-                }
-
-                let emitted = utf8_buf.push_and_take_valid(&token_buf[..piece_len]);
-                println!(
-                    "🔍 Token content redacted (emitted {} bytes, raw {} bytes)",
-                    emitted.len(),
-                    raw_len
-                );
-
-                // Call callback only if it's not None
-                if !emitted.is_empty() {
-                    if let Some(callback) = on_token_callback {
-                        println!("🔍 Calling callback with token...");
-                        match std::ffi::CString::new(emitted.as_str()) {
-                            Ok(token_cstr) => {
-                                callback(token_cstr.as_ptr(), user_data);
-                                println!("🔍 Callback completed");
-                            }
-                            Err(_) => {
-                                println!("⚠️ Token callback skipped - CString conversion failed");
-                            }
-                        }
-                    } else {
-                        println!(
-                            "🔍 No callback - token text redacted ({} bytes)",
-                            emitted.len()
+                            "⚠️ Token piece truncated for UTF-8 buffering (reported {} bytes, buffer {} bytes)",
+                            raw_len,
+                            token_buf.len()
                         );
-                    }
                 }
+
+                println!("🔍 Token content redacted (raw {} bytes)", raw_len);
+                emit(sampled_token, &token_buf[..piece_len]);
             } else if token_len < 0 {
                 println!(
                     "⚠️ Token piece did not fit buffer (needed {} bytes)",
@@ -3908,40 +4101,81 @@ pub extern "C" fn gpuf_start_generation_async(
             } else {
                 println!("🔍 Empty token skipped");
             }
+        };
 
-            // Create single token batch
-            let single_token_batch = llama_batch {
-                n_tokens: 1,
-                token: (&sampled_token as *const LlamaToken) as *mut LlamaToken,
-                embd: std::ptr::null_mut(),
-                pos: (&next_pos as *const LlamaPos) as *mut LlamaPos,
-                n_seq_id: std::ptr::null_mut(),
-                seq_id: std::ptr::null_mut(),
-                logits: std::ptr::null_mut(),
-            };
+        let mut completion_tokens: c_int = 0;
+        if let Some((draft, n_draft)) = speculative::draft_for(ctx) {
+            // Speculative rounds stop at the end of the context
+            completion_tokens = speculative::generate(
+                ctx,
+                draft,
+                n_draft,
+                sampler,
+                &mut decoded_tokens,
+                safe_generation_limit,
+                &mut emit_piece,
+            );
+        } else {
+            for _i in 0..safe_generation_limit {
+                // Check for stop signal
+                if should_stop_generation() {
+                    println!("⏹️ Generation stopped by user");
+                    break;
+                }
 
-            // Decode token
-            if llama_decode(ctx, single_token_batch) != 0 {
-                break;
-            }
+                // Sample next token from the last position's logits
+                let sampled_token = sampler::sample(sampler, ctx, -1);
 
-            next_pos += 1;
-        }
+                println!(
+                    "🔍 Sampled token: {} (EOS: {})",
+                    sampled_token,
+                    llama_vocab_is_eog(vocab, sampled_token)
+                );
 
-        // Cleanup sampler
-        llama_sampler_free(sampler);
+                // Check EOS
+                if llama_vocab_is_eog(vocab, sampled_token) {
+                    println!("🔍 EOS token detected, stopping generation");
+                    break;
+                }
 
-        // Flush any remaining buffered bytes (best-effort)
-        let tail = utf8_buf.flush_lossy();
+                completion_tokens = completion_tokens.saturating_add(1);
 
-        if !tail.is_empty() {
-            if let Some(callback) = on_token_callback {
-                if let Ok(token_cstr) = std::ffi::CString::new(tail.as_str()) {
-                    callback(token_cstr.as_ptr(), user_data);
+                emit_piece(sampled_token);
+
+                if next_pos >= n_ctx {
+                    let shifted = n_keep.is_some_and(|n_keep| {
+                        context_options::shift(ctx, n_keep, &mut decoded_tokens)
+                    });
+                    if !shifted {
+                        break;
+                    }
+                    next_pos = decoded_tokens.len() as i32;
                 }
+
+                // Create single token batch
+                let single_token_batch = llama_batch {
+                    n_tokens: 1,
+                    token: (&sampled_token as *const LlamaToken) as *mut LlamaToken,
+                    embd: std::ptr::null_mut(),
+                    pos: (&next_pos as *const LlamaPos) as *mut LlamaPos,
+                    n_seq_id: std::ptr::null_mut(),
+                    seq_id: std::ptr::null_mut(),
+                    logits: std::ptr::null_mut(),
+                };
+
+                // Decode token
+                if llama_decode(ctx, single_token_batch) != 0 {
+                    break;
+                }
+
+                decoded_tokens.push(sampled_token);
+                next_pos += 1;
             }
         }
 
+        prefix_cache::record_sequence(ctx, &decoded_tokens);
+        timer.finish(completion_tokens, decoded_tokens.len());
+
         // Cleanup
         cleanup_generation_control();
         println!(
@@ -4143,7 +4377,7 @@ pub extern "C" fn start_remote_worker(
     worker_type: *const c_char,
     client_id: *const c_char,
 ) -> c_int {
-    use crate::util::cmd::{Args, EngineType, LlamaSplitModeArg, WorkerType};
+    use crate::util::cmd::{Args, EngineType, GpuPlacementArg, LlamaSplitModeArg, WorkerType};
 
     println!("🔥 GPUFabric C API: Starting remote worker");
 
@@ -4233,6 +4467,10 @@ pub extern "C" fn start_remote_worker(
         p2p_udp_port: 40000,
         p2p_bind_addr: "127.0.0.1".to_string(),
         p2p_public_listen: false,
+        p2p_xdp_pin_dir: None,
+        model_peer_listen: None,
+        model_peers: None,
+        model_peer_token: None,
         cert_chain_path: "".to_string(),
         control_tls: false,
         control_tls_server_name: None,
@@ -4248,7 +4486,10 @@ pub extern "C" fn start_remote_worker(
         llama_split_mode: LlamaSplitModeArg::Layer,
         llama_main_gpu: 0,
         llama_devices: None,
+        gpu_placement: GpuPlacementArg::Manual,
         stream_chunk_bytes: 256,
+        stream_flush_tokens: crate::util::stream_coalescer::DEFAULT_FLUSH_TOKENS,
+        stream_flush_ms: crate::util::stream_coalescer::DEFAULT_FLUSH_MS,
     };
 
     #[cfg(target_os = "android")]
@@ -4488,10 +4729,191 @@ fn ensure_backend_initialized() -> c_int {
     0
 }
 
+/// Model and context serving remote-worker tasks.
+///
+/// Tasks hold an `Arc` for their whole run. A hot swap only replaces the
+/// `Arc`; the previous context is handed back to the model registry once
+/// its last task ends, so in-flight tasks drain on the old model while new
+/// tasks start on the new one.
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub struct ServingModel {
+    pub model: *mut llama_model,
+    pub context: *mut llama_context,
+}
+
+// SAFETY: The pointers are only passed to llama.cpp while
+// `GLOBAL_INFERENCE_MUTEX` is held, and `Drop` waits for that mutex.
+#[cfg(any(target_os = "android", target_os = "ios"))]
+unsafe impl Send for ServingModel {}
+#[cfg(any(target_os = "android", target_os = "ios"))]
+unsafe impl Sync for ServingModel {}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+impl Drop for ServingModel {
+    fn drop(&mut self) {
+        // Readers of the raw GLOBAL_*_PTR values run under the inference
+        // mutex; wait for them before the context can be freed.
+        let _inference_lock = GLOBAL_INFERENCE_MUTEX
+            .lock()
+            .unwrap_or_else(|poisoned| poisoned.into_inner());
+        speculative::forget(self.context);
+        // SAFETY: No task holds the context any more. Contexts the JNI
+        // service loaded outside the registry are not leased, so release
+        // leaves them to their owner.
+        if unsafe { model_registry::release(self.context) } == 0 {
+            println!("✅ C API: Previous context returned to pool");
+        }
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+static SERVING_MODEL: Lazy<Mutex<Option<Arc<ServingModel>>>> = Lazy::new(|| Mutex::new(None));
+
+/// Lease the model currently serving remote-worker tasks.
+///
+/// Take the lease before `GLOBAL_INFERENCE_MUTEX` and drop it after the
+/// lock: releasing the last lease of a replaced model waits for that mutex.
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub fn serving_model() -> Option<Arc<ServingModel>> {
+    SERVING_MODEL
+        .lock()
+        .unwrap_or_else(|poisoned| poisoned.into_inner())
+        .clone()
+}
+
+/// Serve a model and context loaded outside the model registry (the JNI
+/// inference service), or stop serving when either pointer is null. Tasks
+/// already holding a lease keep the previous pair until they finish.
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub(crate) fn set_serving_model(model: *mut llama_model, context: *mut llama_context) {
+    use std::sync::atomic::Ordering;
+
+    let previous = {
+        let mut serving = SERVING_MODEL
+            .lock()
+            .unwrap_or_else(|poisoned| poisoned.into_inner());
+        GLOBAL_MODEL_PTR.store(model, Ordering::SeqCst);
+        GLOBAL_CONTEXT_PTR.store(context, Ordering::SeqCst);
+        if model.is_null() || context.is_null() {
+            serving.take()
+        } else {
+            serving.replace(Arc::new(ServingModel { model, context }))
+        }
+    };
+    drop(previous);
+}
+
+/// Decode one BOS token so weights are paged in and the compute graph is
+/// allocated before the first real request, then drop it again.
+#[cfg(any(target_os = "android", target_os = "ios"))]
+unsafe fn warm_up_context(ctx: *mut llama_context) {
+    let vocab = llama_model_get_vocab(llama_get_model(ctx));
+    if vocab.is_null() {
+        return;
+    }
+    let mut token = llama_vocab_bos(vocab);
+    if llama_decode(ctx, llama_batch_get_one(&mut token, 1)) != 0 {
+        println!("⚠️ C API: Warm-up decode failed");
+    }
+    llama_memory_seq_rm(llama_get_memory(ctx), 0, -1, -1);
+    prefix_cache::forget(ctx);
+}
+
+/// Record loading progress for `gpuf_load_model_get_progress`.
+#[cfg(any(target_os = "android", target_os = "ios"))]
+fn set_async_loading_progress(progress: f32) {
+    let mut state_guard = ASYNC_LOADING_STATE
+        .lock()
+        .unwrap_or_else(|poisoned| poisoned.into_inner());
+    if let Some(ref mut state) = *state_guard {
+        state.progress = progress;
+    }
+}
+
+/// Load, warm up and switch to the model at `path_str`. The old model keeps
+/// serving and stays advertised until the final pointer flip.
+#[cfg(any(target_os = "android", target_os = "ios"))]
+fn swap_remote_worker_model(path_str: &str, on_progress: &dyn Fn(f32)) -> c_int {
+    use std::sync::atomic::Ordering;
+
+    // Serializes swaps only; inference keeps running on the current model.
+    let _swap_lock = MODEL_SWAP_LOCK
+        .lock()
+        .unwrap_or_else(|poisoned| poisoned.into_inner());
+
+    MODEL_STATUS.lock().unwrap().set_switching(path_str);
+    on_progress(0.1);
+
+    // 1. Lease a context on the new model; a resident model or pooled
+    // context from an earlier switch is reused instead of loading again.
+    // SAFETY: The registry only frees models and contexts that are not
+    // leased; the serving context stays leased until the flip below.
+    let (context_ptr, pooled) = match unsafe { model_registry::acquire(path_str) } {
+        Ok(leased) => leased,
+        Err(model_registry::AcquireError::Load) => {
+            eprintln!("❌ C API: Failed to load model");
+            MODEL_STATUS
+                .lock()
+                .unwrap()
+                .set_switch_error("Failed to load model");
+            return -3;
+        }
+        Err(model_registry::AcquireError::Context) => {
+            eprintln!("❌ C API: Failed to create context");
+            MODEL_STATUS
+                .lock()
+                .unwrap()
+                .set_switch_error("Failed to create context");
+            return -4;
+        }
+    };
+    on_progress(0.8);
+
+    // 2. Warm up a fresh context while the old model is still serving.
+    // SAFETY: `context_ptr` is a live context leased from the registry and
+    // not yet visible to any task.
+    let model_ptr = unsafe {
+        if !pooled {
+            warm_up_context(context_ptr);
+        }
+        // Keep speculative decoding on if a worker draft is configured
+        speculative::follow_serving(context_ptr);
+        llama_get_model(context_ptr) as *mut llama_model
+    };
+    on_progress(0.9);
+    println!(
+        "✅ C API: Model ready (path {} bytes, {} resident)",
+        path_str.len(),
+        model_registry::gpuf_model_registry_resident_count()
+    );
+
+    // 3. Flip: new tasks lease the new model from here on.
+    let previous = {
+        let mut serving = SERVING_MODEL
+            .lock()
+            .unwrap_or_else(|poisoned| poisoned.into_inner());
+        GLOBAL_MODEL_PTR.store(model_ptr, Ordering::SeqCst);
+        GLOBAL_CONTEXT_PTR.store(context_ptr, Ordering::SeqCst);
+        MODEL_STATUS.lock().unwrap().set_loaded(path_str);
+        serving.replace(Arc::new(ServingModel {
+            model: model_ptr,
+            context: context_ptr,
+        }))
+    };
+    println!("✅ C API: Serving model switched");
+
+    // 4. The previous context goes back to the pool once its last task
+    // drops its lease; the model stays resident subject to the budget.
+    drop(previous);
+    on_progress(1.0);
+    0
+}
+
 /// Set remote worker model (C API) - Safe Hot Swapping Version
 ///
 /// This function supports safe hot swapping without stopping the worker.
-/// Uses coordination mutex to ensure no inference requests access freed memory.
+/// Tasks lease the serving model, so the old model is only released after
+/// its in-flight tasks have finished.
 ///
 /// # Parameters
 /// - `model_path`: Path to the model file (.gguf)
@@ -4508,111 +4930,189 @@ fn ensure_backend_initialized() -> c_int {
 ///
 /// # Hot Swapping
 /// This function can be called multiple times without stopping the worker.
-/// Inference requests will be briefly paused during the swap but the worker
-/// remains connected and continues processing afterward.
+/// The new model is loaded and warmed up while the old one keeps serving
+/// and stays advertised; only the final pointer flip is atomic. Models are
+/// kept in the model registry, so switching back to one that is still
+/// resident skips the GGUF load. Use `set_remote_worker_model_async` to
+/// load in the background.
 #[cfg(any(target_os = "android", target_os = "ios"))]
 #[no_mangle]
 pub extern "C" fn set_remote_worker_model(model_path: *const c_char) -> c_int {
-    use std::sync::atomic::Ordering;
-
     println!("🔥 GPUFabric C API: Setting remote worker model (hot swap enabled)");
 
-    // 1. Ensure backend is initialized (only once per process)
+    let path_str = match remote_worker_model_path(model_path) {
+        Ok(path) => path,
+        Err(code) => return code,
+    };
+
+    let result = swap_remote_worker_model(&path_str, &|_| {});
+    if result == 0 {
+        println!("🎉 C API: Remote worker model set successfully (hot swap)");
+    }
+    result
+}
+
+/// Backend setup and path validation shared by the swap entry points.
+#[cfg(any(target_os = "android", target_os = "ios"))]
+fn remote_worker_model_path(model_path: *const c_char) -> Result<String, c_int> {
+    // Ensure backend is initialized (only once per process)
     if ensure_backend_initialized() != 0 {
         eprintln!("❌ C API: Backend initialization failed");
-        return -1;
+        return Err(-1);
     }
     println!("✅ C API: Backend ready");
 
-    // 2. Convert C string to Rust string
-    let path_str = if model_path.is_null() {
+    if model_path.is_null() {
         eprintln!("❌ C API: Model path is null");
-        return -2;
-    } else {
-        // SAFETY: `model_path` was checked for null and must point to a
-        // NUL-terminated string owned by the caller for this call.
-        unsafe {
-            match std::ffi::CStr::from_ptr(model_path).to_str() {
-                Ok(s) => s,
-                Err(e) => {
-                    eprintln!("❌ C API: Failed to convert model path: {}", e);
-                    return -2;
-                }
-            }
+        return Err(-2);
+    }
+    // SAFETY: `model_path` was checked for null and must point to a
+    // NUL-terminated string owned by the caller for this call.
+    match unsafe { std::ffi::CStr::from_ptr(model_path) }.to_str() {
+        Ok(s) => Ok(s.to_owned()),
+        Err(e) => {
+            eprintln!("❌ C API: Failed to convert model path: {}", e);
+            Err(-2)
         }
+    }
+}
+
+/// Start a background hot swap to `model_path` and return immediately.
+///
+/// Progress is reported through `gpuf_load_model_get_status`,
+/// `gpuf_load_model_get_progress` and `gpuf_load_model_wait`, like
+/// `gpuf_load_model_async_start`. The current model keeps serving until the
+/// swap completes. The pointer from `gpuf_load_model_get_result` belongs to
+/// the model registry and must not be freed.
+///
+/// # Returns
+/// - `0`: Swap started
+/// - `-1`: Backend initialization failed
+/// - `-2`: Path conversion failed
+/// - `-5`: Another background load is still running
+///
+/// # Safety
+/// Caller must ensure `model_path` is a valid null-terminated C string
+#[cfg(any(target_os = "android", target_os = "ios"))]
+#[no_mangle]
+pub extern "C" fn set_remote_worker_model_async(model_path: *const c_char) -> c_int {
+    let path_str = match remote_worker_model_path(model_path) {
+        Ok(path) => path,
+        Err(code) => return code,
     };
 
-    // 3. Update model status to loading
     {
-        let mut status = MODEL_STATUS.lock().unwrap();
-        status.set_loading(path_str);
+        let mut state_guard = ASYNC_LOADING_STATE
+            .lock()
+            .unwrap_or_else(|poisoned| poisoned.into_inner());
+        if matches!(*state_guard, Some(AsyncLoadingState { status: 1, .. })) {
+            return -5;
+        }
+        *state_guard = Some(AsyncLoadingState {
+            status: 1, // loading
+            progress: 0.0,
+            model_ptr: 0,
+            context_ptr: 0,
+        });
     }
 
-    // 4. Load new model and context
-    let model_ptr = gpuf_load_model(model_path);
-    if model_ptr.is_null() {
-        eprintln!("❌ C API: Failed to load model");
-        let mut status = MODEL_STATUS.lock().unwrap();
-        status.set_error("Failed to load model");
-        return -3;
-    }
-    println!("✅ C API: Model loaded (path {} bytes)", path_str.len());
-
-    let context_ptr = gpuf_create_context(model_ptr);
-    if context_ptr.is_null() {
-        eprintln!("❌ C API: Failed to create context");
-        let mut status = MODEL_STATUS.lock().unwrap();
-        status.set_error("Failed to create context");
-        // SAFETY: `model_ptr` was returned by `gpuf_load_model` above.
-        unsafe { llama_model_free(model_ptr) };
-        return -4;
-    }
-    println!("✅ C API: Context created");
-
-    // 5. Atomically swap model/context using inference mutex
-    // This blocks both other swaps AND inference requests briefly
-    println!("🔄 C API: Swapping model (blocking inference briefly)...");
-    {
-        let _swap_lock = MODEL_SWAP_LOCK.lock().unwrap();
-        let _inference_lock = GLOBAL_INFERENCE_MUTEX.lock().unwrap();
-
-        // Get old model/context for cleanup
-        let old_model = GLOBAL_MODEL_PTR.load(Ordering::SeqCst);
-        let old_context = GLOBAL_CONTEXT_PTR.load(Ordering::SeqCst);
+    let handle = std::thread::spawn(move || {
+        let result = swap_remote_worker_model(&path_str, &set_async_loading_progress);
+        let mut state_guard = ASYNC_LOADING_STATE
+            .lock()
+            .unwrap_or_else(|poisoned| poisoned.into_inner());
+        if let Some(ref mut state) = *state_guard {
+            if result == 0 {
+                state.status = 2; // completed
+                state.progress = 1.0;
+                state.model_ptr =
+                    GLOBAL_MODEL_PTR.load(std::sync::atomic::Ordering::SeqCst) as usize;
+            } else {
+                state.status = 3; // error
+                state.progress = -1.0;
+            }
+        }
+        (result == 0) as i32
+    });
 
-        // Update to new model/context atomically
-        GLOBAL_MODEL_PTR.store(model_ptr, Ordering::SeqCst);
-        GLOBAL_CONTEXT_PTR.store(context_ptr, Ordering::SeqCst);
+    let mut handle_guard = ASYNC_LOADING_HANDLE
+        .lock()
+        .unwrap_or_else(|poisoned| poisoned.into_inner());
+    if let Some(previous) = handle_guard.replace(handle) {
+        let _ = previous.join();
+    }
+    0
+}
 
-        println!("✅ C API: Global pointers updated");
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+#[no_mangle]
+pub extern "C" fn set_remote_worker_model_async(_model_path: *const c_char) -> c_int {
+    -1
+}
 
-        // Clean up old resources AFTER updating pointers
-        if !old_model.is_null() || !old_context.is_null() {
-            println!("🧹 C API: Cleaning up previous model/context");
+/// Configure a draft model for speculative decoding on the remote worker.
+///
+/// The draft is kept in the model registry and paired with the serving
+/// context, now and after every later `set_remote_worker_model` swap whose
+/// model shares the draft's vocabulary. Passing a null `draft_path` turns
+/// speculative decoding off again.
+///
+/// # Parameters
+/// - `draft_path`: Path to a small model with the target's vocabulary (.gguf)
+/// - `n_draft`: Tokens proposed per round, at most `MAX_DRAFT_TOKENS`
+///
+/// # Returns
+/// - `0`: Success
+/// - `-1`: Backend initialization failed or `n_draft` is not positive
+/// - `-2`: Path conversion failed, or the serving model's vocabulary differs
+/// - `-3`: Model loading failed
+/// - `-4`: Context creation failed
+///
+/// # Safety
+/// Caller must ensure `draft_path` is null or a valid null-terminated C string
+#[cfg(any(target_os = "android", target_os = "ios"))]
+#[no_mangle]
+pub extern "C" fn set_remote_worker_draft_model(
+    draft_path: *const c_char,
+    n_draft: c_int,
+) -> c_int {
+    // A swap must not pick up a half-replaced draft
+    let _swap_lock = MODEL_SWAP_LOCK
+        .lock()
+        .unwrap_or_else(|poisoned| poisoned.into_inner());
+    let serving = serving_model().map(|serving| serving.context);
 
-            if !old_context.is_null() {
-                // SAFETY: Old context pointer came from this SDK global state.
-                unsafe { llama_free(old_context) };
-                println!("✅ C API: Old context freed");
-            }
-            if !old_model.is_null() {
-                // SAFETY: Old model pointer came from this SDK global state.
-                unsafe { llama_model_free(old_model) };
-                println!("✅ C API: Old model freed");
-            }
-        }
+    if draft_path.is_null() {
+        // SAFETY: Only releases the draft context the worker leased earlier.
+        return unsafe { speculative::set_worker_draft(serving, None) };
     }
+    if n_draft <= 0 {
+        return -1;
+    }
+    let path_str = match remote_worker_model_path(draft_path) {
+        Ok(path) => path,
+        Err(code) => return code,
+    };
 
-    println!("✅ C API: Model swap completed");
-
-    // 6. Update status to loaded
-    {
-        let mut status = MODEL_STATUS.lock().unwrap();
-        status.set_loaded(path_str);
+    // SAFETY: The registry only frees models and contexts that are not
+    // leased; the draft context stays leased while it is configured.
+    unsafe {
+        let draft = match model_registry::acquire(&path_str) {
+            Ok((draft, _)) => draft,
+            Err(model_registry::AcquireError::Load) => return -3,
+            Err(model_registry::AcquireError::Context) => return -4,
+        };
+        speculative::set_worker_draft(serving, Some((draft, n_draft)))
     }
+}
 
-    println!("🎉 C API: Remote worker model set successfully (hot swap)");
-    0 // Success
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+#[no_mangle]
+pub extern "C" fn set_remote_worker_draft_model(
+    _draft_path: *const c_char,
+    _n_draft: c_int,
+) -> c_int {
+    -1
 }
 
 #[cfg(not(any(target_os = "android", target_os = "ios")))]
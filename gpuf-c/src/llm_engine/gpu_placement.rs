@@ -0,0 +1,617 @@
+// ============================================================================
+// Automatic GPU placement for the desktop llama.cpp engine
+// ============================================================================
+//
+// Workers used to load with the configured `n_gpu_layers` (99 by default),
+// so a model larger than the GPUs failed to load instead of running partly
+// on the CPU. With `--gpu-placement auto` the engine reads the tensor sizes
+// from the GGUF header and the free memory of each GPU
+// (`util::system_info::gpu_free_memory`), and offloads as many layers as
+// fit once every device keeps headroom for llama.cpp's compute buffers and
+// each offloaded layer brings its KV cache for the configured context.
+//
+// Layers are split over the GPUs in proportion to their free memory, which
+// is also what llama.cpp does when no `tensor_split` is given; the plan
+// simulates that assignment so every device's share is known to fit. GPUs
+// too full to take a share are left out of the device list. The chosen
+// layout rides in the heartbeat so the server knows how much of the model
+// actually runs on the GPUs.
+// ============================================================================
+
+use std::collections::HashMap;
+use std::fs::File;
+use std::io::{BufReader, Read};
+use std::path::Path;
+use std::sync::Mutex;
+
+use anyhow::{anyhow, Result};
+use common::{GpuPlacement, GpuShare};
+
+use crate::util::system_info::GpuMemory;
+
+const GGUF_MAGIC: &[u8; 4] = b"GGUF";
+const GGUF_DEFAULT_ALIGNMENT: u64 = 32;
+/// KV cache entries are f16.
+const KV_BYTES_PER_ELEMENT: u64 = 2;
+
+#[derive(Debug, Clone, Copy)]
+pub struct PlacementLimits {
+    /// Memory left free on every GPU for compute buffers and the backend
+    /// context.
+    pub headroom_bytes: u64,
+}
+
+impl Default for PlacementLimits {
+    fn default() -> Self {
+        Self {
+            headroom_bytes: 768 << 20,
+        }
+    }
+}
+
+impl PlacementLimits {
+    /// Defaults overridden by `GPUF_GPU_HEADROOM_MB`.
+    pub fn from_env() -> Self {
+        let defaults = Self::default();
+        Self {
+            headroom_bytes: std::env::var("GPUF_GPU_HEADROOM_MB")
+                .ok()
+                .and_then(|s| s.parse::<u64>().ok())
+                .map_or(defaults.headroom_bytes, |mb| mb << 20),
+        }
+    }
+}
+
+/// Memory a model needs per offloadable layer, from its GGUF header.
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct ModelFootprint {
+    /// Weight bytes of each repeating block (`blk.N.*`).
+    pub layer_bytes: Vec<u64>,
+    /// Weight bytes of the output layer, offloaded as layer `n_layers`.
+    pub output_bytes: u64,
+    /// K and V cache bytes one token takes in one layer.
+    pub kv_bytes_per_token: u64,
+}
+
+// ----------------------------------------------------------------------------
+// GGUF header
+// ----------------------------------------------------------------------------
+
+struct GgufReader<R> {
+    inner: R,
+    pos: u64,
+}
+
+impl<R: Read> GgufReader<R> {
+    fn bytes<const N: usize>(&mut self) -> Result<[u8; N]> {
+        let mut buf = [0u8; N];
+        self.inner.read_exact(&mut buf)?;
+        self.pos += N as u64;
+        Ok(buf)
+    }
+
+    fn u32(&mut self) -> Result<u32> {
+        Ok(u32::from_le_bytes(self.bytes()?))
+    }
+
+    fn u64(&mut self) -> Result<u64> {
+        Ok(u64::from_le_bytes(self.bytes()?))
+    }
+
+    fn skip(&mut self, n: u64) -> Result<()> {
+        let skipped = std::io::copy(&mut (&mut self.inner).take(n), &mut std::io::sink())?;
+        self.pos += skipped;
+        if skipped != n {
+            return Err(anyhow!("GGUF header truncated"));
+        }
+        Ok(())
+    }
+
+    fn string(&mut self) -> Result<String> {
+        let len = self.u64()?;
+        if len > 1 << 20 {
+            return Err(anyhow!("GGUF string of {} bytes", len));
+        }
+        let mut buf = vec![0u8; len as usize];
+        self.inner.read_exact(&mut buf)?;
+        self.pos += len;
+        Ok(String::from_utf8_lossy(&buf).into_owned())
+    }
+
+    /// A metadata value: integers are returned, strings returned as text,
+    /// everything else (floats, bools, arrays) skipped.
+    fn value(&mut self, ty: u32) -> Result<Value> {
+        Ok(match ty {
+            0 | 1 | 7 => Value::Int(self.bytes::<1>()?[0] as u64),
+            2 | 3 => Value::Int(u16::from_le_bytes(self.bytes()?) as u64),
+            4 | 5 => Value::Int(self.u32()? as u64),
+            10 | 11 => Value::Int(self.u64()?),
+            6 => self.skip(4).map(|_| Value::Other)?,
+            12 => self.skip(8).map(|_| Value::Other)?,
+            8 => Value::Text(self.string()?),
+            9 => {
+                let elem = self.u32()?;
+                let count = self.u64()?;
+                match elem {
+                    0 | 1 | 7 => self.skip(count)?,
+                    2 | 3 => self.skip(count * 2)?,
+                    4 | 5 | 6 => self.skip(count * 4)?,
+                    10 | 11 | 12 => self.skip(count * 8)?,
+                    8 => {
+                        for _ in 0..count {
+                            let len = self.u64()?;
+                            self.skip(len)?;
+                        }
+                    }
+                    other => return Err(anyhow!("GGUF array of type {}", other)),
+                }
+                Value::Other
+            }
+            other => return Err(anyhow!("GGUF value of type {}", other)),
+        })
+    }
+}
+
+enum Value {
+    Int(u64),
+    Text(String),
+    Other,
+}
+
+/// Block index of a `blk.N.*` tensor.
+fn block_of(name: &str) -> Option<usize> {
+    let rest = name.strip_prefix("blk.")?;
+    rest[..rest.find('.')?].parse().ok()
+}
+
+impl ModelFootprint {
+    /// Read the footprint of the GGUF model at `path` without loading it.
+    pub fn read(path: &Path) -> Result<Self> {
+        let file = File::open(path)?;
+        let file_len = file.metadata()?.len();
+        Self::parse(BufReader::new(file), file_len)
+    }
+
+    fn parse(inner: impl Read, file_len: u64) -> Result<Self> {
+        let mut r = GgufReader { inner, pos: 0 };
+        if &r.bytes::<4>()? != GGUF_MAGIC {
+            return Err(anyhow!("not a GGUF file"));
+        }
+        let version = r.u32()?;
+        if version < 2 {
+            return Err(anyhow!("GGUF version {} is not supported", version));
+        }
+        let n_tensors = r.u64()?;
+        let n_kv = r.u64()?;
+
+        let mut ints: HashMap<String, u64> = HashMap::new();
+        let mut arch = String::new();
+        for _ in 0..n_kv {
+            let key = r.string()?;
+            let ty = r.u32()?;
+            match r.value(ty)? {
+                Value::Int(v) => {
+                    ints.insert(key, v);
+                }
+                Value::Text(v) if key == "general.architecture" => arch = v,
+                _ => {}
+            }
+        }
+
+        let mut tensors = Vec::with_capacity(n_tensors.min(1 << 16) as usize);
+        for _ in 0..n_tensors {
+            let name = r.string()?;
+            let n_dims = r.u32()?;
+            r.skip(n_dims as u64 * 8)?;
+            let _ggml_type = r.u32()?;
+            let offset = r.u64()?;
+            tensors.push((name, offset));
+        }
+
+        // Tensor data is laid out back to back (padded to the alignment)
+        // in offset order, so each tensor ends where the next one starts.
+        let alignment = ints
+            .get("general.alignment")
+            .copied()
+            .filter(|a| *a > 0)
+            .unwrap_or(GGUF_DEFAULT_ALIGNMENT);
+        let data_start = r.pos.div_ceil(alignment) * alignment;
+        let data_len = file_len.saturating_sub(data_start);
+        tensors.sort_by_key(|(_, offset)| *offset);
+        let ends: Vec<u64> = tensors
+            .iter()
+            .skip(1)
+            .map(|(_, offset)| *offset)
+            .chain(std::iter::once(data_len))
+            .collect();
+
+        let meta = |key: &str| ints.get(&format!("{arch}.{key}")).copied();
+        let n_layers = meta("block_count").unwrap_or(0) as usize;
+        let mut footprint = ModelFootprint {
+            layer_bytes: vec![0; n_layers],
+            ..Self::default()
+        };
+        let mut token_embd_bytes = 0;
+        let mut has_output = false;
+        for ((name, offset), end) in tensors.iter().zip(ends) {
+            let bytes = end.saturating_sub(*offset);
+            if let Some(block) = block_of(name) {
+                if block >= footprint.layer_bytes.len() {
+                    footprint.layer_bytes.resize(block + 1, 0);
+                }
+                footprint.layer_bytes[block] += bytes;
+            } else if name.starts_with("output") {
+                has_output |= name == "output.weight";
+                footprint.output_bytes += bytes;
+            } else if name == "token_embd.weight" {
+                token_embd_bytes = bytes;
+            }
+        }
+        if !has_output {
+            // Tied embeddings: llama.cpp copies token_embd into the output
+            // layer.
+            footprint.output_bytes += token_embd_bytes;
+        }
+
+        if let (Some(n_embd), Some(n_head)) =
+            (meta("embedding_length"), meta("attention.head_count"))
+        {
+            if n_head > 0 {
+                let n_head_kv = meta("attention.head_count_kv").unwrap_or(n_head);
+                let k_len = meta("attention.key_length").unwrap_or(n_embd / n_head);
+                let v_len = meta("attention.value_length").unwrap_or(k_len);
+                footprint.kv_bytes_per_token = (k_len + v_len) * n_head_kv * KV_BYTES_PER_ELEMENT;
+            }
+        }
+        Ok(footprint)
+    }
+
+    pub fn n_layers(&self) -> u32 {
+        self.layer_bytes.len() as u32
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Placement
+// ----------------------------------------------------------------------------
+
+#[derive(Debug, Clone, PartialEq)]
+pub struct DeviceShare {
+    pub index: u32,
+    pub free_bytes: u64,
+    pub layers: u32,
+    /// Weights and KV cache of the device's layers.
+    pub bytes: u64,
+}
+
+#[derive(Debug, Clone, PartialEq)]
+pub struct Placement {
+    pub n_layers: u32,
+    /// The `n_gpu_layers` to load with.
+    pub n_gpu_layers: u32,
+    /// GPUs that take layers, in device order.
+    pub devices: Vec<DeviceShare>,
+}
+
+impl Placement {
+    /// Share of the offloaded layers per device in `devices`; what
+    /// llama.cpp derives from free memory when `tensor_split` is unset.
+    pub fn tensor_split(&self) -> Vec<f32> {
+        let total: u64 = self.devices.iter().map(|d| d.free_bytes).sum();
+        self.devices
+            .iter()
+            .map(|d| d.free_bytes as f32 / total.max(1) as f32)
+            .collect()
+    }
+
+    /// Device indices for `llama_devices`.
+    pub fn device_list(&self) -> String {
+        self.devices
+            .iter()
+            .map(|d| d.index.to_string())
+            .collect::<Vec<_>>()
+            .join(",")
+    }
+
+    fn to_heartbeat(&self) -> GpuPlacement {
+        GpuPlacement {
+            n_layers: self.n_layers,
+            n_gpu_layers: self.n_gpu_layers,
+            devices: self
+                .devices
+                .iter()
+                .map(|d| GpuShare {
+                    index: d.index as u16,
+                    layers: d.layers,
+                    used_mb: (d.bytes >> 20) as u32,
+                    free_mb: (d.free_bytes >> 20) as u32,
+                })
+                .collect(),
+        }
+    }
+}
+
+/// Spread `items` (bytes of each offloaded layer, in layer order) over
+/// devices weighted by `weights` the way llama.cpp does: item `j` of `n`
+/// goes to the first device whose cumulative share exceeds `j / n`.
+/// Returns the layer count and bytes per device.
+fn assign(items: &[u64], weights: &[u64]) -> Vec<(u32, u64)> {
+    let mut shares = vec![(0u32, 0u64); weights.len()];
+    if items.is_empty() || weights.is_empty() {
+        return shares;
+    }
+    let total = weights.iter().sum::<u64>().max(1) as f32;
+    let mut cumulative = Vec::with_capacity(weights.len());
+    let mut sum = 0u64;
+    for w in weights {
+        sum += w;
+        cumulative.push(sum as f32 / total);
+    }
+    for (j, &bytes) in items.iter().enumerate() {
+        let at = j as f32 / items.len() as f32;
+        let device = cumulative
+            .partition_point(|&c| c <= at)
+            .min(weights.len() - 1);
+        shares[device].0 += 1;
+        shares[device].1 += bytes;
+    }
+    shares
+}
+
+/// The most layers `devices` can take, with each device's share.
+fn fit(layer_costs: &[u64], output_cost: u64, devices: &[(GpuMemory, u64)]) -> Placement {
+    let n = layer_costs.len();
+    if devices.is_empty() {
+        return Placement {
+            n_layers: n as u32,
+            n_gpu_layers: 0,
+            devices: Vec::new(),
+        };
+    }
+    let weights: Vec<u64> = devices.iter().map(|(gpu, _)| gpu.free_bytes).collect();
+    let fits = |shares: &[(u32, u64)]| {
+        shares
+            .iter()
+            .zip(devices)
+            .all(|((_, bytes), (_, budget))| bytes <= budget)
+    };
+
+    let full: Vec<u64> = layer_costs
+        .iter()
+        .copied()
+        .chain(std::iter::once(output_cost))
+        .collect();
+    // All blocks plus the output layer, else the last `k` blocks:
+    // llama.cpp offloads from the end.
+    let (n_gpu_layers, shares) = std::iter::once((n + 1, assign(&full, &weights)))
+        .chain(
+            (0..=n)
+                .rev()
+                .map(|k| (k, assign(&layer_costs[n - k..], &weights))),
+        )
+        .find(|(_, shares)| fits(shares))
+        .unwrap_or((0, Vec::new()));
+
+    Placement {
+        n_layers: n as u32,
+        n_gpu_layers: n_gpu_layers as u32,
+        devices: devices
+            .iter()
+            .zip(shares)
+            .filter(|(_, (layers, _))| *layers > 0)
+            .map(|((gpu, _), (layers, bytes))| DeviceShare {
+                index: gpu.index,
+                free_bytes: gpu.free_bytes,
+                layers,
+                bytes,
+            })
+            .collect(),
+    }
+}
+
+/// Plan the offload of `model` with an `n_ctx` context onto `gpus`.
+///
+/// A GPU with less free memory than the headroom takes no layers. Because
+/// shares follow free memory, the GPU with the least room relative to its
+/// free memory limits the rest; such GPUs are dropped one at a time while
+/// that lets more layers onto the GPUs.
+pub fn plan(
+    model: &ModelFootprint,
+    n_ctx: u32,
+    gpus: &[GpuMemory],
+    limits: PlacementLimits,
+) -> Placement {
+    let kv_per_layer = model.kv_bytes_per_token * n_ctx as u64;
+    let layer_costs: Vec<u64> = model.layer_bytes.iter().map(|b| b + kv_per_layer).collect();
+
+    let mut devices: Vec<(GpuMemory, u64)> = gpus
+        .iter()
+        .filter(|gpu| gpu.free_bytes > limits.headroom_bytes)
+        .map(|gpu| (*gpu, gpu.free_bytes - limits.headroom_bytes))
+        .collect();
+    devices.sort_by_key(|(gpu, _)| gpu.index);
+
+    let mut best = fit(&layer_costs, model.output_bytes, &devices);
+    while devices.len() > 1 {
+        let tightest = devices
+            .iter()
+            .enumerate()
+            .min_by(|(_, (a, a_budget)), (_, (b, b_budget))| {
+                let a = *a_budget as f64 / a.free_bytes as f64;
+                let b = *b_budget as f64 / b.free_bytes as f64;
+                a.total_cmp(&b)
+            })
+            .map(|(i, _)| i)
+            .unwrap_or(0);
+        devices.remove(tightest);
+        let candidate = fit(&layer_costs, model.output_bytes, &devices);
+        if candidate.n_gpu_layers > best.n_gpu_layers {
+            best = candidate;
+        }
+    }
+    if best.n_gpu_layers == 0 {
+        best.devices.clear();
+    }
+    best
+}
+
+/// Plan the offload of the GGUF model at `path` onto this machine's GPUs.
+pub fn plan_for_model(path: &Path, n_ctx: u32) -> Result<Placement> {
+    let gpus = crate::util::system_info::gpu_free_memory();
+    if gpus.is_empty() {
+        return Err(anyhow!("no per-GPU free memory available"));
+    }
+    let model = ModelFootprint::read(path)?;
+    if model.layer_bytes.is_empty() {
+        return Err(anyhow!("no repeating layers found in the GGUF header"));
+    }
+    Ok(plan(&model, n_ctx, &gpus, PlacementLimits::from_env()))
+}
+
+// ----------------------------------------------------------------------------
+// Heartbeat
+// ----------------------------------------------------------------------------
+
+static CURRENT: Mutex<Option<GpuPlacement>> = Mutex::new(None);
+
+/// The engine loaded its model with `placement`.
+pub fn record(placement: &Placement) {
+    *CURRENT.lock().unwrap_or_else(|p| p.into_inner()) = Some(placement.to_heartbeat());
+}
+
+/// The engine unloaded its model.
+pub fn forget() {
+    *CURRENT.lock().unwrap_or_else(|p| p.into_inner()) = None;
+}
+
+/// Layout of the loaded model; None unless it was placed automatically.
+pub fn heartbeat_placement() -> Option<GpuPlacement> {
+    CURRENT.lock().unwrap_or_else(|p| p.into_inner()).clone()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const MB: u64 = 1 << 20;
+
+    fn model(layers: usize, layer_mb: u64, output_mb: u64) -> ModelFootprint {
+        ModelFootprint {
+            layer_bytes: vec![layer_mb * MB; layers],
+            output_bytes: output_mb * MB,
+            kv_bytes_per_token: 0,
+        }
+    }
+
+    fn gpu(index: u32, free_mb: u64) -> GpuMemory {
+        GpuMemory {
+            index,
+            free_bytes: free_mb * MB,
+        }
+    }
+
+    fn limits(headroom_mb: u64) -> PlacementLimits {
+        PlacementLimits {
+            headroom_bytes: headroom_mb * MB,
+        }
+    }
+
+    #[test]
+    fn splits_across_gpus_in_proportion_to_free_memory() {
+        let placement = plan(
+            &model(30, 100, 100),
+            4096,
+            &[gpu(0, 8000), gpu(1, 24000)],
+            limits(500),
+        );
+        assert_eq!(placement.n_gpu_layers, 31);
+        let layers: Vec<u32> = placement.devices.iter().map(|d| d.layers).collect();
+        assert_eq!(layers, vec![8, 23]);
+        assert_eq!(placement.tensor_split(), vec![0.25, 0.75]);
+        assert_eq!(placement.device_list(), "0,1");
+    }
+
+    #[test]
+    fn offloads_what_fits_and_counts_the_kv_cache() {
+        let mut big = model(40, 500, 1000);
+        // 1 KiB per token and layer: 4 MiB per layer at n_ctx 4096.
+        big.kv_bytes_per_token = 1024;
+        let placement = plan(&big, 4096, &[gpu(0, 10_500)], limits(500));
+        // 10 000 MiB of budget over 504 MiB layers; no room for the output.
+        assert_eq!(placement.n_gpu_layers, 19);
+        assert_eq!(placement.devices[0].bytes, 19 * 504 * MB);
+
+        let none = plan(&big, 4096, &[gpu(0, 400)], limits(500));
+        assert_eq!(none.n_gpu_layers, 0);
+        assert!(none.devices.is_empty());
+    }
+
+    #[test]
+    fn drops_a_gpu_that_would_hold_the_others_back() {
+        // GPU 1 has almost no room beyond its headroom, yet proportional
+        // shares would give it a third of the layers.
+        let placement = plan(
+            &model(20, 100, 100),
+            4096,
+            &[gpu(0, 4000), gpu(1, 2000)],
+            limits(1900),
+        );
+        assert_eq!(placement.n_gpu_layers, 21);
+        assert_eq!(placement.device_list(), "0");
+    }
+
+    fn gguf_string(out: &mut Vec<u8>, s: &str) {
+        out.extend((s.len() as u64).to_le_bytes());
+        out.extend(s.as_bytes());
+    }
+
+    #[test]
+    fn reads_layer_sizes_from_the_gguf_header() {
+        let mut gguf = Vec::new();
+        gguf.extend(GGUF_MAGIC);
+        gguf.extend(3u32.to_le_bytes());
+        gguf.extend(4u64.to_le_bytes()); // tensors
+        gguf.extend(6u64.to_le_bytes()); // metadata
+        gguf_string(&mut gguf, "general.architecture");
+        gguf.extend(8u32.to_le_bytes());
+        gguf_string(&mut gguf, "llama");
+        for (key, value) in [
+            ("llama.block_count", 2u32),
+            ("llama.embedding_length", 64),
+            ("llama.attention.head_count", 8),
+            ("llama.attention.head_count_kv", 2),
+        ] {
+            gguf_string(&mut gguf, key);
+            gguf.extend(4u32.to_le_bytes());
+            gguf.extend(value.to_le_bytes());
+        }
+        gguf_string(&mut gguf, "tokenizer.ggml.tokens");
+        gguf.extend(9u32.to_le_bytes());
+        gguf.extend(8u32.to_le_bytes());
+        gguf.extend(2u64.to_le_bytes());
+        gguf_string(&mut gguf, "<s>");
+        gguf_string(&mut gguf, "</s>");
+        for (name, offset) in [
+            ("token_embd.weight", 0u64),
+            ("blk.0.attn_q.weight", 1024),
+            ("blk.0.ffn_up.weight", 1536),
+            ("blk.1.attn_q.weight", 2048),
+        ] {
+            gguf_string(&mut gguf, name);
+            gguf.extend(2u32.to_le_bytes());
+            gguf.extend(64u64.to_le_bytes());
+            gguf.extend(8u64.to_le_bytes());
+            gguf.extend(0u32.to_le_bytes());
+            gguf.extend(offset.to_le_bytes());
+        }
+        let data_start = (gguf.len() as u64).div_ceil(32) * 32;
+        let file_len = data_start + 2048 + 768;
+
+        let footprint = ModelFootprint::parse(&gguf[..], file_len).unwrap();
+        assert_eq!(footprint.layer_bytes, vec![1024, 768]);
+        // No output.weight: the tied token embedding is offloaded instead.
+        assert_eq!(footprint.output_bytes, 1024);
+        // (8 + 8) * 2 KV heads * 2 bytes.
+        assert_eq!(footprint.kv_bytes_per_token, 64);
+    }
+}
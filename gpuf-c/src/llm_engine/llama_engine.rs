@@ -14,7 +14,10 @@ use tokio::sync::mpsc;
 #[cfg(not(target_os = "android"))]
 use tokio_stream::wrappers::ReceiverStream;
 
-use crate::util::cmd::LlamaSplitModeArg;
+use crate::util::cmd::{GpuPlacementArg, LlamaSplitModeArg};
+
+#[cfg(not(target_os = "android"))]
+use super::gpu_placement;
 
 // llama-cpp-2 imports (only for non-Android platforms)
 #[cfg(not(target_os = "android"))]
@@ -42,6 +45,7 @@ pub struct LlamaEngine {
     pub llama_split_mode: LlamaSplitModeArg,
     pub llama_main_gpu: i32,
     pub llama_devices: Option<String>,
+    pub gpu_placement: GpuPlacementArg,
     pub is_initialized: bool,
     pub models_dir: PathBuf,
     // Added: model loading status tracking
@@ -147,10 +151,12 @@ impl LlamaEngine {
                     self.clear_cache();
                 }
             }
-            let n_gpu_layers = self.n_gpu_layers;
-            let llama_split_mode = self.llama_split_mode.clone();
-            let llama_main_gpu = self.llama_main_gpu;
-            let llama_devices = self.llama_devices.clone();
+            let mut n_gpu_layers = self.n_gpu_layers;
+            let mut llama_split_mode = self.llama_split_mode.clone();
+            let mut llama_main_gpu = self.llama_main_gpu;
+            let mut llama_devices = self.llama_devices.clone();
+            let gpu_placement = self.gpu_placement;
+            let n_ctx = self.n_ctx;
             let model_path_for_closure = resolved_model_path_str.clone();
             let model_path_for_cache = model_path_for_closure.clone();
 
@@ -186,6 +192,42 @@ impl LlamaEngine {
                     ));
                 }
 
+                // Auto placement overrides the configured offload; without a
+                // plan (no VRAM info, unreadable header) the configuration
+                // applies as given.
+                let placement = match gpu_placement {
+                    GpuPlacementArg::Manual => None,
+                    GpuPlacementArg::Auto => {
+                        match gpu_placement::plan_for_model(
+                            Path::new(&model_path_for_closure),
+                            n_ctx,
+                        ) {
+                            Ok(placement) => Some(placement),
+                            Err(e) => {
+                                warn!("Automatic GPU placement unavailable ({}), using configured n_gpu_layers", e);
+                                None
+                            }
+                        }
+                    }
+                };
+                if let Some(ref placement) = placement {
+                    info!(
+                        "Automatic GPU placement: {}/{} layers on devices [{}], split {:?}",
+                        placement.n_gpu_layers,
+                        placement.n_layers + 1,
+                        placement.device_list(),
+                        placement.tensor_split()
+                    );
+                    n_gpu_layers = placement.n_gpu_layers;
+                    // Device indices below refer to the selected devices.
+                    llama_main_gpu = 0;
+                    llama_devices = Some(placement.device_list());
+                    if placement.devices.len() > 1 && llama_split_mode == LlamaSplitModeArg::None
+                    {
+                        llama_split_mode = LlamaSplitModeArg::Layer;
+                    }
+                }
+
                 let split_mode = match llama_split_mode {
                     LlamaSplitModeArg::None => LlamaCppSplitMode::None,
                     LlamaSplitModeArg::Layer => LlamaCppSplitMode::Layer,
@@ -228,6 +270,11 @@ impl LlamaEngine {
                     LlamaModel::load_from_file(&*backend, &model_path_for_closure, &model_params)
                         .map_err(|e| anyhow!("Failed to load model: {:?}", e))?;
 
+                match placement {
+                    Some(ref placement) => gpu_placement::record(placement),
+                    None => gpu_placement::forget(),
+                }
+
                 Ok::<(Arc<LlamaBackend>, LlamaModel), anyhow::Error>((backend, model))
             })
             .await??;
@@ -251,6 +298,7 @@ impl LlamaEngine {
     pub fn clear_cache(&mut self) {
         if self.cached_model.is_some() {
             info!("Clearing model cache to free memory");
+            gpu_placement::forget();
             self.cached_model = None;
             self.cached_backend = None;
             self.cached_model_path = None;
@@ -582,6 +630,127 @@ impl LlamaEngine {
         }
     }
 
+    /// Embed `inputs` with the cached model, one sequence per input, packed
+    /// into decode batches of up to `n_batch` tokens like `gpuf_embed_batch`.
+    /// Returns the vectors back to back, their width and the prompt tokens.
+    pub async fn embed_with_cached_model(
+        &self,
+        inputs: Vec<String>,
+        normalize: bool,
+    ) -> Result<(Vec<f32>, u32, u32)> {
+        if !self.is_initialized {
+            return Err(anyhow!("Engine not initialized - call load_model() first"));
+        }
+
+        #[cfg(target_os = "android")]
+        {
+            let _ = (inputs, normalize);
+            Err(anyhow!("Android embeddings go through gpuf_embed_batch"))
+        }
+
+        #[cfg(not(target_os = "android"))]
+        {
+            let backend = self
+                .cached_backend
+                .as_ref()
+                .ok_or_else(|| anyhow!("Model not loaded - call load_model() first"))?
+                .clone();
+            let model = self
+                .cached_model
+                .as_ref()
+                .ok_or_else(|| anyhow!("Model not loaded - call load_model() first"))?
+                .clone();
+            let n_batch = self.n_batch.max(1);
+
+            tokio::task::spawn_blocking(move || {
+                use crate::embedding::{l2_normalize, plan_batches};
+                use llama_cpp_2::llama_batch::LlamaBatch;
+                use llama_cpp_2::model::AddBos;
+
+                // Sequences per decode call; short RAG chunks fill a batch
+                // long before the token budget does.
+                const EMBED_MAX_SEQUENCES: u32 = 32;
+
+                // One context per call sized for one batch: the KV cache is
+                // cleared between batches, and a whole sequence fits in one
+                // micro-batch as non-causal encoders require.
+                let context_params = LlamaContextParams::default()
+                    .with_n_ctx(NonZeroU32::new(n_batch))
+                    .with_n_batch(n_batch)
+                    .with_n_ubatch(n_batch)
+                    .with_n_seq_max(EMBED_MAX_SEQUENCES)
+                    .with_embeddings(true);
+
+                let model_guard = model
+                    .lock()
+                    .map_err(|e| anyhow!("Failed to lock model: {:?}", e))?;
+                let mut context = model_guard
+                    .new_context(&*backend, context_params)
+                    .map_err(|e| anyhow!("Failed to create context: {:?}", e))?;
+                let dim = model_guard.n_embd().max(0) as usize;
+
+                let mut tokens = Vec::with_capacity(inputs.len());
+                for (i, input) in inputs.iter().enumerate() {
+                    let t = model_guard
+                        .str_to_token(input, AddBos::Always)
+                        .map_err(|e| anyhow!("Failed to tokenize input {}: {:?}", i, e))?;
+                    if t.is_empty() || t.len() > n_batch as usize {
+                        return Err(anyhow!(
+                            "Input {} has {} tokens; embeddings take 1 to {}",
+                            i,
+                            t.len(),
+                            n_batch
+                        ));
+                    }
+                    tokens.push(t);
+                }
+                let lens: Vec<usize> = tokens.iter().map(Vec::len).collect();
+                let prompt_tokens: usize = lens.iter().sum();
+
+                let mut out = vec![0f32; dim * inputs.len()];
+                let mut batch = LlamaBatch::new(n_batch as usize, 1);
+                for range in plan_batches(&lens, n_batch as usize, EMBED_MAX_SEQUENCES as usize) {
+                    context.clear_kv_cache();
+                    batch.clear();
+                    for (seq, i) in range.clone().enumerate() {
+                        batch
+                            .add_sequence(&tokens[i], seq as i32, true)
+                            .map_err(|e| anyhow!("Failed to add input to batch: {:?}", e))?;
+                    }
+                    context
+                        .decode(&mut batch)
+                        .map_err(|e| anyhow!("Failed to decode batch: {:?}", e))?;
+
+                    let mut row = 0i32;
+                    for (seq, i) in range.enumerate() {
+                        let dst = &mut out[i * dim..(i + 1) * dim];
+                        match context.embeddings_seq_ith(seq as i32) {
+                            Ok(e) => dst.copy_from_slice(&e[..dim]),
+                            // No pooling layer: average the token embeddings.
+                            Err(_) => {
+                                for _ in 0..lens[i] {
+                                    let e = context.embeddings_ith(row).map_err(|e| {
+                                        anyhow!("Failed to read embeddings: {:?}", e)
+                                    })?;
+                                    dst.iter_mut().zip(e).for_each(|(d, x)| *d += x);
+                                    row += 1;
+                                }
+                                let n = lens[i] as f32;
+                                dst.iter_mut().for_each(|d| *d /= n);
+                            }
+                        }
+                        if normalize {
+                            l2_normalize(dst);
+                        }
+                    }
+                }
+
+                Ok((out, dim as u32, prompt_tokens as u32))
+            })
+            .await?
+        }
+    }
+
     pub fn new() -> Self {
         let models_dir = dirs::home_dir()
             .unwrap_or_else(|| PathBuf::from("."))
@@ -598,6 +767,7 @@ impl LlamaEngine {
             llama_split_mode: LlamaSplitModeArg::Layer,
             llama_main_gpu: 0,
             llama_devices: None,
+            gpu_placement: GpuPlacementArg::Manual,
             is_initialized: false,
             models_dir,
             loading_status: Arc::new(RwLock::new("not_loaded".to_string())),
@@ -635,6 +805,7 @@ impl LlamaEngine {
             llama_split_mode,
             llama_main_gpu,
             llama_devices,
+            gpu_placement: GpuPlacementArg::Manual,
             is_initialized: false,
             models_dir,
             loading_status: Arc::new(RwLock::new("not_loaded".to_string())),
@@ -649,6 +820,13 @@ impl LlamaEngine {
         }
     }
 
+    /// Choose `n_gpu_layers` and the GPUs from free VRAM at load time
+    /// instead of taking them from the configuration.
+    pub fn with_gpu_placement(mut self, gpu_placement: GpuPlacementArg) -> Self {
+        self.gpu_placement = gpu_placement;
+        self
+    }
+
     pub fn with_config(
         model_path: String,
         n_ctx: u32,
@@ -673,6 +851,7 @@ impl LlamaEngine {
             llama_split_mode,
             llama_main_gpu,
             llama_devices,
+            gpu_placement: GpuPlacementArg::Manual,
             is_initialized: false,
             models_dir,
             loading_status: Arc::new(RwLock::new("not_loaded".to_string())),
@@ -806,13 +985,13 @@ impl LlamaEngine {
                 return Err(anyhow!("Android: Model not loaded by SDK"));
             }
 
-            use crate::GLOBAL_CONTEXT_PTR;
-            use crate::GLOBAL_MODEL_PTR;
             use std::ffi::CString;
             use std::os::raw::c_char;
 
-            let model_ptr = GLOBAL_MODEL_PTR.load(std::sync::atomic::Ordering::SeqCst);
-            let context_ptr = GLOBAL_CONTEXT_PTR.load(std::sync::atomic::Ordering::SeqCst);
+            // Lease the serving model so a swap cannot free it mid-generation
+            let serving = crate::serving_model()
+                .ok_or_else(|| anyhow!("Android: Model not loaded by SDK"))?;
+            let (model_ptr, context_ptr) = (serving.model, serving.context);
 
             // Convert prompt to C string
             let prompt_cstr =
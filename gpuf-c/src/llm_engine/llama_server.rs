@@ -764,7 +764,7 @@ async fn require_api_key(
     Ok(next.run(req).await)
 }
 
-fn is_authorized(headers: &HeaderMap, expected: &str) -> bool {
+pub(crate) fn is_authorized(headers: &HeaderMap, expected: &str) -> bool {
     let bearer = headers
         .get(header::AUTHORIZATION)
         .and_then(|value| value.to_str().ok())
@@ -793,7 +793,7 @@ fn constant_time_eq(a: &[u8], b: &[u8]) -> bool {
     diff == 0
 }
 
-fn is_loopback_host(host: &str) -> bool {
+pub(crate) fn is_loopback_host(host: &str) -> bool {
     let normalized = host.trim().trim_matches('[').trim_matches(']');
     if normalized.eq_ignore_ascii_case("localhost") {
         return true;
@@ -1,4 +1,5 @@
 pub mod anthropic_server;
+pub mod gpu_placement;
 pub mod inference_service;
 #[cfg(not(target_os = "ios"))]
 pub mod llama_engine;
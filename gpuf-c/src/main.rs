@@ -115,7 +115,8 @@ async fn run_standalone_llama(mut args: Args) -> Result<()> {
         args.llama_split_mode.clone(),
         args.llama_main_gpu,
         args.llama_devices.clone(),
-    );
+    )
+    .with_gpu_placement(args.gpu_placement);
 
     engine.init().await?;
     engine.start_worker().await?;
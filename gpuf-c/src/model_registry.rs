@@ -0,0 +1,519 @@
+// ============================================================================
+// Resident model registry and context pool
+// ============================================================================
+//
+// Models are kept loaded (mmap'd) by path so switching back to a recently
+// used model does not pay the GGUF load again. Each resident model keeps a
+// small pool of released contexts that the next acquire reuses, KV cache
+// and resident prefix included. When a memory budget is set, idle models
+// are evicted least recently used first to make room for a new load.
+// Resident models are reported in the worker heartbeat so the scheduler can
+// prefer workers that already have the requested model loaded.
+// ============================================================================
+
+use std::ffi::{c_char, c_int};
+
+use crate::{context_options, llama_context};
+
+/// Released contexts kept per resident model for reuse.
+pub const MAX_POOLED_CONTEXTS: usize = 2;
+
+/// Bytes of an f16 KV cache holding `n_ctx` cells.
+fn kv_cache_bytes(n_ctx: u64, n_layer: u64, n_embd: u64, n_head: u64, n_head_kv: u64) -> u64 {
+    if n_head == 0 {
+        return 0;
+    }
+    let n_embd_kv = n_embd * n_head_kv / n_head;
+    // K and V, two bytes per element
+    2 * 2 * n_ctx * n_layer * n_embd_kv
+}
+
+/// Bytes of the KV cache that takes `f16_bytes` in f16 when K and V are
+/// stored as `type_k` and `type_v`.
+fn quantized_kv_bytes(f16_bytes: u64, type_k: c_int, type_v: c_int) -> u64 {
+    // Elements of either K or V
+    let elements = f16_bytes / 4;
+    [type_k, type_v]
+        .into_iter()
+        .map(|ty| {
+            let (num, den) = context_options::kv_element_bytes(ty);
+            elements * num / den
+        })
+        .sum()
+}
+
+#[derive(Debug, Clone, Copy)]
+struct Residency {
+    bytes: u64,
+    last_used: u64,
+    busy: bool,
+}
+
+/// Indices of the models to evict, least recently used first, so that
+/// `incoming` more bytes fit into `budget` (0 means unlimited). Busy models
+/// are never chosen, so the result may still exceed the budget.
+fn eviction_plan(resident: &[Residency], budget: u64, incoming: u64) -> Vec<usize> {
+    if budget == 0 {
+        return Vec::new();
+    }
+    let mut used = resident.iter().map(|r| r.bytes).sum::<u64>() + incoming;
+    let mut idle: Vec<usize> = (0..resident.len()).filter(|&i| !resident[i].busy).collect();
+    idle.sort_by_key(|&i| resident[i].last_used);
+
+    let mut plan = Vec::new();
+    for i in idle {
+        if used <= budget {
+            break;
+        }
+        used = used.saturating_sub(resident[i].bytes);
+        plan.push(i);
+    }
+    plan
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+mod engine {
+    use super::*;
+    use crate::{
+        chat_prompt, gpuf_load_model, llama_free, llama_get_model, llama_model, llama_model_free,
+        llama_model_n_embd, llama_model_n_head, llama_model_n_head_kv, llama_model_n_layer,
+        llama_model_size, llama_n_ctx, prefix_cache, warm_start,
+    };
+    use once_cell::sync::Lazy;
+    use std::collections::HashMap;
+    use std::ffi::CString;
+    use std::sync::Mutex;
+
+    struct ResidentModel {
+        path: String,
+        model: usize,
+        weight_bytes: u64,
+        /// KV cache estimate per context, known after the first context.
+        context_bytes: u64,
+        idle: Vec<usize>,
+        /// Contexts handed out, plus acquires still creating one.
+        leased: usize,
+        last_used: u64,
+    }
+
+    impl ResidentModel {
+        fn bytes(&self) -> u64 {
+            self.weight_bytes + self.context_bytes * (self.idle.len() + self.leased) as u64
+        }
+
+        fn residency(&self) -> Residency {
+            Residency {
+                bytes: self.bytes(),
+                last_used: self.last_used,
+                busy: self.leased > 0,
+            }
+        }
+
+        unsafe fn free(self) {
+            for ctx in self.idle {
+                let ctx = ctx as *mut llama_context;
+                prefix_cache::forget(ctx);
+                context_options::forget(ctx);
+                llama_free(ctx);
+            }
+            warm_start::forget_model(self.model as *mut llama_model);
+            chat_prompt::forget_model(self.model as *mut llama_model);
+            llama_model_free(self.model as *mut llama_model);
+            println!(
+                "🧹 Model evicted from registry ({} MB)",
+                self.weight_bytes >> 20
+            );
+        }
+    }
+
+    #[derive(Default)]
+    struct Registry {
+        models: Vec<ResidentModel>,
+        /// 0 = unlimited
+        budget: u64,
+        tick: u64,
+        /// leased context -> model pointer
+        leases: HashMap<usize, usize>,
+    }
+
+    impl Registry {
+        fn touch(&mut self, idx: usize) {
+            self.tick += 1;
+            self.models[idx].last_used = self.tick;
+        }
+
+        fn position(&self, model: usize) -> Option<usize> {
+            self.models.iter().position(|m| m.model == model)
+        }
+
+        /// Unlink the models that have to go for `incoming` bytes; the
+        /// caller frees them after dropping the lock.
+        fn make_room(&mut self, incoming: u64) -> Vec<ResidentModel> {
+            let resident: Vec<Residency> = self.models.iter().map(|m| m.residency()).collect();
+            let mut plan = eviction_plan(&resident, self.budget, incoming);
+            plan.sort_unstable_by(|a, b| b.cmp(a));
+            plan.into_iter().map(|i| self.models.remove(i)).collect()
+        }
+    }
+
+    static REGISTRY: Lazy<Mutex<Registry>> = Lazy::new(|| Mutex::new(Registry::default()));
+
+    fn lock() -> std::sync::MutexGuard<'static, Registry> {
+        REGISTRY.lock().unwrap_or_else(|p| p.into_inner())
+    }
+
+    unsafe fn free_all(evicted: Vec<ResidentModel>) {
+        for model in evicted {
+            model.free();
+        }
+    }
+
+    pub(crate) enum AcquireError {
+        Load,
+        Context,
+    }
+
+    /// Reserve a context of `path`'s model, loading the model if it is not
+    /// resident. Returns the model and an idle context if one was pooled.
+    unsafe fn reserve(path: &str) -> Result<(usize, Option<usize>), AcquireError> {
+        {
+            let mut registry = lock();
+            if let Some(idx) = registry.models.iter().position(|m| m.path == path) {
+                registry.touch(idx);
+                let entry = &mut registry.models[idx];
+                entry.leased += 1;
+                return Ok((entry.model, entry.idle.pop()));
+            }
+        }
+
+        // mmap'd weights are roughly the file size; use that to make room
+        // before loading.
+        let file_bytes = std::fs::metadata(path).map(|m| m.len()).unwrap_or(0);
+        let evicted = lock().make_room(file_bytes);
+        free_all(evicted);
+
+        let path_c = CString::new(path).map_err(|_| AcquireError::Load)?;
+        let model = gpuf_load_model(path_c.as_ptr());
+        if model.is_null() {
+            return Err(AcquireError::Load);
+        }
+
+        let mut registry = lock();
+        if registry.models.iter().any(|m| m.path == path) {
+            // Loaded concurrently by another caller; keep theirs.
+            drop(registry);
+            warm_start::forget_model(model);
+            chat_prompt::forget_model(model);
+            llama_model_free(model);
+            return reserve(path);
+        }
+        registry.tick += 1;
+        let last_used = registry.tick;
+        registry.models.push(ResidentModel {
+            path: path.to_string(),
+            model: model as usize,
+            weight_bytes: llama_model_size(model),
+            context_bytes: 0,
+            idle: Vec::new(),
+            leased: 1,
+            last_used,
+        });
+        Ok((model as usize, None))
+    }
+
+    fn unreserve(model: usize) {
+        let mut registry = lock();
+        if let Some(idx) = registry.position(model) {
+            registry.models[idx].leased -= 1;
+        }
+    }
+
+    /// Lease a context on the model at `path`, reusing a pooled one when
+    /// possible, and tell whether it came from the pool. The model stays
+    /// resident while any context is leased.
+    pub(crate) unsafe fn acquire(path: &str) -> Result<(*mut llama_context, bool), AcquireError> {
+        let (model, pooled) = reserve(path)?;
+        let reused = pooled.is_some();
+        let ctx = match pooled {
+            Some(ctx) => ctx as *mut llama_context,
+            None => {
+                let context_bytes = {
+                    let mut registry = lock();
+                    let idx = registry.position(model);
+                    let bytes = idx.map_or(0, |i| registry.models[i].context_bytes);
+                    let evicted = registry.make_room(bytes);
+                    drop(registry);
+                    free_all(evicted);
+                    bytes
+                };
+                let options = context_options::registry_options();
+                let ctx = context_options::create(model as *mut llama_model, &options);
+                if ctx.is_null() {
+                    unreserve(model);
+                    return Err(AcquireError::Context);
+                }
+                if context_bytes == 0 {
+                    let m = model as *const llama_model;
+                    let f16_bytes = kv_cache_bytes(
+                        llama_n_ctx(ctx).max(0) as u64,
+                        llama_model_n_layer(m).max(0) as u64,
+                        llama_model_n_embd(m).max(0) as u64,
+                        llama_model_n_head(m).max(0) as u64,
+                        llama_model_n_head_kv(m).max(0) as u64,
+                    );
+                    let bytes = quantized_kv_bytes(f16_bytes, options.type_k, options.type_v);
+                    let mut registry = lock();
+                    if let Some(idx) = registry.position(model) {
+                        registry.models[idx].context_bytes = bytes;
+                    }
+                }
+                ctx
+            }
+        };
+        lock().leases.insert(ctx as usize, model);
+        Ok((ctx, reused))
+    }
+
+    /// Return a leased context to its model's pool.
+    pub(crate) unsafe fn release(ctx: *mut llama_context) -> c_int {
+        let mut registry = lock();
+        let Some(model) = registry.leases.remove(&(ctx as usize)) else {
+            return -2;
+        };
+        debug_assert_eq!(llama_get_model(ctx) as usize, model);
+        let surplus = match registry.position(model) {
+            Some(idx) => {
+                let entry = &mut registry.models[idx];
+                entry.leased -= 1;
+                if entry.idle.len() < MAX_POOLED_CONTEXTS {
+                    entry.idle.push(ctx as usize);
+                    false
+                } else {
+                    true
+                }
+            }
+            None => true,
+        };
+        drop(registry);
+        if surplus {
+            prefix_cache::forget(ctx);
+            context_options::forget(ctx);
+            llama_free(ctx);
+        }
+        0
+    }
+
+    pub(super) unsafe fn evict(path: &str) -> c_int {
+        let mut registry = lock();
+        let Some(idx) = registry.models.iter().position(|m| m.path == path) else {
+            return -2;
+        };
+        if registry.models[idx].leased > 0 {
+            return -3;
+        }
+        let entry = registry.models.remove(idx);
+        drop(registry);
+        entry.free();
+        0
+    }
+
+    pub(super) unsafe fn set_budget(bytes: u64) {
+        let evicted = {
+            let mut registry = lock();
+            registry.budget = bytes;
+            registry.make_room(0)
+        };
+        free_all(evicted);
+    }
+
+    pub(super) fn resident_count() -> c_int {
+        lock().models.len() as c_int
+    }
+
+    /// Paths of the resident models, most recently used first.
+    pub(crate) fn resident_paths() -> Vec<String> {
+        let registry = lock();
+        let mut models: Vec<&ResidentModel> = registry.models.iter().collect();
+        models.sort_by(|a, b| b.last_used.cmp(&a.last_used));
+        models.into_iter().map(|m| m.path.clone()).collect()
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub(crate) use engine::{acquire, release, resident_paths, AcquireError};
+
+/// Paths of models this process keeps loaded, most recently used first.
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub(crate) fn resident_paths() -> Vec<String> {
+    crate::MODEL_STATUS
+        .lock()
+        .ok()
+        .filter(|s| s.is_loaded)
+        .and_then(|s| s.current_model.clone())
+        .into_iter()
+        .collect()
+}
+
+/// Limit the memory used by resident models and their contexts to
+/// `budget_mb` megabytes (0 = unlimited, the default). Idle models are
+/// evicted least recently used first, immediately and before later loads.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_model_registry_set_budget_mb(budget_mb: u64) {
+    // SAFETY: Only frees models and contexts the registry owns and that are
+    // not leased.
+    unsafe { engine::set_budget(budget_mb.saturating_mul(1 << 20)) }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_model_registry_set_budget_mb(_budget_mb: u64) {}
+
+/// Lease a context on the model at `path`, loading the model if it is not
+/// resident yet. A context released earlier is reused when available.
+///
+/// Returns null if the model cannot be loaded or no context can be created.
+/// Hand the context back with `gpuf_model_registry_release`; never free it
+/// or its model directly.
+///
+/// # Safety
+/// `path` must be a valid NUL-terminated string.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_model_registry_acquire(path: *const c_char) -> *mut llama_context {
+    if path.is_null() {
+        return std::ptr::null_mut();
+    }
+    // SAFETY: `path` was checked for null and must be NUL-terminated.
+    unsafe {
+        let Ok(path) = std::ffi::CStr::from_ptr(path).to_str() else {
+            return std::ptr::null_mut();
+        };
+        engine::acquire(path).map_or(std::ptr::null_mut(), |(ctx, _)| ctx)
+    }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_model_registry_acquire(_path: *const c_char) -> *mut llama_context {
+    std::ptr::null_mut()
+}
+
+/// Return a context leased with `gpuf_model_registry_acquire`. Destroy its
+/// sessions first. Returns 0 on success, -1 for a null context or -2 if
+/// `ctx` is not leased.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_model_registry_release(ctx: *mut llama_context) -> c_int {
+    if ctx.is_null() {
+        return -1;
+    }
+    // SAFETY: Only contexts found in the lease table are touched.
+    unsafe { engine::release(ctx) }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_model_registry_release(_ctx: *mut llama_context) -> c_int {
+    -1
+}
+
+/// Unload the model at `path` and its pooled contexts.
+///
+/// Returns 0 on success, -1 for an invalid path, -2 if the model is not
+/// resident and -3 while one of its contexts is leased.
+///
+/// # Safety
+/// `path` must be a valid NUL-terminated string.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_model_registry_evict(path: *const c_char) -> c_int {
+    if path.is_null() {
+        return -1;
+    }
+    // SAFETY: `path` was checked for null and must be NUL-terminated; only
+    // idle registry-owned models are freed.
+    unsafe {
+        match std::ffi::CStr::from_ptr(path).to_str() {
+            Ok(path) => engine::evict(path),
+            Err(_) => -1,
+        }
+    }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_model_registry_evict(_path: *const c_char) -> c_int {
+    -1
+}
+
+/// Number of models currently resident in the registry.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_model_registry_resident_count() -> c_int {
+    engine::resident_count()
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_model_registry_resident_count() -> c_int {
+    0
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn model(bytes: u64, last_used: u64, busy: bool) -> Residency {
+        Residency {
+            bytes,
+            last_used,
+            busy,
+        }
+    }
+
+    #[test]
+    fn evicts_least_recently_used_until_it_fits() {
+        let resident = [
+            model(40, 3, false),
+            model(30, 1, false),
+            model(20, 2, false),
+        ];
+        assert_eq!(eviction_plan(&resident, 100, 30), vec![1]);
+        assert_eq!(eviction_plan(&resident, 100, 70), vec![1, 2, 0]);
+        assert!(eviction_plan(&resident, 100, 10).is_empty());
+        assert!(eviction_plan(&resident, 0, 1000).is_empty());
+    }
+
+    #[test]
+    fn never_evicts_busy_models() {
+        let resident = [model(60, 1, true), model(30, 2, false)];
+        assert_eq!(eviction_plan(&resident, 50, 10), vec![1]);
+        assert_eq!(
+            eviction_plan(&[model(60, 1, true)], 50, 10),
+            Vec::<usize>::new()
+        );
+    }
+
+    #[test]
+    fn estimates_f16_kv_cache() {
+        // 7B-class: 32 layers, 4096 embd, 32 heads, 8 KV heads (GQA), 4k ctx
+        assert_eq!(kv_cache_bytes(4096, 32, 4096, 32, 8), 512 << 20);
+        assert_eq!(kv_cache_bytes(4096, 32, 4096, 0, 8), 0);
+    }
+
+    #[test]
+    fn quantized_kv_cache_shrinks() {
+        use context_options::{KV_CACHE_F16, KV_CACHE_Q4_0, KV_CACHE_Q8_0};
+        let f16 = 512 << 20;
+        assert_eq!(quantized_kv_bytes(f16, KV_CACHE_F16, KV_CACHE_F16), f16);
+        assert_eq!(
+            quantized_kv_bytes(f16, KV_CACHE_Q8_0, KV_CACHE_Q8_0),
+            272 << 20
+        );
+        assert_eq!(
+            quantized_kv_bytes(f16, KV_CACHE_Q8_0, KV_CACHE_Q4_0),
+            208 << 20
+        );
+    }
+}
@@ -0,0 +1,420 @@
+// ============================================================================
+// Per-request inference performance counters
+// ============================================================================
+//
+// Every completion run through `generate_streaming` or
+// `manual_llama_completion` records how long tokenization, prompt prefill
+// and decoding took, its time to first token, how much of the prompt came
+// from the KV prefix cache and how many KV cells the sequence holds
+// afterwards. The most recent request, rolling means over the last
+// `PERF_WINDOW` requests and the totals since the previous heartbeat are
+// kept here; the latter ride in `CommandV1::Heartbeat` so the server can
+// store them per day.
+// ============================================================================
+
+use std::ffi::c_int;
+use std::sync::Mutex;
+use std::time::{Duration, Instant};
+
+use common::InferenceStats;
+use serde::Serialize;
+
+/// Requests the rolling aggregate covers.
+pub const PERF_WINDOW: c_int = 32;
+
+/// Performance of one request, or an aggregate over several.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default, PartialEq, Serialize)]
+pub struct gpuf_perf_stats {
+    /// Requests covered: 1 for the last request, up to `PERF_WINDOW` for
+    /// the rolling aggregate.
+    pub requests: u64,
+    /// Duration of the most recent model load.
+    pub model_load_ms: f32,
+    pub tokenize_ms: f32,
+    pub prefill_ms: f32,
+    pub decode_ms: f32,
+    /// Time from the start of the request to the first sampled token.
+    pub ttft_ms: f32,
+    /// Generated tokens per second of decode time.
+    pub decode_tokens_per_second: f32,
+    pub prompt_tokens: u64,
+    /// Prompt tokens served from the KV cache instead of being prefilled.
+    pub prompt_tokens_reused: u64,
+    pub generated_tokens: u64,
+    /// KV cells held by the request's sequence when it finished.
+    pub kv_cells_used: u64,
+    /// Process resident set high-water mark.
+    pub peak_rss_bytes: u64,
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+struct Sample {
+    tokenize: Duration,
+    prefill: Duration,
+    decode: Duration,
+    ttft: Duration,
+    prompt_tokens: u64,
+    reused: u64,
+    generated: u64,
+    kv_cells: u64,
+}
+
+/// Running sums over a set of samples.
+#[derive(Debug, Clone, Copy, Default)]
+struct Totals {
+    requests: u64,
+    tokenize: Duration,
+    prefill: Duration,
+    decode: Duration,
+    ttft: Duration,
+    prompt_tokens: u64,
+    reused: u64,
+    generated: u64,
+}
+
+impl Totals {
+    fn add(&mut self, sample: &Sample) {
+        self.requests += 1;
+        self.tokenize += sample.tokenize;
+        self.prefill += sample.prefill;
+        self.decode += sample.decode;
+        self.ttft += sample.ttft;
+        self.prompt_tokens += sample.prompt_tokens;
+        self.reused += sample.reused;
+        self.generated += sample.generated;
+    }
+
+    fn mean_ms(&self, total: Duration) -> f32 {
+        if self.requests == 0 {
+            0.0
+        } else {
+            total.as_secs_f32() * 1000.0 / self.requests as f32
+        }
+    }
+
+    fn tokens_per_second(&self) -> f32 {
+        let seconds = self.decode.as_secs_f32();
+        if seconds > 0.0 {
+            self.generated as f32 / seconds
+        } else {
+            0.0
+        }
+    }
+}
+
+struct Perf {
+    /// Most recent samples, oldest first.
+    window: Vec<Sample>,
+    since_heartbeat: Totals,
+    model_load: Duration,
+}
+
+impl Perf {
+    const fn new() -> Self {
+        Self {
+            window: Vec::new(),
+            since_heartbeat: Totals {
+                requests: 0,
+                tokenize: Duration::ZERO,
+                prefill: Duration::ZERO,
+                decode: Duration::ZERO,
+                ttft: Duration::ZERO,
+                prompt_tokens: 0,
+                reused: 0,
+                generated: 0,
+            },
+            model_load: Duration::ZERO,
+        }
+    }
+
+    fn record(&mut self, sample: Sample) {
+        if self.window.len() == PERF_WINDOW as usize {
+            self.window.remove(0);
+        }
+        self.window.push(sample);
+        self.since_heartbeat.add(&sample);
+    }
+
+    fn stats(&self, totals: &Totals, kv_cells: u64, peak_rss: u64) -> gpuf_perf_stats {
+        gpuf_perf_stats {
+            requests: totals.requests,
+            model_load_ms: self.model_load.as_secs_f32() * 1000.0,
+            tokenize_ms: totals.mean_ms(totals.tokenize),
+            prefill_ms: totals.mean_ms(totals.prefill),
+            decode_ms: totals.mean_ms(totals.decode),
+            ttft_ms: totals.mean_ms(totals.ttft),
+            decode_tokens_per_second: totals.tokens_per_second(),
+            prompt_tokens: totals.prompt_tokens,
+            prompt_tokens_reused: totals.reused,
+            generated_tokens: totals.generated,
+            kv_cells_used: kv_cells,
+            peak_rss_bytes: peak_rss,
+        }
+    }
+
+    fn last(&self, peak_rss: u64) -> gpuf_perf_stats {
+        let mut totals = Totals::default();
+        let sample = self.window.last().copied().unwrap_or_default();
+        if !self.window.is_empty() {
+            totals.add(&sample);
+        }
+        self.stats(&totals, sample.kv_cells, peak_rss)
+    }
+
+    fn aggregate(&self, peak_rss: u64) -> gpuf_perf_stats {
+        let mut totals = Totals::default();
+        self.window.iter().for_each(|sample| totals.add(sample));
+        let kv_cells = self.window.last().map_or(0, |sample| sample.kv_cells);
+        self.stats(&totals, kv_cells, peak_rss)
+    }
+
+    /// Totals since the previous call, in the heartbeat's wire format.
+    fn take_heartbeat(&mut self, peak_rss: u64) -> Option<InferenceStats> {
+        if self.since_heartbeat.requests == 0 && self.model_load.is_zero() {
+            return None;
+        }
+        let totals = std::mem::take(&mut self.since_heartbeat);
+        Some(InferenceStats {
+            requests: totals.requests.min(u32::MAX as u64) as u32,
+            prompt_tokens: totals.prompt_tokens,
+            prompt_tokens_reused: totals.reused,
+            generated_tokens: totals.generated,
+            avg_tokenize_ms: totals.mean_ms(totals.tokenize),
+            avg_prefill_ms: totals.mean_ms(totals.prefill),
+            avg_decode_ms: totals.mean_ms(totals.decode),
+            avg_ttft_ms: totals.mean_ms(totals.ttft),
+            decode_tokens_per_sec: totals.tokens_per_second(),
+            model_load_ms: self.model_load.as_millis().min(u32::MAX as u128) as u32,
+            kv_cells_used: self.window.last().map_or(0, |sample| sample.kv_cells) as u32,
+            peak_rss_mb: (peak_rss >> 20) as u32,
+        })
+    }
+
+    fn reset(&mut self) {
+        self.window.clear();
+        self.since_heartbeat = Totals::default();
+    }
+}
+
+static PERF: Mutex<Perf> = Mutex::new(Perf::new());
+
+fn perf() -> std::sync::MutexGuard<'static, Perf> {
+    PERF.lock().unwrap_or_else(|poisoned| poisoned.into_inner())
+}
+
+/// Resident set high-water mark of this process in bytes, 0 if unknown.
+fn peak_rss_bytes() -> u64 {
+    #[cfg(unix)]
+    {
+        // SAFETY: `getrusage` only writes the zero-initialised struct.
+        let usage = unsafe {
+            let mut usage: libc::rusage = std::mem::zeroed();
+            if libc::getrusage(libc::RUSAGE_SELF, &mut usage) != 0 {
+                return 0;
+            }
+            usage
+        };
+        let max_rss = usage.ru_maxrss.max(0) as u64;
+        // Bytes on Apple platforms, kilobytes elsewhere
+        if cfg!(any(target_os = "macos", target_os = "ios")) {
+            max_rss
+        } else {
+            max_rss * 1024
+        }
+    }
+    #[cfg(not(unix))]
+    {
+        0
+    }
+}
+
+/// Phase timer of one completion request. Phases are marked in order; a
+/// request dropped without `finish` (e.g. a failed prefill) is not counted.
+pub(crate) struct RequestTimer {
+    start: Instant,
+    mark: Instant,
+    sample: Sample,
+    first_token: bool,
+}
+
+impl RequestTimer {
+    pub(crate) fn start() -> Self {
+        let now = Instant::now();
+        Self {
+            start: now,
+            mark: now,
+            sample: Sample::default(),
+            first_token: true,
+        }
+    }
+
+    fn lap(&mut self) -> Duration {
+        let now = Instant::now();
+        let elapsed = now - self.mark;
+        self.mark = now;
+        elapsed
+    }
+
+    pub(crate) fn tokenized(&mut self, prompt_tokens: usize) {
+        self.sample.tokenize = self.lap();
+        self.sample.prompt_tokens = prompt_tokens as u64;
+    }
+
+    pub(crate) fn prefilled(&mut self, reused: usize) {
+        self.sample.prefill = self.lap();
+        self.sample.reused = reused as u64;
+    }
+
+    /// A token was sampled; the first one fixes the time to first token.
+    pub(crate) fn token(&mut self) {
+        if self.first_token {
+            self.first_token = false;
+            self.sample.ttft = self.start.elapsed();
+        }
+    }
+
+    pub(crate) fn finish(mut self, generated: c_int, kv_cells_used: usize) {
+        self.sample.decode = self.lap();
+        self.sample.generated = generated.max(0) as u64;
+        self.sample.kv_cells = kv_cells_used as u64;
+        crate::perf_profile::observe(self.sample.generated, self.sample.decode);
+        perf().record(self.sample);
+    }
+}
+
+/// A model finished loading after `elapsed`.
+pub(crate) fn record_model_load(elapsed: Duration) {
+    perf().model_load = elapsed;
+}
+
+/// Counters of the most recent request.
+pub(crate) fn last() -> gpuf_perf_stats {
+    perf().last(peak_rss_bytes())
+}
+
+/// Inference totals since the previous heartbeat, None if nothing ran and no
+/// model was loaded.
+pub(crate) fn take_heartbeat_stats() -> Option<InferenceStats> {
+    perf().take_heartbeat(peak_rss_bytes())
+}
+
+/// Copy the counters of the most recent request into `stats`. Every field
+/// is 0 before the first request finishes.
+/// Returns 0 on success or -1 for a null `stats`.
+///
+/// # Safety
+/// `stats` must point to writable memory for one `gpuf_perf_stats`.
+#[no_mangle]
+pub extern "C" fn gpuf_perf_get_last(stats: *mut gpuf_perf_stats) -> c_int {
+    if stats.is_null() {
+        return -1;
+    }
+    // SAFETY: `stats` was checked for null; the caller guarantees it is
+    // writable.
+    unsafe { *stats = last() };
+    0
+}
+
+/// Copy means over the last `PERF_WINDOW` requests into `stats`: phase
+/// times and TTFT are per-request means, token counts are sums and
+/// `kv_cells_used` is that of the latest request.
+/// Returns 0 on success or -1 for a null `stats`.
+///
+/// # Safety
+/// `stats` must point to writable memory for one `gpuf_perf_stats`.
+#[no_mangle]
+pub extern "C" fn gpuf_perf_get_aggregate(stats: *mut gpuf_perf_stats) -> c_int {
+    if stats.is_null() {
+        return -1;
+    }
+    // SAFETY: `stats` was checked for null; the caller guarantees it is
+    // writable.
+    unsafe { *stats = perf().aggregate(peak_rss_bytes()) };
+    0
+}
+
+/// Forget recorded requests. The last model load time is kept.
+#[no_mangle]
+pub extern "C" fn gpuf_perf_reset() {
+    perf().reset();
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sample(prefill_ms: u64, decode_ms: u64, generated: u64) -> Sample {
+        Sample {
+            tokenize: Duration::from_millis(1),
+            prefill: Duration::from_millis(prefill_ms),
+            decode: Duration::from_millis(decode_ms),
+            ttft: Duration::from_millis(prefill_ms + 5),
+            prompt_tokens: 10,
+            reused: 4,
+            generated,
+            kv_cells: 10 + generated,
+        }
+    }
+
+    #[test]
+    fn last_and_aggregate_summarise_the_window() {
+        let mut perf = Perf::new();
+        assert_eq!(perf.last(0), gpuf_perf_stats::default());
+
+        perf.record(sample(10, 1000, 20));
+        perf.record(sample(30, 1000, 40));
+
+        let last = perf.last(7);
+        assert_eq!(last.requests, 1);
+        assert!((last.prefill_ms - 30.0).abs() < 0.01);
+        assert!((last.ttft_ms - 35.0).abs() < 0.01);
+        assert!((last.decode_tokens_per_second - 40.0).abs() < 0.01);
+        assert_eq!(last.kv_cells_used, 50);
+        assert_eq!(last.peak_rss_bytes, 7);
+
+        let aggregate = perf.aggregate(7);
+        assert_eq!(aggregate.requests, 2);
+        assert!((aggregate.prefill_ms - 20.0).abs() < 0.01);
+        assert!((aggregate.decode_tokens_per_second - 30.0).abs() < 0.01);
+        assert_eq!(aggregate.prompt_tokens, 20);
+        assert_eq!(aggregate.prompt_tokens_reused, 8);
+        assert_eq!(aggregate.generated_tokens, 60);
+    }
+
+    #[test]
+    fn window_keeps_the_latest_requests() {
+        let mut perf = Perf::new();
+        perf.record(sample(1000, 1000, 1));
+        for _ in 0..PERF_WINDOW {
+            perf.record(sample(10, 1000, 1));
+        }
+        let aggregate = perf.aggregate(0);
+        assert_eq!(aggregate.requests, PERF_WINDOW as u64);
+        assert!((aggregate.prefill_ms - 10.0).abs() < 0.01);
+    }
+
+    #[test]
+    fn heartbeat_takes_totals_since_the_previous_one() {
+        let mut perf = Perf::new();
+        assert_eq!(perf.take_heartbeat(0), None);
+
+        perf.model_load = Duration::from_millis(1500);
+        perf.record(sample(10, 500, 10));
+        perf.record(sample(30, 500, 10));
+        let stats = perf.take_heartbeat(3 << 20).unwrap();
+        assert_eq!(stats.requests, 2);
+        assert_eq!(stats.generated_tokens, 20);
+        assert!((stats.avg_prefill_ms - 20.0).abs() < 0.01);
+        assert!((stats.decode_tokens_per_sec - 20.0).abs() < 0.01);
+        assert_eq!(stats.model_load_ms, 1500);
+        assert_eq!(stats.peak_rss_mb, 3);
+
+        // Nothing new ran, the model stays loaded
+        let stats = perf.take_heartbeat(0).unwrap();
+        assert_eq!(stats.requests, 0);
+        assert_eq!(stats.generated_tokens, 0);
+        // The rolling window is unaffected
+        assert_eq!(perf.aggregate(0).requests, 2);
+    }
+}
@@ -0,0 +1,475 @@
+// ============================================================================
+// Thermal- and battery-aware performance profiles
+// ============================================================================
+//
+// Mobile workers used to decode with a fixed thread count until the OS
+// throttled the SoC and tokens/s collapsed mid-task. A profile chosen with
+// `gpuf_set_perf_profile` (max-throughput, sustained or battery) sets the
+// decode and batch thread counts and the prefill chunk size; before each
+// completion the engine re-reads the thermal and battery signals from
+// `util::system_info` (or those the app reported with
+// `gpuf_report_device_state`, the only source on iOS) and scales the
+// profile down as the device heats up or the battery runs low.
+//
+// Decode throughput of finished requests feeds an estimate of the tokens/s
+// the worker can sustain at its current limits, reported in the heartbeat
+// so the scheduler can steer work away from throttled devices. Model
+// weights stay on the CPU on mobile, so GPU offload is not part of a
+// profile.
+// ============================================================================
+
+use std::ffi::c_int;
+use std::sync::Mutex;
+use std::time::{Duration, Instant};
+
+use common::PerfCapacity;
+use serde::Serialize;
+
+pub const PERF_PROFILE_MAX_THROUGHPUT: c_int = 0;
+/// The default: the thread count workers always used, backed off when hot.
+pub const PERF_PROFILE_SUSTAINED: c_int = 1;
+pub const PERF_PROFILE_BATTERY: c_int = 2;
+
+/// How long a state reported by the app overrides the sensors.
+const REPORT_TTL: Duration = Duration::from_secs(120);
+/// Battery percentage below which a discharging device drops to the
+/// battery profile's limits.
+const LOW_BATTERY_PERCENT: u8 = 15;
+/// Requests shorter than this say little about decode speed.
+const MIN_OBSERVED_TOKENS: u64 = 8;
+
+/// Current profile, limits and sustainable throughput.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default, PartialEq, Serialize)]
+pub struct gpuf_perf_profile_status {
+    /// One of the `PERF_PROFILE_*` values.
+    pub profile: c_int,
+    /// 0 nominal, 1 light, 2 moderate, 3 severe.
+    pub thermal_level: c_int,
+    /// -1 when unknown.
+    pub battery_percent: c_int,
+    pub charging: c_int,
+    pub n_threads: c_int,
+    pub n_threads_batch: c_int,
+    /// Tokens per prefill `llama_decode`, 0 for the context's `n_batch`.
+    pub prefill_batch: c_int,
+    /// Non-zero while thermal or battery limits hold the engine below its
+    /// profile.
+    pub throttled: c_int,
+    /// Decode tokens/s expected at the current limits, 0 before the first
+    /// request.
+    pub sustainable_tokens_per_second: f32,
+}
+
+/// Signals a profile reacts to.
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+pub(crate) struct DeviceState {
+    /// 0 nominal, 1 light, 2 moderate, 3 severe.
+    pub thermal_level: u8,
+    pub battery_percent: Option<u8>,
+    pub charging: bool,
+}
+
+/// Engine settings for the next request.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub(crate) struct Limits {
+    pub n_threads: i32,
+    pub n_threads_batch: i32,
+    /// Prefill chunk, 0 for uncapped.
+    pub prefill_batch: i32,
+    pub throttled: bool,
+}
+
+impl Limits {
+    /// Tokens per prefill decode on a context with `n_batch`.
+    pub(crate) fn prefill_chunk(&self, n_batch: c_int) -> c_int {
+        if self.prefill_batch > 0 {
+            n_batch.min(self.prefill_batch)
+        } else {
+            n_batch
+        }
+    }
+}
+
+/// Thermal level of a CPU zone temperature.
+pub(crate) fn thermal_level_from_celsius(celsius: u32) -> u8 {
+    match celsius {
+        0..=44 => 0,
+        45..=54 => 1,
+        55..=64 => 2,
+        _ => 3,
+    }
+}
+
+fn profile_limits(profile: c_int, cores: i32) -> Limits {
+    let cores = cores.max(1);
+    let (threads, prefill_batch) = match profile {
+        PERF_PROFILE_MAX_THROUGHPUT => (cores.min(8), 0),
+        PERF_PROFILE_BATTERY => (cores.min(2), 32),
+        _ => (cores.min(crate::DEFAULT_LLAMA_THREADS), 0),
+    };
+    Limits {
+        n_threads: threads,
+        n_threads_batch: threads,
+        prefill_batch,
+        throttled: false,
+    }
+}
+
+/// Limits of `profile` on a device with `cores` CPUs in `state`: threads
+/// shrink by a quarter, half and three quarters at thermal levels 1-3,
+/// prefill chunks cap at 64 and 32 tokens from level 2, and a discharging
+/// device with a low battery gets at most the battery profile's limits.
+pub(crate) fn plan(profile: c_int, state: DeviceState, cores: i32) -> Limits {
+    let base = profile_limits(profile, cores);
+    let scale = |threads: i32| {
+        let scaled = match state.thermal_level {
+            0 => threads,
+            1 => threads * 3 / 4,
+            2 => threads / 2,
+            _ => threads / 4,
+        };
+        scaled.max(1)
+    };
+    let mut limits = Limits {
+        n_threads: scale(base.n_threads),
+        n_threads_batch: scale(base.n_threads_batch),
+        prefill_batch: base.prefill_batch,
+        throttled: false,
+    };
+    let thermal_cap = match state.thermal_level {
+        0 | 1 => 0,
+        2 => 64,
+        _ => 32,
+    };
+    limits.prefill_batch = min_cap(limits.prefill_batch, thermal_cap);
+
+    let low_battery = !state.charging
+        && state
+            .battery_percent
+            .is_some_and(|percent| percent < LOW_BATTERY_PERCENT);
+    if low_battery {
+        let battery = profile_limits(PERF_PROFILE_BATTERY, cores);
+        limits.n_threads = limits.n_threads.min(battery.n_threads);
+        limits.n_threads_batch = limits.n_threads_batch.min(battery.n_threads_batch);
+        limits.prefill_batch = min_cap(limits.prefill_batch, battery.prefill_batch);
+    }
+
+    limits.throttled = limits.n_threads < base.n_threads
+        || limits.n_threads_batch < base.n_threads_batch
+        || limits.prefill_batch != base.prefill_batch;
+    limits
+}
+
+/// The tighter of two prefill caps, 0 meaning uncapped.
+fn min_cap(a: i32, b: i32) -> i32 {
+    match (a, b) {
+        (0, cap) | (cap, 0) => cap,
+        (a, b) => a.min(b),
+    }
+}
+
+/// Decode throughput, smoothed over requests and normalized to the thread
+/// count it was measured with.
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+struct Throughput {
+    tokens_per_second: f32,
+    threads: i32,
+}
+
+impl Throughput {
+    const ALPHA: f32 = 0.3;
+
+    fn observe(&mut self, tokens_per_second: f32, threads: i32) {
+        if tokens_per_second <= 0.0 || threads <= 0 {
+            return;
+        }
+        self.tokens_per_second = if self.threads == 0 {
+            tokens_per_second
+        } else {
+            let previous = self.expected(threads);
+            previous + Self::ALPHA * (tokens_per_second - previous)
+        };
+        self.threads = threads;
+    }
+
+    /// Tokens/s at `threads`, assuming decode scales with the thread count
+    /// (an upper bound once memory bandwidth saturates).
+    fn expected(&self, threads: i32) -> f32 {
+        if self.threads == 0 {
+            return 0.0;
+        }
+        self.tokens_per_second * threads as f32 / self.threads as f32
+    }
+}
+
+struct ProfileState {
+    profile: c_int,
+    reported: Option<(DeviceState, Instant)>,
+    /// Limits of the request in flight or the last one.
+    limits: Option<Limits>,
+    throughput: Throughput,
+}
+
+static STATE: Mutex<ProfileState> = Mutex::new(ProfileState {
+    profile: PERF_PROFILE_SUSTAINED,
+    reported: None,
+    limits: None,
+    throughput: Throughput {
+        tokens_per_second: 0.0,
+        threads: 0,
+    },
+});
+
+fn state() -> std::sync::MutexGuard<'static, ProfileState> {
+    STATE.lock().unwrap_or_else(|p| p.into_inner())
+}
+
+fn cores() -> i32 {
+    std::thread::available_parallelism().map_or(1, |n| n.get() as i32)
+}
+
+/// Device state from the app's last report or, when that is stale, the
+/// sensors.
+fn sensed(reported: Option<(DeviceState, Instant)>) -> DeviceState {
+    if let Some((device, at)) = reported {
+        if at.elapsed() < REPORT_TTL {
+            return device;
+        }
+    }
+    #[cfg(target_os = "android")]
+    {
+        use crate::util::system_info::{read_battery_info, read_thermal_info};
+        let (battery_percent, charging) = read_battery_info()
+            .map_or((None, false), |(percent, charging)| {
+                (Some(percent), charging)
+            });
+        DeviceState {
+            thermal_level: read_thermal_info().map_or(0, thermal_level_from_celsius),
+            battery_percent,
+            charging,
+        }
+    }
+    #[cfg(not(target_os = "android"))]
+    DeviceState::default()
+}
+
+/// Limits for the next request under the current profile and signals.
+pub(crate) fn next_limits() -> Limits {
+    let (profile, reported) = {
+        let state = state();
+        (state.profile, state.reported)
+    };
+    let limits = plan(profile, sensed(reported), cores());
+    let mut state = state();
+    if state.limits.is_some_and(|previous| previous != limits) {
+        println!(
+            "🌡️ Perf profile {}: {} threads ({} batch), prefill chunk {}, throttled: {}",
+            profile,
+            limits.n_threads,
+            limits.n_threads_batch,
+            limits.prefill_batch,
+            limits.throttled
+        );
+    }
+    state.limits = Some(limits);
+    limits
+}
+
+/// A request finished decoding `generated` tokens in `decode`.
+pub(crate) fn observe(generated: u64, decode: Duration) {
+    let seconds = decode.as_secs_f32();
+    if generated < MIN_OBSERVED_TOKENS || seconds <= 0.0 {
+        return;
+    }
+    let mut state = state();
+    if let Some(limits) = state.limits {
+        state
+            .throughput
+            .observe(generated as f32 / seconds, limits.n_threads);
+    }
+}
+
+fn status() -> gpuf_perf_profile_status {
+    let (profile, reported, throughput) = {
+        let state = state();
+        (state.profile, state.reported, state.throughput)
+    };
+    let device = sensed(reported);
+    let limits = plan(profile, device, cores());
+    gpuf_perf_profile_status {
+        profile,
+        thermal_level: device.thermal_level as c_int,
+        battery_percent: device.battery_percent.map_or(-1, c_int::from),
+        charging: device.charging as c_int,
+        n_threads: limits.n_threads,
+        n_threads_batch: limits.n_threads_batch,
+        prefill_batch: limits.prefill_batch,
+        throttled: limits.throttled as c_int,
+        sustainable_tokens_per_second: throughput.expected(limits.n_threads),
+    }
+}
+
+/// Sustainable throughput for the heartbeat, None before the engine
+/// finished a request.
+pub(crate) fn heartbeat_capacity() -> Option<PerfCapacity> {
+    if state().throughput.threads == 0 {
+        return None;
+    }
+    let status = status();
+    Some(PerfCapacity {
+        profile: status.profile as u8,
+        throttled: status.throttled != 0,
+        thermal_level: status.thermal_level as u8,
+        sustainable_tokens_per_sec: status.sustainable_tokens_per_second,
+    })
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+mod engine {
+    use super::*;
+    use crate::{llama_context, llama_set_n_threads};
+
+    /// Apply the limits for the next request to `ctx` and return them.
+    pub(crate) unsafe fn prepare(ctx: *mut llama_context) -> Limits {
+        let limits = next_limits();
+        if !ctx.is_null() {
+            llama_set_n_threads(ctx, limits.n_threads, limits.n_threads_batch);
+        }
+        limits
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub(crate) use engine::prepare;
+
+/// Select a `PERF_PROFILE_*` profile for the following requests.
+/// Returns 0 on success or -1 for an unknown profile.
+#[no_mangle]
+pub extern "C" fn gpuf_set_perf_profile(profile: c_int) -> c_int {
+    if !(PERF_PROFILE_MAX_THROUGHPUT..=PERF_PROFILE_BATTERY).contains(&profile) {
+        return -1;
+    }
+    state().profile = profile;
+    0
+}
+
+/// Report device signals the SDK cannot read itself: `thermal_level` 0-3
+/// (map Android's `PowerManager` thermal status or iOS's
+/// `ProcessInfo.thermalState`), `battery_percent` 0-100 or -1 when unknown,
+/// and whether the device is charging. A report overrides the sensors for
+/// two minutes. Returns 0 on success or -1 for out-of-range values.
+#[no_mangle]
+pub extern "C" fn gpuf_report_device_state(
+    thermal_level: c_int,
+    battery_percent: c_int,
+    charging: c_int,
+) -> c_int {
+    if !(0..=3).contains(&thermal_level) || !(-1..=100).contains(&battery_percent) {
+        return -1;
+    }
+    let device = DeviceState {
+        thermal_level: thermal_level as u8,
+        battery_percent: u8::try_from(battery_percent).ok(),
+        charging: charging != 0,
+    };
+    state().reported = Some((device, Instant::now()));
+    0
+}
+
+/// Copy the current profile, the limits it yields under the latest device
+/// signals and the sustainable throughput into `status`.
+/// Returns 0 on success or -1 for a null `status`.
+///
+/// # Safety
+/// `status` must point to writable memory for one
+/// `gpuf_perf_profile_status`.
+#[no_mangle]
+pub unsafe extern "C" fn gpuf_get_perf_profile_status(
+    status: *mut gpuf_perf_profile_status,
+) -> c_int {
+    if status.is_null() {
+        return -1;
+    }
+    *status = self::status();
+    0
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn device(thermal_level: u8, battery: Option<u8>, charging: bool) -> DeviceState {
+        DeviceState {
+            thermal_level,
+            battery_percent: battery,
+            charging,
+        }
+    }
+
+    #[test]
+    fn profiles_back_off_as_the_device_heats_up() {
+        let cool = device(0, Some(80), false);
+        let sustained = plan(PERF_PROFILE_SUSTAINED, cool, 8);
+        assert_eq!((sustained.n_threads, sustained.prefill_batch), (4, 0));
+        assert!(!sustained.throttled);
+        assert_eq!(plan(PERF_PROFILE_MAX_THROUGHPUT, cool, 8).n_threads, 8);
+        assert_eq!(plan(PERF_PROFILE_BATTERY, cool, 8).prefill_batch, 32);
+
+        let levels: Vec<(i32, i32)> = (0..4)
+            .map(|level| {
+                let limits = plan(PERF_PROFILE_MAX_THROUGHPUT, device(level, None, false), 8);
+                (limits.n_threads, limits.prefill_batch)
+            })
+            .collect();
+        assert_eq!(levels, vec![(8, 0), (6, 0), (4, 64), (2, 32)]);
+        assert!(plan(PERF_PROFILE_MAX_THROUGHPUT, device(1, None, false), 8).throttled);
+        // Never below one thread
+        assert_eq!(
+            plan(PERF_PROFILE_BATTERY, device(3, None, false), 8).n_threads,
+            1
+        );
+    }
+
+    #[test]
+    fn low_battery_limits_unless_charging() {
+        let low = plan(PERF_PROFILE_MAX_THROUGHPUT, device(0, Some(10), false), 8);
+        assert_eq!(
+            (low.n_threads, low.prefill_batch, low.throttled),
+            (2, 32, true)
+        );
+        let charging = plan(PERF_PROFILE_MAX_THROUGHPUT, device(0, Some(10), true), 8);
+        assert_eq!((charging.n_threads, charging.throttled), (8, false));
+    }
+
+    #[test]
+    fn throughput_follows_the_thread_count() {
+        let mut throughput = Throughput::default();
+        assert_eq!(throughput.expected(4), 0.0);
+        throughput.observe(20.0, 4);
+        assert_eq!(throughput.expected(2), 10.0);
+        // Smoothed after rescaling the estimate to the new thread count
+        throughput.observe(4.0, 2);
+        assert!((throughput.expected(2) - 8.2).abs() < 1e-4);
+        assert_eq!(thermal_level_from_celsius(38), 0);
+        assert_eq!(thermal_level_from_celsius(70), 3);
+        assert_eq!(
+            Limits {
+                prefill_batch: 32,
+                ..low_limits()
+            }
+            .prefill_chunk(128),
+            32
+        );
+        assert_eq!(low_limits().prefill_chunk(128), 128);
+    }
+
+    fn low_limits() -> Limits {
+        Limits {
+            n_threads: 1,
+            n_threads_batch: 1,
+            prefill_batch: 0,
+            throttled: false,
+        }
+    }
+}
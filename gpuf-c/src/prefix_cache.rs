@@ -0,0 +1,325 @@
+// ============================================================================
+// Prompt-prefix KV cache reuse
+// ============================================================================
+//
+// The single-request entry points decode into sequence 0. Instead of clearing
+// that sequence before every request, we remember which tokens are resident
+// and only trim the KV cache back to the longest common prefix with the new
+// prompt, so a repeated system prompt or chat history is not prefilled again.
+// Named snapshots keep copies of sequence 0 (llama state save/restore) that
+// can be swapped back in later, e.g. one per conversation.
+// ============================================================================
+
+use std::ffi::{c_char, c_int};
+
+use crate::{llama_context, LlamaToken};
+
+/// Number of named prefix snapshots kept in memory; the oldest is evicted.
+pub const MAX_PREFIX_SNAPSHOTS: usize = 4;
+
+fn common_prefix_len(resident: &[LlamaToken], prompt: &[LlamaToken]) -> usize {
+    resident
+        .iter()
+        .zip(prompt)
+        .take_while(|(a, b)| a == b)
+        .count()
+}
+
+/// Tokens of `prompt` that can stay in the cache. The last prompt token is
+/// always decoded again so the request gets fresh logits to sample from.
+fn reusable_prefix(resident: &[LlamaToken], prompt: &[LlamaToken]) -> usize {
+    common_prefix_len(resident, prompt).min(prompt.len().saturating_sub(1))
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+mod engine {
+    use super::*;
+    use crate::{
+        llama_get_memory, llama_get_model, llama_memory_seq_rm, llama_state_seq_get_data,
+        llama_state_seq_get_size, llama_state_seq_set_data, LlamaPos,
+    };
+    use once_cell::sync::Lazy;
+    use std::collections::{HashMap, VecDeque};
+    use std::ffi::CStr;
+    use std::sync::Mutex;
+
+    #[derive(Default)]
+    struct ResidentSequence {
+        tokens: Vec<LlamaToken>,
+        last_reused: usize,
+    }
+
+    struct PrefixSnapshot {
+        name: String,
+        model: usize,
+        tokens: Vec<LlamaToken>,
+        state: Vec<u8>,
+    }
+
+    /// context pointer -> tokens resident in sequence 0
+    static RESIDENT: Lazy<Mutex<HashMap<usize, ResidentSequence>>> =
+        Lazy::new(|| Mutex::new(HashMap::new()));
+    static SNAPSHOTS: Lazy<Mutex<VecDeque<PrefixSnapshot>>> =
+        Lazy::new(|| Mutex::new(VecDeque::new()));
+
+    /// Trim sequence 0 of `ctx` to the prefix shared with `prompt` and return
+    /// the number of reused tokens, i.e. the position prefill starts from.
+    /// `None` means sequence 0 could not be cleared; the caller must not
+    /// decode into it.
+    pub(crate) unsafe fn prepare_sequence(
+        ctx: *mut llama_context,
+        prompt: &[LlamaToken],
+    ) -> Option<usize> {
+        let mut resident = RESIDENT.lock().unwrap_or_else(|p| p.into_inner());
+        let entry = resident.entry(ctx as usize).or_default();
+        let mut reused = reusable_prefix(&entry.tokens, prompt);
+
+        let kv = llama_get_memory(ctx);
+        if reused == 0 || !llama_memory_seq_rm(kv, 0, reused as LlamaPos, -1) {
+            // Partial removal is not supported by every memory type
+            // (recurrent models); fall back to a clean sequence. Clearing the
+            // whole memory instead would wipe the gpuf_session_* sequences.
+            if !llama_memory_seq_rm(kv, 0, -1, -1) {
+                println!("❌ KV sequence 0 could not be cleared; skipping prefix reuse");
+                resident.remove(&(ctx as usize));
+                return None;
+            }
+            reused = 0;
+        }
+
+        entry.tokens.truncate(reused);
+        entry.last_reused = reused;
+        Some(reused)
+    }
+
+    /// Record the tokens now decoded into sequence 0 of `ctx`.
+    pub(crate) fn record_sequence(ctx: *mut llama_context, tokens: &[LlamaToken]) {
+        let mut resident = RESIDENT.lock().unwrap_or_else(|p| p.into_inner());
+        let entry = resident.entry(ctx as usize).or_default();
+        entry.tokens.clear();
+        entry.tokens.extend_from_slice(tokens);
+    }
+
+    /// Sequence 0 of `ctx` was rewritten or the context is going away.
+    pub(crate) fn forget(ctx: *mut llama_context) {
+        let mut resident = RESIDENT.lock().unwrap_or_else(|p| p.into_inner());
+        resident.remove(&(ctx as usize));
+    }
+
+    pub(super) fn last_reused(ctx: *mut llama_context) -> c_int {
+        let resident = RESIDENT.lock().unwrap_or_else(|p| p.into_inner());
+        resident
+            .get(&(ctx as usize))
+            .map_or(0, |entry| entry.last_reused as c_int)
+    }
+
+    unsafe fn snapshot_name(name: *const c_char) -> Option<String> {
+        if name.is_null() {
+            return None;
+        }
+        CStr::from_ptr(name)
+            .to_str()
+            .ok()
+            .filter(|s| !s.is_empty())
+            .map(str::to_string)
+    }
+
+    pub(super) unsafe fn save(ctx: *mut llama_context, name: *const c_char) -> c_int {
+        let Some(name) = snapshot_name(name) else {
+            return -1;
+        };
+        if ctx.is_null() {
+            return -1;
+        }
+        save_named(ctx, name)
+    }
+
+    /// Snapshot sequence 0 of `ctx` as `name`; see `gpuf_prefix_snapshot_save`.
+    pub(crate) unsafe fn save_named(ctx: *mut llama_context, name: String) -> c_int {
+        let tokens = {
+            let resident = RESIDENT.lock().unwrap_or_else(|p| p.into_inner());
+            match resident.get(&(ctx as usize)) {
+                Some(entry) if !entry.tokens.is_empty() => entry.tokens.clone(),
+                _ => return -2,
+            }
+        };
+
+        let size = llama_state_seq_get_size(ctx, 0);
+        let mut state = vec![0u8; size];
+        if size == 0 || llama_state_seq_get_data(ctx, state.as_mut_ptr(), size, 0) != size {
+            println!("❌ Prefix snapshot '{}' could not be read", name);
+            return -3;
+        }
+
+        let mut snapshots = SNAPSHOTS.lock().unwrap_or_else(|p| p.into_inner());
+        snapshots.retain(|s| s.name != name);
+        while snapshots.len() >= MAX_PREFIX_SNAPSHOTS {
+            snapshots.pop_front();
+        }
+        println!(
+            "✅ Prefix snapshot '{}' saved ({} tokens, {} bytes)",
+            name,
+            tokens.len(),
+            state.len()
+        );
+        let n_tokens = tokens.len() as c_int;
+        snapshots.push_back(PrefixSnapshot {
+            name,
+            model: llama_get_model(ctx) as usize,
+            tokens,
+            state,
+        });
+        n_tokens
+    }
+
+    pub(super) unsafe fn restore(ctx: *mut llama_context, name: *const c_char) -> c_int {
+        let Some(name) = snapshot_name(name) else {
+            return -1;
+        };
+        if ctx.is_null() {
+            return -1;
+        }
+        let snapshots = SNAPSHOTS.lock().unwrap_or_else(|p| p.into_inner());
+        let Some(snapshot) = snapshots.iter().find(|s| s.name == name) else {
+            return -2;
+        };
+        if snapshot.model != llama_get_model(ctx) as usize {
+            return -4;
+        }
+
+        llama_memory_seq_rm(llama_get_memory(ctx), 0, -1, -1);
+        let read = llama_state_seq_set_data(ctx, snapshot.state.as_ptr(), snapshot.state.len(), 0);
+        if read == 0 {
+            println!("❌ Prefix snapshot '{}' could not be restored", name);
+            forget(ctx);
+            return -3;
+        }
+        record_sequence(ctx, &snapshot.tokens);
+        snapshot.tokens.len() as c_int
+    }
+
+    pub(super) unsafe fn drop_snapshot(name: *const c_char) -> c_int {
+        let Some(name) = snapshot_name(name) else {
+            return -1;
+        };
+        let mut snapshots = SNAPSHOTS.lock().unwrap_or_else(|p| p.into_inner());
+        let before = snapshots.len();
+        snapshots.retain(|s| s.name != name);
+        if snapshots.len() == before {
+            -2
+        } else {
+            0
+        }
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub(crate) use engine::{forget, prepare_sequence, record_sequence, save_named};
+
+/// Number of prompt tokens the last request on `ctx` reused from the KV
+/// cache instead of prefilling them again.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_prefix_reused_tokens(ctx: *mut llama_context) -> c_int {
+    if ctx.is_null() {
+        return -1;
+    }
+    engine::last_reused(ctx)
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_prefix_reused_tokens(_ctx: *mut llama_context) -> c_int {
+    -1
+}
+
+/// Save the tokens resident in sequence 0 of `ctx` as snapshot `name`,
+/// replacing an older snapshot of the same name. At most
+/// `MAX_PREFIX_SNAPSHOTS` are kept; the oldest is evicted first.
+///
+/// Returns the number of tokens saved, -1 for invalid arguments, -2 if
+/// nothing is resident and -3 if llama.cpp could not serialize the state.
+///
+/// # Safety
+/// `ctx` must be a live context not used for generation during the call and
+/// `name` a valid NUL-terminated string.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_prefix_snapshot_save(ctx: *mut llama_context, name: *const c_char) -> c_int {
+    // SAFETY: Pointer validity is part of the documented caller contract;
+    // null pointers are rejected inside.
+    unsafe { engine::save(ctx, name) }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_prefix_snapshot_save(
+    _ctx: *mut llama_context,
+    _name: *const c_char,
+) -> c_int {
+    -1
+}
+
+/// Replace sequence 0 of `ctx` with snapshot `name`, so the next request
+/// only prefills what follows the snapshot's tokens.
+///
+/// Returns the number of restored tokens, -1 for invalid arguments, -2 for
+/// an unknown snapshot, -3 if llama.cpp rejected the state and -4 if the
+/// snapshot was taken with a different model.
+///
+/// # Safety
+/// `ctx` must be a live context not used for generation during the call and
+/// `name` a valid NUL-terminated string.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_prefix_snapshot_restore(
+    ctx: *mut llama_context,
+    name: *const c_char,
+) -> c_int {
+    // SAFETY: Pointer validity is part of the documented caller contract;
+    // null pointers are rejected inside.
+    unsafe { engine::restore(ctx, name) }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_prefix_snapshot_restore(
+    _ctx: *mut llama_context,
+    _name: *const c_char,
+) -> c_int {
+    -1
+}
+
+/// Drop snapshot `name`. Returns 0 on success, -1 for an invalid name or -2
+/// if no such snapshot exists.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_prefix_snapshot_drop(name: *const c_char) -> c_int {
+    // SAFETY: `name` must be null or a valid NUL-terminated string.
+    unsafe { engine::drop_snapshot(name) }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_prefix_snapshot_drop(_name: *const c_char) -> c_int {
+    -1
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn reuses_longest_common_prefix() {
+        assert_eq!(reusable_prefix(&[1, 2, 3, 9], &[1, 2, 3, 4, 5]), 3);
+        assert_eq!(reusable_prefix(&[7, 2, 3], &[1, 2, 3]), 0);
+        assert_eq!(reusable_prefix(&[], &[1, 2]), 0);
+    }
+
+    #[test]
+    fn keeps_last_prompt_token_for_logits() {
+        assert_eq!(reusable_prefix(&[1, 2, 3, 4], &[1, 2, 3]), 2);
+        assert_eq!(reusable_prefix(&[1, 2, 3], &[1, 2, 3]), 2);
+        assert_eq!(reusable_prefix(&[1], &[]), 0);
+    }
+}
@@ -0,0 +1,720 @@
+// ============================================================================
+// Persistent samplers with a partial-selection fast path
+// ============================================================================
+//
+// Every request used to build a fresh llama.cpp sampler chain (penalties,
+// top-k, top-p, temperature, dist) and free it afterwards, and sampling each
+// token copied the full vocabulary into a candidate array that top-k/top-p
+// then sorted. With 150k-token vocabularies that sort is a visible share of
+// per-token time on CPU-only workers.
+//
+// The sampler here is a single llama.cpp sampler (`llama_sampler_init` with
+// our own interface) that applies the whole chain in one pass over the raw
+// logits: penalties touch only the recent tokens, top-k and top-p pick their
+// candidates with `select_nth_unstable` (top-p probes a growing prefix until
+// it covers the requested mass) and only the survivors are sorted. Chains
+// are pooled by parameters so the legacy entry points and sessions reuse
+// them, and `gpuf_sampler_create` hands out long-lived handles.
+// ============================================================================
+
+use std::cmp::Ordering;
+use std::collections::VecDeque;
+use std::ffi::c_int;
+
+use crate::LlamaToken;
+
+/// Number of recent tokens the repeat penalty looks back over.
+pub const REPEAT_PENALTY_WINDOW: usize = 64;
+
+/// Seed of samplers created from per-request parameters.
+const DEFAULT_SEED: u32 = 1234;
+
+/// Idle pooled samplers kept for reuse.
+const MAX_POOLED_SAMPLERS: usize = 8;
+
+/// First prefix probed for the top-p nucleus; grows 4x per miss.
+const TOP_P_PROBE: usize = 64;
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub(crate) struct SamplerParams {
+    pub temperature: f32,
+    pub top_k: c_int,
+    pub top_p: f32,
+    pub min_p: f32,
+    pub repeat_penalty: f32,
+    pub seed: u32,
+}
+
+impl SamplerParams {
+    /// Parameters of the legacy entry points (no min-p, fixed seed).
+    pub(crate) fn new(temperature: f32, top_k: c_int, top_p: f32, repeat_penalty: f32) -> Self {
+        Self {
+            temperature,
+            top_k,
+            top_p,
+            min_p: 0.0,
+            repeat_penalty,
+            seed: DEFAULT_SEED,
+        }
+    }
+}
+
+#[derive(Clone)]
+struct FastSampler {
+    params: SamplerParams,
+    rng: u64,
+    recent: VecDeque<LlamaToken>,
+    /// Working copy of the logits, indexed by candidate.
+    logits: Vec<f32>,
+    /// Candidate indices; after truncation the survivors, best first.
+    order: Vec<u32>,
+}
+
+impl FastSampler {
+    fn new(params: SamplerParams) -> Self {
+        Self {
+            params,
+            rng: params.seed as u64,
+            recent: VecDeque::with_capacity(REPEAT_PENALTY_WINDOW),
+            logits: Vec::new(),
+            order: Vec::new(),
+        }
+    }
+
+    fn reset(&mut self) {
+        self.rng = self.params.seed as u64;
+        self.recent.clear();
+    }
+
+    fn accept(&mut self, token: LlamaToken) {
+        if self.recent.len() == REPEAT_PENALTY_WINDOW {
+            self.recent.pop_front();
+        }
+        self.recent.push_back(token);
+    }
+
+    /// splitmix64, mapped to [0, 1)
+    fn next_uniform(&mut self) -> f32 {
+        self.rng = self.rng.wrapping_add(0x9e37_79b9_7f4a_7c15);
+        let mut z = self.rng;
+        z = (z ^ (z >> 30)).wrapping_mul(0xbf58_476d_1ce4_e5b9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94d0_49bb_1331_11eb);
+        z ^= z >> 31;
+        (z >> 40) as f32 / (1u64 << 24) as f32
+    }
+
+    /// llama.cpp repeat penalty: each distinct recent token once.
+    fn apply_penalties(&mut self, index_of: impl Fn(LlamaToken) -> Option<usize>) {
+        let penalty = self.params.repeat_penalty;
+        if penalty == 1.0 || penalty <= 0.0 {
+            return;
+        }
+        for (i, &token) in self.recent.iter().enumerate() {
+            if self.recent.iter().take(i).any(|&t| t == token) {
+                continue;
+            }
+            if let Some(logit) = index_of(token).and_then(|idx| self.logits.get_mut(idx)) {
+                if *logit <= 0.0 {
+                    *logit *= penalty;
+                } else {
+                    *logit /= penalty;
+                }
+            }
+        }
+    }
+
+    /// Leave the candidates surviving top-k, top-p and min-p in `order`,
+    /// best first. Returns false when nothing is truncated, in which case
+    /// `order` is untouched and every candidate stays eligible.
+    fn truncate(&mut self, max: f32) -> bool {
+        let SamplerParams {
+            top_k,
+            top_p,
+            min_p,
+            ..
+        } = self.params;
+        let n = self.logits.len();
+        let k = if top_k > 0 {
+            (top_k as usize).min(n)
+        } else {
+            n
+        };
+        let nucleus = top_p < 1.0;
+        if k == n && !nucleus && min_p <= 0.0 {
+            return false;
+        }
+
+        let logits = &self.logits;
+        let order = &mut self.order;
+        let best_first = |a: &u32, b: &u32| logits[*b as usize].total_cmp(&logits[*a as usize]);
+        order.clear();
+        order.extend(0..n as u32);
+
+        if k < n {
+            select_front(order, k, best_first);
+            order.truncate(k);
+        } else if !nucleus {
+            // min-p alone: keep everything within ln(min_p) of the maximum
+            let floor = max + min_p.ln();
+            order.retain(|&i| logits[i as usize] >= floor);
+            order.sort_unstable_by(best_first);
+        }
+
+        if nucleus {
+            // top-p renormalizes over whatever top-k left
+            // The nucleus edge sits among the smallest probabilities, so
+            // accumulate its mass in f64
+            let total: f64 = if k < n {
+                order
+                    .iter()
+                    .map(|&i| (logits[i as usize] - max).exp() as f64)
+                    .sum()
+            } else {
+                sum_exp(logits, max)
+            };
+            let target = top_p as f64 * total;
+            let mut probe = if k < n { k } else { TOP_P_PROBE.min(n) };
+            loop {
+                select_front(order, probe, best_first);
+                let mut mass = 0.0f64;
+                let cut = order[..probe].iter().position(|&i| {
+                    mass += (logits[i as usize] - max).exp() as f64;
+                    mass >= target
+                });
+                match cut {
+                    Some(last) => {
+                        order.truncate(last + 1);
+                        break;
+                    }
+                    None if probe == order.len() => break,
+                    None => probe = (probe * 4).min(order.len()),
+                }
+            }
+        }
+
+        if min_p > 0.0 && (k < n || nucleus) {
+            let floor = max + min_p.ln();
+            let keep = order
+                .iter()
+                .position(|&i| logits[i as usize] < floor)
+                .unwrap_or(order.len())
+                .max(1);
+            order.truncate(keep);
+        }
+        true
+    }
+
+    /// Pick a candidate from `logits` after penalties; `index_of` maps a
+    /// token id to its candidate index.
+    fn choose(&mut self, index_of: impl Fn(LlamaToken) -> Option<usize>) -> usize {
+        self.apply_penalties(index_of);
+        if self.params.temperature <= 0.0 {
+            return argmax(&self.logits);
+        }
+        let max = max_logit(&self.logits);
+        let inv_temp = 1.0 / self.params.temperature;
+        let draw = self.next_uniform();
+
+        if !self.truncate(max) {
+            let total = sum_exp_scaled(&self.logits, max, inv_temp);
+            let mut remaining = draw as f64 * total;
+            for (i, &logit) in self.logits.iter().enumerate() {
+                remaining -= ((logit - max) * inv_temp).exp() as f64;
+                if remaining <= 0.0 {
+                    return i;
+                }
+            }
+            return argmax(&self.logits);
+        }
+
+        let logits = &self.logits;
+        let weight = |i: u32| ((logits[i as usize] - max) * inv_temp).exp();
+        let total: f32 = self.order.iter().map(|&i| weight(i)).sum();
+        let mut remaining = draw * total;
+        for &i in &self.order {
+            remaining -= weight(i);
+            if remaining <= 0.0 {
+                return i as usize;
+            }
+        }
+        self.order[0] as usize
+    }
+}
+
+/// Move the `count` best candidates to the front of `order`, best first,
+/// without sorting the rest.
+fn select_front(order: &mut [u32], count: usize, cmp: impl Fn(&u32, &u32) -> Ordering + Copy) {
+    if count == 0 {
+        return;
+    }
+    if count < order.len() {
+        order.select_nth_unstable_by(count - 1, cmp);
+    }
+    order[..count].sort_unstable_by(cmp);
+}
+
+// The reductions keep eight independent accumulators so the compiler can
+// vectorize them instead of serializing on a single one.
+
+fn max_logit(logits: &[f32]) -> f32 {
+    let mut lanes = [f32::NEG_INFINITY; 8];
+    let chunks = logits.chunks_exact(8);
+    let tail = chunks.remainder();
+    for chunk in chunks {
+        for (lane, &x) in lanes.iter_mut().zip(chunk) {
+            if x > *lane {
+                *lane = x;
+            }
+        }
+    }
+    tail.iter()
+        .chain(lanes.iter())
+        .fold(f32::NEG_INFINITY, |m, &x| if x > m { x } else { m })
+}
+
+fn argmax(logits: &[f32]) -> usize {
+    let max = max_logit(logits);
+    logits.iter().position(|&x| x == max).unwrap_or(0)
+}
+
+fn sum_exp(logits: &[f32], max: f32) -> f64 {
+    sum_exp_scaled(logits, max, 1.0)
+}
+
+fn sum_exp_scaled(logits: &[f32], max: f32, scale: f32) -> f64 {
+    let mut lanes = [0.0f64; 8];
+    let chunks = logits.chunks_exact(8);
+    let tail = chunks.remainder();
+    for chunk in chunks {
+        for (lane, &x) in lanes.iter_mut().zip(chunk) {
+            *lane += ((x - max) * scale).exp() as f64;
+        }
+    }
+    tail.iter()
+        .map(|&x| ((x - max) * scale).exp() as f64)
+        .sum::<f64>()
+        + lanes.iter().sum::<f64>()
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+mod engine {
+    use super::*;
+    use crate::{
+        llama_context, llama_get_logits_ith, llama_get_model, llama_model_get_vocab, llama_sampler,
+        llama_sampler_free, llama_sampler_i, llama_sampler_init, llama_sampler_reset,
+        llama_sampler_sample, llama_token_data_array, llama_vocab_n_tokens,
+    };
+    use std::ffi::{c_char, c_void};
+    use std::sync::Mutex;
+
+    /// Public layout of `struct llama_sampler` in llama.h.
+    #[repr(C)]
+    struct SamplerHeader {
+        iface: *const llama_sampler_i,
+        ctx: *mut c_void,
+    }
+
+    static FAST_IFACE: llama_sampler_i = llama_sampler_i {
+        name: Some(fast_name),
+        accept: Some(fast_accept),
+        apply: Some(fast_apply),
+        reset: Some(fast_reset),
+        clone: Some(fast_clone),
+        free: Some(fast_free),
+        optional: [0; 4],
+    };
+
+    /// The fast sampler behind `smpl`, if it is one of ours.
+    unsafe fn fast<'a>(smpl: *const llama_sampler) -> Option<&'a mut FastSampler> {
+        let header = smpl as *const SamplerHeader;
+        if header.is_null() || !std::ptr::eq((*header).iface, &FAST_IFACE) {
+            return None;
+        }
+        ((*header).ctx as *mut FastSampler).as_mut()
+    }
+
+    unsafe extern "C" fn fast_name(_smpl: *const llama_sampler) -> *const c_char {
+        b"gpuf-fast\0".as_ptr() as *const c_char
+    }
+
+    unsafe extern "C" fn fast_accept(smpl: *mut llama_sampler, token: LlamaToken) {
+        if let Some(sampler) = fast(smpl) {
+            sampler.accept(token);
+        }
+    }
+
+    /// Chain/`llama_sampler_sample` path: pick from a prepared candidate
+    /// array. Our decode loops go through `sample` and skip this copy.
+    unsafe extern "C" fn fast_apply(smpl: *mut llama_sampler, cur_p: *mut llama_token_data_array) {
+        let (Some(sampler), Some(cur_p)) = (fast(smpl), cur_p.as_mut()) else {
+            return;
+        };
+        if cur_p.data.is_null() || cur_p.size == 0 {
+            return;
+        }
+        let data = std::slice::from_raw_parts(cur_p.data, cur_p.size);
+        sampler.logits.clear();
+        sampler.logits.extend(data.iter().map(|d| d.logit));
+        let chosen = sampler.choose(|token| {
+            let idx = token as usize;
+            if data.get(idx).is_some_and(|d| d.id == token) {
+                Some(idx)
+            } else {
+                data.iter().position(|d| d.id == token)
+            }
+        });
+        cur_p.selected = chosen as i64;
+    }
+
+    unsafe extern "C" fn fast_reset(smpl: *mut llama_sampler) {
+        if let Some(sampler) = fast(smpl) {
+            sampler.reset();
+        }
+    }
+
+    unsafe extern "C" fn fast_clone(smpl: *const llama_sampler) -> *mut llama_sampler {
+        match fast(smpl) {
+            Some(sampler) => wrap(sampler.clone()),
+            None => std::ptr::null_mut(),
+        }
+    }
+
+    unsafe extern "C" fn fast_free(smpl: *mut llama_sampler) {
+        let header = smpl as *mut SamplerHeader;
+        if !(*header).ctx.is_null() {
+            drop(Box::from_raw((*header).ctx as *mut FastSampler));
+            (*header).ctx = std::ptr::null_mut();
+        }
+    }
+
+    unsafe fn wrap(sampler: FastSampler) -> *mut llama_sampler {
+        let state = Box::into_raw(Box::new(sampler));
+        let smpl = llama_sampler_init(&FAST_IFACE, state as *mut c_void);
+        if smpl.is_null() {
+            drop(Box::from_raw(state));
+        }
+        smpl
+    }
+
+    pub(crate) fn create(params: SamplerParams) -> *mut llama_sampler {
+        // SAFETY: FAST_IFACE is 'static and the state box is owned by the
+        // new sampler until `fast_free`.
+        unsafe { wrap(FastSampler::new(params)) }
+    }
+
+    /// Sample a token from the logits at `idx` and accept it, like
+    /// `llama_sampler_sample`. Our samplers read the logits directly instead
+    /// of going through a full candidate array; other samplers fall back to
+    /// llama.cpp.
+    ///
+    /// # Safety
+    /// `smpl` and `ctx` must be live, with logits available at `idx`.
+    pub(crate) unsafe fn sample(
+        smpl: *mut llama_sampler,
+        ctx: *mut llama_context,
+        idx: c_int,
+    ) -> LlamaToken {
+        let Some(sampler) = fast(smpl) else {
+            return llama_sampler_sample(smpl, ctx, idx);
+        };
+        let logits = llama_get_logits_ith(ctx, idx);
+        let n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(llama_get_model(ctx)));
+        if logits.is_null() || n_vocab <= 0 {
+            return llama_sampler_sample(smpl, ctx, idx);
+        }
+        let n = n_vocab as usize;
+        sampler.logits.clear();
+        sampler
+            .logits
+            .extend_from_slice(std::slice::from_raw_parts(logits, n));
+        let token =
+            sampler.choose(|token| ((token as usize) < n).then_some(token as usize)) as LlamaToken;
+        sampler.accept(token);
+        token
+    }
+
+    struct Pooled {
+        params: SamplerParams,
+        sampler: usize,
+    }
+
+    static POOL: Mutex<Vec<Pooled>> = Mutex::new(Vec::new());
+
+    /// A pooled sampler; reset and returned to the pool on drop.
+    pub(crate) struct SamplerLease {
+        params: SamplerParams,
+        sampler: *mut llama_sampler,
+    }
+
+    // SAFETY: a lease is used by one request at a time; the sampler's state
+    // is only reached through it.
+    unsafe impl Send for SamplerLease {}
+
+    impl SamplerLease {
+        pub(crate) fn as_ptr(&self) -> *mut llama_sampler {
+            self.sampler
+        }
+    }
+
+    impl Drop for SamplerLease {
+        fn drop(&mut self) {
+            if self.sampler.is_null() {
+                return;
+            }
+            // SAFETY: the lease owns the sampler; resetting clears the
+            // penalty window and restarts the seed for the next request.
+            unsafe { llama_sampler_reset(self.sampler) };
+            let mut pool = POOL.lock().unwrap_or_else(|p| p.into_inner());
+            if pool.len() >= MAX_POOLED_SAMPLERS {
+                let oldest = pool.remove(0);
+                // SAFETY: pooled samplers are owned by the pool.
+                unsafe { llama_sampler_free(oldest.sampler as *mut llama_sampler) };
+            }
+            pool.push(Pooled {
+                params: self.params,
+                sampler: self.sampler as usize,
+            });
+        }
+    }
+
+    /// Lease a sampler for `params`, reusing an idle one when possible.
+    pub(crate) fn acquire(params: SamplerParams) -> SamplerLease {
+        let reused = {
+            let mut pool = POOL.lock().unwrap_or_else(|p| p.into_inner());
+            pool.iter()
+                .rposition(|p| p.params == params)
+                .map(|i| pool.remove(i).sampler as *mut llama_sampler)
+        };
+        SamplerLease {
+            params,
+            sampler: reused.unwrap_or_else(|| create(params)),
+        }
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub(crate) use engine::{acquire, sample, SamplerLease};
+
+/// Create a reusable sampler: repeat penalty over the last
+/// `REPEAT_PENALTY_WINDOW` tokens, then top-k (`top_k <= 0` disables),
+/// top-p (`>= 1` disables), min-p (`<= 0` disables) and temperature
+/// (`<= 0` samples greedily), drawing with `seed`.
+///
+/// The handle is a regular llama.cpp sampler: pass it to
+/// `gpuf_start_generation_with_sampler` or `gpuf_sampler_sample`, one
+/// request at a time. Its penalty window and random state carry over
+/// between requests until `gpuf_sampler_reset`. Free it with
+/// `gpuf_sampler_free`. Returns null on failure.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_sampler_create(
+    temperature: f32,
+    top_k: c_int,
+    top_p: f32,
+    min_p: f32,
+    repeat_penalty: f32,
+    seed: u32,
+) -> *mut crate::llama_sampler {
+    engine::create(SamplerParams {
+        temperature,
+        top_k,
+        top_p,
+        min_p,
+        repeat_penalty,
+        seed,
+    })
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_sampler_create(
+    _temperature: f32,
+    _top_k: c_int,
+    _top_p: f32,
+    _min_p: f32,
+    _repeat_penalty: f32,
+    _seed: u32,
+) -> *mut crate::llama_sampler {
+    std::ptr::null_mut()
+}
+
+/// Clear the penalty window and restart the random state of `sampler`.
+///
+/// # Safety
+/// `sampler` must come from `gpuf_sampler_create` and not be in use.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub unsafe extern "C" fn gpuf_sampler_reset(sampler: *mut crate::llama_sampler) {
+    if !sampler.is_null() {
+        crate::llama_sampler_reset(sampler);
+    }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub unsafe extern "C" fn gpuf_sampler_reset(_sampler: *mut crate::llama_sampler) {}
+
+/// Sample and accept a token from the logits of batch position `idx` of
+/// `ctx` (-1 for the last). Returns the token or -1 on invalid arguments.
+///
+/// # Safety
+/// `sampler` must be live and unused by other threads; `ctx` must hold
+/// logits for `idx`.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub unsafe extern "C" fn gpuf_sampler_sample(
+    sampler: *mut crate::llama_sampler,
+    ctx: *mut crate::llama_context,
+    idx: c_int,
+) -> LlamaToken {
+    if sampler.is_null() || ctx.is_null() {
+        return -1;
+    }
+    engine::sample(sampler, ctx, idx)
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub unsafe extern "C" fn gpuf_sampler_sample(
+    _sampler: *mut crate::llama_sampler,
+    _ctx: *mut crate::llama_context,
+    _idx: c_int,
+) -> LlamaToken {
+    -1
+}
+
+/// Free a sampler from `gpuf_sampler_create`.
+///
+/// # Safety
+/// `sampler` must not be used afterwards.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub unsafe extern "C" fn gpuf_sampler_free(sampler: *mut crate::llama_sampler) {
+    if !sampler.is_null() {
+        crate::llama_sampler_free(sampler);
+    }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub unsafe extern "C" fn gpuf_sampler_free(_sampler: *mut crate::llama_sampler) {}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sampler(temperature: f32, top_k: c_int, top_p: f32, min_p: f32) -> FastSampler {
+        FastSampler::new(SamplerParams {
+            temperature,
+            top_k,
+            top_p,
+            min_p,
+            repeat_penalty: 1.0,
+            seed: 7,
+        })
+    }
+
+    /// Distinct logits in [-5, 5), shuffled by a multiplicative permutation.
+    fn logits(n: usize) -> Vec<f32> {
+        (0..n)
+            .map(|i| ((i * 7919) % n) as f32 * 10.0 / n as f32 - 5.0)
+            .collect()
+    }
+
+    /// Survivors the llama.cpp chain would keep, by full sort.
+    fn reference(logits: &[f32], top_k: c_int, top_p: f32, min_p: f32) -> Vec<u32> {
+        let mut order: Vec<u32> = (0..logits.len() as u32).collect();
+        order.sort_by(|a, b| logits[*b as usize].total_cmp(&logits[*a as usize]));
+        if top_k > 0 {
+            order.truncate(top_k as usize);
+        }
+        let max = logits[order[0] as usize];
+        if top_p < 1.0 {
+            let weight = |i: u32| (logits[i as usize] - max).exp() as f64;
+            let total: f64 = order.iter().map(|&i| weight(i)).sum();
+            let mut mass = 0.0;
+            let keep = order
+                .iter()
+                .position(|&i| {
+                    mass += weight(i);
+                    mass >= top_p as f64 * total
+                })
+                .map_or(order.len(), |last| last + 1);
+            order.truncate(keep);
+        }
+        if min_p > 0.0 {
+            order.retain(|&i| logits[i as usize] >= max + min_p.ln());
+        }
+        order
+    }
+
+    #[test]
+    fn truncation_matches_full_sort() {
+        let values = logits(5000);
+        for &(top_k, top_p, min_p) in &[
+            (40, 1.0, 0.0),
+            (40, 0.9, 0.0),
+            (0, 0.9, 0.0),
+            (0, 0.999, 0.0),
+            (0, 1.0, 0.05),
+            (200, 0.95, 0.1),
+        ] {
+            let mut s = sampler(0.8, top_k, top_p, min_p);
+            s.logits = values.clone();
+            assert!(s.truncate(max_logit(&values)));
+            assert_eq!(s.order, reference(&values, top_k, top_p, min_p));
+        }
+
+        let mut s = sampler(0.8, 0, 1.0, 0.0);
+        s.logits = values;
+        assert!(!s.truncate(0.0));
+    }
+
+    #[test]
+    fn greedy_and_penalties() {
+        let mut s = sampler(0.0, 0, 1.0, 0.0);
+        s.params.repeat_penalty = 4.0;
+        s.logits = vec![0.5, 2.0, -1.0, 1.5];
+        assert_eq!(s.choose(|t| Some(t as usize)), 1);
+
+        // Token 1 is penalized below token 3 once it was just generated
+        s.accept(1);
+        s.accept(1);
+        s.logits = vec![0.5, 2.0, -1.0, 1.5];
+        assert_eq!(s.choose(|t| Some(t as usize)), 3);
+        assert_eq!(s.logits[1], 0.5);
+    }
+
+    #[test]
+    fn draws_are_seeded_and_stay_in_the_nucleus() {
+        let values = logits(2000);
+        let keep = reference(&values, 50, 0.8, 0.0);
+        let mut s = sampler(1.0, 50, 0.8, 0.0);
+        let mut first = Vec::new();
+        for _ in 0..32 {
+            s.logits = values.clone();
+            let chosen = s.choose(|_| None) as u32;
+            assert!(keep.contains(&chosen));
+            first.push(chosen);
+        }
+
+        s.reset();
+        let again: Vec<u32> = (0..32)
+            .map(|_| {
+                s.logits = values.clone();
+                s.choose(|_| None) as u32
+            })
+            .collect();
+        assert_eq!(first, again);
+        assert!(first.iter().any(|&c| c != first[0]));
+    }
+
+    #[test]
+    fn lane_reductions_cover_the_tail() {
+        let values: Vec<f32> = (0..19).map(|i| i as f32 * 0.25).collect();
+        assert_eq!(max_logit(&values), 4.5);
+        assert_eq!(argmax(&values), 18);
+        let expected: f64 = values.iter().map(|&x| (x - 4.5).exp() as f64).sum();
+        assert!((sum_exp(&values, 4.5) - expected).abs() < 1e-5);
+    }
+}
@@ -0,0 +1,787 @@
+// ============================================================================
+// Multi-sequence sessions with continuous batching
+// ============================================================================
+//
+// A session owns one llama.cpp sequence id inside a shared context. Every
+// submitted request becomes part of a per-context worker loop that packs the
+// next decode token of each generating session plus prompt chunks of newly
+// admitted sessions into a single `llama_decode` batch per iteration.
+// Cancellation is per session instead of the process-wide
+// `GENERATION_STOP_FLAG`.
+//
+// Sequence 0 is reserved for the legacy single-request entry points
+// (`gpuf_start_generation_async`, `gpuf_generate_with_sampling`), so sessions
+// use sequence ids 1..n_seq_max.
+// ============================================================================
+
+use std::ffi::{c_char, c_int, c_void};
+
+use crate::{CompletionCallback, TokenCallback};
+
+/// Upper bound on concurrent sessions per context (excluding sequence 0).
+pub const SESSION_MAX_SEQUENCES: u32 = 8;
+
+/// Scheduling state of one sequence, as seen by the batch planner.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+struct SequenceCursor {
+    prompt_len: usize,
+    /// Prompt tokens already decoded.
+    prefilled: usize,
+    /// Has a sampled token waiting to be decoded.
+    decoding: bool,
+}
+
+/// A contiguous run of tokens one sequence contributes to the next batch.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+struct BatchSlice {
+    sequence: usize,
+    /// Prompt offset for prefill slices; unused for decode slices.
+    start: usize,
+    len: usize,
+    decode: bool,
+    /// The last token of this slice needs logits.
+    wants_logits: bool,
+}
+
+/// Plan one iteration: decode steps go first so generating sessions keep
+/// their latency, then the remaining batch capacity is filled with prompt
+/// chunks in admission order.
+fn plan_batch(cursors: &[SequenceCursor], n_batch: usize) -> Vec<BatchSlice> {
+    let mut slices = Vec::new();
+    let mut budget = n_batch;
+
+    for (sequence, cursor) in cursors.iter().enumerate() {
+        if budget == 0 {
+            return slices;
+        }
+        if cursor.decoding {
+            slices.push(BatchSlice {
+                sequence,
+                start: 0,
+                len: 1,
+                decode: true,
+                wants_logits: true,
+            });
+            budget -= 1;
+        }
+    }
+
+    for (sequence, cursor) in cursors.iter().enumerate() {
+        if budget == 0 {
+            break;
+        }
+        if cursor.decoding || cursor.prefilled >= cursor.prompt_len {
+            continue;
+        }
+        let len = (cursor.prompt_len - cursor.prefilled).min(budget);
+        slices.push(BatchSlice {
+            sequence,
+            start: cursor.prefilled,
+            len,
+            decode: false,
+            wants_logits: cursor.prefilled + len == cursor.prompt_len,
+        });
+        budget -= len;
+    }
+
+    slices
+}
+
+/// Number of queued requests, taken in order, that fit next to `reserved`
+/// KV cells of running sequences in a cache of `n_ctx` cells. All sequences
+/// of a context share its cache, so each request reserves its prompt plus
+/// its generation limit. An idle context always takes the first request,
+/// which `submit` already capped to `n_ctx`.
+fn admissible(mut reserved: usize, queued: impl IntoIterator<Item = usize>, n_ctx: usize) -> usize {
+    let mut admitted = 0;
+    for cells in queued {
+        if reserved > 0 && reserved + cells > n_ctx {
+            break;
+        }
+        reserved += cells;
+        admitted += 1;
+    }
+    admitted
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+mod engine {
+    use super::*;
+    use crate::sampler::{SamplerLease, SamplerParams};
+    use crate::{
+        llama_batch, llama_batch_free, llama_batch_init, llama_context, llama_decode,
+        llama_get_memory, llama_get_model, llama_memory_seq_rm, llama_model_get_vocab,
+        llama_n_batch, llama_n_ctx, llama_n_seq_max, llama_token_to_piece, llama_vocab,
+        llama_vocab_is_eog, sampler, LlamaPos, LlamaSeqId, LlamaToken, Utf8EmitBuffer,
+        GLOBAL_INFERENCE_MUTEX,
+    };
+    use once_cell::sync::Lazy;
+    use std::collections::{HashMap, VecDeque};
+    use std::ffi::{CStr, CString};
+    use std::sync::atomic::{AtomicBool, AtomicI32, Ordering};
+    use std::sync::{Arc, Mutex};
+
+    static NEXT_SESSION_ID: AtomicI32 = AtomicI32::new(1);
+    static SESSIONS: Lazy<Mutex<SessionRegistry>> =
+        Lazy::new(|| Mutex::new(SessionRegistry::default()));
+
+    #[derive(Default)]
+    struct SessionRegistry {
+        contexts: HashMap<usize, ContextSessions>,
+        /// session id -> context key
+        owners: HashMap<c_int, usize>,
+    }
+
+    #[derive(Default)]
+    struct ContextSessions {
+        free_seqs: Vec<LlamaSeqId>,
+        slots: HashMap<c_int, SessionSlot>,
+        pending: VecDeque<SessionJob>,
+        worker_running: bool,
+    }
+
+    struct SessionSlot {
+        seq_id: LlamaSeqId,
+        cancel: Arc<AtomicBool>,
+        busy: bool,
+        /// Destroy requested while a request was running.
+        closing: bool,
+    }
+
+    /// A submitted request waiting to be admitted by the worker.
+    struct SessionJob {
+        session: c_int,
+        seq_id: LlamaSeqId,
+        cancel: Arc<AtomicBool>,
+        tokens: Vec<LlamaToken>,
+        limit: c_int,
+        sampler: SamplerLease,
+        on_token: TokenCallback,
+        on_complete: CompletionCallback,
+        user_data: *mut c_void,
+    }
+
+    // SAFETY: The sampler lease is owned by the job and only touched by the
+    // worker that admits it. `user_data` is opaque to us and handed back to the
+    // caller's callbacks, which the C API documents as running on the worker
+    // thread.
+    unsafe impl Send for SessionJob {}
+
+    impl SessionJob {
+        /// KV cells the request may occupy: its prompt plus its limit.
+        fn kv_cells(&self) -> usize {
+            self.tokens.len() + self.limit.max(0) as usize
+        }
+    }
+
+    struct ActiveSequence {
+        job: SessionJob,
+        prefilled: usize,
+        n_past: LlamaPos,
+        pending_token: Option<LlamaToken>,
+        logits_idx: Option<c_int>,
+        generated: c_int,
+        text: String,
+        utf8: Utf8EmitBuffer,
+    }
+
+    impl ActiveSequence {
+        fn new(job: SessionJob) -> Self {
+            Self {
+                job,
+                prefilled: 0,
+                n_past: 0,
+                pending_token: None,
+                logits_idx: None,
+                generated: 0,
+                text: String::new(),
+                utf8: Utf8EmitBuffer::new(),
+            }
+        }
+
+        fn cursor(&self) -> SequenceCursor {
+            SequenceCursor {
+                prompt_len: self.job.tokens.len(),
+                prefilled: self.prefilled,
+                decoding: self.pending_token.is_some(),
+            }
+        }
+
+        fn emit(&mut self, text: String, token: LlamaToken) {
+            if text.is_empty() {
+                return;
+            }
+            self.text.push_str(&text);
+            if let Some(callback) = self.job.on_token {
+                if let Ok(cstr) = CString::new(text) {
+                    callback(self.job.user_data, cstr.as_ptr(), token);
+                }
+            }
+        }
+    }
+
+    unsafe fn tokenize_prompt(vocab: *const llama_vocab, prompt: &CStr) -> Vec<LlamaToken> {
+        // Each request carries the whole conversation: `finish` drops the
+        // sequence's cells, so every turn is prefilled from position 0.
+        crate::chat_prompt::tokenize_prompt(vocab, &prompt.to_string_lossy())
+    }
+
+    pub(crate) unsafe fn batch_push(
+        batch: &mut llama_batch,
+        token: LlamaToken,
+        pos: LlamaPos,
+        seq_id: LlamaSeqId,
+        logits: bool,
+    ) -> c_int {
+        let i = batch.n_tokens as usize;
+        *batch.token.add(i) = token;
+        *batch.pos.add(i) = pos;
+        *batch.n_seq_id.add(i) = 1;
+        *(*batch.seq_id.add(i)) = seq_id;
+        *batch.logits.add(i) = logits as i8;
+        batch.n_tokens += 1;
+        i as c_int
+    }
+
+    pub(super) fn create(ctx: *mut llama_context) -> c_int {
+        if ctx.is_null() {
+            return -1;
+        }
+        let key = ctx as usize;
+        let mut registry = SESSIONS.lock().unwrap_or_else(|p| p.into_inner());
+        let sessions = registry.contexts.entry(key).or_insert_with(|| {
+            // SAFETY: `ctx` was checked for null and must be a live context.
+            let n_seq_max = unsafe { llama_n_seq_max(ctx) }.min(SESSION_MAX_SEQUENCES + 1);
+            ContextSessions {
+                free_seqs: (1..n_seq_max as LlamaSeqId).rev().collect(),
+                ..Default::default()
+            }
+        });
+        let Some(seq_id) = sessions.free_seqs.pop() else {
+            println!("⚠️ No free sequence for a new session (context {:p})", ctx);
+            return -2;
+        };
+        let session = NEXT_SESSION_ID.fetch_add(1, Ordering::SeqCst);
+        sessions.slots.insert(
+            session,
+            SessionSlot {
+                seq_id,
+                cancel: Arc::new(AtomicBool::new(false)),
+                busy: false,
+                closing: false,
+            },
+        );
+        registry.owners.insert(session, key);
+        println!("✅ Session {} created on sequence {}", session, seq_id);
+        session
+    }
+
+    #[allow(clippy::too_many_arguments)]
+    pub(super) fn submit(
+        session: c_int,
+        prompt: *const c_char,
+        max_tokens: c_int,
+        temperature: f32,
+        top_k: c_int,
+        top_p: f32,
+        repeat_penalty: f32,
+        on_token: TokenCallback,
+        on_complete: CompletionCallback,
+        user_data: *mut c_void,
+    ) -> c_int {
+        if prompt.is_null() || max_tokens <= 0 {
+            return -1;
+        }
+        let mut registry = SESSIONS.lock().unwrap_or_else(|p| p.into_inner());
+        let Some(&key) = registry.owners.get(&session) else {
+            return -2;
+        };
+        let ctx = key as *mut llama_context;
+        let Some(sessions) = registry.contexts.get_mut(&key) else {
+            return -2;
+        };
+        let Some(slot) = sessions.slots.get_mut(&session) else {
+            return -2;
+        };
+        if slot.busy || slot.closing {
+            return -3;
+        }
+
+        // SAFETY: `prompt` was checked for null and must be NUL-terminated.
+        // `ctx` is the live context the session was created on; tokenizing
+        // only reads the vocabulary.
+        let (tokens, n_ctx, sampler) = unsafe {
+            let vocab = llama_model_get_vocab(llama_get_model(ctx));
+            if vocab.is_null() {
+                return -1;
+            }
+            let tokens = tokenize_prompt(vocab, CStr::from_ptr(prompt));
+            (
+                tokens,
+                llama_n_ctx(ctx),
+                sampler::acquire(SamplerParams::new(
+                    temperature,
+                    top_k,
+                    top_p,
+                    repeat_penalty,
+                )),
+            )
+        };
+        if tokens.is_empty() || (tokens.len() as c_int) >= n_ctx || sampler.as_ptr().is_null() {
+            return -4;
+        }
+
+        slot.busy = true;
+        slot.cancel.store(false, Ordering::SeqCst);
+        sessions.pending.push_back(SessionJob {
+            session,
+            seq_id: slot.seq_id,
+            cancel: Arc::clone(&slot.cancel),
+            limit: max_tokens.min(n_ctx - tokens.len() as c_int),
+            tokens,
+            sampler,
+            on_token,
+            on_complete,
+            user_data,
+        });
+
+        if !sessions.worker_running {
+            sessions.worker_running = true;
+            std::thread::spawn(move || run_worker(key));
+        }
+        0
+    }
+
+    pub(super) fn cancel(session: c_int) -> c_int {
+        let registry = SESSIONS.lock().unwrap_or_else(|p| p.into_inner());
+        let slot = registry
+            .owners
+            .get(&session)
+            .and_then(|key| registry.contexts.get(key))
+            .and_then(|sessions| sessions.slots.get(&session));
+        match slot {
+            Some(slot) => {
+                slot.cancel.store(true, Ordering::SeqCst);
+                0
+            }
+            None => -2,
+        }
+    }
+
+    pub(super) fn destroy(session: c_int) -> c_int {
+        let mut registry = SESSIONS.lock().unwrap_or_else(|p| p.into_inner());
+        let Some(key) = registry.owners.get(&session).copied() else {
+            return -2;
+        };
+        let Some(sessions) = registry.contexts.get_mut(&key) else {
+            return -2;
+        };
+        let Some(slot) = sessions.slots.get_mut(&session) else {
+            return -2;
+        };
+        if slot.busy {
+            // The worker releases the sequence once the request winds down.
+            slot.cancel.store(true, Ordering::SeqCst);
+            slot.closing = true;
+            return 0;
+        }
+        let seq_id = slot.seq_id;
+        sessions.slots.remove(&session);
+        sessions.free_seqs.push(seq_id);
+        registry.owners.remove(&session);
+        0
+    }
+
+    /// Sequence ids of `ctx` above 0 that hold no session KV cells: every
+    /// sequence without a request in flight. The caller must hold
+    /// `GLOBAL_INFERENCE_MUTEX` and remove its own cells from them again
+    /// before releasing it, since the session worker only decodes under it.
+    pub(crate) unsafe fn idle_sequences(ctx: *mut llama_context) -> Vec<LlamaSeqId> {
+        let registry = SESSIONS.lock().unwrap_or_else(|p| p.into_inner());
+        let busy: Vec<LlamaSeqId> = registry
+            .contexts
+            .get(&(ctx as usize))
+            .map(|sessions| {
+                sessions
+                    .slots
+                    .values()
+                    .filter(|slot| slot.busy)
+                    .map(|slot| slot.seq_id)
+                    .collect()
+            })
+            .unwrap_or_default();
+        (1..llama_n_seq_max(ctx) as LlamaSeqId)
+            .filter(|seq_id| !busy.contains(seq_id))
+            .collect()
+    }
+
+    /// Deliver the remaining text, drop the sequence's KV cells and make the
+    /// session available again (or release it if a destroy is pending).
+    unsafe fn finish(ctx: *mut llama_context, key: usize, mut seq: ActiveSequence) {
+        let tail = seq.utf8.flush_lossy();
+        seq.emit(tail, -1);
+        {
+            let _lock = GLOBAL_INFERENCE_MUTEX
+                .lock()
+                .unwrap_or_else(|p| p.into_inner());
+            llama_memory_seq_rm(llama_get_memory(ctx), seq.job.seq_id, -1, -1);
+        }
+
+        {
+            let mut registry = SESSIONS.lock().unwrap_or_else(|p| p.into_inner());
+            let mut released = false;
+            if let Some(sessions) = registry.contexts.get_mut(&key) {
+                if let Some(slot) = sessions.slots.get_mut(&seq.job.session) {
+                    slot.busy = false;
+                    if slot.closing {
+                        sessions.slots.remove(&seq.job.session);
+                        sessions.free_seqs.push(seq.job.seq_id);
+                        released = true;
+                    }
+                }
+            }
+            if released {
+                registry.owners.remove(&seq.job.session);
+            }
+        }
+
+        println!(
+            "✅ Session {} finished ({} tokens{})",
+            seq.job.session,
+            seq.generated,
+            if seq.job.cancel.load(Ordering::SeqCst) {
+                ", cancelled"
+            } else {
+                ""
+            }
+        );
+        if let Some(callback) = seq.job.on_complete {
+            let text = CString::new(std::mem::take(&mut seq.text)).unwrap_or_default();
+            callback(seq.job.user_data, text.as_ptr(), seq.generated);
+        }
+    }
+
+    fn run_worker(key: usize) {
+        let ctx = key as *mut llama_context;
+        // SAFETY: Sessions keep the context alive while the worker runs: the
+        // worker exits as soon as no request is pending or running, and
+        // callers must destroy their sessions before freeing the context. The
+        // batch is allocated for `n_batch` single-sequence tokens and every
+        // push stays within the plan produced for that capacity.
+        unsafe {
+            let vocab = llama_model_get_vocab(llama_get_model(ctx));
+            let n_batch = llama_n_batch(ctx).max(1);
+            let n_ctx = llama_n_ctx(ctx).max(1) as usize;
+            let mut batch = llama_batch_init(n_batch, 0, 1);
+            let mut running: Vec<ActiveSequence> = Vec::new();
+            println!("🚀 Session worker started (context {:p})", ctx);
+
+            loop {
+                {
+                    let mut registry = SESSIONS.lock().unwrap_or_else(|p| p.into_inner());
+                    let Some(sessions) = registry.contexts.get_mut(&key) else {
+                        break;
+                    };
+                    // Requests that would overflow the shared KV cache wait
+                    // until running ones finish.
+                    let reserved = running.iter().map(|seq| seq.job.kv_cells()).sum();
+                    let admitted = admissible(
+                        reserved,
+                        sessions.pending.iter().map(SessionJob::kv_cells),
+                        n_ctx,
+                    );
+                    running.extend(sessions.pending.drain(..admitted).map(ActiveSequence::new));
+                    if running.is_empty() {
+                        sessions.worker_running = false;
+                        break;
+                    }
+                }
+
+                let (cancelled, active): (Vec<_>, Vec<_>) = running
+                    .drain(..)
+                    .partition(|seq| seq.job.cancel.load(Ordering::SeqCst));
+                running = active;
+                for seq in cancelled {
+                    finish(ctx, key, seq);
+                }
+                if running.is_empty() {
+                    continue;
+                }
+
+                let cursors: Vec<SequenceCursor> = running.iter().map(|s| s.cursor()).collect();
+                batch.n_tokens = 0;
+                for slice in plan_batch(&cursors, n_batch as usize) {
+                    let seq = &mut running[slice.sequence];
+                    if slice.decode {
+                        let token = seq.pending_token.take().unwrap_or_default();
+                        let idx = batch_push(&mut batch, token, seq.n_past, seq.job.seq_id, true);
+                        seq.logits_idx = Some(idx);
+                        seq.n_past += 1;
+                        continue;
+                    }
+                    for i in 0..slice.len {
+                        let token = seq.job.tokens[slice.start + i];
+                        let logits = slice.wants_logits && i + 1 == slice.len;
+                        let idx = batch_push(&mut batch, token, seq.n_past, seq.job.seq_id, logits);
+                        if logits {
+                            seq.logits_idx = Some(idx);
+                        }
+                        seq.n_past += 1;
+                    }
+                    seq.prefilled += slice.len;
+                }
+
+                // Sampling reads the logits buffer of `ctx`, which the next
+                // decode on the same context (legacy sequence-0 paths
+                // included) overwrites, so it happens under the same lock.
+                let sampled: Result<Vec<Option<LlamaToken>>, c_int> = {
+                    let _lock = GLOBAL_INFERENCE_MUTEX
+                        .lock()
+                        .unwrap_or_else(|p| p.into_inner());
+                    let result = llama_decode(ctx, batch.clone());
+                    if result != 0 {
+                        Err(result)
+                    } else {
+                        Ok(running
+                            .iter_mut()
+                            .map(|seq| {
+                                seq.logits_idx
+                                    .take()
+                                    .map(|idx| sampler::sample(seq.job.sampler.as_ptr(), ctx, idx))
+                            })
+                            .collect())
+                    }
+                };
+                let sampled = match sampled {
+                    Ok(sampled) => sampled,
+                    Err(result) => {
+                        println!(
+                            "❌ Session batch decode failed: {} ({} tokens, {} sessions)",
+                            result,
+                            batch.n_tokens,
+                            running.len()
+                        );
+                        for seq in running.drain(..) {
+                            finish(ctx, key, seq);
+                        }
+                        continue;
+                    }
+                };
+
+                let mut still_running = Vec::with_capacity(running.len());
+                for (mut seq, token) in running.drain(..).zip(sampled) {
+                    let Some(token) = token else {
+                        still_running.push(seq);
+                        continue;
+                    };
+                    if llama_vocab_is_eog(vocab, token) {
+                        finish(ctx, key, seq);
+                        continue;
+                    }
+                    seq.generated += 1;
+
+                    let mut piece = [0u8; 64];
+                    let len = llama_token_to_piece(
+                        vocab,
+                        token,
+                        piece.as_mut_ptr() as *mut c_char,
+                        piece.len() as c_int,
+                        0,
+                        false,
+                    );
+                    if len > 0 {
+                        let text = seq
+                            .utf8
+                            .push_and_take_valid(&piece[..(len as usize).min(piece.len())]);
+                        seq.emit(text, token);
+                    }
+
+                    if seq.generated >= seq.job.limit {
+                        finish(ctx, key, seq);
+                    } else {
+                        seq.pending_token = Some(token);
+                        still_running.push(seq);
+                    }
+                }
+                running = still_running;
+            }
+
+            llama_batch_free(batch);
+            println!("🛑 Session worker stopped (context {:p})", ctx);
+        }
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub(crate) use engine::{batch_push, idle_sequences};
+
+/// Create a generation session on `ctx`.
+///
+/// Each session owns one sequence of the context's KV cache, so up to
+/// `n_seq_max - 1` sessions can generate concurrently; their decode steps are
+/// merged into one `llama_decode` batch per iteration.
+///
+/// Returns a positive session id, -1 for an invalid context or -2 when every
+/// sequence of the context is already taken.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_session_create(ctx: *mut crate::llama_context) -> c_int {
+    engine::create(ctx)
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_session_create(_ctx: *mut crate::llama_context) -> c_int {
+    -1
+}
+
+/// Queue a prompt on `session` and return immediately.
+///
+/// `on_token` receives `(user_data, text, token_id)` for every emitted UTF-8
+/// chunk and `on_complete` receives `(user_data, full_text, token_count)` once
+/// the request ends. Both run on the context's session worker thread.
+///
+/// The context's KV cache is shared by its sessions: a request whose prompt
+/// plus `max_tokens` does not fit next to the running ones waits until they
+/// finish.
+///
+/// Returns 0 on success, -1 for invalid arguments, -2 for an unknown session,
+/// -3 if the session already has a request in flight and -4 if the prompt
+/// cannot be tokenized or does not fit the context.
+///
+/// # Safety
+/// `prompt` must be a valid NUL-terminated string for the duration of this
+/// call. `user_data` must stay valid until `on_complete` has been called.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_session_submit(
+    session: c_int,
+    prompt: *const c_char,
+    max_tokens: c_int,
+    temperature: f32,
+    top_k: c_int,
+    top_p: f32,
+    repeat_penalty: f32,
+    on_token: TokenCallback,
+    on_complete: CompletionCallback,
+    user_data: *mut c_void,
+) -> c_int {
+    engine::submit(
+        session,
+        prompt,
+        max_tokens,
+        temperature,
+        top_k,
+        top_p,
+        repeat_penalty,
+        on_token,
+        on_complete,
+        user_data,
+    )
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_session_submit(
+    _session: c_int,
+    _prompt: *const c_char,
+    _max_tokens: c_int,
+    _temperature: f32,
+    _top_k: c_int,
+    _top_p: f32,
+    _repeat_penalty: f32,
+    _on_token: TokenCallback,
+    _on_complete: CompletionCallback,
+    _user_data: *mut c_void,
+) -> c_int {
+    -1
+}
+
+/// Cancel the request running on `session`. Other sessions on the same
+/// context keep generating; `on_complete` still fires with the partial text.
+///
+/// Returns 0 on success or -2 for an unknown session.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_session_cancel(session: c_int) -> c_int {
+    engine::cancel(session)
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_session_cancel(_session: c_int) -> c_int {
+    -2
+}
+
+/// Release `session` and its sequence. A request still in flight is
+/// cancelled and the sequence is freed after its `on_complete` callback.
+///
+/// Returns 0 on success or -2 for an unknown session.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_session_destroy(session: c_int) -> c_int {
+    engine::destroy(session)
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_session_destroy(_session: c_int) -> c_int {
+    -2
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn prefill(prompt_len: usize, prefilled: usize) -> SequenceCursor {
+        SequenceCursor {
+            prompt_len,
+            prefilled,
+            decoding: false,
+        }
+    }
+
+    fn decoding() -> SequenceCursor {
+        SequenceCursor {
+            prompt_len: 4,
+            prefilled: 4,
+            decoding: true,
+        }
+    }
+
+    #[test]
+    fn decode_steps_are_scheduled_before_prefill() {
+        let plan = plan_batch(&[prefill(10, 0), decoding(), decoding()], 8);
+        assert_eq!(plan.len(), 3);
+        assert!(plan[0].decode && plan[0].sequence == 1);
+        assert!(plan[1].decode && plan[1].sequence == 2);
+        assert_eq!((plan[2].sequence, plan[2].start, plan[2].len), (0, 0, 6));
+        assert!(!plan[2].wants_logits);
+    }
+
+    #[test]
+    fn prefill_requests_logits_only_on_last_prompt_chunk() {
+        let plan = plan_batch(&[prefill(10, 6)], 8);
+        assert_eq!(plan.len(), 1);
+        assert_eq!((plan[0].start, plan[0].len), (6, 4));
+        assert!(plan[0].wants_logits);
+    }
+
+    #[test]
+    fn admission_keeps_reserved_cells_within_the_cache() {
+        assert_eq!(admissible(0, [300, 300, 300], 1024), 3);
+        assert_eq!(admissible(0, [300, 300, 300, 300], 1024), 3);
+        assert_eq!(admissible(800, [300, 100], 1024), 0);
+        // An idle context always takes the head of the queue.
+        assert_eq!(admissible(0, [1024, 1], 1024), 1);
+        assert_eq!(admissible(0, [], 1024), 0);
+    }
+
+    #[test]
+    fn batch_capacity_is_never_exceeded() {
+        let plan = plan_batch(&[decoding(), prefill(100, 0), prefill(100, 0)], 16);
+        let total: usize = plan.iter().map(|s| s.len).sum();
+        assert_eq!(total, 16);
+        assert_eq!(plan.len(), 2);
+    }
+}
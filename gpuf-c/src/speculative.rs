@@ -0,0 +1,584 @@
+// ============================================================================
+// Speculative decoding with a draft model
+// ============================================================================
+//
+// A small draft model sharing the target's vocabulary proposes up to
+// `n_draft` tokens greedily; the target then decodes the pending token plus
+// all proposals in one `llama_decode` batch and samples every position with
+// its own sampler chain. Proposals are accepted while they match what the
+// target sampled, the first mismatch becomes the next pending token, and the
+// rejected tail is removed from both KV caches. Each round therefore emits
+// between one and `n_draft + 1` tokens for a single target decode.
+//
+// A draft is paired with a target context via `gpuf_speculative_attach`.
+// The remote worker keeps one draft configured with
+// `set_remote_worker_draft_model`, which follows the serving context across
+// model swaps.
+// ============================================================================
+
+use std::ffi::c_int;
+use std::time::Duration;
+
+use crate::{llama_context, LlamaToken};
+
+/// Upper bound on tokens proposed per round.
+pub const MAX_DRAFT_TOKENS: c_int = 16;
+
+/// Speculative decoding counters of one target context, accumulated since
+/// the draft was attached.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default, PartialEq)]
+pub struct gpuf_speculative_stats {
+    /// Tokens proposed by the draft model.
+    pub drafted_tokens: u64,
+    /// Proposed tokens the target model accepted.
+    pub accepted_tokens: u64,
+    /// Batched `llama_decode` calls on the target model.
+    pub target_decodes: u64,
+    /// Tokens emitted to callers.
+    pub generated_tokens: u64,
+    /// `accepted_tokens / drafted_tokens`, 0 before the first proposal.
+    pub acceptance_rate: f32,
+    /// Generated tokens per second of speculative generation time.
+    pub tokens_per_second: f32,
+}
+
+#[derive(Debug, Default, Clone, Copy)]
+struct Counters {
+    drafted: u64,
+    accepted: u64,
+    target_decodes: u64,
+    generated: u64,
+    elapsed: Duration,
+}
+
+impl Counters {
+    fn record_round(&mut self, drafted: usize, accepted: usize) {
+        self.drafted += drafted as u64;
+        self.accepted += accepted as u64;
+        self.target_decodes += 1;
+    }
+
+    fn record_run(&mut self, generated: c_int, elapsed: Duration) {
+        self.generated += generated.max(0) as u64;
+        self.elapsed += elapsed;
+    }
+
+    fn merge(&mut self, other: &Counters) {
+        self.drafted += other.drafted;
+        self.accepted += other.accepted;
+        self.target_decodes += other.target_decodes;
+        self.generated += other.generated;
+        self.elapsed += other.elapsed;
+    }
+
+    fn stats(&self) -> gpuf_speculative_stats {
+        let seconds = self.elapsed.as_secs_f32();
+        gpuf_speculative_stats {
+            drafted_tokens: self.drafted,
+            accepted_tokens: self.accepted,
+            target_decodes: self.target_decodes,
+            generated_tokens: self.generated,
+            acceptance_rate: if self.drafted > 0 {
+                self.accepted as f32 / self.drafted as f32
+            } else {
+                0.0
+            },
+            tokens_per_second: if seconds > 0.0 {
+                self.generated as f32 / seconds
+            } else {
+                0.0
+            },
+        }
+    }
+}
+
+/// Proposals worth drafting this round: no more than the caller still wants
+/// and no more than fit behind the pending token in the context window.
+fn draft_len(n_draft: usize, remaining: usize, free_positions: usize) -> usize {
+    n_draft.min(remaining).min(free_positions.saturating_sub(1))
+}
+
+/// Walk the target's samples over the verification batch. `sample(i)` draws
+/// the target token at batch index `i`, where index 0 holds the pending
+/// token and index `i` the token after `proposal[i - 1]`. Sampling stops at
+/// the first disagreement, so the sampler only ever accepts emitted tokens.
+///
+/// Returns the number of accepted proposals and the next pending token.
+fn verify(
+    proposal: &[LlamaToken],
+    mut sample: impl FnMut(usize) -> LlamaToken,
+) -> (usize, LlamaToken) {
+    for (i, &drafted) in proposal.iter().enumerate() {
+        let sampled = sample(i);
+        if sampled != drafted {
+            return (i, sampled);
+        }
+    }
+    (proposal.len(), sample(proposal.len()))
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+mod engine {
+    use super::*;
+    use crate::{
+        llama_batch, llama_decode, llama_get_memory, llama_get_model, llama_memory_seq_rm,
+        llama_model_get_vocab, llama_n_batch, llama_n_ctx, llama_sampler, llama_sampler_free,
+        llama_sampler_init_greedy, llama_sampler_sample, llama_vocab_is_eog, llama_vocab_n_tokens,
+        model_registry, prefix_cache, sampler, should_stop_generation, LlamaPos,
+        GLOBAL_INFERENCE_MUTEX,
+    };
+    use once_cell::sync::Lazy;
+    use std::collections::HashMap;
+    use std::sync::Mutex;
+    use std::time::Instant;
+
+    /// target context pointer -> its draft
+    static PAIRINGS: Lazy<Mutex<HashMap<usize, Pairing>>> =
+        Lazy::new(|| Mutex::new(HashMap::new()));
+    static WORKER_DRAFT: Lazy<Mutex<Option<Pairing>>> = Lazy::new(|| Mutex::new(None));
+
+    #[derive(Clone, Copy)]
+    struct Pairing {
+        draft: *mut llama_context,
+        n_draft: usize,
+        counters: Counters,
+    }
+
+    // SAFETY: The draft context is only decoded by generation calls, which
+    // the callers serialize per context like the target context itself.
+    unsafe impl Send for Pairing {}
+
+    unsafe fn vocab_size(ctx: *mut llama_context) -> c_int {
+        let vocab = llama_model_get_vocab(llama_get_model(ctx));
+        if vocab.is_null() {
+            return -1;
+        }
+        llama_vocab_n_tokens(vocab)
+    }
+
+    pub(super) unsafe fn attach(
+        ctx: *mut llama_context,
+        draft: *mut llama_context,
+        n_draft: c_int,
+    ) -> c_int {
+        if ctx.is_null() || draft.is_null() || ctx == draft || n_draft <= 0 {
+            return -1;
+        }
+        let target_vocab = vocab_size(ctx);
+        if target_vocab <= 0 || target_vocab != vocab_size(draft) {
+            println!("⚠️ Draft model vocabulary does not match the target model");
+            return -2;
+        }
+        PAIRINGS.lock().unwrap_or_else(|p| p.into_inner()).insert(
+            ctx as usize,
+            Pairing {
+                draft,
+                n_draft: n_draft.min(MAX_DRAFT_TOKENS) as usize,
+                counters: Counters::default(),
+            },
+        );
+        println!(
+            "✅ Speculative decoding: {} draft tokens per round",
+            n_draft
+        );
+        0
+    }
+
+    pub(super) fn detach(ctx: *mut llama_context) -> bool {
+        PAIRINGS
+            .lock()
+            .unwrap_or_else(|p| p.into_inner())
+            .remove(&(ctx as usize))
+            .is_some()
+    }
+
+    pub(super) fn stats(ctx: *mut llama_context) -> Option<gpuf_speculative_stats> {
+        PAIRINGS
+            .lock()
+            .unwrap_or_else(|p| p.into_inner())
+            .get(&(ctx as usize))
+            .map(|pairing| pairing.counters.stats())
+    }
+
+    /// The target context is going back to the pool; drop its pairing.
+    pub(crate) fn forget(ctx: *mut llama_context) {
+        detach(ctx);
+    }
+
+    /// Draft context and length paired with `ctx`, if any.
+    pub(crate) fn draft_for(ctx: *mut llama_context) -> Option<(*mut llama_context, usize)> {
+        PAIRINGS
+            .lock()
+            .unwrap_or_else(|p| p.into_inner())
+            .get(&(ctx as usize))
+            .map(|pairing| (pairing.draft, pairing.n_draft))
+    }
+
+    /// Replace the remote worker's draft with the leased context `draft`
+    /// (`None` disables speculative decoding) and pair it with `serving`.
+    /// The previous draft context goes back to the model registry.
+    pub(crate) unsafe fn set_worker_draft(
+        serving: Option<*mut llama_context>,
+        draft: Option<(*mut llama_context, c_int)>,
+    ) -> c_int {
+        // Generation decodes the draft under the inference mutex.
+        let _inference_lock = GLOBAL_INFERENCE_MUTEX
+            .lock()
+            .unwrap_or_else(|p| p.into_inner());
+        let mut worker = WORKER_DRAFT.lock().unwrap_or_else(|p| p.into_inner());
+        if let Some(previous) = worker.take() {
+            PAIRINGS
+                .lock()
+                .unwrap_or_else(|p| p.into_inner())
+                .retain(|_, pairing| pairing.draft != previous.draft);
+            prefix_cache::forget(previous.draft);
+            model_registry::release(previous.draft);
+        }
+        let Some((draft, n_draft)) = draft else {
+            println!("✅ Speculative decoding disabled for the remote worker");
+            return 0;
+        };
+        if let Some(serving) = serving {
+            let result = attach(serving, draft, n_draft);
+            if result != 0 {
+                model_registry::release(draft);
+                return result;
+            }
+        }
+        *worker = Some(Pairing {
+            draft,
+            n_draft: n_draft.clamp(1, MAX_DRAFT_TOKENS) as usize,
+            counters: Counters::default(),
+        });
+        0
+    }
+
+    /// Pair the remote worker's draft, if configured, with the context that
+    /// just became the serving one.
+    pub(crate) unsafe fn follow_serving(ctx: *mut llama_context) {
+        let worker = *WORKER_DRAFT.lock().unwrap_or_else(|p| p.into_inner());
+        if let Some(pairing) = worker {
+            if attach(ctx, pairing.draft, pairing.n_draft as c_int) != 0 {
+                println!("⚠️ Draft model kept idle until a compatible model is served");
+            }
+        }
+    }
+
+    /// Decode `tokens` into sequence 0 of `ctx` from position `start` in
+    /// chunks of `n_batch`, requesting logits for the last one only.
+    unsafe fn decode_chunked(ctx: *mut llama_context, tokens: &[LlamaToken], start: usize) -> bool {
+        let n_batch = llama_n_batch(ctx).max(1) as usize;
+        let mut offset = 0;
+        while offset < tokens.len() {
+            let end = (offset + n_batch).min(tokens.len());
+            let chunk = &tokens[offset..end];
+            let pos: Vec<LlamaPos> = (0..chunk.len())
+                .map(|i| (start + offset + i) as LlamaPos)
+                .collect();
+            let mut logits = vec![0i8; chunk.len()];
+            if end == tokens.len() {
+                logits[chunk.len() - 1] = 1;
+            }
+            let batch = llama_batch {
+                n_tokens: chunk.len() as c_int,
+                token: chunk.as_ptr() as *mut LlamaToken,
+                embd: std::ptr::null_mut(),
+                pos: pos.as_ptr() as *mut LlamaPos,
+                n_seq_id: std::ptr::null_mut(),
+                seq_id: std::ptr::null_mut(),
+                logits: logits.as_mut_ptr(),
+            };
+            if llama_decode(ctx, batch) != 0 {
+                return false;
+            }
+            offset = end;
+        }
+        true
+    }
+
+    /// Speculative replacement for the one-token decode loop of the legacy
+    /// entry points. `tokens` are resident in sequence 0 of `ctx` with the
+    /// logits of the last one current; accepted tokens are appended to it.
+    /// Each generated token is passed to `emit`, end-of-generation tokens
+    /// stop the loop. Returns the number of generated tokens.
+    ///
+    /// # Safety
+    /// `ctx`, `draft` and `sampler` must be live and used by no other thread.
+    pub(crate) unsafe fn generate(
+        ctx: *mut llama_context,
+        draft: *mut llama_context,
+        n_draft: usize,
+        sampler: *mut llama_sampler,
+        tokens: &mut Vec<LlamaToken>,
+        limit: c_int,
+        emit: &mut dyn FnMut(LlamaToken),
+    ) -> c_int {
+        let started = Instant::now();
+        let vocab = llama_model_get_vocab(llama_get_model(ctx));
+        let n_ctx = llama_n_ctx(ctx).max(0) as usize;
+        let greedy = llama_sampler_init_greedy();
+        let mut run_counters = Counters::default();
+
+        // The draft mirrors sequence 0 of the target up to `draft_past`; a
+        // draft whose sequence cannot be cleared is not used
+        let draft_prefix = prefix_cache::prepare_sequence(draft, tokens);
+        let mut draft_past = draft_prefix.unwrap_or(0);
+        let mut drafting = n_draft > 0 && !greedy.is_null() && draft_prefix.is_some();
+        let mut proposal: Vec<LlamaToken> = Vec::with_capacity(n_draft);
+        let mut generated: c_int = 0;
+        let mut pending = sampler::sample(sampler, ctx, -1);
+
+        'generation: while generated < limit && !should_stop_generation() {
+            if llama_vocab_is_eog(vocab, pending) {
+                break;
+            }
+            emit(pending);
+            generated += 1;
+            if generated >= limit {
+                break;
+            }
+
+            // 1. Let the draft catch up with the pending token and propose
+            let n_past = tokens.len();
+            let k = draft_len(
+                n_draft,
+                (limit - generated) as usize,
+                n_ctx.saturating_sub(n_past),
+            );
+            proposal.clear();
+            if drafting && k > 0 {
+                let mut catch_up = tokens[draft_past..].to_vec();
+                catch_up.push(pending);
+                if decode_chunked(draft, &catch_up, draft_past) {
+                    draft_past = n_past + 1;
+                    while proposal.len() < k {
+                        let token = llama_sampler_sample(greedy, draft, -1);
+                        proposal.push(token);
+                        if proposal.len() == k || llama_vocab_is_eog(vocab, token) {
+                            break;
+                        }
+                        if !decode_chunked(draft, &[token], draft_past) {
+                            break;
+                        }
+                        draft_past += 1;
+                    }
+                } else {
+                    println!("⚠️ Draft decode failed, continuing without speculation");
+                    llama_memory_seq_rm(llama_get_memory(draft), 0, draft_past as LlamaPos, -1);
+                    drafting = false;
+                }
+            }
+
+            // 2. Verify the pending token and all proposals in one batch
+            let mut batch_tokens = Vec::with_capacity(proposal.len() + 1);
+            batch_tokens.push(pending);
+            batch_tokens.extend_from_slice(&proposal);
+            let pos: Vec<LlamaPos> = (0..batch_tokens.len())
+                .map(|i| (n_past + i) as LlamaPos)
+                .collect();
+            let mut logits = vec![1i8; batch_tokens.len()];
+            let batch = llama_batch {
+                n_tokens: batch_tokens.len() as c_int,
+                token: batch_tokens.as_mut_ptr(),
+                embd: std::ptr::null_mut(),
+                pos: pos.as_ptr() as *mut LlamaPos,
+                n_seq_id: std::ptr::null_mut(),
+                seq_id: std::ptr::null_mut(),
+                logits: logits.as_mut_ptr(),
+            };
+            if llama_decode(ctx, batch) != 0 {
+                llama_memory_seq_rm(llama_get_memory(ctx), 0, n_past as LlamaPos, -1);
+                break;
+            }
+            tokens.push(pending);
+
+            let (accepted, next) = verify(&proposal, |i| sampler::sample(sampler, ctx, i as c_int));
+            run_counters.record_round(proposal.len(), accepted);
+
+            // 3. Drop the rejected tail from both caches
+            let kept = n_past + 1 + accepted;
+            llama_memory_seq_rm(llama_get_memory(ctx), 0, kept as LlamaPos, -1);
+            if draft_past > kept {
+                llama_memory_seq_rm(llama_get_memory(draft), 0, kept as LlamaPos, -1);
+                draft_past = kept;
+            }
+            tokens.extend_from_slice(&proposal[..accepted]);
+
+            for &token in &proposal[..accepted] {
+                if llama_vocab_is_eog(vocab, token) || should_stop_generation() {
+                    break 'generation;
+                }
+                emit(token);
+                generated += 1;
+                if generated >= limit {
+                    break 'generation;
+                }
+            }
+            pending = next;
+        }
+
+        if !greedy.is_null() {
+            llama_sampler_free(greedy);
+        }
+        prefix_cache::record_sequence(draft, &tokens[..draft_past.min(tokens.len())]);
+
+        run_counters.record_run(generated, started.elapsed());
+        let run = run_counters.stats();
+        println!(
+            "✅ Speculative decoding: {} tokens in {} target decodes, acceptance {:.0}%, {:.1} tokens/s",
+            generated,
+            run.target_decodes,
+            run.acceptance_rate * 100.0,
+            run.tokens_per_second
+        );
+        if let Some(pairing) = PAIRINGS
+            .lock()
+            .unwrap_or_else(|p| p.into_inner())
+            .get_mut(&(ctx as usize))
+        {
+            pairing.counters.merge(&run_counters);
+        }
+        generated
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub(crate) use engine::{draft_for, follow_serving, forget, generate, set_worker_draft};
+
+/// Pair `ctx` with `draft_ctx`, a context on a smaller model with the same
+/// vocabulary (e.g. loaded with `gpuf_load_model` and `gpuf_create_context`).
+/// From then on `gpuf_start_generation_async`, `gpuf_start_generation_stream`
+/// and `gpuf_generate_with_sampling` on `ctx` let the draft propose up to
+/// `n_draft` tokens (at most `MAX_DRAFT_TOKENS`) that the target verifies in
+/// a single batched decode. Attaching again replaces the draft and resets the
+/// statistics.
+///
+/// Returns 0 on success, -1 for invalid arguments and -2 if the vocabularies
+/// differ.
+///
+/// # Safety
+/// Both contexts must stay alive until `gpuf_speculative_detach`, and the
+/// draft context must not be used for anything else meanwhile.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_speculative_attach(
+    ctx: *mut llama_context,
+    draft_ctx: *mut llama_context,
+    n_draft: c_int,
+) -> c_int {
+    // SAFETY: Null pointers are rejected; the caller keeps both contexts alive.
+    unsafe { engine::attach(ctx, draft_ctx, n_draft) }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_speculative_attach(
+    _ctx: *mut llama_context,
+    _draft_ctx: *mut llama_context,
+    _n_draft: c_int,
+) -> c_int {
+    -1
+}
+
+/// Stop speculative decoding on `ctx`. The draft context is not freed.
+/// Returns 0 on success or -2 if no draft was attached.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_speculative_detach(ctx: *mut llama_context) -> c_int {
+    if engine::detach(ctx) {
+        0
+    } else {
+        -2
+    }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_speculative_detach(_ctx: *mut llama_context) -> c_int {
+    -2
+}
+
+/// Copy the speculative decoding statistics of `ctx` into `stats`.
+/// Returns 0 on success, -1 for a null `stats` and -2 if no draft is
+/// attached.
+///
+/// # Safety
+/// `stats` must point to writable memory for one `gpuf_speculative_stats`.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_speculative_get_stats(
+    ctx: *mut llama_context,
+    stats: *mut gpuf_speculative_stats,
+) -> c_int {
+    if stats.is_null() {
+        return -1;
+    }
+    match engine::stats(ctx) {
+        Some(current) => {
+            // SAFETY: `stats` was checked for null and is writable per contract.
+            unsafe { stats.write(current) };
+            0
+        }
+        None => -2,
+    }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_speculative_get_stats(
+    _ctx: *mut llama_context,
+    _stats: *mut gpuf_speculative_stats,
+) -> c_int {
+    -2
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn verify_accepts_matching_prefix_and_returns_correction() {
+        let proposal = [5, 6, 7, 8];
+        let target = [5, 6, 9, 1, 1];
+        let mut sampled = Vec::new();
+        let (accepted, next) = verify(&proposal, |i| {
+            sampled.push(i);
+            target[i]
+        });
+        assert_eq!((accepted, next), (2, 9));
+        // Positions after the first mismatch are never sampled
+        assert_eq!(sampled, vec![0, 1, 2]);
+
+        let (accepted, next) = verify(&proposal, |i| [5, 6, 7, 8, 4][i]);
+        assert_eq!((accepted, next), (4, 4));
+
+        let (accepted, next) = verify(&[], |_| 3);
+        assert_eq!((accepted, next), (0, 3));
+    }
+
+    #[test]
+    fn draft_len_respects_remaining_tokens_and_context() {
+        assert_eq!(draft_len(4, 100, 100), 4);
+        assert_eq!(draft_len(4, 2, 100), 2);
+        // Pending token plus proposals must fit the window
+        assert_eq!(draft_len(4, 100, 3), 2);
+        assert_eq!(draft_len(4, 100, 1), 0);
+        assert_eq!(draft_len(4, 100, 0), 0);
+    }
+
+    #[test]
+    fn stats_report_acceptance_and_throughput() {
+        let mut counters = Counters::default();
+        assert_eq!(counters.stats().acceptance_rate, 0.0);
+        counters.record_round(4, 3);
+        counters.record_round(4, 1);
+        counters.record_run(6, Duration::from_secs(2));
+        let stats = counters.stats();
+        assert_eq!(stats.drafted_tokens, 8);
+        assert_eq!(stats.accepted_tokens, 4);
+        assert_eq!(stats.target_decodes, 2);
+        assert_eq!(stats.acceptance_rate, 0.5);
+        assert_eq!(stats.tokens_per_second, 3.0);
+    }
+}
@@ -0,0 +1,449 @@
+// ============================================================================
+// Batched token streaming
+// ============================================================================
+//
+// `gpuf_start_generation_async` crosses the FFI boundary once per token and
+// allocates a CString for each. A `gpuf_stream` is a fixed-capacity ring the
+// decode loop writes tokens and raw UTF-8 bytes into; the host drains it in
+// batches with `gpuf_stream_poll`. The optional `on_ready` signal is
+// coalesced (every N tokens or T milliseconds) so the host wakes up once per
+// batch. When the ring is full the decode loop waits for the host to drain it.
+// ============================================================================
+
+use std::collections::VecDeque;
+use std::ffi::{c_int, c_void};
+use std::time::Duration;
+
+use crate::util::stream_coalescer::{StreamCoalescer, DEFAULT_FLUSH_MS, DEFAULT_FLUSH_TOKENS};
+use crate::LlamaToken;
+
+/// Smallest text ring accepted; one token piece must always fit.
+const MIN_TEXT_CAPACITY: usize = 64;
+
+/// Default ring sizes used when `gpuf_stream_create` is passed 0.
+const DEFAULT_TOKEN_CAPACITY: usize = 256;
+const DEFAULT_TEXT_CAPACITY: usize = 4096;
+
+/// Length of the longest prefix of `bytes` that does not end inside a UTF-8
+/// sequence.
+fn utf8_boundary(bytes: &[u8]) -> usize {
+    let len = bytes.len();
+    for back in 1..=len.min(3) {
+        let b = bytes[len - back];
+        if b & 0xC0 == 0x80 {
+            // continuation byte, keep looking for the lead byte
+            continue;
+        }
+        let needed = match b {
+            0xC0..=0xDF => 2,
+            0xE0..=0xEF => 3,
+            0xF0..=0xF7 => 4,
+            _ => 1,
+        };
+        return if needed > back { len - back } else { len };
+    }
+    len
+}
+
+struct StreamRing {
+    tokens: VecDeque<LlamaToken>,
+    text: VecDeque<u8>,
+    token_capacity: usize,
+    text_capacity: usize,
+    coalescer: StreamCoalescer,
+    finished: bool,
+}
+
+impl StreamRing {
+    fn new(token_capacity: usize, text_capacity: usize, coalescer: StreamCoalescer) -> Self {
+        let token_capacity = token_capacity.max(1);
+        let text_capacity = text_capacity.max(MIN_TEXT_CAPACITY);
+        Self {
+            tokens: VecDeque::with_capacity(token_capacity),
+            text: VecDeque::with_capacity(text_capacity),
+            token_capacity,
+            text_capacity,
+            coalescer,
+            finished: false,
+        }
+    }
+
+    fn fits(&self, piece_len: usize) -> bool {
+        self.tokens.len() < self.token_capacity
+            && self.text.len() + piece_len.min(self.text_capacity) <= self.text_capacity
+    }
+
+    /// Append one token; the caller has checked `fits`. Returns true when the
+    /// host should be signalled.
+    fn push(&mut self, token: LlamaToken, piece: &[u8]) -> bool {
+        self.tokens.push_back(token);
+        let room = self.text_capacity - self.text.len();
+        // NULs are dropped so hosts may treat the text as a C string.
+        self.text
+            .extend(piece.iter().copied().filter(|&b| b != 0).take(room));
+        self.coalescer.push(self.text.len())
+    }
+
+    /// Move up to `tokens_out.len()` tokens and `text_out.len()` bytes out of
+    /// the ring. Text is cut on a UTF-8 boundary until generation finished.
+    fn drain(&mut self, tokens_out: &mut [LlamaToken], text_out: &mut [u8]) -> (usize, usize) {
+        let n_tokens = tokens_out.len().min(self.tokens.len());
+        for (slot, token) in tokens_out.iter_mut().zip(self.tokens.drain(..n_tokens)) {
+            *slot = token;
+        }
+
+        let mut n_bytes = text_out.len().min(self.text.len());
+        for (slot, byte) in text_out.iter_mut().zip(self.text.iter()).take(n_bytes) {
+            *slot = *byte;
+        }
+        if !(self.finished && n_bytes == self.text.len()) {
+            n_bytes = utf8_boundary(&text_out[..n_bytes]);
+        }
+        self.text.drain(..n_bytes);
+
+        if n_tokens > 0 || n_bytes > 0 {
+            self.coalescer.reset();
+        }
+        (n_tokens, n_bytes)
+    }
+
+    fn is_drained(&self) -> bool {
+        self.finished && self.tokens.is_empty() && self.text.is_empty()
+    }
+}
+
+/// Opaque stream handle shared by the generating thread and the host.
+#[allow(non_camel_case_types)]
+pub struct gpuf_stream {
+    ring: std::sync::Mutex<StreamRing>,
+    space: std::sync::Condvar,
+    on_ready: Option<extern "C" fn(*mut c_void)>,
+    user_data: *mut c_void,
+}
+
+impl gpuf_stream {
+    fn lock(&self) -> std::sync::MutexGuard<'_, StreamRing> {
+        self.ring.lock().unwrap_or_else(|p| p.into_inner())
+    }
+
+    fn signal(&self) {
+        if let Some(on_ready) = self.on_ready {
+            on_ready(self.user_data);
+        }
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+mod engine {
+    use super::*;
+    use crate::{generate_streaming, llama_context, sampler, should_stop_generation};
+    use std::ffi::c_char;
+
+    /// Back off this long between stop-flag checks while the ring is full.
+    const FULL_RING_WAIT: Duration = Duration::from_millis(10);
+
+    impl gpuf_stream {
+        /// Block until `piece` fits, then append it. Gives up when the
+        /// generation is stopped while waiting.
+        fn write(&self, token: LlamaToken, piece: &[u8]) {
+            let mut ring = self.lock();
+            while !ring.fits(piece.len()) {
+                if should_stop_generation() {
+                    return;
+                }
+                ring = self
+                    .space
+                    .wait_timeout(ring, FULL_RING_WAIT)
+                    .unwrap_or_else(|p| p.into_inner())
+                    .0;
+            }
+            let ready = ring.push(token, piece);
+            drop(ring);
+            if ready {
+                self.signal();
+            }
+        }
+
+        fn begin(&self) {
+            let mut ring = self.lock();
+            ring.tokens.clear();
+            ring.text.clear();
+            ring.coalescer.reset();
+            ring.finished = false;
+        }
+
+        fn finish(&self) {
+            self.lock().finished = true;
+            self.signal();
+        }
+    }
+
+    pub(super) unsafe fn run(
+        ctx: *mut llama_context,
+        prompt: *const c_char,
+        max_tokens: c_int,
+        temperature: f32,
+        top_k: c_int,
+        top_p: f32,
+        repeat_penalty: f32,
+        stream: &gpuf_stream,
+    ) -> c_int {
+        let lease = sampler::acquire(sampler::SamplerParams::new(
+            temperature,
+            top_k,
+            top_p,
+            repeat_penalty,
+        ));
+        if lease.as_ptr().is_null() {
+            return -1;
+        }
+        stream.begin();
+        let completion_tokens = generate_streaming(
+            ctx,
+            prompt,
+            max_tokens,
+            lease.as_ptr(),
+            &mut |token, piece| stream.write(token, piece),
+        );
+        stream.finish();
+        completion_tokens
+    }
+}
+
+/// Create a token stream for `gpuf_start_generation_stream`.
+///
+/// The ring holds up to `token_capacity` tokens and `text_capacity` bytes of
+/// UTF-8 text (0 selects a default). `on_ready(user_data)` is called from the
+/// generating thread after `flush_tokens` tokens or once the oldest unread
+/// token is `flush_ms` old, and once more when generation ends; it must not
+/// block. Free the stream with `gpuf_stream_free`.
+#[no_mangle]
+pub extern "C" fn gpuf_stream_create(
+    token_capacity: c_int,
+    text_capacity: c_int,
+    flush_tokens: c_int,
+    flush_ms: c_int,
+    on_ready: Option<extern "C" fn(*mut c_void)>,
+    user_data: *mut c_void,
+) -> *mut gpuf_stream {
+    let or_default = |value: c_int, default: usize| {
+        if value > 0 {
+            value as usize
+        } else {
+            default
+        }
+    };
+    let coalescer = StreamCoalescer::new(
+        or_default(flush_tokens, DEFAULT_FLUSH_TOKENS as usize) as u32,
+        Duration::from_millis(or_default(flush_ms, DEFAULT_FLUSH_MS as usize) as u64),
+        usize::MAX,
+    );
+    let ring = StreamRing::new(
+        or_default(token_capacity, DEFAULT_TOKEN_CAPACITY),
+        or_default(text_capacity, DEFAULT_TEXT_CAPACITY),
+        coalescer,
+    );
+    Box::into_raw(Box::new(gpuf_stream {
+        ring: std::sync::Mutex::new(ring),
+        space: std::sync::Condvar::new(),
+        on_ready,
+        user_data,
+    }))
+}
+
+/// Drain `stream` without blocking.
+///
+/// Copies up to `max_tokens` token ids into `tokens_out` and up to
+/// `text_cap` bytes of text into `text_out` (not NUL-terminated, never split
+/// inside a UTF-8 sequence; the length goes to `text_len_out`). Either
+/// buffer may be null with a zero size. `finished_out` is set to 1 once the
+/// generation has ended and everything was read.
+///
+/// Returns the number of tokens copied or -1 for invalid arguments.
+///
+/// # Safety
+/// `stream` must come from `gpuf_stream_create`, the output buffers must be
+/// valid for the given sizes and the out pointers null or writable.
+#[no_mangle]
+pub extern "C" fn gpuf_stream_poll(
+    stream: *mut gpuf_stream,
+    tokens_out: *mut LlamaToken,
+    max_tokens: c_int,
+    text_out: *mut u8,
+    text_cap: c_int,
+    text_len_out: *mut c_int,
+    finished_out: *mut c_int,
+) -> c_int {
+    if stream.is_null()
+        || (tokens_out.is_null() && max_tokens > 0)
+        || (text_out.is_null() && text_cap > 0)
+    {
+        return -1;
+    }
+
+    // SAFETY: Pointer validity and buffer sizes are part of the documented
+    // caller contract; null buffers are only accepted with a zero size.
+    unsafe {
+        let stream = &*stream;
+        let tokens_out = if max_tokens > 0 {
+            std::slice::from_raw_parts_mut(tokens_out, max_tokens as usize)
+        } else {
+            &mut []
+        };
+        let text_out = if text_cap > 0 {
+            std::slice::from_raw_parts_mut(text_out, text_cap as usize)
+        } else {
+            &mut []
+        };
+
+        let (n_tokens, n_bytes, drained) = {
+            let mut ring = stream.lock();
+            let (n_tokens, n_bytes) = ring.drain(tokens_out, text_out);
+            (n_tokens, n_bytes, ring.is_drained())
+        };
+        stream.space.notify_one();
+
+        if !text_len_out.is_null() {
+            *text_len_out = n_bytes as c_int;
+        }
+        if !finished_out.is_null() {
+            *finished_out = drained as c_int;
+        }
+        n_tokens as c_int
+    }
+}
+
+/// Free a stream created by `gpuf_stream_create`.
+///
+/// # Safety
+/// No generation may be writing to `stream`; stop it with
+/// `gpuf_stop_generation` and wait for `gpuf_start_generation_stream` to
+/// return first.
+#[no_mangle]
+pub extern "C" fn gpuf_stream_free(stream: *mut gpuf_stream) {
+    if stream.is_null() {
+        return;
+    }
+    // SAFETY: `stream` was produced by `gpuf_stream_create` and, per the
+    // caller contract, is no longer in use.
+    unsafe {
+        drop(Box::from_raw(stream));
+    }
+}
+
+/// Generate like `gpuf_start_generation_async`, but write tokens and text
+/// into `stream` instead of calling back once per token. Blocks until
+/// generation ends; run it on a worker thread and drain `stream` from
+/// another with `gpuf_stream_poll`. If the host stops draining, generation
+/// waits for room in the ring (or for `gpuf_stop_generation`).
+///
+/// Returns the number of generated tokens or -1 on error.
+#[no_mangle]
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub extern "C" fn gpuf_start_generation_stream(
+    ctx: *mut crate::llama_context,
+    prompt: *const std::ffi::c_char,
+    max_tokens: c_int,
+    temperature: f32,
+    top_k: c_int,
+    top_p: f32,
+    repeat_penalty: f32,
+    stream: *mut gpuf_stream,
+) -> c_int {
+    if ctx.is_null() || prompt.is_null() || stream.is_null() {
+        println!("❌ Invalid context, prompt or stream for stream generation");
+        return -1;
+    }
+    // SAFETY: All pointers were checked for null and must stay valid until
+    // this synchronous call returns.
+    unsafe {
+        engine::run(
+            ctx,
+            prompt,
+            max_tokens,
+            temperature,
+            top_k,
+            top_p,
+            repeat_penalty,
+            &*stream,
+        )
+    }
+}
+
+#[no_mangle]
+#[cfg(not(any(target_os = "android", target_os = "ios")))]
+pub extern "C" fn gpuf_start_generation_stream(
+    _ctx: *mut crate::llama_context,
+    _prompt: *const std::ffi::c_char,
+    _max_tokens: c_int,
+    _temperature: f32,
+    _top_k: c_int,
+    _top_p: f32,
+    _repeat_penalty: f32,
+    _stream: *mut gpuf_stream,
+) -> c_int {
+    -1
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn ring(tokens: usize, text: usize) -> StreamRing {
+        StreamRing::new(
+            tokens,
+            text,
+            StreamCoalescer::new(2, Duration::from_secs(60), usize::MAX),
+        )
+    }
+
+    #[test]
+    fn signals_in_batches_and_drains_in_order() {
+        let mut r = ring(8, 64);
+        assert!(!r.push(1, b"he"));
+        assert!(r.push(2, b"llo"));
+
+        let mut tokens = [0; 8];
+        let mut text = [0u8; 16];
+        assert_eq!(r.drain(&mut tokens, &mut text), (2, 5));
+        assert_eq!(&tokens[..2], &[1, 2]);
+        assert_eq!(&text[..5], b"hello");
+        assert!(!r.push(3, b"!"));
+    }
+
+    #[test]
+    fn holds_back_split_utf8_until_finished() {
+        let euro = "€".as_bytes();
+        let mut r = ring(8, 64);
+        r.push(1, b"a");
+        r.push(2, &euro[..2]);
+
+        let mut tokens = [0; 8];
+        let mut text = [0u8; 16];
+        assert_eq!(r.drain(&mut tokens, &mut text), (2, 1));
+        r.push(3, &euro[2..]);
+        assert_eq!(r.drain(&mut tokens, &mut text), (1, 3));
+        assert_eq!(&text[..3], euro);
+
+        r.push(4, &euro[..1]);
+        r.finished = true;
+        assert_eq!(r.drain(&mut tokens, &mut text), (1, 1));
+        assert!(r.is_drained());
+    }
+
+    #[test]
+    fn reports_full_ring_and_drops_nuls() {
+        let mut r = ring(2, 64);
+        assert!(r.fits(4));
+        r.push(1, b"a\0b");
+        r.push(2, b"c");
+        assert!(!r.fits(1));
+
+        let mut text = [0u8; 16];
+        assert_eq!(r.drain(&mut [], &mut text), (0, 3));
+        assert_eq!(&text[..3], b"abc");
+        assert!(!r.fits(1));
+        assert_eq!(r.drain(&mut [0; 1], &mut []), (1, 0));
+        assert!(r.fits(1));
+    }
+}
@@ -30,6 +30,32 @@ impl std::str::FromStr for LlamaSplitModeArg {
     }
 }
 
+/// How the llama engine chooses `n_gpu_layers` and the GPUs to use.
+#[derive(ValueEnum, Debug, Clone, Copy, PartialEq, Eq, serde::Serialize)]
+pub enum GpuPlacementArg {
+    /// Use `n_gpu_layers`, `llama_split_mode` and `llama_devices` as given.
+    #[clap(name = "manual")]
+    Manual,
+    /// Fit the model to the free memory of each GPU.
+    #[clap(name = "auto")]
+    Auto,
+}
+
+impl std::str::FromStr for GpuPlacementArg {
+    type Err = String;
+
+    fn from_str(s: &str) -> std::result::Result<Self, Self::Err> {
+        match s.trim().to_lowercase().as_str() {
+            "manual" => Ok(Self::Manual),
+            "auto" => Ok(Self::Auto),
+            other => Err(format!(
+                "Invalid gpu_placement '{}'. Must be one of: manual, auto",
+                other
+            )),
+        }
+    }
+}
+
 #[derive(Debug, Clone)]
 pub struct SecurityConfig {
     pub require_api_key: bool,
@@ -118,6 +144,25 @@ pub struct Args {
     #[arg(long, default_value_t = false)]
     pub p2p_public_listen: bool,
 
+    /// bpffs directory with the pinned maps of xdp_p2p_filter.o. When set, the P2P UDP
+    /// port is registered with the XDP pre-filter; otherwise only the socket path is used.
+    #[arg(long, default_value = None)]
+    pub p2p_xdp_pin_dir: Option<String>,
+
+    /// Serve downloaded models to LAN peers on this address (e.g. 0.0.0.0:17090).
+    /// A non-loopback address requires --model-peer-token.
+    #[arg(long, default_value = None)]
+    pub model_peer_listen: Option<String>,
+
+    /// Comma-separated base URLs of LAN peers (e.g. http://10.0.0.5:17090) to fetch
+    /// model chunks from before falling back to the download URL.
+    #[arg(long, env = "GPUF_MODEL_PEERS", default_value = None)]
+    pub model_peers: Option<String>,
+
+    /// Shared bearer token for serving to and fetching from model peers.
+    #[arg(long, env = "GPUF_MODEL_PEER_TOKEN", default_value = None)]
+    pub model_peer_token: Option<String>,
+
     /// Certificate chain for TLS
     #[arg(long, default_value = "ca-cert.pem")]
     pub cert_chain_path: String,
@@ -208,10 +253,32 @@ pub struct Args {
 
     #[arg(
         long,
-        default_value_t = 1,
+        value_enum,
+        default_value_t = GpuPlacementArg::Manual,
+        help = "GPU placement: manual uses n_gpu_layers/llama_devices, auto fits layers to free VRAM"
+    )]
+    pub gpu_placement: GpuPlacementArg,
+
+    #[arg(
+        long,
+        default_value_t = 4096,
         help = "Max bytes per streamed delta chunk sent to server"
     )]
     pub stream_chunk_bytes: usize,
+
+    #[arg(
+        long,
+        default_value_t = crate::util::stream_coalescer::DEFAULT_FLUSH_TOKENS,
+        help = "Send a streamed delta chunk after this many tokens"
+    )]
+    pub stream_flush_tokens: u32,
+
+    #[arg(
+        long,
+        default_value_t = crate::util::stream_coalescer::DEFAULT_FLUSH_MS,
+        help = "Send a streamed delta chunk once its oldest token is this many ms old"
+    )]
+    pub stream_flush_ms: u64,
 }
 
 impl Args {
@@ -260,6 +327,17 @@ impl Args {
                 None => self.llama_split_mode.clone(),
             };
 
+            let gpu_placement = match config_data
+                .client
+                .gpu_placement
+                .as_deref()
+                .map(|s| s.parse::<GpuPlacementArg>())
+            {
+                Some(Ok(v)) => v,
+                Some(Err(e)) => return Err(anyhow::anyhow!(e)),
+                None => self.gpu_placement,
+            };
+
             Ok(Args {
                 config: Some(config_path.clone()),
                 client_id: Some(client_id),
@@ -272,6 +350,10 @@ impl Args {
                 p2p_udp_port: self.p2p_udp_port,
                 p2p_bind_addr: self.p2p_bind_addr.clone(),
                 p2p_public_listen: self.p2p_public_listen,
+                p2p_xdp_pin_dir: self.p2p_xdp_pin_dir.clone(),
+                model_peer_listen: self.model_peer_listen.clone(),
+                model_peers: self.model_peers.clone(),
+                model_peer_token: self.model_peer_token.clone(),
                 cert_chain_path: config_data.client.cert_chain_path,
                 control_tls: config_data.client.control_tls.unwrap_or(self.control_tls),
                 control_tls_server_name: config_data
@@ -300,7 +382,10 @@ impl Args {
                     .llama_devices
                     .clone()
                     .or_else(|| self.llama_devices.clone()),
+                gpu_placement,
                 stream_chunk_bytes: self.stream_chunk_bytes,
+                stream_flush_tokens: self.stream_flush_tokens,
+                stream_flush_ms: self.stream_flush_ms,
             })
         } else {
             // In standalone_llama mode, client_id is optional
@@ -320,6 +405,17 @@ impl Args {
         format!("{}:{}", self.p2p_bind_addr, self.p2p_udp_port)
     }
 
+    pub fn model_peer_urls(&self) -> Vec<String> {
+        self.model_peers
+            .as_deref()
+            .unwrap_or("")
+            .split(',')
+            .map(str::trim)
+            .filter(|s| !s.is_empty())
+            .map(str::to_string)
+            .collect()
+    }
+
     pub fn security_config(&self) -> SecurityConfig {
         SecurityConfig::from_args(self)
     }
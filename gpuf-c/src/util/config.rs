@@ -67,6 +67,9 @@ pub struct ClientConfig {
 
     #[serde(rename = "llama_devices")]
     pub llama_devices: Option<String>,
+
+    #[serde(rename = "gpu_placement")]
+    pub gpu_placement: Option<String>,
 }
 
 impl Config {
@@ -7,12 +7,17 @@ pub mod mobile_tls_policy;
 pub mod model_downloader;
 #[cfg(not(target_os = "ios"))]
 pub mod model_downloader_example;
+#[cfg(not(target_os = "android"))]
+pub mod model_peer;
 pub mod network_info;
 pub mod nvswitch_check;
+pub mod p2p_xdp;
 pub mod safe_command;
 pub mod security_metrics;
+pub mod stream_coalescer;
 pub mod system_info;
 pub mod system_info_vulkan;
+pub mod udp_batch;
 
 use std::sync::OnceLock;
 use tracing::{debug, Level};
@@ -4,20 +4,30 @@
 //! - Parallel chunk downloading for faster speeds
 //! - Resume capability for interrupted downloads
 //! - Progress tracking and reporting
-//! - Integrity verification with checksums
+//! - Integrity verification with checksums, hashed while the parts stream in
+//! - Chunks fetched from LAN peers first (see `model_peer`), with the origin
+//!   as fallback
 
 use crate::util::security_metrics;
 use anyhow::{anyhow, Result};
 use futures_util::StreamExt;
 use reqwest::Client;
+use sha2::{Digest, Sha256};
 use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicU64, Ordering};
 use std::sync::Arc;
 use tokio::io::{AsyncReadExt, AsyncWriteExt};
-use tokio::sync::{Mutex, Semaphore};
+use tokio::sync::{Mutex, Notify, Semaphore};
 use tokio::task::JoinSet;
 use tokio::time::{timeout, Duration};
 use tracing::{debug, error, info, warn};
 
+/// How long to wait for a peer to accept before using the origin instead.
+const PEER_CONNECT_TIMEOUT: Duration = Duration::from_secs(3);
+/// Part boundaries are rounded to this so the parts can be reflinked into
+/// the final file on filesystems that support it.
+const PART_ALIGN: u64 = 1024 * 1024;
+
 /// Configuration for model downloading
 #[derive(Debug, Clone)]
 pub struct DownloadConfig {
@@ -35,6 +45,11 @@ pub struct DownloadConfig {
     pub checksum: String,
     /// Whether to resume interrupted downloads
     pub resume: bool,
+    /// URLs of the same file on LAN peers. Each chunk is fetched from one of
+    /// them first and from `url` if that peer fails.
+    pub peer_urls: Vec<String>,
+    /// Bearer token sent to peers (their `--model-peer-token`).
+    pub peer_token: Option<String>,
 }
 
 impl Default for DownloadConfig {
@@ -47,6 +62,8 @@ impl Default for DownloadConfig {
             expected_size: None,
             checksum: String::new(),
             resume: true,
+            peer_urls: Vec::new(),
+            peer_token: None,
         }
     }
 }
@@ -72,6 +89,8 @@ pub type ProgressCallback = Box<dyn Fn(DownloadProgress) + Send + Sync>;
 /// Model downloader with parallel and resume capabilities
 pub struct ModelDownloader {
     client: Client,
+    /// Same as `client` but gives up quickly on peers that are not there.
+    peer_client: Client,
     config: DownloadConfig,
     progress_callback: Option<Arc<ProgressCallback>>,
 }
@@ -84,10 +103,16 @@ impl ModelDownloader {
             .timeout(std::time::Duration::from_secs(300)) // 5 minute timeout
             .build()
             .expect("Failed to create HTTP client");
+        let peer_client = Client::builder()
+            .connect_timeout(PEER_CONNECT_TIMEOUT)
+            .timeout(std::time::Duration::from_secs(300))
+            .build()
+            .expect("Failed to create HTTP client");
 
         Self {
             config,
             client,
+            peer_client,
             progress_callback: None,
         }
     }
@@ -201,11 +226,10 @@ impl ModelDownloader {
         }
 
         // Download chunks
+        // Verified against the checksum while the parts streamed in.
         self.download_chunks(chunks, file_size, downloaded_size)
             .await?;
 
-        self.verify_checksum(&self.config.checksum).await?;
-
         info!("Download completed successfully!");
         Ok(())
     }
@@ -294,7 +318,10 @@ impl ModelDownloader {
 
         // Calculate optimal chunk count
         let chunk_count = (remaining / chunk_size).min(self.config.parallel_chunks as u64) as usize;
-        let actual_chunk_size = remaining / chunk_count as u64;
+        let mut actual_chunk_size = remaining / chunk_count as u64;
+        if actual_chunk_size >= PART_ALIGN {
+            actual_chunk_size -= actual_chunk_size % PART_ALIGN;
+        }
 
         for i in 0..chunk_count {
             let chunk_start = start_pos + (i as u64 * actual_chunk_size);
@@ -314,64 +341,95 @@ impl ModelDownloader {
         chunks
     }
 
-    /// Download multiple chunks in parallel
+    /// Download multiple chunks in parallel. Peers are tried first; if the
+    /// assembled data then fails the checksum, the parts are dropped and the
+    /// download is repeated from the origin alone, so one bad peer cannot wedge
+    /// a rollout.
     async fn download_chunks(
         &self,
         chunks: Vec<DownloadChunk>,
         total_size: u64,
         initial_downloaded: u64,
+    ) -> Result<()> {
+        let with_peers = !self.config.peer_urls.is_empty();
+        match self
+            .download_chunks_from(&chunks, total_size, initial_downloaded, with_peers)
+            .await
+        {
+            Err(e) if with_peers && e.is::<ChecksumMismatch>() => {
+                warn!("{}; retrying from the origin only", e);
+                self.download_chunks_from(&chunks, total_size, initial_downloaded, false)
+                    .await
+            }
+            result => result,
+        }
+    }
+
+    async fn download_chunks_from(
+        &self,
+        chunks: &[DownloadChunk],
+        total_size: u64,
+        initial_downloaded: u64,
+        with_peers: bool,
     ) -> Result<()> {
         let parts_dir = self.parts_dir();
         tokio::fs::create_dir_all(&parts_dir).await?;
 
         let mut existing = 0u64;
+        let mut part_lens = Vec::with_capacity(chunks.len());
         for chunk in chunks.iter() {
             let part_path = Self::part_path(&parts_dir, chunk.index);
+            let mut len = 0;
             if let Ok(meta) = tokio::fs::metadata(&part_path).await {
-                let len = meta.len();
-                let max_len = (chunk.end - chunk.start) + 1;
-                if len <= max_len {
-                    existing += len;
+                if meta.len() <= chunk.len() {
+                    len = meta.len();
                 } else {
                     let _ = tokio::fs::remove_file(&part_path).await;
                 }
             }
+            existing += len;
+            part_lens.push(len);
         }
 
+        let hash = Arc::new(PartsHash::new(&part_lens));
+        let hash_task = tokio::spawn(Self::hash_parts(
+            parts_dir.clone(),
+            chunks.iter().map(|c| c.len()).collect(),
+            hash.clone(),
+        ));
+
         let semaphore = Arc::new(Semaphore::new(self.config.parallel_chunks));
         let baseline_downloaded = initial_downloaded + existing;
-        let downloaded_bytes = Arc::new(Mutex::new(baseline_downloaded));
-        let start_time = std::time::Instant::now();
+        let ctx = Arc::new(ChunkContext {
+            client: self.client.clone(),
+            peer_client: self.peer_client.clone(),
+            url: self.config.url.clone(),
+            peer_urls: if with_peers {
+                self.config.peer_urls.clone()
+            } else {
+                Vec::new()
+            },
+            peer_token: self.config.peer_token.clone(),
+            parts_dir: parts_dir.clone(),
+            hash: hash.clone(),
+            downloaded_bytes: Arc::new(Mutex::new(baseline_downloaded)),
+            total_size,
+            progress_callback: self.progress_callback.clone(),
+            start_time: std::time::Instant::now(),
+            baseline_downloaded,
+        });
         let total_chunks = chunks.len();
 
         let mut set = JoinSet::new();
 
-        for chunk in chunks {
+        for &chunk in chunks {
             let semaphore = semaphore.clone();
-            let client = self.client.clone();
-            let url = self.config.url.clone();
-            let output_path = self.config.output_path.clone();
-            let parts_dir = parts_dir.clone();
-            let downloaded_bytes = downloaded_bytes.clone();
-            let progress_callback = self.progress_callback.clone();
-            let baseline_downloaded = baseline_downloaded;
+            let ctx = ctx.clone();
 
             set.spawn(async move {
                 let _permit = semaphore.acquire().await?;
 
-                let result = Self::download_chunk_to_part(
-                    client,
-                    &url,
-                    &output_path,
-                    &parts_dir,
-                    chunk,
-                    downloaded_bytes.clone(),
-                    total_size,
-                    progress_callback,
-                    start_time,
-                    baseline_downloaded,
-                )
-                .await;
+                let result = Self::download_chunk_to_part(&ctx, chunk).await;
 
                 // Return the chunk index for error reporting
                 match result {
@@ -387,27 +445,47 @@ impl ModelDownloader {
         // Wait for all chunks to complete
         let mut completed = 0;
         while let Some(result) = set.join_next().await {
-            match result {
+            let failure = match result {
                 Ok(Ok(chunk_index)) => {
                     completed += 1;
                     debug!(
                         "Chunk {} completed ({} / {})",
                         chunk_index, completed, total_chunks
                     );
+                    continue;
                 }
-                Ok(Err(e)) => {
-                    return Err(anyhow!("Chunk download failed: {}", e));
-                }
-                Err(e) => {
-                    return Err(anyhow!("Task join error: {}", e));
-                }
+                Ok(Err(e)) => anyhow!("Chunk download failed: {}", e),
+                Err(e) => anyhow!("Task join error: {}", e),
+            };
+            hash_task.abort();
+            return Err(failure);
+        }
+
+        // A stream that ended early leaves a short part; keep it for resume.
+        for chunk in chunks {
+            let written = hash.written(chunk.index);
+            if written != chunk.len() {
+                hash_task.abort();
+                return Err(anyhow!(
+                    "Chunk {} ended early ({} of {} bytes)",
+                    chunk.index,
+                    written,
+                    chunk.len()
+                ));
             }
         }
 
+        let actual_checksum = hash_task
+            .await
+            .map_err(|e| anyhow!("Hash task join error: {}", e))??;
+        if let Err(e) = Self::check_sha256(&actual_checksum, &self.config.checksum) {
+            let _ = tokio::fs::remove_dir_all(&parts_dir).await;
+            return Err(e);
+        }
+
         let temp_path = self.temp_output_path();
         let _ = tokio::fs::remove_file(&temp_path).await;
         Self::assemble_parts(&parts_dir, &temp_path, total_chunks).await?;
-        Self::verify_checksum_at_path(&temp_path, &self.config.checksum).await?;
         tokio::fs::rename(&temp_path, &self.config.output_path).await?;
 
         let _ = tokio::fs::remove_dir_all(&parts_dir).await;
@@ -415,6 +493,40 @@ impl ModelDownloader {
         Ok(())
     }
 
+    /// SHA-256 over the parts in order, fed as the contiguous downloaded
+    /// prefix grows. Reads come back from the page cache, so by the time the
+    /// last chunk lands only its tail is left to hash.
+    async fn hash_parts(
+        parts_dir: PathBuf,
+        lens: Vec<u64>,
+        hash: Arc<PartsHash>,
+    ) -> Result<String> {
+        let mut hasher = Sha256::new();
+        let mut buffer = vec![0u8; 1024 * 1024];
+        for (index, len) in lens.into_iter().enumerate() {
+            let mut file: Option<tokio::fs::File> = None;
+            let mut hashed = 0u64;
+            while hashed < len {
+                let available = hash.written(index);
+                if available <= hashed {
+                    hash.notify.notified().await;
+                    continue;
+                }
+                if file.is_none() {
+                    file = Some(tokio::fs::File::open(Self::part_path(&parts_dir, index)).await?);
+                }
+                let Some(file) = file.as_mut() else {
+                    unreachable!("part file opened above");
+                };
+                let want = (available - hashed).min(buffer.len() as u64) as usize;
+                file.read_exact(&mut buffer[..want]).await?;
+                hasher.update(&buffer[..want]);
+                hashed += want as u64;
+            }
+        }
+        Ok(format!("{:x}", hasher.finalize()))
+    }
+
     fn parts_dir(&self) -> PathBuf {
         let mut p = self.config.output_path.to_string_lossy().to_string();
         p.push_str(".parts");
@@ -516,50 +628,87 @@ impl ModelDownloader {
         Ok(())
     }
 
+    /// Assemble the verified parts into `output_path` without copying through
+    /// user space: a single part is renamed into place, and several are joined
+    /// with `std::io::copy`, which on Linux uses `copy_file_range` (a reflink
+    /// on btrfs/XFS when part boundaries are block aligned).
     async fn assemble_parts(
         parts_dir: &Path,
         output_path: &Path,
         total_parts: usize,
     ) -> Result<()> {
-        let mut out = tokio::fs::File::create(output_path).await?;
-        for i in 0..total_parts {
-            let part = Self::part_path(parts_dir, i);
-            let mut f = tokio::fs::File::open(&part).await?;
-            tokio::io::copy(&mut f, &mut out).await?;
+        if total_parts == 1 {
+            tokio::fs::rename(Self::part_path(parts_dir, 0), output_path).await?;
+            return Ok(());
         }
-        out.sync_all().await?;
-        Ok(())
+
+        let parts_dir = parts_dir.to_path_buf();
+        let output_path = output_path.to_path_buf();
+        tokio::task::spawn_blocking(move || -> Result<()> {
+            let mut out = std::fs::File::create(&output_path)?;
+            for i in 0..total_parts {
+                let mut part = std::fs::File::open(Self::part_path(&parts_dir, i))?;
+                std::io::copy(&mut part, &mut out)?;
+            }
+            out.sync_all()?;
+            Ok(())
+        })
+        .await
+        .map_err(|e| anyhow!("Assemble task join error: {}", e))?
     }
 
-    async fn download_chunk_to_part(
-        client: Client,
+    /// Fetch what is missing of `chunk`, from a peer first when there are any.
+    /// The part file is append-only, so the origin picks up exactly where a
+    /// failed peer stopped.
+    async fn download_chunk_to_part(ctx: &ChunkContext, chunk: DownloadChunk) -> Result<()> {
+        if !ctx.peer_urls.is_empty() {
+            // Spread chunks across peers instead of all starting on the first.
+            let peer = &ctx.peer_urls[chunk.index % ctx.peer_urls.len()];
+            match Self::fetch_range(
+                ctx,
+                &ctx.peer_client,
+                peer,
+                ctx.peer_token.as_deref(),
+                chunk,
+            )
+            .await
+            {
+                Ok(()) => return Ok(()),
+                Err(e) => warn!(
+                    "Peer fetch of chunk {} failed ({}), falling back to origin",
+                    chunk.index, e
+                ),
+            }
+        }
+        Self::fetch_range(ctx, &ctx.client, &ctx.url, None, chunk).await
+    }
+
+    async fn fetch_range(
+        ctx: &ChunkContext,
+        client: &Client,
         url: &str,
-        output_path: &Path,
-        parts_dir: &Path,
+        token: Option<&str>,
         chunk: DownloadChunk,
-        downloaded_bytes: Arc<Mutex<u64>>,
-        total_size: u64,
-        progress_callback: Option<Arc<ProgressCallback>>,
-        start_time: std::time::Instant,
-        baseline_downloaded: u64,
     ) -> Result<()> {
-        let _ = output_path;
-        let part_path = Self::part_path(parts_dir, chunk.index);
+        let part_path = Self::part_path(&ctx.parts_dir, chunk.index);
 
         let existing_len = match tokio::fs::metadata(&part_path).await {
             Ok(meta) => meta.len(),
             Err(_) => 0,
         };
 
-        let max_len = (chunk.end - chunk.start) + 1;
-        let existing_len = existing_len.min(max_len);
+        let existing_len = existing_len.min(chunk.len());
         let start = chunk.start + existing_len;
         if start > chunk.end {
             return Ok(());
         }
 
         let range_header = format!("bytes={}-{}", start, chunk.end);
-        let response = client.get(url).header("Range", range_header).send().await?;
+        let mut request = client.get(url).header("Range", range_header);
+        if let Some(token) = token {
+            request = request.bearer_auth(token);
+        }
+        let response = request.send().await?;
 
         if response.status() != 206 {
             return Err(anyhow!(
@@ -578,35 +727,48 @@ impl ModelDownloader {
 
         let mut stream = response.bytes_stream();
         let mut last_report = std::time::Instant::now();
+        let mut written = existing_len;
 
         loop {
             let next = timeout(Duration::from_secs(30), stream.next()).await;
             match next {
                 Ok(Some(item)) => {
                     let bytes = item?;
+                    let room = (chunk.len() - written) as usize;
+                    if bytes.len() > room {
+                        return Err(anyhow!(
+                            "Server sent more than the requested range for chunk {}",
+                            chunk.index
+                        ));
+                    }
                     file.write_all(&bytes).await?;
+                    // Flushed bytes are visible to the hashing task.
+                    file.flush().await?;
+                    written += bytes.len() as u64;
+                    ctx.hash.publish(chunk.index, written);
 
-                    let mut downloaded = downloaded_bytes.lock().await;
+                    let mut downloaded = ctx.downloaded_bytes.lock().await;
                     *downloaded += bytes.len() as u64;
 
-                    if let Some(callback) = progress_callback.as_ref() {
+                    if let Some(callback) = ctx.progress_callback.as_ref() {
                         if last_report.elapsed().as_secs() >= 1 {
                             last_report = std::time::Instant::now();
-                            let elapsed_secs = start_time.elapsed().as_secs();
+                            let elapsed_secs = ctx.start_time.elapsed().as_secs();
                             let downloaded_since_start =
-                                downloaded.saturating_sub(baseline_downloaded);
+                                downloaded.saturating_sub(ctx.baseline_downloaded);
                             let speed_bps = if elapsed_secs > 0 {
                                 downloaded_since_start / elapsed_secs
                             } else {
                                 0
                             };
+                            let total_size = ctx.total_size;
                             let progress = DownloadProgress {
                                 downloaded_bytes: *downloaded,
                                 total_bytes: total_size,
                                 percentage: (*downloaded as f64) / (total_size as f64),
                                 speed_bps,
                                 eta_seconds: if speed_bps > 0 {
-                                    Some((total_size - *downloaded) / speed_bps)
+                                    Some(total_size.saturating_sub(*downloaded) / speed_bps)
                                 } else {
                                     None
                                 },
@@ -622,8 +784,6 @@ impl ModelDownloader {
             }
         }
 
-        file.flush().await?;
-
         Ok(())
     }
 
@@ -633,10 +793,8 @@ impl ModelDownloader {
     }
 
     async fn verify_checksum_at_path(path: &Path, expected_checksum: &str) -> Result<()> {
-        use sha2::{Digest, Sha256};
-
         info!("Verifying file integrity...");
-        let expected_checksum = Self::normalize_sha256(expected_checksum)?;
+        Self::normalize_sha256(expected_checksum)?;
 
         let mut file = tokio::fs::File::open(path).await?;
         let mut hasher = Sha256::new();
@@ -650,15 +808,18 @@ impl ModelDownloader {
             hasher.update(&buffer[..bytes_read]);
         }
 
-        let actual_checksum = format!("{:x}", hasher.finalize());
+        Self::check_sha256(&format!("{:x}", hasher.finalize()), expected_checksum)
+    }
 
+    fn check_sha256(actual_checksum: &str, expected_checksum: &str) -> Result<()> {
+        let expected_checksum = Self::normalize_sha256(expected_checksum)?;
         if actual_checksum != expected_checksum {
             security_metrics::record_checksum_failure();
-            return Err(anyhow!(
-                "Checksum verification failed. Expected: {}, Actual: {}",
-                expected_checksum,
-                actual_checksum
-            ));
+            return Err(ChecksumMismatch {
+                expected: expected_checksum,
+                actual: actual_checksum.to_string(),
+            }
+            .into());
         }
 
         info!("Checksum verification passed");
@@ -741,6 +902,9 @@ impl ModelDownloader {
 
         let mut downloaded_bytes = effective_resume_from;
         let start_time = std::time::Instant::now();
+        // A fresh download is hashed as it streams; a resumed one is checked
+        // from disk afterwards, since its prefix was never seen here.
+        let mut hasher = (effective_resume_from == 0).then(Sha256::new);
 
         // Use streaming download
         let mut stream = response.bytes_stream();
@@ -749,6 +913,9 @@ impl ModelDownloader {
         while let Some(chunk_result) = stream.next().await {
             let chunk = chunk_result?;
             file.write_all(&chunk).await?;
+            if let Some(hasher) = hasher.as_mut() {
+                hasher.update(&chunk);
+            }
             downloaded_bytes += chunk.len() as u64;
 
             // Update progress
@@ -790,7 +957,12 @@ impl ModelDownloader {
         file.sync_all().await?;
         info!("Simple download completed: {} bytes", downloaded_bytes);
 
-        Self::verify_checksum_at_path(&temp_path, &self.config.checksum).await?;
+        match hasher {
+            Some(hasher) => {
+                Self::check_sha256(&format!("{:x}", hasher.finalize()), &self.config.checksum)?
+            }
+            None => Self::verify_checksum_at_path(&temp_path, &self.config.checksum).await?,
+        }
         tokio::fs::rename(&temp_path, &self.config.output_path).await?;
 
         Ok(())
@@ -805,6 +977,71 @@ struct DownloadChunk {
     index: usize,
 }
 
+impl DownloadChunk {
+    fn len(&self) -> u64 {
+        self.end - self.start + 1
+    }
+}
+
+/// State shared by the chunk tasks of one download.
+struct ChunkContext {
+    client: Client,
+    peer_client: Client,
+    url: String,
+    peer_urls: Vec<String>,
+    peer_token: Option<String>,
+    parts_dir: PathBuf,
+    hash: Arc<PartsHash>,
+    downloaded_bytes: Arc<Mutex<u64>>,
+    total_size: u64,
+    progress_callback: Option<Arc<ProgressCallback>>,
+    start_time: std::time::Instant,
+    baseline_downloaded: u64,
+}
+
+/// Bytes flushed to each part file, published to the hashing task.
+struct PartsHash {
+    written: Vec<AtomicU64>,
+    notify: Notify,
+}
+
+impl PartsHash {
+    fn new(existing: &[u64]) -> Self {
+        Self {
+            written: existing.iter().map(|&len| AtomicU64::new(len)).collect(),
+            notify: Notify::new(),
+        }
+    }
+
+    fn written(&self, index: usize) -> u64 {
+        self.written[index].load(Ordering::Acquire)
+    }
+
+    fn publish(&self, index: usize, len: u64) {
+        self.written[index].store(len, Ordering::Release);
+        // One consumer, so a stored permit is enough to never miss an update.
+        self.notify.notify_one();
+    }
+}
+
+#[derive(Debug)]
+struct ChecksumMismatch {
+    expected: String,
+    actual: String,
+}
+
+impl std::fmt::Display for ChecksumMismatch {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        write!(
+            f,
+            "Checksum verification failed. Expected: {}, Actual: {}",
+            self.expected, self.actual
+        )
+    }
+}
+
+impl std::error::Error for ChecksumMismatch {}
+
 /// Convenience function for simple downloads
 pub async fn download_model(url: &str, output_path: &Path, checksum: &str) -> Result<()> {
     let config = DownloadConfig {
@@ -898,6 +1135,41 @@ mod tests {
         Ok(())
     }
 
+    #[tokio::test]
+    async fn test_parts_hashed_as_they_stream_in() -> Result<()> {
+        let temp = tempfile::tempdir()?;
+        let parts_dir = temp.path().join("model.gguf.parts");
+        tokio::fs::create_dir_all(&parts_dir).await?;
+
+        // Part 0 is already on disk (resume); part 1 arrives in two writes.
+        tokio::fs::write(ModelDownloader::part_path(&parts_dir, 0), b"a").await?;
+        let hash = Arc::new(PartsHash::new(&[1, 0]));
+        let task = tokio::spawn(ModelDownloader::hash_parts(
+            parts_dir.clone(),
+            vec![1, 2],
+            hash.clone(),
+        ));
+
+        let part1 = ModelDownloader::part_path(&parts_dir, 1);
+        tokio::fs::write(&part1, b"b").await?;
+        hash.publish(1, 1);
+        let mut f = tokio::fs::OpenOptions::new().append(true).open(&part1).await?;
+        f.write_all(b"c").await?;
+        f.flush().await?;
+        hash.publish(1, 2);
+
+        let actual = task.await??;
+        ModelDownloader::check_sha256(
+            &actual,
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+        )?;
+
+        let out = temp.path().join("model.gguf");
+        ModelDownloader::assemble_parts(&parts_dir, &out, 2).await?;
+        assert_eq!(tokio::fs::read(&out).await?, b"abc");
+        Ok(())
+    }
+
     #[tokio::test]
     async fn test_chunk_calculation() {
         let downloader = ModelDownloader::new(DownloadConfig {
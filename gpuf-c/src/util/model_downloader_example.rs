@@ -21,6 +21,8 @@ pub async fn download_llama_model() -> Result<()> {
         expected_size: Some(668_066_816), // Expected file size
         checksum: "0000000000000000000000000000000000000000000000000000000000000000".to_string(), // Replace with the model publisher's SHA256
         resume: true,
+        peer_urls: Vec::new(),
+        peer_token: None,
     };
 
     let mut downloader = ModelDownloader::new(config);
@@ -76,6 +78,8 @@ pub async fn download_for_slow_network() -> Result<()> {
         expected_size: None,
         checksum: "0000000000000000000000000000000000000000000000000000000000000000".to_string(),
         resume: true,
+        peer_urls: Vec::new(),
+        peer_token: None,
     };
 
     let downloader = ModelDownloader::new(config);
@@ -109,6 +113,8 @@ pub async fn download_multiple_models() -> Result<()> {
             checksum: "0000000000000000000000000000000000000000000000000000000000000000"
                 .to_string(),
             resume: true,
+            peer_urls: Vec::new(),
+            peer_token: None,
         };
 
         let downloader = ModelDownloader::new(config);
@@ -142,6 +148,8 @@ pub async fn download_and_initialize_llama() -> Result<()> {
         expected_size: Some(668_066_816),
         checksum: "0000000000000000000000000000000000000000000000000000000000000000".to_string(),
         resume: true,
+        peer_urls: Vec::new(),
+        peer_token: None,
     };
 
     let mut downloader = ModelDownloader::new(config);
@@ -191,6 +199,8 @@ mod tests {
             checksum: "0000000000000000000000000000000000000000000000000000000000000000"
                 .to_string(),
             resume: true,
+            peer_urls: Vec::new(),
+            peer_token: None,
         };
 
         assert_eq!(config.url, "https://example.com/test.bin");
@@ -0,0 +1,283 @@
+//! LAN model distribution.
+//!
+//! A worker started with `--model-peer-listen` serves the verified model
+//! files in its models directory over HTTP range requests, and lists them at
+//! `GET /models` so peers can see what it holds. Workers given
+//! `--model-peers` pass the matching URLs to `ModelDownloader`, which fetches
+//! each chunk from a peer first and from the origin when that peer fails.
+//! Only files that finished downloading and passed the checksum are in the
+//! models directory under their final name, so partial data is never served;
+//! the downloader still checks the whole file against the expected SHA-256.
+
+use crate::llm_engine::llama_server::{is_authorized, is_loopback_host};
+use crate::util::security_metrics;
+use anyhow::{anyhow, Result};
+use axum::{
+    body::Body,
+    extract::{Path as UrlPath, State},
+    http::{header, HeaderMap, StatusCode},
+    response::{IntoResponse, Response},
+    routing::get,
+    Json, Router,
+};
+use serde::Serialize;
+use std::path::PathBuf;
+use std::sync::Arc;
+use tokio::io::{AsyncReadExt, AsyncSeekExt};
+use tracing::{info, warn};
+use url::Url;
+
+const READ_CHUNK: u64 = 256 * 1024;
+
+#[derive(Clone)]
+struct PeerState {
+    models_dir: Arc<PathBuf>,
+    token: Option<Arc<str>>,
+}
+
+#[derive(Debug, Serialize)]
+struct HeldModel {
+    name: String,
+    size: u64,
+}
+
+/// URLs of `file_name` on each peer base URL (`http://host:port`).
+pub fn peer_file_urls(peers: &[String], file_name: &str) -> Vec<String> {
+    peers
+        .iter()
+        .filter_map(|base| {
+            let mut url = match Url::parse(base.trim()) {
+                Ok(url) => url,
+                Err(e) => {
+                    warn!("Ignoring invalid model peer URL {:?}: {}", base, e);
+                    return None;
+                }
+            };
+            url.path_segments_mut()
+                .ok()?
+                .pop_if_empty()
+                .push("models")
+                .push(file_name);
+            Some(url.to_string())
+        })
+        .collect()
+}
+
+/// Serve the models in `models_dir` to peers on `addr`. A non-loopback
+/// address requires `token`, which peers send as a bearer token.
+pub async fn serve(models_dir: PathBuf, addr: &str, token: Option<String>) -> Result<()> {
+    let host = addr.rsplit_once(':').map(|(h, _)| h).unwrap_or(addr);
+    if token.is_none() && !is_loopback_host(host) {
+        return Err(anyhow!(
+            "A model peer token is required to serve models on non-loopback address {}. Set --model-peer-token or GPUF_MODEL_PEER_TOKEN.",
+            addr
+        ));
+    }
+
+    let state = PeerState {
+        models_dir: Arc::new(models_dir),
+        token: token.map(Arc::from),
+    };
+    let app = Router::new()
+        .route("/models", get(list_models))
+        .route("/models/:name", get(get_model))
+        .with_state(state);
+
+    info!("Serving models to LAN peers on {}", addr);
+    let listener = tokio::net::TcpListener::bind(addr).await?;
+    axum::serve(listener, app).await?;
+    Ok(())
+}
+
+fn authorize(state: &PeerState, headers: &HeaderMap) -> Result<(), Response> {
+    if let Some(expected) = state.token.as_deref() {
+        if !is_authorized(headers, expected) {
+            security_metrics::record_auth_failure();
+            return Err(StatusCode::UNAUTHORIZED.into_response());
+        }
+    }
+    Ok(())
+}
+
+/// Plain file names with a model extension; nothing that could leave the
+/// models directory or name an in-progress download.
+fn is_servable_name(name: &str) -> bool {
+    if name.is_empty() || name.starts_with('.') || name.contains(['/', '\\']) {
+        return false;
+    }
+    let ext = std::path::Path::new(name)
+        .extension()
+        .and_then(|s| s.to_str())
+        .unwrap_or("")
+        .to_ascii_lowercase();
+    matches!(ext.as_str(), "gguf" | "bin" | "safetensors")
+}
+
+async fn list_models(State(state): State<PeerState>, headers: HeaderMap) -> Response {
+    if let Err(resp) = authorize(&state, &headers) {
+        return resp;
+    }
+    let mut held = Vec::new();
+    if let Ok(mut dir) = tokio::fs::read_dir(state.models_dir.as_ref()).await {
+        while let Ok(Some(entry)) = dir.next_entry().await {
+            let Some(name) = entry.file_name().to_str().map(str::to_string) else {
+                continue;
+            };
+            if !is_servable_name(&name) {
+                continue;
+            }
+            // DirEntry::metadata does not follow symlinks.
+            if let Ok(meta) = entry.metadata().await {
+                if meta.is_file() {
+                    held.push(HeldModel {
+                        name,
+                        size: meta.len(),
+                    });
+                }
+            }
+        }
+    }
+    Json(held).into_response()
+}
+
+async fn get_model(
+    State(state): State<PeerState>,
+    UrlPath(name): UrlPath<String>,
+    headers: HeaderMap,
+) -> Response {
+    if let Err(resp) = authorize(&state, &headers) {
+        return resp;
+    }
+    if !is_servable_name(&name) {
+        return StatusCode::NOT_FOUND.into_response();
+    }
+    let path = state.models_dir.join(&name);
+    let size = match tokio::fs::symlink_metadata(&path).await {
+        Ok(meta) if meta.is_file() => meta.len(),
+        _ => return StatusCode::NOT_FOUND.into_response(),
+    };
+
+    let range = headers
+        .get(header::RANGE)
+        .and_then(|v| v.to_str().ok())
+        .map(|v| parse_range(v, size));
+    let (start, end, status) = match range {
+        None => (0, size.saturating_sub(1), StatusCode::OK),
+        Some(Some((start, end))) => (start, end, StatusCode::PARTIAL_CONTENT),
+        Some(None) => {
+            return (
+                StatusCode::RANGE_NOT_SATISFIABLE,
+                [(header::CONTENT_RANGE, format!("bytes */{}", size))],
+            )
+                .into_response()
+        }
+    };
+    let len = if size == 0 { 0 } else { end - start + 1 };
+
+    let mut file = match tokio::fs::File::open(&path).await {
+        Ok(file) => file,
+        Err(_) => return StatusCode::NOT_FOUND.into_response(),
+    };
+    if start > 0 {
+        if let Err(e) = file.seek(std::io::SeekFrom::Start(start)).await {
+            return (StatusCode::INTERNAL_SERVER_ERROR, e.to_string()).into_response();
+        }
+    }
+
+    let body = futures_util::stream::unfold((file, len), |(mut file, remaining)| async move {
+        if remaining == 0 {
+            return None;
+        }
+        let mut buf = vec![0u8; remaining.min(READ_CHUNK) as usize];
+        match file.read(&mut buf).await {
+            Ok(0) => None,
+            Ok(n) => {
+                buf.truncate(n);
+                Some((
+                    Ok::<_, std::io::Error>(bytes::Bytes::from(buf)),
+                    (file, remaining - n as u64),
+                ))
+            }
+            Err(e) => Some((Err(e), (file, 0))),
+        }
+    });
+
+    let mut resp = Response::builder()
+        .status(status)
+        .header(header::ACCEPT_RANGES, "bytes")
+        .header(header::CONTENT_LENGTH, len)
+        .header(header::CONTENT_TYPE, "application/octet-stream");
+    if status == StatusCode::PARTIAL_CONTENT {
+        resp = resp.header(
+            header::CONTENT_RANGE,
+            format!("bytes {}-{}/{}", start, end, size),
+        );
+    }
+    resp.body(Body::from_stream(body))
+        .unwrap_or_else(|_| StatusCode::INTERNAL_SERVER_ERROR.into_response())
+}
+
+/// Parse a single-range `Range` header (`bytes=a-b`, `bytes=a-`,
+/// `bytes=-n`) into an inclusive byte range within `size`.
+fn parse_range(value: &str, size: u64) -> Option<(u64, u64)> {
+    let spec = value.trim().strip_prefix("bytes=")?;
+    if spec.contains(',') || size == 0 {
+        return None;
+    }
+    let (first, last) = spec.split_once('-')?;
+    let (first, last) = (first.trim(), last.trim());
+    let (start, end) = if first.is_empty() {
+        let suffix: u64 = last.parse().ok()?;
+        if suffix == 0 {
+            return None;
+        }
+        (size.saturating_sub(suffix), size - 1)
+    } else {
+        let start: u64 = first.parse().ok()?;
+        let end = if last.is_empty() {
+            size - 1
+        } else {
+            last.parse::<u64>().ok()?.min(size - 1)
+        };
+        (start, end)
+    };
+    (start <= end).then_some((start, end))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn parses_single_byte_ranges() {
+        assert_eq!(parse_range("bytes=0-99", 1000), Some((0, 99)));
+        assert_eq!(parse_range("bytes=900-", 1000), Some((900, 999)));
+        assert_eq!(parse_range("bytes=900-5000", 1000), Some((900, 999)));
+        assert_eq!(parse_range("bytes=-100", 1000), Some((900, 999)));
+        assert_eq!(parse_range("bytes=1000-", 1000), None);
+        assert_eq!(parse_range("bytes=5-1", 1000), None);
+        assert_eq!(parse_range("bytes=0-1,5-6", 1000), None);
+        assert_eq!(parse_range("items=0-1", 1000), None);
+    }
+
+    #[test]
+    fn peer_urls_and_names() {
+        let peers = vec![
+            "http://10.0.0.5:17090".to_string(),
+            "http://10.0.0.6:17090/".to_string(),
+            "not a url".to_string(),
+        ];
+        assert_eq!(
+            peer_file_urls(&peers, "qwen 7b.gguf"),
+            vec![
+                "http://10.0.0.5:17090/models/qwen%207b.gguf".to_string(),
+                "http://10.0.0.6:17090/models/qwen%207b.gguf".to_string(),
+            ]
+        );
+
+        assert!(is_servable_name("model.gguf"));
+        assert!(!is_servable_name("model.gguf.tmp.42"));
+        assert!(!is_servable_name("../model.gguf"));
+        assert!(!is_servable_name(".model.gguf"));
+    }
+}
@@ -0,0 +1,251 @@
+//! User-space side of the P2P data-plane XDP pre-filter (`gpuf-s/src/xdp/xdp_p2p_filter.c`).
+//!
+//! The program and its maps are loaded and pinned by the operator, e.g.
+//! `bpftool prog load xdp_p2p_filter.o /sys/fs/bpf/gpuf_p2p/prog pinmaps /sys/fs/bpf/gpuf_p2p`.
+//! The worker registers its data-plane port, publishes the wall clock used for
+//! the in-kernel freshness check and mirrors source bans. When the pin
+//! directory is missing the worker keeps using the plain UDP socket path.
+
+use anyhow::{anyhow, Result};
+use std::net::IpAddr;
+use std::sync::Arc;
+use std::time::Duration;
+
+#[cfg(target_os = "linux")]
+mod sys {
+    use std::ffi::CString;
+    use std::io;
+    use std::os::fd::{AsRawFd, FromRawFd, OwnedFd};
+
+    const BPF_MAP_UPDATE_ELEM: libc::c_long = 2;
+    const BPF_MAP_DELETE_ELEM: libc::c_long = 3;
+    const BPF_OBJ_GET: libc::c_long = 7;
+
+    /// `union bpf_attr` member used by the *_ELEM commands.
+    #[repr(C)]
+    #[derive(Default)]
+    struct MapElemAttr {
+        map_fd: u32,
+        _pad: u32,
+        key: u64,
+        value: u64,
+        flags: u64,
+    }
+
+    /// `union bpf_attr` member used by BPF_OBJ_GET.
+    #[repr(C)]
+    #[derive(Default)]
+    struct ObjGetAttr {
+        pathname: u64,
+        bpf_fd: u32,
+        file_flags: u32,
+    }
+
+    fn bpf<T>(cmd: libc::c_long, attr: &mut T) -> io::Result<libc::c_long> {
+        // SAFETY: attr is a live repr(C) bpf_attr member of the size passed.
+        let ret = unsafe {
+            libc::syscall(
+                libc::SYS_bpf,
+                cmd,
+                attr as *mut T,
+                std::mem::size_of::<T>() as u32,
+            )
+        };
+        if ret < 0 {
+            Err(io::Error::last_os_error())
+        } else {
+            Ok(ret)
+        }
+    }
+
+    pub fn obj_get(path: &str) -> io::Result<OwnedFd> {
+        let path =
+            CString::new(path).map_err(|e| io::Error::new(io::ErrorKind::InvalidInput, e))?;
+        let mut attr = ObjGetAttr {
+            pathname: path.as_ptr() as u64,
+            ..Default::default()
+        };
+        let fd = bpf(BPF_OBJ_GET, &mut attr)?;
+        // SAFETY: BPF_OBJ_GET returned a fresh file descriptor we now own.
+        Ok(unsafe { OwnedFd::from_raw_fd(fd as i32) })
+    }
+
+    pub fn update<K, V>(map: &OwnedFd, key: &K, value: &V) -> io::Result<()> {
+        let mut attr = MapElemAttr {
+            map_fd: map.as_raw_fd() as u32,
+            key: key as *const K as u64,
+            value: value as *const V as u64,
+            ..Default::default()
+        };
+        bpf(BPF_MAP_UPDATE_ELEM, &mut attr).map(|_| ())
+    }
+
+    pub fn delete<K>(map: &OwnedFd, key: &K) -> io::Result<()> {
+        let mut attr = MapElemAttr {
+            map_fd: map.as_raw_fd() as u32,
+            key: key as *const K as u64,
+            ..Default::default()
+        };
+        bpf(BPF_MAP_DELETE_ELEM, &mut attr).map(|_| ())
+    }
+
+    pub fn monotonic_ns() -> u64 {
+        let mut ts = libc::timespec {
+            tv_sec: 0,
+            tv_nsec: 0,
+        };
+        // SAFETY: ts is a valid out pointer; CLOCK_MONOTONIC matches bpf_ktime_get_ns.
+        unsafe { libc::clock_gettime(libc::CLOCK_MONOTONIC, &mut ts) };
+        (ts.tv_sec as u64) * 1_000_000_000 + ts.tv_nsec as u64
+    }
+}
+
+/// Mirrors `struct p2p_src` in xdp_p2p_filter.c.
+#[cfg_attr(not(target_os = "linux"), allow(dead_code))]
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+struct P2PXdpSource {
+    family: u32,
+    addr: [u32; 4],
+}
+
+impl From<IpAddr> for P2PXdpSource {
+    fn from(ip: IpAddr) -> Self {
+        let mut src = Self::default();
+        match ip {
+            IpAddr::V4(v4) => {
+                src.family = 0;
+                src.addr[0] = u32::from_ne_bytes(v4.octets());
+            }
+            IpAddr::V6(v6) => {
+                src.family = 1;
+                for (slot, chunk) in src.addr.iter_mut().zip(v6.octets().chunks_exact(4)) {
+                    *slot = u32::from_ne_bytes([chunk[0], chunk[1], chunk[2], chunk[3]]);
+                }
+            }
+        }
+        src
+    }
+}
+
+/// Mirrors `struct p2p_clock` in xdp_p2p_filter.c.
+#[cfg_attr(not(target_os = "linux"), allow(dead_code))]
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy)]
+struct P2PXdpClock {
+    wall_secs: u64,
+    mono_ns: u64,
+}
+
+/// Pinned maps of a loaded `xdp_p2p_filter` program.
+#[cfg_attr(not(target_os = "linux"), allow(dead_code))]
+pub struct P2PXdpMaps {
+    #[cfg(target_os = "linux")]
+    ports: std::os::fd::OwnedFd,
+    #[cfg(target_os = "linux")]
+    banned: std::os::fd::OwnedFd,
+    #[cfg(target_os = "linux")]
+    clock: std::os::fd::OwnedFd,
+}
+
+impl P2PXdpMaps {
+    #[cfg(target_os = "linux")]
+    pub fn open(pin_dir: &str) -> Result<Arc<Self>> {
+        let open = |name: &str| {
+            let path = format!("{}/{}", pin_dir.trim_end_matches('/'), name);
+            sys::obj_get(&path).map_err(|e| anyhow!("P2P XDP map {} unavailable: {}", path, e))
+        };
+        Ok(Arc::new(Self {
+            ports: open("p2p_ports")?,
+            banned: open("p2p_banned")?,
+            clock: open("p2p_clock")?,
+        }))
+    }
+
+    #[cfg(not(target_os = "linux"))]
+    pub fn open(_pin_dir: &str) -> Result<Arc<Self>> {
+        Err(anyhow!("P2P XDP fast path requires Linux"))
+    }
+
+    /// Start filtering `port` and publish the wall clock for freshness checks.
+    /// The port is released when the returned guard is dropped.
+    pub fn register_port(self: &Arc<Self>, port: u16) -> Result<P2PXdpPort> {
+        self.publish_clock()?;
+        #[cfg(target_os = "linux")]
+        sys::update(&self.ports, &port, &1u8)
+            .map_err(|e| anyhow!("P2P XDP port {} registration failed: {}", port, e))?;
+        Ok(P2PXdpPort {
+            maps: Arc::clone(self),
+            port,
+        })
+    }
+
+    fn publish_clock(&self) -> Result<()> {
+        #[cfg(target_os = "linux")]
+        {
+            let clock = P2PXdpClock {
+                wall_secs: std::time::SystemTime::now()
+                    .duration_since(std::time::UNIX_EPOCH)
+                    .unwrap_or_default()
+                    .as_secs(),
+                mono_ns: sys::monotonic_ns(),
+            };
+            sys::update(&self.clock, &0u32, &clock)
+                .map_err(|e| anyhow!("P2P XDP clock publish failed: {}", e))?;
+        }
+        Ok(())
+    }
+
+    fn ban_source(&self, ip: IpAddr, ttl: Duration) -> Result<()> {
+        #[cfg(target_os = "linux")]
+        {
+            let until = sys::monotonic_ns().saturating_add(ttl.as_nanos() as u64);
+            sys::update(&self.banned, &P2PXdpSource::from(ip), &until)
+                .map_err(|e| anyhow!("P2P XDP ban of {} failed: {}", ip, e))?;
+        }
+        #[cfg(not(target_os = "linux"))]
+        let _ = (ip, ttl);
+        Ok(())
+    }
+}
+
+/// A data-plane port registered with the XDP pre-filter.
+#[cfg_attr(not(target_os = "linux"), allow(dead_code))]
+pub struct P2PXdpPort {
+    maps: Arc<P2PXdpMaps>,
+    port: u16,
+}
+
+impl P2PXdpPort {
+    /// Mirror a user-space source ban so further datagrams drop in the driver.
+    pub fn ban_source(&self, ip: IpAddr, ttl: Duration) {
+        if let Err(e) = self.maps.ban_source(ip, ttl) {
+            tracing::warn!("{}", e);
+        }
+    }
+}
+
+impl Drop for P2PXdpPort {
+    fn drop(&mut self) {
+        #[cfg(target_os = "linux")]
+        let _ = sys::delete(&self.maps.ports, &self.port);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn source_key_matches_network_order_layout() {
+        let v4 = P2PXdpSource::from("10.0.0.1".parse::<IpAddr>().unwrap());
+        assert_eq!(v4.family, 0);
+        assert_eq!(v4.addr[0].to_ne_bytes(), [10, 0, 0, 1]);
+        assert_eq!(&v4.addr[1..], &[0, 0, 0]);
+
+        let v6 = P2PXdpSource::from("2001:db8::1".parse::<IpAddr>().unwrap());
+        assert_eq!(v6.family, 1);
+        assert_eq!(v6.addr[0].to_ne_bytes(), [0x20, 0x01, 0x0d, 0xb8]);
+        assert_eq!(v6.addr[3].to_ne_bytes(), [0, 0, 0, 1]);
+    }
+}
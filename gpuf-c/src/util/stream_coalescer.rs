@@ -0,0 +1,94 @@
+//! Token coalescing shared by the C ring-buffer stream (`gpuf_stream_*`) and
+//! the `InferenceResultChunk` writers, so one signal or chunk carries many
+//! tokens instead of one.
+
+use std::time::{Duration, Instant};
+
+pub const DEFAULT_FLUSH_TOKENS: u32 = 8;
+pub const DEFAULT_FLUSH_MS: u64 = 50;
+
+/// Decides when buffered tokens should be flushed: after `max_tokens`
+/// tokens, once the oldest buffered token is `max_delay` old, or when the
+/// buffered text reaches `max_bytes`.
+#[derive(Debug, Clone)]
+pub struct StreamCoalescer {
+    max_tokens: u32,
+    max_delay: Duration,
+    max_bytes: usize,
+    pending_tokens: u32,
+    first_pending: Option<Instant>,
+}
+
+impl StreamCoalescer {
+    pub fn new(max_tokens: u32, max_delay: Duration, max_bytes: usize) -> Self {
+        Self {
+            max_tokens: max_tokens.max(1),
+            max_delay,
+            max_bytes: max_bytes.max(1),
+            pending_tokens: 0,
+            first_pending: None,
+        }
+    }
+
+    /// Record one token; `buffered_bytes` is the size of the pending text.
+    /// Returns true when the caller should flush now.
+    pub fn push(&mut self, buffered_bytes: usize) -> bool {
+        self.push_at(buffered_bytes, Instant::now())
+    }
+
+    fn push_at(&mut self, buffered_bytes: usize, now: Instant) -> bool {
+        self.pending_tokens = self.pending_tokens.saturating_add(1);
+        let first = *self.first_pending.get_or_insert(now);
+        self.pending_tokens >= self.max_tokens
+            || buffered_bytes >= self.max_bytes
+            || now.duration_since(first) >= self.max_delay
+    }
+
+    /// Forget pending tokens after a flush.
+    pub fn reset(&mut self) {
+        self.pending_tokens = 0;
+        self.first_pending = None;
+    }
+}
+
+impl Default for StreamCoalescer {
+    fn default() -> Self {
+        Self::new(
+            DEFAULT_FLUSH_TOKENS,
+            Duration::from_millis(DEFAULT_FLUSH_MS),
+            usize::MAX,
+        )
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn flushes_every_n_tokens() {
+        let mut c = StreamCoalescer::new(3, Duration::from_secs(60), usize::MAX);
+        let now = Instant::now();
+        assert!(!c.push_at(1, now));
+        assert!(!c.push_at(2, now));
+        assert!(c.push_at(3, now));
+        c.reset();
+        assert!(!c.push_at(1, now));
+    }
+
+    #[test]
+    fn flushes_when_oldest_token_is_due() {
+        let mut c = StreamCoalescer::new(100, Duration::from_millis(50), usize::MAX);
+        let start = Instant::now();
+        assert!(!c.push_at(1, start));
+        assert!(!c.push_at(2, start + Duration::from_millis(20)));
+        assert!(c.push_at(3, start + Duration::from_millis(50)));
+    }
+
+    #[test]
+    fn flushes_on_byte_cap() {
+        let mut c = StreamCoalescer::new(100, Duration::from_secs(60), 16);
+        assert!(!c.push(15));
+        assert!(c.push(16));
+    }
+}
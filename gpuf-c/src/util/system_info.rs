@@ -285,7 +285,7 @@ fn read_cpu_cores() -> Option<u32> {
 
 /// Read thermal information from /sys/class/thermal/
 #[cfg(target_os = "android")]
-fn read_thermal_info() -> Option<u32> {
+pub(crate) fn read_thermal_info() -> Option<u32> {
     use std::fs;
 
     // Try to read from common thermal zones
@@ -311,6 +311,21 @@ fn read_thermal_info() -> Option<u32> {
     None
 }
 
+/// Read battery charge percentage and whether it is charging from
+/// /sys/class/power_supply/
+#[cfg(target_os = "android")]
+pub(crate) fn read_battery_info() -> Option<(u8, bool)> {
+    use std::fs;
+
+    let capacity = fs::read_to_string("/sys/class/power_supply/battery/capacity").ok()?;
+    let percent = capacity.trim().parse::<u8>().ok()?.min(100);
+    // "Charging" or "Full" while plugged in, "Discharging"/"Not charging" otherwise
+    let charging = fs::read_to_string("/sys/class/power_supply/battery/status")
+        .map(|status| matches!(status.trim(), "Charging" | "Full"))
+        .unwrap_or(false);
+    Some((percent, charging))
+}
+
 /// Estimate CPU TFLOPS (very rough approximation)
 #[cfg(target_os = "android")]
 fn estimate_cpu_tflops(cpu_cores: u32) -> Option<f64> {
@@ -846,6 +861,90 @@ pub async fn collect_device_info(engine_type: common::EngineType) -> Result<(Dev
     }
 }
 
+/// Free memory of one GPU. `index` follows the order in which llama.cpp
+/// enumerates GPU backend devices (CUDA/ROCm ordinal, PCI order for DRM).
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct GpuMemory {
+    pub index: u32,
+    pub free_bytes: u64,
+}
+
+// Free VRAM per device, used to plan model offload across GPUs
+#[cfg(all(
+    not(target_os = "macos"),
+    not(target_os = "android"),
+    any(feature = "cuda", feature = "nvml")
+))]
+pub fn gpu_free_memory() -> Vec<GpuMemory> {
+    let nvml = match nvml_wrapper::NVML::init() {
+        Ok(nvml) => nvml,
+        Err(e) => {
+            debug!("NVML initialization failed: {}. No GPU memory info.", e);
+            return Vec::new();
+        }
+    };
+    let count = nvml.device_count().unwrap_or(0);
+    (0..count)
+        .filter_map(|i| {
+            let meminfo = nvml.device_by_index(i).ok()?.memory_info().ok()?;
+            Some(GpuMemory {
+                index: i,
+                free_bytes: meminfo.free,
+            })
+        })
+        .collect()
+}
+
+// Linux without NVML: AMD GPUs report VRAM usage through sysfs
+#[cfg(all(target_os = "linux", not(feature = "cuda"), not(feature = "nvml")))]
+pub fn gpu_free_memory() -> Vec<GpuMemory> {
+    use std::fs;
+
+    let read = |path: std::path::PathBuf| -> Option<u64> {
+        fs::read_to_string(path).ok()?.trim().parse::<u64>().ok()
+    };
+
+    let mut cards: Vec<(u32, std::path::PathBuf)> = fs::read_dir("/sys/class/drm")
+        .into_iter()
+        .flatten()
+        .flatten()
+        .filter_map(|entry| {
+            let name = entry.file_name().to_str()?.to_string();
+            let number = name.strip_prefix("card")?.parse::<u32>().ok()?;
+            Some((number, entry.path()))
+        })
+        .collect();
+    cards.sort_by_key(|(number, _)| *number);
+
+    cards
+        .into_iter()
+        .filter_map(|(_, path)| {
+            let total = read(path.join("device/mem_info_vram_total"))?;
+            let used = read(path.join("device/mem_info_vram_used"))?;
+            Some(total.saturating_sub(used))
+        })
+        .enumerate()
+        .map(|(i, free_bytes)| GpuMemory {
+            index: i as u32,
+            free_bytes,
+        })
+        .collect()
+}
+
+// No per-device VRAM source: macOS (unified memory), Android, Windows
+// without NVML
+#[cfg(not(any(
+    all(
+        not(target_os = "macos"),
+        not(target_os = "android"),
+        any(feature = "cuda", feature = "nvml")
+    ),
+    all(target_os = "linux", not(feature = "cuda"), not(feature = "nvml"))
+)))]
+pub fn gpu_free_memory() -> Vec<GpuMemory> {
+    Vec::new()
+}
+
 #[cfg(target_os = "macos")]
 fn _get_chip_info() -> String {
     let output = crate::util::safe_command::run_command_default(
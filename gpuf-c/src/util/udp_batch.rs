@@ -0,0 +1,339 @@
+//! Batched datagram I/O for the P2P UDP data plane.
+//!
+//! On Linux a receive drains up to `BATCH` datagrams with one `recvmmsg` into
+//! a fixed arena, and queued sends leave with one `sendmmsg`. Elsewhere the
+//! same calls drain the socket with non-blocking `recv_from`/`send_to`, so
+//! callers are written once against the batch API.
+
+use std::io;
+use std::net::SocketAddr;
+
+use tokio::net::UdpSocket;
+
+/// Datagrams moved per receive or send call.
+pub const BATCH: usize = 32;
+/// Arena slot per datagram. P2P datagrams are bounded by the data-plane MTU,
+/// so anything larger is truncated and then fails authentication.
+pub const DATAGRAM_CAPACITY: usize = 2048;
+
+/// Receive arena: `BATCH` fixed slots filled by `recv_batch`.
+pub struct RecvBatch {
+    arena: Box<[u8]>,
+    received: Vec<(usize, SocketAddr)>,
+}
+
+impl RecvBatch {
+    pub fn new() -> Self {
+        Self {
+            arena: vec![0u8; BATCH * DATAGRAM_CAPACITY].into_boxed_slice(),
+            received: Vec::with_capacity(BATCH),
+        }
+    }
+
+    /// Datagrams from the last `recv_batch`, in arrival order.
+    pub fn iter(&self) -> impl Iterator<Item = (&[u8], SocketAddr)> + '_ {
+        self.received
+            .iter()
+            .zip(self.arena.chunks_exact(DATAGRAM_CAPACITY))
+            .map(|(&(len, from), slot)| (&slot[..len], from))
+    }
+}
+
+impl Default for RecvBatch {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+/// Datagrams queued for one `send_batch`.
+#[derive(Default)]
+pub struct SendBatch {
+    buf: Vec<u8>,
+    packets: Vec<(usize, usize, SocketAddr)>,
+}
+
+impl SendBatch {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn push(&mut self, datagram: &[u8], to: SocketAddr) {
+        let start = self.buf.len();
+        self.buf.extend_from_slice(datagram);
+        self.packets.push((start, datagram.len(), to));
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.packets.is_empty()
+    }
+
+    fn packet(&self, i: usize) -> (&[u8], SocketAddr) {
+        let (start, len, to) = self.packets[i];
+        (&self.buf[start..start + len], to)
+    }
+
+    fn clear(&mut self) {
+        self.buf.clear();
+        self.packets.clear();
+    }
+}
+
+#[cfg(target_os = "linux")]
+mod sys {
+    use std::io;
+    use std::mem;
+    use std::net::{Ipv4Addr, Ipv6Addr, SocketAddr, SocketAddrV4, SocketAddrV6};
+    use std::os::fd::RawFd;
+
+    use super::{SendBatch, BATCH, DATAGRAM_CAPACITY};
+
+    fn to_socket_addr(storage: &libc::sockaddr_storage) -> Option<SocketAddr> {
+        match storage.ss_family as libc::c_int {
+            libc::AF_INET => {
+                // SAFETY: the kernel wrote a sockaddr_in for AF_INET.
+                let addr = unsafe { &*(storage as *const _ as *const libc::sockaddr_in) };
+                Some(SocketAddr::V4(SocketAddrV4::new(
+                    Ipv4Addr::from(u32::from_be(addr.sin_addr.s_addr)),
+                    u16::from_be(addr.sin_port),
+                )))
+            }
+            libc::AF_INET6 => {
+                // SAFETY: the kernel wrote a sockaddr_in6 for AF_INET6.
+                let addr = unsafe { &*(storage as *const _ as *const libc::sockaddr_in6) };
+                Some(SocketAddr::V6(SocketAddrV6::new(
+                    Ipv6Addr::from(addr.sin6_addr.s6_addr),
+                    u16::from_be(addr.sin6_port),
+                    addr.sin6_flowinfo,
+                    addr.sin6_scope_id,
+                )))
+            }
+            _ => None,
+        }
+    }
+
+    fn from_socket_addr(addr: &SocketAddr) -> (libc::sockaddr_storage, libc::socklen_t) {
+        // SAFETY: an all-zero sockaddr_storage is valid.
+        let mut storage: libc::sockaddr_storage = unsafe { mem::zeroed() };
+        let len = match addr {
+            SocketAddr::V4(v4) => {
+                // SAFETY: sockaddr_storage is large and aligned enough for sockaddr_in.
+                let out = unsafe { &mut *(&mut storage as *mut _ as *mut libc::sockaddr_in) };
+                out.sin_family = libc::AF_INET as libc::sa_family_t;
+                out.sin_port = v4.port().to_be();
+                out.sin_addr.s_addr = u32::from(*v4.ip()).to_be();
+                mem::size_of::<libc::sockaddr_in>()
+            }
+            SocketAddr::V6(v6) => {
+                // SAFETY: sockaddr_storage is large and aligned enough for sockaddr_in6.
+                let out = unsafe { &mut *(&mut storage as *mut _ as *mut libc::sockaddr_in6) };
+                out.sin6_family = libc::AF_INET6 as libc::sa_family_t;
+                out.sin6_port = v6.port().to_be();
+                out.sin6_addr.s6_addr = v6.ip().octets();
+                out.sin6_flowinfo = v6.flowinfo();
+                out.sin6_scope_id = v6.scope_id();
+                mem::size_of::<libc::sockaddr_in6>()
+            }
+        };
+        (storage, len as libc::socklen_t)
+    }
+
+    pub(super) fn recvmmsg(
+        fd: RawFd,
+        arena: &mut [u8],
+        received: &mut Vec<(usize, SocketAddr)>,
+    ) -> io::Result<()> {
+        // SAFETY: all-zero iovec, mmsghdr and sockaddr_storage are valid.
+        let mut addrs: [libc::sockaddr_storage; BATCH] = unsafe { mem::zeroed() };
+        let mut iovecs: [libc::iovec; BATCH] = unsafe { mem::zeroed() };
+        let mut hdrs: [libc::mmsghdr; BATCH] = unsafe { mem::zeroed() };
+        for (i, slot) in arena.chunks_exact_mut(DATAGRAM_CAPACITY).enumerate() {
+            iovecs[i].iov_base = slot.as_mut_ptr().cast();
+            iovecs[i].iov_len = slot.len();
+            hdrs[i].msg_hdr.msg_name = (&mut addrs[i] as *mut libc::sockaddr_storage).cast();
+            hdrs[i].msg_hdr.msg_namelen = mem::size_of::<libc::sockaddr_storage>() as _;
+            hdrs[i].msg_hdr.msg_iov = &mut iovecs[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+        }
+        // SAFETY: every header points at a live arena slot and address buffer.
+        let n = unsafe {
+            libc::recvmmsg(
+                fd,
+                hdrs.as_mut_ptr(),
+                BATCH as _,
+                libc::MSG_DONTWAIT as _,
+                std::ptr::null_mut(),
+            )
+        };
+        if n < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        received.clear();
+        for i in 0..n as usize {
+            // A datagram from an unknown family still takes its slot so slots
+            // and entries stay aligned; it is reported with an unspecified
+            // address and then fails validation.
+            let from = to_socket_addr(&addrs[i])
+                .unwrap_or_else(|| SocketAddr::from((Ipv4Addr::UNSPECIFIED, 0)));
+            let len = (hdrs[i].msg_len as usize).min(DATAGRAM_CAPACITY);
+            received.push((len, from));
+        }
+        Ok(())
+    }
+
+    /// Send packets from `first` on; returns how many the kernel took.
+    pub(super) fn sendmmsg(fd: RawFd, batch: &SendBatch, first: usize) -> io::Result<usize> {
+        let count = (batch.packets.len() - first).min(BATCH);
+        // SAFETY: all-zero iovec, mmsghdr and sockaddr_storage are valid.
+        let mut addrs: [(libc::sockaddr_storage, libc::socklen_t); BATCH] =
+            unsafe { mem::zeroed() };
+        let mut iovecs: [libc::iovec; BATCH] = unsafe { mem::zeroed() };
+        let mut hdrs: [libc::mmsghdr; BATCH] = unsafe { mem::zeroed() };
+        for i in 0..count {
+            let (datagram, to) = batch.packet(first + i);
+            addrs[i] = from_socket_addr(&to);
+            iovecs[i].iov_base = datagram.as_ptr() as *mut libc::c_void;
+            iovecs[i].iov_len = datagram.len();
+            hdrs[i].msg_hdr.msg_name = (&mut addrs[i].0 as *mut libc::sockaddr_storage).cast();
+            hdrs[i].msg_hdr.msg_namelen = addrs[i].1;
+            hdrs[i].msg_hdr.msg_iov = &mut iovecs[i];
+            hdrs[i].msg_hdr.msg_iovlen = 1;
+        }
+        // SAFETY: every header points at a live datagram and address; the
+        // kernel only reads the iovec buffers.
+        let n = unsafe {
+            libc::sendmmsg(
+                fd,
+                hdrs.as_mut_ptr(),
+                count as _,
+                libc::MSG_DONTWAIT as _,
+            )
+        };
+        if n < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(n as usize)
+    }
+}
+
+/// Wait for at least one datagram and take everything queued, up to `BATCH`.
+/// Returns the number of datagrams now in `batch`.
+#[cfg(target_os = "linux")]
+pub async fn recv_batch(socket: &UdpSocket, batch: &mut RecvBatch) -> io::Result<usize> {
+    use std::os::fd::AsRawFd;
+    use tokio::io::Interest;
+
+    loop {
+        socket.readable().await?;
+        match socket.try_io(Interest::READABLE, || {
+            sys::recvmmsg(socket.as_raw_fd(), &mut batch.arena, &mut batch.received)
+        }) {
+            Ok(()) => return Ok(batch.received.len()),
+            Err(e) if e.kind() == io::ErrorKind::WouldBlock => continue,
+            Err(e) => return Err(e),
+        }
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+pub async fn recv_batch(socket: &UdpSocket, batch: &mut RecvBatch) -> io::Result<usize> {
+    let RecvBatch { arena, received } = batch;
+    received.clear();
+    let mut slots = arena.chunks_exact_mut(DATAGRAM_CAPACITY);
+    let first = slots.next().expect("receive arena has slots");
+    loop {
+        match socket.recv_from(first).await {
+            Ok((len, from)) => {
+                received.push((len, from));
+                break;
+            }
+            Err(e) if is_oversized(&e) => continue,
+            Err(e) => return Err(e),
+        }
+    }
+    for slot in slots {
+        match socket.try_recv_from(slot) {
+            Ok((len, from)) => received.push((len, from)),
+            Err(e) if is_oversized(&e) => continue,
+            Err(_) => break,
+        }
+    }
+    Ok(received.len())
+}
+
+/// Windows reports a datagram larger than the buffer as an error rather than
+/// truncating it; such datagrams are dropped.
+#[cfg(not(target_os = "linux"))]
+fn is_oversized(e: &io::Error) -> bool {
+    cfg!(windows) && e.raw_os_error() == Some(10040) // WSAEMSGSIZE
+}
+
+/// Send everything queued in `batch` and clear it.
+#[cfg(target_os = "linux")]
+pub async fn send_batch(socket: &UdpSocket, batch: &mut SendBatch) -> io::Result<()> {
+    use std::os::fd::AsRawFd;
+    use tokio::io::Interest;
+
+    let mut sent = 0;
+    let result = loop {
+        if sent >= batch.packets.len() {
+            break Ok(());
+        }
+        if let Err(e) = socket.writable().await {
+            break Err(e);
+        }
+        match socket.try_io(Interest::WRITABLE, || {
+            sys::sendmmsg(socket.as_raw_fd(), batch, sent)
+        }) {
+            Ok(n) => sent += n,
+            Err(e) if e.kind() == io::ErrorKind::WouldBlock => continue,
+            Err(e) => break Err(e),
+        }
+    };
+    batch.clear();
+    result
+}
+
+#[cfg(not(target_os = "linux"))]
+pub async fn send_batch(socket: &UdpSocket, batch: &mut SendBatch) -> io::Result<()> {
+    let mut result = Ok(());
+    for i in 0..batch.packets.len() {
+        let (datagram, to) = batch.packet(i);
+        if let Err(e) = socket.send_to(datagram, to).await {
+            result = Err(e);
+            break;
+        }
+    }
+    batch.clear();
+    result
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[tokio::test]
+    async fn batches_round_trip_over_loopback() {
+        let rx = UdpSocket::bind("127.0.0.1:0").await.unwrap();
+        let tx = UdpSocket::bind("127.0.0.1:0").await.unwrap();
+        let to = rx.local_addr().unwrap();
+
+        let mut out = SendBatch::new();
+        for i in 0..5u8 {
+            out.push(&vec![i; 100 + i as usize], to);
+        }
+        send_batch(&tx, &mut out).await.unwrap();
+        assert!(out.is_empty());
+
+        let mut batch = RecvBatch::new();
+        let mut seen = Vec::new();
+        while seen.len() < 5 {
+            recv_batch(&rx, &mut batch).await.unwrap();
+            for (datagram, from) in batch.iter() {
+                assert_eq!(from, tx.local_addr().unwrap());
+                seen.push((datagram[0], datagram.len()));
+            }
+        }
+        let expected: Vec<_> = (0..5u8).map(|i| (i, 100 + i as usize)).collect();
+        assert_eq!(seen, expected);
+    }
+}
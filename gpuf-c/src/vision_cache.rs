@@ -0,0 +1,436 @@
+// ============================================================================
+// Vision-encoder embedding cache
+// ============================================================================
+//
+// Multimodal requests tokenize the prompt and image into mtmd chunks and
+// evaluate them in order. The image chunks go through the vision encoder and
+// projector, which is by far the slowest step, yet multi-turn conversations
+// send the same image on every turn. Encoded image embeddings
+// (`mtmd_get_output_embd`) are therefore kept in a byte-bounded LRU cache
+// keyed by the multimodal model, its projector type and the SHA-256 of the
+// image bytes; a hit decodes the cached embeddings straight into the text
+// model and skips `mtmd_encode_chunk`.
+// ============================================================================
+
+use std::ffi::c_int;
+use std::sync::{Arc, Mutex};
+
+/// Default byte budget of the embedding cache, in megabytes.
+pub const VISION_CACHE_DEFAULT_BUDGET_MB: u64 = 64;
+
+/// Counters of the vision embedding cache since process start or the last
+/// `gpuf_vision_cache_clear`.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct gpuf_vision_cache_stats {
+    /// Image chunks served from the cache.
+    pub hits: u64,
+    /// Image chunks that had to be encoded.
+    pub misses: u64,
+    /// Cached images.
+    pub entries: u64,
+    /// Bytes of cached embeddings.
+    pub bytes: u64,
+    /// Current byte budget.
+    pub budget_bytes: u64,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+struct ImageKey {
+    /// `gpuf_multimodal_model` pointer
+    model: usize,
+    projector: c_int,
+    digest: [u8; 32],
+    /// Index of the image among the request's image chunks.
+    ordinal: usize,
+}
+
+struct CachedEmbedding {
+    key: ImageKey,
+    embd: Arc<[f32]>,
+    last_used: u64,
+}
+
+struct EmbeddingCache {
+    entries: Vec<CachedEmbedding>,
+    budget_bytes: usize,
+    used_bytes: usize,
+    tick: u64,
+    hits: u64,
+    misses: u64,
+}
+
+fn embedding_bytes(embd: &[f32]) -> usize {
+    std::mem::size_of_val(embd)
+}
+
+impl EmbeddingCache {
+    const fn new(budget_bytes: usize) -> Self {
+        Self {
+            entries: Vec::new(),
+            budget_bytes,
+            used_bytes: 0,
+            tick: 0,
+            hits: 0,
+            misses: 0,
+        }
+    }
+
+    /// Embeddings of `key` if cached with exactly `n_values` floats.
+    fn get(&mut self, key: &ImageKey, n_values: usize) -> Option<Arc<[f32]>> {
+        self.tick += 1;
+        match self.entries.iter().position(|entry| entry.key == *key) {
+            Some(idx) if self.entries[idx].embd.len() == n_values => {
+                self.hits += 1;
+                let entry = &mut self.entries[idx];
+                entry.last_used = self.tick;
+                Some(entry.embd.clone())
+            }
+            Some(idx) => {
+                // Same image, different chunk layout: re-encode
+                self.misses += 1;
+                self.remove(idx);
+                None
+            }
+            None => {
+                self.misses += 1;
+                None
+            }
+        }
+    }
+
+    fn insert(&mut self, key: ImageKey, embd: Arc<[f32]>) {
+        if let Some(idx) = self.entries.iter().position(|entry| entry.key == key) {
+            self.remove(idx);
+        }
+        let bytes = embedding_bytes(&embd);
+        if bytes > self.budget_bytes {
+            return;
+        }
+        self.evict_until(self.budget_bytes - bytes);
+        self.tick += 1;
+        self.used_bytes += bytes;
+        self.entries.push(CachedEmbedding {
+            key,
+            embd,
+            last_used: self.tick,
+        });
+    }
+
+    fn remove(&mut self, idx: usize) {
+        let entry = self.entries.swap_remove(idx);
+        self.used_bytes -= embedding_bytes(&entry.embd);
+    }
+
+    /// Drop least recently used entries until at most `bytes` are cached.
+    fn evict_until(&mut self, bytes: usize) {
+        while self.used_bytes > bytes {
+            let Some(idx) = self
+                .entries
+                .iter()
+                .enumerate()
+                .min_by_key(|(_, entry)| entry.last_used)
+                .map(|(idx, _)| idx)
+            else {
+                break;
+            };
+            self.remove(idx);
+        }
+    }
+
+    fn set_budget(&mut self, budget_bytes: usize) {
+        self.budget_bytes = budget_bytes;
+        self.evict_until(budget_bytes);
+    }
+
+    fn forget_model(&mut self, model: usize) {
+        let mut idx = 0;
+        while idx < self.entries.len() {
+            if self.entries[idx].key.model == model {
+                self.remove(idx);
+            } else {
+                idx += 1;
+            }
+        }
+    }
+
+    fn clear(&mut self) {
+        self.entries.clear();
+        self.used_bytes = 0;
+        self.hits = 0;
+        self.misses = 0;
+    }
+
+    fn stats(&self) -> gpuf_vision_cache_stats {
+        gpuf_vision_cache_stats {
+            hits: self.hits,
+            misses: self.misses,
+            entries: self.entries.len() as u64,
+            bytes: self.used_bytes as u64,
+            budget_bytes: self.budget_bytes as u64,
+        }
+    }
+}
+
+static CACHE: Mutex<EmbeddingCache> = Mutex::new(EmbeddingCache::new(
+    (VISION_CACHE_DEFAULT_BUDGET_MB as usize) << 20,
+));
+
+fn cache() -> std::sync::MutexGuard<'static, EmbeddingCache> {
+    CACHE.lock().unwrap_or_else(|p| p.into_inner())
+}
+
+#[cfg(target_os = "android")]
+mod engine {
+    use super::*;
+    use crate::{
+        gpuf_multimodal_model, llama_context, llama_get_memory, llama_memory_seq_rm,
+        llama_model_n_embd, mtmd_encode_chunk, mtmd_get_output_embd,
+        mtmd_helper_decode_image_chunk, mtmd_helper_eval_chunk_single,
+        mtmd_input_chunk_get_n_tokens, mtmd_input_chunk_get_tokens_text, mtmd_input_chunk_get_type,
+        mtmd_input_chunks_get, mtmd_input_chunks_size, LlamaToken, MtmdInputChunks, MtmdLlamaPos,
+        MtmdLlamaSeqId, ProjectorType,
+    };
+    use sha2::{Digest, Sha256};
+
+    const MTMD_INPUT_CHUNK_TYPE_TEXT: c_int = 0;
+    const MTMD_INPUT_CHUNK_TYPE_IMAGE: c_int = 1;
+
+    unsafe fn text_tokens<'a>(chunk: *const std::ffi::c_void) -> Option<&'a [LlamaToken]> {
+        if mtmd_input_chunk_get_type(chunk) != MTMD_INPUT_CHUNK_TYPE_TEXT {
+            return None;
+        }
+        let mut n_tokens = 0usize;
+        let tokens = mtmd_input_chunk_get_tokens_text(chunk, &mut n_tokens);
+        if tokens.is_null() {
+            return None;
+        }
+        Some(std::slice::from_raw_parts(tokens, n_tokens))
+    }
+
+    /// Qwen3-VL appends deepstack features to every image token, so its
+    /// encoder output is wider than the text model's embeddings.
+    fn cacheable(projector: ProjectorType) -> bool {
+        !matches!(projector, ProjectorType::Qwen3VL)
+    }
+
+    /// Cache-aware replacement for `mtmd_helper_eval_chunks` with the same
+    /// arguments plus the raw `image` bytes the chunks were tokenized from.
+    /// `prefilled` are leading prompt tokens already decoded into `seq_id`
+    /// from `n_past`; a first text chunk holding exactly those is skipped.
+    ///
+    /// # Safety
+    /// `model` must be a live multimodal model, `ctx` a context on its text
+    /// model and `chunks` the output of `mtmd_tokenize` on that model.
+    #[allow(clippy::too_many_arguments)]
+    pub(crate) unsafe fn eval_chunks(
+        model: *mut gpuf_multimodal_model,
+        ctx: *mut llama_context,
+        chunks: *mut MtmdInputChunks,
+        image: &[u8],
+        n_past: MtmdLlamaPos,
+        seq_id: MtmdLlamaSeqId,
+        n_batch: c_int,
+        logits_last: bool,
+        prefilled: &[LlamaToken],
+        new_n_past: &mut MtmdLlamaPos,
+    ) -> c_int {
+        let model_ref = &*model;
+        let mtmd_ctx = model_ref.mtmd_context;
+        let use_cache = !image.is_empty() && cacheable(model_ref.projector_type);
+        let digest: [u8; 32] = if use_cache {
+            Sha256::digest(image).into()
+        } else {
+            [0; 32]
+        };
+        let n_embd = llama_model_n_embd(model_ref.text_model).max(0) as usize;
+
+        let n_chunks = mtmd_input_chunks_size(chunks);
+        let mut n_past = n_past;
+        let mut ordinal = 0;
+        for i in 0..n_chunks {
+            let chunk = mtmd_input_chunks_get(chunks, i);
+            let last = i + 1 == n_chunks;
+            if i == 0 && !prefilled.is_empty() {
+                if !(logits_last && last) && text_tokens(chunk) == Some(prefilled) {
+                    n_past += prefilled.len() as MtmdLlamaPos;
+                    continue;
+                }
+                llama_memory_seq_rm(llama_get_memory(ctx), seq_id, n_past, -1);
+            }
+            if !use_cache || mtmd_input_chunk_get_type(chunk) != MTMD_INPUT_CHUNK_TYPE_IMAGE {
+                let result = mtmd_helper_eval_chunk_single(
+                    mtmd_ctx,
+                    ctx,
+                    chunk,
+                    n_past,
+                    seq_id,
+                    n_batch,
+                    logits_last && last,
+                    &mut n_past,
+                );
+                if result != 0 {
+                    return result;
+                }
+                continue;
+            }
+
+            let key = ImageKey {
+                model: model as usize,
+                projector: model_ref.projector_type as c_int,
+                digest,
+                ordinal,
+            };
+            ordinal += 1;
+            let n_values = mtmd_input_chunk_get_n_tokens(chunk) * n_embd;
+            let cached = cache().get(&key, n_values);
+            let embd = match cached {
+                Some(embd) => {
+                    println!("✅ Vision cache hit ({} values)", n_values);
+                    embd
+                }
+                None => {
+                    let result = mtmd_encode_chunk(mtmd_ctx, chunk);
+                    if result != 0 {
+                        return result;
+                    }
+                    let output = mtmd_get_output_embd(mtmd_ctx);
+                    if output.is_null() {
+                        return -1;
+                    }
+                    let embd: Arc<[f32]> = std::slice::from_raw_parts(output, n_values).into();
+                    cache().insert(key, embd.clone());
+                    embd
+                }
+            };
+
+            // The helper only reads the embeddings despite the mutable pointer
+            let result = mtmd_helper_decode_image_chunk(
+                mtmd_ctx,
+                ctx,
+                chunk,
+                embd.as_ptr() as *mut f32,
+                n_past,
+                seq_id,
+                n_batch,
+                &mut n_past,
+            );
+            if result != 0 {
+                return result;
+            }
+        }
+        *new_n_past = n_past;
+        0
+    }
+}
+
+#[cfg(target_os = "android")]
+pub(crate) use engine::eval_chunks;
+
+/// The multimodal model at `model` is being freed; drop its embeddings.
+pub(crate) fn forget_model(model: *const crate::gpuf_multimodal_model) {
+    cache().forget_model(model as usize);
+}
+
+/// Limit the vision embedding cache to `budget_mb` megabytes (default
+/// `VISION_CACHE_DEFAULT_BUDGET_MB`, 0 disables caching). Least recently
+/// used images are evicted first.
+#[no_mangle]
+pub extern "C" fn gpuf_vision_cache_set_budget_mb(budget_mb: u64) {
+    cache().set_budget(budget_mb.saturating_mul(1 << 20) as usize);
+}
+
+/// Drop all cached image embeddings and reset the hit/miss counters.
+#[no_mangle]
+pub extern "C" fn gpuf_vision_cache_clear() {
+    cache().clear();
+}
+
+/// Copy the vision embedding cache counters into `stats`.
+/// Returns 0 on success or -1 for a null `stats`.
+///
+/// # Safety
+/// `stats` must point to writable memory for one `gpuf_vision_cache_stats`.
+#[no_mangle]
+pub extern "C" fn gpuf_vision_cache_get_stats(stats: *mut gpuf_vision_cache_stats) -> c_int {
+    if stats.is_null() {
+        return -1;
+    }
+    let current = cache().stats();
+    // SAFETY: `stats` was checked for null and is writable per contract.
+    unsafe { stats.write(current) };
+    0
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn key(model: usize, digest: u8) -> ImageKey {
+        ImageKey {
+            model,
+            projector: 3,
+            digest: [digest; 32],
+            ordinal: 0,
+        }
+    }
+
+    fn embd(values: usize) -> Arc<[f32]> {
+        vec![0.5; values].into()
+    }
+
+    #[test]
+    fn hits_only_for_same_image_and_layout() {
+        let mut cache = EmbeddingCache::new(1 << 20);
+        assert!(cache.get(&key(1, 7), 16).is_none());
+        cache.insert(key(1, 7), embd(16));
+
+        assert_eq!(cache.get(&key(1, 7), 16).map(|e| e.len()), Some(16));
+        // Another model or image misses
+        assert!(cache.get(&key(2, 7), 16).is_none());
+        assert!(cache.get(&key(1, 8), 16).is_none());
+        // A different token count invalidates the entry
+        assert!(cache.get(&key(1, 7), 32).is_none());
+        assert_eq!(cache.stats().entries, 0);
+
+        let stats = cache.stats();
+        assert_eq!((stats.hits, stats.misses), (1, 4));
+    }
+
+    #[test]
+    fn evicts_least_recently_used_within_budget() {
+        // Room for two 64-value (256-byte) entries
+        let mut cache = EmbeddingCache::new(600);
+        cache.insert(key(1, 1), embd(64));
+        cache.insert(key(1, 2), embd(64));
+        assert!(cache.get(&key(1, 1), 64).is_some());
+        cache.insert(key(1, 3), embd(64));
+
+        assert!(cache.get(&key(1, 2), 64).is_none());
+        assert!(cache.get(&key(1, 1), 64).is_some());
+        assert!(cache.get(&key(1, 3), 64).is_some());
+        assert_eq!(cache.stats().bytes, 512);
+
+        // Entries larger than the budget are not kept
+        cache.insert(key(1, 4), embd(200));
+        assert!(cache.get(&key(1, 4), 200).is_none());
+
+        cache.set_budget(300);
+        assert_eq!(cache.stats().entries, 1);
+        cache.set_budget(0);
+        assert_eq!(cache.stats().bytes, 0);
+    }
+
+    #[test]
+    fn forget_model_drops_only_its_entries() {
+        let mut cache = EmbeddingCache::new(1 << 20);
+        cache.insert(key(1, 1), embd(8));
+        cache.insert(key(2, 1), embd(8));
+        cache.insert(key(1, 2), embd(8));
+        cache.forget_model(1);
+
+        let stats = cache.stats();
+        assert_eq!((stats.entries, stats.bytes), (1, 32));
+        assert!(cache.get(&key(2, 1), 8).is_some());
+    }
+}
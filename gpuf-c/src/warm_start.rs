@@ -0,0 +1,447 @@
+// ============================================================================
+// Warm start: persisted system-prompt state next to the model files
+// ============================================================================
+//
+// A cold worker has to load the weights and then prefill the same system
+// prompt before its first token, every time the app starts. With warm start
+// enabled (`gpuf_warm_start_enable`), every new context decodes each prompt
+// registered with `gpuf_warm_start_add_prompt` once, saves the resulting
+// sequence state with `llama_state_seq_save_file` and, on the next start,
+// loads it back instead of prefilling again. Each prompt also becomes a
+// named prefix snapshot (`gpuf_prefix_snapshot_restore`), and the first one
+// is left resident in sequence 0, so a request that begins with it only
+// decodes its own suffix.
+//
+// Cache files live in `.gpuf-warm` beside the model (or in the directory
+// passed to `gpuf_warm_start_enable`) and are keyed by the prompt, the
+// model file's size and modification time and the context options that
+// shape the KV cache, so replacing the model or changing the cache type
+// never restores incompatible state; stale files of a model are removed as
+// it warms. Weights are mmapped and stay on the CPU on mobile, which leaves
+// no GPU pipeline cache worth persisting.
+// ============================================================================
+
+use std::ffi::{c_char, c_int, CStr};
+use std::path::{Path, PathBuf};
+use std::sync::Mutex;
+
+use sha2::{Digest, Sha256};
+
+use crate::context_options::gpuf_context_options;
+use crate::prefix_cache::MAX_PREFIX_SNAPSHOTS;
+
+/// Bump when the key inputs or the file layout change.
+const CACHE_VERSION: u32 = 1;
+const CACHE_DIR: &str = ".gpuf-warm";
+const CACHE_EXT: &str = "state";
+
+struct WarmPrompt {
+    name: String,
+    text: String,
+}
+
+struct WarmConfig {
+    enabled: bool,
+    dir: Option<PathBuf>,
+    prompts: Vec<WarmPrompt>,
+}
+
+static CONFIG: Mutex<WarmConfig> = Mutex::new(WarmConfig {
+    enabled: false,
+    dir: None,
+    prompts: Vec::new(),
+});
+
+fn config() -> std::sync::MutexGuard<'static, WarmConfig> {
+    CONFIG.lock().unwrap_or_else(|p| p.into_inner())
+}
+
+/// Identity of a model file: size and modification time (seconds).
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+struct ModelFingerprint {
+    len: u64,
+    mtime: u64,
+}
+
+fn fingerprint(model_path: &Path) -> Option<ModelFingerprint> {
+    let meta = std::fs::metadata(model_path).ok()?;
+    let mtime = meta
+        .modified()
+        .ok()
+        .and_then(|t| t.duration_since(std::time::UNIX_EPOCH).ok())
+        .map_or(0, |d| d.as_secs());
+    Some(ModelFingerprint {
+        len: meta.len(),
+        mtime,
+    })
+}
+
+fn model_stem(model_path: &Path) -> &str {
+    model_path
+        .file_stem()
+        .and_then(|s| s.to_str())
+        .unwrap_or("model")
+}
+
+/// Hex key of the state `prompt` leaves in a context created with `options`
+/// on the model file identified by `model`.
+fn cache_key(model: ModelFingerprint, options: &gpuf_context_options, prompt: &str) -> String {
+    let mut hasher = Sha256::new();
+    hasher.update(CACHE_VERSION.to_le_bytes());
+    hasher.update(model.len.to_le_bytes());
+    hasher.update(model.mtime.to_le_bytes());
+    hasher.update(options.n_ctx.to_le_bytes());
+    hasher.update(options.type_k.to_le_bytes());
+    hasher.update(options.type_v.to_le_bytes());
+    hasher.update(options.flash_attn.to_le_bytes());
+    hasher.update(prompt.as_bytes());
+    hex::encode(&hasher.finalize()[..8])
+}
+
+fn cache_dir(configured: Option<&Path>, model_path: &Path) -> PathBuf {
+    match configured {
+        Some(dir) => dir.to_path_buf(),
+        None => model_path
+            .parent()
+            .unwrap_or_else(|| Path::new("."))
+            .join(CACHE_DIR),
+    }
+}
+
+fn cache_file_name(model_path: &Path, key: &str) -> String {
+    format!("{}-{}.{}", model_stem(model_path), key, CACHE_EXT)
+}
+
+/// Whether `file_name` is a cache file of the model at `model_path` that
+/// none of the `live` names refer to.
+fn is_stale(file_name: &str, model_path: &Path, live: &[String]) -> bool {
+    let prefix = format!("{}-", model_stem(model_path));
+    let Some(key) = file_name
+        .strip_prefix(&prefix)
+        .and_then(|rest| rest.strip_suffix(&format!(".{}", CACHE_EXT)))
+    else {
+        return false;
+    };
+    // Another model whose stem extends this one ("qwen" vs "qwen-7b")
+    // leaves a dash in what would be the key.
+    key.len() == 16 && !key.contains('-') && !live.iter().any(|l| l == file_name)
+}
+
+unsafe fn c_string(s: *const c_char) -> Option<String> {
+    if s.is_null() {
+        return None;
+    }
+    CStr::from_ptr(s)
+        .to_str()
+        .ok()
+        .filter(|s| !s.is_empty())
+        .map(str::to_string)
+}
+
+pub(crate) fn enabled() -> bool {
+    let config = config();
+    config.enabled && !config.prompts.is_empty()
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+mod engine {
+    use super::*;
+    use crate::{
+        llama_batch_get_one, llama_context, llama_decode, llama_get_memory, llama_memory_seq_rm,
+        llama_model, llama_model_get_vocab, llama_n_batch, llama_n_ctx, llama_state_seq_load_file,
+        llama_state_seq_save_file, llama_tokenize, llama_vocab, prefix_cache, LlamaToken,
+    };
+    use once_cell::sync::Lazy;
+    use std::collections::HashMap;
+    use std::ffi::CString;
+
+    /// model pointer -> file it was loaded from
+    static MODEL_PATHS: Lazy<Mutex<HashMap<usize, PathBuf>>> =
+        Lazy::new(|| Mutex::new(HashMap::new()));
+
+    pub(crate) fn note_model(model: *mut llama_model, path: &str) {
+        MODEL_PATHS
+            .lock()
+            .unwrap_or_else(|p| p.into_inner())
+            .insert(model as usize, PathBuf::from(path));
+    }
+
+    /// The model is being freed; its pointer may be reused.
+    pub(crate) fn forget_model(model: *mut llama_model) {
+        MODEL_PATHS
+            .lock()
+            .unwrap_or_else(|p| p.into_inner())
+            .remove(&(model as usize));
+    }
+
+    unsafe fn tokenize(vocab: *const llama_vocab, text: &str) -> Vec<LlamaToken> {
+        let mut tokens: Vec<LlamaToken> = vec![0; text.len() + 2];
+        let n = llama_tokenize(
+            vocab,
+            text.as_ptr() as *const c_char,
+            text.len() as c_int,
+            tokens.as_mut_ptr(),
+            tokens.len() as c_int,
+            true,
+            true,
+        );
+        tokens.truncate(n.max(0) as usize);
+        tokens
+    }
+
+    /// Decode `text` into the empty sequence 0 of `ctx`.
+    unsafe fn prefill(
+        ctx: *mut llama_context,
+        vocab: *const llama_vocab,
+        text: &str,
+    ) -> Vec<LlamaToken> {
+        let mut tokens = tokenize(vocab, text);
+        if tokens.is_empty() || tokens.len() >= llama_n_ctx(ctx) as usize {
+            return Vec::new();
+        }
+        let n_batch = llama_n_batch(ctx).max(1) as usize;
+        for chunk in tokens.chunks_mut(n_batch) {
+            if llama_decode(
+                ctx,
+                llama_batch_get_one(chunk.as_mut_ptr(), chunk.len() as c_int),
+            ) != 0
+            {
+                return Vec::new();
+            }
+        }
+        tokens
+    }
+
+    unsafe fn load(ctx: *mut llama_context, path: &CString) -> Option<Vec<LlamaToken>> {
+        let mut tokens: Vec<LlamaToken> = vec![0; llama_n_ctx(ctx).max(0) as usize];
+        let mut n_tokens = 0usize;
+        let read = llama_state_seq_load_file(
+            ctx,
+            path.as_ptr(),
+            0,
+            tokens.as_mut_ptr(),
+            tokens.len(),
+            &mut n_tokens,
+        );
+        if read == 0 || n_tokens == 0 {
+            return None;
+        }
+        tokens.truncate(n_tokens);
+        Some(tokens)
+    }
+
+    /// Bring every configured prompt into `ctx`, from the cache when
+    /// possible, and leave the first one resident in sequence 0.
+    pub(crate) unsafe fn warm(
+        ctx: *mut llama_context,
+        model: *mut llama_model,
+        options: &gpuf_context_options,
+    ) {
+        let (dir, prompts) = {
+            let config = config();
+            if !config.enabled || config.prompts.is_empty() {
+                return;
+            }
+            let prompts: Vec<(String, String)> = config
+                .prompts
+                .iter()
+                .map(|p| (p.name.clone(), p.text.clone()))
+                .collect();
+            (config.dir.clone(), prompts)
+        };
+        let Some(model_path) = MODEL_PATHS
+            .lock()
+            .unwrap_or_else(|p| p.into_inner())
+            .get(&(model as usize))
+            .cloned()
+        else {
+            return;
+        };
+        let Some(print) = fingerprint(&model_path) else {
+            return;
+        };
+        let dir = cache_dir(dir.as_deref(), &model_path);
+        if let Err(e) = std::fs::create_dir_all(&dir) {
+            println!(
+                "⚠️ Warm start disabled, cannot create {}: {}",
+                dir.display(),
+                e
+            );
+            return;
+        }
+
+        let vocab = llama_model_get_vocab(model);
+        let kv = llama_get_memory(ctx);
+        let started = std::time::Instant::now();
+        let mut live = Vec::with_capacity(prompts.len());
+        // The first prompt goes last so it stays resident.
+        for (name, text) in prompts.iter().rev() {
+            let file_name = cache_file_name(&model_path, &cache_key(print, options, text));
+            let Ok(path) = CString::new(dir.join(&file_name).to_string_lossy().as_bytes()) else {
+                continue;
+            };
+            live.push(file_name);
+
+            llama_memory_seq_rm(kv, 0, -1, -1);
+            let tokens = match load(ctx, &path) {
+                Some(tokens) => tokens,
+                None => {
+                    llama_memory_seq_rm(kv, 0, -1, -1);
+                    let tokens = prefill(ctx, vocab, text);
+                    if tokens.is_empty() {
+                        println!("⚠️ Warm start prompt '{}' could not be decoded", name);
+                        llama_memory_seq_rm(kv, 0, -1, -1);
+                        prefix_cache::forget(ctx);
+                        continue;
+                    }
+                    if llama_state_seq_save_file(
+                        ctx,
+                        path.as_ptr(),
+                        0,
+                        tokens.as_ptr(),
+                        tokens.len(),
+                    ) == 0
+                    {
+                        println!("⚠️ Warm start state for '{}' could not be saved", name);
+                    }
+                    tokens
+                }
+            };
+            prefix_cache::record_sequence(ctx, &tokens);
+            prefix_cache::save_named(ctx, name.clone());
+        }
+
+        if let Ok(entries) = std::fs::read_dir(&dir) {
+            for entry in entries.flatten() {
+                let file_name = entry.file_name();
+                if is_stale(&file_name.to_string_lossy(), &model_path, &live) {
+                    let _ = std::fs::remove_file(entry.path());
+                }
+            }
+        }
+        println!(
+            "✅ Warm start: {} prompt(s) ready in {} ms",
+            prompts.len(),
+            started.elapsed().as_millis()
+        );
+    }
+}
+
+#[cfg(any(target_os = "android", target_os = "ios"))]
+pub(crate) use engine::{forget_model, note_model, warm};
+
+/// Turn warm start on. Cache files go to `cache_dir`, or to a `.gpuf-warm`
+/// directory next to each model file when it is null. Takes effect for
+/// contexts created afterwards. Returns 0, or -1 for an invalid `cache_dir`.
+///
+/// # Safety
+/// `cache_dir` must be null or a valid NUL-terminated C string.
+#[no_mangle]
+pub unsafe extern "C" fn gpuf_warm_start_enable(cache_dir: *const c_char) -> c_int {
+    let dir = if cache_dir.is_null() {
+        None
+    } else {
+        match c_string(cache_dir) {
+            Some(dir) => Some(PathBuf::from(dir)),
+            None => return -1,
+        }
+    };
+    let mut config = config();
+    config.enabled = true;
+    config.dir = dir;
+    0
+}
+
+/// Turn warm start off and forget the registered prompts. Cache files stay
+/// on disk.
+#[no_mangle]
+pub extern "C" fn gpuf_warm_start_disable() {
+    let mut config = config();
+    config.enabled = false;
+    config.dir = None;
+    config.prompts.clear();
+}
+
+/// Register `prompt`, already rendered with the model's chat template
+/// (e.g. the full system turn), to be warmed under the snapshot `name`.
+/// Re-registering a name replaces its text. Returns the number of prompts,
+/// -1 for invalid arguments or -2 when `MAX_PREFIX_SNAPSHOTS` are registered.
+///
+/// # Safety
+/// `name` and `prompt` must be valid NUL-terminated C strings.
+#[no_mangle]
+pub unsafe extern "C" fn gpuf_warm_start_add_prompt(
+    name: *const c_char,
+    prompt: *const c_char,
+) -> c_int {
+    let (Some(name), Some(text)) = (c_string(name), c_string(prompt)) else {
+        return -1;
+    };
+    let mut config = config();
+    if let Some(existing) = config.prompts.iter_mut().find(|p| p.name == name) {
+        existing.text = text;
+    } else if config.prompts.len() >= MAX_PREFIX_SNAPSHOTS {
+        return -2;
+    } else {
+        config.prompts.push(WarmPrompt { name, text });
+    }
+    config.prompts.len() as c_int
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const MODEL: ModelFingerprint = ModelFingerprint {
+        len: 1 << 30,
+        mtime: 1_700_000_000,
+    };
+
+    #[test]
+    fn key_tracks_model_options_and_prompt() {
+        let options = gpuf_context_options::default();
+        let key = cache_key(MODEL, &options, "You are helpful.");
+        assert_eq!(key.len(), 16);
+        assert_eq!(key, cache_key(MODEL, &options, "You are helpful."));
+
+        let touched = ModelFingerprint {
+            mtime: MODEL.mtime + 1,
+            ..MODEL
+        };
+        assert_ne!(key, cache_key(touched, &options, "You are helpful."));
+        assert_ne!(key, cache_key(MODEL, &options, "You are terse."));
+        let quantized = gpuf_context_options {
+            type_k: crate::context_options::KV_CACHE_Q8_0,
+            ..options
+        };
+        assert_ne!(key, cache_key(MODEL, &quantized, "You are helpful."));
+    }
+
+    #[test]
+    fn files_sit_next_to_the_model() {
+        let model = Path::new("/data/models/qwen2.5-0.5b.gguf");
+        assert_eq!(
+            cache_dir(None, model),
+            PathBuf::from("/data/models/.gpuf-warm")
+        );
+        assert_eq!(
+            cache_dir(Some(Path::new("/cache")), model),
+            PathBuf::from("/cache")
+        );
+        assert_eq!(
+            cache_file_name(model, "0123456789abcdef"),
+            "qwen2.5-0.5b-0123456789abcdef.state"
+        );
+    }
+
+    #[test]
+    fn prunes_only_stale_files_of_the_same_model() {
+        let model = Path::new("/m/qwen.gguf");
+        let live = vec!["qwen-0123456789abcdef.state".to_string()];
+        assert!(!is_stale("qwen-0123456789abcdef.state", model, &live));
+        assert!(is_stale("qwen-fedcba9876543210.state", model, &live));
+        assert!(!is_stale("qwen-7b-fedcba9876543210.state", model, &live));
+        assert!(!is_stale("llama-fedcba9876543210.state", model, &live));
+        assert!(!is_stale("qwen-notes.txt", model, &live));
+    }
+}
@@ -1,6 +1,6 @@
 use anyhow::Result;
 use clap::Parser;
-use gpuf_s::{consumer, points_sync};
+use gpuf_s::{consumer, db::rollup, points_sync};
 use tracing::{error, info, warn};
 use tracing_subscriber::{fmt, EnvFilter};
 
@@ -77,6 +77,14 @@ pub struct Args {
         default_value = "10"
     )]
     pub points_credit_sync_max_attempts: i32,
+
+    /// Days of raw heartbeats to keep; 0 keeps them forever.
+    #[arg(long, env = "GPUF_HEARTBEAT_RETENTION_DAYS", default_value = "7")]
+    pub heartbeat_retention_days: i64,
+
+    /// Days of per-minute heartbeat rollups to keep; 0 keeps them forever.
+    #[arg(long, env = "GPUF_MINUTE_ROLLUP_RETENTION_DAYS", default_value = "30")]
+    pub minute_rollup_retention_days: i64,
 }
 #[tokio::main]
 async fn main() -> Result<()> {
@@ -133,6 +141,33 @@ async fn main() -> Result<()> {
         }
     });
 
+    let prune_pool = db_pool.clone();
+    let heartbeat_retention_days = args.heartbeat_retention_days;
+    let minute_rollup_retention_days = args.minute_rollup_retention_days;
+    tokio::spawn(async move {
+        let mut ticker = tokio::time::interval(Duration::from_secs(3600));
+        loop {
+            ticker.tick().await;
+
+            match rollup::prune_heartbeats(&prune_pool, heartbeat_retention_days).await {
+                Ok(n) if n > 0 => info!(
+                    "Pruned {} heartbeats older than {} days",
+                    n, heartbeat_retention_days
+                ),
+                Ok(_) => {}
+                Err(e) => error!("Failed to prune heartbeats: {}", e),
+            }
+            match rollup::prune_minute_rollups(&prune_pool, minute_rollup_retention_days).await {
+                Ok(n) if n > 0 => info!(
+                    "Pruned {} minute rollups older than {} days",
+                    n, minute_rollup_retention_days
+                ),
+                Ok(_) => {}
+                Err(e) => error!("Failed to prune minute rollups: {}", e),
+            }
+        }
+    });
+
     let mut points_sync_config = points_sync::PointsSyncConfig {
         enabled: args.points_credit_sync_enabled,
         endpoint: args.points_credit_sync_endpoint.clone(),
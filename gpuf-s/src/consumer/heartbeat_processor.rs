@@ -1,15 +1,33 @@
+//! Heartbeat batch ingestion.
+//!
+//! A batch is decoded up front and written in one transaction: the raw rows go
+//! in through a single binary COPY, client state is refreshed once per client
+//! from its latest heartbeat, and the daily stats are upserted. If the batch
+//! fails as a whole it is retried one heartbeat per transaction, so a single
+//! bad row does not drop the rest. Heartbeats that were stored are folded
+//! into the minute/hour rollups, which are flushed on the batch timeout.
+
+use std::collections::HashMap;
+use std::time::Duration;
+
 use anyhow::Result;
-use chrono::{TimeZone, Utc};
+use chrono::{DateTime, TimeZone, Utc};
 use rdkafka::message::Timestamp;
 use rdkafka::message::{Message, OwnedMessage};
-use sqlx::{Pool, Postgres};
+use sqlx::{Pool, Postgres, Transaction};
 use tokio::sync::mpsc;
-use tracing::{debug, error, info};
+use tracing::{debug, error, info, warn};
 
-use crate::db::stats::{insert_heartbeat, ClientDailyStats, DeviceDailyStats};
-use crate::util::protoc;
+use crate::db::rollup::Rollups;
+use crate::db::stats::{
+    copy_heartbeats, insert_heartbeat, update_client_state, ClientDailyStats, DeviceDailyStats,
+    HeartbeatRow, InferenceDailyStats,
+};
+use crate::util::protoc::{self, ClientId};
 use common::format_bytes;
 
+type Heartbeat = (protoc::HeartbeatMessage, DateTime<Utc>);
+
 #[allow(dead_code)]
 pub async fn start_processor(
     mut rx: mpsc::Receiver<Vec<OwnedMessage>>,
@@ -22,152 +40,229 @@ pub async fn start_processor(
         batch_size, batch_timeout_secs
     );
 
+    let mut rollups = Rollups::default();
+    let mut flush_ticker = tokio::time::interval(Duration::from_secs(batch_timeout_secs.max(1)));
+
     loop {
-        match rx.recv().await {
-            Some(messages) => {
-                let pool = db_pool.clone();
-                let message_count = messages.len();
+        tokio::select! {
+            batch = rx.recv() => match batch {
+                Some(messages) => {
+                    let message_count = messages.len();
 
-                if let Err(e) = process_batch(messages, pool).await {
-                    error!("Error processing batch: {}", e);
-                }
+                    if let Err(e) = process_batch(messages, &db_pool, &mut rollups).await {
+                        error!("Error processing batch: {}", e);
+                    }
 
-                debug!("Processed batch of {} messages", message_count);
-            }
-            None => {
-                info!("No more messages to process, shutting down processor");
-                break;
-            }
+                    debug!("Processed batch of {} messages", message_count);
+                }
+                None => {
+                    info!("No more messages to process, shutting down processor");
+                    flush_rollups(&db_pool, &mut rollups).await;
+                    break;
+                }
+            },
+            _ = flush_ticker.tick() => flush_rollups(&db_pool, &mut rollups).await,
         }
     }
 
     Ok(())
 }
 
+async fn flush_rollups(db_pool: &Pool<Postgres>, rollups: &mut Rollups) {
+    if rollups.is_empty() {
+        return;
+    }
+    // Kept in memory on failure and retried on the next tick.
+    if let Err(e) = rollups.flush(db_pool).await {
+        error!("Failed to flush heartbeat rollups: {}", e);
+    }
+}
+
+fn decode(message: &OwnedMessage) -> Option<Heartbeat> {
+    if message.key().is_none() {
+        debug!("Received message with no key, skipping");
+        return None;
+    }
+
+    let event_ts = match message.timestamp() {
+        Timestamp::NotAvailable => Utc::now(),
+        Timestamp::CreateTime(ms) | Timestamp::LogAppendTime(ms) => Utc
+            .timestamp_millis_opt(ms)
+            .single()
+            .unwrap_or_else(Utc::now),
+    };
+
+    let payload = match message.payload() {
+        Some(p) => p,
+        None => {
+            error!("Message has no payload, skipping");
+            return None;
+        }
+    };
+
+    debug!("Heartbeat payload received ({} bytes)", payload.len());
+    let cfg = bincode::config::standard()
+        .with_fixed_int_encoding()
+        .with_little_endian();
+    let (heartbeat, _): (protoc::HeartbeatMessage, _) =
+        match bincode::decode_from_slice(payload, cfg) {
+            Ok(v) => v,
+            Err(e) => {
+                error!("Failed to deserialize heartbeat: {}", e);
+                return None;
+            }
+        };
+
+    info!("Heartbeat received from client {} total_tflops {} cpu_usage {}% memory_usage {}% disk_usage {}% network_up {} network_down {}", heartbeat.client_id.log_label(), heartbeat.total_tflops, heartbeat.system_info.cpu_usage, heartbeat.system_info.memory_usage, heartbeat.system_info.disk_usage, format_bytes!(heartbeat.system_info.network_tx), format_bytes!(heartbeat.system_info.network_rx));
+    Some((heartbeat, event_ts))
+}
+
 #[allow(dead_code)]
-async fn process_batch(messages: Vec<OwnedMessage>, db_pool: Pool<Postgres>) -> Result<()> {
-    for message in messages {
-        match message.key() {
-            Some(_key) => {
-                let event_ts = match message.timestamp() {
-                    Timestamp::NotAvailable => Utc::now(),
-                    Timestamp::CreateTime(ms) | Timestamp::LogAppendTime(ms) => Utc
-                        .timestamp_millis_opt(ms)
-                        .single()
-                        .unwrap_or_else(Utc::now),
-                };
-
-                // Parse the message payload
-                let payload = match message.payload() {
-                    Some(p) => p,
-                    None => {
-                        error!("Message has no payload, skipping");
-                        continue;
-                    }
-                };
-
-                debug!("Heartbeat payload received ({} bytes)", payload.len());
-                let cfg = bincode::config::standard()
-                    .with_fixed_int_encoding()
-                    .with_little_endian();
-                // Try to deserialize as JSON first
-                let (heartbeat, _): (protoc::HeartbeatMessage, _) =
-                    match bincode::decode_from_slice(payload, cfg) {
-                        Ok(v) => v,
-                        Err(e) => {
-                            error!("Failed to deserialize heartbeat: {}", e);
-                            continue;
-                        }
-                    };
-
-                let mut transaction = match db_pool.begin().await {
-                    Ok(tx) => tx,
-                    Err(e) => {
-                        error!("Failed to start DB transaction: {}", e);
-                        continue;
+async fn process_batch(
+    messages: Vec<OwnedMessage>,
+    db_pool: &Pool<Postgres>,
+    rollups: &mut Rollups,
+) -> Result<()> {
+    let heartbeats: Vec<Heartbeat> = messages.iter().filter_map(decode).collect();
+    if heartbeats.is_empty() {
+        return Ok(());
+    }
+
+    match ingest_batch(&heartbeats, db_pool).await {
+        Ok(()) => {
+            for (heartbeat, ts) in &heartbeats {
+                rollups.record(heartbeat, *ts);
+            }
+            debug!(
+                "Ingested {} heartbeats in one transaction",
+                heartbeats.len()
+            );
+        }
+        Err(e) => {
+            warn!(
+                "Batch ingest of {} heartbeats failed, retrying one by one: {}",
+                heartbeats.len(),
+                e
+            );
+            for (heartbeat, ts) in &heartbeats {
+                match ingest_one(heartbeat, *ts, db_pool).await {
+                    Ok(()) => {
+                        rollups.record(heartbeat, *ts);
+                        debug!(
+                            "Successfully processed heartbeat for client: {}",
+                            heartbeat.client_id.log_label()
+                        );
                     }
-                };
-
-                info!("Heartbeat received from client {} total_tflops {} cpu_usage {}% memory_usage {}% disk_usage {}% network_up {} network_down {}", heartbeat.client_id.log_label(), heartbeat.total_tflops, heartbeat.system_info.cpu_usage, heartbeat.system_info.memory_usage, heartbeat.system_info.disk_usage, format_bytes!(heartbeat.system_info.network_tx), format_bytes!(heartbeat.system_info.network_rx));
-                // Update last seen timestamp with safe type conversion
-                if let Err(e) = insert_heartbeat(
-                    &mut transaction,
-                    &heartbeat.client_id,
-                    &heartbeat.system_info,
-                    &heartbeat.devices_info,
-                    heartbeat.device_memtotal_gb.try_into().unwrap_or(0),
-                    heartbeat.device_count.try_into().unwrap_or(0),
-                    heartbeat.total_tflops.try_into().unwrap_or(0),
-                    Some(event_ts),
-                )
-                .await
-                {
-                    error!(
-                        "Failed to update heartbeat for client {}: {}",
+                    Err(e) => error!(
+                        "Failed to store heartbeat for client {}: {}",
                         heartbeat.client_id.log_label(),
                         e
-                    );
-                    let _ = transaction.rollback().await;
-                    continue;
+                    ),
                 }
+            }
+        }
+    }
 
-                if let Err(e) = ClientDailyStats::upsert(
-                    &mut transaction,
-                    &heartbeat.client_id,
-                    Some(heartbeat.system_info.cpu_usage as f64),
-                    Some(heartbeat.system_info.memory_usage as f64),
-                    Some(heartbeat.system_info.disk_usage as f64),
-                    Some(heartbeat.system_info.network_rx.try_into().unwrap_or(0)),
-                    Some(heartbeat.system_info.network_tx.try_into().unwrap_or(0)),
-                    event_ts,
-                )
-                .await
-                {
-                    error!(
-                        "Failed to update client heartbeat for client {}: {}",
-                        heartbeat.client_id.log_label(),
-                        e
-                    );
-                    let _ = transaction.rollback().await;
-                    continue;
-                }
-                if let Err(e) = DeviceDailyStats::upsert_batch(
-                    &mut transaction,
-                    &heartbeat.client_id,
-                    &heartbeat.devices_info,
-                    event_ts,
-                )
-                .await
-                {
-                    error!(
-                        "Failed to update device heartbeat for client {}: {}",
-                        heartbeat.client_id.log_label(),
-                        e
-                    );
-                    let _ = transaction.rollback().await;
-                    continue;
-                }
+    Ok(())
+}
 
-                if let Err(e) = transaction.commit().await {
-                    error!(
-                        "Failed to commit transaction for client {}: {}",
-                        heartbeat.client_id.log_label(),
-                        e
-                    );
-                    continue;
+async fn ingest_batch(heartbeats: &[Heartbeat], db_pool: &Pool<Postgres>) -> Result<()> {
+    let mut transaction = db_pool.begin().await?;
+
+    let rows: Vec<HeartbeatRow> = heartbeats
+        .iter()
+        .map(|(heartbeat, ts)| HeartbeatRow {
+            client_id: &heartbeat.client_id,
+            system_info: &heartbeat.system_info,
+            timestamp: *ts,
+        })
+        .collect();
+    copy_heartbeats(&mut transaction, &rows).await?;
+
+    // Client state only needs the newest heartbeat of each client.
+    let mut latest: HashMap<ClientId, usize> = HashMap::new();
+    for (i, (heartbeat, ts)) in heartbeats.iter().enumerate() {
+        latest
+            .entry(heartbeat.client_id)
+            .and_modify(|j| {
+                if heartbeats[*j].1 <= *ts {
+                    *j = i;
                 }
+            })
+            .or_insert(i);
+    }
+    let mut latest: Vec<usize> = latest.into_values().collect();
+    latest.sort_unstable();
+    for i in latest {
+        let heartbeat = &heartbeats[i].0;
+        update_client_state(
+            &mut transaction,
+            &heartbeat.client_id,
+            &heartbeat.system_info,
+            &heartbeat.devices_info,
+            heartbeat.device_memtotal_gb.try_into().unwrap_or(0),
+            heartbeat.device_count.try_into().unwrap_or(0),
+            heartbeat.total_tflops.try_into().unwrap_or(0),
+        )
+        .await?;
+    }
 
-                debug!(
-                    "Successfully processed heartbeat for client: {}",
-                    heartbeat.client_id.log_label()
-                );
-            }
-            None => {
-                debug!("Received message with no key, skipping");
-                continue;
-            }
-        }
+    for (heartbeat, ts) in heartbeats {
+        write_daily_stats(&mut transaction, heartbeat, *ts).await?;
     }
 
+    transaction.commit().await?;
+    Ok(())
+}
+
+async fn ingest_one(
+    heartbeat: &protoc::HeartbeatMessage,
+    event_ts: DateTime<Utc>,
+    db_pool: &Pool<Postgres>,
+) -> Result<()> {
+    let mut transaction = db_pool.begin().await?;
+    insert_heartbeat(
+        &mut transaction,
+        &heartbeat.client_id,
+        &heartbeat.system_info,
+        &heartbeat.devices_info,
+        heartbeat.device_memtotal_gb.try_into().unwrap_or(0),
+        heartbeat.device_count.try_into().unwrap_or(0),
+        heartbeat.total_tflops.try_into().unwrap_or(0),
+        Some(event_ts),
+    )
+    .await?;
+    write_daily_stats(&mut transaction, heartbeat, event_ts).await?;
+    transaction.commit().await?;
+    Ok(())
+}
+
+async fn write_daily_stats(
+    transaction: &mut Transaction<'_, Postgres>,
+    heartbeat: &protoc::HeartbeatMessage,
+    event_ts: DateTime<Utc>,
+) -> Result<()> {
+    ClientDailyStats::upsert(
+        transaction,
+        &heartbeat.client_id,
+        Some(heartbeat.system_info.cpu_usage as f64),
+        Some(heartbeat.system_info.memory_usage as f64),
+        Some(heartbeat.system_info.disk_usage as f64),
+        Some(heartbeat.system_info.network_rx.try_into().unwrap_or(0)),
+        Some(heartbeat.system_info.network_tx.try_into().unwrap_or(0)),
+        event_ts,
+    )
+    .await?;
+    DeviceDailyStats::upsert_batch(
+        transaction,
+        &heartbeat.client_id,
+        &heartbeat.devices_info,
+        event_ts,
+    )
+    .await?;
+    if let Some(inference_stats) = &heartbeat.inference_stats {
+        InferenceDailyStats::upsert(transaction, &heartbeat.client_id, inference_stats, event_ts)
+            .await?;
+    }
     Ok(())
 }
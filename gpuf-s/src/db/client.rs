@@ -86,6 +86,23 @@ pub async fn get_user_client_by_token(
     Ok((client_ids, access_level))
 }
 
+/// All tokens that currently authenticate, for the XDP key set sync.
+#[allow(dead_code)] // Used by the XDP API key sync
+pub async fn get_active_api_keys(pool: &Pool<Postgres>) -> Result<Vec<String>> {
+    let keys = sqlx::query_scalar::<_, String>(
+        r#"
+        SELECT key
+        FROM tokens
+        WHERE status = 1
+          AND (expired_time = -1 OR expired_time > EXTRACT(EPOCH FROM NOW())::bigint)
+          AND deleted_at IS NULL
+        "#,
+    )
+    .fetch_all(pool)
+    .await?;
+    Ok(keys)
+}
+
 pub async fn update_client_db(
     pool: &Pool<Postgres>,
     client_id: &ClientId,
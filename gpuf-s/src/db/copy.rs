@@ -0,0 +1,109 @@
+//! PostgreSQL binary `COPY ... FROM STDIN` encoding.
+//!
+//! Rows are encoded straight into one buffer in the wire format (signature,
+//! flags, then a field count and length-prefixed big-endian values per row)
+//! and sent in a single `COPY`. Only the column types the heartbeat tables
+//! use are supported.
+
+use chrono::{DateTime, Utc};
+use sqlx::postgres::PgConnection;
+
+const SIGNATURE: &[u8] = b"PGCOPY\n\xff\r\n\0";
+/// Microseconds between the Unix epoch and the PostgreSQL epoch (2000-01-01).
+const PG_EPOCH_OFFSET_MICROS: i64 = 946_684_800_000_000;
+
+pub struct BinaryCopy {
+    buf: Vec<u8>,
+    rows: usize,
+}
+
+impl BinaryCopy {
+    pub fn new() -> Self {
+        let mut buf = Vec::with_capacity(64 * 1024);
+        buf.extend_from_slice(SIGNATURE);
+        buf.extend_from_slice(&0i32.to_be_bytes()); // flags
+        buf.extend_from_slice(&0i32.to_be_bytes()); // header extension length
+        Self { buf, rows: 0 }
+    }
+
+    pub fn rows(&self) -> usize {
+        self.rows
+    }
+
+    /// Start a row of `fields` values; push exactly that many after it.
+    pub fn row(&mut self, fields: i16) -> &mut Self {
+        self.buf.extend_from_slice(&fields.to_be_bytes());
+        self.rows += 1;
+        self
+    }
+
+    fn field(&mut self, value: &[u8]) -> &mut Self {
+        self.buf
+            .extend_from_slice(&(value.len() as i32).to_be_bytes());
+        self.buf.extend_from_slice(value);
+        self
+    }
+
+    pub fn bytea(&mut self, value: &[u8]) -> &mut Self {
+        self.field(value)
+    }
+
+    pub fn int2(&mut self, value: i16) -> &mut Self {
+        self.field(&value.to_be_bytes())
+    }
+
+    pub fn int8(&mut self, value: i64) -> &mut Self {
+        self.field(&value.to_be_bytes())
+    }
+
+    pub fn timestamptz(&mut self, value: DateTime<Utc>) -> &mut Self {
+        let micros = value.timestamp_micros() - PG_EPOCH_OFFSET_MICROS;
+        self.field(&micros.to_be_bytes())
+    }
+
+    /// The encoded stream, trailer included.
+    pub fn finish(mut self) -> Vec<u8> {
+        self.buf.extend_from_slice(&(-1i16).to_be_bytes());
+        self.buf
+    }
+}
+
+/// Run `statement` (a `COPY ... FROM STDIN WITH (FORMAT binary)`) with
+/// `copy` as its input. Returns the rows copied.
+pub async fn copy_in(
+    conn: &mut PgConnection,
+    statement: &str,
+    copy: BinaryCopy,
+) -> Result<u64, sqlx::Error> {
+    let mut sink = conn.copy_in_raw(statement).await?;
+    if let Err(e) = sink.send(copy.finish()).await {
+        let _ = sink.abort(e.to_string()).await;
+        return Err(e);
+    }
+    sink.finish().await
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use chrono::TimeZone;
+
+    #[test]
+    fn encodes_header_rows_and_trailer() {
+        let mut copy = BinaryCopy::new();
+        let ts = Utc.with_ymd_and_hms(2000, 1, 1, 0, 0, 1).unwrap();
+        copy.row(3).bytea(&[0xab]).int2(-2).timestamptz(ts);
+        assert_eq!(copy.rows(), 1);
+
+        let bytes = copy.finish();
+        let mut expected = SIGNATURE.to_vec();
+        expected.extend_from_slice(&[0, 0, 0, 0, 0, 0, 0, 0]);
+        expected.extend_from_slice(&[0, 3]);
+        expected.extend_from_slice(&[0, 0, 0, 1, 0xab]);
+        expected.extend_from_slice(&[0, 0, 0, 2, 0xff, 0xfe]);
+        expected.extend_from_slice(&[0, 0, 0, 8]);
+        expected.extend_from_slice(&1_000_000i64.to_be_bytes());
+        expected.extend_from_slice(&[0xff, 0xff]);
+        assert_eq!(bytes, expected);
+    }
+}
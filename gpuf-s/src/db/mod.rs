@@ -1,6 +1,8 @@
 pub mod apk;
 pub mod client;
+pub mod copy;
 pub mod models;
+pub mod rollup;
 pub mod stats;
 
 const GPU_ASSETS_TABLE: &str = "gpu_assets";
@@ -12,3 +14,6 @@ const APK_VERSIONS_TABLE: &str = "apk_versions";
 const CLIENT_MODELS_TABLE: &str = "client_models";
 const CLIENT_DAILY_STATS_TABLE: &str = "client_daily_stats";
 const DEVICE_DAILY_STATS_TABLE: &str = "device_daily_stats";
+const INFERENCE_DAILY_STATS_TABLE: &str = "inference_daily_stats";
+const CLIENT_ROLLUPS_TABLE: &str = "client_heartbeat_rollups";
+const DEVICE_ROLLUPS_TABLE: &str = "device_heartbeat_rollups";
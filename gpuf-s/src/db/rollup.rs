@@ -0,0 +1,404 @@
+//! Per-minute and per-hour heartbeat rollups.
+//!
+//! The heartbeat consumer folds every ingested heartbeat into in-memory
+//! buckets and flushes them on its batch timeout, merging into the rollup
+//! tables. Rows store sums and counts rather than averages, so a bucket
+//! flushed in several parts, or by several consumers, still adds up. The
+//! dashboard queries read these tables instead of aggregating raw rows, and
+//! raw heartbeats only need to be kept for a short retention window.
+
+use std::collections::HashMap;
+
+use chrono::{DateTime, Utc};
+use common::get_u8_from_u64;
+use sqlx::{Pool, Postgres, QueryBuilder};
+
+use crate::db::{CLIENT_ROLLUPS_TABLE, DEVICE_ROLLUPS_TABLE, HEARTBEAT_TABLE};
+use crate::util::protoc::{ClientId, HeartbeatMessage};
+
+pub const MINUTE_SECS: i32 = 60;
+pub const HOUR_SECS: i32 = 3600;
+const BUCKETS: [i32; 2] = [MINUTE_SECS, HOUR_SECS];
+
+/// Rows per INSERT, well below the bind parameter limit.
+const ROWS_PER_STATEMENT: usize = 4000;
+/// Rows deleted per statement when pruning, to keep locks short.
+const PRUNE_CHUNK: i64 = 10_000;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+struct ClientKey {
+    client_id: ClientId,
+    bucket_secs: i32,
+    bucket_start: i64,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+struct DeviceKey {
+    client_id: ClientId,
+    device_index: i16,
+    bucket_secs: i32,
+    bucket_start: i64,
+}
+
+#[derive(Debug, Clone, PartialEq)]
+struct ClientSums {
+    heartbeats: i32,
+    cpu_usage: i64,
+    memory_usage: i64,
+    disk_usage: i64,
+    max_cpu_usage: i16,
+    network_in_bytes: i64,
+    network_out_bytes: i64,
+    last_heartbeat: DateTime<Utc>,
+}
+
+#[derive(Debug, Clone, PartialEq)]
+struct DeviceSums {
+    heartbeats: i32,
+    utilization: i64,
+    temperature: i64,
+    max_temperature: i16,
+    power_usage: i64,
+    memory_usage: i64,
+    last_heartbeat: DateTime<Utc>,
+}
+
+fn bucket_start(ts: DateTime<Utc>, bucket_secs: i32) -> i64 {
+    let secs = ts.timestamp();
+    secs - secs.rem_euclid(bucket_secs as i64)
+}
+
+fn to_timestamp(secs: i64) -> DateTime<Utc> {
+    DateTime::from_timestamp(secs, 0).unwrap_or_default()
+}
+
+#[derive(Default)]
+pub struct Rollups {
+    clients: HashMap<ClientKey, ClientSums>,
+    devices: HashMap<DeviceKey, DeviceSums>,
+}
+
+impl Rollups {
+    pub fn is_empty(&self) -> bool {
+        self.clients.is_empty() && self.devices.is_empty()
+    }
+
+    /// Fold one heartbeat received at `ts` into its minute and hour buckets.
+    pub fn record(&mut self, heartbeat: &HeartbeatMessage, ts: DateTime<Utc>) {
+        let system = &heartbeat.system_info;
+        for bucket_secs in BUCKETS {
+            let start = bucket_start(ts, bucket_secs);
+            let key = ClientKey {
+                client_id: heartbeat.client_id,
+                bucket_secs,
+                bucket_start: start,
+            };
+            let sums = self.clients.entry(key).or_insert(ClientSums {
+                heartbeats: 0,
+                cpu_usage: 0,
+                memory_usage: 0,
+                disk_usage: 0,
+                max_cpu_usage: 0,
+                network_in_bytes: 0,
+                network_out_bytes: 0,
+                last_heartbeat: ts,
+            });
+            sums.heartbeats += 1;
+            sums.cpu_usage += system.cpu_usage as i64;
+            sums.memory_usage += system.memory_usage as i64;
+            sums.disk_usage += system.disk_usage as i64;
+            sums.max_cpu_usage = sums.max_cpu_usage.max(system.cpu_usage as i16);
+            sums.network_in_bytes += system.network_rx.min(i64::MAX as u64) as i64;
+            sums.network_out_bytes += system.network_tx.min(i64::MAX as u64) as i64;
+            sums.last_heartbeat = sums.last_heartbeat.max(ts);
+
+            // Same device numbering as device_daily_stats.
+            for device in &heartbeat.devices_info {
+                for index in 0..device.num {
+                    let slot = index as usize;
+                    let key = DeviceKey {
+                        client_id: heartbeat.client_id,
+                        device_index: index as i16,
+                        bucket_secs,
+                        bucket_start: start,
+                    };
+                    let sums = self.devices.entry(key).or_insert(DeviceSums {
+                        heartbeats: 0,
+                        utilization: 0,
+                        temperature: 0,
+                        max_temperature: 0,
+                        power_usage: 0,
+                        memory_usage: 0,
+                        last_heartbeat: ts,
+                    });
+                    let temperature = get_u8_from_u64(device.temp, slot) as i16;
+                    sums.heartbeats += 1;
+                    sums.utilization += get_u8_from_u64(device.usage, slot) as i64;
+                    sums.temperature += temperature as i64;
+                    sums.max_temperature = sums.max_temperature.max(temperature);
+                    sums.power_usage += get_u8_from_u64(device.power_usage, slot) as i64;
+                    sums.memory_usage += get_u8_from_u64(device.mem_usage, slot) as i64;
+                    sums.last_heartbeat = sums.last_heartbeat.max(ts);
+                }
+            }
+        }
+    }
+
+    /// Merge the buckets into the rollup tables in one transaction. They are
+    /// kept for the next flush when it fails.
+    pub async fn flush(&mut self, pool: &Pool<Postgres>) -> Result<(), sqlx::Error> {
+        if self.is_empty() {
+            return Ok(());
+        }
+        let mut tx = pool.begin().await?;
+
+        let clients: Vec<_> = self.clients.iter().collect();
+        for rows in clients.chunks(ROWS_PER_STATEMENT) {
+            let mut query = QueryBuilder::<Postgres>::new(format!(
+                "INSERT INTO {CLIENT_ROLLUPS_TABLE} (
+                    client_id, bucket_secs, bucket_start, heartbeats,
+                    sum_cpu_usage, sum_memory_usage, sum_disk_usage, max_cpu_usage,
+                    network_in_bytes, network_out_bytes, last_heartbeat
+                ) "
+            ));
+            query.push_values(rows, |mut b, (key, sums)| {
+                b.push_bind(key.client_id)
+                    .push_bind(key.bucket_secs)
+                    .push_bind(to_timestamp(key.bucket_start))
+                    .push_bind(sums.heartbeats)
+                    .push_bind(sums.cpu_usage)
+                    .push_bind(sums.memory_usage)
+                    .push_bind(sums.disk_usage)
+                    .push_bind(sums.max_cpu_usage)
+                    .push_bind(sums.network_in_bytes)
+                    .push_bind(sums.network_out_bytes)
+                    .push_bind(sums.last_heartbeat);
+            });
+            let t = CLIENT_ROLLUPS_TABLE;
+            query.push(format!(
+                " ON CONFLICT (client_id, bucket_secs, bucket_start) DO UPDATE SET
+                    heartbeats = {t}.heartbeats + EXCLUDED.heartbeats,
+                    sum_cpu_usage = {t}.sum_cpu_usage + EXCLUDED.sum_cpu_usage,
+                    sum_memory_usage = {t}.sum_memory_usage + EXCLUDED.sum_memory_usage,
+                    sum_disk_usage = {t}.sum_disk_usage + EXCLUDED.sum_disk_usage,
+                    max_cpu_usage = GREATEST({t}.max_cpu_usage, EXCLUDED.max_cpu_usage),
+                    network_in_bytes = {t}.network_in_bytes + EXCLUDED.network_in_bytes,
+                    network_out_bytes = {t}.network_out_bytes + EXCLUDED.network_out_bytes,
+                    last_heartbeat = GREATEST({t}.last_heartbeat, EXCLUDED.last_heartbeat)"
+            ));
+            query.build().execute(&mut *tx).await?;
+        }
+
+        let devices: Vec<_> = self.devices.iter().collect();
+        for rows in devices.chunks(ROWS_PER_STATEMENT) {
+            let mut query = QueryBuilder::<Postgres>::new(format!(
+                "INSERT INTO {DEVICE_ROLLUPS_TABLE} (
+                    client_id, device_index, bucket_secs, bucket_start, heartbeats,
+                    sum_utilization, sum_temperature, max_temperature,
+                    sum_power_usage, sum_memory_usage, last_heartbeat
+                ) "
+            ));
+            query.push_values(rows, |mut b, (key, sums)| {
+                b.push_bind(key.client_id)
+                    .push_bind(key.device_index)
+                    .push_bind(key.bucket_secs)
+                    .push_bind(to_timestamp(key.bucket_start))
+                    .push_bind(sums.heartbeats)
+                    .push_bind(sums.utilization)
+                    .push_bind(sums.temperature)
+                    .push_bind(sums.max_temperature)
+                    .push_bind(sums.power_usage)
+                    .push_bind(sums.memory_usage)
+                    .push_bind(sums.last_heartbeat);
+            });
+            let t = DEVICE_ROLLUPS_TABLE;
+            query.push(format!(
+                " ON CONFLICT (client_id, device_index, bucket_secs, bucket_start) DO UPDATE SET
+                    heartbeats = {t}.heartbeats + EXCLUDED.heartbeats,
+                    sum_utilization = {t}.sum_utilization + EXCLUDED.sum_utilization,
+                    sum_temperature = {t}.sum_temperature + EXCLUDED.sum_temperature,
+                    max_temperature = GREATEST({t}.max_temperature, EXCLUDED.max_temperature),
+                    sum_power_usage = {t}.sum_power_usage + EXCLUDED.sum_power_usage,
+                    sum_memory_usage = {t}.sum_memory_usage + EXCLUDED.sum_memory_usage,
+                    last_heartbeat = GREATEST({t}.last_heartbeat, EXCLUDED.last_heartbeat)"
+            ));
+            query.build().execute(&mut *tx).await?;
+        }
+
+        tx.commit().await?;
+        self.clients.clear();
+        self.devices.clear();
+        Ok(())
+    }
+}
+
+async fn prune_older_than(
+    pool: &Pool<Postgres>,
+    table: &str,
+    time_column: &str,
+    extra_filter: &str,
+    retention_days: i64,
+) -> Result<u64, sqlx::Error> {
+    let sql = format!(
+        "DELETE FROM {table} WHERE ctid IN (
+            SELECT ctid FROM {table}
+            WHERE {time_column} < NOW() - ($1 * INTERVAL '1 day') {extra_filter}
+            LIMIT $2
+        )"
+    );
+    let mut total = 0;
+    loop {
+        let deleted = sqlx::query(&sql)
+            .bind(retention_days)
+            .bind(PRUNE_CHUNK)
+            .execute(pool)
+            .await?
+            .rows_affected();
+        total += deleted;
+        if deleted < PRUNE_CHUNK as u64 {
+            return Ok(total);
+        }
+    }
+}
+
+/// Delete raw heartbeats older than `retention_days`; 0 keeps them.
+pub async fn prune_heartbeats(
+    pool: &Pool<Postgres>,
+    retention_days: i64,
+) -> Result<u64, sqlx::Error> {
+    if retention_days <= 0 {
+        return Ok(0);
+    }
+    prune_older_than(pool, HEARTBEAT_TABLE, "timestamp", "", retention_days).await
+}
+
+/// Delete minute rollups older than `retention_days`; 0 keeps them. Hour
+/// rollups are kept.
+pub async fn prune_minute_rollups(
+    pool: &Pool<Postgres>,
+    retention_days: i64,
+) -> Result<u64, sqlx::Error> {
+    if retention_days <= 0 {
+        return Ok(0);
+    }
+    let filter = format!("AND bucket_secs = {MINUTE_SECS}");
+    let clients = prune_older_than(
+        pool,
+        CLIENT_ROLLUPS_TABLE,
+        "bucket_start",
+        &filter,
+        retention_days,
+    )
+    .await?;
+    let devices = prune_older_than(
+        pool,
+        DEVICE_ROLLUPS_TABLE,
+        "bucket_start",
+        &filter,
+        retention_days,
+    )
+    .await?;
+    Ok(clients + devices)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use chrono::TimeZone;
+    use common::{set_u8_to_u64, DevicesInfo, EngineType, OsType, SystemInfo};
+
+    fn heartbeat(cpu: u8, temps: &[u8]) -> HeartbeatMessage {
+        let mut temp = 0;
+        for (i, t) in temps.iter().enumerate() {
+            set_u8_to_u64(&mut temp, i, *t);
+        }
+        HeartbeatMessage {
+            client_id: ClientId([7; 16]),
+            system_info: SystemInfo {
+                cpu_usage: cpu,
+                memory_usage: 50,
+                disk_usage: 10,
+                network_rx: 100,
+                network_tx: 200,
+            },
+            device_memtotal_gb: 0,
+            device_count: temps.len() as u32,
+            total_tflops: 0,
+            devices_info: vec![DevicesInfo {
+                num: temps.len() as u16,
+                pod_id: 0,
+                total_tflops: 0,
+                memtotal_gb: 0,
+                port: 0,
+                ip: 0,
+                os_type: OsType::LINUX,
+                engine_type: EngineType::Llama,
+                usage: 0,
+                mem_usage: 0,
+                power_usage: 0,
+                temp,
+                vendor_id: 0,
+                device_id: 0,
+                memsize_gb: 0,
+                powerlimit_w: 0,
+            }],
+            inference_stats: None,
+        }
+    }
+
+    #[test]
+    fn folds_heartbeats_into_minute_and_hour_buckets() {
+        let mut rollups = Rollups::default();
+        let t0 = Utc.with_ymd_and_hms(2025, 3, 1, 10, 0, 5).unwrap();
+        rollups.record(&heartbeat(20, &[40, 60]), t0);
+        rollups.record(
+            &heartbeat(40, &[50, 70]),
+            t0 + chrono::Duration::seconds(30),
+        );
+        rollups.record(
+            &heartbeat(60, &[45, 65]),
+            t0 + chrono::Duration::seconds(70),
+        );
+
+        // Minutes 10:00 and 10:01, plus hour 10:00.
+        assert_eq!(rollups.clients.len(), 3);
+        assert_eq!(rollups.devices.len(), 6);
+
+        let minute = ClientKey {
+            client_id: ClientId([7; 16]),
+            bucket_secs: MINUTE_SECS,
+            bucket_start: bucket_start(t0, MINUTE_SECS),
+        };
+        let sums = &rollups.clients[&minute];
+        assert_eq!(sums.heartbeats, 2);
+        assert_eq!(sums.cpu_usage, 60);
+        assert_eq!(sums.max_cpu_usage, 40);
+        assert_eq!(sums.network_in_bytes, 200);
+        assert_eq!(sums.network_out_bytes, 400);
+
+        let hour = DeviceKey {
+            client_id: ClientId([7; 16]),
+            device_index: 1,
+            bucket_secs: HOUR_SECS,
+            bucket_start: bucket_start(t0, HOUR_SECS),
+        };
+        let sums = &rollups.devices[&hour];
+        assert_eq!(sums.heartbeats, 3);
+        assert_eq!(sums.temperature, 60 + 70 + 65);
+        assert_eq!(sums.max_temperature, 70);
+        assert_eq!(sums.last_heartbeat, t0 + chrono::Duration::seconds(70));
+    }
+
+    #[test]
+    fn bucket_start_floors_to_the_bucket() {
+        let ts = Utc.with_ymd_and_hms(2025, 3, 1, 10, 59, 59).unwrap();
+        assert_eq!(
+            to_timestamp(bucket_start(ts, HOUR_SECS)),
+            Utc.with_ymd_and_hms(2025, 3, 1, 10, 0, 0).unwrap()
+        );
+        assert_eq!(
+            to_timestamp(bucket_start(ts, MINUTE_SECS)),
+            Utc.with_ymd_and_hms(2025, 3, 1, 10, 59, 0).unwrap()
+        );
+    }
+}
@@ -1,11 +1,13 @@
+use crate::db::copy::{copy_in, BinaryCopy};
+use crate::db::rollup::{HOUR_SECS, MINUTE_SECS};
 use crate::db::{
-    CLIENT_DAILY_STATS_TABLE, DEVICE_DAILY_STATS_TABLE, DEVICE_INFO_TABLE, GPU_ASSETS_TABLE,
-    HEARTBEAT_TABLE, SYSTEM_INFO_TABLE,
+    CLIENT_DAILY_STATS_TABLE, CLIENT_ROLLUPS_TABLE, DEVICE_DAILY_STATS_TABLE, DEVICE_INFO_TABLE,
+    GPU_ASSETS_TABLE, HEARTBEAT_TABLE, INFERENCE_DAILY_STATS_TABLE, SYSTEM_INFO_TABLE,
 };
 use crate::util::protoc::ClientId;
 use anyhow::Result;
 use chrono::{DateTime, NaiveDate, NaiveDateTime, Utc};
-use common::{get_u16_from_u128, get_u8_from_u64, DevicesInfo, SystemInfo};
+use common::{get_u16_from_u128, get_u8_from_u64, DevicesInfo, InferenceStats, SystemInfo};
 use serde::{Deserialize, Serialize};
 use sqlx::{FromRow, PgPool, Pool, Postgres, QueryBuilder, Transaction};
 use tracing::{debug, info};
@@ -46,6 +48,31 @@ pub struct DeviceDailyStats {
     pub updated_at: DateTime<Utc>,
 }
 
+/// Daily inference performance of a client, accumulated from heartbeats.
+/// Averages are weighted by the requests of each heartbeat.
+#[derive(Debug, FromRow, Serialize, Deserialize)]
+pub struct InferenceDailyStats {
+    pub id: i64,
+    pub date: NaiveDate,
+    pub client_id: Vec<u8>,
+    pub total_requests: i32,
+    pub total_prompt_tokens: i64,
+    pub total_prompt_tokens_reused: i64,
+    pub total_generated_tokens: i64,
+    pub avg_tokenize_ms: Option<f64>,
+    pub avg_prefill_ms: Option<f64>,
+    pub avg_decode_ms: Option<f64>,
+    pub avg_ttft_ms: Option<f64>,
+    pub avg_decode_tokens_per_sec: Option<f64>,
+    pub max_model_load_ms: i32,
+    pub max_kv_cells_used: i32,
+    pub peak_rss_mb: i32,
+    pub last_heartbeat: DateTime<Utc>,
+    pub last_heartbeat_bucket: i64,
+    pub created_at: DateTime<Utc>,
+    pub updated_at: DateTime<Utc>,
+}
+
 impl ClientDailyStats {
     pub async fn upsert(
         tx: &mut Transaction<'_, Postgres>,
@@ -329,6 +356,114 @@ impl DeviceDailyStats {
     }
 }
 
+impl InferenceDailyStats {
+    pub async fn upsert(
+        tx: &mut Transaction<'_, Postgres>,
+        client_id: &ClientId,
+        stats: &InferenceStats,
+        timestamp: DateTime<Utc>,
+    ) -> Result<u64, sqlx::Error> {
+        let day = timestamp.date_naive();
+        let interval_secs: i64 = sqlx::query_scalar(
+            "SELECT COALESCE(heartbeat_interval_secs, 120)::BIGINT FROM heartbeat_config_daily WHERE date = $1",
+        )
+        .bind(day)
+        .fetch_optional(&mut **tx)
+        .await?
+        .unwrap_or(120);
+        let bucket: i64 = (timestamp.timestamp() / interval_secs.max(1)).max(0);
+
+        let t = INFERENCE_DAILY_STATS_TABLE;
+        let fresh = format!("EXCLUDED.last_heartbeat_bucket > {t}.last_heartbeat_bucket");
+        let weighted = |column: &str| {
+            format!(
+                "{column} = CASE
+                    WHEN {fresh} AND {t}.total_requests + EXCLUDED.total_requests > 0 THEN
+                        (COALESCE({t}.{column}, 0) * {t}.total_requests + EXCLUDED.{column} * EXCLUDED.total_requests) /
+                        ({t}.total_requests + EXCLUDED.total_requests)
+                    ELSE {t}.{column}
+                END"
+            )
+        };
+        let summed = |column: &str| {
+            format!("{column} = {t}.{column} + CASE WHEN {fresh} THEN EXCLUDED.{column} ELSE 0 END")
+        };
+        let maximum =
+            |column: &str| format!("{column} = GREATEST({t}.{column}, EXCLUDED.{column})");
+        let updates = [
+            weighted("avg_tokenize_ms"),
+            weighted("avg_prefill_ms"),
+            weighted("avg_decode_ms"),
+            weighted("avg_ttft_ms"),
+            weighted("avg_decode_tokens_per_sec"),
+            summed("total_requests"),
+            summed("total_prompt_tokens"),
+            summed("total_prompt_tokens_reused"),
+            summed("total_generated_tokens"),
+            maximum("max_model_load_ms"),
+            maximum("max_kv_cells_used"),
+            maximum("peak_rss_mb"),
+            maximum("last_heartbeat"),
+            maximum("last_heartbeat_bucket"),
+        ]
+        .join(",\n                ");
+
+        let result = sqlx::query(&format!(
+            "
+            INSERT INTO {t} (
+                date, client_id,
+                total_requests, total_prompt_tokens, total_prompt_tokens_reused, total_generated_tokens,
+                avg_tokenize_ms, avg_prefill_ms, avg_decode_ms, avg_ttft_ms, avg_decode_tokens_per_sec,
+                max_model_load_ms, max_kv_cells_used, peak_rss_mb,
+                last_heartbeat, last_heartbeat_bucket
+            )
+            VALUES ($1, $2, $3, $4, $5, $6, $7, $8, $9, $10, $11, $12, $13, $14, $15, $16)
+            ON CONFLICT (client_id, date)
+            DO UPDATE SET
+                {updates},
+                updated_at = NOW()
+            "
+        ))
+        .bind(day)
+        .bind(client_id)
+        .bind(stats.requests.min(i32::MAX as u32) as i32)
+        .bind(stats.prompt_tokens.min(i64::MAX as u64) as i64)
+        .bind(stats.prompt_tokens_reused.min(i64::MAX as u64) as i64)
+        .bind(stats.generated_tokens.min(i64::MAX as u64) as i64)
+        .bind(stats.avg_tokenize_ms as f64)
+        .bind(stats.avg_prefill_ms as f64)
+        .bind(stats.avg_decode_ms as f64)
+        .bind(stats.avg_ttft_ms as f64)
+        .bind(stats.decode_tokens_per_sec as f64)
+        .bind(stats.model_load_ms.min(i32::MAX as u32) as i32)
+        .bind(stats.kv_cells_used.min(i32::MAX as u32) as i32)
+        .bind(stats.peak_rss_mb.min(i32::MAX as u32) as i32)
+        .bind(timestamp)
+        .bind(bucket)
+        .execute(&mut **tx)
+        .await?;
+
+        Ok(result.rows_affected())
+    }
+
+    #[allow(dead_code)] // Get inference statistics for date range
+    pub async fn get_stats(
+        pool: &PgPool,
+        client_id: &[u8; 16],
+        start_date: NaiveDate,
+        end_date: NaiveDate,
+    ) -> Result<Vec<Self>, sqlx::Error> {
+        sqlx::query_as(
+            format!("SELECT * FROM {} WHERE client_id = $1 AND date BETWEEN $2 AND $3 ORDER BY date DESC", INFERENCE_DAILY_STATS_TABLE).as_str()
+        )
+        .bind(client_id)
+        .bind(start_date)
+        .bind(end_date)
+        .fetch_all(pool)
+        .await
+    }
+}
+
 pub async fn insert_heartbeat(
     tx: &mut Transaction<'_, Postgres>,
     client_id: &ClientId,
@@ -362,6 +497,92 @@ pub async fn insert_heartbeat(
     .execute(&mut **tx)
     .await?;
 
+    update_client_state(
+        tx,
+        client_id,
+        system_info,
+        devices_info,
+        device_memtotal_gb,
+        device_count,
+        total_tflops,
+    )
+    .await
+}
+
+/// A raw heartbeat row for `copy_heartbeats`.
+pub struct HeartbeatRow<'a> {
+    pub client_id: &'a ClientId,
+    pub system_info: &'a SystemInfo,
+    pub timestamp: DateTime<Utc>,
+}
+
+/// Bulk insert raw heartbeats: one binary COPY into a session staging table,
+/// then a single INSERT that skips rows already stored. Returns the rows
+/// inserted.
+pub async fn copy_heartbeats(
+    tx: &mut Transaction<'_, Postgres>,
+    rows: &[HeartbeatRow<'_>],
+) -> anyhow::Result<u64> {
+    if rows.is_empty() {
+        return Ok(0);
+    }
+    // Emptied on every commit and reused by later batches on this connection.
+    sqlx::query(
+        "CREATE TEMP TABLE IF NOT EXISTS heartbeat_staging (
+            client_id BYTEA NOT NULL,
+            cpu_usage SMALLINT,
+            mem_usage SMALLINT,
+            disk_usage SMALLINT,
+            network_up BIGINT NOT NULL,
+            network_down BIGINT NOT NULL,
+            timestamp TIMESTAMPTZ NOT NULL
+        ) ON COMMIT DELETE ROWS",
+    )
+    .execute(&mut **tx)
+    .await?;
+
+    let mut copy = BinaryCopy::new();
+    for row in rows {
+        copy.row(7)
+            .bytea(&row.client_id.0)
+            .int2(row.system_info.cpu_usage as i16)
+            .int2(row.system_info.memory_usage as i16)
+            .int2(row.system_info.disk_usage as i16)
+            .int8(row.system_info.network_tx as i64)
+            .int8(row.system_info.network_rx as i64)
+            .timestamptz(row.timestamp);
+    }
+    copy_in(
+        &mut **tx,
+        "COPY heartbeat_staging (client_id, cpu_usage, mem_usage, disk_usage, network_up, network_down, timestamp) FROM STDIN WITH (FORMAT binary)",
+        copy,
+    )
+    .await?;
+
+    let inserted = sqlx::query(&format!(
+        "INSERT INTO {} (client_id, cpu_usage, mem_usage, disk_usage, network_up, network_down, timestamp)
+        SELECT client_id, cpu_usage, mem_usage, disk_usage, network_up, network_down, timestamp
+        FROM heartbeat_staging
+        ON CONFLICT (client_id, timestamp) DO NOTHING",
+        HEARTBEAT_TABLE
+    ))
+    .execute(&mut **tx)
+    .await?
+    .rows_affected();
+    Ok(inserted)
+}
+
+/// Refresh the online status, system info and device info of a client from
+/// its latest heartbeat.
+pub async fn update_client_state(
+    tx: &mut Transaction<'_, Postgres>,
+    client_id: &ClientId,
+    system_info: &SystemInfo,
+    devices_info: &Vec<DevicesInfo>,
+    device_memtotal_gb: i32,
+    device_count: i32,
+    total_tflops: i32,
+) -> anyhow::Result<()> {
     // Update GPU assets status
     sqlx::query(&format!("UPDATE  {} SET client_status = $1, updated_at = NOW() WHERE client_id = $2 AND valid_status = 'valid' ",GPU_ASSETS_TABLE))
     .bind("online")
@@ -760,87 +981,77 @@ where
     serializer.serialize_str(&hex::encode(bytes))
 }
 
+/// Daily monitor rows of a user's clients, aggregated from the hourly
+/// heartbeat rollups.
 pub async fn get_client_monitor(
     pool: &Pool<Postgres>,
     user_id: &str,
     client_id: Option<String>,
 ) -> Result<Vec<ClientMonitorInfo>> {
-    let mut query_builder = sqlx::QueryBuilder::new(&format!(
+    let client_id = client_id.map(hex::decode).transpose()?;
+
+    let mut query_builder = QueryBuilder::<Postgres>::new(format!(
         "
-     WITH stats_with_avg AS (
-        SELECT 
-            ga.client_id,
-            ga.client_name,
-            ga.created_at,
-            ga.updated_at,
-            cds.date,
-            cds.avg_cpu_usage,
-            cds.avg_memory_usage,
-            cds.avg_disk_usage,
-            cds.total_network_in_bytes,
-            cds.total_network_out_bytes,
-            cds.total_heartbeats,
-            cds.last_heartbeat,
-            CASE 
-                WHEN cds.total_heartbeats > 0 
-                THEN cds.total_network_in_bytes::float8 / NULLIF(cds.total_heartbeats, 0) 
-                ELSE 0 
-            END as avg_network_in_bytes,
-            CASE 
-                WHEN cds.total_heartbeats > 0 
-                THEN cds.total_network_out_bytes::float8 / NULLIF(cds.total_heartbeats, 0) 
-                ELSE 0 
-            END as avg_network_out_bytes
-        FROM {} ga
-        LEFT JOIN {} cds ON ga.client_id = cds.client_id
-        WHERE ga.user_id = $1
-        AND ga.valid_status = 'valid'
-  
-   
-    ",
-        GPU_ASSETS_TABLE, CLIENT_DAILY_STATS_TABLE
+    WITH daily AS (
+        SELECT
+            r.client_id,
+            (r.bucket_start AT TIME ZONE 'UTC')::date AS date,
+            SUM(r.heartbeats)::int AS total_heartbeats,
+            SUM(r.sum_cpu_usage)::float8 / NULLIF(SUM(r.heartbeats), 0) AS avg_cpu_usage,
+            SUM(r.sum_memory_usage)::float8 / NULLIF(SUM(r.heartbeats), 0) AS avg_memory_usage,
+            SUM(r.sum_disk_usage)::float8 / NULLIF(SUM(r.heartbeats), 0) AS avg_disk_usage,
+            SUM(r.network_in_bytes)::bigint AS total_network_in_bytes,
+            SUM(r.network_out_bytes)::bigint AS total_network_out_bytes,
+            MAX(r.last_heartbeat) AS last_heartbeat
+        FROM {} r
+        WHERE r.bucket_secs = {}
+        AND r.client_id IN (
+            SELECT client_id FROM {} WHERE user_id = ",
+        CLIENT_ROLLUPS_TABLE, HOUR_SECS, GPU_ASSETS_TABLE
     ));
-
-    // Add client_id filter if provided
-    if let Some(_cid) = &client_id {
-        query_builder.push(" AND ga.client_id = $2");
+    query_builder.push_bind(user_id);
+    query_builder.push(" AND valid_status = 'valid'");
+    if let Some(cid) = &client_id {
+        query_builder.push(" AND client_id = ");
+        query_builder.push_bind(cid.clone());
     }
-
-    // Order by most recent dates first
-    query_builder
-        .push(" ) SELECT * FROM stats_with_avg  ORDER BY date DESC NULLS LAST, updated_at DESC");
-
-    // Build the query
-    let mut query = query_builder.build_query_as::<ClientMonitorInfo>();
-
-    // Bind parameters
-    query = query.bind(user_id);
+    query_builder.push(format!(
+        "
+        )
+        GROUP BY r.client_id, date
+    )
+    SELECT
+        ga.client_id,
+        ga.client_name,
+        ga.created_at,
+        ga.updated_at,
+        d.date,
+        d.avg_cpu_usage,
+        d.avg_memory_usage,
+        d.avg_disk_usage,
+        d.total_network_in_bytes,
+        d.total_network_out_bytes,
+        d.total_heartbeats,
+        d.last_heartbeat,
+        COALESCE(d.total_network_in_bytes::float8 / NULLIF(d.total_heartbeats, 0), 0) AS avg_network_in_bytes,
+        COALESCE(d.total_network_out_bytes::float8 / NULLIF(d.total_heartbeats, 0), 0) AS avg_network_out_bytes
+    FROM {} ga
+    LEFT JOIN daily d ON ga.client_id = d.client_id
+    WHERE ga.user_id = ",
+        GPU_ASSETS_TABLE
+    ));
+    query_builder.push_bind(user_id);
+    query_builder.push(" AND ga.valid_status = 'valid'");
     if let Some(cid) = client_id {
-        query = query.bind(hex::decode(cid)?);
-    }
-
-    // Execute the query
-    let mut results = query.fetch_all(pool).await?;
-
-    // Convert the average values to f64 for consistency
-    for result in &mut results {
-        // The database already calculated these, but we need to ensure they're f64
-        if let (Some(in_bytes), Some(heartbeats)) =
-            (result.total_network_in_bytes, result.total_heartbeats)
-        {
-            if heartbeats > 0 {
-                result.avg_network_in_bytes = Some(in_bytes as f64 / heartbeats as f64);
-            }
-        }
-        if let (Some(out_bytes), Some(heartbeats)) =
-            (result.total_network_out_bytes, result.total_heartbeats)
-        {
-            if heartbeats > 0 {
-                result.avg_network_out_bytes = Some(out_bytes as f64 / heartbeats as f64);
-            }
-        }
+        query_builder.push(" AND ga.client_id = ");
+        query_builder.push_bind(cid);
     }
+    query_builder.push(" ORDER BY d.date DESC NULLS LAST, ga.updated_at DESC");
 
+    let results = query_builder
+        .build_query_as::<ClientMonitorInfo>()
+        .fetch_all(pool)
+        .await?;
     Ok(results)
 }
 
@@ -857,6 +1068,9 @@ pub struct ClientHeartbeatInfo {
     pub network_down: i64,
 }
 
+/// Per-minute heartbeat history of a user's clients, read from the minute
+/// rollups. `cpu_usage`, `mem_usage` and `disk_usage` are minute averages and
+/// the network counters are summed over the minute.
 pub async fn get_client_heartbeats(
     pool: &Pool<Postgres>,
     user_id: &str,
@@ -864,77 +1078,51 @@ pub async fn get_client_heartbeats(
     start_date: Option<String>,
     end_date: Option<String>,
 ) -> Result<Vec<ClientHeartbeatInfo>> {
-    let mut query = format!(
+    let mut query_builder = QueryBuilder::<Postgres>::new(format!(
         "
-        SELECT 
-            h.client_id,
+        SELECT
+            r.client_id,
             COALESCE(ga.client_name, '') as client_name,
-            h.timestamp,
-            h.cpu_usage,
-            h.mem_usage,
-            h.disk_usage,
-            h.network_up,
-            h.network_down
-        FROM {} h
-        INNER JOIN {} ga ON h.client_id = ga.client_id
-        WHERE ga.user_id = $1 
+            r.bucket_start AS timestamp,
+            (r.sum_cpu_usage / NULLIF(r.heartbeats, 0))::smallint AS cpu_usage,
+            (r.sum_memory_usage / NULLIF(r.heartbeats, 0))::smallint AS mem_usage,
+            (r.sum_disk_usage / NULLIF(r.heartbeats, 0))::smallint AS disk_usage,
+            r.network_out_bytes AS network_up,
+            r.network_in_bytes AS network_down
+        FROM {} r
+        INNER JOIN {} ga ON r.client_id = ga.client_id
+        WHERE r.bucket_secs = {}
         AND ga.valid_status = 'valid'
-    ",
-        HEARTBEAT_TABLE, GPU_ASSETS_TABLE
-    );
-
-    let mut params: Vec<String> = vec![user_id.to_string()];
-    let mut param_count = 2; // Start from $2
+        AND ga.user_id = ",
+        CLIENT_ROLLUPS_TABLE, GPU_ASSETS_TABLE, MINUTE_SECS
+    ));
+    query_builder.push_bind(user_id);
 
-    // Add client_id filter if provided
     if let Some(cid) = &client_id {
-        query.push_str(&format!(" AND h.client_id = ${}", param_count));
-        params.push(
-            hex::decode(cid)?
-                .into_iter()
-                .map(|b| format!("{:02x}", b))
-                .collect(),
-        );
-        param_count += 1;
+        query_builder.push(" AND r.client_id = ");
+        query_builder.push_bind(hex::decode(cid)?);
     }
 
-    let start_datetime = start_date.as_ref().and_then(|d| {
-        NaiveDateTime::parse_from_str(d, "%Y-%m-%dT%H:%M:%S")
-            .ok()
-            .map(|ndt| ndt.and_utc().naive_utc())
-    });
-    let end_datetime = end_date.as_ref().and_then(|d| {
+    let parse = |d: &String| {
         NaiveDateTime::parse_from_str(d, "%Y-%m-%dT%H:%M:%S")
             .ok()
-            .map(|ndt| ndt.and_utc().naive_utc())
-    });
-
-    // Add start date filter if provided
-    if let Some(start) = &start_datetime {
-        query.push_str(&format!(" AND h.timestamp >= ${}::timestamp", param_count));
+            .map(|ndt| ndt.and_utc())
+    };
+    if let Some(start) = start_date.as_ref().and_then(parse) {
         info!("start_datetime: {}", start);
-        params.push(start.to_string());
-        param_count += 1;
+        query_builder.push(" AND r.bucket_start >= ");
+        query_builder.push_bind(start);
     }
-
-    // Add end date filter if provided
-    if let Some(end) = &end_datetime {
-        query.push_str(&format!(" AND h.timestamp < ${}::timestamp", param_count));
-        params.push(end.to_string());
-        let _ = param_count + 1; // param_count is only used for SQL parameter numbering
+    if let Some(end) = end_date.as_ref().and_then(parse) {
+        query_builder.push(" AND r.bucket_start < ");
+        query_builder.push_bind(end);
     }
 
-    // Order by timestamp in descending order
-    query.push_str(" ORDER BY h.timestamp DESC");
-
-    // Execute the query with parameters
-    let mut query_builder = sqlx::query_as::<_, ClientHeartbeatInfo>(&query);
+    query_builder.push(" ORDER BY r.bucket_start DESC");
 
-    // Bind all parameters
-    for param in params {
-        query_builder = query_builder.bind(param);
-    }
-
-    let heartbeats = query_builder.fetch_all(pool).await?;
+    let heartbeats = query_builder
+        .build_query_as::<ClientHeartbeatInfo>()
+        .fetch_all(pool)
+        .await?;
     Ok(heartbeats)
 }
@@ -872,7 +872,7 @@ pub async fn connect_client_filter_model_and_client(
             );
             let mut writer = client_info.writer.lock().await;
 
-            if let Err(e) = write_command(&mut *writer, &command).await {
+            if let Err(e) = writer.send(&command).await {
                 error!(
                 "Failed to send RequestNewProxyConn to client {}: {}. Removing from active list.",
                 client_id, e
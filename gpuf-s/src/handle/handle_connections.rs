@@ -4,14 +4,15 @@ use crate::db::{
     client,
     models::{self, HotModelClass},
 };
+use crate::inference::InferenceScheduler;
 use crate::util::protoc::{ClientId, HeartbeatMessage};
-use bytes::BytesMut;
 use std::collections::HashMap;
 
 use anyhow::{anyhow, Result};
 use common::{
-    format_bytes, os_type_str, CommandV2, DataPlaneSecret, DownloadStatus, Model, OsType, PodModel,
-    RedactedString,
+    format_bytes, os_type_str, CommandReader, CommandV2, CommandWriter, DataPlaneSecret,
+    DownloadStatus, Model, OsType, PodModel, RedactedString, FEATURE_WORKER_STATUS,
+    PROTOCOL_VERSION,
 };
 use redis::AsyncCommands;
 use redis::Client as RedisClient;
@@ -145,7 +146,7 @@ fn set_keepalive(_stream: &TcpStream) -> std::io::Result<()> {
 }
 
 async fn handle_single_client(
-    mut reader: Box<dyn AsyncRead + Send + Unpin>,
+    reader: Box<dyn AsyncRead + Send + Unpin>,
     writer: Box<dyn AsyncWrite + Send + Unpin>,
     addr: std::net::SocketAddr,
     active_clients: ActiveClients,
@@ -156,14 +157,16 @@ async fn handle_single_client(
     redis_client: Arc<RedisClient>,
     server_state: Arc<crate::handle::ServerState>,
 ) -> Result<()> {
-    let writer = Arc::new(Mutex::new(writer));
+    let writer = Arc::new(Mutex::new(CommandWriter::new(writer)));
 
     let mut authed = false;
     let mut session_client_id = ClientId([0; 16]);
-    let mut buf = BytesMut::with_capacity(1024 * 1024);
+    let mut reader = CommandReader::new(reader);
+    // Stats of the last WorkerStatus, published with the heartbeat after it.
+    let mut pending_inference_stats: Option<common::InferenceStats> = None;
 
     loop {
-        match read_command(&mut reader, &mut buf).await {
+        match reader.read_command().await {
             Ok(Command::V1(CommandV1::Login {
                 version,
                 auto_models,
@@ -174,6 +177,10 @@ async fn handle_single_client(
                 device_total_tflops,
                 devices_info,
             })) => {
+                // session_client_id keys every later update on this connection
+                if authed {
+                    return Err(anyhow!("Login on an authenticated connection"));
+                }
                 info!(
                     "Registration attempt for client {}",
                     ClientId(id).log_label()
@@ -218,8 +225,27 @@ async fn handle_single_client(
                     }
                 };
                 session_client_id = ClientId(id);
+                if let Some(client) = active_clients.lock().await.get(&session_client_id) {
+                    server_state
+                        .inference_scheduler
+                        .update_device(&session_client_id, client);
+                }
 
-                write_command(&mut *writer.lock().await, &Command::V1(validate_result)).await?;
+                // Workers older than PROTOCOL_VERSION cannot decode it
+                let features = match validate_result {
+                    CommandV1::LoginResult { success: true, .. } if version >= PROTOCOL_VERSION => {
+                        Some(Command::V2(CommandV2::ServerFeatures {
+                            features: FEATURE_WORKER_STATUS,
+                        }))
+                    }
+                    _ => None,
+                };
+                let result = Command::V1(validate_result);
+                writer
+                    .lock()
+                    .await
+                    .send_all(features.iter().chain([&result]))
+                    .await?;
             }
             // Device system status from client to server 120s
             Ok(Command::V1(CommandV1::Heartbeat {
@@ -234,6 +260,21 @@ async fn handle_single_client(
                     "Heartbeat received from client {}",
                     ClientId(id).log_label()
                 );
+                // Only the logged-in connection may touch scheduling state;
+                // heartbeats on other connections are just published.
+                if authed {
+                    if let Some(client) = active_clients.lock().await.get_mut(&session_client_id) {
+                        if let Some(info) = client.system_info.as_mut() {
+                            info.cpu_usage = system_info.cpu_usage;
+                            info.memory_usage = system_info.memory_usage;
+                            info.disk_usage = system_info.disk_usage;
+                            info.last_heartbeat = Utc::now().into();
+                        }
+                        server_state
+                            .inference_scheduler
+                            .update_device(&session_client_id, client);
+                    }
+                }
                 handle_heartbeat(
                     &producer,
                     &ClientId(id),
@@ -242,9 +283,33 @@ async fn handle_single_client(
                     device_memtotal_gb,
                     device_count as u32,
                     device_total_tflops,
+                    pending_inference_stats.take(),
                 )
                 .await;
             }
+            // Worker state sent right before a heartbeat
+            Ok(Command::V2(CommandV2::WorkerStatus {
+                client_id: _,
+                resident_models,
+                inference_stats,
+                perf_capacity,
+                task_slots,
+                gpu_placement,
+            })) => {
+                if !authed {
+                    return Err(anyhow!("WorkerStatus before login"));
+                }
+                if let Some(client) = active_clients.lock().await.get_mut(&session_client_id) {
+                    client.resident_models = resident_models;
+                    client.perf_capacity = perf_capacity;
+                    client.task_slots = task_slots;
+                    client.gpu_placement = gpu_placement;
+                    server_state
+                        .inference_scheduler
+                        .update_device(&session_client_id, client);
+                }
+                pending_inference_stats = inference_stats;
+            }
             // Device model status from client to server 300s
             Ok(Command::V1(CommandV1::ModelStatus {
                 client_id: id,
@@ -262,6 +327,7 @@ async fn handle_single_client(
                 let pods_model = match handle_models_status(
                     &hot_models,
                     &active_clients,
+                    &server_state.inference_scheduler,
                     &ClientId(id),
                     auto_models_device,
                     models,
@@ -280,11 +346,14 @@ async fn handle_single_client(
                         }
                     }
                 };
-                write_command(&mut *writer.lock().await, &Command::V1(pods_model)).await?;
+                writer.lock().await.send(&Command::V1(pods_model)).await?;
             }
             Err(e) => {
                 info!("addr {} disconnected: {}", addr, e);
                 active_clients.lock().await.remove(&session_client_id);
+                server_state
+                    .inference_scheduler
+                    .remove_device(&session_client_id);
                 client::upsert_client_status(&db_pool, &session_client_id, "offline").await?;
                 return Ok(());
             }
@@ -316,6 +385,23 @@ async fn handle_single_client(
                     )
                     .await;
             }
+            Ok(Command::V1(CommandV1::EmbeddingResult {
+                task_id,
+                dim,
+                embeddings,
+                prompt_tokens,
+                error,
+            })) => {
+                debug!(
+                    "Received embedding result for task {} from device {}",
+                    task_id,
+                    session_client_id.log_label()
+                );
+                server_state
+                    .inference_scheduler
+                    .handle_embedding_result(task_id, dim, embeddings, prompt_tokens, error)
+                    .await;
+            }
             Ok(Command::V1(CommandV1::InferenceResultChunk {
                 task_id,
                 seq,
@@ -499,16 +585,19 @@ async fn handle_single_client(
                     force_tls: false,
                 });
 
-                write_command(&mut *source_writer.lock().await, &to_source).await?;
-                write_command(&mut *target_writer.lock().await, &to_target).await?;
-
-                // Notify target about the request (optional but useful)
+                // Notify target about the request (optional but useful); it
+                // leaves in the same write as the target's config
                 let forward = Command::V2(CommandV2::P2PConnectionRequest {
                     source_client_id,
                     target_client_id,
                     connection_id,
                 });
-                write_command(&mut *target_writer.lock().await, &forward).await?;
+                source_writer.lock().await.send(&to_source).await?;
+                target_writer
+                    .lock()
+                    .await
+                    .send_all([&to_target, &forward])
+                    .await?;
             }
 
             Ok(Command::V2(CommandV2::P2PCandidates {
@@ -553,7 +642,63 @@ async fn handle_single_client(
                     connection_id,
                     candidates,
                 });
-                write_command(&mut *target_writer.lock().await, &forward).await?;
+                target_writer.lock().await.send(&forward).await?;
+            }
+
+            // Outcomes of a P2P attempt are relayed to the peer so the requester
+            // can stream over the data plane, or fall back to the relay, right
+            // away instead of waiting out its own timeouts.
+            Ok(Command::V2(CommandV2::P2PConnectionEstablished {
+                peer_id,
+                connection_id,
+                connection_type,
+            })) => {
+                if !authed {
+                    return Err(anyhow!("P2PConnectionEstablished before login"));
+                }
+                info!(
+                    "P2P connection {} established between {} and {} ({:?})",
+                    hex::encode(connection_id),
+                    session_client_id.log_label(),
+                    ClientId(peer_id).log_label(),
+                    connection_type
+                );
+                let forward = Command::V2(CommandV2::P2PConnectionEstablished {
+                    peer_id: session_client_id.0,
+                    connection_id,
+                    connection_type,
+                });
+                forward_to_p2p_peer(&active_clients, ClientId(peer_id), &forward).await?;
+            }
+
+            Ok(Command::V2(CommandV2::P2PConnectionFailed {
+                peer_id,
+                connection_id,
+                mut error,
+            })) => {
+                if !authed {
+                    return Err(anyhow!("P2PConnectionFailed before login"));
+                }
+                warn!(
+                    "P2P connection {} between {} and {} failed: {}",
+                    hex::encode(connection_id),
+                    session_client_id.log_label(),
+                    ClientId(peer_id).log_label(),
+                    error
+                );
+                if error.len() > 256 {
+                    let mut end = 256;
+                    while !error.is_char_boundary(end) {
+                        end -= 1;
+                    }
+                    error.truncate(end);
+                }
+                let forward = Command::V2(CommandV2::P2PConnectionFailed {
+                    peer_id: session_client_id.0,
+                    connection_id,
+                    error,
+                });
+                forward_to_p2p_peer(&active_clients, ClientId(peer_id), &forward).await?;
             }
             _ => {
                 warn!("Received unexpected command from client addr {}", addr);
@@ -564,6 +709,28 @@ async fn handle_single_client(
     Ok(()) // This is theoretically unreachable but required by compiler
 }
 
+/// Relay a P2P signalling command to `peer` if it is online. An offline peer
+/// is not an error for the sender; the attempt has simply nobody to tell.
+async fn forward_to_p2p_peer(
+    active_clients: &ActiveClients,
+    peer: ClientId,
+    command: &Command,
+) -> Result<()> {
+    let writer = {
+        let clients = active_clients.lock().await;
+        clients.get(&peer).map(|c| c.writer.clone())
+    };
+    match writer {
+        Some(writer) => writer.lock().await.send(command).await?,
+        None => debug!(
+            "P2P peer {} is not online, dropping {:?}",
+            peer.log_label(),
+            command
+        ),
+    }
+    Ok(())
+}
+
 async fn handle_login(
     version: u32,
     auto_models: bool,
@@ -648,6 +815,10 @@ async fn handle_login(
             }),
             connected_at: Utc::now(),
             models: None,
+            resident_models: Vec::new(),
+            perf_capacity: None,
+            task_slots: 0,
+            gpu_placement: None,
             devices_info,
         },
     );
@@ -657,6 +828,7 @@ async fn handle_login(
 async fn handle_models_status(
     hot_models: &Arc<HotModelClass>,
     active_clients: &Arc<Mutex<HashMap<ClientId, ClientInfo>>>,
+    scheduler: &InferenceScheduler,
     client_id: &ClientId,
     auto_models_device: Vec<DevicesInfo>,
     models: Vec<Model>,
@@ -665,6 +837,7 @@ async fn handle_models_status(
     let mut clients = active_clients.lock().await;
     if let Some(client) = clients.get_mut(client_id) {
         client.models = Some(models);
+        scheduler.update_device(client_id, client);
     }
 
     let mut pods_model: Vec<PodModel> = Vec::with_capacity(auto_models_device.len());
@@ -734,6 +907,7 @@ async fn handle_heartbeat(
     device_memtotal_gb: u32,
     device_count: u32,
     total_tflops: u32,
+    inference_stats: Option<common::InferenceStats>,
 ) {
     debug!("Sending heartbeat to consumer client {} cpu_usage {}% memory_usage {}% disk_usage {}% device_memtotal_gb {} GB device_count {} total_tflops {} tflops", client_id.log_label(), system_info.cpu_usage, system_info.memory_usage, system_info.disk_usage, device_memtotal_gb, device_count, total_tflops);
 
@@ -744,6 +918,7 @@ async fn handle_heartbeat(
         total_tflops,
         system_info,
         devices_info,
+        inference_stats,
     };
 
     let cfg = config::standard()
@@ -12,7 +12,7 @@ use crate::util::{
 use anyhow::{anyhow, Result};
 use bytes::BytesMut;
 use chrono::{DateTime, Utc};
-use common::{join_streams, read_command, write_command, Command, CommandV1, DevicesInfo, Model};
+use common::{join_streams, read_command, Command, CommandV1, CommandWriter, DevicesInfo, Model};
 use rdkafka::producer::FutureProducer;
 use rdkafka::producer::Producer;
 use redis::Client as RedisClient;
@@ -30,7 +30,9 @@ pub type UserDb = Arc<Mutex<HashMap<String, User>>>;
 pub type TokenDb = Arc<Mutex<HashMap<String, String>>>;
 pub type ActiveClients = Arc<Mutex<HashMap<ClientId, ClientInfo>>>;
 pub type PendingConnections = Arc<Mutex<HashMap<ProxyConnId, (TcpStream, BytesMut)>>>;
-pub type ControlWriter = Box<dyn AsyncWrite + Send + Unpin>;
+/// Control connection write half; its encode buffer lives as long as the
+/// connection, so sends do not allocate.
+pub type ControlWriter = CommandWriter<Box<dyn AsyncWrite + Send + Unpin>>;
 
 pub fn install_rustls_crypto_provider_once() {
     static INIT: Once = Once::new();
@@ -49,7 +51,7 @@ pub fn install_rustls_crypto_provider_once() {
 pub struct ClientInfo {
     pub writer: Arc<Mutex<ControlWriter>>,
     pub authed: bool,
-    #[allow(dead_code)] // Client protocol version
+    /// Client protocol version
     pub version: u32,
     pub system_info: Option<SystemInfo>,
     #[allow(dead_code)] // Connected devices information
@@ -57,6 +59,14 @@ pub struct ClientInfo {
     #[allow(dead_code)] // Connection timestamp
     pub connected_at: DateTime<Utc>,
     pub models: Option<Vec<Model>>,
+    /// Models the client reported as loaded in its last heartbeat.
+    pub resident_models: Vec<String>,
+    /// Sustainable throughput from the last heartbeat of a mobile worker.
+    pub perf_capacity: Option<common::PerfCapacity>,
+    /// Inference tasks the client runs at once; 0 until it reports them.
+    pub task_slots: u16,
+    /// How a desktop worker split its loaded model over its GPUs.
+    pub gpu_placement: Option<common::GpuPlacement>,
 }
 
 pub struct User {
@@ -0,0 +1,452 @@
+//! Admission control and per-device task queues.
+//!
+//! A task goes straight to a device with a free task slot (see
+//! `DeviceIndex::reserve`). When every candidate is busy, it waits in the
+//! bounded queue of the candidate with the least queued work. Each time a
+//! slot frees, the device takes the next task from its own queue or, with
+//! an empty queue, steals the oldest task it can serve from the longest
+//! queue. When the queues are full, or the fleet-wide limit on queued tasks
+//! is reached, the request is refused at once with `Saturated`, which the
+//! HTTP handlers turn into a 429, instead of piling onto a device and timing
+//! out.
+
+use std::collections::{HashMap, VecDeque};
+use std::fmt;
+use std::sync::Mutex;
+use std::time::Duration;
+
+use tokio::sync::oneshot;
+
+use super::device_index::{DeviceEntry, DeviceIndex, IndexSnapshot};
+use crate::util::protoc::ClientId;
+
+/// The fleet cannot take the request now; retry after `retry_after`.
+#[derive(Debug, Clone, Copy)]
+pub struct Saturated {
+    pub retry_after: Duration,
+}
+
+impl fmt::Display for Saturated {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(f, "All devices are busy, please retry later")
+    }
+}
+
+impl std::error::Error for Saturated {}
+
+/// No connected device can take a task on `model` (`None` for any model).
+#[derive(Debug, Clone)]
+pub struct NoDevice {
+    pub model: Option<String>,
+}
+
+impl fmt::Display for NoDevice {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match &self.model {
+            Some(model) => write!(f, "No compatible client found for model '{model}'"),
+            None => write!(f, "No available Android devices found"),
+        }
+    }
+}
+
+impl std::error::Error for NoDevice {}
+
+#[derive(Debug, Clone, Copy)]
+pub struct AdmissionLimits {
+    /// Tasks that may wait for one device.
+    pub device_queue_depth: usize,
+    /// Tasks that may wait across all devices.
+    pub max_queued: usize,
+    /// How long a task waits for a slot before it is refused.
+    pub queue_timeout: Duration,
+}
+
+impl Default for AdmissionLimits {
+    fn default() -> Self {
+        Self {
+            device_queue_depth: 4,
+            max_queued: 1024,
+            queue_timeout: Duration::from_secs(30),
+        }
+    }
+}
+
+impl AdmissionLimits {
+    /// Defaults overridden by `GPUF_DEVICE_QUEUE_DEPTH`, `GPUF_MAX_QUEUED_TASKS`
+    /// and `GPUF_QUEUE_TIMEOUT_SECS`.
+    pub fn from_env() -> Self {
+        fn var(name: &str) -> Option<u64> {
+            std::env::var(name).ok().and_then(|s| s.parse::<u64>().ok())
+        }
+        let defaults = Self::default();
+        Self {
+            device_queue_depth: var("GPUF_DEVICE_QUEUE_DEPTH")
+                .map_or(defaults.device_queue_depth, |v| v as usize),
+            max_queued: var("GPUF_MAX_QUEUED_TASKS").map_or(defaults.max_queued, |v| v as usize),
+            queue_timeout: var("GPUF_QUEUE_TIMEOUT_SECS")
+                .filter(|&v| v > 0)
+                .map_or(defaults.queue_timeout, Duration::from_secs),
+        }
+    }
+}
+
+struct QueuedTask {
+    task_id: String,
+    model: Option<String>,
+    allowed: Option<Vec<ClientId>>,
+    /// Told which device holds the slot claimed for the task.
+    dispatch: oneshot::Sender<ClientId>,
+}
+
+#[derive(Default)]
+struct Queues {
+    by_device: HashMap<ClientId, VecDeque<QueuedTask>>,
+    queued: usize,
+}
+
+impl Queues {
+    fn len(&self, client_id: &ClientId) -> usize {
+        self.by_device.get(client_id).map_or(0, VecDeque::len)
+    }
+
+    /// Candidate with room in its queue and the least queued work per slot.
+    fn least_loaded(
+        &self,
+        snapshot: &IndexSnapshot,
+        model: Option<&str>,
+        allowed: Option<&[ClientId]>,
+        depth: usize,
+    ) -> Option<ClientId> {
+        snapshot
+            .candidates(model, allowed)
+            .filter(|entry| self.len(&entry.client_id) < depth)
+            .min_by_key(|entry| {
+                let work = self.len(&entry.client_id) as u32 + entry.in_flight();
+                (work * 64) / entry.slots()
+            })
+            .map(|entry| entry.client_id)
+    }
+
+    fn push(&mut self, device: ClientId, task: QueuedTask) {
+        self.by_device.entry(device).or_default().push_back(task);
+        self.queued += 1;
+    }
+
+    /// Next task `device` should run: the head of its own queue, else the
+    /// oldest task it can serve from the longest queue.
+    fn take_for(&mut self, device: &DeviceEntry) -> Option<QueuedTask> {
+        let own = self
+            .by_device
+            .get_mut(&device.client_id)
+            .and_then(VecDeque::pop_front);
+        let task = own.or_else(|| {
+            let mut queues: Vec<_> = self
+                .by_device
+                .iter_mut()
+                .filter(|(id, queue)| **id != device.client_id && !queue.is_empty())
+                .collect();
+            queues.sort_by_key(|(_, queue)| std::cmp::Reverse(queue.len()));
+            queues.into_iter().find_map(|(_, queue)| {
+                let pos = queue
+                    .iter()
+                    .position(|t| device.serves(t.model.as_deref(), t.allowed.as_deref()))?;
+                queue.remove(pos)
+            })
+        })?;
+        self.queued -= 1;
+        self.by_device.retain(|_, queue| !queue.is_empty());
+        Some(task)
+    }
+}
+
+pub struct Admission {
+    limits: AdmissionLimits,
+    queues: Mutex<Queues>,
+}
+
+impl Admission {
+    pub fn new(limits: AdmissionLimits) -> Self {
+        Self {
+            limits,
+            queues: Mutex::new(Queues::default()),
+        }
+    }
+
+    pub fn queue_timeout(&self) -> Duration {
+        self.limits.queue_timeout
+    }
+
+    pub fn queued(&self) -> usize {
+        self.queues.lock().unwrap_or_else(|p| p.into_inner()).queued
+    }
+
+    pub(crate) fn saturated(&self) -> Saturated {
+        Saturated {
+            retry_after: Duration::from_secs(1),
+        }
+    }
+
+    /// Queue `task_id` on the candidate with the least queued work per slot.
+    /// Returns that device and the receiver told where the task runs once a
+    /// slot frees, or `Saturated` when it cannot wait anywhere.
+    pub fn enqueue(
+        &self,
+        snapshot: &IndexSnapshot,
+        task_id: &str,
+        model: Option<&str>,
+        allowed: Option<&[ClientId]>,
+    ) -> Result<(ClientId, oneshot::Receiver<ClientId>), Saturated> {
+        let mut queues = self.queues.lock().unwrap_or_else(|p| p.into_inner());
+        if queues.queued >= self.limits.max_queued {
+            return Err(self.saturated());
+        }
+        let device = queues
+            .least_loaded(snapshot, model, allowed, self.limits.device_queue_depth)
+            .ok_or_else(|| self.saturated())?;
+
+        let (dispatch, receiver) = oneshot::channel();
+        queues.push(
+            device,
+            QueuedTask {
+                task_id: task_id.to_string(),
+                model: model.map(str::to_string),
+                allowed: allowed.map(<[ClientId]>::to_vec),
+                dispatch,
+            },
+        );
+        Ok((device, receiver))
+    }
+
+    /// Drop `task_id` from its queue. False when it was no longer queued,
+    /// i.e. it has been dispatched.
+    pub fn cancel(&self, task_id: &str) -> bool {
+        let mut queues = self.queues.lock().unwrap_or_else(|p| p.into_inner());
+        let mut found = false;
+        for queue in queues.by_device.values_mut() {
+            if let Some(pos) = queue.iter().position(|t| t.task_id == task_id) {
+                queue.remove(pos);
+                found = true;
+                break;
+            }
+        }
+        if found {
+            queues.queued -= 1;
+            queues.by_device.retain(|_, queue| !queue.is_empty());
+        }
+        found
+    }
+
+    /// Fill the free slots of `client_id` from the queues.
+    pub fn pump(&self, index: &DeviceIndex, client_id: &ClientId) {
+        let snapshot = index.snapshot();
+        let Some(device) = snapshot.get(client_id) else {
+            return;
+        };
+        loop {
+            let task = {
+                let mut queues = self.queues.lock().unwrap_or_else(|p| p.into_inner());
+                let Some(task) = queues.take_for(device) else {
+                    return;
+                };
+                if !index.try_begin_task(&task.task_id, device) {
+                    // No free slot after all; put it back at the head.
+                    queues
+                        .by_device
+                        .entry(*client_id)
+                        .or_default()
+                        .push_front(task);
+                    queues.queued += 1;
+                    return;
+                }
+                task
+            };
+            if task.dispatch.send(*client_id).is_err() {
+                // The request gave up meanwhile; free the slot again.
+                index.finish_task(&task.task_id);
+            }
+        }
+    }
+
+    /// The device disconnected and is gone from `index`. Its queued tasks
+    /// move to the queues of other devices that can serve them, which are
+    /// then pumped; a task no other device can take fails.
+    pub fn drop_device(&self, index: &DeviceIndex, client_id: &ClientId) {
+        let snapshot = index.snapshot();
+        let mut targets = Vec::new();
+        {
+            let mut queues = self.queues.lock().unwrap_or_else(|p| p.into_inner());
+            let Some(orphans) = queues.by_device.remove(client_id) else {
+                return;
+            };
+            queues.queued -= orphans.len();
+            for task in orphans {
+                let Some(device) = queues.least_loaded(
+                    &snapshot,
+                    task.model.as_deref(),
+                    task.allowed.as_deref(),
+                    self.limits.device_queue_depth,
+                ) else {
+                    continue;
+                };
+                queues.push(device, task);
+                if !targets.contains(&device) {
+                    targets.push(device);
+                }
+            }
+        }
+        for device in &targets {
+            self.pump(index, device);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::inference::device_index::DeviceStats;
+
+    fn id(n: u8) -> ClientId {
+        ClientId([n; 16])
+    }
+
+    fn index_with(devices: &[(u8, &[&str])]) -> DeviceIndex {
+        let index = DeviceIndex::new();
+        for (n, models) in devices {
+            index.update_stats(
+                &id(*n),
+                Some(DeviceStats {
+                    models: models.iter().map(|m| m.to_string()).collect(),
+                    ..DeviceStats::default()
+                }),
+            );
+        }
+        index
+    }
+
+    fn limits(device_queue_depth: usize, max_queued: usize) -> AdmissionLimits {
+        AdmissionLimits {
+            device_queue_depth,
+            max_queued,
+            ..AdmissionLimits::default()
+        }
+    }
+
+    #[test]
+    fn queues_until_a_slot_frees_then_sheds_load() {
+        let index = index_with(&[(1, &["qwen"])]);
+        let admission = Admission::new(limits(1, 8));
+        let snapshot = index.snapshot();
+        index.begin_task("busy", &id(1));
+
+        let (device, mut rx) = admission
+            .enqueue(&snapshot, "queued", Some("qwen"), None)
+            .unwrap();
+        assert_eq!(device, id(1));
+        assert!(admission
+            .enqueue(&snapshot, "refused", Some("qwen"), None)
+            .is_err());
+
+        admission.pump(&index, &id(1));
+        assert!(rx.try_recv().is_err(), "no free slot yet");
+        assert_eq!(index.finish_task("busy"), Some(id(1)));
+        admission.pump(&index, &id(1));
+        assert_eq!(rx.try_recv().unwrap(), id(1));
+        assert_eq!(admission.queued(), 0);
+        assert_eq!(index.snapshot().get(&id(1)).unwrap().in_flight(), 1);
+    }
+
+    #[test]
+    fn idle_device_steals_tasks_it_can_serve() {
+        let index = index_with(&[(1, &["qwen"]), (2, &["qwen"]), (3, &["llama"])]);
+        let admission = Admission::new(limits(4, 8));
+        index.begin_task("busy1", &id(1));
+        index.begin_task("busy2", &id(2));
+        index.begin_task("busy3", &id(3));
+        let snapshot = index.snapshot();
+
+        let (queued_on, mut rx) = admission
+            .enqueue(&snapshot, "t", Some("qwen"), None)
+            .unwrap();
+        let (other, other_task) = if queued_on == id(1) {
+            (id(2), "busy2")
+        } else {
+            (id(1), "busy1")
+        };
+        // A device without the model leaves it queued.
+        index.finish_task("busy3");
+        admission.pump(&index, &id(3));
+        assert!(rx.try_recv().is_err());
+
+        index.finish_task(other_task);
+        admission.pump(&index, &other);
+        assert_eq!(rx.try_recv().unwrap(), other);
+    }
+
+    #[test]
+    fn respects_allowed_ids_when_stealing() {
+        let index = index_with(&[(1, &[]), (2, &[])]);
+        let admission = Admission::new(limits(4, 8));
+        index.begin_task("busy1", &id(1));
+        index.begin_task("busy2", &id(2));
+        let snapshot = index.snapshot();
+
+        let (queued_on, mut rx) = admission
+            .enqueue(&snapshot, "t", None, Some(&[id(1)]))
+            .unwrap();
+        assert_eq!(queued_on, id(1));
+        index.finish_task("busy2");
+        admission.pump(&index, &id(2));
+        assert!(rx.try_recv().is_err());
+        index.finish_task("busy1");
+        admission.pump(&index, &id(1));
+        assert_eq!(rx.try_recv().unwrap(), id(1));
+    }
+
+    #[test]
+    fn disconnect_moves_queued_tasks_to_other_devices() {
+        let index = index_with(&[(1, &["qwen"]), (2, &["qwen"]), (3, &["llama"])]);
+        let admission = Admission::new(limits(4, 8));
+        index.begin_task("busy1", &id(1));
+        index.begin_task("busy2", &id(2));
+        index.begin_task("busy3", &id(3));
+        let snapshot = index.snapshot();
+
+        let (_, mut qwen) = admission
+            .enqueue(&snapshot, "qwen", Some("qwen"), Some(&[id(1)]))
+            .unwrap();
+        let (_, mut any) = admission.enqueue(&snapshot, "any", None, None).unwrap();
+        let (queued_on, _) = admission
+            .enqueue(&snapshot, "llama", Some("llama"), None)
+            .unwrap();
+        assert_eq!(queued_on, id(3));
+
+        // Device 1 goes away: the task pinned to it fails, the others wait
+        // on devices that remain.
+        index.remove(&id(1));
+        admission.drop_device(&index, &id(1));
+        assert!(matches!(
+            qwen.try_recv(),
+            Err(oneshot::error::TryRecvError::Closed)
+        ));
+        assert_eq!(admission.queued(), 2);
+
+        index.finish_task("busy2");
+        admission.pump(&index, &id(2));
+        assert_eq!(any.try_recv().unwrap(), id(2));
+    }
+
+    #[test]
+    fn cancel_and_fleet_limit() {
+        let index = index_with(&[(1, &[]), (2, &[])]);
+        let admission = Admission::new(limits(4, 1));
+        index.begin_task("busy1", &id(1));
+        index.begin_task("busy2", &id(2));
+        let snapshot = index.snapshot();
+
+        let (_, _rx) = admission.enqueue(&snapshot, "a", None, None).unwrap();
+        assert!(admission.enqueue(&snapshot, "b", None, None).is_err());
+        assert!(admission.cancel("a"));
+        assert!(!admission.cancel("a"));
+        assert!(admission.enqueue(&snapshot, "b", None, None).is_ok());
+    }
+}
@@ -0,0 +1,620 @@
+//! Device index backing `InferenceScheduler`'s device selection.
+//!
+//! Selecting a device used to lock `active_clients` and scan every
+//! connected worker on each request. The index instead keeps one entry per
+//! authenticated worker plus per-model buckets, updated by the connection
+//! handler on login, model status, heartbeat and disconnect, and publishes
+//! them as an immutable snapshot. A request clones the current snapshot's
+//! `Arc` and ranks candidates without touching the client map, so selection
+//! never waits on a heartbeat, a login or a slow device writer.
+//!
+//! Among the candidates, selection uses power-of-two-choices: two random
+//! devices are scored and the lower score wins. That keeps the choice
+//! close to the best device while spreading a burst of requests instead
+//! of sending all of it to whichever worker looked idle at the last
+//! heartbeat. Each device runs at most its advertised number of task
+//! slots at once; `reserve` only picks devices with a free slot, and the
+//! admission controller queues whatever does not fit.
+
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::{Arc, Mutex, OnceLock, RwLock};
+
+use rand::Rng;
+
+use crate::handle::ClientInfo;
+use crate::util::protoc::ClientId;
+
+/// Throughput assumed for workers that do not report one (desktop workers
+/// and mobile workers that have not finished a request yet).
+const DEFAULT_TOKENS_PER_SEC: f32 = 10.0;
+/// A worker that has to load the model first counts as this many queued
+/// requests' worth of extra wait.
+const COLD_PENALTY: f64 = 4.0;
+/// Score factor of a worker running below its profile from heat or battery.
+const THROTTLED_PENALTY: f64 = 2.0;
+/// Extra score factor of a worker whose loaded model runs entirely on
+/// the CPU; a partial offload pays its CPU share of it.
+const CPU_LAYERS_PENALTY: f64 = 4.0;
+/// Upper bound on the task slots a worker can claim.
+const MAX_TASK_SLOTS: u32 = 16;
+/// Attempts to claim a free slot before the task has to queue.
+const RESERVE_ATTEMPTS: usize = 3;
+
+/// Task slots of workers that advertise none, `GPUF_DEVICE_TASK_SLOTS`
+/// (default 1: workers serve one inference at a time).
+fn default_task_slots() -> u32 {
+    static SLOTS: OnceLock<u32> = OnceLock::new();
+    *SLOTS.get_or_init(|| {
+        std::env::var("GPUF_DEVICE_TASK_SLOTS")
+            .ok()
+            .and_then(|s| s.parse::<u32>().ok())
+            .filter(|&v| v > 0)
+            .unwrap_or(1)
+    })
+}
+
+/// What the scheduler knows about one worker, as of its last update.
+#[derive(Debug, Clone, Default)]
+pub struct DeviceStats {
+    /// CPU plus memory usage, in percent.
+    pub load: u16,
+    pub throttled: bool,
+    /// Sustainable decode throughput the worker advertised, if any.
+    pub tokens_per_sec: Option<f32>,
+    /// Models the worker can serve.
+    pub models: Vec<String>,
+    /// Models the worker has loaded.
+    pub resident_models: Vec<String>,
+    /// Tasks the worker advertised it runs at once; 0 when unknown.
+    pub task_slots: u32,
+    /// Share of its resident model's layers the worker placed on GPUs,
+    /// when it reported its placement.
+    pub gpu_offload: Option<f32>,
+}
+
+impl DeviceStats {
+    /// Stats of an authenticated client with system info; `None` for
+    /// clients the scheduler must not pick.
+    fn from_client(info: &ClientInfo) -> Option<Self> {
+        if !info.authed {
+            return None;
+        }
+        let system_info = info.system_info.as_ref()?;
+        let capacity = info.perf_capacity.as_ref();
+        Some(Self {
+            load: system_info.cpu_usage as u16 + system_info.memory_usage as u16,
+            throttled: capacity.is_some_and(|c| c.throttled),
+            tokens_per_sec: capacity
+                .map(|c| c.sustainable_tokens_per_sec)
+                .filter(|tps| *tps > 0.0),
+            models: info.models.iter().flatten().map(|m| m.id.clone()).collect(),
+            resident_models: info.resident_models.clone(),
+            task_slots: info.task_slots as u32,
+            gpu_offload: info
+                .gpu_placement
+                .as_ref()
+                .map(|p| p.n_gpu_layers.min(p.n_layers + 1) as f32 / (p.n_layers + 1) as f32),
+        })
+    }
+}
+
+#[derive(Debug)]
+pub struct DeviceEntry {
+    pub client_id: ClientId,
+    pub stats: DeviceStats,
+    /// Tasks sent to the device and not yet finished; shared across
+    /// snapshots so it survives updates of the entry.
+    in_flight: Arc<AtomicU32>,
+}
+
+impl DeviceEntry {
+    pub fn in_flight(&self) -> u32 {
+        self.in_flight.load(Ordering::Relaxed)
+    }
+
+    pub fn slots(&self) -> u32 {
+        match self.stats.task_slots {
+            0 => default_task_slots(),
+            n => n.min(MAX_TASK_SLOTS),
+        }
+    }
+
+    fn has_free_slot(&self) -> bool {
+        self.in_flight() < self.slots()
+    }
+
+    /// Whether a task on `model` (`None` for any) restricted to `allowed`
+    /// may run on this device.
+    pub fn serves(&self, model: Option<&str>, allowed: Option<&[ClientId]>) -> bool {
+        allowed.map_or(true, |allowed| allowed.contains(&self.client_id))
+            && model.map_or(true, |model| self.stats.models.iter().any(|m| m == model))
+    }
+
+    /// Expected wait for one more task; lower is better. Queued work over
+    /// throughput, scaled up for busy, throttled or cold devices.
+    fn score(&self, model: Option<&str>) -> f64 {
+        let tokens_per_sec = self.stats.tokens_per_sec.unwrap_or(DEFAULT_TOKENS_PER_SEC) as f64;
+        let mut score = (self.in_flight() as f64 + 1.0) / tokens_per_sec;
+        score *= 1.0 + self.stats.load as f64 / 200.0;
+        if self.stats.throttled {
+            score *= THROTTLED_PENALTY;
+        }
+        let warm = model.map_or(true, |model| {
+            self.stats.resident_models.iter().any(|m| m == model)
+        });
+        if !warm {
+            score *= COLD_PENALTY;
+        } else if let Some(offload) = self.stats.gpu_offload {
+            score *= 1.0 + CPU_LAYERS_PENALTY * (1.0 - offload as f64);
+        }
+        score
+    }
+}
+
+/// The devices a task may run on, borrowed from a snapshot.
+#[derive(Clone, Copy)]
+enum PoolSource<'s, 'p> {
+    All,
+    /// A per-model bucket of indices into `IndexSnapshot::devices`.
+    Bucket(&'s [usize]),
+    /// Allowed ids; they may be gone or lack the model.
+    Allowed(&'p [ClientId]),
+}
+
+#[derive(Clone, Copy)]
+struct Pool<'s, 'p> {
+    snapshot: &'s IndexSnapshot,
+    source: PoolSource<'s, 'p>,
+    model: Option<&'p str>,
+}
+
+impl<'s> Pool<'s, '_> {
+    fn len(&self) -> usize {
+        match self.source {
+            PoolSource::All => self.snapshot.devices.len(),
+            PoolSource::Bucket(indices) => indices.len(),
+            PoolSource::Allowed(ids) => ids.len(),
+        }
+    }
+
+    /// Entry at position `i`, if it can run the task.
+    fn get(&self, i: usize) -> Option<&'s DeviceEntry> {
+        match self.source {
+            PoolSource::All => Some(&*self.snapshot.devices[i]),
+            PoolSource::Bucket(indices) => Some(&*self.snapshot.devices[indices[i]]),
+            PoolSource::Allowed(ids) => self
+                .snapshot
+                .get(&ids[i])
+                .filter(|entry| entry.serves(self.model, None)),
+        }
+    }
+}
+
+/// Immutable view of all selectable devices.
+#[derive(Debug, Default)]
+pub struct IndexSnapshot {
+    devices: Vec<Arc<DeviceEntry>>,
+    by_id: HashMap<ClientId, usize>,
+    by_model: HashMap<String, Vec<usize>>,
+}
+
+impl IndexSnapshot {
+    fn build(entries: &HashMap<ClientId, Arc<DeviceEntry>>) -> Self {
+        let mut snapshot = Self {
+            devices: Vec::with_capacity(entries.len()),
+            ..Self::default()
+        };
+        for entry in entries.values() {
+            let idx = snapshot.devices.len();
+            snapshot.by_id.insert(entry.client_id, idx);
+            for model in &entry.stats.models {
+                snapshot
+                    .by_model
+                    .entry(model.clone())
+                    .or_default()
+                    .push(idx);
+            }
+            snapshot.devices.push(entry.clone());
+        }
+        snapshot
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.devices.is_empty()
+    }
+
+    pub fn len(&self) -> usize {
+        self.devices.len()
+    }
+
+    pub fn get(&self, client_id: &ClientId) -> Option<&DeviceEntry> {
+        self.by_id.get(client_id).map(|&idx| &*self.devices[idx])
+    }
+
+    fn pool<'p>(&self, model: Option<&'p str>, allowed: Option<&'p [ClientId]>) -> Pool<'_, 'p> {
+        let source = match (allowed, model) {
+            (Some(allowed), _) => PoolSource::Allowed(allowed),
+            (None, Some(model)) => {
+                PoolSource::Bucket(self.by_model.get(model).map_or(&[], Vec::as_slice))
+            }
+            (None, None) => PoolSource::All,
+        };
+        Pool {
+            snapshot: self,
+            source,
+            model,
+        }
+    }
+
+    /// Devices that serve `model` (any device for `None`), restricted to
+    /// `allowed` when given.
+    pub fn candidates<'a>(
+        &'a self,
+        model: Option<&'a str>,
+        allowed: Option<&'a [ClientId]>,
+    ) -> impl Iterator<Item = &'a DeviceEntry> + 'a {
+        let pool = self.pool(model, allowed);
+        (0..pool.len()).filter_map(move |i| pool.get(i))
+    }
+
+    /// Pick a device for a task on `model` (`None` for any device) among
+    /// `allowed` (`None` for all) with power-of-two-choices.
+    pub fn select<R: Rng + ?Sized>(
+        &self,
+        model: Option<&str>,
+        allowed: Option<&[ClientId]>,
+        rng: &mut R,
+    ) -> Option<&DeviceEntry> {
+        self.sample(model, allowed, rng, |_| true)
+    }
+
+    /// Power-of-two-choices among the candidates `accept`ed, drawn straight
+    /// from the model bucket, the allowed ids or the device list. Only when
+    /// neither random draw is accepted is the pool scanned, from a random
+    /// offset, for the first two that are.
+    fn sample<R: Rng + ?Sized>(
+        &self,
+        model: Option<&str>,
+        allowed: Option<&[ClientId]>,
+        rng: &mut R,
+        accept: impl Fn(&DeviceEntry) -> bool,
+    ) -> Option<&DeviceEntry> {
+        let pool = self.pool(model, allowed);
+        let n = pool.len();
+        let draw = |i: usize| pool.get(i).filter(|entry| accept(entry));
+        let (a, b) = match n {
+            0 => return None,
+            1 => return draw(0),
+            _ => {
+                let a = rng.gen_range(0..n);
+                (a, (a + rng.gen_range(1..n)) % n)
+            }
+        };
+        let mut choices = (draw(a), draw(b));
+        if choices.0.is_none() && choices.1.is_none() {
+            let start = rng.gen_range(0..n);
+            let mut accepted = (0..n).filter_map(|k| draw((start + k) % n));
+            choices = (accepted.next(), accepted.next());
+        }
+        match choices {
+            (Some(a), Some(b)) => Some(if b.score(model) < a.score(model) {
+                b
+            } else {
+                a
+            }),
+            (a, b) => a.or(b),
+        }
+    }
+}
+
+#[derive(Default)]
+pub struct DeviceIndex {
+    snapshot: RwLock<Arc<IndexSnapshot>>,
+    entries: Mutex<HashMap<ClientId, Arc<DeviceEntry>>>,
+    /// task id -> device running it and that device's in-flight counter
+    tasks: Mutex<HashMap<String, (ClientId, Arc<AtomicU32>)>>,
+}
+
+impl DeviceIndex {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// The current snapshot. Readers only hold the lock to clone the `Arc`.
+    pub fn snapshot(&self) -> Arc<IndexSnapshot> {
+        self.snapshot
+            .read()
+            .unwrap_or_else(|p| p.into_inner())
+            .clone()
+    }
+
+    fn publish(&self, entries: &HashMap<ClientId, Arc<DeviceEntry>>) {
+        let snapshot = Arc::new(IndexSnapshot::build(entries));
+        *self.snapshot.write().unwrap_or_else(|p| p.into_inner()) = snapshot;
+    }
+
+    fn set(
+        entries: &mut HashMap<ClientId, Arc<DeviceEntry>>,
+        client_id: &ClientId,
+        stats: Option<DeviceStats>,
+    ) {
+        let Some(stats) = stats else {
+            entries.remove(client_id);
+            return;
+        };
+        let in_flight = entries
+            .get(client_id)
+            .map(|entry| entry.in_flight.clone())
+            .unwrap_or_default();
+        entries.insert(
+            *client_id,
+            Arc::new(DeviceEntry {
+                client_id: *client_id,
+                stats,
+                in_flight,
+            }),
+        );
+    }
+
+    /// Mirror `info`, the client map's entry for `client_id`, into the index.
+    pub fn update(&self, client_id: &ClientId, info: &ClientInfo) {
+        self.update_stats(client_id, DeviceStats::from_client(info));
+    }
+
+    pub(crate) fn update_stats(&self, client_id: &ClientId, stats: Option<DeviceStats>) {
+        let mut entries = self.entries.lock().unwrap_or_else(|p| p.into_inner());
+        Self::set(&mut entries, client_id, stats);
+        self.publish(&entries);
+    }
+
+    /// The client disconnected; drop it and the tasks it was running.
+    pub fn remove(&self, client_id: &ClientId) {
+        let mut entries = self.entries.lock().unwrap_or_else(|p| p.into_inner());
+        if let Some(entry) = entries.remove(client_id) {
+            self.tasks
+                .lock()
+                .unwrap_or_else(|p| p.into_inner())
+                .retain(|_, (_, counter)| !Arc::ptr_eq(counter, &entry.in_flight));
+            self.publish(&entries);
+        }
+    }
+
+    /// Replace the index with the contents of `clients`.
+    pub fn rebuild(&self, clients: &HashMap<ClientId, ClientInfo>) {
+        let mut entries = self.entries.lock().unwrap_or_else(|p| p.into_inner());
+        entries.retain(|id, _| clients.contains_key(id));
+        for (client_id, info) in clients {
+            Self::set(&mut entries, client_id, DeviceStats::from_client(info));
+        }
+        self.publish(&entries);
+    }
+
+    fn track(&self, task_id: &str, entry: &DeviceEntry) {
+        let previous = self.tasks.lock().unwrap_or_else(|p| p.into_inner()).insert(
+            task_id.to_string(),
+            (entry.client_id, entry.in_flight.clone()),
+        );
+        if let Some((_, previous)) = previous {
+            previous.fetch_sub(1, Ordering::Relaxed);
+        }
+    }
+
+    /// Task `task_id` was sent to `client_id`, regardless of its slots.
+    pub fn begin_task(&self, task_id: &str, client_id: &ClientId) {
+        let snapshot = self.snapshot();
+        let Some(entry) = snapshot.get(client_id) else {
+            return;
+        };
+        entry.in_flight.fetch_add(1, Ordering::Relaxed);
+        self.track(task_id, entry);
+    }
+
+    /// Claim a slot on `entry` for `task_id`; false when all are taken.
+    pub fn try_begin_task(&self, task_id: &str, entry: &DeviceEntry) -> bool {
+        let slots = entry.slots();
+        let claimed = entry
+            .in_flight
+            .fetch_update(Ordering::AcqRel, Ordering::Relaxed, |n| {
+                (n < slots).then_some(n + 1)
+            })
+            .is_ok();
+        if claimed {
+            self.track(task_id, entry);
+        }
+        claimed
+    }
+
+    /// Claim a free slot for `task_id` on a device picked like `select`
+    /// among those with one. `None` when every candidate is busy.
+    pub fn reserve<R: Rng + ?Sized>(
+        &self,
+        snapshot: &IndexSnapshot,
+        task_id: &str,
+        model: Option<&str>,
+        allowed: Option<&[ClientId]>,
+        rng: &mut R,
+    ) -> Option<ClientId> {
+        for _ in 0..RESERVE_ATTEMPTS {
+            let entry = snapshot.sample(model, allowed, rng, DeviceEntry::has_free_slot)?;
+            if self.try_begin_task(task_id, entry) {
+                return Some(entry.client_id);
+            }
+        }
+        None
+    }
+
+    /// Task `task_id` completed, failed or was cancelled. Returns the device
+    /// whose slot it freed, once; later calls return `None`.
+    pub fn finish_task(&self, task_id: &str) -> Option<ClientId> {
+        let (client_id, counter) = self
+            .tasks
+            .lock()
+            .unwrap_or_else(|p| p.into_inner())
+            .remove(task_id)?;
+        counter.fetch_sub(1, Ordering::Relaxed);
+        Some(client_id)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use rand::rngs::StdRng;
+    use rand::SeedableRng;
+
+    fn stats(load: u16, models: &[&str], resident: &[&str]) -> DeviceStats {
+        DeviceStats {
+            load,
+            models: models.iter().map(|m| m.to_string()).collect(),
+            resident_models: resident.iter().map(|m| m.to_string()).collect(),
+            ..DeviceStats::default()
+        }
+    }
+
+    fn id(n: u8) -> ClientId {
+        ClientId([n; 16])
+    }
+
+    #[test]
+    fn buckets_devices_by_model_and_honors_allowed_ids() {
+        let index = DeviceIndex::new();
+        index.update_stats(&id(1), Some(stats(10, &["qwen"], &[])));
+        index.update_stats(&id(2), Some(stats(10, &["llama"], &[])));
+        let snapshot = index.snapshot();
+        let mut rng = StdRng::seed_from_u64(7);
+
+        for _ in 0..16 {
+            let picked = snapshot.select(Some("qwen"), None, &mut rng).unwrap();
+            assert_eq!(picked.client_id, id(1));
+        }
+        assert!(snapshot.select(Some("mistral"), None, &mut rng).is_none());
+        assert!(snapshot
+            .select(Some("qwen"), Some(&[id(2)]), &mut rng)
+            .is_none());
+        assert_eq!(
+            snapshot
+                .select(None, Some(&[id(2)]), &mut rng)
+                .unwrap()
+                .client_id,
+            id(2)
+        );
+    }
+
+    #[test]
+    fn prefers_idle_warm_unthrottled_devices() {
+        let index = DeviceIndex::new();
+        index.update_stats(&id(1), Some(stats(10, &["qwen"], &["qwen"])));
+        index.update_stats(&id(2), Some(stats(10, &["qwen"], &[])));
+        let mut rng = StdRng::seed_from_u64(7);
+        let pick = |rng: &mut StdRng| {
+            index
+                .snapshot()
+                .select(Some("qwen"), None, rng)
+                .unwrap()
+                .client_id
+        };
+        assert_eq!(pick(&mut rng), id(1), "warm beats cold");
+
+        // Enough queued work on the warm device outweighs a cold load.
+        for task in 0..4 {
+            index.begin_task(&format!("t{task}"), &id(1));
+        }
+        assert_eq!(pick(&mut rng), id(2));
+        for task in 0..4 {
+            index.finish_task(&format!("t{task}"));
+            index.finish_task(&format!("t{task}"));
+        }
+        assert_eq!(
+            index
+                .snapshot()
+                .select(None, Some(&[id(1)]), &mut rng)
+                .unwrap()
+                .in_flight(),
+            0
+        );
+
+        let mut throttled = stats(10, &["qwen"], &["qwen"]);
+        throttled.throttled = true;
+        throttled.tokens_per_sec = Some(1.0);
+        index.update_stats(&id(1), Some(throttled));
+        assert_eq!(pick(&mut rng), id(2));
+    }
+
+    #[test]
+    fn prefers_workers_with_the_model_on_their_gpus() {
+        let index = DeviceIndex::new();
+        let mut partial = stats(10, &["qwen"], &["qwen"]);
+        partial.gpu_offload = Some(0.25);
+        let mut full = stats(10, &["qwen"], &["qwen"]);
+        full.gpu_offload = Some(1.0);
+        index.update_stats(&id(1), Some(partial));
+        index.update_stats(&id(2), Some(full));
+        let snapshot = index.snapshot();
+        let mut rng = StdRng::seed_from_u64(5);
+        for _ in 0..8 {
+            let picked = snapshot.select(Some("qwen"), None, &mut rng).unwrap();
+            assert_eq!(picked.client_id, id(2));
+        }
+    }
+
+    #[test]
+    fn in_flight_survives_updates_and_removal_drops_tasks() {
+        let index = DeviceIndex::new();
+        index.update_stats(&id(1), Some(stats(10, &["qwen"], &[])));
+        index.begin_task("a", &id(1));
+        index.update_stats(&id(1), Some(stats(50, &["qwen"], &["qwen"])));
+        let snapshot = index.snapshot();
+        let entry = snapshot
+            .select(None, None, &mut StdRng::seed_from_u64(1))
+            .unwrap();
+        assert_eq!(entry.in_flight(), 1);
+
+        index.remove(&id(1));
+        assert!(index.snapshot().is_empty());
+        assert_eq!(index.finish_task("a"), None);
+        assert!(index.tasks.lock().unwrap().is_empty());
+        index.update_stats(&id(1), None);
+        assert!(index.snapshot().is_empty());
+    }
+
+    #[test]
+    fn reserve_respects_task_slots() {
+        let index = DeviceIndex::new();
+        let mut two = stats(10, &["qwen"], &[]);
+        two.task_slots = 2;
+        index.update_stats(&id(1), Some(two));
+        let snapshot = index.snapshot();
+        let mut rng = StdRng::seed_from_u64(3);
+
+        let reserve =
+            |task: &str, rng: &mut StdRng| index.reserve(&snapshot, task, Some("qwen"), None, rng);
+        assert_eq!(reserve("a", &mut rng), Some(id(1)));
+        assert_eq!(reserve("b", &mut rng), Some(id(1)));
+        assert_eq!(reserve("c", &mut rng), None);
+        assert_eq!(index.finish_task("a"), Some(id(1)));
+        assert_eq!(index.finish_task("a"), None);
+        assert_eq!(reserve("c", &mut rng), Some(id(1)));
+    }
+
+    #[test]
+    fn reserve_finds_the_only_free_device() {
+        let index = DeviceIndex::new();
+        for n in 1..=32 {
+            index.update_stats(&id(n), Some(stats(10, &["qwen"], &[])));
+            if n != 17 {
+                index.begin_task(&format!("busy{n}"), &id(n));
+            }
+        }
+        let snapshot = index.snapshot();
+        let mut rng = StdRng::seed_from_u64(11);
+        assert_eq!(
+            index.reserve(&snapshot, "a", Some("qwen"), None, &mut rng),
+            Some(id(17))
+        );
+        assert_eq!(
+            index.reserve(&snapshot, "b", Some("qwen"), None, &mut rng),
+            None
+        );
+    }
+}
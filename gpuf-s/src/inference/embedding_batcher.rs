@@ -0,0 +1,361 @@
+//! Coalescing of `/v1/embeddings` requests.
+//!
+//! RAG clients issue many small embedding requests. Sent one by one, each
+//! would take a device task slot and a `llama_decode` call for a handful of
+//! tokens. Instead, requests for the same model, normalization and device
+//! set join an open batch. The request that opened it flushes it once the
+//! window has passed, and a request that fills it to `max_inputs` flushes it
+//! at once. The device embeds the whole batch as one `EmbeddingTask`, and
+//! the result is split back to each request by input range.
+
+use std::collections::HashMap;
+use std::ops::Range;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Mutex;
+use std::time::Duration;
+
+use tokio::sync::oneshot;
+
+use super::admission::{NoDevice, Saturated};
+use crate::util::protoc::ClientId;
+
+#[derive(Debug, Clone, Copy)]
+pub struct BatchLimits {
+    /// How long an open batch waits for more requests.
+    pub window: Duration,
+    /// Inputs after which a batch is flushed without waiting.
+    pub max_inputs: usize,
+}
+
+impl Default for BatchLimits {
+    fn default() -> Self {
+        Self {
+            window: Duration::from_millis(5),
+            max_inputs: 256,
+        }
+    }
+}
+
+impl BatchLimits {
+    /// Defaults overridden by `GPUF_EMBED_BATCH_WINDOW_MS` and
+    /// `GPUF_EMBED_BATCH_MAX_INPUTS`.
+    pub fn from_env() -> Self {
+        fn var(name: &str) -> Option<u64> {
+            std::env::var(name).ok().and_then(|s| s.parse::<u64>().ok())
+        }
+        let defaults = Self::default();
+        Self {
+            window: var("GPUF_EMBED_BATCH_WINDOW_MS")
+                .map_or(defaults.window, Duration::from_millis),
+            max_inputs: var("GPUF_EMBED_BATCH_MAX_INPUTS")
+                .filter(|&v| v > 0)
+                .map_or(defaults.max_inputs, |v| v as usize),
+        }
+    }
+}
+
+/// Requests may share a batch only when they agree on all of these.
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+pub struct BatchKey {
+    pub model: String,
+    pub normalize: bool,
+    pub allowed: Option<Vec<ClientId>>,
+}
+
+/// One request's share of a device result.
+#[derive(Debug, Clone, PartialEq)]
+pub struct EmbeddingSlice {
+    pub dim: u32,
+    /// `inputs.len() * dim` floats, row per input.
+    pub embeddings: Vec<f32>,
+    pub prompt_tokens: u32,
+}
+
+#[derive(Debug, Clone)]
+pub enum BatchError {
+    Saturated(Saturated),
+    NoDevice(NoDevice),
+    Failed(String),
+}
+
+impl From<&anyhow::Error> for BatchError {
+    fn from(e: &anyhow::Error) -> Self {
+        if let Some(saturated) = e.downcast_ref::<Saturated>() {
+            Self::Saturated(*saturated)
+        } else if let Some(no_device) = e.downcast_ref::<NoDevice>() {
+            Self::NoDevice(no_device.clone())
+        } else {
+            Self::Failed(e.to_string())
+        }
+    }
+}
+
+impl From<BatchError> for anyhow::Error {
+    fn from(e: BatchError) -> Self {
+        match e {
+            BatchError::Saturated(saturated) => saturated.into(),
+            BatchError::NoDevice(no_device) => no_device.into(),
+            BatchError::Failed(message) => anyhow::anyhow!(message),
+        }
+    }
+}
+
+pub type SliceReceiver = oneshot::Receiver<Result<EmbeddingSlice, BatchError>>;
+
+struct Waiter {
+    rows: Range<usize>,
+    /// Input bytes, to apportion the batch's prompt tokens.
+    bytes: usize,
+    tx: oneshot::Sender<Result<EmbeddingSlice, BatchError>>,
+}
+
+pub struct EmbeddingBatch {
+    pub key: BatchKey,
+    inputs: Vec<String>,
+    waiters: Vec<Waiter>,
+}
+
+impl EmbeddingBatch {
+    fn new(key: BatchKey) -> Self {
+        Self {
+            key,
+            inputs: Vec::new(),
+            waiters: Vec::new(),
+        }
+    }
+
+    fn push(&mut self, inputs: Vec<String>) -> SliceReceiver {
+        let (tx, rx) = oneshot::channel();
+        let start = self.inputs.len();
+        let bytes = inputs.iter().map(String::len).sum();
+        self.inputs.extend(inputs);
+        self.waiters.push(Waiter {
+            rows: start..self.inputs.len(),
+            bytes,
+            tx,
+        });
+        rx
+    }
+
+    pub fn len(&self) -> usize {
+        self.inputs.len()
+    }
+
+    /// Requests coalesced into this batch.
+    pub fn requests(&self) -> usize {
+        self.waiters.len()
+    }
+
+    /// The inputs to send to the device; the batch keeps only the ranges.
+    pub fn take_inputs(&mut self) -> Vec<String> {
+        std::mem::take(&mut self.inputs)
+    }
+
+    /// Split a device result between the requests in the batch. The device
+    /// reports one token count for the whole batch, which is shared out in
+    /// proportion to input length.
+    pub fn complete(self, dim: u32, embeddings: Vec<f32>, prompt_tokens: u32) {
+        let rows = self.waiters.last().map_or(0, |w| w.rows.end);
+        if dim == 0 || embeddings.len() != rows * dim as usize {
+            self.fail(BatchError::Failed(format!(
+                "device returned {} floats for {} inputs of dimension {}",
+                embeddings.len(),
+                rows,
+                dim
+            )));
+            return;
+        }
+
+        let dim_len = dim as usize;
+        let total_bytes = self.waiters.iter().map(|w| w.bytes).sum::<usize>().max(1) as u64;
+        let mut tokens_left = prompt_tokens;
+        let last = self.waiters.len() - 1;
+        let mut embeddings = Some(embeddings);
+        for (i, waiter) in self.waiters.into_iter().enumerate() {
+            let tokens = if i == last {
+                tokens_left
+            } else {
+                (prompt_tokens as u64 * waiter.bytes as u64 / total_bytes) as u32
+            };
+            tokens_left -= tokens;
+            let slice = if last == 0 {
+                embeddings.take().unwrap_or_default()
+            } else {
+                let all = embeddings.as_ref().map_or(&[][..], Vec::as_slice);
+                all[waiter.rows.start * dim_len..waiter.rows.end * dim_len].to_vec()
+            };
+            let _ = waiter.tx.send(Ok(EmbeddingSlice {
+                dim,
+                embeddings: slice,
+                prompt_tokens: tokens,
+            }));
+        }
+    }
+
+    pub fn fail(self, error: BatchError) {
+        for waiter in self.waiters {
+            let _ = waiter.tx.send(Err(error.clone()));
+        }
+    }
+}
+
+/// What a request must do after joining.
+pub struct Joined {
+    pub rx: SliceReceiver,
+    /// Batches that are full and must be dispatched now.
+    pub ready: Vec<EmbeddingBatch>,
+    /// The request opened a batch; flush it with `take` after the window.
+    pub flush_after: Option<u64>,
+}
+
+pub struct EmbeddingBatcher {
+    limits: BatchLimits,
+    open: Mutex<HashMap<BatchKey, (u64, EmbeddingBatch)>>,
+    next_generation: AtomicU64,
+}
+
+impl EmbeddingBatcher {
+    pub fn new(limits: BatchLimits) -> Self {
+        Self {
+            limits,
+            open: Mutex::new(HashMap::new()),
+            next_generation: AtomicU64::new(0),
+        }
+    }
+
+    pub fn window(&self) -> Duration {
+        self.limits.window
+    }
+
+    pub fn join(&self, key: BatchKey, inputs: Vec<String>) -> Joined {
+        let mut open = self.open.lock().unwrap();
+        let mut ready = Vec::new();
+
+        // A request that would overflow the open batch seals it and starts
+        // the next one.
+        if let Some((_, batch)) = open.get(&key) {
+            if batch.len() + inputs.len() > self.limits.max_inputs {
+                ready.extend(open.remove(&key).map(|(_, b)| b));
+            }
+        }
+
+        let mut flush_after = None;
+        let (_, batch) = open.entry(key.clone()).or_insert_with(|| {
+            let generation = self.next_generation.fetch_add(1, Ordering::Relaxed);
+            flush_after = Some(generation);
+            (generation, EmbeddingBatch::new(key.clone()))
+        });
+        let rx = batch.push(inputs);
+        if batch.len() >= self.limits.max_inputs {
+            ready.extend(open.remove(&key).map(|(_, b)| b));
+            flush_after = None;
+        }
+
+        Joined {
+            rx,
+            ready,
+            flush_after,
+        }
+    }
+
+    /// Close the batch opened as `generation`, unless it was already flushed
+    /// for being full.
+    pub fn take(&self, key: &BatchKey, generation: u64) -> Option<EmbeddingBatch> {
+        let mut open = self.open.lock().unwrap();
+        match open.get(key) {
+            Some((g, _)) if *g == generation => open.remove(key).map(|(_, b)| b),
+            _ => None,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn key(model: &str) -> BatchKey {
+        BatchKey {
+            model: model.to_string(),
+            normalize: true,
+            allowed: None,
+        }
+    }
+
+    fn texts(n: usize) -> Vec<String> {
+        (0..n).map(|i| format!("text {i}")).collect()
+    }
+
+    fn batcher(max_inputs: usize) -> EmbeddingBatcher {
+        EmbeddingBatcher::new(BatchLimits {
+            max_inputs,
+            ..BatchLimits::default()
+        })
+    }
+
+    #[test]
+    fn concurrent_requests_share_one_batch() {
+        let batcher = batcher(16);
+        let first = batcher.join(key("m"), texts(2));
+        let second = batcher.join(key("m"), texts(3));
+        let other_model = batcher.join(key("n"), texts(1));
+
+        assert!(first.ready.is_empty() && second.ready.is_empty());
+        let generation = first.flush_after.expect("first request opens the batch");
+        assert!(second.flush_after.is_none());
+        assert!(other_model.flush_after.is_some());
+
+        let batch = batcher.take(&key("m"), generation).unwrap();
+        assert_eq!((batch.len(), batch.requests()), (5, 2));
+        assert!(batcher.take(&key("m"), generation).is_none());
+    }
+
+    #[test]
+    fn full_batches_flush_without_waiting() {
+        let batcher = batcher(4);
+        let first = batcher.join(key("m"), texts(3));
+        let generation = first.flush_after.unwrap();
+
+        // Does not fit: the open batch is sealed, a new one is opened.
+        let second = batcher.join(key("m"), texts(2));
+        assert_eq!(second.ready.len(), 1);
+        assert_eq!(second.ready[0].len(), 3);
+        assert!(second.flush_after.is_some());
+        assert!(batcher.take(&key("m"), generation).is_none());
+
+        // Fills the new batch exactly.
+        let third = batcher.join(key("m"), texts(2));
+        assert_eq!(third.ready.len(), 1);
+        assert_eq!(third.ready[0].len(), 4);
+        assert!(third.flush_after.is_none());
+    }
+
+    #[test]
+    fn results_are_split_by_input_range() {
+        let batcher = batcher(16);
+        let mut a = batcher.join(key("m"), vec!["aaaa".into()]);
+        let mut b = batcher.join(key("m"), vec!["bb".into(), "bb".into(), "bb".into()]);
+        let mut batch = batcher.take(&key("m"), a.flush_after.unwrap()).unwrap();
+        assert_eq!(batch.take_inputs().len(), 4);
+
+        let embeddings: Vec<f32> = (0..8).map(|v| v as f32).collect();
+        batch.complete(2, embeddings, 20);
+
+        let a = a.rx.try_recv().unwrap().unwrap();
+        let b = b.rx.try_recv().unwrap().unwrap();
+        assert_eq!(a.embeddings, vec![0.0, 1.0]);
+        assert_eq!(b.embeddings, vec![2.0, 3.0, 4.0, 5.0, 6.0, 7.0]);
+        assert_eq!((a.prompt_tokens, b.prompt_tokens), (8, 12));
+    }
+
+    #[test]
+    fn malformed_results_fail_every_request() {
+        let batcher = batcher(16);
+        let mut a = batcher.join(key("m"), texts(1));
+        let mut b = batcher.join(key("m"), texts(1));
+        let batch = batcher.take(&key("m"), a.flush_after.unwrap()).unwrap();
+        batch.complete(4, vec![0.0; 4], 2);
+
+        assert!(matches!(a.rx.try_recv(), Ok(Err(BatchError::Failed(_)))));
+        assert!(matches!(b.rx.try_recv(), Ok(Err(BatchError::Failed(_)))));
+    }
+}
@@ -33,6 +33,10 @@ pub struct InferenceGateway {
     pub scheduler: Arc<InferenceScheduler>,
     pub db_pool: Arc<Pool<Postgres>>,
     pub producer: Arc<FutureProducer>,
+    /// XDP auth filter attached by this server, whose counters
+    /// `/api/v1/xdp/stats` reports.
+    #[cfg(all(feature = "xdp", target_os = "linux"))]
+    pub xdp_filter: Option<Arc<crate::xdp::xdp_filter::XdpFilter>>,
 }
 
 impl InferenceGateway {
@@ -45,6 +49,8 @@ impl InferenceGateway {
             scheduler,
             db_pool,
             producer,
+            #[cfg(all(feature = "xdp", target_os = "linux"))]
+            xdp_filter: None,
         }
     }
     #[cfg(feature = "experimental")]
@@ -54,11 +60,13 @@ impl InferenceGateway {
         producer: Arc<FutureProducer>,
     ) -> Self {
         let scheduler = Arc::new(InferenceScheduler::new(active_clients));
-        Self {
-            scheduler,
-            db_pool,
-            producer,
-        }
+        Self::new(scheduler, db_pool, producer)
+    }
+
+    #[cfg(all(feature = "xdp", target_os = "linux"))]
+    pub fn with_xdp_filter(mut self, filter: Arc<crate::xdp::xdp_filter::XdpFilter>) -> Self {
+        self.xdp_filter = Some(filter);
+        self
     }
 
     async fn auth_middleware(
@@ -150,20 +158,25 @@ impl InferenceGateway {
     /// Create API router for inference endpoints
     pub async fn create_router(self: Arc<Self>) -> Router {
         let state = Arc::clone(&self);
-        Router::new()
+        let router = Router::new()
             // OpenAI Compatible Inference APIs
             .route("/v1/completions", post(handlers::handle_completion))
             .route(
                 "/v1/chat/completions",
                 post(handlers::handle_chat_completion),
             )
+            .route("/v1/embeddings", post(handlers::handle_embeddings))
             .route("/v1/models", get(handlers::list_models))
             // Device Management APIs
             .route("/api/v1/devices", get(handlers::list_devices))
             .route(
                 "/api/v1/devices/:id/status",
                 get(handlers::get_device_status),
-            )
+            );
+        // XDP filter counters
+        #[cfg(all(feature = "xdp", target_os = "linux"))]
+        let router = router.route("/api/v1/xdp/stats", get(handlers::get_xdp_stats));
+        router
             .route_layer(middleware::from_fn_with_state(
                 self.db_pool.clone(),
                 Self::auth_middleware,
@@ -1,6 +1,6 @@
 use axum::{
     extract::{Extension, Path, State},
-    http::{HeaderMap, StatusCode},
+    http::{header, HeaderMap, StatusCode},
     response::{sse::Event, sse::Sse, IntoResponse, Response},
     Json,
 };
@@ -14,10 +14,11 @@ use tokio_stream::wrappers::ReceiverStream;
 use tracing::{debug, error, info};
 
 use crate::inference::{
+    admission::{NoDevice, Saturated},
     gateway::{AuthContext, InferenceGateway},
     scheduler::{
-        ChatCompletionRequest, ChatCompletionResponse, CompletionRequest, DeviceInfo, ModelInfo,
-        StreamEvent,
+        ChatCompletionRequest, ChatCompletionResponse, CompletionRequest, DeviceInfo,
+        EmbeddingData, EmbeddingRequest, EmbeddingResponse, EmbeddingUsage, ModelInfo, StreamEvent,
     },
 };
 use crate::util::protoc::ClientId;
@@ -173,6 +174,24 @@ impl Drop for StreamCancelGuard {
     }
 }
 
+/// 429 with `Retry-After` when the scheduler shed the request because every
+/// device queue was full.
+fn saturated_response(e: &anyhow::Error) -> Option<Response> {
+    let saturated = e.downcast_ref::<Saturated>()?;
+    let retry_after = saturated.retry_after.as_secs().max(1);
+    let error_response = json!({
+        "error": {"message": saturated.to_string(), "type": "rate_limit_error", "code": 429}
+    });
+    Some(
+        (
+            StatusCode::TOO_MANY_REQUESTS,
+            [(header::RETRY_AFTER, retry_after.to_string())],
+            Json(error_response),
+        )
+            .into_response(),
+    )
+}
+
 // OpenAI Compatible API Handlers
 
 /// Handle text completion requests
@@ -367,6 +386,9 @@ pub async fn handle_completion(
             }
             Err(e) => {
                 error!("Completion request failed: {}", e);
+                if let Some(response) = saturated_response(&e) {
+                    return response;
+                }
                 let error_response = json!({
                     "error": {"message": e.to_string(), "type": "api_error", "code": 500}
                 });
@@ -417,6 +439,9 @@ pub async fn handle_completion(
         }
         Err(e) => {
             error!("Completion request failed: {}", e);
+            if let Some(response) = saturated_response(&e) {
+                return response;
+            }
             // Return appropriate HTTP status code with JSON error message
             let (status, error_message) = if e
                 .to_string()
@@ -662,6 +687,9 @@ pub async fn handle_chat_completion(
             }
             Err(e) => {
                 error!("Chat completion request failed: {}", e);
+                if let Some(response) = saturated_response(&e) {
+                    return response;
+                }
                 let error_response = json!({
                     "error": {"message": e.to_string(), "type": "api_error", "code": 500}
                 });
@@ -771,6 +799,161 @@ pub async fn handle_chat_completion(
         }
         Err(e) => {
             error!("Chat completion request failed: {}", e);
+            if let Some(response) = saturated_response(&e) {
+                return response;
+            }
+            let error_response = json!({
+                "error": {"message": e.to_string(), "type": "api_error", "code": 500}
+            });
+            (StatusCode::INTERNAL_SERVER_ERROR, Json(error_response)).into_response()
+        }
+    }
+}
+
+/// Handle embedding requests. Concurrent requests for the same model are
+/// coalesced by the scheduler into shared device batches.
+pub async fn handle_embeddings(
+    State(gateway): State<Arc<InferenceGateway>>,
+    Extension(auth): Extension<AuthContext>,
+    headers: HeaderMap,
+    Json(request): Json<EmbeddingRequest>,
+) -> Response {
+    let request_id = headers
+        .get("request-id")
+        .and_then(|v| v.to_str().ok())
+        .map(|s| s.to_string());
+
+    let target_client_id = match headers
+        .get("x-target-client-id")
+        .and_then(|v| v.to_str().ok())
+        .map(str::trim)
+        .filter(|s| !s.is_empty())
+    {
+        None => None,
+        Some(raw) => match crate::util::protoc::ClientId::from_str(raw) {
+            Ok(id) => Some(id),
+            Err(e) => {
+                let error_response = json!({
+                    "error": {
+                        "message": format!("Invalid x-target-client-id: {}", e),
+                        "type": "invalid_request_error",
+                        "code": 400
+                    }
+                });
+                return (StatusCode::BAD_REQUEST, Json(error_response)).into_response();
+            }
+        },
+    };
+
+    if let Some(target) = target_client_id {
+        if auth.access_level.is_metered() {
+            let error_response = json!({
+                "error": {
+                    "message": "x-target-client-id is not allowed for metered tokens",
+                    "type": "forbidden",
+                    "code": 403
+                }
+            });
+            return (StatusCode::FORBIDDEN, Json(error_response)).into_response();
+        }
+
+        if !auth.client_ids.contains(&target) {
+            let error_response = json!({
+                "error": {
+                    "message": "x-target-client-id is not in the allowed client_ids for this token",
+                    "type": "forbidden",
+                    "code": 403
+                }
+            });
+            return (StatusCode::FORBIDDEN, Json(error_response)).into_response();
+        }
+    }
+
+    if let Some(format) = request.encoding_format.as_deref() {
+        if format != "float" {
+            let error_response = json!({
+                "error": {
+                    "message": format!("Unsupported encoding_format '{}', only 'float' is supported", format),
+                    "type": "invalid_request_error",
+                    "code": 400
+                }
+            });
+            return (StatusCode::BAD_REQUEST, Json(error_response)).into_response();
+        }
+    }
+
+    let inputs = request.input.into_vec();
+    if inputs.is_empty() || inputs.iter().any(|s| s.is_empty()) {
+        let error_response = json!({
+            "error": {
+                "message": "input must be a non-empty string or array of non-empty strings",
+                "type": "invalid_request_error",
+                "code": 400
+            }
+        });
+        return (StatusCode::BAD_REQUEST, Json(error_response)).into_response();
+    }
+    debug!("Received embedding request: {} inputs", inputs.len());
+
+    let model_name = request.model.unwrap_or_else(|| "gpuf".to_string());
+    let allowed_ids = target_client_id
+        .as_ref()
+        .map(std::slice::from_ref)
+        .unwrap_or(auth.client_ids.as_slice());
+
+    match gateway
+        .scheduler
+        .execute_embeddings(
+            model_name.clone(),
+            inputs,
+            request.normalize.unwrap_or(true),
+            Some(allowed_ids),
+        )
+        .await
+    {
+        Ok((dim, embeddings, prompt_tokens)) => {
+            if auth.access_level.is_metered() {
+                if let Some(chosen_client_id) = auth.client_ids.first() {
+                    if let Err(e) = gateway
+                        .send_request_metrics(request_id, *chosen_client_id, auth.access_level)
+                        .await
+                    {
+                        error!("Failed to send request metrics: {}", e);
+                    }
+                }
+            }
+
+            let data = embeddings
+                .chunks_exact(dim.max(1) as usize)
+                .enumerate()
+                .map(|(index, row)| EmbeddingData {
+                    object: "embedding".to_string(),
+                    index,
+                    embedding: row.to_vec(),
+                })
+                .collect();
+            Json(EmbeddingResponse {
+                object: "list".to_string(),
+                data,
+                model: model_name,
+                usage: EmbeddingUsage {
+                    prompt_tokens,
+                    total_tokens: prompt_tokens,
+                },
+            })
+            .into_response()
+        }
+        Err(e) => {
+            error!("Embedding request failed: {}", e);
+            if let Some(response) = saturated_response(&e) {
+                return response;
+            }
+            if e.downcast_ref::<NoDevice>().is_some() {
+                let error_response = json!({
+                    "error": {"message": e.to_string(), "type": "api_error", "code": 503}
+                });
+                return (StatusCode::SERVICE_UNAVAILABLE, Json(error_response)).into_response();
+            }
             let error_response = json!({
                 "error": {"message": e.to_string(), "type": "api_error", "code": 500}
             });
@@ -808,6 +991,31 @@ pub async fn list_devices(
     Json(devices)
 }
 
+/// Counters of the attached XDP auth filter, summed over CPUs.
+#[cfg(all(feature = "xdp", target_os = "linux"))]
+pub async fn get_xdp_stats(State(gateway): State<Arc<InferenceGateway>>) -> Response {
+    let Some(filter) = gateway.xdp_filter.as_ref() else {
+        let error_response = json!({
+            "error": {"message": "No XDP filter is attached", "type": "not_found", "code": 404}
+        });
+        return (StatusCode::NOT_FOUND, Json(error_response)).into_response();
+    };
+    match filter.stats().await {
+        Ok(stats) => Json(json!({
+            "avg_scan_bytes": stats.avg_scan_bytes(),
+            "counters": stats,
+        }))
+        .into_response(),
+        Err(e) => {
+            error!("Failed to read XDP stats: {}", e);
+            let error_response = json!({
+                "error": {"message": e.to_string(), "type": "api_error", "code": 500}
+            });
+            (StatusCode::INTERNAL_SERVER_ERROR, Json(error_response)).into_response()
+        }
+    }
+}
+
 /// Get device status by ID
 pub async fn get_device_status(
     State(gateway): State<Arc<InferenceGateway>>,
@@ -1,3 +1,6 @@
+pub mod admission;
+pub mod device_index;
+pub mod embedding_batcher;
 pub mod gateway;
 pub mod handlers;
 pub mod scheduler;
@@ -2,12 +2,16 @@ use anyhow::{anyhow, Result};
 use serde::{Deserialize, Serialize};
 use std::collections::HashMap;
 use std::sync::Arc;
-use tokio::io::AsyncWriteExt;
 use tokio::sync::mpsc;
 use tokio::sync::{oneshot, Mutex};
 use tracing::{debug, error, info, warn};
 use uuid::Uuid;
 
+use super::admission::{Admission, AdmissionLimits, NoDevice, Saturated};
+use super::device_index::DeviceIndex;
+use super::embedding_batcher::{
+    BatchError, BatchKey, BatchLimits, EmbeddingBatch, EmbeddingBatcher,
+};
 use crate::handle::ActiveClients;
 use crate::util::protoc::ClientId;
 use common::{Command, CommandV1, OutputPhase};
@@ -96,6 +100,53 @@ pub struct CompletionUsage {
     pub final_tokens: Option<u32>,
 }
 
+#[derive(Debug, Deserialize)]
+pub struct EmbeddingRequest {
+    pub model: Option<String>,
+    pub input: EmbeddingInput,
+    /// Only "float" is supported.
+    pub encoding_format: Option<String>,
+    /// Scale vectors to unit length (default true).
+    pub normalize: Option<bool>,
+}
+
+#[derive(Debug, Deserialize)]
+#[serde(untagged)]
+pub enum EmbeddingInput {
+    One(String),
+    Many(Vec<String>),
+}
+
+impl EmbeddingInput {
+    pub fn into_vec(self) -> Vec<String> {
+        match self {
+            EmbeddingInput::One(text) => vec![text],
+            EmbeddingInput::Many(texts) => texts,
+        }
+    }
+}
+
+#[derive(Debug, Serialize)]
+pub struct EmbeddingResponse {
+    pub object: String,
+    pub data: Vec<EmbeddingData>,
+    pub model: String,
+    pub usage: EmbeddingUsage,
+}
+
+#[derive(Debug, Serialize)]
+pub struct EmbeddingData {
+    pub object: String,
+    pub index: usize,
+    pub embedding: Vec<f32>,
+}
+
+#[derive(Debug, Serialize)]
+pub struct EmbeddingUsage {
+    pub prompt_tokens: u32,
+    pub total_tokens: u32,
+}
+
 #[derive(Debug, Serialize)]
 pub struct ModelInfo {
     pub id: String,
@@ -106,6 +157,8 @@ pub struct ModelInfo {
 
 // Task result tracking
 type PendingTask = oneshot::Sender<Result<CompletionResponse>>;
+// (dim, embeddings, prompt_tokens) from the device
+type PendingEmbedding = oneshot::Sender<std::result::Result<(u32, Vec<f32>, u32), String>>;
 
 #[derive(Debug)]
 pub enum StreamEvent {
@@ -115,13 +168,28 @@ pub enum StreamEvent {
     Error(String),
 }
 
+/// How long a device may take for one task, `GPUF_INFERENCE_TIMEOUT_SECS`
+/// (300 s by default).
+fn inference_timeout() -> std::time::Duration {
+    let secs = std::env::var("GPUF_INFERENCE_TIMEOUT_SECS")
+        .ok()
+        .and_then(|s| s.parse::<u64>().ok())
+        .filter(|&v| v > 0)
+        .unwrap_or(300);
+    std::time::Duration::from_secs(secs)
+}
+
 // Inference Scheduler
 pub struct InferenceScheduler {
     pending_tasks: Arc<Mutex<HashMap<String, PendingTask>>>,
     partial_results: Arc<Mutex<HashMap<String, String>>>,
     pending_streams: Arc<Mutex<HashMap<String, mpsc::Sender<StreamEvent>>>>,
     stream_usages: Arc<Mutex<HashMap<String, CompletionUsage>>>,
+    pending_embeddings: Arc<Mutex<HashMap<String, PendingEmbedding>>>,
+    embedding_batcher: EmbeddingBatcher,
     active_clients: ActiveClients,
+    device_index: Arc<DeviceIndex>,
+    admission: Admission,
 }
 
 impl InferenceScheduler {
@@ -131,12 +199,48 @@ impl InferenceScheduler {
             partial_results: Arc::new(Mutex::new(HashMap::new())),
             pending_streams: Arc::new(Mutex::new(HashMap::new())),
             stream_usages: Arc::new(Mutex::new(HashMap::new())),
+            pending_embeddings: Arc::new(Mutex::new(HashMap::new())),
+            embedding_batcher: EmbeddingBatcher::new(BatchLimits::from_env()),
             active_clients,
+            device_index: Arc::new(DeviceIndex::new()),
+            admission: Admission::new(AdmissionLimits::from_env()),
         }
     }
 
+    /// Called by the connection handler whenever `info` changes; new slots
+    /// may admit queued tasks.
+    pub fn update_device(&self, client_id: &ClientId, info: &crate::handle::ClientInfo) {
+        self.device_index.update(client_id, info);
+        self.admission.pump(&self.device_index, client_id);
+    }
+
+    /// The device disconnected.
+    pub fn remove_device(&self, client_id: &ClientId) {
+        self.device_index.remove(client_id);
+        self.admission.drop_device(&self.device_index, client_id);
+    }
+
+    /// Free the slot of `task_id` and hand it to the next queued task.
+    fn finish_task(&self, task_id: &str) {
+        if let Some(client_id) = self.device_index.finish_task(task_id) {
+            self.admission.pump(&self.device_index, &client_id);
+        }
+    }
+
+    /// Snapshot to select from. A scheduler nobody feeds (one built straight
+    /// on a client map) fills its index from the map on first use.
+    async fn index_snapshot(&self) -> Arc<super::device_index::IndexSnapshot> {
+        let snapshot = self.device_index.snapshot();
+        if !snapshot.is_empty() {
+            return snapshot;
+        }
+        let clients = self.active_clients.lock().await;
+        self.device_index.rebuild(&clients);
+        self.device_index.snapshot()
+    }
+
     pub async fn execute_inference_stream(
-        &self,
+        self: &Arc<Self>,
         request: CompletionRequest,
         allowed_client_ids: Option<&[ClientId]>,
     ) -> Result<(String, ClientId, mpsc::Receiver<StreamEvent>)> {
@@ -148,7 +252,16 @@ impl InferenceScheduler {
             streams.insert(task_id.clone(), tx);
         }
 
-        let device_id = self.select_best_device(allowed_client_ids).await?;
+        let device_id = match self
+            .acquire_device(&task_id, None, allowed_client_ids)
+            .await
+        {
+            Ok(d) => d,
+            Err(e) => {
+                self.pending_streams.lock().await.remove(&task_id);
+                return Err(e);
+            }
+        };
         if let Err(e) = self
             .send_task_to_device(
                 &device_id,
@@ -164,68 +277,18 @@ impl InferenceScheduler {
             )
             .await
         {
+            self.finish_task(&task_id);
             let mut streams = self.pending_streams.lock().await;
             streams.remove(&task_id);
             return Err(e);
         }
+        self.spawn_stream_deadline(task_id.clone(), device_id);
 
         Ok((task_id, device_id, rx))
     }
 
-    async fn select_best_device_for_model(
-        &self,
-        model_name: &str,
-        allowed_client_ids: Option<&[ClientId]>,
-    ) -> Result<ClientId> {
-        let clients = self.active_clients.lock().await;
-
-        let mut best_device: Option<(ClientId, u16)> = None;
-
-        debug!("online Clients: {}", clients.len());
-        for (client_id, client_info) in clients.iter() {
-            if let Some(allowed) = allowed_client_ids {
-                if !allowed.iter().any(|id| id == client_id) {
-                    debug!("Client {} is not allowed", client_id.log_label());
-                    continue;
-                }
-            }
-            debug!(
-                "Client {} is authed {} model {}",
-                client_id.log_label(),
-                client_info.authed,
-                model_name
-            );
-            if !client_info.authed {
-                continue;
-            }
-            let Some(models) = &client_info.models else {
-                continue;
-            };
-            if !models.iter().any(|m| m.id == model_name) {
-                continue;
-            }
-
-            let Some(system_info) = &client_info.system_info else {
-                continue;
-            };
-            let total_load: u16 = (system_info.cpu_usage + system_info.memory_usage) as u16;
-
-            match best_device {
-                None => best_device = Some((*client_id, total_load)),
-                Some((_best_id, best_load)) if total_load < best_load => {
-                    best_device = Some((*client_id, total_load))
-                }
-                _ => {}
-            }
-        }
-
-        best_device
-            .map(|(id, _)| id)
-            .ok_or_else(|| anyhow!("No compatible client found for model '{model_name}'"))
-    }
-
     pub async fn execute_chat_inference_stream(
-        &self,
+        self: &Arc<Self>,
         model: String,
         messages: Vec<ChatMessage>,
         max_tokens: u32,
@@ -245,17 +308,25 @@ impl InferenceScheduler {
             streams.insert(task_id.clone(), tx);
         }
 
-        let device_id = match self
-            .select_best_device_for_model(&model, allowed_client_ids)
+        let selected = match self
+            .acquire_device(&task_id, Some(&model), allowed_client_ids)
             .await
         {
-            Ok(d) => d,
-            Err(e) => {
+            Err(e) if e.downcast_ref::<Saturated>().is_none() => {
                 warn!(
                     "No model-compatible device found for model '{}': {}. Falling back to generic device selection.",
                     model, e
                 );
-                self.select_best_device(allowed_client_ids).await?
+                self.acquire_device(&task_id, None, allowed_client_ids)
+                    .await
+            }
+            selected => selected,
+        };
+        let device_id = match selected {
+            Ok(d) => d,
+            Err(e) => {
+                self.pending_streams.lock().await.remove(&task_id);
+                return Err(e);
             }
         };
         debug!(
@@ -287,14 +358,47 @@ impl InferenceScheduler {
             )
             .await
         {
+            self.finish_task(&task_id);
             let mut streams = self.pending_streams.lock().await;
             streams.remove(&task_id);
             return Err(e);
         }
+        self.spawn_stream_deadline(task_id.clone(), device_id);
 
         Ok((task_id, device_id, rx))
     }
 
+    /// A streaming task holds its slot until the device sends the last
+    /// chunk. If that does not happen within the inference timeout, end the
+    /// stream with an error, free the slot and cancel the task on the device.
+    fn spawn_stream_deadline(self: &Arc<Self>, task_id: String, device_id: ClientId) {
+        let scheduler = self.clone();
+        tokio::spawn(async move {
+            let timeout = inference_timeout();
+            tokio::time::sleep(timeout).await;
+            let Some(sender) = scheduler.pending_streams.lock().await.remove(&task_id) else {
+                return;
+            };
+            scheduler.stream_usages.lock().await.remove(&task_id);
+            warn!(
+                "Streaming task {} on device {} timed out after {} seconds",
+                task_id,
+                device_id.log_label(),
+                timeout.as_secs()
+            );
+            let _ = sender
+                .send(StreamEvent::Error(format!(
+                    "Inference task timed out after {} seconds",
+                    timeout.as_secs()
+                )))
+                .await;
+            let _ = sender.send(StreamEvent::Done).await;
+            if let Err(e) = scheduler.cancel_inference(&task_id, &device_id).await {
+                debug!("Could not cancel timed out task {}: {}", task_id, e);
+            }
+        });
+    }
+
     pub async fn cancel_inference(&self, task_id: &str, device_id: &ClientId) -> Result<()> {
         debug!(
             "Cancelling inference for task {} on device {}",
@@ -305,8 +409,7 @@ impl InferenceScheduler {
             let mut streams = self.pending_streams.lock().await;
             streams.remove(task_id);
         }
-
-        use common::write_command;
+        self.finish_task(task_id);
 
         let mut clients = self.active_clients.lock().await;
         let client_info = clients
@@ -323,8 +426,7 @@ impl InferenceScheduler {
             task_id: task_id.to_string(),
         };
         let command = Command::V1(cancel);
-        write_command(&mut *writer, &command).await?;
-        writer.flush().await?;
+        writer.send(&command).await?;
         Ok(())
     }
 
@@ -342,22 +444,22 @@ impl InferenceScheduler {
         repeat_last_n: i32,
         min_keep: u32,
     ) -> Result<()> {
-        use common::write_command;
+        let writer = {
+            let clients = self.active_clients.lock().await;
+            let client_info = clients
+                .get(device_id)
+                .ok_or_else(|| anyhow!("Device not found or not connected"))?;
 
-        let mut clients = self.active_clients.lock().await;
-        let client_info = clients
-            .get_mut(device_id)
-            .ok_or_else(|| anyhow!("Device not found or not connected"))?;
-
-        if !client_info.authed {
-            error!("Device {} not authenticated", device_id.log_label());
-            return Err(anyhow!("Device not authenticated"));
-        }
+            if !client_info.authed {
+                error!("Device {} not authenticated", device_id.log_label());
+                return Err(anyhow!("Device not authenticated"));
+            }
+            client_info.writer.clone()
+        };
 
-        let mut writer = client_info
-            .writer
-            .try_lock()
-            .map_err(|_| anyhow!("Device is busy, please try again"))?;
+        // The writer is only held for one frame at a time; wait for it
+        // (without holding the client map) instead of failing the task.
+        let mut writer = writer.lock().await;
 
         let chat_task = CommandV1::ChatInferenceTask {
             task_id: task_id.clone(),
@@ -383,8 +485,7 @@ impl InferenceScheduler {
             },
             max_tokens
         );
-        write_command(&mut *writer, &command).await?;
-        writer.flush().await?;
+        writer.send(&command).await?;
         Ok(())
     }
 
@@ -406,6 +507,10 @@ impl InferenceScheduler {
             streams.get(&task_id).cloned()
         };
 
+        if done || error.is_some() {
+            self.finish_task(&task_id);
+        }
+
         if let Some(sender) = stream_sender {
             if let Some(err) = error {
                 let _ = sender.send(StreamEvent::Error(err)).await;
@@ -494,6 +599,7 @@ impl InferenceScheduler {
             "Handling inference result for task {} (success: {})",
             task_id, success
         );
+        self.finish_task(&task_id);
 
         let mut tasks = self.pending_tasks.lock().await;
         let pending_count_before = tasks.len();
@@ -553,64 +659,88 @@ impl InferenceScheduler {
         }
     }
 
-    /// Select best Android device for inference
-    async fn select_best_device(
+    /// Claim a task slot for `task_id` on a device serving `model` (any
+    /// device for `None`), waiting in a device queue while every candidate
+    /// is busy. Fails with `NoDevice` when no candidate is connected and with
+    /// `Saturated` when the queues are full or the wait exceeds the queue
+    /// timeout.
+    async fn acquire_device(
         &self,
+        task_id: &str,
+        model: Option<&str>,
         allowed_client_ids: Option<&[ClientId]>,
     ) -> Result<ClientId> {
-        let clients = self.active_clients.lock().await;
-
-        let mut best_device: Option<(ClientId, u16)> = None;
-        let mut device_count = 0;
-
-        let mut consider_device =
-            |client_id: &ClientId, client_info: &crate::handle::ClientInfo| {
-                // Only consider authenticated Android devices
-                if !client_info.authed {
-                    return;
-                }
-
-                // Check if device has system info (Android devices should have this)
-                let Some(system_info) = &client_info.system_info else {
-                    return;
-                };
-
-                // Simple load balancing: choose device with lowest CPU + Memory usage
-                let total_load: u16 = (system_info.cpu_usage + system_info.memory_usage) as u16;
-                device_count += 1;
-
-                if best_device.is_none() || total_load < best_device.as_ref().unwrap().1 {
-                    best_device = Some((*client_id, total_load));
-                }
-            };
-
-        match allowed_client_ids {
-            Some(allowed) => {
-                // Base set = allowed ids; lookup active client info from map (O(1) average)
-                for client_id in allowed {
-                    if let Some(client_info) = clients.get(client_id) {
-                        consider_device(client_id, client_info);
-                    }
-                }
+        let snapshot = self.index_snapshot().await;
+        if snapshot
+            .candidates(model, allowed_client_ids)
+            .next()
+            .is_none()
+        {
+            return Err(NoDevice {
+                model: model.map(str::to_string),
             }
-            None => {
-                // No restriction; base set = all active clients
-                for (client_id, client_info) in clients.iter() {
-                    consider_device(client_id, client_info);
-                }
+            .into());
+        }
+
+        // Workers that already have the model loaded score better than ones
+        // that would have to load it first, unthrottled better than throttled.
+        let reserved = self.device_index.reserve(
+            &snapshot,
+            task_id,
+            model,
+            allowed_client_ids,
+            &mut rand::thread_rng(),
+        );
+        if let Some(device_id) = reserved {
+            if let Some(device) = snapshot.get(&device_id) {
+                info!(
+                    "Selected device {} for task {} (model: {:?}, load: {}%, in flight: {}, throttled: {}, available devices: {})",
+                    device_id.log_label(),
+                    task_id,
+                    model,
+                    device.stats.load,
+                    device.in_flight(),
+                    device.stats.throttled,
+                    snapshot.len()
+                );
             }
+            return Ok(device_id);
         }
 
-        if let Some((client_id, _load)) = best_device {
-            info!(
-                "Selected device {} for inference (load: {}%, available devices: {})",
-                client_id.log_label(),
-                _load,
-                device_count
-            );
-            Ok(client_id)
-        } else {
-            Err(anyhow!("No available Android devices found"))
+        let (queued_on, mut dispatched) =
+            self.admission
+                .enqueue(&snapshot, task_id, model, allowed_client_ids)?;
+        debug!(
+            "All candidates busy, task {} queued on device {} ({} queued)",
+            task_id,
+            queued_on.log_label(),
+            self.admission.queued()
+        );
+        // A slot may have freed between the reservation and the enqueue.
+        self.admission.pump(&self.device_index, &queued_on);
+
+        let wait = self.admission.queue_timeout();
+        match tokio::time::timeout(wait, &mut dispatched).await {
+            Ok(Ok(device_id)) => Ok(device_id),
+            Ok(Err(_)) => Err(anyhow!(
+                "Device {} disconnected while task {} was queued",
+                queued_on.log_label(),
+                task_id
+            )),
+            Err(_) if !self.admission.cancel(task_id) => {
+                // Dispatched right as the wait ran out.
+                dispatched
+                    .try_recv()
+                    .map_err(|_| anyhow!("Task {} lost its queue slot", task_id))
+            }
+            Err(_) => {
+                warn!(
+                    "Task {} waited {}s for a device slot, refusing it",
+                    task_id,
+                    wait.as_secs()
+                );
+                Err(self.admission.saturated().into())
+            }
         }
     }
 
@@ -628,25 +758,24 @@ impl InferenceScheduler {
         repeat_last_n: i32,
         min_keep: u32,
     ) -> Result<()> {
-        use common::write_command;
-
         // Find active client connection
-        let mut clients = self.active_clients.lock().await;
-        let client_info = clients
-            .get_mut(device_id)
-            .ok_or_else(|| anyhow!("Device not found or not connected"))?;
+        let writer = {
+            let clients = self.active_clients.lock().await;
+            let client_info = clients
+                .get(device_id)
+                .ok_or_else(|| anyhow!("Device not found or not connected"))?;
 
-        // Check if client is authenticated and ready
-        if !client_info.authed {
-            error!("Device {} not authenticated", device_id.log_label());
-            return Err(anyhow!("Device not authenticated"));
-        }
+            // Check if client is authenticated and ready
+            if !client_info.authed {
+                error!("Device {} not authenticated", device_id.log_label());
+                return Err(anyhow!("Device not authenticated"));
+            }
+            client_info.writer.clone()
+        };
 
-        // Try to acquire writer lock (non-blocking to avoid deadlocks)
-        let mut writer = client_info
-            .writer
-            .try_lock()
-            .map_err(|_| anyhow!("Device is busy, please try again"))?;
+        // Wait for the writer without holding the client map, so a frame
+        // in flight to this device delays the task instead of failing it.
+        let mut writer = writer.lock().await;
 
         // Create and send inference task command
         let inference_task = CommandV1::InferenceTask {
@@ -672,8 +801,7 @@ impl InferenceScheduler {
             },
             max_tokens
         );
-        write_command(&mut *writer, &command).await?;
-        writer.flush().await?;
+        writer.send(&command).await?;
 
         info!(
             "Successfully sent inference task {} to device {}",
@@ -710,7 +838,16 @@ impl InferenceScheduler {
         }
 
         // Select best available device
-        let device_id = self.select_best_device(allowed_client_ids).await?;
+        let device_id = match self
+            .acquire_device(&task_id, None, allowed_client_ids)
+            .await
+        {
+            Ok(d) => d,
+            Err(e) => {
+                self.pending_tasks.lock().await.remove(&task_id);
+                return Err(e);
+            }
+        };
 
         // Send task to device
         info!(
@@ -734,6 +871,7 @@ impl InferenceScheduler {
             .await
         {
             // Clean up pending task on failure
+            self.finish_task(&task_id);
             let mut tasks = self.pending_tasks.lock().await;
             tasks.remove(&task_id);
             error!(
@@ -763,11 +901,7 @@ impl InferenceScheduler {
         }
 
         // Wait for result with timeout
-        let timeout_secs: u64 = std::env::var("GPUF_INFERENCE_TIMEOUT_SECS")
-            .ok()
-            .and_then(|s| s.parse::<u64>().ok())
-            .filter(|&v| v > 0)
-            .unwrap_or(300);
+        let timeout_secs = inference_timeout().as_secs();
 
         info!(
             "Waiting for result of task {} with {}s timeout...",
@@ -786,6 +920,7 @@ impl InferenceScheduler {
                 // Clean up pending task on timeout
                 let mut tasks = self.pending_tasks.lock().await;
                 tasks.remove(&task_id);
+                self.finish_task(&task_id);
                 warn!("Task {} timed out after {} seconds", task_id, timeout_secs);
                 Err(anyhow!(
                     "Inference task timed out after {} seconds",
@@ -795,6 +930,187 @@ impl InferenceScheduler {
         }
     }
 
+    /// Embed `inputs` with `model`. Concurrent requests for the same model
+    /// are coalesced into one device task (see `embedding_batcher`).
+    pub async fn execute_embeddings(
+        self: &Arc<Self>,
+        model: String,
+        inputs: Vec<String>,
+        normalize: bool,
+        allowed_client_ids: Option<&[ClientId]>,
+    ) -> Result<(u32, Vec<f32>, u32)> {
+        let key = BatchKey {
+            model,
+            normalize,
+            allowed: allowed_client_ids.map(<[ClientId]>::to_vec),
+        };
+        let joined = self.embedding_batcher.join(key.clone(), inputs);
+
+        // Dispatch from spawned tasks so a client that hangs up does not
+        // strand the requests that joined its batch.
+        for batch in joined.ready {
+            tokio::spawn(self.clone().dispatch_embedding_batch(batch));
+        }
+        if let Some(generation) = joined.flush_after {
+            let scheduler = self.clone();
+            tokio::spawn(async move {
+                tokio::time::sleep(scheduler.embedding_batcher.window()).await;
+                if let Some(batch) = scheduler.embedding_batcher.take(&key, generation) {
+                    scheduler.dispatch_embedding_batch(batch).await;
+                }
+            });
+        }
+
+        match joined.rx.await {
+            Ok(Ok(slice)) => Ok((slice.dim, slice.embeddings, slice.prompt_tokens)),
+            Ok(Err(e)) => Err(e.into()),
+            Err(_) => Err(anyhow!("Embedding batch was dropped")),
+        }
+    }
+
+    async fn dispatch_embedding_batch(self: Arc<Self>, mut batch: EmbeddingBatch) {
+        let task_id = Uuid::new_v4().to_string();
+        let model = batch.key.model.clone();
+        let allowed = batch.key.allowed.clone();
+
+        // No fallback to other devices: a worker without the model cannot
+        // embed with it.
+        let device_id = match self
+            .acquire_device(&task_id, Some(&model), allowed.as_deref())
+            .await
+        {
+            Ok(d) => d,
+            Err(e) => {
+                batch.fail((&e).into());
+                return;
+            }
+        };
+
+        let (sender, receiver) = oneshot::channel();
+        self.pending_embeddings
+            .lock()
+            .await
+            .insert(task_id.clone(), sender);
+        let inputs = batch.take_inputs();
+        info!(
+            "Dispatching embedding task {} to device {} ({} inputs from {} requests)",
+            task_id,
+            device_id.log_label(),
+            inputs.len(),
+            batch.requests()
+        );
+        if let Err(e) = self
+            .send_embedding_task_to_device(
+                &device_id,
+                task_id.clone(),
+                model,
+                inputs,
+                batch.key.normalize,
+            )
+            .await
+        {
+            self.finish_task(&task_id);
+            self.pending_embeddings.lock().await.remove(&task_id);
+            error!(
+                "Failed to send embedding task to device {}: {}",
+                device_id.log_label(),
+                e
+            );
+            batch.fail((&e).into());
+            return;
+        }
+
+        let timeout_secs = inference_timeout().as_secs();
+        match tokio::time::timeout(std::time::Duration::from_secs(timeout_secs), receiver).await {
+            Ok(Ok(Ok((dim, embeddings, prompt_tokens)))) => {
+                batch.complete(dim, embeddings, prompt_tokens)
+            }
+            Ok(Ok(Err(e))) => batch.fail(BatchError::Failed(e)),
+            Ok(Err(_)) => batch.fail(BatchError::Failed(
+                "Task response channel closed".to_string(),
+            )),
+            Err(_) => {
+                self.pending_embeddings.lock().await.remove(&task_id);
+                self.finish_task(&task_id);
+                warn!(
+                    "Embedding task {} timed out after {} seconds",
+                    task_id, timeout_secs
+                );
+                batch.fail(BatchError::Failed(format!(
+                    "Embedding task timed out after {} seconds",
+                    timeout_secs
+                )));
+            }
+        }
+    }
+
+    async fn send_embedding_task_to_device(
+        &self,
+        device_id: &ClientId,
+        task_id: String,
+        model: String,
+        inputs: Vec<String>,
+        normalize: bool,
+    ) -> Result<()> {
+        let writer = {
+            let clients = self.active_clients.lock().await;
+            let client_info = clients
+                .get(device_id)
+                .ok_or_else(|| anyhow!("Device not found or not connected"))?;
+            if !client_info.authed {
+                error!("Device {} not authenticated", device_id.log_label());
+                return Err(anyhow!("Device not authenticated"));
+            }
+            if client_info.version < common::PROTOCOL_VERSION {
+                return Err(anyhow!(
+                    "Device {} runs protocol version {} without embedding tasks",
+                    device_id.log_label(),
+                    client_info.version
+                ));
+            }
+            client_info.writer.clone()
+        };
+
+        // Embedding batches arrive back to back; wait for the writer rather
+        // than refusing the whole batch as busy.
+        let mut writer = writer.lock().await;
+        let command = Command::V1(CommandV1::EmbeddingTask {
+            task_id,
+            model,
+            inputs,
+            normalize,
+        });
+        writer.send(&command).await?;
+        Ok(())
+    }
+
+    /// Handle an embedding result from a device
+    pub async fn handle_embedding_result(
+        &self,
+        task_id: String,
+        dim: u32,
+        embeddings: Vec<f32>,
+        prompt_tokens: u32,
+        error: Option<String>,
+    ) {
+        self.finish_task(&task_id);
+        let sender = self.pending_embeddings.lock().await.remove(&task_id);
+        let Some(sender) = sender else {
+            debug!(
+                "Dropping embedding result for task {} because it is no longer pending",
+                task_id
+            );
+            return;
+        };
+        let result = match error {
+            Some(e) => Err(e),
+            None => Ok((dim, embeddings, prompt_tokens)),
+        };
+        if sender.send(result).is_err() {
+            warn!("Failed to send embedding result for task {}", task_id);
+        }
+    }
+
     /// Get list of available devices
     pub async fn get_available_devices(
         &self,
@@ -6,3 +6,5 @@ pub mod handle;
 pub mod inference;
 pub mod points_sync;
 pub mod util;
+#[cfg(all(feature = "xdp", target_os = "linux"))]
+pub mod xdp;
@@ -59,11 +59,30 @@ async fn main() -> Result<()> {
 
     // Start inference gateway.
     let inference_gateway_port = args.inference_gateway_port;
-    let inference_gateway = Arc::new(inference::InferenceGateway::new(
+    let inference_gateway = inference::InferenceGateway::new(
         server_state.inference_scheduler.clone(),
         server_state.db_pool.clone(),
         server_state.producer.clone(),
-    ));
+    );
+    #[cfg(all(feature = "xdp", target_os = "linux"))]
+    let inference_gateway = match &args.xdp_interface {
+        Some(interface) => {
+            let filter =
+                Arc::new(xdp::xdp_filter::XdpFilter::new(interface, &args.xdp_object).await?);
+            let keys = filter.sync_api_keys_from_db(&server_state.db_pool).await?;
+            filter.spawn_key_sync(
+                server_state.db_pool.clone(),
+                std::time::Duration::from_secs(args.xdp_sync_interval_secs.max(1)),
+            );
+            info!(
+                "XDP auth filter attached to {} with {} API keys",
+                interface, keys
+            );
+            inference_gateway.with_xdp_filter(filter)
+        }
+        None => inference_gateway,
+    };
+    let inference_gateway = Arc::new(inference_gateway);
     let inference_gateway_task = tokio::spawn(async move {
         info!(
             "Starting Inference Gateway on port {}...",
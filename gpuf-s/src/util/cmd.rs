@@ -51,6 +51,18 @@ pub struct Args {
 
     #[arg(long, default_value = "localhost:9092")]
     pub bootstrap_server: String,
+
+    /// Attach the XDP auth filter to this interface (needs CAP_NET_ADMIN).
+    #[arg(long)]
+    pub xdp_interface: Option<String>,
+
+    /// Compiled XDP auth filter object, see src/xdp/Makefile.
+    #[arg(long, default_value = "xdp_auth_filter.o")]
+    pub xdp_object: String,
+
+    /// Seconds between re-syncs of the XDP filter's API keys from the database.
+    #[arg(long, default_value_t = 60)]
+    pub xdp_sync_interval_secs: u64,
 }
 
 #[cfg(test)]
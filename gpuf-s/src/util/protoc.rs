@@ -4,7 +4,7 @@ use std::error::Error;
 use std::fmt::Display;
 use std::str::FromStr;
 
-use common::{DevicesInfo, SystemInfo};
+use common::{DevicesInfo, InferenceStats, SystemInfo};
 use serde::{de, ser::SerializeTuple, Deserialize, Deserializer, Serialize, Serializer};
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq, Hash, Default, bincode::Encode, bincode::Decode)]
@@ -168,6 +168,7 @@ pub struct HeartbeatMessage {
     pub device_count: u32,
     pub total_tflops: u32,
     pub devices_info: Vec<DevicesInfo>,
+    pub inference_stats: Option<InferenceStats>,
 }
 
 #[allow(dead_code)]
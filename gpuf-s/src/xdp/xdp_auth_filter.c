@@ -1,20 +1,267 @@
 #include <linux/bpf.h>
 #include <linux/if_ether.h>
 #include <linux/ip.h>
+#include <linux/ipv6.h>
 #include <linux/tcp.h>
 #include <bpf/bpf_helpers.h>
 
+#include "xdp_ipv6.h"
+#include "xdp_stats.h"
+
 #define IPPROTO_TCP 6
 
 #define MAX_SCAN_LEN 256
-#define TOKEN_LEN 16
+/* tokens.key is varchar(48); a longer token cannot be a valid key and is denied */
+#define MAX_TOKEN_LEN 48
+#define API_KEY_ENTRIES 65536
+#define FLOW_CACHE_ENTRIES 65536
+#define SRC_BUCKET_ENTRIES 65536
 
-struct {
+#define FLOW_VERDICT_ALLOW 1
+#define FLOW_VERDICT_DENY 2
+
+#define FAMILY_IPV4 0
+#define FAMILY_IPV6 1
+
+#define NSEC_PER_SEC 1000000000ULL
+/* idle longer than this refills the bucket completely (also avoids overflow) */
+#define BUCKET_FULL_REFILL_NS (10 * NSEC_PER_SEC)
+
+/* token_digest() results */
+#define TOKEN_SPLIT 0
+#define TOKEN_DONE 1
+#define TOKEN_TOO_LONG 2
+
+/*
+ * Double-buffered key set keyed by token digest. api_keys_active[0] holds the
+ * key-set generation and its low bit selects the live buffer; user space
+ * refills the other one and bumps the generation, so a full rotation is
+ * atomic. max_entries is overridden at load time.
+ */
+struct api_key_buffer {
     __uint(type, BPF_MAP_TYPE_HASH);
-    __uint(max_entries, 128);
-    __type(key, __u8[TOKEN_LEN]);
+    __uint(max_entries, API_KEY_ENTRIES);
+    __type(key, __u64);
     __type(value, __u8);
-} api_keys SEC(".maps");
+};
+
+struct api_key_buffer api_keys_a SEC(".maps");
+struct api_key_buffer api_keys_b SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u32);
+} api_keys_active SEC(".maps");
+
+/*
+ * SipHash-2-4 key for token digests, written by XdpFilter at load time from a
+ * random source so digests cannot be precomputed or collided offline. Must
+ * match token_digest() in xdp_filter.rs.
+ */
+struct siphash_key {
+    __u64 k0;
+    __u64 k1;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct siphash_key);
+} token_hash_key SEC(".maps");
+
+/* connection key; protocol is always TCP so it is not stored. IPv4 uses addr[0] */
+struct flow_key {
+    __u32 family;
+    __u32 saddr[4];
+    __u32 daddr[4];
+    __u16 sport;
+    __u16 dport;
+};
+
+/*
+ * Verdict per connection, taken on its first segment with an Authorization
+ * header; later segments are passed or dropped with one lookup. Verdicts from
+ * an older key-set generation are ignored, so adding or revoking a key sends
+ * open connections back through the scan. The gateway still checks the key
+ * of every request, so a keep-alive connection cannot swap in a bad key past
+ * it. LRU so abandoned connections (no FIN/RST seen) age out on their own.
+ */
+struct flow_state {
+    __u32 generation;
+    __u32 state;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, FLOW_CACHE_ENTRIES);
+    __type(key, struct flow_key);
+    __type(value, struct flow_state);
+} flow_verdicts SEC(".maps");
+
+/* rate-limit key: IPv4 /32 in prefix[0], IPv6 /64 in prefix[0..1] */
+struct src_prefix {
+    __u32 family;
+    __u32 prefix[2];
+};
+
+struct token_bucket {
+    __u64 tokens;
+    __u64 last_ns;
+};
+
+/* index FAMILY_IPV4 / FAMILY_IPV6; rate_pps == 0 disables limiting */
+struct rate_limit_cfg {
+    __u64 rate_pps;
+    __u64 burst;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, SRC_BUCKET_ENTRIES);
+    __type(key, struct src_prefix);
+    __type(value, struct token_bucket);
+} src_buckets SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 2);
+    __type(key, __u32);
+    __type(value, struct rate_limit_cfg);
+} rate_limit_config SEC(".maps");
+
+static __always_inline __u32 key_generation(void) {
+    __u32 zero = 0;
+    __u32 *generation = bpf_map_lookup_elem(&api_keys_active, &zero);
+    return generation ? *generation : 0;
+}
+
+static __always_inline int api_key_known(__u32 generation, __u64 *digest) {
+    if (generation & 1)
+        return bpf_map_lookup_elem(&api_keys_b, digest) != NULL;
+    return bpf_map_lookup_elem(&api_keys_a, digest) != NULL;
+}
+
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND(v0, v1, v2, v3)                                                   \
+    do {                                                                           \
+        v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32);              \
+        v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2;                                   \
+        v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0;                                   \
+        v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32);              \
+    } while (0)
+
+/*
+ * SipHash-2-4 of the token following "Authorization:", skipping spaces and
+ * the "Bearer " scheme. The whole token is hashed. Returns TOKEN_SPLIT if the
+ * token runs into the end of the segment (cannot be decided from this packet),
+ * TOKEN_TOO_LONG if it exceeds MAX_TOKEN_LEN, TOKEN_DONE otherwise.
+ */
+static __always_inline int token_digest(unsigned char *p, void *data_end, __u64 *digest) {
+    __u32 zero = 0;
+    struct siphash_key *k = bpf_map_lookup_elem(&token_hash_key, &zero);
+    if (!k)
+        return TOKEN_SPLIT;
+
+    #pragma unroll
+    for (int i = 0; i < 4; i++) {
+        if (p + 1 > (unsigned char *)data_end || *p != ' ')
+            break;
+        p++;
+    }
+    if (p + 7 <= (unsigned char *)data_end && __builtin_memcmp(p, "Bearer ", 7) == 0)
+        p += 7;
+
+    __u64 v0 = k->k0 ^ 0x736f6d6570736575ULL;
+    __u64 v1 = k->k1 ^ 0x646f72616e646f6dULL;
+    __u64 v2 = k->k0 ^ 0x6c7967656e657261ULL;
+    __u64 v3 = k->k1 ^ 0x7465646279746573ULL;
+    __u64 m = 0;
+    __u64 len = 0;
+
+    /* one extra iteration to see the terminator of a MAX_TOKEN_LEN token */
+    for (int i = 0; i <= MAX_TOKEN_LEN; i++) {
+        if (p + i + 1 > (unsigned char *)data_end)
+            return TOKEN_SPLIT;
+        unsigned char c = p[i];
+        if (c == '\r' || c == '\n' || c == ' ')
+            break;
+        if (i == MAX_TOKEN_LEN)
+            return TOKEN_TOO_LONG;
+        m |= (__u64)c << (8 * (i & 7));
+        len++;
+        if ((i & 7) == 7) {
+            v3 ^= m;
+            SIPROUND(v0, v1, v2, v3);
+            SIPROUND(v0, v1, v2, v3);
+            v0 ^= m;
+            m = 0;
+        }
+    }
+
+    __u64 b = (len << 56) | m;
+    v3 ^= b;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= b;
+    v2 ^= 0xff;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    *digest = v0 ^ v1 ^ v2 ^ v3;
+    return TOKEN_DONE;
+}
+
+static __always_inline int record_verdict(struct flow_key *key, __u32 generation, __u32 verdict) {
+    struct flow_state value = { .generation = generation, .state = verdict };
+    bpf_map_update_elem(&flow_verdicts, key, &value, BPF_ANY);
+    return verdict == FLOW_VERDICT_DENY ? XDP_DROP : XDP_PASS;
+}
+
+/*
+ * Token bucket per source prefix. Updates race between CPUs; an occasional
+ * lost decrement is acceptable for flood protection.
+ */
+static __always_inline int over_rate_limit(struct src_prefix *src) {
+    __u32 family = src->family;
+    struct rate_limit_cfg *cfg = bpf_map_lookup_elem(&rate_limit_config, &family);
+    if (!cfg || cfg->rate_pps == 0)
+        return 0;
+
+    __u64 now = bpf_ktime_get_ns();
+    struct token_bucket *bucket = bpf_map_lookup_elem(&src_buckets, src);
+    if (!bucket) {
+        struct token_bucket fresh = {
+            .tokens = cfg->burst > 0 ? cfg->burst - 1 : 0,
+            .last_ns = now,
+        };
+        bpf_map_update_elem(&src_buckets, src, &fresh, BPF_ANY);
+        return 0;
+    }
+
+    __u64 elapsed = now - bucket->last_ns;
+    if (elapsed >= BUCKET_FULL_REFILL_NS) {
+        bucket->tokens = cfg->burst;
+        bucket->last_ns = now;
+    } else {
+        __u64 refill = elapsed * cfg->rate_pps / NSEC_PER_SEC;
+        if (refill > 0) {
+            bucket->tokens += refill;
+            if (bucket->tokens > cfg->burst)
+                bucket->tokens = cfg->burst;
+            bucket->last_ns = now;
+        }
+    }
+
+    if (bucket->tokens == 0)
+        return 1;
+    bucket->tokens--;
+    return 0;
+}
 
 SEC("xdp")
 int xdp_auth_filter(struct xdp_md *ctx) {
@@ -24,33 +271,89 @@ int xdp_auth_filter(struct xdp_md *ctx) {
     /* Ethernet header */
     struct ethhdr *eth = data;
     if ((void *)(eth + 1) > data_end)
-        return XDP_PASS;
+        return stat_pass(STAT_PASS_MALFORMED);
+
+    struct flow_key key = {};
+    struct src_prefix src = {};
+    struct tcphdr *tcph;
 
     __u16 h_proto = eth->h_proto;
-    if (h_proto != __constant_htons(ETH_P_IP))
-        return XDP_PASS;
+    if (h_proto == __constant_htons(ETH_P_IP)) {
+        /* IP header: make sure ihl valid and within packet */
+        struct iphdr *iph = data + sizeof(*eth);
+        if ((void *)(iph + 1) > data_end)
+            return stat_pass(STAT_PASS_MALFORMED);
+        if (iph->protocol != IPPROTO_TCP)
+            return stat_pass(STAT_PASS_NON_TCP);
+        if (iph->ihl < 5)
+            return stat_pass(STAT_PASS_MALFORMED);
+        if ((void *)iph + iph->ihl * 4 > data_end)
+            return stat_pass(STAT_PASS_MALFORMED);
 
-    /* IP header: make sure ihl valid and within packet */
-    struct iphdr *iph = data + sizeof(*eth);
-    if ((void *)(iph + 1) > data_end)
-        return XDP_PASS;
-    if (iph->protocol != IPPROTO_TCP)
-        return XDP_PASS;
-    if (iph->ihl < 5)
-        return XDP_PASS;
-    if ((void *)iph + iph->ihl * 4 > data_end)
-        return XDP_PASS;
+        key.family = FAMILY_IPV4;
+        key.saddr[0] = iph->saddr;
+        key.daddr[0] = iph->daddr;
+        src.family = FAMILY_IPV4;
+        src.prefix[0] = iph->saddr;
+        tcph = (void *)iph + iph->ihl * 4;
+    } else if (h_proto == __constant_htons(ETH_P_IPV6)) {
+        struct ipv6hdr *ip6h = data + sizeof(*eth);
+        if ((void *)(ip6h + 1) > data_end)
+            return stat_pass(STAT_PASS_MALFORMED);
+
+        __u8 nexthdr = ip6h->nexthdr;
+        void *l4 = skip_ipv6_ext_hdrs(ip6h + 1, data_end, &nexthdr);
+        if (!l4)
+            return stat_pass(STAT_PASS_MALFORMED);
+        if (nexthdr != IPPROTO_TCP)
+            return stat_pass(STAT_PASS_NON_TCP);
+
+        key.family = FAMILY_IPV6;
+        __builtin_memcpy(key.saddr, &ip6h->saddr, sizeof(key.saddr));
+        __builtin_memcpy(key.daddr, &ip6h->daddr, sizeof(key.daddr));
+        src.family = FAMILY_IPV6;
+        __builtin_memcpy(src.prefix, &ip6h->saddr, sizeof(src.prefix));
+        tcph = l4;
+    } else {
+        return stat_pass(STAT_PASS_NON_IP);
+    }
 
     /* TCP header: check doff and bounds */
-    struct tcphdr *tcph = (void *)iph + iph->ihl * 4;
     if ((void *)(tcph + 1) > data_end)
-        return XDP_PASS;
+        return stat_pass(STAT_PASS_MALFORMED);
     if (tcph->doff < 5)
-        return XDP_PASS;
+        return stat_pass(STAT_PASS_MALFORMED);
     if ((void *)tcph + tcph->doff * 4 > data_end)
+        return stat_pass(STAT_PASS_MALFORMED);
+
+    key.sport = tcph->source;
+    key.dport = tcph->dest;
+
+    /* connection teardown: forget the verdict and let the stack close it */
+    if (tcph->fin || tcph->rst) {
+        bpf_map_delete_elem(&flow_verdicts, &key);
         return XDP_PASS;
+    }
 
-    /* payload pointer */
+    /* decided on an earlier segment of this connection, under the live key set */
+    __u32 generation = key_generation();
+    struct flow_state *state = bpf_map_lookup_elem(&flow_verdicts, &key);
+    if (state && state->generation == generation) {
+        stat_add(STAT_VERDICT_CACHED, 1);
+        return state->state == FLOW_VERDICT_DENY ? XDP_DROP : XDP_PASS;
+    }
+
+    /*
+     * Handshakes and segments of connections that have not presented a
+     * valid key spend tokens from the source prefix bucket, so a flood never
+     * reaches the accept loop.
+     */
+    if (over_rate_limit(&src)) {
+        stat_add(STAT_RATE_LIMITED, 1);
+        return XDP_DROP;
+    }
+
+    /* payload pointer; handshake segments carry none and are not recorded */
     unsigned char *payload = (unsigned char *)tcph + tcph->doff * 4;
     if (payload >= (unsigned char *)data_end)
         return XDP_PASS;
@@ -61,35 +364,48 @@ int xdp_auth_filter(struct xdp_md *ctx) {
     if (limit > MAX_SCAN_LEN)
         limit = MAX_SCAN_LEN;
 
+    stat_add(STAT_PACKETS_SCANNED, 1);
+    stat_add(STAT_BYTES_SCANNED, limit);
+
     /* prefix we search for */
     const char prefix[] = "Authorization:"; /* length 14 */
     const int prefix_len = 14;
 
     /* scan loop: *always* check pointer arithmetic before any read */
+    int header_at = -1;
     #pragma unroll
     for (int i = 0; i < MAX_SCAN_LEN; i++) {
         /* ensure we don't run past our computed limit */
-        if ((__u64)i + prefix_len + TOKEN_LEN > limit)
+        if ((__u64)i + prefix_len > limit)
             break;
 
         /* explicit pointer check so verifier can see it */
-        if (payload + i + prefix_len + TOKEN_LEN > (unsigned char *)data_end)
+        if (payload + i + prefix_len > (unsigned char *)data_end)
             break;
 
-        /* now it's safe to compare prefix */
         if (__builtin_memcmp(payload + i, prefix, prefix_len) == 0) {
-            /* safe to copy token (we already checked bounds) */
-            __u8 token[TOKEN_LEN];
-            __builtin_memcpy(token, payload + i + prefix_len, TOKEN_LEN);
-
-            __u8 *val = bpf_map_lookup_elem(&api_keys, token);
-            if (val)
-                return XDP_PASS;
-            else
-                return XDP_DROP;
+            header_at = i;
+            break;
+        }
+    }
+
+    if (header_at >= 0) {
+        __u64 digest;
+        unsigned char *token = payload + (header_at & (MAX_SCAN_LEN - 1)) + prefix_len;
+        int digested = token_digest(token, data_end, &digest);
+        /* token split across segments: undecided, look again on the next one */
+        if (digested == TOKEN_SPLIT)
+            return XDP_PASS;
+
+        if (digested == TOKEN_DONE && api_key_known(generation, &digest)) {
+            stat_add(STAT_TOKEN_HIT, 1);
+            return record_verdict(&key, generation, FLOW_VERDICT_ALLOW);
         }
+        stat_add(STAT_TOKEN_MISS, 1);
+        return record_verdict(&key, generation, FLOW_VERDICT_DENY);
     }
 
+    /* no header yet (undecided connection): pass, look again on the next one */
     return XDP_PASS;
 }
 
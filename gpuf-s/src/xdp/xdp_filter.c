@@ -4,6 +4,8 @@
 #include <linux/tcp.h>
 #include <bpf/bpf_helpers.h>
 
+#include "xdp_stats.h"
+
 #define IPPROTO_TCP 6
 
 #define MAX_SCAN_LEN 256
@@ -30,34 +32,34 @@ int xdp_auth_filter(struct xdp_md *ctx) {
 
     struct ethhdr *eth = data;
     if ((void*)(eth + 1) > data_end)
-        return XDP_PASS;
+        return stat_pass(STAT_PASS_MALFORMED);
     
     __u16 h_proto = eth->h_proto;
     if (h_proto != __constant_htons(ETH_P_IP))
-        return XDP_PASS;
+        return stat_pass(STAT_PASS_NON_IP);
 
     struct iphdr *iph = data + sizeof(*eth);
     if ((void*)(iph + 1) > data_end)
-        return XDP_PASS;
+        return stat_pass(STAT_PASS_MALFORMED);
 
     if (iph->protocol != IPPROTO_TCP)
-        return XDP_PASS;
+        return stat_pass(STAT_PASS_NON_TCP);
     
     if (iph->ihl < 5)
-    return XDP_PASS;
+        return stat_pass(STAT_PASS_MALFORMED);
 
     if ((void*)iph + iph->ihl * 4 > data_end)
-        return XDP_PASS;
+        return stat_pass(STAT_PASS_MALFORMED);
 
 
     struct tcphdr *tcph = (void*)iph + iph->ihl*4;
     if ((void*)(tcph + 1) > data_end)
-        return XDP_PASS;
+        return stat_pass(STAT_PASS_MALFORMED);
     
     if (tcph->doff < 5)
-        return XDP_PASS;
+        return stat_pass(STAT_PASS_MALFORMED);
     if ((void*)tcph + tcph->doff * 4 > data_end)
-        return XDP_PASS;
+        return stat_pass(STAT_PASS_MALFORMED);
 
     char *payload = (void*)tcph + tcph->doff*4;
     if (payload >= (char*)data_end)
@@ -67,6 +69,9 @@ int xdp_auth_filter(struct xdp_md *ctx) {
     if (payload + scan_len > (char*)data_end)
         scan_len = (char*)data_end - payload;
 
+    stat_add(STAT_PACKETS_SCANNED, 1);
+    stat_add(STAT_BYTES_SCANNED, scan_len);
+
     #pragma unroll
     for (int i = 0; i < MAX_SCAN_LEN; i++) {
         if (i + 14 + TOKEN_LEN > scan_len)
@@ -79,10 +84,12 @@ int xdp_auth_filter(struct xdp_md *ctx) {
             // } 
             __builtin_memcpy(token, payload + i + 14, TOKEN_LEN);
             __u8 *val = bpf_map_lookup_elem(&api_keys, token);
-            if (val)
+            if (val) {
+                stat_add(STAT_TOKEN_HIT, 1);
                 return XDP_PASS;
-            else
-                return XDP_DROP;
+            }
+            stat_add(STAT_TOKEN_MISS, 1);
+            return XDP_DROP;
         }
     }
 
@@ -1,20 +1,275 @@
+use crate::db::client::get_active_api_keys;
 use anyhow::{Context, Result};
-use aya::{maps::HashMap, Ebpf, EbpfLoader};
+use aya::{
+    maps::{Array, HashMap, Map, PerCpuArray},
+    Ebpf, EbpfLoader, Pod,
+};
+use serde::Serialize;
+use sqlx::{Pool, Postgres};
+use std::io;
+use std::os::fd::{AsFd, AsRawFd, RawFd};
 use std::sync::Arc;
+use std::time::Duration;
 use tokio::sync::Mutex;
 
-#[allow(dead_code)] // Experimental XDP implementation for high-performance packet filtering
+/// Slots of the `xdp_stats` per-CPU array, in the order of `enum xdp_stat` in xdp_stats.h.
+const XDP_STAT_SLOTS: usize = 9;
+
+/// Address family slot of the `rate_limit_config` map (FAMILY_IPV4 / FAMILY_IPV6).
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum IpFamily {
+    V4 = 0,
+    V6 = 1,
+}
+
+/// Mirrors `struct rate_limit_cfg`; `rate_pps == 0` disables limiting for the family.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub struct RateLimitConfig {
+    pub rate_pps: u64,
+    pub burst: u64,
+}
+
+// SAFETY: repr(C) plain integers with no padding, same layout as the eBPF struct.
+unsafe impl Pod for RateLimitConfig {}
+
+/// Counters summed over all CPUs.
+#[derive(Debug, Default, Clone, PartialEq, Serialize)]
+pub struct XdpStats {
+    pub packets_scanned: u64,
+    pub bytes_scanned: u64,
+    pub token_hits: u64,
+    pub token_misses: u64,
+    pub pass_non_ip: u64,
+    pub pass_non_tcp: u64,
+    pub pass_malformed: u64,
+    pub verdict_cached: u64,
+    pub rate_limited: u64,
+}
+
+impl XdpStats {
+    fn from_slots(slots: &[u64; XDP_STAT_SLOTS]) -> Self {
+        Self {
+            packets_scanned: slots[0],
+            bytes_scanned: slots[1],
+            token_hits: slots[2],
+            token_misses: slots[3],
+            pass_non_ip: slots[4],
+            pass_non_tcp: slots[5],
+            pass_malformed: slots[6],
+            verdict_cached: slots[7],
+            rate_limited: slots[8],
+        }
+    }
+
+    /// Average payload bytes scanned per scanned packet, used to size MAX_SCAN_LEN.
+    pub fn avg_scan_bytes(&self) -> u64 {
+        if self.packets_scanned == 0 {
+            0
+        } else {
+            self.bytes_scanned / self.packets_scanned
+        }
+    }
+}
+
+/// Default `max_entries` of each key buffer, see `XdpFilter::with_key_capacity`.
+pub const DEFAULT_API_KEY_CAPACITY: u32 = 65536;
+/// Longest token the filter accepts; matches MAX_TOKEN_LEN in xdp_auth_filter.c.
+const MAX_TOKEN_LEN: usize = 48;
+
+/// Mirrors `struct siphash_key`, the per-load key of the token digest.
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct TokenHashKey {
+    pub k0: u64,
+    pub k1: u64,
+}
+
+// SAFETY: repr(C) plain integers with no padding, same layout as the eBPF struct.
+unsafe impl Pod for TokenHashKey {}
+
+impl TokenHashKey {
+    fn random() -> Self {
+        Self {
+            k0: rand::random(),
+            k1: rand::random(),
+        }
+    }
+}
+
+const API_KEY_BUFFERS: [&str; 2] = ["api_keys_a", "api_keys_b"];
+const BPF_MAP_UPDATE_BATCH: libc::c_long = 26;
+const BPF_MAP_DELETE_BATCH: libc::c_long = 27;
+
+fn sip_round(v: &mut [u64; 4]) {
+    v[0] = v[0].wrapping_add(v[1]);
+    v[1] = v[1].rotate_left(13) ^ v[0];
+    v[0] = v[0].rotate_left(32);
+    v[2] = v[2].wrapping_add(v[3]);
+    v[3] = v[3].rotate_left(16) ^ v[2];
+    v[0] = v[0].wrapping_add(v[3]);
+    v[3] = v[3].rotate_left(21) ^ v[0];
+    v[2] = v[2].wrapping_add(v[1]);
+    v[1] = v[1].rotate_left(17) ^ v[2];
+    v[2] = v[2].rotate_left(32);
+}
+
+fn siphash24(key: &TokenHashKey, data: &[u8]) -> u64 {
+    let mut v = [
+        key.k0 ^ 0x736f6d6570736575,
+        key.k1 ^ 0x646f72616e646f6d,
+        key.k0 ^ 0x6c7967656e657261,
+        key.k1 ^ 0x7465646279746573,
+    ];
+    let mut chunks = data.chunks_exact(8);
+    for chunk in &mut chunks {
+        let m = u64::from_le_bytes(chunk.try_into().unwrap());
+        v[3] ^= m;
+        sip_round(&mut v);
+        sip_round(&mut v);
+        v[0] ^= m;
+    }
+    let b = chunks
+        .remainder()
+        .iter()
+        .enumerate()
+        .fold((data.len() as u64) << 56, |b, (i, &byte)| {
+            b | (byte as u64) << (8 * i)
+        });
+    v[3] ^= b;
+    sip_round(&mut v);
+    sip_round(&mut v);
+    v[0] ^= b;
+    v[2] ^= 0xff;
+    for _ in 0..4 {
+        sip_round(&mut v);
+    }
+    v[0] ^ v[1] ^ v[2] ^ v[3]
+}
+
+/// SipHash-2-4 digest of a whole token, the key of the `api_keys_*` maps.
+/// `None` for tokens longer than MAX_TOKEN_LEN, which the filter always denies.
+pub fn token_digest(key: &TokenHashKey, token: &[u8]) -> Option<u64> {
+    if token.len() > MAX_TOKEN_LEN {
+        return None;
+    }
+    Some(siphash24(key, token))
+}
+
+/// `batch` member of `union bpf_attr` (BPF_MAP_UPDATE_BATCH / BPF_MAP_DELETE_BATCH).
+#[repr(C)]
+#[derive(Default)]
+struct BpfMapBatchAttr {
+    in_batch: u64,
+    out_batch: u64,
+    keys: u64,
+    values: u64,
+    count: u32,
+    map_fd: u32,
+    elem_flags: u64,
+    flags: u64,
+}
+
+fn bpf_map_batch(
+    cmd: libc::c_long,
+    fd: RawFd,
+    keys: &[u64],
+    values: Option<&[u8]>,
+) -> io::Result<()> {
+    if keys.is_empty() {
+        return Ok(());
+    }
+    let mut attr = BpfMapBatchAttr {
+        keys: keys.as_ptr() as u64,
+        values: values.map_or(0, |v| v.as_ptr() as u64),
+        count: keys.len() as u32,
+        map_fd: fd as u32,
+        ..Default::default()
+    };
+    // SAFETY: attr points at key/value arrays of `count` elements that outlive the call.
+    let ret = unsafe {
+        libc::syscall(
+            libc::SYS_bpf,
+            cmd,
+            &mut attr as *mut BpfMapBatchAttr,
+            std::mem::size_of::<BpfMapBatchAttr>() as u32,
+        )
+    };
+    if ret < 0 {
+        Err(io::Error::last_os_error())
+    } else {
+        Ok(())
+    }
+}
+
+fn hash_map_fd(map: &Map) -> Result<RawFd> {
+    match map {
+        Map::HashMap(data) => Ok(data.fd().as_fd().as_raw_fd()),
+        _ => Err(anyhow::anyhow!("API key buffer is not a hash map")),
+    }
+}
+
+/// Key buffers and selector, taken out of `Ebpf` so a full resync does not
+/// block stats or rate-limit updates.
+struct ApiKeyMaps {
+    buffers: [Map; 2],
+    selector: Map,
+    /// Key-set generation written to `api_keys_active`; its low bit is the
+    /// live buffer, and connection states of other generations are ignored.
+    generation: u32,
+    capacity: u32,
+    hash_key: TokenHashKey,
+}
+
+impl ApiKeyMaps {
+    fn active(&self) -> usize {
+        (self.generation & 1) as usize
+    }
+
+    /// Publish `generation`, invalidating every cached connection state.
+    fn publish(&mut self, generation: u32) -> Result<()> {
+        let mut selector: Array<_, u32> = Array::try_from(&mut self.selector)?;
+        selector.set(0, generation, 0)?;
+        self.generation = generation;
+        Ok(())
+    }
+
+    fn digest(&self, key: &[u8]) -> Result<u64> {
+        token_digest(&self.hash_key, key).ok_or(anyhow::anyhow!(
+            "API key longer than {} bytes cannot pass the XDP filter",
+            MAX_TOKEN_LEN
+        ))
+    }
+}
+
 pub struct XdpFilter {
     bpf: Arc<Mutex<Ebpf>>,
+    api_keys: Mutex<ApiKeyMaps>,
 }
 
 impl XdpFilter {
-    #[allow(dead_code)] // Experimental XDP implementation for high-performance packet filtering
     pub async fn new(interface: &str, obj_path: &str) -> Result<Self> {
-        let mut bpf = EbpfLoader::new()
+        Self::with_key_capacity(interface, obj_path, DEFAULT_API_KEY_CAPACITY).await
+    }
+
+    /// Load the filter with room for `capacity` API keys in each key buffer.
+    pub async fn with_key_capacity(interface: &str, obj_path: &str, capacity: u32) -> Result<Self> {
+        let mut loader = EbpfLoader::new();
+        for name in API_KEY_BUFFERS {
+            loader.set_max_entries(name, capacity);
+        }
+        let mut bpf = loader
             .load_file(obj_path)
             .context(format!("Failed to load XDP eBPF object file: {}", obj_path))?;
 
+        // fresh digest key per load, set before the program sees any packet
+        let hash_key = TokenHashKey::random();
+        let mut hash_key_map: Array<_, TokenHashKey> = Array::try_from(
+            bpf.map_mut("token_hash_key")
+                .ok_or(anyhow::anyhow!("Failed to get map token_hash_key"))?,
+        )?;
+        hash_key_map.set(0, hash_key, 0)?;
+
         // get XDP program
         let program: &mut aya::programs::Xdp = bpf
             .program_mut("xdp_auth_filter")
@@ -24,50 +279,253 @@ impl XdpFilter {
         // TODO: if the interface has already attached eBPF program, need to detach
         program.load()?;
         program.attach(interface, aya::programs::XdpFlags::default())?;
+
+        let mut take_map = |name: &str| {
+            bpf.take_map(name)
+                .ok_or(anyhow::anyhow!("Failed to get map {}", name))
+        };
+        let api_keys = ApiKeyMaps {
+            buffers: [take_map(API_KEY_BUFFERS[0])?, take_map(API_KEY_BUFFERS[1])?],
+            selector: take_map("api_keys_active")?,
+            generation: 0,
+            capacity,
+            hash_key,
+        };
         Ok(Self {
             bpf: Arc::new(Mutex::new(bpf)),
+            api_keys: Mutex::new(api_keys),
         })
     }
 
     #[allow(dead_code)] // Experimental XDP implementation for high-performance packet filtering
     pub async fn add_api_key(&self, key: &[u8]) -> Result<()> {
-        let mut bpf = self.bpf.lock().await;
-        // corresponding eBPF map key length is 16
-        let mut api_keys: HashMap<_, [u8; 16], u8> = HashMap::try_from(
-            bpf.map_mut("api_keys")
-                .ok_or(anyhow::anyhow!("Failed to get map"))?,
-        )?;
-
-        let mut padded_key = [0u8; 16];
-        let len = key.len().min(16);
-        padded_key[..len].copy_from_slice(&key[..len]);
+        let mut guard = self.api_keys.lock().await;
+        let maps = &mut *guard;
+        let digest = maps.digest(key)?;
+        let active = maps.active();
+        let mut api_keys: HashMap<_, u64, u8> = HashMap::try_from(&mut maps.buffers[active])?;
 
-        api_keys.insert(&padded_key, &1, 0)?;
-        println!("Added API key: {:?}", String::from_utf8_lossy(&padded_key));
+        api_keys.insert(digest, 1, 0)?;
+        // same buffer, new generation: drops DENY states cached for this key
+        maps.publish(maps.generation.wrapping_add(2))?;
+        println!("Added API key digest: {:016x}", digest);
         Ok(())
     }
 
     #[allow(dead_code)] // Experimental XDP implementation for high-performance packet filtering
     pub async fn remove_api_key(&self, key: &[u8]) -> Result<()> {
+        let mut guard = self.api_keys.lock().await;
+        let maps = &mut *guard;
+        let digest = maps.digest(key)?;
+        let active = maps.active();
+        let mut api_keys: HashMap<_, u64, u8> = HashMap::try_from(&mut maps.buffers[active])?;
+
+        api_keys.remove(&digest)?;
+        maps.publish(maps.generation.wrapping_add(2))?;
+        println!("Removed API key digest: {:016x}", digest);
+        Ok(())
+    }
+
+    /// Replace the whole key set: refill the standby buffer with batch
+    /// delete/update, then bump the generation in `api_keys_active` so the
+    /// kernel switches buffers and drops cached connection states in one
+    /// write. Returns the number of distinct keys installed.
+    pub async fn sync_api_keys<I, T>(&self, keys: I) -> Result<usize>
+    where
+        I: IntoIterator<Item = T>,
+        T: AsRef<[u8]>,
+    {
+        let mut guard = self.api_keys.lock().await;
+        let maps = &mut *guard;
+
+        let mut skipped = 0usize;
+        let mut digests: Vec<u64> = keys
+            .into_iter()
+            .filter_map(|key| {
+                let digest = token_digest(&maps.hash_key, key.as_ref());
+                skipped += digest.is_none() as usize;
+                digest
+            })
+            .collect();
+        digests.sort_unstable();
+        digests.dedup();
+        if skipped > 0 {
+            println!(
+                "Skipped {} API keys longer than {} bytes, the XDP filter denies them",
+                skipped, MAX_TOKEN_LEN
+            );
+        }
+        if digests.len() > maps.capacity as usize {
+            return Err(anyhow::anyhow!(
+                "{} API keys exceed XDP key capacity {}",
+                digests.len(),
+                maps.capacity
+            ));
+        }
+
+        let standby = 1 - maps.active();
+        let fd = hash_map_fd(&maps.buffers[standby])?;
+
+        // drop the generation left over from the previous swap
+        let stale: Vec<u64> = {
+            let buffer: HashMap<_, u64, u8> = HashMap::try_from(&maps.buffers[standby])?;
+            buffer.keys().collect::<Result<_, _>>()?
+        };
+        if let Err(e) = bpf_map_batch(BPF_MAP_DELETE_BATCH, fd, &stale, None) {
+            println!("Batch delete unavailable ({}), deleting keys one by one", e);
+            let mut buffer: HashMap<_, u64, u8> = HashMap::try_from(&mut maps.buffers[standby])?;
+            for digest in &stale {
+                let _ = buffer.remove(digest);
+            }
+        }
+
+        let values = vec![1u8; digests.len()];
+        if let Err(e) = bpf_map_batch(BPF_MAP_UPDATE_BATCH, fd, &digests, Some(&values)) {
+            println!(
+                "Batch update unavailable ({}), inserting keys one by one",
+                e
+            );
+            let mut buffer: HashMap<_, u64, u8> = HashMap::try_from(&mut maps.buffers[standby])?;
+            for digest in &digests {
+                buffer.insert(digest, 1, 0)?;
+            }
+        }
+
+        maps.publish(maps.generation.wrapping_add(1))?;
+        println!(
+            "Synced {} API keys into {}",
+            digests.len(),
+            API_KEY_BUFFERS[standby]
+        );
+        Ok(digests.len())
+    }
+
+    /// Load every active token from the `tokens` table and swap it in.
+    pub async fn sync_api_keys_from_db(&self, pool: &Pool<Postgres>) -> Result<usize> {
+        let keys = get_active_api_keys(pool).await?;
+        self.sync_api_keys(&keys).await
+    }
+
+    /// Re-sync the API keys from the `tokens` table every `interval`, so
+    /// new and revoked tokens reach the filter.
+    pub fn spawn_key_sync(self: &Arc<Self>, pool: Arc<Pool<Postgres>>, interval: Duration) {
+        let filter = Arc::clone(self);
+        tokio::spawn(async move {
+            let mut ticker = tokio::time::interval(interval);
+            ticker.tick().await;
+            loop {
+                ticker.tick().await;
+                if let Err(e) = filter.sync_api_keys_from_db(&pool).await {
+                    println!("XDP API key sync failed: {:#}", e);
+                }
+            }
+        });
+    }
+
+    /// Set the per-source token bucket for one address family (IPv4 buckets are
+    /// per /32, IPv6 per /64). Takes effect on the next packet.
+    #[allow(dead_code)] // Experimental XDP implementation for high-performance packet filtering
+    pub async fn set_rate_limit(&self, family: IpFamily, rate_pps: u64, burst: u64) -> Result<()> {
         let mut bpf = self.bpf.lock().await;
-        let mut api_keys: HashMap<_, [u8; 16], u8> = HashMap::try_from(
-            bpf.map_mut("api_keys")
+        let mut config: Array<_, RateLimitConfig> = Array::try_from(
+            bpf.map_mut("rate_limit_config")
+                .ok_or(anyhow::anyhow!("Failed to get map"))?,
+        )?;
+
+        config.set(family as u32, RateLimitConfig { rate_pps, burst }, 0)?;
+        println!(
+            "Set {:?} rate limit: {} pps, burst {}",
+            family, rate_pps, burst
+        );
+        Ok(())
+    }
+
+    /// Read the `xdp_stats` map and sum every counter across CPUs.
+    pub async fn stats(&self) -> Result<XdpStats> {
+        let bpf = self.bpf.lock().await;
+        let stats: PerCpuArray<_, u64> = PerCpuArray::try_from(
+            bpf.map("xdp_stats")
                 .ok_or(anyhow::anyhow!("Failed to get map"))?,
         )?;
 
-        let mut padded_key = [0u8; 16];
-        let len = key.len().min(16);
-        padded_key[..len].copy_from_slice(&key[..len]);
+        let mut slots = [0u64; XDP_STAT_SLOTS];
+        for (index, slot) in slots.iter_mut().enumerate() {
+            let per_cpu = stats.get(&(index as u32), 0)?;
+            *slot = per_cpu.iter().sum();
+        }
+        Ok(XdpStats::from_slots(&slots))
+    }
 
-        api_keys.remove(&padded_key)?;
+    #[allow(dead_code)] // Experimental XDP implementation for high-performance packet filtering
+    pub async fn print_stats(&self) -> Result<()> {
+        let stats = self.stats().await?;
+        println!("XDP Filter Stats:");
+        println!(
+            "{:<12} {:<14} {:<10} {:<10} {:<10} {:<10} {:<10} {:<10} {:<10} {:<10}",
+            "Scanned",
+            "Bytes",
+            "Avg Bytes",
+            "Hits",
+            "Misses",
+            "Cached",
+            "Limited",
+            "Non-IP",
+            "Non-TCP",
+            "Malformed"
+        );
+        println!("{}", "-".repeat(110));
         println!(
-            "Removed API key: {:?}",
-            String::from_utf8_lossy(&padded_key)
+            "{:<12} {:<14} {:<10} {:<10} {:<10} {:<10} {:<10} {:<10} {:<10} {:<10}",
+            stats.packets_scanned,
+            stats.bytes_scanned,
+            stats.avg_scan_bytes(),
+            stats.token_hits,
+            stats.token_misses,
+            stats.verdict_cached,
+            stats.rate_limited,
+            stats.pass_non_ip,
+            stats.pass_non_tcp,
+            stats.pass_malformed
         );
         Ok(())
     }
 }
 
+#[test]
+fn test_xdp_stats_slot_order() {
+    let stats = XdpStats::from_slots(&[10, 2560, 3, 1, 4, 5, 6, 7, 8]);
+    assert_eq!(stats.packets_scanned, 10);
+    assert_eq!(stats.token_hits, 3);
+    assert_eq!(stats.token_misses, 1);
+    assert_eq!(stats.verdict_cached, 7);
+    assert_eq!(stats.rate_limited, 8);
+    assert_eq!(stats.avg_scan_bytes(), 256);
+    assert_eq!(XdpStats::default().avg_scan_bytes(), 0);
+}
+
+#[test]
+fn test_token_digest_matches_siphash24() {
+    // reference vectors from the SipHash paper, key 00..0f
+    let key = TokenHashKey {
+        k0: 0x0706050403020100,
+        k1: 0x0f0e0d0c0b0a0908,
+    };
+    let message: Vec<u8> = (0..15).collect();
+    assert_eq!(token_digest(&key, b""), Some(0x726fdb47dd0e0e31));
+    assert_eq!(token_digest(&key, &message), Some(0xa129ca6149be45e5));
+
+    // the whole token counts, and the digest depends on the key
+    let long = [b'k'; MAX_TOKEN_LEN];
+    let mut other = long;
+    other[MAX_TOKEN_LEN - 1] = b'j';
+    assert_ne!(token_digest(&key, &long), token_digest(&key, &other));
+    assert_ne!(
+        token_digest(&key, &long),
+        token_digest(&TokenHashKey::default(), &long)
+    );
+    assert_eq!(token_digest(&key, &[b'k'; MAX_TOKEN_LEN + 1]), None);
+}
+
 #[tokio::test]
 async fn test_xdp_filter() {
     let xdp_filter = XdpFilter::new("enp5s0", "./gpuf-s/src/xdp/xdp_auth_filter.o")
@@ -81,4 +539,9 @@ async fn test_xdp_filter() {
         .remove_api_key(b"1234567890")
         .await
         .expect("Failed to remove API key");
+    let synced = xdp_filter
+        .sync_api_keys(["1234567890", "abcdef", "1234567890"])
+        .await
+        .expect("Failed to sync API keys");
+    assert_eq!(synced, 2);
 }
@@ -0,0 +1,71 @@
+/*
+ * IPv6 extension header walk shared by the XDP filters.
+ */
+#ifndef GPUF_XDP_IPV6_H
+#define GPUF_XDP_IPV6_H
+
+#include <linux/bpf.h>
+#include <linux/ipv6.h>
+#include <bpf/bpf_helpers.h>
+
+/* IPv6 next-header values we walk over */
+#define NEXTHDR_HOP 0
+#define NEXTHDR_ROUTING 43
+#define NEXTHDR_FRAGMENT 44
+#define NEXTHDR_AUTH 51
+#define NEXTHDR_DEST 60
+#define MAX_IPV6_EXT_HDRS 6
+
+/* IPv6 fragment header (not exported by uapi headers) */
+struct ipv6_frag_hdr {
+    __u8 nexthdr;
+    __u8 reserved;
+    __be16 frag_off;
+    __be32 identification;
+};
+
+/*
+ * Walk a bounded number of IPv6 extension headers. Returns the L4 header
+ * and sets *nexthdr, or NULL if the chain is truncated or the packet is a
+ * non-first fragment (no L4 header to inspect).
+ */
+static __always_inline void *skip_ipv6_ext_hdrs(void *hdr, void *data_end, __u8 *nexthdr) {
+    #pragma unroll
+    for (int i = 0; i < MAX_IPV6_EXT_HDRS; i++) {
+        switch (*nexthdr) {
+        case NEXTHDR_HOP:
+        case NEXTHDR_ROUTING:
+        case NEXTHDR_DEST: {
+            struct ipv6_opt_hdr *opt = hdr;
+            if ((void *)(opt + 1) > data_end)
+                return NULL;
+            *nexthdr = opt->nexthdr;
+            hdr += (opt->hdrlen + 1) * 8;
+            break;
+        }
+        case NEXTHDR_AUTH: {
+            struct ipv6_opt_hdr *opt = hdr;
+            if ((void *)(opt + 1) > data_end)
+                return NULL;
+            *nexthdr = opt->nexthdr;
+            hdr += (opt->hdrlen + 2) * 4;
+            break;
+        }
+        case NEXTHDR_FRAGMENT: {
+            struct ipv6_frag_hdr *frag = hdr;
+            if ((void *)(frag + 1) > data_end)
+                return NULL;
+            if (frag->frag_off & __constant_htons(0xFFF8))
+                return NULL;
+            *nexthdr = frag->nexthdr;
+            hdr += sizeof(*frag);
+            break;
+        }
+        default:
+            return hdr;
+        }
+    }
+    return hdr;
+}
+
+#endif /* GPUF_XDP_IPV6_H */
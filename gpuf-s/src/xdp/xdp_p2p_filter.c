@@ -0,0 +1,207 @@
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <linux/udp.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+#include "xdp_ipv6.h"
+
+/*
+ * Pre-filter for the gpuf-c P2P UDP data plane (handle_udp.rs).
+ * Frames on registered ports are checked for header shape, fragment
+ * metadata, timestamp freshness and banned sources before they reach user
+ * space, and invalid ones are dropped in the driver. Valid frames continue
+ * to the worker's UDP socket, which verifies the HMAC tag and keeps the
+ * per-peer msg_id replay window (P2PReplayWindow).
+ */
+
+#define IPPROTO_UDP 17
+
+/* must match ClientWorker::P2P_UDP_* in handle_udp.rs */
+#define P2P_UDP_VERSION 2
+#define P2P_UDP_FLAG_ACK 0x01
+#define P2P_UDP_MTU_PAYLOAD 1200
+#define P2P_UDP_HEADER_LEN 54
+#define P2P_UDP_FRAGMENT_PAYLOAD (P2P_UDP_MTU_PAYLOAD - P2P_UDP_HEADER_LEN)
+#define P2P_MAX_FRAGMENTS_PER_MESSAGE 128
+/* oldest accepted timestamp; ClientWorker::P2P_REPLAY_WINDOW_SECS */
+#define P2P_MAX_TIMESTAMP_AGE_SECS 300
+#define P2P_FUTURE_SKEW_SECS 30
+
+#define NSEC_PER_SEC 1000000000ULL
+
+#define FAMILY_IPV4 0
+#define FAMILY_IPV6 1
+
+struct p2p_udp_hdr {
+    __u8 magic[4];
+    __u8 version;
+    __u8 flags;
+    __be32 msg_id;
+    __be16 frag_idx;
+    __be16 frag_cnt;
+    __be64 timestamp;
+    __u8 tag[32];
+} __attribute__((packed));
+
+_Static_assert(sizeof(struct p2p_udp_hdr) == P2P_UDP_HEADER_LEN, "P2P header layout");
+
+struct p2p_src {
+    __u32 family;
+    __u32 addr[4];
+};
+
+/* wall clock published by user space, advanced here with the monotonic clock */
+struct p2p_clock {
+    __u64 wall_secs;
+    __u64 mono_ns;
+};
+
+enum p2p_stat {
+    P2P_STAT_PASSED = 0,
+    P2P_STAT_DROP_MALFORMED,
+    P2P_STAT_DROP_STALE,
+    P2P_STAT_DROP_BANNED,
+    P2P_STAT_MAX,
+};
+
+/* UDP ports (host order) bound by P2P data-plane sockets */
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, 64);
+    __type(key, __u16);
+    __type(value, __u8);
+} p2p_ports SEC(".maps");
+
+/* value: CLOCK_MONOTONIC deadline of the ban in ns */
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, 4096);
+    __type(key, struct p2p_src);
+    __type(value, __u64);
+} p2p_banned SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct p2p_clock);
+} p2p_clock SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, P2P_STAT_MAX);
+    __type(key, __u32);
+    __type(value, __u64);
+} p2p_stats SEC(".maps");
+
+static __always_inline int p2p_drop(__u32 idx) {
+    __u64 *v = bpf_map_lookup_elem(&p2p_stats, &idx);
+    if (v)
+        *v += 1;
+    return XDP_DROP;
+}
+
+/*
+ * Timestamp freshness, same rule as ClientWorker::p2p_timestamp_is_fresh;
+ * unknown clock passes. This only bounds the age of a frame: replays inside
+ * that age are caught by the msg_id window in user space.
+ */
+static __always_inline int timestamp_is_fresh(__u64 timestamp) {
+    __u32 zero = 0;
+    struct p2p_clock *clock = bpf_map_lookup_elem(&p2p_clock, &zero);
+    if (!clock || clock->wall_secs == 0)
+        return 1;
+    __u64 now = clock->wall_secs + (bpf_ktime_get_ns() - clock->mono_ns) / NSEC_PER_SEC;
+    if (timestamp > now)
+        return timestamp <= now + P2P_FUTURE_SKEW_SECS;
+    return now - timestamp <= P2P_MAX_TIMESTAMP_AGE_SECS;
+}
+
+SEC("xdp")
+int xdp_p2p_filter(struct xdp_md *ctx) {
+    void *data = (void *)(long)ctx->data;
+    void *data_end = (void *)(long)ctx->data_end;
+
+    struct ethhdr *eth = data;
+    if ((void *)(eth + 1) > data_end)
+        return XDP_PASS;
+
+    struct p2p_src src = {};
+    struct udphdr *udph;
+
+    if (eth->h_proto == __constant_htons(ETH_P_IP)) {
+        struct iphdr *iph = data + sizeof(*eth);
+        if ((void *)(iph + 1) > data_end)
+            return XDP_PASS;
+        if (iph->protocol != IPPROTO_UDP || iph->ihl < 5)
+            return XDP_PASS;
+        if ((void *)iph + iph->ihl * 4 > data_end)
+            return XDP_PASS;
+        src.family = FAMILY_IPV4;
+        src.addr[0] = iph->saddr;
+        udph = (void *)iph + iph->ihl * 4;
+    } else if (eth->h_proto == __constant_htons(ETH_P_IPV6)) {
+        struct ipv6hdr *ip6h = data + sizeof(*eth);
+        if ((void *)(ip6h + 1) > data_end)
+            return XDP_PASS;
+        __u8 nexthdr = ip6h->nexthdr;
+        void *l4 = skip_ipv6_ext_hdrs(ip6h + 1, data_end, &nexthdr);
+        if (!l4 || nexthdr != IPPROTO_UDP)
+            return XDP_PASS;
+        src.family = FAMILY_IPV6;
+        __builtin_memcpy(src.addr, &ip6h->saddr, sizeof(src.addr));
+        udph = l4;
+    } else {
+        return XDP_PASS;
+    }
+
+    if ((void *)(udph + 1) > data_end)
+        return XDP_PASS;
+
+    __u16 port = bpf_ntohs(udph->dest);
+    if (!bpf_map_lookup_elem(&p2p_ports, &port))
+        return XDP_PASS;
+
+    __u64 *banned_until = bpf_map_lookup_elem(&p2p_banned, &src);
+    if (banned_until && *banned_until > bpf_ktime_get_ns())
+        return p2p_drop(P2P_STAT_DROP_BANNED);
+
+    struct p2p_udp_hdr *hdr = (void *)(udph + 1);
+    if ((void *)(hdr + 1) > data_end)
+        return p2p_drop(P2P_STAT_DROP_MALFORMED);
+    if (hdr->magic[0] != 'P' || hdr->magic[1] != '2' || hdr->magic[2] != 'P' ||
+        hdr->magic[3] != 'U' || hdr->version != P2P_UDP_VERSION)
+        return p2p_drop(P2P_STAT_DROP_MALFORMED);
+
+    __u64 payload_len = (__u64)(data_end - (void *)(hdr + 1));
+    __u16 frag_idx = bpf_ntohs(hdr->frag_idx);
+    __u16 frag_cnt = bpf_ntohs(hdr->frag_cnt);
+
+    /* same metadata rules as ClientWorker::p2p_udp_validate_fragment */
+    if (hdr->flags & P2P_UDP_FLAG_ACK) {
+        if (frag_idx != 0 || frag_cnt != 0 || payload_len != 0)
+            return p2p_drop(P2P_STAT_DROP_MALFORMED);
+    } else {
+        if (frag_cnt == 0 || frag_cnt > P2P_MAX_FRAGMENTS_PER_MESSAGE)
+            return p2p_drop(P2P_STAT_DROP_MALFORMED);
+        if (frag_idx >= frag_cnt)
+            return p2p_drop(P2P_STAT_DROP_MALFORMED);
+        /* same cap as P2PUdpReassemblyState::accept_fragment */
+        if (payload_len > P2P_UDP_FRAGMENT_PAYLOAD)
+            return p2p_drop(P2P_STAT_DROP_MALFORMED);
+    }
+
+    if (!timestamp_is_fresh(bpf_be64_to_cpu(hdr->timestamp)))
+        return p2p_drop(P2P_STAT_DROP_STALE);
+
+    __u32 idx = P2P_STAT_PASSED;
+    __u64 *passed = bpf_map_lookup_elem(&p2p_stats, &idx);
+    if (passed)
+        *passed += 1;
+    return XDP_PASS;
+}
+
+char _license[] SEC("license") = "GPL";
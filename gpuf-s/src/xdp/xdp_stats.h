@@ -0,0 +1,43 @@
+/*
+ * Shared per-CPU counters for the XDP filters.
+ * Indices must stay in sync with XDP_STAT_SLOTS and XdpStats::from_slots
+ * in xdp_filter.rs.
+ */
+#ifndef GPUF_XDP_STATS_H
+#define GPUF_XDP_STATS_H
+
+#include <linux/bpf.h>
+#include <bpf/bpf_helpers.h>
+
+enum xdp_stat {
+    STAT_PACKETS_SCANNED = 0,
+    STAT_BYTES_SCANNED,
+    STAT_TOKEN_HIT,
+    STAT_TOKEN_MISS,
+    STAT_PASS_NON_IP,
+    STAT_PASS_NON_TCP,
+    STAT_PASS_MALFORMED,
+    STAT_VERDICT_CACHED,
+    STAT_RATE_LIMITED,
+    STAT_MAX,
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, STAT_MAX);
+    __type(key, __u32);
+    __type(value, __u64);
+} xdp_stats SEC(".maps");
+
+static __always_inline void stat_add(__u32 idx, __u64 n) {
+    __u64 *v = bpf_map_lookup_elem(&xdp_stats, &idx);
+    if (v)
+        *v += n;
+}
+
+static __always_inline int stat_pass(__u32 idx) {
+    stat_add(idx, 1);
+    return XDP_PASS;
+}
+
+#endif /* GPUF_XDP_STATS_H */
@@ -188,6 +188,94 @@ CREATE INDEX IF NOT EXISTS idx_device_daily_stats_date ON device_daily_stats (da
 CREATE INDEX IF NOT EXISTS idx_device_daily_stats_client_id ON device_daily_stats (client_id);
 CREATE INDEX IF NOT EXISTS idx_device_daily_stats_device_index ON device_daily_stats (device_index);
 
+-- Inference performance reported in heartbeats; averages are weighted by requests
+CREATE TABLE IF NOT EXISTS inference_daily_stats (
+    id BIGSERIAL,
+    date DATE NOT NULL,
+    client_id BYTEA NOT NULL,
+    total_requests INTEGER NOT NULL DEFAULT 0,
+    total_prompt_tokens BIGINT NOT NULL DEFAULT 0,
+    total_prompt_tokens_reused BIGINT NOT NULL DEFAULT 0,
+    total_generated_tokens BIGINT NOT NULL DEFAULT 0,
+    avg_tokenize_ms FLOAT,
+    avg_prefill_ms FLOAT,
+    avg_decode_ms FLOAT,
+    avg_ttft_ms FLOAT,
+    avg_decode_tokens_per_sec FLOAT,
+    max_model_load_ms INTEGER NOT NULL DEFAULT 0,
+    max_kv_cells_used INTEGER NOT NULL DEFAULT 0,
+    peak_rss_mb INTEGER NOT NULL DEFAULT 0,
+    last_heartbeat TIMESTAMPTZ NOT NULL DEFAULT NOW(),
+    last_heartbeat_bucket BIGINT NOT NULL DEFAULT 0,
+    created_at TIMESTAMPTZ NOT NULL DEFAULT NOW(),
+    updated_at TIMESTAMPTZ NOT NULL DEFAULT NOW(),
+    PRIMARY KEY (client_id, date)
+);
+
+CREATE INDEX IF NOT EXISTS idx_inference_daily_stats_date ON inference_daily_stats (date);
+
+-- Per-minute (bucket_secs = 60) and per-hour (3600) heartbeat rollups written by
+-- the heartbeat consumer. Sums and counts rather than averages, so partial
+-- flushes of a bucket merge by addition.
+CREATE TABLE IF NOT EXISTS client_heartbeat_rollups (
+    client_id BYTEA NOT NULL,
+    bucket_secs INTEGER NOT NULL,
+    bucket_start TIMESTAMPTZ NOT NULL,
+    heartbeats INTEGER NOT NULL DEFAULT 0,
+    sum_cpu_usage BIGINT NOT NULL DEFAULT 0,
+    sum_memory_usage BIGINT NOT NULL DEFAULT 0,
+    sum_disk_usage BIGINT NOT NULL DEFAULT 0,
+    max_cpu_usage SMALLINT NOT NULL DEFAULT 0,
+    network_in_bytes BIGINT NOT NULL DEFAULT 0,
+    network_out_bytes BIGINT NOT NULL DEFAULT 0,
+    last_heartbeat TIMESTAMPTZ NOT NULL,
+    PRIMARY KEY (client_id, bucket_secs, bucket_start)
+);
+
+CREATE INDEX IF NOT EXISTS idx_client_heartbeat_rollups_bucket
+ON client_heartbeat_rollups (bucket_secs, bucket_start);
+
+CREATE TABLE IF NOT EXISTS device_heartbeat_rollups (
+    client_id BYTEA NOT NULL,
+    device_index SMALLINT NOT NULL,
+    bucket_secs INTEGER NOT NULL,
+    bucket_start TIMESTAMPTZ NOT NULL,
+    heartbeats INTEGER NOT NULL DEFAULT 0,
+    sum_utilization BIGINT NOT NULL DEFAULT 0,
+    sum_temperature BIGINT NOT NULL DEFAULT 0,
+    max_temperature SMALLINT NOT NULL DEFAULT 0,
+    sum_power_usage BIGINT NOT NULL DEFAULT 0,
+    sum_memory_usage BIGINT NOT NULL DEFAULT 0,
+    last_heartbeat TIMESTAMPTZ NOT NULL,
+    PRIMARY KEY (client_id, device_index, bucket_secs, bucket_start)
+);
+
+CREATE INDEX IF NOT EXISTS idx_device_heartbeat_rollups_bucket
+ON device_heartbeat_rollups (bucket_secs, bucket_start);
+
+-- Backfill client rollups from raw heartbeats already stored
+INSERT INTO client_heartbeat_rollups (
+    client_id, bucket_secs, bucket_start, heartbeats,
+    sum_cpu_usage, sum_memory_usage, sum_disk_usage, max_cpu_usage,
+    network_in_bytes, network_out_bytes, last_heartbeat
+)
+SELECT
+    h.client_id,
+    b.secs,
+    to_timestamp(floor(extract(epoch FROM h.timestamp) / b.secs) * b.secs) AS bucket_start,
+    COUNT(*),
+    COALESCE(SUM(h.cpu_usage), 0),
+    COALESCE(SUM(h.mem_usage), 0),
+    COALESCE(SUM(h.disk_usage), 0),
+    COALESCE(MAX(h.cpu_usage), 0),
+    SUM(h.network_down),
+    SUM(h.network_up),
+    MAX(h.timestamp)
+FROM heartbeat h
+CROSS JOIN (VALUES (60), (3600)) AS b (secs)
+GROUP BY h.client_id, b.secs, bucket_start
+ON CONFLICT (client_id, bucket_secs, bucket_start) DO NOTHING;
+
 CREATE TABLE IF NOT EXISTS heartbeat_config_daily (
     date DATE PRIMARY KEY,
     heartbeat_interval_secs INTEGER NOT NULL DEFAULT 120,